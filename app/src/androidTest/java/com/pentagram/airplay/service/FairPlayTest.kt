@@ -95,6 +95,28 @@ class FairPlayTest {
         assertNull("Handshake with 165 bytes should fail", longResult)
     }
 
+    @Test
+    fun testRespondAnswersBothPhases() {
+        fairPlay.init()
+
+        val response = ByteArray(FairPlay.RESPONSE_MAX_LEN)
+        val setupRequest = ByteArray(16)
+        setupRequest[4] = 0x03
+        setupRequest[14] = 0x02
+        assertEquals("fp-setup phase 1 should answer 142 bytes", 142, fairPlay.respond(setupRequest, response))
+        assertEquals("Reply message should carry the requested mode", 0x02, response[13].toInt())
+
+        val handshakeRequest = ByteArray(164) { it.toByte() }
+        handshakeRequest[4] = 0x03
+        assertEquals("fp-setup phase 2 should answer 32 bytes", 32, fairPlay.respond(handshakeRequest, response))
+        assertArrayEquals(handshakeRequest.copyOfRange(144, 164), response.copyOfRange(12, 32))
+
+        setupRequest[14] = 0x04
+        assertEquals("Unknown key mode should be rejected", -1, fairPlay.respond(setupRequest, response))
+        assertEquals("Output shorter than a setup reply should be rejected", -1,
+            fairPlay.respond(handshakeRequest, ByteArray(32)))
+    }
+
     @Test
     fun testDecryptRequires72Bytes() {
         fairPlay.init()
@@ -36,11 +36,20 @@ class AirPlayReceiverActivity : AppCompatActivity() {
             currentInstance?.updateVideoSize(width, height)
         }
 
-        fun finishCurrentActivity() {
+        /**
+         * Close the receiver activity; with a session UUID, only if that session is the one shown,
+         * so one sender ending does not close another's stream. Returns whether it was closed.
+         */
+        fun finishCurrentActivity(sessionUUID: String? = null): Boolean {
+            if (sessionUUID != null && sessionUUID != currentSessionUUID) {
+                Log.i(TAG, "finishCurrentActivity($sessionUUID) ignored - showing $currentSessionUUID")
+                return false
+            }
             Log.i(TAG, "finishCurrentActivity() called - closing receiver activity")
             currentInstance?.runOnUiThread {
                 currentInstance?.finish()
             }
+            return true
         }
     }
 
@@ -1,6 +1,7 @@
 package com.pentagram.airplay.crypto
 
 import android.util.Log
+import java.nio.ByteBuffer
 
 /**
  * JNI wrapper for UxPlay's mirror_buffer video decryption
@@ -72,6 +73,22 @@ class MirrorBufferDecryptor(private val baseKey: ByteArray) {
         return nativeDecrypt(nativeHandle, encryptedData)
     }
 
+    /**
+     * Decrypt the first [length] bytes of a direct buffer in place
+     * (pooled payloads: no copy in, no array out)
+     */
+    fun decryptInPlace(buffer: ByteBuffer, length: Int) {
+        if (!initialized) {
+            throw IllegalStateException("Must call initAes() before decrypt()")
+        }
+        if (nativeHandle == 0L) {
+            throw IllegalStateException("Native handle is invalid")
+        }
+        if (nativeDecryptInPlace(nativeHandle, buffer, length) != 0) {
+            throw IllegalArgumentException("Buffer must be direct and hold $length bytes")
+        }
+    }
+
     fun destroy() {
         if (nativeHandle != 0L) {
             nativeDestroy(nativeHandle)
@@ -89,5 +106,6 @@ class MirrorBufferDecryptor(private val baseKey: ByteArray) {
     private external fun nativeInit(aeskey: ByteArray): Long
     private external fun nativeInitAes(handle: Long, streamConnectionID: Long)
     private external fun nativeDecrypt(handle: Long, input: ByteArray): ByteArray
+    private external fun nativeDecryptInPlace(handle: Long, buffer: ByteBuffer, length: Int): Int
     private external fun nativeDestroy(handle: Long)
 }
@@ -0,0 +1,149 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+import java.nio.ByteBuffer
+
+/**
+ * Native access-unit assembler for the mirror video stream (access_unit.c)
+ *
+ * [assemble] rewrites a decrypted video payload's 4-byte NAL lengths into Annex-B
+ * start codes in place, so the payload buffer holds one complete frame that goes
+ * to the decoder as a single input. The packet header's sender timestamp is mapped
+ * to local System.nanoTime() time for the frame's presentation timestamp. The
+ * results of the last call are read from the properties below. Set [codec] to
+ * [CODEC_HEVC] for an HEVC stream. Access-unit sizes are kept in a histogram that
+ * [inputSize] turns into the decoder's input buffer size, and [copyTo] moves a
+ * finished frame into a codec input buffer with one native copy.
+ */
+class AccessUnitAssembler {
+
+    companion object {
+        private const val TAG = "AccessUnitAssembler"
+
+        // Must match access_unit.h
+        const val FLAG_KEYFRAME = 0x01
+        const val FLAG_PARAMETER_SETS = 0x02
+        const val FLAG_PICTURE = 0x04
+        const val FLAG_TRUNCATED = 0x08
+        const val FLAG_REFERENCE = 0x10
+        const val CODEC_H264 = 0
+        const val CODEC_HEVC = 1
+
+        // Must match access_unit_jni.c
+        private const val OUT_PTS_NS = 0
+        private const val OUT_FLAGS = 1
+        private const val OUT_NAL_COUNT = 2
+        private const val OUT_SPS = 3
+        private const val OUT_PPS = 5
+        private const val OUT_VPS = 7
+        private const val OUT_LEN = 9
+        private const val STATS_LEN = 10
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    class Stats(
+        val units: Long,
+        val keyframes: Long,
+        val nalUnits: Long,
+        val truncated: Long,
+        val dropped: Long,
+        val clockResets: Long,
+        val clockOffsetNs: Long,
+        val maxLength: Int,
+        /** Power-of-two bounds */
+        val p50Length: Int,
+        val p99Length: Int
+    ) {
+        override fun toString(): String =
+            "$units access units ($keyframes key, ${"%.2f".format(if (units == 0L) 0.0 else nalUnits.toDouble() / units)} NALs each), " +
+                "size p50 <= ${p50Length / 1024} KB, p99 <= ${p99Length / 1024} KB, max ${maxLength / 1024} KB, " +
+                "truncated $truncated, dropped $dropped, clock resets $clockResets"
+    }
+
+    private external fun nativeCreate(): Long
+    private external fun nativeSetCodec(handle: Long, codec: Int)
+    private external fun nativeAssemble(handle: Long, buffer: ByteBuffer, length: Int, ntpTimestamp: Long, arrivalNs: Long,
+                                        out: LongArray): Int
+    private external fun nativeCopy(src: ByteBuffer, length: Int, dst: ByteBuffer): Int
+    private external fun nativeInputSize(handle: Long, spsBound: Int): Int
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeDestroy(handle: Long)
+
+    // Read by inputSize from whichever thread creates a decoder
+    @Volatile
+    private var handle: Long = nativeCreate()
+    private val fields = LongArray(OUT_LEN)
+
+    /** Presentation time of the last access unit, System.nanoTime() base */
+    val ptsNs: Long get() = fields[OUT_PTS_NS]
+    val flags: Int get() = fields[OUT_FLAGS].toInt()
+    val nalCount: Int get() = fields[OUT_NAL_COUNT].toInt()
+    val isKeyFrame: Boolean get() = (flags and FLAG_KEYFRAME) != 0
+    val hasPicture: Boolean get() = (flags and FLAG_PICTURE) != 0
+    val hasParameterSets: Boolean get() = (flags and FLAG_PARAMETER_SETS) != 0
+
+    /** SPS / PPS NAL units (no start code) inside the last access unit; length 0 when absent */
+    val spsOffset: Int get() = fields[OUT_SPS].toInt()
+    val spsLength: Int get() = fields[OUT_SPS + 1].toInt()
+    val ppsOffset: Int get() = fields[OUT_PPS].toInt()
+    val ppsLength: Int get() = fields[OUT_PPS + 1].toInt()
+    /** HEVC only */
+    val vpsOffset: Int get() = fields[OUT_VPS].toInt()
+    val vpsLength: Int get() = fields[OUT_VPS + 1].toInt()
+
+    /** [CODEC_H264] or [CODEC_HEVC]: how NAL headers of the following payloads are read */
+    var codec: Int = CODEC_H264
+        set(value) {
+            if (handle != 0L) nativeSetCodec(handle, value)
+            field = value
+        }
+
+    /**
+     * Turn payload[0, length) into one Annex-B access unit in place
+     * @param arrivalNs System.nanoTime() when the packet was queued ([FrameQueue.Frame.enqueueNs]), not when
+     *        it is assembled: queue wait would otherwise pass for network delay in the sender clock mapping
+     * @return access-unit length (bytes after it are dropped garbage), or -1 if nothing was valid
+     */
+    fun assemble(payload: ByteBuffer, length: Int, ntpTimestamp: Long, arrivalNs: Long): Int {
+        if (handle == 0L) return -1
+        return nativeAssemble(handle, payload, length, ntpTimestamp, arrivalNs, fields)
+    }
+
+    /**
+     * Copy the access unit in src[0, length) to the start of a codec input buffer
+     * @return false if dst is smaller or not direct; the caller then copies through the ByteBuffer API
+     */
+    fun copyTo(src: ByteBuffer, length: Int, dst: ByteBuffer): Boolean = nativeCopy(src, length, dst) == length
+
+    /**
+     * KEY_MAX_INPUT_SIZE for a decoder created now: spsBound until a keyframe has been seen, then twice
+     * the largest access unit so far (at least a quarter of spsBound and 256 KB)
+     */
+    fun inputSize(spsBound: Int): Int {
+        val h = handle
+        return if (h != 0L) nativeInputSize(h, spsBound) else spsBound
+    }
+
+    fun stats(): Stats? {
+        if (handle == 0L) return null
+        val values = LongArray(STATS_LEN)
+        nativeGetStats(handle, values)
+        return Stats(values[0], values[1], values[2], values[3], values[4], values[5], values[6], values[7].toInt(),
+            values[8].toInt(), values[9].toInt())
+    }
+
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
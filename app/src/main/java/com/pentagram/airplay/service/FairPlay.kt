@@ -5,12 +5,18 @@ import android.util.Log
 /**
  * FairPlay wrapper using native C implementation from UxPlay
  * Handles decryption of the encrypted AES key (ekey) from SETUP requests
+ *
+ * Each instance owns its own native FairPlay state, so every receiver session
+ * can run fp-setup independently of the others.
  */
 class FairPlay {
 
     companion object {
         private const val TAG = "FairPlay"
 
+        /** Largest fp-setup response body (phase 1 reply message); size of a [respond] output array */
+        const val RESPONSE_MAX_LEN = 142
+
         init {
             try {
                 // Load Conscrypt's native library first to provide BoringSSL symbols
@@ -31,13 +37,17 @@ class FairPlay {
     }
 
     // Native methods
-    private external fun nativeInit(): Int
-    private external fun nativeSetup(request: ByteArray): ByteArray?
-    private external fun nativeHandshake(request: ByteArray): ByteArray?
-    private external fun nativeDecrypt(encryptedKey: ByteArray): ByteArray?
-    private external fun nativeDestroy()
-
-    private var initialized = false
+    private external fun nativeInit(): Long
+    private external fun nativeSetup(handle: Long, request: ByteArray): ByteArray?
+    private external fun nativeHandshake(handle: Long, request: ByteArray): ByteArray?
+    private external fun nativeRespond(handle: Long, request: ByteArray, response: ByteArray): Int
+    private external fun nativeDecrypt(handle: Long, encryptedKey: ByteArray): ByteArray?
+    private external fun nativeDestroy(handle: Long)
+
+    // Native fairplay_t of this instance, 0 until init()
+    private var handle = 0L
+    private val initialized: Boolean
+        get() = handle != 0L
 
     /**
      * Initialize FairPlay
@@ -47,9 +57,8 @@ class FairPlay {
             return true
         }
 
-        val result = nativeInit()
-        if (result == 0) {
-            initialized = true
+        handle = nativeInit()
+        if (handle != 0L) {
             Log.i(TAG, "FairPlay initialized")
             return true
         }
@@ -74,7 +83,7 @@ class FairPlay {
             return null
         }
 
-        val response = nativeSetup(request)
+        val response = nativeSetup(handle, request)
         if (response != null) {
             Log.i(TAG, "FairPlay setup successful (${response.size} bytes)")
         } else {
@@ -100,7 +109,7 @@ class FairPlay {
             return null
         }
 
-        val response = nativeHandshake(request)
+        val response = nativeHandshake(handle, request)
         if (response != null) {
             Log.i(TAG, "FairPlay handshake successful (${response.size} bytes)")
         } else {
@@ -110,6 +119,21 @@ class FairPlay {
         return response
     }
 
+    /**
+     * Answer either fp-setup phase in one native call
+     * Input: raw request body (16-byte setup or 164-byte handshake)
+     * Output: response body written into [response] (at least [RESPONSE_MAX_LEN] bytes, owned by
+     *         the caller's connection); returns its length, or -1 on failure
+     */
+    fun respond(request: ByteArray, response: ByteArray): Int {
+        if (!initialized) {
+            Log.e(TAG, "FairPlay not initialized")
+            return -1
+        }
+
+        return nativeRespond(handle, request, response)
+    }
+
     /**
      * Decrypt the encrypted AES key (ekey) from SETUP request
      * Input: 72-byte RSA-encrypted key
@@ -127,7 +151,7 @@ class FairPlay {
         }
 
         Log.d(TAG, "Decrypting 72-byte ekey to 16-byte AES key...")
-        val aesKey = nativeDecrypt(encryptedKey)
+        val aesKey = nativeDecrypt(handle, encryptedKey)
 
         if (aesKey != null) {
             Log.i(TAG, "✅ FairPlay decrypt successful! Got 16-byte AES key")
@@ -144,8 +168,8 @@ class FairPlay {
      */
     fun destroy() {
         if (initialized) {
-            nativeDestroy()
-            initialized = false
+            nativeDestroy(handle)
+            handle = 0L
             Log.i(TAG, "FairPlay destroyed")
         }
     }
@@ -1,828 +0,0 @@
-package com.pentagram.airplay.service
-
-import kotlin.math.abs
-import kotlin.math.sin
-
-/**
- * FairPlay PlayFair Decryption Implementation
- *
- * This is a complete port of the C implementation from UxPlay's playfair library.
- * Used to decrypt AirPlay's RSA-encrypted AES keys (ekey) from SETUP requests.
- *
- * Note: This cryptographic implementation must be byte-perfect. All lookup tables
- * and bit operations are preserved exactly as in the original C code.
- */
-class FairPlayDecrypt {
-
-    /**
-     * Decrypts a 72-byte RSA-encrypted AES key (ekey) to a 16-byte AES key.
-     *
-     * @param message3 The fp-setup message (mode-specific data)
-     * @param cipherText The 72-byte encrypted key from AirPlay SETUP
-     * @return 16-byte decrypted AES key
-     */
-    fun decrypt(message3: ByteArray, cipherText: ByteArray): ByteArray {
-        require(cipherText.size >= 72) { "CipherText must be at least 72 bytes" }
-
-        val chunk1 = cipherText.copyOfRange(16, 16 + 40)
-        val chunk2 = cipherText.copyOfRange(56, 56 + 16)
-        val blockIn = ByteArray(16)
-        val sapKey = ByteArray(16)
-        val keySchedule = Array(11) { IntArray(4) }
-
-        generateSessionKey(defaultSap, message3, sapKey)
-        generateKeySchedule(sapKey, keySchedule)
-        zXor(chunk2, blockIn, 1)
-        cycle(blockIn, keySchedule)
-
-        val keyOut = ByteArray(16)
-        for (i in 0..15) {
-            keyOut[i] = (blockIn[i].toInt() xor chunk1[i].toInt()).toByte()
-        }
-
-        xXor(keyOut, keyOut, 1)
-        zXor(keyOut, keyOut, 1)
-
-        return keyOut
-    }
-
-    // ============================================================================
-    // XOR Operations with Keys
-    // ============================================================================
-
-    private fun zXor(input: ByteArray, output: ByteArray, blocks: Int) {
-        for (j in 0 until blocks) {
-            for (i in 0..15) {
-                output[j * 16 + i] = (input[j * 16 + i].toInt() xor Z_KEY[i].toInt()).toByte()
-            }
-        }
-    }
-
-    private fun xXor(input: ByteArray, output: ByteArray, blocks: Int) {
-        for (j in 0 until blocks) {
-            for (i in 0..15) {
-                output[j * 16 + i] = (input[j * 16 + i].toInt() xor X_KEY[i].toInt()).toByte()
-            }
-        }
-    }
-
-    private fun tXor(input: ByteArray, output: ByteArray) {
-        for (i in 0..15) {
-            output[i] = (input[i].toInt() xor T_KEY[i].toInt()).toByte()
-        }
-    }
-
-    private fun xorBlocks(a: ByteArray, b: ByteArray, out: ByteArray) {
-        for (i in 0..15) {
-            out[i] = (a[i].toInt() xor b[i].toInt()).toByte()
-        }
-    }
-
-    // ============================================================================
-    // Key Schedule Generation (AES-like with custom S-boxes)
-    // ============================================================================
-
-    private fun tableIndex(i: Int): Int {
-        return ((31 * i) % 0x28) shl 8
-    }
-
-    private fun generateKeySchedule(keyMaterial: ByteArray, keySchedule: Array<IntArray>) {
-        val keyData = IntArray(4)
-        val buffer = ByteArray(16)
-
-        // Initialize key schedule
-        for (i in 0..10) {
-            keySchedule[i][0] = 0xdeadbeef.toInt()
-            keySchedule[i][1] = 0xdeadbeef.toInt()
-            keySchedule[i][2] = 0xdeadbeef.toInt()
-            keySchedule[i][3] = 0xdeadbeef.toInt()
-        }
-
-        var ti = 0
-        tXor(keyMaterial, buffer)
-
-        // Convert buffer to words
-        for (i in 0..3) {
-            keyData[i] = bytesToInt(buffer, i * 4)
-        }
-
-        for (round in 0..10) {
-            // H - set first chunk
-            keySchedule[round][0] = keyData[0]
-
-            // I - S-box transformation
-            val table1Offset = tableIndex(ti)
-            val table2Offset = tableIndex(ti + 1)
-            val table3Offset = tableIndex(ti + 2)
-            val table4Offset = tableIndex(ti + 3)
-            ti += 4
-
-            intToBytes(keyData[0], buffer, 0)
-            intToBytes(keyData[1], buffer, 4)
-            intToBytes(keyData[2], buffer, 8)
-            intToBytes(keyData[3], buffer, 12)
-
-            buffer[0] = (buffer[0].toInt() xor TABLE_S1[table1Offset + (buffer[0x0d].toInt() and 0xFF)].toInt() xor INDEX_MANGLE[round].toInt()).toByte()
-            buffer[1] = (buffer[1].toInt() xor TABLE_S1[table2Offset + (buffer[0x0e].toInt() and 0xFF)].toInt()).toByte()
-            buffer[2] = (buffer[2].toInt() xor TABLE_S1[table3Offset + (buffer[0x0f].toInt() and 0xFF)].toInt()).toByte()
-            buffer[3] = (buffer[3].toInt() xor TABLE_S1[table4Offset + (buffer[0x0c].toInt() and 0xFF)].toInt()).toByte()
-
-            keyData[0] = bytesToInt(buffer, 0)
-            keyData[1] = bytesToInt(buffer, 4)
-            keyData[2] = bytesToInt(buffer, 8)
-            keyData[3] = bytesToInt(buffer, 12)
-
-            // H - set second chunk
-            keySchedule[round][1] = keyData[1]
-
-            // J
-            keyData[1] = keyData[1] xor keyData[0]
-
-            // H - set third chunk
-            keySchedule[round][2] = keyData[2]
-
-            // J
-            keyData[2] = keyData[2] xor keyData[1]
-
-            // K and L
-            keySchedule[round][3] = keyData[3]
-
-            // J again
-            keyData[3] = keyData[3] xor keyData[2]
-        }
-    }
-
-    // ============================================================================
-    // Cycle Function (AES-like with custom T-tables)
-    // ============================================================================
-
-    private fun permuteBlock1(block: ByteArray) {
-        block[0] = TABLE_S3[0x000 + (block[0].toInt() and 0xFF)]
-        block[4] = TABLE_S3[0x400 + (block[4].toInt() and 0xFF)]
-        block[8] = TABLE_S3[0x800 + (block[8].toInt() and 0xFF)]
-        block[12] = TABLE_S3[0xC00 + (block[12].toInt() and 0xFF)]
-
-        var tmp = block[13]
-        block[13] = TABLE_S3[0x100 + (block[9].toInt() and 0xFF)]
-        block[9] = TABLE_S3[0xD00 + (block[5].toInt() and 0xFF)]
-        block[5] = TABLE_S3[0x900 + (block[1].toInt() and 0xFF)]
-        block[1] = TABLE_S3[0x500 + (tmp.toInt() and 0xFF)]
-
-        tmp = block[2]
-        block[2] = TABLE_S3[0xA00 + (block[10].toInt() and 0xFF)]
-        block[10] = TABLE_S3[0x200 + (tmp.toInt() and 0xFF)]
-        tmp = block[6]
-        block[6] = TABLE_S3[0xE00 + (block[14].toInt() and 0xFF)]
-        block[14] = TABLE_S3[0x600 + (tmp.toInt() and 0xFF)]
-
-        tmp = block[3]
-        block[3] = TABLE_S3[0xF00 + (block[7].toInt() and 0xFF)]
-        block[7] = TABLE_S3[0x300 + (block[11].toInt() and 0xFF)]
-        block[11] = TABLE_S3[0x700 + (block[15].toInt() and 0xFF)]
-        block[15] = TABLE_S3[0xB00 + (tmp.toInt() and 0xFF)]
-    }
-
-    private fun permuteTable2(i: Int): Int {
-        return ((71 * i) % 144) shl 8
-    }
-
-    private fun permuteBlock2(block: ByteArray, round: Int) {
-        block[0] = TABLE_S4[permuteTable2(round * 16 + 0) + (block[0].toInt() and 0xFF)]
-        block[4] = TABLE_S4[permuteTable2(round * 16 + 4) + (block[4].toInt() and 0xFF)]
-        block[8] = TABLE_S4[permuteTable2(round * 16 + 8) + (block[8].toInt() and 0xFF)]
-        block[12] = TABLE_S4[permuteTable2(round * 16 + 12) + (block[12].toInt() and 0xFF)]
-
-        var tmp = block[13]
-        block[13] = TABLE_S4[permuteTable2(round * 16 + 13) + (block[9].toInt() and 0xFF)]
-        block[9] = TABLE_S4[permuteTable2(round * 16 + 9) + (block[5].toInt() and 0xFF)]
-        block[5] = TABLE_S4[permuteTable2(round * 16 + 5) + (block[1].toInt() and 0xFF)]
-        block[1] = TABLE_S4[permuteTable2(round * 16 + 1) + (tmp.toInt() and 0xFF)]
-
-        tmp = block[2]
-        block[2] = TABLE_S4[permuteTable2(round * 16 + 2) + (block[10].toInt() and 0xFF)]
-        block[10] = TABLE_S4[permuteTable2(round * 16 + 10) + (tmp.toInt() and 0xFF)]
-        tmp = block[6]
-        block[6] = TABLE_S4[permuteTable2(round * 16 + 6) + (block[14].toInt() and 0xFF)]
-        block[14] = TABLE_S4[permuteTable2(round * 16 + 14) + (tmp.toInt() and 0xFF)]
-
-        tmp = block[3]
-        block[3] = TABLE_S4[permuteTable2(round * 16 + 3) + (block[7].toInt() and 0xFF)]
-        block[7] = TABLE_S4[permuteTable2(round * 16 + 7) + (block[11].toInt() and 0xFF)]
-        block[11] = TABLE_S4[permuteTable2(round * 16 + 11) + (block[15].toInt() and 0xFF)]
-        block[15] = TABLE_S4[permuteTable2(round * 16 + 15) + (tmp.toInt() and 0xFF)]
-    }
-
-    private fun cycle(block: ByteArray, keySchedule: Array<IntArray>) {
-        val bWords = IntArray(4)
-        for (i in 0..3) {
-            bWords[i] = bytesToInt(block, i * 4)
-        }
-
-        bWords[0] = bWords[0] xor keySchedule[10][0]
-        bWords[1] = bWords[1] xor keySchedule[10][1]
-        bWords[2] = bWords[2] xor keySchedule[10][2]
-        bWords[3] = bWords[3] xor keySchedule[10][3]
-
-        for (i in 0..3) {
-            intToBytes(bWords[i], block, i * 4)
-        }
-
-        permuteBlock1(block)
-
-        for (round in 0..8) {
-            val key0 = keySchedule[9 - round][0]
-            val key1 = keySchedule[9 - round][1]
-            val key2 = keySchedule[9 - round][2]
-            val key3 = keySchedule[9 - round][3]
-
-            val key0Bytes = ByteArray(4)
-            val key1Bytes = ByteArray(4)
-            val key2Bytes = ByteArray(4)
-            val key3Bytes = ByteArray(4)
-            intToBytes(key0, key0Bytes, 0)
-            intToBytes(key1, key1Bytes, 0)
-            intToBytes(key2, key2Bytes, 0)
-            intToBytes(key3, key3Bytes, 0)
-
-            val ptr1 = TABLE_S5[(block[3].toInt() and 0xFF) xor (key0Bytes[3].toInt() and 0xFF)]
-            val ptr2 = TABLE_S6[(block[2].toInt() and 0xFF) xor (key0Bytes[2].toInt() and 0xFF)]
-            val ptr3 = TABLE_S8[(block[0].toInt() and 0xFF) xor (key0Bytes[0].toInt() and 0xFF)]
-            val ptr4 = TABLE_S7[(block[1].toInt() and 0xFF) xor (key0Bytes[1].toInt() and 0xFF)]
-
-            bWords[0] = ptr1 xor ptr2 xor ptr3 xor ptr4
-
-            val ptr2_1 = TABLE_S5[(block[7].toInt() and 0xFF) xor (key1Bytes[3].toInt() and 0xFF)]
-            val ptr1_1 = TABLE_S6[(block[6].toInt() and 0xFF) xor (key1Bytes[2].toInt() and 0xFF)]
-            val ptr4_1 = TABLE_S7[(block[5].toInt() and 0xFF) xor (key1Bytes[1].toInt() and 0xFF)]
-            val ptr3_1 = TABLE_S8[(block[4].toInt() and 0xFF) xor (key1Bytes[0].toInt() and 0xFF)]
-
-            bWords[1] = ptr1_1 xor ptr2_1 xor ptr3_1 xor ptr4_1
-
-            bWords[2] = TABLE_S5[(block[11].toInt() and 0xFF) xor (key2Bytes[3].toInt() and 0xFF)] xor
-                        TABLE_S6[(block[10].toInt() and 0xFF) xor (key2Bytes[2].toInt() and 0xFF)] xor
-                        TABLE_S7[(block[9].toInt() and 0xFF) xor (key2Bytes[1].toInt() and 0xFF)] xor
-                        TABLE_S8[(block[8].toInt() and 0xFF) xor (key2Bytes[0].toInt() and 0xFF)]
-
-            bWords[3] = TABLE_S5[(block[15].toInt() and 0xFF) xor (key3Bytes[3].toInt() and 0xFF)] xor
-                        TABLE_S6[(block[14].toInt() and 0xFF) xor (key3Bytes[2].toInt() and 0xFF)] xor
-                        TABLE_S7[(block[13].toInt() and 0xFF) xor (key3Bytes[1].toInt() and 0xFF)] xor
-                        TABLE_S8[(block[12].toInt() and 0xFF) xor (key3Bytes[0].toInt() and 0xFF)]
-
-            for (i in 0..3) {
-                intToBytes(bWords[i], block, i * 4)
-            }
-
-            permuteBlock2(block, 8 - round)
-        }
-
-        for (i in 0..3) {
-            bWords[i] = bytesToInt(block, i * 4)
-        }
-
-        bWords[0] = bWords[0] xor keySchedule[0][0]
-        bWords[1] = bWords[1] xor keySchedule[0][1]
-        bWords[2] = bWords[2] xor keySchedule[0][2]
-        bWords[3] = bWords[3] xor keySchedule[0][3]
-
-        for (i in 0..3) {
-            intToBytes(bWords[i], block, i * 4)
-        }
-    }
-
-    // ============================================================================
-    // Session Key Generation
-    // ============================================================================
-
-    private fun messageTableIndex(i: Int): Int {
-        return (97 * i % 144) shl 8
-    }
-
-    private fun decryptMessage(messageIn: ByteArray, decryptedMessage: ByteArray) {
-        val buffer = ByteArray(16)
-        val keySchedule = Array(11) { IntArray(4) }
-        val mode = messageIn[12].toInt() and 0xFF
-
-        generateKeySchedule(INITIAL_SESSION_KEY, keySchedule)
-
-        for (i in 0..7) {
-            // Copy in the nth block
-            for (j in 0..15) {
-                buffer[j] = when (mode) {
-                    3 -> messageIn[(0x80 - 0x10 * i) + j]
-                    else -> messageIn[(0x10 * (i + 1)) + j]
-                }
-            }
-
-            // Permutation and update 9 times
-            for (j in 0..8) {
-                val base = 0x80 - 0x10 * j
-                val modeKey = MESSAGE_KEY[mode]
-
-                buffer[0x00] = MESSAGE_TABLE[messageTableIndex(base + 0x00) + (buffer[0x00].toInt() and 0xFF)]
-                buffer[0x00] = (buffer[0x00].toInt() xor modeKey[base + 0x00].toInt()).toByte()
-                buffer[0x04] = MESSAGE_TABLE[messageTableIndex(base + 0x04) + (buffer[0x04].toInt() and 0xFF)]
-                buffer[0x04] = (buffer[0x04].toInt() xor modeKey[base + 0x04].toInt()).toByte()
-                buffer[0x08] = MESSAGE_TABLE[messageTableIndex(base + 0x08) + (buffer[0x08].toInt() and 0xFF)]
-                buffer[0x08] = (buffer[0x08].toInt() xor modeKey[base + 0x08].toInt()).toByte()
-                buffer[0x0C] = MESSAGE_TABLE[messageTableIndex(base + 0x0C) + (buffer[0x0C].toInt() and 0xFF)]
-                buffer[0x0C] = (buffer[0x0C].toInt() xor modeKey[base + 0x0C].toInt()).toByte()
-
-                var tmp = buffer[0x0D]
-                buffer[0x0D] = MESSAGE_TABLE[messageTableIndex(base + 0x0D) + (buffer[0x09].toInt() and 0xFF)]
-                buffer[0x0D] = (buffer[0x0D].toInt() xor modeKey[base + 0x0D].toInt()).toByte()
-                buffer[0x09] = MESSAGE_TABLE[messageTableIndex(base + 0x09) + (buffer[0x05].toInt() and 0xFF)]
-                buffer[0x09] = (buffer[0x09].toInt() xor modeKey[base + 0x09].toInt()).toByte()
-                buffer[0x05] = MESSAGE_TABLE[messageTableIndex(base + 0x05) + (buffer[0x01].toInt() and 0xFF)]
-                buffer[0x05] = (buffer[0x05].toInt() xor modeKey[base + 0x05].toInt()).toByte()
-                buffer[0x01] = MESSAGE_TABLE[messageTableIndex(base + 0x01) + (tmp.toInt() and 0xFF)]
-                buffer[0x01] = (buffer[0x01].toInt() xor modeKey[base + 0x01].toInt()).toByte()
-
-                tmp = buffer[0x02]
-                buffer[0x02] = MESSAGE_TABLE[messageTableIndex(base + 0x02) + (buffer[0x0A].toInt() and 0xFF)]
-                buffer[0x02] = (buffer[0x02].toInt() xor modeKey[base + 0x02].toInt()).toByte()
-                buffer[0x0A] = MESSAGE_TABLE[messageTableIndex(base + 0x0A) + (tmp.toInt() and 0xFF)]
-                buffer[0x0A] = (buffer[0x0A].toInt() xor modeKey[base + 0x0A].toInt()).toByte()
-                tmp = buffer[0x06]
-                buffer[0x06] = MESSAGE_TABLE[messageTableIndex(base + 0x06) + (buffer[0x0E].toInt() and 0xFF)]
-                buffer[0x06] = (buffer[0x06].toInt() xor modeKey[base + 0x06].toInt()).toByte()
-                buffer[0x0E] = MESSAGE_TABLE[messageTableIndex(base + 0x0E) + (tmp.toInt() and 0xFF)]
-                buffer[0x0E] = (buffer[0x0E].toInt() xor modeKey[base + 0x0E].toInt()).toByte()
-
-                tmp = buffer[0x03]
-                buffer[0x03] = MESSAGE_TABLE[messageTableIndex(base + 0x03) + (buffer[0x07].toInt() and 0xFF)]
-                buffer[0x03] = (buffer[0x03].toInt() xor modeKey[base + 0x03].toInt()).toByte()
-                buffer[0x07] = MESSAGE_TABLE[messageTableIndex(base + 0x07) + (buffer[0x0B].toInt() and 0xFF)]
-                buffer[0x07] = (buffer[0x07].toInt() xor modeKey[base + 0x07].toInt()).toByte()
-                buffer[0x0B] = MESSAGE_TABLE[messageTableIndex(base + 0x0B) + (buffer[0x0F].toInt() and 0xFF)]
-                buffer[0x0B] = (buffer[0x0B].toInt() xor modeKey[base + 0x0B].toInt()).toByte()
-                buffer[0x0F] = MESSAGE_TABLE[messageTableIndex(base + 0x0F) + (tmp.toInt() and 0xFF)]
-                buffer[0x0F] = (buffer[0x0F].toInt() xor modeKey[base + 0x0F].toInt()).toByte()
-
-                // XOR with table_s9
-                val block = IntArray(4)
-                block[0] = TABLE_S9[0x000 + (buffer[0x00].toInt() and 0xFF)] xor
-                           TABLE_S9[0x100 + (buffer[0x01].toInt() and 0xFF)] xor
-                           TABLE_S9[0x200 + (buffer[0x02].toInt() and 0xFF)] xor
-                           TABLE_S9[0x300 + (buffer[0x03].toInt() and 0xFF)]
-                block[1] = TABLE_S9[0x000 + (buffer[0x04].toInt() and 0xFF)] xor
-                           TABLE_S9[0x100 + (buffer[0x05].toInt() and 0xFF)] xor
-                           TABLE_S9[0x200 + (buffer[0x06].toInt() and 0xFF)] xor
-                           TABLE_S9[0x300 + (buffer[0x07].toInt() and 0xFF)]
-                block[2] = TABLE_S9[0x000 + (buffer[0x08].toInt() and 0xFF)] xor
-                           TABLE_S9[0x100 + (buffer[0x09].toInt() and 0xFF)] xor
-                           TABLE_S9[0x200 + (buffer[0x0A].toInt() and 0xFF)] xor
-                           TABLE_S9[0x300 + (buffer[0x0B].toInt() and 0xFF)]
-                block[3] = TABLE_S9[0x000 + (buffer[0x0C].toInt() and 0xFF)] xor
-                           TABLE_S9[0x100 + (buffer[0x0D].toInt() and 0xFF)] xor
-                           TABLE_S9[0x200 + (buffer[0x0E].toInt() and 0xFF)] xor
-                           TABLE_S9[0x300 + (buffer[0x0F].toInt() and 0xFF)]
-
-                for (k in 0..3) {
-                    intToBytes(block[k], buffer, k * 4)
-                }
-            }
-
-            // Final permutation with table_s10
-            buffer[0x00] = TABLE_S10[(0x0 shl 8) + (buffer[0x00].toInt() and 0xFF)]
-            buffer[0x04] = TABLE_S10[(0x4 shl 8) + (buffer[0x04].toInt() and 0xFF)]
-            buffer[0x08] = TABLE_S10[(0x8 shl 8) + (buffer[0x08].toInt() and 0xFF)]
-            buffer[0x0C] = TABLE_S10[(0xC shl 8) + (buffer[0x0C].toInt() and 0xFF)]
-
-            var tmp = buffer[0x0D]
-            buffer[0x0D] = TABLE_S10[(0xD shl 8) + (buffer[0x09].toInt() and 0xFF)]
-            buffer[0x09] = TABLE_S10[(0x9 shl 8) + (buffer[0x05].toInt() and 0xFF)]
-            buffer[0x05] = TABLE_S10[(0x5 shl 8) + (buffer[0x01].toInt() and 0xFF)]
-            buffer[0x01] = TABLE_S10[(0x1 shl 8) + (tmp.toInt() and 0xFF)]
-
-            tmp = buffer[0x02]
-            buffer[0x02] = TABLE_S10[(0x2 shl 8) + (buffer[0x0A].toInt() and 0xFF)]
-            buffer[0x0A] = TABLE_S10[(0xA shl 8) + (tmp.toInt() and 0xFF)]
-            tmp = buffer[0x06]
-            buffer[0x06] = TABLE_S10[(0x6 shl 8) + (buffer[0x0E].toInt() and 0xFF)]
-            buffer[0x0E] = TABLE_S10[(0xE shl 8) + (tmp.toInt() and 0xFF)]
-
-            tmp = buffer[0x03]
-            buffer[0x03] = TABLE_S10[(0x3 shl 8) + (buffer[0x07].toInt() and 0xFF)]
-            buffer[0x07] = TABLE_S10[(0x7 shl 8) + (buffer[0x0B].toInt() and 0xFF)]
-            buffer[0x0B] = TABLE_S10[(0xB shl 8) + (buffer[0x0F].toInt() and 0xFF)]
-            buffer[0x0F] = TABLE_S10[(0xF shl 8) + (tmp.toInt() and 0xFF)]
-
-            // XOR with previous block
-            when (mode) {
-                2, 1, 0 -> {
-                    if (i > 0) {
-                        xorBlocks(buffer, messageIn.copyOfRange(0x10 * i, 0x10 * i + 16),
-                                 decryptedMessage.copyOfRange(0x10 * i, 0x10 * i + 16))
-                        System.arraycopy(decryptedMessage, 0x10 * i, decryptedMessage, 0x10 * i, 16)
-                    } else {
-                        xorBlocks(buffer, MESSAGE_IV[mode], decryptedMessage.copyOfRange(0x10 * i, 0x10 * i + 16))
-                        System.arraycopy(decryptedMessage, 0x10 * i, decryptedMessage, 0x10 * i, 16)
-                    }
-                }
-                else -> {
-                    if (i < 7) {
-                        val destOffset = 0x70 - 0x10 * i
-                        xorBlocks(buffer, messageIn.copyOfRange(destOffset, destOffset + 16),
-                                 decryptedMessage.copyOfRange(destOffset, destOffset + 16))
-                        System.arraycopy(decryptedMessage, destOffset, decryptedMessage, destOffset, 16)
-                    } else {
-                        val destOffset = 0x70 - 0x10 * i
-                        xorBlocks(buffer, MESSAGE_IV[mode], decryptedMessage.copyOfRange(destOffset, destOffset + 16))
-                        System.arraycopy(decryptedMessage, destOffset, decryptedMessage, destOffset, 16)
-                    }
-                }
-            }
-        }
-    }
-
-    private fun swapBytes(a: Int, b: Int, sessionKey: ByteArray) {
-        val temp = sessionKey[a]
-        sessionKey[a] = sessionKey[b]
-        sessionKey[b] = temp
-    }
-
-    private fun generateSessionKey(oldSap: ByteArray, messageIn: ByteArray, sessionKey: ByteArray) {
-        val decryptedMessage = ByteArray(128)
-        val newSap = ByteArray(320)
-        val md5 = ByteArray(16)
-
-        decryptMessage(messageIn, decryptedMessage)
-
-        // Combine blocks
-        System.arraycopy(STATIC_SOURCE_1, 0, newSap, 0x000, 0x11)
-        System.arraycopy(decryptedMessage, 0, newSap, 0x011, 0x80)
-        System.arraycopy(oldSap, 0x80, newSap, 0x091, 0x80)
-        System.arraycopy(STATIC_SOURCE_2, 0, newSap, 0x111, 0x2F)
-        System.arraycopy(INITIAL_SESSION_KEY, 0, sessionKey, 0, 16)
-
-        for (round in 0..4) {
-            val base = newSap.copyOfRange(round * 64, round * 64 + 64)
-            modifiedMd5(base, sessionKey, md5)
-            sapHash(base, sessionKey)
-
-            val sessionKeyWords = IntArray(4)
-            val md5Words = IntArray(4)
-            for (i in 0..3) {
-                sessionKeyWords[i] = bytesToInt(sessionKey, i * 4)
-                md5Words[i] = bytesToInt(md5, i * 4)
-            }
-
-            for (i in 0..3) {
-                sessionKeyWords[i] = (sessionKeyWords[i] + md5Words[i])
-            }
-
-            for (i in 0..3) {
-                intToBytes(sessionKeyWords[i], sessionKey, i * 4)
-            }
-        }
-
-        // Swap bytes
-        for (i in 0..15 step 4) {
-            swapBytes(i, i + 3, sessionKey)
-            swapBytes(i + 1, i + 2, sessionKey)
-        }
-
-        // XOR with 121
-        for (i in 0..15) {
-            sessionKey[i] = (sessionKey[i].toInt() xor 121).toByte()
-        }
-    }
-
-    // ============================================================================
-    // Modified MD5
-    // ============================================================================
-
-    private val MD5_SHIFT = intArrayOf(
-        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
-        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
-        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
-        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
-    )
-
-    private fun md5F(b: Int, c: Int, d: Int): Int = (b and c) or (b.inv() and d)
-    private fun md5G(b: Int, c: Int, d: Int): Int = (b and d) or (c and d.inv())
-    private fun md5H(b: Int, c: Int, d: Int): Int = b xor c xor d
-    private fun md5I(b: Int, c: Int, d: Int): Int = c xor (b or d.inv())
-
-    private fun rol(input: Int, count: Int): Int {
-        return (input shl count) or (input ushr (32 - count))
-    }
-
-    private fun swap(blockWords: IntArray, a: Int, b: Int) {
-        val temp = blockWords[a]
-        blockWords[a] = blockWords[b]
-        blockWords[b] = temp
-    }
-
-    private fun modifiedMd5(originalBlockIn: ByteArray, keyIn: ByteArray, keyOut: ByteArray) {
-        val blockIn = originalBlockIn.copyOf()
-        val blockWords = IntArray(16)
-        val keyWords = IntArray(4)
-        val outWords = IntArray(4)
-
-        for (i in 0..15) {
-            blockWords[i] = bytesToIntLE(blockIn, i * 4)
-        }
-
-        for (i in 0..3) {
-            keyWords[i] = bytesToInt(keyIn, i * 4)
-        }
-
-        var a = keyWords[0]
-        var b = keyWords[1]
-        var c = keyWords[2]
-        var d = keyWords[3]
-
-        for (i in 0..63) {
-            val j = when {
-                i < 16 -> i
-                i < 32 -> (5 * i + 1) % 16
-                i < 48 -> (3 * i + 5) % 16
-                else -> 7 * i % 16
-            }
-
-            val input = blockWords[j]
-            val constant = (Math.pow(2.0, 32.0) * abs(sin((i + 1).toDouble()))).toLong().toInt()
-            var z = a + input + constant
-
-            z = when {
-                i < 16 -> rol(z + md5F(b, c, d), MD5_SHIFT[i])
-                i < 32 -> rol(z + md5G(b, c, d), MD5_SHIFT[i])
-                i < 48 -> rol(z + md5H(b, c, d), MD5_SHIFT[i])
-                else -> rol(z + md5I(b, c, d), MD5_SHIFT[i])
-            }
-
-            z += b
-            val tmp = d
-            d = c
-            c = b
-            b = z
-            a = tmp
-
-            if (i == 31) {
-                swap(blockWords, a and 15, b and 15)
-                swap(blockWords, (a and (15 shl 4)) shr 4, (b and (15 shl 4)) shr 4)
-                swap(blockWords, (a and (15 shl 8)) shr 8, (b and (15 shl 8)) shr 8)
-                swap(blockWords, (a and (15 shl 12)) shr 12, (b and (15 shl 12)) shr 12)
-            }
-        }
-
-        outWords[0] = keyWords[0] + a
-        outWords[1] = keyWords[1] + b
-        outWords[2] = keyWords[2] + c
-        outWords[3] = keyWords[3] + d
-
-        for (i in 0..3) {
-            intToBytes(outWords[i], keyOut, i * 4)
-        }
-    }
-
-    // ============================================================================
-    // SAP Hash
-    // ============================================================================
-
-    private fun rol8(input: Byte, count: Int): Byte {
-        val i = input.toInt() and 0xFF
-        return (((i shl count) and 0xFF) or (i ushr (8 - count))).toByte()
-    }
-
-    private fun rol8x(input: Byte, count: Int): Int {
-        val i = input.toInt() and 0xFF
-        return (i shl count) or (i ushr (8 - count))
-    }
-
-    private fun sapHash(blockIn: ByteArray, keyOut: ByteArray) {
-        val blockWords = IntArray(16)
-        for (i in 0..15) {
-            blockWords[i] = bytesToInt(blockIn, i * 4)
-        }
-
-        val buffer0 = byteArrayOf(0x96.toByte(), 0x5F, 0xC6.toByte(), 0x53, 0xF8.toByte(), 0x46, 0xCC.toByte(), 0x18,
-                                 0xDF.toByte(), 0xBE.toByte(), 0xB2.toByte(), 0xF8.toByte(), 0x38, 0xD7.toByte(), 0xEC.toByte(), 0x22,
-                                 0x03, 0xD1.toByte(), 0x20, 0x8F.toByte())
-        val buffer1 = ByteArray(210)
-        val buffer2 = byteArrayOf(0x43, 0x54, 0x62, 0x7A, 0x18, 0xC3.toByte(), 0xD6.toByte(), 0xB3.toByte(),
-                                 0x9A.toByte(), 0x56, 0xF6.toByte(), 0x1C, 0x14, 0x3F, 0x0C, 0x1D,
-                                 0x3B, 0x36, 0x83.toByte(), 0xB1.toByte(), 0x39, 0x51, 0x4A, 0xAA.toByte(),
-                                 0x09, 0x3E, 0xFE.toByte(), 0x44, 0xAF.toByte(), 0xDE.toByte(), 0xC3.toByte(), 0x20,
-                                 0x9D.toByte(), 0x42, 0x3A)
-        val buffer3 = ByteArray(132)
-        val buffer4 = byteArrayOf(0xED.toByte(), 0x25, 0xD1.toByte(), 0xBB.toByte(), 0xBC.toByte(), 0x27, 0x9F.toByte(), 0x02,
-                                 0xA2.toByte(), 0xA9.toByte(), 0x11, 0x00, 0x0C, 0xB3.toByte(), 0x52, 0xC0.toByte(),
-                                 0xBD.toByte(), 0xE3.toByte(), 0x1B, 0x49, 0xC7.toByte())
-        val i0Index = intArrayOf(18, 22, 23, 0, 5, 19, 32, 31, 10, 21, 30)
-
-        // Load input into buffer1
-        for (i in 0..209) {
-            val inWord = blockWords[((i % 64) shr 2)]
-            val inByte = (inWord shr ((3 - (i % 4)) shl 3)) and 0xFF
-            buffer1[i] = inByte.toByte()
-        }
-
-        // Scrambling
-        for (i in 0..839) {
-            val x = buffer1[((i - 155) and 0xFFFFFFFF.toInt()) % 210]
-            val y = buffer1[((i - 57) and 0xFFFFFFFF.toInt()) % 210]
-            val z = buffer1[((i - 13) and 0xFFFFFFFF.toInt()) % 210]
-            val w = buffer1[(i and 0xFFFFFFFF.toInt()) % 210]
-            buffer1[i % 210] = ((rol8(y, 5).toInt() and 0xFF) +
-                               (rol8(z, 3).toInt() and 0xFF xor w.toInt() and 0xFF) -
-                               (rol8(x, 7).toInt() and 0xFF) and 0xFF).toByte()
-        }
-
-        // Garble (simplified - full implementation would be very large)
-        // This is a placeholder - full garble implementation from hand_garble.c would go here
-        // For now, we'll skip it as it's ~400 lines of complex bit manipulations
-
-        // Fill output with 0xE1
-        for (i in 0..15) {
-            keyOut[i] = 0xE1.toByte()
-        }
-
-        // Use buffer3
-        for (i in 0..10) {
-            if (i == 3) {
-                keyOut[i] = 0x3D
-            } else {
-                keyOut[i] = ((keyOut[i].toInt() and 0xFF) + (buffer3[i0Index[i] * 4].toInt() and 0xFF) and 0xFF).toByte()
-            }
-        }
-
-        // XOR with buffer0
-        for (i in 0..19) {
-            keyOut[i % 16] = (keyOut[i % 16].toInt() xor buffer0[i].toInt()).toByte()
-        }
-
-        // XOR with buffer2
-        for (i in 0..34) {
-            keyOut[i % 16] = (keyOut[i % 16].toInt() xor buffer2[i].toInt()).toByte()
-        }
-
-        // XOR with buffer1
-        for (i in 0..209) {
-            keyOut[i % 16] = (keyOut[i % 16].toInt() xor buffer1[i].toInt()).toByte()
-        }
-
-        // Reverse scramble
-        for (j in 0..15) {
-            for (i in 0..15) {
-                val x = keyOut[((i - 7) and 0xFFFFFFFF.toInt()) % 16]
-                val y = keyOut[i % 16]
-                val z = keyOut[((i - 37) and 0xFFFFFFFF.toInt()) % 16]
-                val w = keyOut[((i - 177) and 0xFFFFFFFF.toInt()) % 16]
-                keyOut[i] = (rol8(x, 1).toInt() xor y.toInt() xor rol8(z, 6).toInt() xor rol8(w, 5).toInt()).toByte()
-            }
-        }
-    }
-
-    // ============================================================================
-    // Helper Functions
-    // ============================================================================
-
-    private fun bytesToInt(bytes: ByteArray, offset: Int): Int {
-        return ((bytes[offset].toInt() and 0xFF) shl 24) or
-               ((bytes[offset + 1].toInt() and 0xFF) shl 16) or
-               ((bytes[offset + 2].toInt() and 0xFF) shl 8) or
-               (bytes[offset + 3].toInt() and 0xFF)
-    }
-
-    private fun bytesToIntLE(bytes: ByteArray, offset: Int): Int {
-        return (bytes[offset].toInt() and 0xFF) or
-               ((bytes[offset + 1].toInt() and 0xFF) shl 8) or
-               ((bytes[offset + 2].toInt() and 0xFF) shl 16) or
-               ((bytes[offset + 3].toInt() and 0xFF) shl 24)
-    }
-
-    private fun intToBytes(value: Int, bytes: ByteArray, offset: Int) {
-        bytes[offset] = (value shr 24).toByte()
-        bytes[offset + 1] = (value shr 16).toByte()
-        bytes[offset + 2] = (value shr 8).toByte()
-        bytes[offset + 3] = value.toByte()
-    }
-
-    // ============================================================================
-    // Constants and Lookup Tables
-    // ============================================================================
-
-    companion object {
-        // Basic XOR keys
-        private val Z_KEY = byteArrayOf(
-            0x1a, 0x64, 0xf9.toByte(), 0x60, 0x6c, 0xe3.toByte(), 0x01, 0xa9.toByte(),
-            0x54, 0x48, 0x1b, 0xd4.toByte(), 0xab.toByte(), 0x81.toByte(), 0xfc.toByte(), 0xc6.toByte()
-        )
-
-        private val X_KEY = byteArrayOf(
-            0x8e.toByte(), 0xba.toByte(), 0x07, 0xcc.toByte(), 0xb6.toByte(), 0x5a, 0xf6.toByte(), 0x20,
-            0x33, 0xcf.toByte(), 0xf8.toByte(), 0x42, 0xe5.toByte(), 0xd5.toByte(), 0x5a, 0x7d
-        )
-
-        private val T_KEY = byteArrayOf(
-            0xd0.toByte(), 0x04, 0xa9.toByte(), 0x61, 0x6b, 0xa4.toByte(), 0x00, 0x87.toByte(),
-            0x68, 0x8b.toByte(), 0x5f, 0x15, 0x15, 0x35, 0xd9.toByte(), 0xa9.toByte()
-        )
-
-        private val INDEX_MANGLE = byteArrayOf(
-            0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80.toByte(), 0x1B, 0x36, 0x6C
-        )
-
-        private val INITIAL_SESSION_KEY = byteArrayOf(
-            0xDC.toByte(), 0xDC.toByte(), 0xF3.toByte(), 0xB9.toByte(), 0x0B, 0x74, 0xDC.toByte(), 0xFB.toByte(),
-            0x86.toByte(), 0x7F, 0xF7.toByte(), 0x60, 0x16, 0x72, 0x90.toByte(), 0x51
-        )
-
-        private val STATIC_SOURCE_1 = byteArrayOf(
-            0xFA.toByte(), 0x9C.toByte(), 0xAD.toByte(), 0x4D, 0x4B, 0x68, 0x26, 0x8C.toByte(),
-            0x7F, 0xF3.toByte(), 0x88.toByte(), 0x99.toByte(), 0xDE.toByte(), 0x92.toByte(), 0x2E, 0x95.toByte(),
-            0x1E
-        )
-
-        private val STATIC_SOURCE_2 = byteArrayOf(
-            0xEC.toByte(), 0x4E, 0x27, 0x5E, 0xFD.toByte(), 0xF2.toByte(), 0xE8.toByte(), 0x30,
-            0x97.toByte(), 0xAE.toByte(), 0x70, 0xFB.toByte(), 0xE0.toByte(), 0x00, 0x3F, 0x1C,
-            0x39, 0x80.toByte(), 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-        )
-
-        // Default SAP (256 bytes + some extra)
-        private val defaultSap = byteArrayOf(
-            0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79,
-            0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79,
-            0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79,
-            0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79, 0x79,
-            0x79, 0x79, 0x79, 0x79, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x02, 0x53,
-            0x00, 0x01, 0xcc.toByte(), 0x34, 0x2a, 0x5e, 0x5b, 0x1a, 0x67, 0x73, 0xc2.toByte(), 0x0e, 0x21, 0xb8.toByte(), 0x22, 0x4d,
-            0xf8.toByte(), 0x62, 0x48, 0x18, 0x64, 0xef.toByte(), 0x81.toByte(), 0x0a, 0xae.toByte(), 0x2e, 0x37, 0x03, 0xc8.toByte(), 0x81.toByte(), 0x9c.toByte(), 0x23,
-            0x53, 0x9d.toByte(), 0xe5.toByte(), 0xf5.toByte(), 0xd7.toByte(), 0x49, 0xbc.toByte(), 0x5b, 0x7a, 0x26, 0x6c, 0x49, 0x62, 0x83.toByte(), 0xce.toByte(), 0x7f,
-            0x03, 0x93.toByte(), 0x7a, 0xe1.toByte(), 0xf6.toByte(), 0x16, 0xde.toByte(), 0x0c, 0x15, 0xff.toByte(), 0x33, 0x8c.toByte(), 0xca.toByte(), 0xff.toByte(), 0xb0.toByte(), 0x9e.toByte(),
-            0xaa.toByte(), 0xbb.toByte(), 0xe4.toByte(), 0x0f, 0x5d, 0x5f, 0x55, 0x8f.toByte(), 0xb9.toByte(), 0x7f, 0x17, 0x31, 0xf8.toByte(), 0xf7.toByte(), 0xda.toByte(), 0x60,
-            0xa0.toByte(), 0xec.toByte(), 0x65, 0x79, 0xc3.toByte(), 0x3e, 0xa9.toByte(), 0x83.toByte(), 0x12, 0xc3.toByte(), 0xb6.toByte(), 0x71, 0x35, 0xa6.toByte(), 0x69, 0x4f,
-            0xf8.toByte(), 0x23, 0x05, 0xd9.toByte(), 0xba.toByte(), 0x5c, 0x61, 0x5f, 0xa2.toByte(), 0x54, 0xd2.toByte(), 0xb1.toByte(), 0x83.toByte(), 0x45, 0x83.toByte(), 0xce.toByte(),
-            0xe4.toByte(), 0x2d, 0x44, 0x26, 0xc8.toByte(), 0x35, 0xa7.toByte(), 0xa5.toByte(), 0xf6.toByte(), 0xc8.toByte(), 0x42, 0x1c, 0x0d, 0xa3.toByte(), 0xf1.toByte(), 0xc7.toByte(),
-            0x00, 0x50, 0xf2.toByte(), 0xe5.toByte(), 0x17, 0xf8.toByte(), 0xd0.toByte(), 0xfa.toByte(), 0x77, 0x8d.toByte(), 0xfb.toByte(), 0x82.toByte(), 0x8d.toByte(), 0x40, 0xc7.toByte(), 0x8e.toByte(),
-            0x94.toByte(), 0x1e, 0x1e, 0x1e
-        )
-
-        // Message IV and Keys (4 modes)
-        private val MESSAGE_IV = arrayOf(
-            byteArrayOf(0x57, 0x52, 0xF1.toByte(), 0xB7.toByte(), 0x54, 0x9D.toByte(), 0x8F.toByte(), 0x87.toByte(), 0x0C, 0x10, 0x48, 0x5A, 0x60, 0x88.toByte(), 0xCA.toByte(), 0xDB.toByte()),
-            byteArrayOf(0x66, 0x4E, 0x34, 0x8F.toByte(), 0x9B.toByte(), 0x00, 0x43, 0x8C.toByte(), 0x95.toByte(), 0x24, 0xF4.toByte(), 0x00, 0xA1.toByte(), 0x52, 0x92.toByte(), 0xDE.toByte()),
-            byteArrayOf(0x29, 0x46, 0x45, 0xB7.toByte(), 0x45, 0x2E, 0x81.toByte(), 0xF3.toByte(), 0xAB.toByte(), 0x97.toByte(), 0xE3.toByte(), 0x66, 0x9F.toByte(), 0x64, 0x18, 0x58),
-            byteArrayOf(0x74, 0x13, 0x74, 0x74, 0x75, 0x39, 0x0D, 0x39, 0x91.toByte(), 0xB5.toByte(), 0x0C, 0x7D, 0xDB.toByte(), 0x9B.toByte(), 0x4A, 0x34)
-        )
-
-        // NOTE: The following tables are MASSIVE (471KB total in the C code).
-        // Due to size constraints, I'm providing the structure here but the actual data
-        // needs to be extracted from omg_hax.h. For a working implementation, you would need to:
-        // 1. Extract all table data from omg_hax.h
-        // 2. Convert to Kotlin ByteArray/IntArray format
-        // 3. Include all tables: TABLE_S1 through TABLE_S10, MESSAGE_KEY, MESSAGE_TABLE
-
-        // For now, I'll provide empty placeholders that show the correct structure:
-
-        // TABLE_S1: 10240 bytes (40 tables of 256 bytes each)
-        private val TABLE_S1 = ByteArray(10240)
-
-        // TABLE_S2 (MESSAGE_TABLE): 36864 bytes (144 tables of 256 bytes each)
-        private val MESSAGE_TABLE = ByteArray(36864)
-
-        // TABLE_S3: 4096 bytes (16 tables of 256 bytes each)
-        private val TABLE_S3 = ByteArray(4096)
-
-        // TABLE_S4: 36864 bytes (144 tables of 256 bytes each)
-        private val TABLE_S4 = ByteArray(36864)
-
-        // TABLE_S5-S8: T-tables (4 * 256 * 4 bytes = 4096 bytes each)
-        private val TABLE_S5 = IntArray(256)
-        private val TABLE_S6 = IntArray(256)
-        private val TABLE_S7 = IntArray(256)
-        private val TABLE_S8 = IntArray(256)
-
-        // TABLE_S9: 1024 ints (4096 bytes)
-        private val TABLE_S9 = IntArray(1024)
-
-        // TABLE_S10: 4096 bytes (16 tables of 256 bytes each)
-        private val TABLE_S10 = ByteArray(4096)
-
-        // MESSAGE_KEY: 4 modes * 144 bytes each
-        private val MESSAGE_KEY = Array(4) { ByteArray(144) }
-
-        init {
-            // TODO: Initialize all lookup tables from omg_hax.h
-            // This would require parsing and converting ~471KB of C array data
-            // For a complete implementation, you need to:
-            // 1. Read omg_hax.h
-            // 2. Extract each array (message_key, message_iv, table_s1-s10, etc.)
-            // 3. Convert hex values to Kotlin byte/int arrays
-            // 4. Assign to the arrays above
-
-            throw NotImplementedError(
-                "Lookup tables must be initialized from omg_hax.h. " +
-                "Extract table data from /Users/markcipolla/code/UxPlay/lib/playfair/omg_hax.h " +
-                "and populate TABLE_S1 through TABLE_S10, MESSAGE_KEY, and MESSAGE_TABLE."
-            )
-        }
-    }
-}
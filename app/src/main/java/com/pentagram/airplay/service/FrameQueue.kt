@@ -0,0 +1,160 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+import java.nio.ByteBuffer
+import java.util.concurrent.atomic.AtomicReferenceArray
+
+/**
+ * Native single-producer / single-consumer frame queue (frame_queue.c)
+ *
+ * Moves pooled payload buffers from the network reader thread to the decoder
+ * thread without locks: the native ring carries the descriptor and a cookie,
+ * and the ByteBuffer object rides along in a slot array indexed by that cookie.
+ * Exactly one thread may call [push] and one other thread [pop].
+ */
+class FrameQueue(capacity: Int = DEFAULT_CAPACITY) {
+
+    companion object {
+        private const val TAG = "FrameQueue"
+
+        // Must match frame_queue.h
+        const val DEFAULT_CAPACITY = 64
+
+        // Must match frame_queue_jni.c
+        private const val OUT_COOKIE = 0
+        private const val OUT_LENGTH = 1
+        private const val OUT_TYPE = 2
+        private const val OUT_NTP_TIMESTAMP = 3
+        private const val OUT_ENQUEUE_NS = 4
+        private const val OUT_TRACE_ID = 5
+        private const val OUT_LEN = 6
+        private const val STATS_LEN = 7
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    /** A popped frame; the consumer owns [buffer] until it releases it to the pool */
+    class Frame {
+        var buffer: ByteBuffer? = null
+        var length = 0
+        var type = 0
+        var ntpTimestamp = 0L
+        /** CLOCK_MONOTONIC (System.nanoTime()) time of the push */
+        var enqueueNs = 0L
+        /** [FrameTrace] id given at push, 0 when untraced */
+        var traceId = 0
+    }
+
+    class Stats(
+        val pushes: Long,
+        val pops: Long,
+        val producerWaits: Long,
+        val consumerWaits: Long,
+        val wakes: Long,
+        val size: Int,
+        val capacity: Int
+    ) {
+        override fun toString(): String =
+            "$pushes pushed, $pops popped, $size/$capacity queued, " +
+                "reader waited $producerWaits, decoder waited $consumerWaits, $wakes wakes"
+    }
+
+    private external fun nativeCreate(capacity: Int): Long
+    private external fun nativePush(handle: Long, buffer: ByteBuffer, length: Int, type: Int, ntpTimestamp: Long,
+                                    cookie: Long, traceId: Int, timeoutNs: Long): Int
+    private external fun nativePop(handle: Long, timeoutNs: Long, out: LongArray): Int
+    private external fun nativeClose(handle: Long)
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeDestroy(handle: Long)
+
+    private var handle: Long = nativeCreate(capacity)
+
+    // Twice the ring: the producer can only reuse a slot once the consumer has
+    // popped past the cookie that last held it, and the consumer reads the slot
+    // before its next pop
+    private val slots: AtomicReferenceArray<ByteBuffer?>
+    private val slotMask: Int
+    private var nextCookie = 0L
+    private val fields = LongArray(OUT_LEN)
+
+    init {
+        var ringSize = 2
+        while (ringSize < capacity) ringSize = ringSize shl 1
+        slots = AtomicReferenceArray(2 * ringSize)
+        slotMask = 2 * ringSize - 1
+    }
+
+    /**
+     * Producer: hand buffer[0, length) to the consumer
+     * @param timeoutNs wait for room (0: don't wait, < 0: forever)
+     * @param traceId [FrameTrace] id handed to the consumer with the frame
+     * @return false if the queue stayed full or is closed; the buffer is still the caller's
+     */
+    fun push(buffer: ByteBuffer, length: Int, type: Int, ntpTimestamp: Long, timeoutNs: Long = -1,
+             traceId: Int = 0): Boolean {
+        if (handle == 0L) return false
+        val cookie = nextCookie
+        slots.lazySet((cookie and slotMask.toLong()).toInt(), buffer)
+        if (nativePush(handle, buffer, length, type, ntpTimestamp, cookie, traceId, timeoutNs) != 0) {
+            return false
+        }
+        nextCookie++
+        return true
+    }
+
+    /**
+     * Consumer: fill frame with the next descriptor
+     * @param timeoutNs wait for one (0: don't wait, < 0: forever)
+     * @return false on timeout, or once the queue is closed and drained
+     */
+    fun pop(frame: Frame, timeoutNs: Long = -1): Boolean {
+        if (handle == 0L) return false
+        if (nativePop(handle, timeoutNs, fields) != 0) return false
+        val slot = (fields[OUT_COOKIE] and slotMask.toLong()).toInt()
+        frame.buffer = slots.getAndSet(slot, null)
+        frame.length = fields[OUT_LENGTH].toInt()
+        frame.type = fields[OUT_TYPE].toInt()
+        frame.ntpTimestamp = fields[OUT_NTP_TIMESTAMP]
+        frame.enqueueNs = fields[OUT_ENQUEUE_NS]
+        frame.traceId = fields[OUT_TRACE_ID].toInt()
+        return true
+    }
+
+    /** Set once [close] has taken effect, so a consumer polling with a timeout can tell it from an idle queue */
+    @Volatile
+    var isClosed = false
+        private set
+
+    /**
+     * No more pushes; the consumer's [pop] returns false once it has drained the queue.
+     * May come from a thread other than the producer's (a receiver being stopped), hence locked against [release].
+     */
+    @Synchronized
+    fun close() {
+        if (handle != 0L) nativeClose(handle)
+        isClosed = true
+    }
+
+    fun stats(): Stats? {
+        if (handle == 0L) return null
+        val values = LongArray(STATS_LEN)
+        nativeGetStats(handle, values)
+        return Stats(values[0], values[1], values[2], values[3], values[4], values[5].toInt(), values[6].toInt())
+    }
+
+    /** Both threads must be done with the queue */
+    @Synchronized
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
@@ -0,0 +1,166 @@
+package com.pentagram.airplay.service
+
+import android.os.ParcelFileDescriptor
+import android.util.Log
+import java.io.File
+import java.io.IOException
+
+/**
+ * Native per-frame stage timestamps for the mirror video path (frame_trace.c)
+ *
+ * The reader thread [begin]s each video packet when its payload is in and
+ * [mark]s it decrypted; the decoder thread marks dequeue, assembly (with the
+ * capture estimate) and decoder input, matches decoder output by timestamp with
+ * [output], and [end]s the packet when done with it. Stamps go into a lock-free
+ * native ring and, once a frame completes, into one latency histogram per
+ * stage, so [stats] says which stage a latency regression comes from and
+ * [writeChromeTrace] shows the last frames one by one.
+ */
+class FrameTrace {
+
+    companion object {
+        private const val TAG = "FrameTrace"
+
+        // Must match frame_trace.h
+        const val CAPTURE = 0
+        const val ARRIVAL = 1
+        const val DECRYPTED = 2
+        const val DEQUEUED = 3
+        const val ASSEMBLED = 4
+        const val INPUT = 5
+        const val OUTPUT = 6
+        const val STAGES = 7
+        /** Histogram index of capture to decoder output; index s > 0 is stage s - 1 to stage s */
+        const val END_TO_END = 0
+        const val BUCKETS = 96
+
+        val INTERVAL_NAMES = arrayOf("end to end", "network", "decrypt", "queue", "assemble", "decoder input", "decode")
+
+        // Must match frame_trace_jni.c
+        private const val STATS_COUNTERS = 4
+        private const val STATS_PER_HISTOGRAM = 5
+        private const val STATS_LEN = STATS_COUNTERS + STATS_PER_HISTOGRAM * STAGES
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    /** Latency of one stage in ns; percentiles are histogram bucket bounds (within 25%) */
+    class Interval(val name: String, val count: Long, val p50Ns: Long, val p90Ns: Long, val p99Ns: Long,
+                   val maxNs: Long) {
+        override fun toString(): String =
+            "$name p50 ${ms(p50Ns)} p99 ${ms(p99Ns)} max ${ms(maxNs)}"
+
+        private fun ms(ns: Long) = "%.1f ms".format(ns / 1e6)
+    }
+
+    class Stats(
+        val frames: Long,
+        val completed: Long,
+        val decoded: Long,
+        val unmatchedOutputs: Long,
+        /** Indexed like the native histograms: [END_TO_END], then the interval ending at each stage */
+        val intervals: List<Interval>
+    ) {
+        override fun toString(): String =
+            "$decoded/$frames frames decoded: " +
+                intervals.filter { it.count > 0 }.joinToString(", ")
+    }
+
+    private external fun nativeCreate(): Long
+    private external fun nativeBegin(handle: Long, arrivalNs: Long): Int
+    private external fun nativeMark(handle: Long, id: Int, stage: Int, ns: Long)
+    private external fun nativeOutput(handle: Long, ptsUs: Long, ns: Long): Int
+    private external fun nativeEnd(handle: Long, id: Int)
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeGetHistogram(handle: Long, stage: Int, out: LongArray): Int
+    private external fun nativeWriteJson(handle: Long, fd: Int): Int
+    private external fun nativeDestroy(handle: Long)
+
+    // Hot-path calls are lock-free; release only once the reader and decoder threads are done
+    @Volatile
+    private var handle: Long = nativeCreate()
+
+    /** Reader thread: a video payload has been read; returns its id (0 without a native trace) */
+    fun begin(arrivalNs: Long = System.nanoTime()): Int {
+        val h = handle
+        return if (h != 0L) nativeBegin(h, arrivalNs) else 0
+    }
+
+    /** Frame id reached stage at ns */
+    fun mark(id: Int, stage: Int, ns: Long = System.nanoTime()) {
+        val h = handle
+        if (h != 0L && id != 0) nativeMark(h, id, stage, ns)
+    }
+
+    /** Decoder thread: MediaCodec gave back the frame presented at ptsUs */
+    fun output(ptsUs: Long, ns: Long = System.nanoTime()) {
+        val h = handle
+        if (h != 0L) nativeOutput(h, ptsUs, ns)
+    }
+
+    /** Decoder thread: done with the packet; it completes now unless it is inside the decoder */
+    fun end(id: Int) {
+        val h = handle
+        if (h != 0L && id != 0) nativeEnd(h, id)
+    }
+
+    @Synchronized
+    fun stats(): Stats? {
+        val h = handle
+        if (h == 0L) return null
+        val v = LongArray(STATS_LEN)
+        nativeGetStats(h, v)
+        val intervals = (0 until STAGES).map { i ->
+            val o = STATS_COUNTERS + STATS_PER_HISTOGRAM * i
+            Interval(INTERVAL_NAMES[i], v[o], v[o + 1], v[o + 2], v[o + 3], v[o + 4])
+        }
+        return Stats(v[0], v[1], v[2], v[3], intervals)
+    }
+
+    /**
+     * One histogram: bucket counts and their upper bounds in ns
+     * @param stage [END_TO_END], or the stage the interval ends at
+     */
+    @Synchronized
+    fun histogram(stage: Int): Pair<LongArray, LongArray>? {
+        val h = handle
+        if (h == 0L) return null
+        val v = LongArray(2 * BUCKETS)
+        if (nativeGetHistogram(h, stage, v) != 0) return null
+        return Pair(v.copyOfRange(0, BUCKETS), v.copyOfRange(BUCKETS, 2 * BUCKETS))
+    }
+
+    /**
+     * Write the last frames as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+     * @return frames written, -1 on failure
+     */
+    @Synchronized
+    fun writeChromeTrace(file: File): Int {
+        val h = handle
+        if (h == 0L) return -1
+        val fd = try {
+            ParcelFileDescriptor.open(file, ParcelFileDescriptor.MODE_WRITE_ONLY or
+                ParcelFileDescriptor.MODE_CREATE or ParcelFileDescriptor.MODE_TRUNCATE).detachFd()
+        } catch (e: IOException) {
+            Log.e(TAG, "Cannot open $file for the frame trace", e)
+            return -1
+        }
+        return nativeWriteJson(h, fd)
+    }
+
+    /** Once the reader and decoder threads are done with the trace */
+    @Synchronized
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
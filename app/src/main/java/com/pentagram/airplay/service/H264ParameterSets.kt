@@ -0,0 +1,110 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+
+/**
+ * H.264 SPS / PPS decoding (h264_params.c)
+ *
+ * Reads the picture size, profile, level and VUI fields out of the parameter
+ * sets so the decoder is configured with the stream's real size and input
+ * buffer size, and classifies a changed SPS so that only a change the running
+ * decoder cannot absorb restarts it.
+ */
+class H264ParameterSets {
+
+    companion object {
+        private const val TAG = "H264ParameterSets"
+
+        // Must match h264_params.h
+        const val SAME = 0
+        const val RESOLUTION = 1
+        const val INCOMPATIBLE = 2
+
+        // Must match h264_params_jni.c
+        private const val OUT_PROFILE = 0
+        private const val OUT_LEVEL = 1
+        private const val OUT_WIDTH = 2
+        private const val OUT_HEIGHT = 3
+        private const val OUT_CODED_WIDTH = 4
+        private const val OUT_CODED_HEIGHT = 5
+        private const val OUT_CHROMA_FORMAT = 6
+        private const val OUT_BIT_DEPTH = 7
+        private const val OUT_MAX_REF_FRAMES = 8
+        private const val OUT_FRAME_RATE_MILLI = 9
+        private const val OUT_FULL_RANGE = 10
+        private const val OUT_COLOUR_PRIMARIES = 11
+        private const val OUT_TRANSFER = 12
+        private const val OUT_MATRIX = 13
+        private const val OUT_MAX_INPUT_SIZE = 14
+        private const val OUT_MAX_INPUT_SIZE_ROTATED = 15
+        private const val OUT_LEN = 16
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    class Sps(
+        val profile: Int,
+        val level: Int,
+        /** Displayed size, after cropping */
+        val width: Int,
+        val height: Int,
+        /** Macroblock-aligned size */
+        val codedWidth: Int,
+        val codedHeight: Int,
+        val chromaFormat: Int,
+        val bitDepth: Int,
+        val maxRefFrames: Int,
+        /** 0 when the SPS carries no timing info */
+        val frameRate: Float,
+        val fullRange: Boolean,
+        val colourPrimaries: Int,
+        val transfer: Int,
+        val matrix: Int,
+        /** Input buffer bytes for one access unit at the coded size */
+        val maxInputSize: Int,
+        /** Input buffer bytes for a max(width, height) square, which covers a rotation */
+        val maxInputSizeRotated: Int
+    ) {
+        override fun toString(): String =
+            "${width}x$height (coded ${codedWidth}x$codedHeight), profile $profile level $level, " +
+                "chroma $chromaFormat ${bitDepth}-bit, $maxRefFrames refs" +
+                (if (frameRate > 0) ", ${"%.2f".format(frameRate)} fps" else "")
+    }
+
+    private external fun nativeParseSps(nal: ByteArray, out: LongArray): Int
+    private external fun nativeParsePps(nal: ByteArray): Int
+    private external fun nativeCompareSps(current: ByteArray, next: ByteArray): Int
+
+    /**
+     * Decode an SPS NAL unit (no start code); null if it does not decode
+     */
+    fun parseSps(nal: ByteArray): Sps? {
+        val f = LongArray(OUT_LEN)
+        if (nativeParseSps(nal, f) != 0) return null
+        return Sps(
+            f[OUT_PROFILE].toInt(), f[OUT_LEVEL].toInt(),
+            f[OUT_WIDTH].toInt(), f[OUT_HEIGHT].toInt(),
+            f[OUT_CODED_WIDTH].toInt(), f[OUT_CODED_HEIGHT].toInt(),
+            f[OUT_CHROMA_FORMAT].toInt(), f[OUT_BIT_DEPTH].toInt(), f[OUT_MAX_REF_FRAMES].toInt(),
+            f[OUT_FRAME_RATE_MILLI] / 1000f, f[OUT_FULL_RANGE] != 0L,
+            f[OUT_COLOUR_PRIMARIES].toInt(), f[OUT_TRANSFER].toInt(), f[OUT_MATRIX].toInt(),
+            f[OUT_MAX_INPUT_SIZE].toInt(), f[OUT_MAX_INPUT_SIZE_ROTATED].toInt()
+        )
+    }
+
+    /** seq_parameter_set_id the PPS refers to, or -1 if it does not decode */
+    fun parsePps(nal: ByteArray): Int = nativeParsePps(nal)
+
+    /**
+     * [SAME], [RESOLUTION] or [INCOMPATIBLE] for next against current
+     * (INCOMPATIBLE whenever either one does not decode)
+     */
+    fun compareSps(current: ByteArray, next: ByteArray): Int = nativeCompareSps(current, next)
+}
@@ -0,0 +1,104 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+
+/**
+ * HEVC config packet and SPS decoding (hevc_params.c)
+ *
+ * Recognizes an hvcC record in a type 0x01 packet and locates its VPS, SPS and
+ * PPS, and reads an HEVC SPS into the same [H264ParameterSets.Sps] fields the
+ * H.264 path uses to size and reconfigure the decoder.
+ */
+class HevcParameterSets {
+
+    companion object {
+        private const val TAG = "HevcParameterSets"
+
+        // Must match hevc_params.h (same values as H264ParameterSets)
+        const val SAME = 0
+        const val RESOLUTION = 1
+        const val INCOMPATIBLE = 2
+
+        // Must match hevc_params_jni.c
+        private const val CFG_PROFILE = 0
+        private const val CFG_LEVEL = 1
+        private const val CFG_NAL_LENGTH_SIZE = 2
+        private const val CFG_VPS = 3
+        private const val CFG_SPS = 5
+        private const val CFG_PPS = 7
+        private const val CFG_LEN = 9
+        private const val OUT_PROFILE = 0
+        private const val OUT_LEVEL = 1
+        private const val OUT_WIDTH = 2
+        private const val OUT_HEIGHT = 3
+        private const val OUT_CODED_WIDTH = 4
+        private const val OUT_CODED_HEIGHT = 5
+        private const val OUT_CHROMA_FORMAT = 6
+        private const val OUT_BIT_DEPTH = 7
+        private const val OUT_MAX_REF_FRAMES = 8
+        private const val OUT_MAX_INPUT_SIZE = 9
+        private const val OUT_MAX_INPUT_SIZE_ROTATED = 10
+        private const val OUT_LEN = 11
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    /** Parameter sets of an hvcC record (first NAL unit of each type, no start code) */
+    class Config(
+        val profile: Int,
+        val level: Int,
+        val nalLengthSize: Int,
+        val vps: ByteArray?,
+        val sps: ByteArray,
+        val pps: ByteArray
+    )
+
+    private external fun nativeParseConfig(data: ByteArray, length: Int, out: LongArray): Int
+    private external fun nativeParseSps(nal: ByteArray, out: LongArray): Int
+    private external fun nativeCompareSps(current: ByteArray, next: ByteArray): Int
+
+    /**
+     * Decode a type 0x01 payload as hvcC; null if it is not one (avcC, for instance)
+     */
+    fun parseConfig(data: ByteArray, length: Int): Config? {
+        val f = LongArray(CFG_LEN)
+        if (nativeParseConfig(data, length, f) != 0) return null
+
+        fun nal(idx: Int): ByteArray? {
+            val len = f[idx + 1].toInt()
+            return if (len == 0) null else data.copyOfRange(f[idx].toInt(), f[idx].toInt() + len)
+        }
+        return Config(f[CFG_PROFILE].toInt(), f[CFG_LEVEL].toInt(), f[CFG_NAL_LENGTH_SIZE].toInt(),
+            nal(CFG_VPS), nal(CFG_SPS)!!, nal(CFG_PPS)!!)
+    }
+
+    /**
+     * Decode an HEVC SPS NAL unit (no start code); null if it does not decode.
+     * HEVC SPSs are not read as far as the VUI, so frame rate and colour fields are left unspecified.
+     */
+    fun parseSps(nal: ByteArray): H264ParameterSets.Sps? {
+        val f = LongArray(OUT_LEN)
+        if (nativeParseSps(nal, f) != 0) return null
+        return H264ParameterSets.Sps(
+            f[OUT_PROFILE].toInt(), f[OUT_LEVEL].toInt(),
+            f[OUT_WIDTH].toInt(), f[OUT_HEIGHT].toInt(),
+            f[OUT_CODED_WIDTH].toInt(), f[OUT_CODED_HEIGHT].toInt(),
+            f[OUT_CHROMA_FORMAT].toInt(), f[OUT_BIT_DEPTH].toInt(), f[OUT_MAX_REF_FRAMES].toInt(),
+            0f, false, 2, 2, 2,
+            f[OUT_MAX_INPUT_SIZE].toInt(), f[OUT_MAX_INPUT_SIZE_ROTATED].toInt()
+        )
+    }
+
+    /**
+     * [SAME], [RESOLUTION] or [INCOMPATIBLE] for next against current
+     * (INCOMPATIBLE whenever either one does not decode)
+     */
+    fun compareSps(current: ByteArray, next: ByteArray): Int = nativeCompareSps(current, next)
+}
@@ -0,0 +1,104 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+import java.nio.ByteBuffer
+
+/**
+ * Native keyframe cache (keyframe_cache.c)
+ *
+ * Keeps a copy of the latest keyframe access unit and the reference frames after
+ * it, so a decoder created mid-stream (new surface, codec restart) can be brought
+ * to the current picture at once instead of staying black until the sender's next
+ * keyframe. Not thread-safe: the decoder thread adds, clears and replays.
+ */
+class KeyframeCache(maxBytes: Long = DEFAULT_MAX_BYTES, maxFrames: Int = DEFAULT_MAX_FRAMES) {
+
+    companion object {
+        private const val TAG = "KeyframeCache"
+
+        // Must match keyframe_cache.h
+        const val DEFAULT_MAX_BYTES = 8L shl 20
+        const val DEFAULT_MAX_FRAMES = 240
+
+        // Must match keyframe_cache_jni.c
+        private const val STATS_LEN = 13
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    /** Receives replayed access units; [frame] is only valid during the call */
+    fun interface ReplaySink {
+        /** @return false to stop the replay (e.g. no decoder input buffer) */
+        fun onFrame(frame: ByteBuffer, length: Int, flags: Int, ptsUs: Long, decodeOnly: Boolean): Boolean
+    }
+
+    class Stats(
+        val keyframes: Long,
+        val framesCached: Long,
+        val framesSkipped: Long,
+        val overflows: Long,
+        val hits: Long,
+        val misses: Long,
+        val aborted: Long,
+        val framesReplayed: Long,
+        val bytesReplayed: Long,
+        val frames: Int,
+        val bytes: Long,
+        val peakBytes: Long,
+        val maxBytes: Long
+    ) {
+        override fun toString(): String =
+            "$frames frames / ${bytes / 1024} KB cached (peak ${peakBytes / 1024} KB of ${maxBytes / 1024} KB), " +
+                "$keyframes keyframes, $overflows overflows, replays $hits hit / $misses missed / $aborted aborted, " +
+                "$framesReplayed frames (${bytesReplayed / 1024} KB) replayed"
+    }
+
+    private external fun nativeCreate(maxBytes: Long, maxFrames: Int): Long
+    private external fun nativeAdd(handle: Long, buffer: ByteBuffer, length: Int, flags: Int, ptsUs: Long): Int
+    private external fun nativeClear(handle: Long)
+    private external fun nativeReplay(handle: Long, sink: ReplaySink): Int
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeDestroy(handle: Long)
+
+    private var handle: Long = nativeCreate(maxBytes, maxFrames)
+
+    /**
+     * Offer an assembled access unit (buffer[0, length), [AccessUnitAssembler] flags);
+     * only keyframes and the reference frames after them are copied
+     */
+    fun add(buffer: ByteBuffer, length: Int, flags: Int, ptsUs: Long) {
+        if (handle != 0L) nativeAdd(handle, buffer, length, flags, ptsUs)
+    }
+
+    /** Forget the cached frames, e.g. once the decoder can no longer take them */
+    fun clear() {
+        if (handle != 0L) nativeClear(handle)
+    }
+
+    /**
+     * Feed the cached keyframe and reference frames to sink in stream order, all but the last decode-only
+     * @return frames the sink accepted, -1 when nothing is cached
+     */
+    fun replay(sink: ReplaySink): Int = if (handle != 0L) nativeReplay(handle, sink) else -1
+
+    fun stats(): Stats? {
+        if (handle == 0L) return null
+        val v = LongArray(STATS_LEN)
+        nativeGetStats(handle, v)
+        return Stats(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9].toInt(), v[10], v[11], v[12])
+    }
+
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
@@ -0,0 +1,103 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+
+/**
+ * Native decode latency controller for the mirror video stream (latency_controller.c)
+ *
+ * Tracks the frames queued to MediaCodec against their presentation times. When
+ * the oldest frame inside the decoder is more than [budgetNs] behind, [decide]
+ * drops non-reference frames; beyond [skipNs], or after a reference frame found
+ * no input buffer, it drops everything up to the next IDR frame.
+ */
+class LatencyController(budgetNs: Long = DEFAULT_BUDGET_NS, skipNs: Long = DEFAULT_SKIP_NS) {
+
+    companion object {
+        private const val TAG = "LatencyController"
+
+        // Must match latency_controller.h
+        const val DEFAULT_BUDGET_NS = 100_000_000L
+        const val DEFAULT_SKIP_NS = 300_000_000L
+        const val DECODE = 0
+        const val DROP_NON_REFERENCE = 1
+        const val DROP_TO_IDR = 2
+
+        // Must match latency_controller_jni.c
+        private const val STATS_LEN = 9
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    class Stats(
+        val decoded: Long,
+        val droppedNonReference: Long,
+        val droppedToIdr: Long,
+        val skips: Long,
+        val inputsLost: Long,
+        val recoveredNs: Long,
+        val lagNs: Long,
+        val maxLagNs: Long,
+        val decodeNsPerFrame: Long
+    ) {
+        override fun toString(): String =
+            "decoded $decoded, dropped $droppedNonReference non-reference + $droppedToIdr to IDR " +
+                "($skips skips, $inputsLost inputs lost), recovered ${recoveredNs / 1_000_000} ms, " +
+                "lag ${lagNs / 1_000_000} ms (max ${maxLagNs / 1_000_000} ms), " +
+                "decode ${"%.1f".format(decodeNsPerFrame / 1e6)} ms/frame"
+    }
+
+    private external fun nativeCreate(budgetNs: Long, skipNs: Long): Long
+    private external fun nativeDecide(handle: Long, flags: Int, ptsUs: Long): Int
+    private external fun nativeOnInput(handle: Long, queued: Boolean, flags: Int, ptsUs: Long)
+    private external fun nativeOnOutput(handle: Long, ptsUs: Long)
+    private external fun nativeReset(handle: Long)
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeDestroy(handle: Long)
+
+    private var handle: Long = nativeCreate(budgetNs, skipNs)
+
+    /** @param flags [AccessUnitAssembler] flags of the frame; @return [DECODE] or a drop reason */
+    fun decide(flags: Int, presentationTimeUs: Long): Int {
+        if (handle == 0L) return DECODE
+        return nativeDecide(handle, flags, presentationTimeUs)
+    }
+
+    fun onQueued(flags: Int, presentationTimeUs: Long) {
+        if (handle != 0L) nativeOnInput(handle, true, flags, presentationTimeUs)
+    }
+
+    /** The decoder had no input buffer for a frame [decide] let through */
+    fun onInputLost(flags: Int, presentationTimeUs: Long) {
+        if (handle != 0L) nativeOnInput(handle, false, flags, presentationTimeUs)
+    }
+
+    fun onOutput(presentationTimeUs: Long) {
+        if (handle != 0L) nativeOnOutput(handle, presentationTimeUs)
+    }
+
+    /** The codec was recreated: frames queued to the old one never come out */
+    fun reset() {
+        if (handle != 0L) nativeReset(handle)
+    }
+
+    fun stats(): Stats? {
+        if (handle == 0L) return null
+        val values = LongArray(STATS_LEN)
+        nativeGetStats(handle, values)
+        return Stats(values[0], values[1], values[2], values[3], values[4], values[5], values[6], values[7], values[8])
+    }
+
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
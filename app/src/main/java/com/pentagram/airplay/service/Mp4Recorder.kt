@@ -0,0 +1,150 @@
+package com.pentagram.airplay.service
+
+import android.os.ParcelFileDescriptor
+import android.util.Log
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+
+/**
+ * Native fragmented MP4 recorder for the mirror stream (mp4_recorder.c)
+ *
+ * Muxes the decrypted access units into an avc1 / hvc1 track described by the
+ * sender's config packet, timed by the sender's timestamps. [record] hands over
+ * the pooled payload buffer itself: a writer thread writes it to the file with
+ * writev and hands it back through [reclaim], so recording copies nothing and
+ * never waits on storage. When storage falls behind, frames are refused (the
+ * caller keeps the buffer) until the next keyframe. Not thread-safe: the decoder
+ * thread configures, records and reclaims.
+ */
+class Mp4Recorder private constructor(fd: Int, maxBacklogBytes: Long) {
+
+    companion object {
+        private const val TAG = "Mp4Recorder"
+
+        // Must match mp4_recorder.h
+        const val DEFAULT_MAX_BACKLOG = 16L shl 20
+        const val MAX_FRAMES = 512
+
+        // Must match mp4_recorder_jni.c
+        private const val STATS_LEN = 15
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+
+        /** Record into file (created or truncated); null if it cannot be opened */
+        fun open(file: File, maxBacklogBytes: Long = DEFAULT_MAX_BACKLOG): Mp4Recorder? {
+            val fd = try {
+                ParcelFileDescriptor.open(file, ParcelFileDescriptor.MODE_WRITE_ONLY or
+                    ParcelFileDescriptor.MODE_CREATE or ParcelFileDescriptor.MODE_TRUNCATE).detachFd()
+            } catch (e: IOException) {
+                Log.e(TAG, "Cannot open $file for recording", e)
+                return null
+            }
+            val recorder = Mp4Recorder(fd, maxBacklogBytes)
+            return if (recorder.handle != 0L) recorder else null
+        }
+    }
+
+    class Stats(
+        val frames: Long,
+        val droppedBacklog: Long,
+        val droppedWaiting: Long,
+        val configs: Long,
+        val samples: Long,
+        val fragments: Long,
+        val bytesWritten: Long,
+        val configChanges: Long,
+        val writeErrors: Long,
+        val writeNs: Long,
+        val maxWriteNs: Long,
+        val backlogBytes: Long,
+        val backlogHighWater: Long,
+        val maxBacklog: Long,
+        val failed: Boolean
+    ) {
+        override fun toString(): String =
+            "$samples samples in $fragments fragments (${bytesWritten / 1024} KB), " +
+                "dropped $droppedBacklog (backlog) / $droppedWaiting (waiting for keyframe), " +
+                "backlog ${backlogBytes / 1024} KB (high water ${backlogHighWater / 1024} KB of ${maxBacklog / 1024} KB), " +
+                "longest write ${maxWriteNs / 1_000_000} ms, $configChanges config changes" +
+                if (failed) ", stopped after $writeErrors write errors or a codec change" else ""
+    }
+
+    private external fun nativeCreate(fd: Int, maxBacklog: Long): Long
+    private external fun nativeConfig(handle: Long, data: ByteArray, length: Int): Int
+    private external fun nativeFrame(handle: Long, buffer: ByteBuffer, length: Int, flags: Int, ntpTimestamp: Long,
+                                     cookie: Long): Int
+    private external fun nativeReclaim(handle: Long): Long
+    private external fun nativeStop(handle: Long): Int
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeDestroy(handle: Long)
+
+    private var handle: Long = nativeCreate(fd, maxBacklogBytes)
+
+    // Buffers come back in the order they were taken and at most MAX_FRAMES are held,
+    // so the cookie's low bits index a ring
+    private val slots = arrayOfNulls<ByteBuffer>(MAX_FRAMES)
+    private var nextCookie = 0L
+
+    /** Type 0x01 payload (avcC or hvcC); the first one starts the file, later ones go in-band */
+    fun config(data: ByteArray, length: Int): Boolean = handle != 0L && nativeConfig(handle, data, length) == 0
+
+    /**
+     * Offer an assembled access unit (buffer[0, length), [AccessUnitAssembler] flags)
+     * @return true when the recorder took buffer; it comes back through [reclaim]. False: still the caller's
+     */
+    fun record(buffer: ByteBuffer, length: Int, flags: Int, ntpTimestamp: Long): Boolean {
+        if (handle == 0L) return false
+        val cookie = nextCookie
+        if (nativeFrame(handle, buffer, length, flags, ntpTimestamp, cookie) != 1) return false
+        slots[(cookie % MAX_FRAMES).toInt()] = buffer
+        nextCookie++
+        return true
+    }
+
+    /** Hand every buffer the writer is done with to release */
+    fun reclaim(release: (ByteBuffer) -> Unit) {
+        if (handle == 0L) return
+        while (true) {
+            val cookie = nativeReclaim(handle)
+            if (cookie < 0) return
+            val slot = (cookie % MAX_FRAMES).toInt()
+            slots[slot]?.let(release)
+            slots[slot] = null
+        }
+    }
+
+    /**
+     * Write what is queued and close the file (waits for storage), then hand every held buffer to release
+     * @return false if a write failed
+     */
+    fun stop(release: (ByteBuffer) -> Unit): Boolean {
+        if (handle == 0L) return false
+        val ok = nativeStop(handle) == 0
+        reclaim(release)
+        return ok
+    }
+
+    fun stats(): Stats? {
+        if (handle == 0L) return null
+        val v = LongArray(STATS_LEN)
+        nativeGetStats(handle, v)
+        return Stats(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11], v[12], v[13],
+            v[14] != 0L)
+    }
+
+    /** After [stop]; buffers not reclaimed by then are forgotten */
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
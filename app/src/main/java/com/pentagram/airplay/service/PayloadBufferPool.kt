@@ -0,0 +1,134 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+import java.nio.ByteBuffer
+
+/**
+ * Native size-classed pool for mirror packet payloads (buffer_pool.c)
+ *
+ * Buffers come from power-of-two classes of 16 KB through 4 MB and are recycled
+ * on [release], so payloads of any size are served without allocating once the
+ * stream has warmed up. Payloads above 4 MB are allocated exactly and freed on
+ * release. [destroy] may race with a buffer still being decoded: the native pool
+ * is freed when the last outstanding buffer comes back.
+ */
+class PayloadBufferPool(maxCachedBytes: Long = DEFAULT_MAX_CACHED_BYTES) {
+
+    companion object {
+        private const val TAG = "PayloadBufferPool"
+
+        // Enough to keep a 4 MB IDR plus the usual spread of smaller frames cached
+        const val DEFAULT_MAX_CACHED_BYTES = 16L * 1024 * 1024
+
+        // Must match buffer_pool.h / buffer_pool_jni.c
+        const val MIN_CLASS_SIZE = 16 * 1024
+        const val CLASS_COUNT = 9
+        private const val STATS_PER_CLASS = 5
+        private const val STATS_TOTALS = STATS_PER_CLASS * CLASS_COUNT
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    class ClassStats(
+        val size: Int,
+        val acquires: Long,
+        val hits: Long,
+        val inUse: Int,
+        val inUseHighWater: Int,
+        val cached: Int
+    )
+
+    class Stats(
+        val classes: List<ClassStats>,
+        val oversizeAcquires: Long,
+        val bytesInUse: Long,
+        val bytesInUseHighWater: Long,
+        val bytesCached: Long,
+        val largestRequest: Long
+    ) {
+        /** Fraction of pooled acquires served without allocating */
+        val hitRate: Double
+            get() {
+                val acquires = classes.sumOf { it.acquires } + oversizeAcquires
+                return if (acquires == 0L) 0.0 else classes.sumOf { it.hits }.toDouble() / acquires
+            }
+
+        override fun toString(): String =
+            "hit rate ${"%.1f".format(hitRate * 100)}%, in use high water ${bytesInUseHighWater / 1024} KB, " +
+                "cached ${bytesCached / 1024} KB, largest ${largestRequest / 1024} KB, oversize $oversizeAcquires"
+    }
+
+    private external fun nativeCreate(maxCachedBytes: Long): Long
+    private external fun nativeAcquire(handle: Long, size: Int): ByteBuffer?
+    private external fun nativeRelease(handle: Long, buffer: ByteBuffer)
+    private external fun nativeGetStats(handle: Long, out: LongArray)
+    private external fun nativeTrim(handle: Long)
+    private external fun nativeDestroy(handle: Long)
+
+    private var handle: Long = nativeCreate(maxCachedBytes)
+    private var outstanding = 0
+    private var destroyed = false
+
+    /**
+     * Direct buffer with room for size bytes (limit = size), or null if the pool is gone
+     */
+    @Synchronized
+    fun acquire(size: Int): ByteBuffer? {
+        if (destroyed || handle == 0L) return null
+        val buffer = nativeAcquire(handle, size) ?: return null
+        outstanding++
+        buffer.limit(size)
+        return buffer
+    }
+
+    @Synchronized
+    fun release(buffer: ByteBuffer) {
+        if (handle == 0L) return
+        nativeRelease(handle, buffer)
+        outstanding--
+        if (destroyed && outstanding == 0) {
+            freeNative()
+        }
+    }
+
+    @Synchronized
+    fun stats(): Stats? {
+        if (handle == 0L) return null
+        val values = LongArray(STATS_TOTALS + 5)
+        nativeGetStats(handle, values)
+        val classes = (0 until CLASS_COUNT).map { i ->
+            val c = STATS_PER_CLASS * i
+            ClassStats(MIN_CLASS_SIZE shl i, values[c], values[c + 1], values[c + 2].toInt(),
+                values[c + 3].toInt(), values[c + 4].toInt())
+        }
+        return Stats(classes, values[STATS_TOTALS], values[STATS_TOTALS + 1], values[STATS_TOTALS + 2],
+            values[STATS_TOTALS + 3], values[STATS_TOTALS + 4])
+    }
+
+    @Synchronized
+    fun trim() {
+        if (handle != 0L) nativeTrim(handle)
+    }
+
+    @Synchronized
+    fun destroy() {
+        destroyed = true
+        if (outstanding == 0) {
+            freeNative()
+        }
+    }
+
+    private fun freeNative() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+}
@@ -0,0 +1,106 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+
+/**
+ * Incremental RTSP/HTTP request parser backed by native rtsp_parser_t
+ *
+ * The control connection reads into one receive buffer; [parse] is called with
+ * everything received so far for the pending request and resumes where the
+ * previous call stopped, so headers are scanned once no matter how the request
+ * was split across reads. Field positions come back as offsets into that buffer,
+ * strings are only built for the fields the handlers actually use.
+ */
+class RtspRequestParser {
+
+    companion object {
+        private const val TAG = "RtspRequestParser"
+
+        // Must match rtsp_parser_jni.c / RTSP_MAX_HEADERS
+        private const val MAX_HEADERS = 32
+        private const val OUT_METHOD = 0
+        private const val OUT_PATH = 2
+        private const val OUT_BODY = 6
+        private const val OUT_HEADER_COUNT = 8
+        private const val OUT_HEADERS = 9
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    /**
+     * One parsed request; body is copied out since handlers keep it past the next read
+     */
+    class Request(
+        val method: String,
+        val path: String,
+        val headers: Map<String, String>,
+        val body: ByteArray
+    )
+
+    private external fun nativeCreate(): Long
+    private external fun nativeParse(handle: Long, buf: ByteArray, start: Int, len: Int, out: IntArray): Int
+    private external fun nativeKeepalive(handle: Long, buf: ByteArray, start: Int, len: Int, fd: Int): Int
+    private external fun nativeReset(handle: Long)
+    private external fun nativeDestroy(handle: Long)
+
+    private var handle: Long = nativeCreate()
+    private val fields = IntArray(OUT_HEADERS + 4 * MAX_HEADERS)
+
+    /**
+     * Request length once buf[start, start + len) holds a complete request (read it
+     * with [request]), 0 if more data is needed, -1 if the request is malformed
+     */
+    fun parse(buf: ByteArray, start: Int, len: Int): Int {
+        if (handle == 0L) return -1
+        return nativeParse(handle, buf, start, len, fields)
+    }
+
+    /**
+     * Answer buf[start, start + len) natively when it is a /feedback or GET_PARAMETER
+     * keepalive, writing the reply straight to the socket fd. Returns the request length
+     * when it was answered, 0 if the request needs [parse], -1 if the write failed
+     */
+    fun answerKeepalive(buf: ByteArray, start: Int, len: Int, fd: Int): Int {
+        if (handle == 0L) return 0
+        return nativeKeepalive(handle, buf, start, len, fd)
+    }
+
+    /**
+     * Materialize the request found by the last successful [parse] on the same buf
+     */
+    fun request(buf: ByteArray): Request {
+        val headerCount = fields[OUT_HEADER_COUNT]
+        val headers = HashMap<String, String>(headerCount * 2)
+        for (i in 0 until headerCount) {
+            val h = OUT_HEADERS + 4 * i
+            headers[ascii(buf, fields[h], fields[h + 1]).lowercase()] = ascii(buf, fields[h + 2], fields[h + 3])
+        }
+        val bodyOff = fields[OUT_BODY]
+        return Request(
+            ascii(buf, fields[OUT_METHOD], fields[OUT_METHOD + 1]),
+            ascii(buf, fields[OUT_PATH], fields[OUT_PATH + 1]),
+            headers,
+            buf.copyOfRange(bodyOff, bodyOff + fields[OUT_BODY + 1])
+        )
+    }
+
+    fun reset() {
+        if (handle != 0L) nativeReset(handle)
+    }
+
+    fun release() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+
+    private fun ascii(buf: ByteArray, off: Int, len: Int) = String(buf, off, len, Charsets.ISO_8859_1)
+}
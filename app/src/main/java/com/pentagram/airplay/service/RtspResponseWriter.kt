@@ -0,0 +1,134 @@
+package com.pentagram.airplay.service
+
+import java.io.OutputStream
+
+/**
+ * RTSP/HTTP response serializer for one control connection
+ *
+ * The status line and headers are written byte by byte into one buffer that is
+ * reused for every response on the connection: the fixed headers are encoded
+ * once, and CSeq, Content-Type, the status text and Content-Length are copied in
+ * without building strings. The body is appended after the headers, so the
+ * socket stream gets a single write per response (one send, and no window for
+ * Nagle to hold the body back). The buffer only grows, to the largest response
+ * seen so far.
+ *
+ * Strings are encoded as ISO-8859-1, like the String.toByteArray(ISO_8859_1)
+ * calls this replaces: characters outside Latin-1 become '?'.
+ */
+class RtspResponseWriter(private val output: OutputStream) {
+
+    companion object {
+        private const val INITIAL_CAPACITY = 2048
+
+        private val STATUS_PREFIX = latin1("RTSP/1.0 ")
+        private val SERVER = latin1("Server: AirTunes/220.68\r\n")
+        private val CSEQ = latin1("CSeq: ")
+        private val CONTENT_TYPE = latin1("Content-Type: ")
+        private val CONTENT_LENGTH = latin1("Content-Length: ")
+        private val TRAILER = latin1("Audio-Jack-Status: connected\r\n\r\n")
+
+        private fun latin1(s: String) = s.toByteArray(Charsets.ISO_8859_1)
+    }
+
+    private var buf = ByteArray(INITIAL_CAPACITY)
+    private var pos = 0
+
+    /**
+     * Write one response: headers plus body[0, bodyLength)
+     */
+    fun send(statusCode: Int, statusText: String, contentType: String, cseq: String?, body: ByteArray, bodyLength: Int) {
+        writeHead(statusCode, statusText, contentType, cseq, bodyLength)
+        ensureCapacity(bodyLength)
+        System.arraycopy(body, 0, buf, pos, bodyLength)
+        pos += bodyLength
+        flush()
+    }
+
+    /**
+     * Write one response with a text body
+     */
+    fun send(statusCode: Int, statusText: String, contentType: String, cseq: String?, body: String) {
+        if (body.any { it.code > 0xFF }) {
+            // Rare (error messages): let the encoder decide how many '?' a surrogate pair becomes
+            val bytes = latin1(body)
+            send(statusCode, statusText, contentType, cseq, bytes, bytes.size)
+            return
+        }
+        writeHead(statusCode, statusText, contentType, cseq, body.length)
+        ensureCapacity(body.length)
+        writeLatin1(body)
+        flush()
+    }
+
+    private fun writeHead(statusCode: Int, statusText: String, contentType: String, cseq: String?, bodyLength: Int) {
+        pos = 0
+        ensureCapacity(
+            STATUS_PREFIX.size + 12 + statusText.length + SERVER.size + CSEQ.size + (cseq?.length ?: 0) +
+                CONTENT_TYPE.size + contentType.length + CONTENT_LENGTH.size + 12 + TRAILER.size + 8
+        )
+        writeBytes(STATUS_PREFIX)
+        writeInt(statusCode)
+        buf[pos++] = ' '.code.toByte()
+        writeLatin1(statusText)
+        writeCrlf()
+        writeBytes(SERVER)
+        if (cseq != null) {
+            writeBytes(CSEQ)
+            writeLatin1(cseq)
+            writeCrlf()
+        }
+        if (contentType.isNotEmpty()) {
+            writeBytes(CONTENT_TYPE)
+            writeLatin1(contentType)
+            writeCrlf()
+        }
+        if (bodyLength > 0) {
+            writeBytes(CONTENT_LENGTH)
+            writeInt(bodyLength)
+            writeCrlf()
+        }
+        writeBytes(TRAILER)
+    }
+
+    private fun flush() {
+        output.write(buf, 0, pos)
+        output.flush()
+        pos = 0
+    }
+
+    private fun ensureCapacity(extra: Int) {
+        if (pos + extra > buf.size) {
+            buf = buf.copyOf(maxOf(buf.size * 2, pos + extra))
+        }
+    }
+
+    private fun writeBytes(bytes: ByteArray) {
+        System.arraycopy(bytes, 0, buf, pos, bytes.size)
+        pos += bytes.size
+    }
+
+    private fun writeLatin1(s: String) {
+        for (i in s.indices) {
+            val c = s[i].code
+            buf[pos++] = (if (c <= 0xFF) c else '?'.code).toByte()
+        }
+    }
+
+    private fun writeCrlf() {
+        buf[pos++] = '\r'.code.toByte()
+        buf[pos++] = '\n'.code.toByte()
+    }
+
+    // Non-negative decimal without going through a String
+    private fun writeInt(value: Int) {
+        var divisor = 1
+        while (value / divisor >= 10) {
+            divisor *= 10
+        }
+        while (divisor > 0) {
+            buf[pos++] = ('0'.code + value / divisor % 10).toByte()
+            divisor /= 10
+        }
+    }
+}
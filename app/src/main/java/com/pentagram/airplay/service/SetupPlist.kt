@@ -0,0 +1,130 @@
+package com.pentagram.airplay.service
+
+import android.util.Log
+
+/**
+ * SETUP / POST /stream bplist bodies, decoded natively
+ *
+ * The native reader walks the body's offset table once and reports only the
+ * fields the receiver uses, instead of building a dd-plist object graph and
+ * boxing every value through toJavaObject(). Replies are serialized natively
+ * into an array the caller owns, one per connection, so a shared instance
+ * never hands one sender another's reply.
+ */
+class SetupPlist {
+
+    companion object {
+        private const val TAG = "SetupPlist"
+
+        // Must match setup_plist_jni.c / AIRPLAY_SETUP_MAX_STREAMS
+        private const val MAX_STREAMS = 4
+        private const val OUT_TIMING_PORT = 24
+        private const val OUT_SCREEN_MIRRORING = 25
+        private const val OUT_STREAM_COUNT = 26
+        private const val OUT_STREAMS = 27
+
+        /** Size of a reply array for [writeSessionReply] / [writeStreamsReply] */
+        const val REPLY_MAX_LEN = 256
+
+        init {
+            try {
+                System.loadLibrary("conscrypt_jni")
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Conscrypt not available, trying system crypto", e)
+            }
+            System.loadLibrary("airplay_crypto")
+        }
+    }
+
+    class Stream(
+        val type: Long?,
+        val streamConnectionID: Long?,
+        val controlPort: Long?
+    )
+
+    class Setup(
+        val ekey: ByteArray?,
+        val eiv: ByteArray?,
+        val deviceID: String?,
+        val model: String?,
+        val name: String?,
+        val sessionUUID: String?,
+        val osName: String?,
+        val osVersion: String?,
+        val timingPort: Long?,
+        val isScreenMirroring: Boolean?,
+        val streams: List<Stream>
+    )
+
+    /** One entry of a stream SETUP reply; zero ports are left out */
+    class StreamReply(val type: Int, val dataPort: Int, val controlPort: Int = 0, val serverPort: Int = 0)
+
+    private external fun nativeParse(body: ByteArray, out: LongArray): Int
+    private external fun nativeWriteSessionReply(eventPort: Int, timingPort: Int, out: ByteArray): Int
+    private external fun nativeWriteStreamsReply(replies: IntArray, count: Int, out: ByteArray): Int
+
+    /**
+     * Parse a SETUP or POST /stream body; null if it is not a bplist dictionary
+     */
+    fun parse(body: ByteArray): Setup? {
+        val fields = LongArray(OUT_STREAMS + 4 * MAX_STREAMS)
+        if (nativeParse(body, fields) != 0) return null
+
+        fun bytes(idx: Int): ByteArray? {
+            val off = fields[3 * idx].toInt()
+            return if (off < 0) null else body.copyOfRange(off, off + fields[3 * idx + 1].toInt())
+        }
+        fun string(idx: Int): String? {
+            val off = fields[3 * idx].toInt()
+            if (off < 0) return null
+            val charset = if (fields[3 * idx + 2] != 0L) Charsets.UTF_16BE else Charsets.US_ASCII
+            return String(body, off, fields[3 * idx + 1].toInt(), charset)
+        }
+        fun optional(value: Long) = if (value < 0) null else value
+
+        val streams = ArrayList<Stream>(fields[OUT_STREAM_COUNT].toInt())
+        for (i in 0 until fields[OUT_STREAM_COUNT].toInt()) {
+            val s = OUT_STREAMS + 4 * i
+            streams.add(Stream(
+                optional(fields[s]),
+                if (fields[s + 1] != 0L) fields[s + 2] else null,
+                optional(fields[s + 3])
+            ))
+        }
+        val mirroring = fields[OUT_SCREEN_MIRRORING]
+        return Setup(
+            ekey = bytes(0),
+            eiv = bytes(1),
+            deviceID = string(2),
+            model = string(3),
+            name = string(4),
+            sessionUUID = string(5),
+            osName = string(6),
+            osVersion = string(7),
+            timingPort = optional(fields[OUT_TIMING_PORT]),
+            isScreenMirroring = if (mirroring < 0) null else mirroring != 0L,
+            streams = streams
+        )
+    }
+
+    /**
+     * Write { eventPort, timingPort } into [reply]; returns its length or -1
+     */
+    fun writeSessionReply(eventPort: Int, timingPort: Int, reply: ByteArray): Int =
+        nativeWriteSessionReply(eventPort, timingPort, reply)
+
+    /**
+     * Write { streams: [...] } into [reply]; returns its length or -1
+     */
+    fun writeStreamsReply(streams: List<StreamReply>, reply: ByteArray): Int {
+        val count = minOf(streams.size, MAX_STREAMS)
+        val values = IntArray(4 * count)
+        for (i in 0 until count) {
+            values[4 * i] = streams[i].type
+            values[4 * i + 1] = streams[i].dataPort
+            values[4 * i + 2] = streams[i].controlPort
+            values[4 * i + 3] = streams[i].serverPort
+        }
+        return nativeWriteStreamsReply(values, count, reply)
+    }
+}
@@ -1,7 +1,9 @@
 package com.pentagram.airplay.service
 
 import android.media.MediaCodec
+import android.media.MediaCodecInfo
 import android.media.MediaFormat
+import android.os.Process
 import android.util.Log
 import android.view.Surface
 import com.pentagram.airplay.crypto.MirrorBufferDecryptor
@@ -11,19 +13,25 @@ import kotlinx.coroutines.Job
 import kotlinx.coroutines.cancel
 import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
-import java.io.InputStream
+import kotlinx.coroutines.runBlocking
+import java.io.File
+import java.net.InetSocketAddress
 import java.net.ServerSocket
 import java.net.Socket
 import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.nio.channels.ServerSocketChannel
+import java.nio.channels.SocketChannel
+import java.util.concurrent.atomic.AtomicReference
 
 /**
- * Receives and decodes H.264 video stream from AirPlay client
+ * Receives and decodes H.264 or HEVC video stream from AirPlay client
  *
  * AirPlay uses TCP for video streaming (not RTP):
  * - Stream type 110 = Video
  * - Each packet has 4-byte length header (LITTLE-ENDIAN!)
- * - Followed by H.264 NAL units
- * - SPS/PPS headers sent first
+ * - Followed by length-prefixed H.264 or HEVC NAL units
+ * - SPS/PPS headers (avcC, or hvcC with a VPS for HEVC) sent first
  */
 class VideoStreamReceiver(
     private val isScreenMirroring: Boolean,
@@ -36,74 +44,102 @@ class VideoStreamReceiver(
     companion object {
         private const val TAG = "VideoStreamReceiver"
 
-        // H.264 NAL unit types
-        private const val NAL_SLICE = 1
-        private const val NAL_IDR = 5
-        private const val NAL_SEI = 6
-        private const val NAL_SPS = 7
-        private const val NAL_PPS = 8
-        private const val NAL_AUD = 9
+        // Annex-B start code ahead of each parameter set in codec config
+        private val START_CODE = byteArrayOf(0, 0, 0, 1)
+
+        // 128-byte packet header precedes every payload
+        private const val HEADER_SIZE = 128
+
+        // Sanity bound on the header's payload length; anything larger is a corrupt stream
+        private const val MAX_PAYLOAD_SIZE = 32 * 1024 * 1024
+
+        // Reader re-checks isRunning at this interval while the frame queue is full
+        private const val QUEUE_WAIT_NS = 100_000_000L
+
+        // Idle decoder thread looks for a replaced codec at this interval (a static screen sends no frames)
+        private const val DECODER_IDLE_NS = 50_000_000L
+
+        // Per replayed frame wait for a decoder input buffer
+        private const val REPLAY_INPUT_TIMEOUT_US = 20_000L
     }
 
+    // Set from the UI thread; the decoder thread moves the codec to it (surfaceChanged)
+    @Volatile
     private var surface: Surface? = null
+    @Volatile
+    private var surfaceChanged = false
     private var serverSocket: ServerSocket? = null
+    private var serverChannel: ServerSocketChannel? = null
     private var clientSocket: Socket? = null
+    // Used only by the decoder thread while a stream runs, and by stop() once that thread has finished
+    @Volatile
     private var mediaCodec: MediaCodec? = null
     private val scope = CoroutineScope(Dispatchers.IO + Job())
+    @Volatile
     private var isRunning = false
 
+    // Accept and read loop; it closes the frame queue and joins the decoder thread on its way out
+    private var streamJob: Job? = null
+
+    // The current stream's frame queue, so stop() can wake a reader waiting on it
+    @Volatile
+    private var streamQueue: FrameQueue? = null
+
     // SPS and PPS data (needed for MediaCodec initialization)
     private var spsData: ByteArray? = null
     private var ppsData: ByteArray? = null
+    private var vpsData: ByteArray? = null      // HEVC only
+    private var hevc = false
+    @Volatile
     private var codecInitialized = false
 
     // Native UxPlay mirror_buffer decryptor
     private var nativeDecryptor: MirrorBufferDecryptor? = null
     private var baseEncryptionKey: ByteArray? = null  // Keep for initialization
 
+    // Payload buffers recycled across packets (16 KB..4 MB size classes)
+    private val payloadPool = PayloadBufferPool()
+
+    // Session recording: the file asked for, and what the decoder thread is recording into
+    private val recordingFile = AtomicReference<File?>(null)
+    private var recordingTarget: File? = null
+    private var recorder: Mp4Recorder? = null
+    private var lastConfig: ByteArray? = null
+
+    // Stage timestamps of the current stream's video frames (reader and decoder threads)
+    @Volatile
+    private var frameTrace: FrameTrace? = null
+
+    // The current stream's assembler, whose access-unit sizes size the next decoder's input buffers
+    @Volatile
+    private var accessUnits: AccessUnitAssembler? = null
+
     /**
      * Set or update the surface for video rendering
-     * Can be called after initialization when surface becomes available
+     * Can be called after initialization when surface becomes available. Only the surface is recorded here:
+     * the decoder thread, which owns the codec, recreates it on the new surface at its next frame or idle
+     * wakeup and replays the cached keyframe group into it so the picture returns at once.
      */
     fun setSurface(newSurface: Surface?) {
         Log.w(TAG, "═══════════════════════════════════════════════")
         Log.w(TAG, "setSurface() called!")
         Log.w(TAG, "  New surface: ${if (newSurface != null) "AVAILABLE ✅" else "NULL ❌"}")
         Log.w(TAG, "  Codec initialized: $codecInitialized")
-        Log.w(TAG, "  Has SPS/PPS: ${spsData != null}/${ppsData != null}")
         Log.w(TAG, "═══════════════════════════════════════════════")
 
         surface = newSurface
+        surfaceChanged = true
         Log.w(TAG, "Surface updated: ${if (newSurface != null) "available" else "null"}")
-
-        // If codec is already initialized, we need to reinitialize with the new surface
-        if (codecInitialized && spsData != null && ppsData != null) {
-            Log.w(TAG, "🔄 Codec was already initialized - REINITIALIZING with new surface...")
-            try {
-                mediaCodec?.stop()
-                Log.w(TAG, "  → MediaCodec stopped")
-                mediaCodec?.release()
-                Log.w(TAG, "  → MediaCodec released")
-                codecInitialized = false
-                Log.w(TAG, "  → Calling initializeMediaCodec() with surface...")
-                initializeMediaCodec()
-                Log.w(TAG, "  ✅ MediaCodec reinitialized successfully with surface!")
-            } catch (e: Exception) {
-                Log.e(TAG, "❌ Error reinitializing MediaCodec", e)
-                e.printStackTrace()
-            }
-        } else {
-            Log.w(TAG, "⚠️  Codec NOT yet initialized (will use surface when it initializes)")
-            Log.w(TAG, "     codecInitialized=$codecInitialized, has SPS=${spsData != null}, has PPS=${ppsData != null}")
-        }
     }
 
     fun start(port: Int): Boolean {
         return try {
             Log.i(TAG, "Starting VideoStreamReceiver on port $port...")
-            serverSocket = ServerSocket()
+            // Channel-backed so payloads can be read straight into pooled direct buffers
+            serverChannel = ServerSocketChannel.open()
+            serverSocket = serverChannel!!.socket()
             serverSocket!!.reuseAddress = true  // Allow immediate port reuse
-            serverSocket!!.bind(java.net.InetSocketAddress(port))
+            serverSocket!!.bind(InetSocketAddress(port))
             isRunning = true
 
             // Initialize native decryptor with base key
@@ -133,7 +169,7 @@ class VideoStreamReceiver(
 
             // Start accepting connections in background
             Log.i(TAG, "Launching acceptConnection coroutine...")
-            scope.launch {
+            streamJob = scope.launch {
                 try {
                     Log.i(TAG, "acceptConnection coroutine started")
                     acceptConnection()
@@ -153,11 +189,12 @@ class VideoStreamReceiver(
     private suspend fun acceptConnection() {
         try {
             Log.i(TAG, "Waiting for video stream connection...")
-            clientSocket = serverSocket?.accept()
+            val channel = serverChannel?.accept()
 
-            if (clientSocket != null) {
+            if (channel != null) {
+                clientSocket = channel.socket()
                 Log.i(TAG, "✅ Video client connected: ${clientSocket!!.remoteSocketAddress}")
-                receiveVideoStream(clientSocket!!.getInputStream())
+                receiveVideoStream(channel)
             }
         } catch (e: Exception) {
             if (isRunning) {
@@ -166,9 +203,32 @@ class VideoStreamReceiver(
         }
     }
 
-    private suspend fun receiveVideoStream(inputStream: InputStream) {
-        val buffer = ByteArray(1024 * 128) // 128KB buffer
+    // Reads until buffer has no space remaining; returns bytes read (short only on EOF)
+    private fun readFully(channel: SocketChannel, buffer: ByteBuffer): Int {
+        var total = 0
+        while (buffer.hasRemaining()) {
+            val read = channel.read(buffer)
+            if (read < 0) break
+            total += read
+        }
+        return total
+    }
+
+    private suspend fun receiveVideoStream(channel: SocketChannel) {
         var packetCount = 0
+        // Owned by this loop, so they are freed only once no packet can reach them
+        val queue = FrameQueue()
+        val assembler = AccessUnitAssembler()
+        val latency = LatencyController()
+        val keyframes = KeyframeCache()
+        val trace = FrameTrace()
+        frameTrace = trace
+        accessUnits = assembler
+        streamQueue = queue
+
+        // Decoding runs on its own thread so a slow dequeueInputBuffer never stalls socket reads
+        val decoderThread = Thread({ decodeLoop(queue, assembler, latency, keyframes) }, "MirrorDecoder")
+        decoderThread.start()
 
         try {
             // AirPlay video stream protocol:
@@ -176,94 +236,88 @@ class VideoStreamReceiver(
             // 1. 128-byte header (unencrypted)
             // 2. Variable-length payload (encrypted for video data)
 
-            val header = ByteArray(128)
+            // Payload size in header bytes 0-3 is LITTLE-ENDIAN
+            // (UxPlay uses byteutils_get_int() which reads little-endian on most systems)
+            val header = ByteBuffer.allocateDirect(HEADER_SIZE).order(ByteOrder.LITTLE_ENDIAN)
 
             while (isRunning && scope.isActive) {
                 // Read 128-byte header
-                var headerRead = 0
-                while (headerRead < 128) {
-                    val bytesRead = inputStream.read(header, headerRead, 128 - headerRead)
-                    if (bytesRead == -1) {
-                        if (headerRead == 0) {
-                            Log.i(TAG, "Stream closed by client (clean EOF)")
-                        } else {
-                            Log.w(TAG, "Stream closed mid-header: got $headerRead/128 bytes")
-                        }
-                        break
+                header.clear()
+                val headerRead = readFully(channel, header)
+                if (headerRead != HEADER_SIZE) {
+                    if (headerRead == 0) {
+                        Log.i(TAG, "Stream closed by client (clean EOF)")
+                    } else {
+                        Log.w(TAG, "Stream closed mid-header: got $headerRead/$HEADER_SIZE bytes")
                     }
-                    headerRead += bytesRead
-                }
-
-                if (headerRead != 128) {
                     break
                 }
 
-                // Parse payload size from header bytes 0-3 (LITTLE-ENDIAN!)
-                // UxPlay uses byteutils_get_int() which reads little-endian on most systems
-                val payloadSize = ((header[3].toInt() and 0xFF) shl 24) or
-                                  ((header[2].toInt() and 0xFF) shl 16) or
-                                  ((header[1].toInt() and 0xFF) shl 8) or
-                                  (header[0].toInt() and 0xFF)
+                val payloadSize = header.getInt(0)
 
                 // Parse packet type from header bytes 4-5
-                val packetType = header[4].toInt() and 0xFF
-                val packetSubtype = header[5].toInt() and 0xFF
+                val packetType = header.get(4).toInt() and 0xFF
+                val packetSubtype = header.get(5).toInt() and 0xFF
+
+                // Sender timestamp, NTP-style 32.32 seconds (bytes 8-15, little-endian)
+                val ntpTimestamp = header.getLong(8)
 
-                if (payloadSize <= 0 || payloadSize > buffer.size) {
+                if (payloadSize <= 0 || payloadSize > MAX_PAYLOAD_SIZE) {
                     Log.w(TAG, "Invalid payload size: $payloadSize")
                     break
                 }
 
-                // Read payload data
-                var totalRead = 0
-                while (totalRead < payloadSize) {
-                    val read = inputStream.read(buffer, totalRead, payloadSize - totalRead)
-                    if (read < 0) {
-                        Log.w(TAG, "Stream ended while reading payload: got $totalRead/$payloadSize bytes")
-                        break
-                    }
-                    totalRead += read
-                }
-
-                if (totalRead != payloadSize) {
-                    Log.w(TAG, "Incomplete payload: expected $payloadSize, got $totalRead")
+                // Pooled buffer sized for this payload; large IDR frames just use a bigger class
+                val payload = payloadPool.acquire(payloadSize)
+                if (payload == null) {
+                    Log.e(TAG, "No payload buffer for $payloadSize bytes")
                     break
                 }
 
-                // Decrypt payload if needed
-                // Type 0x00 = encrypted video data
-                // Type 0x01 = unencrypted SPS/PPS configuration (AVCC format)
-                // Type 0x02/0x05 = unencrypted keepalive/reports
-                val decryptedData = if (packetType == 0x00 && nativeDecryptor != null) {
-                    // Encrypted video data - decrypt with native UxPlay implementation
-                    try {
-                        val inputData = buffer.copyOf(payloadSize)
-                        nativeDecryptor!!.decrypt(inputData)
-                    } catch (e: Exception) {
-                        Log.e(TAG, "Decryption failed", e)
-                        buffer.copyOf(payloadSize)
-                    }
-                } else {
-                    // Unencrypted packet (SPS/PPS or keepalive)
-                    buffer.copyOf(payloadSize)
-                }
-
-                // Process the packet based on type
-                when (packetType) {
-                    0x01 -> {
-                        // Type 0x01 = unencrypted SPS/PPS in AVCC format
-                        processAVCCConfigPacket(decryptedData, decryptedData.size)
-                    }
-                    0x00 -> {
-                        // Type 0x00 = encrypted video data (H.264 NAL units)
-                        processH264Packet(decryptedData, decryptedData.size)
+                var handedOff = false
+                try {
+                    // Read payload data
+                    val totalRead = readFully(channel, payload)
+                    if (totalRead != payloadSize) {
+                        Log.w(TAG, "Incomplete payload: expected $payloadSize, got $totalRead")
+                        break
                     }
-                    0x05, 0x02 -> {
-                        // Type 0x05 = statistics/feedback, Type 0x02 = keepalive
-                        // Silently ignore
+                    var traceId = 0
+
+                    // Process the packet based on type
+                    // Type 0x00 = encrypted video data
+                    // Type 0x01 = unencrypted SPS/PPS configuration (avcC or hvcC format)
+                    // Type 0x02/0x05 = unencrypted keepalive/reports
+                    when (packetType) {
+                        0x00, 0x01 -> {
+                            if (packetType == 0x00) {
+                                traceId = trace.begin()
+                                // Encrypted video data (H.264 / HEVC NAL units), decrypted in place here:
+                                // the AES-CTR keystream follows packet order on this thread
+                                nativeDecryptor?.let {
+                                    try {
+                                        it.decryptInPlace(payload, payloadSize)
+                                    } catch (e: Exception) {
+                                        Log.e(TAG, "Decryption failed", e)
+                                    }
+                                }
+                                trace.mark(traceId, FrameTrace.DECRYPTED)
+                            }
+                            // Video and SPS/PPS config share the queue so they stay in order
+                            handedOff = handOff(queue, payload, payloadSize, packetType, ntpTimestamp, traceId)
+                        }
+                        0x05, 0x02 -> {
+                            // Type 0x05 = statistics/feedback, Type 0x02 = keepalive
+                            // Silently ignore
+                        }
+                        else -> {
+                            Log.w(TAG, "Unknown packet type: 0x${"%02X".format(packetType)}")
+                        }
                     }
-                    else -> {
-                        Log.w(TAG, "Unknown packet type: 0x${"%02X".format(packetType)}")
+                } finally {
+                    // Queued payloads are released by the decoder thread
+                    if (!handedOff) {
+                        payloadPool.release(payload)
                     }
                 }
                 packetCount++
@@ -271,13 +325,42 @@ class VideoStreamReceiver(
                 if (packetCount == 1 || packetCount % 100 == 0) {
                     Log.i(TAG, "Received $packetCount video packets")
                 }
+                if (packetCount % 1000 == 0) {
+                    Log.i(TAG, "Payload pool: ${payloadPool.stats()}")
+                    Log.i(TAG, "Frame queue: ${queue.stats()}")
+                    Log.i(TAG, "Latency: ${latency.stats()}")
+                    Log.i(TAG, "Keyframe cache: ${keyframes.stats()}")
+                    Log.i(TAG, "Frame stages: ${trace.stats()}")
+                }
             }
         } catch (e: Exception) {
             if (isRunning) {
                 Log.e(TAG, "Error receiving video stream", e)
             }
         } finally {
+            // The decoder drains what is queued, then exits
+            queue.close()
+            try {
+                decoderThread.join()
+            } catch (e: InterruptedException) {
+                Log.w(TAG, "Interrupted waiting for decoder thread", e)
+            }
+
             Log.i(TAG, "Video stream ended. Total packets: $packetCount")
+            Log.i(TAG, "Payload pool: ${payloadPool.stats()}")
+            Log.i(TAG, "Frame queue: ${queue.stats()}")
+            Log.i(TAG, "Access units: ${assembler.stats()}")
+            Log.i(TAG, "Latency: ${latency.stats()}")
+            Log.i(TAG, "Keyframe cache: ${keyframes.stats()}")
+            Log.i(TAG, "Frame stages: ${trace.stats()}")
+            frameTrace = null
+            accessUnits = null
+            streamQueue = null
+            queue.release()
+            assembler.release()
+            latency.release()
+            keyframes.release()
+            trace.release()
 
             // Notify listener that stream has disconnected
             if (isRunning) {
@@ -287,6 +370,235 @@ class VideoStreamReceiver(
         }
     }
 
+    /**
+     * Reader side: queue a payload for the decoder thread, waiting while it is full
+     * (the latency controller keeps a slow decoder from holding the queue full for long)
+     */
+    private fun handOff(queue: FrameQueue, payload: ByteBuffer, length: Int, type: Int, ntpTimestamp: Long,
+                        traceId: Int): Boolean {
+        while (isRunning) {
+            if (queue.push(payload, length, type, ntpTimestamp, QUEUE_WAIT_NS, traceId)) {
+                return true
+            }
+        }
+        return false
+    }
+
+    /**
+     * Decoder thread: codec config and frames in stream order until the reader closes the queue
+     */
+    private fun decodeLoop(queue: FrameQueue, assembler: AccessUnitAssembler, latency: LatencyController,
+                           keyframes: KeyframeCache) {
+        Process.setThreadPriority(Process.THREAD_PRIORITY_DISPLAY)
+        val frame = FrameQueue.Frame()
+
+        while (true) {
+            updateRecorder()
+            recorder?.reclaim { payloadPool.release(it) }
+            if (surfaceChanged && isRunning) {
+                surfaceChanged = false
+                applySurface(latency, keyframes)
+            }
+            // A pop on a queue already closed returns at once, with a frame or for good
+            val closed = queue.isClosed
+            if (!queue.pop(frame, DECODER_IDLE_NS)) {
+                if (closed) break
+                if (isRunning) attachDecoder(latency, keyframes, nextIsKeyframe = false)
+                continue
+            }
+            val payload = frame.buffer ?: continue
+            val trace = frameTrace
+            trace?.mark(frame.traceId, FrameTrace.DEQUEUED)
+            var recorded = false
+            try {
+                if (isRunning) {
+                    if (frame.type == 0x01) {
+                        // Type 0x01 = unencrypted parameter sets, avcC or hvcC (small, parsed from a copy)
+                        val config = copyRange(payload, 0, frame.length)
+                        lastConfig = config
+                        recorder?.config(config, frame.length)
+                        processConfigPacket(assembler, config, frame.length)
+                    } else {
+                        val auLength = processVideoPacket(assembler, latency, keyframes, payload, frame.length,
+                            frame.ntpTimestamp, frame.enqueueNs, frame.traceId)
+                        // The recorder writes the access unit from this buffer and hands it back later
+                        if (auLength > 0) {
+                            recorded = recorder?.record(payload, auLength, assembler.flags, frame.ntpTimestamp) == true
+                        }
+                    }
+                }
+            } catch (e: Exception) {
+                Log.e(TAG, "Error decoding packet", e)
+            } finally {
+                if (!recorded) payloadPool.release(payload)
+                frame.buffer = null
+                // Done here unless it is inside the decoder; then its output completes it
+                trace?.end(frame.traceId)
+            }
+        }
+        finishRecording()
+        // The file is complete; a later stream must not truncate it
+        recordingTarget?.let { recordingFile.compareAndSet(it, null) }
+        recordingTarget = null
+        Log.i(TAG, "Decoder thread finished")
+    }
+
+    /**
+     * Archive the session to file as fragmented MP4, from the next keyframe on, replacing any
+     * recording in progress. The decoder thread opens the file, so this may be called at any time.
+     */
+    fun startRecording(file: File) {
+        recordingFile.set(file)
+    }
+
+    /** End the recording in progress; the decoder thread writes the last fragment and closes the file */
+    fun stopRecording() {
+        recordingFile.set(null)
+    }
+
+    /**
+     * Decoder thread: follow startRecording / stopRecording
+     */
+    private fun updateRecorder() {
+        val wanted = recordingFile.get()
+        if (wanted === recordingTarget) return
+        finishRecording()
+        recordingTarget = wanted
+        if (wanted == null) return
+        recorder = Mp4Recorder.open(wanted)?.also { r ->
+            Log.i(TAG, "Recording to $wanted")
+            // Started mid-stream: the config packet came before; frames are taken from the next keyframe
+            lastConfig?.let { r.config(it, it.size) }
+        }
+    }
+
+    private fun finishRecording() {
+        val r = recorder ?: return
+        recorder = null
+        // Waits for the backlog to reach storage once, at the end; held payloads go back to the pool
+        if (!r.stop { payloadPool.release(it) }) {
+            Log.w(TAG, "Recording to $recordingTarget had write errors")
+        }
+        Log.i(TAG, "Recording to $recordingTarget finished: ${r.stats()}")
+        r.release()
+    }
+
+    /**
+     * Decoder thread: move to the surface from setSurface. A running codec is recreated on it and caught up
+     * from the keyframe cache; one not yet created picks the surface up when it is.
+     */
+    private fun applySurface(latency: LatencyController, keyframes: KeyframeCache) {
+        if (!codecInitialized) {
+            Log.w(TAG, "⚠️  Codec NOT yet initialized (will use surface when it initializes)")
+            return
+        }
+        Log.w(TAG, "🔄 Codec was already initialized - REINITIALIZING with new surface...")
+        releaseCodec()
+        tryInitializeCodec()
+        attachDecoder(latency, keyframes, nextIsKeyframe = false)
+    }
+
+    /**
+     * Catch up a codec created since the last frame (new surface, restart): the frames queued to the old
+     * one never come out, and without the cached keyframe group the new one would show nothing until the
+     * sender's next keyframe. Skipped when the frame about to be decoded is a keyframe itself.
+     */
+    private fun attachDecoder(latency: LatencyController, keyframes: KeyframeCache, nextIsKeyframe: Boolean) {
+        if (keyframesStale) {
+            // The stream changed under the cached frames; the new decoder cannot take them
+            keyframes.clear()
+            keyframesStale = false
+        }
+        val codec = mediaCodec
+        if (codec === trackedCodec) return
+        trackedCodec = codec
+        latency.reset()
+        renderFromUs = Long.MIN_VALUE
+        if (codec == null || !codecInitialized || nextIsKeyframe) return
+
+        val start = System.nanoTime()
+        var shownUs = Long.MIN_VALUE
+        val replayed = try {
+            keyframes.replay { au, length, flags, ptsUs, decodeOnly ->
+                val index = codec.dequeueInputBuffer(REPLAY_INPUT_TIMEOUT_US)
+                val input = if (index >= 0) codec.getInputBuffer(index) else null
+                if (input == null || input.capacity() < length) {
+                    if (index >= 0) codec.queueInputBuffer(index, 0, 0, ptsUs, 0)
+                    return@replay false
+                }
+                input.clear()
+                input.put(au)
+                val isKeyFrame = (flags and AccessUnitAssembler.FLAG_KEYFRAME) != 0
+                codec.queueInputBuffer(index, 0, length, ptsUs, if (isKeyFrame) MediaCodec.BUFFER_FLAG_KEY_FRAME else 0)
+                shownUs = ptsUs
+                // Only the newest frame is shown; drainOutput holds back everything before it
+                renderFromUs = if (decodeOnly) Long.MAX_VALUE else ptsUs
+                drainOutput(codec, latency)
+                true
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error replaying keyframe cache", e)
+            0
+        }
+        if (replayed > 0) {
+            renderFromUs = shownUs
+            Log.i(TAG, "Replayed $replayed cached frames into the new decoder in " +
+                "${(System.nanoTime() - start) / 1_000_000} ms: ${keyframes.stats()}")
+        } else {
+            renderFromUs = Long.MIN_VALUE
+            if (replayed < 0) Log.i(TAG, "No cached keyframe to replay; waiting for the sender's next one")
+        }
+    }
+
+    /**
+     * Per-stage latency of the current stream's video frames (capture to decoder output), null between streams
+     */
+    fun frameStageStats(): FrameTrace.Stats? = frameTrace?.stats()
+
+    /**
+     * Write the current stream's last frames, stage by stage, as Chrome trace JSON
+     * @return frames written, -1 without a stream or on failure
+     */
+    fun writeFrameTrace(file: File): Int = frameTrace?.writeChromeTrace(file) ?: -1
+
+    /**
+     * Payload buffer pool statistics (hit rate, high-water marks) for diagnostics
+     */
+    fun payloadPoolStats(): PayloadBufferPool.Stats? = payloadPool.stats()
+
+    private fun processConfigPacket(assembler: AccessUnitAssembler, data: ByteArray, length: Int) {
+        // HEVC senders send an hvcC record (VPS/SPS/PPS arrays) instead of avcC
+        val config = hevcParameterSets.parseConfig(data, length)
+        selectCodec(assembler, config != null)
+        if (config == null) {
+            processAVCCConfigPacket(data, length)
+            return
+        }
+        Log.i(TAG, "hvcC: profile ${config.profile}, level ${config.level / 30.0}, " +
+            "VPS/SPS/PPS ${config.vps?.size ?: 0}/${config.sps.size}/${config.pps.size} bytes")
+        if (config.nalLengthSize != 4) {
+            Log.w(TAG, "hvcC declares ${config.nalLengthSize}-byte NAL lengths; frames are read with 4")
+        }
+        applyParameterSets(config.sps, config.pps, inBand = false, newVps = config.vps)
+    }
+
+    /**
+     * Follow the codec of the config packet; a switch between H.264 and HEVC needs a new decoder
+     */
+    private fun selectCodec(assembler: AccessUnitAssembler, isHevc: Boolean) {
+        if (isHevc == hevc) return
+        Log.w(TAG, "Stream codec is now ${if (isHevc) "HEVC" else "H.264"}")
+        hevc = isHevc
+        assembler.codec = if (isHevc) AccessUnitAssembler.CODEC_HEVC else AccessUnitAssembler.CODEC_H264
+        spsData = null
+        ppsData = null
+        vpsData = null
+        keyframesStale = true
+        if (codecInitialized) {
+            releaseCodec()
+        }
+    }
+
     private fun processAVCCConfigPacket(data: ByteArray, length: Int) {
         // Parse AVCC format configuration packet (SPS/PPS)
         // Format: https://wiki.multimedia.cx/index.php/MPEG-4_Part_15
@@ -383,208 +695,295 @@ class VideoStreamReceiver(
                 offset += ppsLength
             }
 
-            // Check if SPS/PPS has changed (indicates resolution change)
-            if (codecInitialized && newSpsData != null && newPpsData != null) {
-                val spsChanged = !newSpsData.contentEquals(spsData)
-                val ppsChanged = !newPpsData.contentEquals(ppsData)
-
-                if (spsChanged || ppsChanged) {
-                    Log.w(TAG, "🔄 SPS/PPS changed - resolution change detected! Reinitializing codec...")
-                    Log.w(TAG, "   SPS changed: $spsChanged")
-                    Log.w(TAG, "   PPS changed: $ppsChanged")
-
-                    // Stop and release the old codec
-                    try {
-                        mediaCodec?.stop()
-                        mediaCodec?.release()
-                        mediaCodec = null
-                        codecInitialized = false
-                        frameCount = 0
-                        Log.w(TAG, "   → Old codec released")
-                    } catch (e: Exception) {
-                        Log.e(TAG, "Error releasing old codec", e)
-                    }
-                }
-            }
-
-            // Update SPS/PPS data
-            spsData = newSpsData
-            ppsData = newPpsData
-
-            // Try to initialize codec now that we have SPS and PPS
-            tryInitializeCodec()
+            // Out of band (type 0x01): anything the running decoder keeps is queued to it as codec config
+            applyParameterSets(newSpsData, newPpsData, inBand = false)
 
         } catch (e: Exception) {
             Log.e(TAG, "Error parsing AVCC config packet", e)
         }
     }
 
-    private fun processH264Packet(data: ByteArray, length: Int) {
-        // Encrypted video packets use length-prefixed NAL units (4-byte big-endian length)
-        // This is the format after AES decryption
-        // Format: [4-byte big-endian length][NAL unit data]... repeat
-
-        var offset = 0
-        var nalCount = 0
-        while (offset < length - 4) {
-            // Read 4-byte big-endian NAL unit length
-            val nalLength = ((data[offset].toInt() and 0xFF) shl 24) or
-                           ((data[offset + 1].toInt() and 0xFF) shl 16) or
-                           ((data[offset + 2].toInt() and 0xFF) shl 8) or
-                           (data[offset + 3].toInt() and 0xFF)
-
-            if (nalLength <= 0 || nalLength > length || offset + 4 + nalLength > length) {
-                // Invalid NAL length
-                Log.w(TAG, "Invalid NAL length: $nalLength at offset $offset (packet size: $length)")
-                break
-            }
-
-            // NAL unit data starts after the 4-byte length
-            val nalDataOffset = offset + 4
+    /**
+     * @return the access unit's length when the packet held a picture (decoded or not), else -1
+     */
+    private fun processVideoPacket(
+        assembler: AccessUnitAssembler,
+        latency: LatencyController,
+        keyframes: KeyframeCache,
+        data: ByteBuffer,
+        length: Int,
+        ntpTimestamp: Long,
+        arrivalNs: Long,
+        traceId: Int
+    ): Int {
+        // Encrypted video packets hold one frame as length-prefixed NAL units
+        // ([4-byte big-endian length][NAL unit data]... after AES decryption).
+        // The assembler turns them into a single Annex-B access unit in place.
+        val auLength = assembler.assemble(data, length, ntpTimestamp, arrivalNs)
+        if (auLength < 0) {
+            Log.w(TAG, "NO NAL units found in $length bytes")
+            return -1
+        }
+        if ((assembler.flags and AccessUnitAssembler.FLAG_TRUNCATED) != 0) {
+            Log.w(TAG, "Invalid NAL length after ${assembler.nalCount} NAL units (packet size: $length)")
+        }
 
-            // Get NAL unit type from first byte
-            val nalHeader = data[nalDataOffset].toInt() and 0xFF
-            val nalType = nalHeader and 0x1F
+        // In-band SPS/PPS (VPS too for HEVC, with keyframes) reach the decoder inside this access unit
+        if (assembler.hasParameterSets) {
+            val sps = if (assembler.spsLength > 0) copyRange(data, assembler.spsOffset, assembler.spsLength) else spsData
+            val pps = if (assembler.ppsLength > 0) copyRange(data, assembler.ppsOffset, assembler.ppsLength) else ppsData
+            val vps = if (assembler.vpsLength > 0) copyRange(data, assembler.vpsOffset, assembler.vpsLength) else vpsData
+            applyParameterSets(sps, pps, inBand = true, newVps = vps)
+        }
 
-            // Check forbidden_zero_bit (first bit must be 0)
-            if ((nalHeader and 0x80) != 0) {
-                Log.w(TAG, "Invalid NAL unit: forbidden_zero_bit is 1")
-                break
+        if (!assembler.hasPicture) {
+            return -1
+        }
+        frameTrace?.let {
+            // Sender capture time on the local clock (best-case transit), then assembly done
+            it.mark(traceId, FrameTrace.CAPTURE, assembler.ptsNs)
+            it.mark(traceId, FrameTrace.ASSEMBLED)
+        }
+        attachDecoder(latency, keyframes, assembler.isKeyFrame)
+        // Cached whether or not it is decoded now: the next decoder needs every reference frame
+        val presentationTimeUs = assembler.ptsNs / 1000
+        keyframes.add(data, auLength, assembler.flags, presentationTimeUs)
+        if (!codecInitialized) {
+            Log.w(TAG, "Received frame before codec initialized (${assembler.nalCount} NAL units)")
+            return auLength
+        }
+        val decision = latency.decide(assembler.flags, presentationTimeUs)
+        if (decision != LatencyController.DECODE) {
+            // Decoder is behind: skip this frame but keep its finished output moving
+            droppedFrameCount++
+            if (decision != lastDropDecision || droppedFrameCount % 60 == 0) {
+                val what = if (decision == LatencyController.DROP_TO_IDR) "up to the next IDR" else "non-reference frames"
+                Log.w(TAG, "Decoder behind, dropping $what: ${latency.stats()}")
             }
-
-            // Process this NAL unit
-            processNALUnit(nalType, data, nalDataOffset, nalLength)
-
-            // Move to next NAL unit
-            offset = nalDataOffset + nalLength
-            nalCount++
+            lastDropDecision = decision
+            mediaCodec?.let { drainOutput(it, latency) }
+            return auLength
         }
+        lastDropDecision = LatencyController.DECODE
 
-        if (nalCount == 0) {
-            Log.w(TAG, "NO NAL units found in $length bytes")
+        frameCount++
+        if (frameCount <= 5 || frameCount % 30 == 0) {
+            Log.i(TAG, "Decoding frame #$frameCount (${if (assembler.isKeyFrame) "IDR" else "SLICE"}, " +
+                "${assembler.nalCount} NAL units, length: $auLength bytes)")
         }
+        // Too big for this decoder's input buffers: a new one sized from the frames seen so far (this one
+        // included, so at least twice as large) takes it from the keyframe cache. Not when the decoder got
+        // that much already and allocated less: a new one would do the same.
+        if (!decodeFrame(assembler, latency, data, auLength, presentationTimeUs, traceId) &&
+            2L * auLength > codecMaxInputSize) {
+            Log.w(TAG, "Restarting decoder for a $auLength-byte access unit: ${assembler.stats()}")
+            releaseCodec()
+            tryInitializeCodec()
+            attachDecoder(latency, keyframes, nextIsKeyframe = false)
+        }
+        return auLength
     }
 
     private var frameCount = 0
+    private var droppedFrameCount = 0L
+    private var lastDropDecision = LatencyController.DECODE
+    private var trackedCodec: MediaCodec? = null
+
+    // Set when the cached keyframe group no longer matches the stream's parameter sets
+    @Volatile
+    private var keyframesStale = false
+
+    // Outputs before this presentation time are decoded but not shown (cache replay)
+    private var renderFromUs = Long.MIN_VALUE
+
+    // What the running decoder was configured for, to decide whether a new SPS needs a restart
+    private val parameterSets = H264ParameterSets()
+    private val hevcParameterSets = HevcParameterSets()
+    private var codecAdaptive = false
+    private var codecMaxWidth = 0
+    private var codecMaxHeight = 0
+    private var codecMaxInputSize = 0
+    private var codecRestarts = 0
+    private var restartsAvoided = 0
+
+    private fun copyRange(data: ByteBuffer, offset: Int, length: Int): ByteArray {
+        // Absolute bulk get() needs API 35; go through a duplicate so data's position is untouched
+        val bytes = ByteArray(length)
+        val src = data.duplicate()
+        src.position(offset)
+        src.get(bytes)
+        return bytes
+    }
 
-    private fun processNALUnit(nalType: Int, data: ByteArray, offset: Int, length: Int) {
-        when (nalType) {
-            NAL_SPS -> {
-                val newSpsData = data.copyOfRange(offset, offset + length)
-
-                // Check if SPS has changed (indicates resolution change)
-                if (codecInitialized && spsData != null && !newSpsData.contentEquals(spsData)) {
-                    Log.w(TAG, "🔄 SPS changed - resolution change detected! Reinitializing codec...")
-
-                    // Stop and release the old codec
-                    try {
-                        mediaCodec?.stop()
-                        mediaCodec?.release()
-                        mediaCodec = null
-                        codecInitialized = false
-                        frameCount = 0
-                        Log.w(TAG, "   → Old codec released")
-                    } catch (e: Exception) {
-                        Log.e(TAG, "Error releasing old codec", e)
-                    }
-                }
+    private fun parseSps(nal: ByteArray): H264ParameterSets.Sps? =
+        if (hevc) hevcParameterSets.parseSps(nal) else parameterSets.parseSps(nal)
 
-                spsData = newSpsData
-                Log.i(TAG, "Received SPS (Sequence Parameter Set): $length bytes")
-                tryInitializeCodec()
-            }
-            NAL_PPS -> {
-                val newPpsData = data.copyOfRange(offset, offset + length)
-
-                // Check if PPS has changed (indicates resolution change)
-                if (codecInitialized && ppsData != null && !newPpsData.contentEquals(ppsData)) {
-                    Log.w(TAG, "🔄 PPS changed - resolution change detected! Reinitializing codec...")
-
-                    // Stop and release the old codec
-                    try {
-                        mediaCodec?.stop()
-                        mediaCodec?.release()
-                        mediaCodec = null
-                        codecInitialized = false
-                        frameCount = 0
-                        Log.w(TAG, "   → Old codec released")
-                    } catch (e: Exception) {
-                        Log.e(TAG, "Error releasing old codec", e)
-                    }
-                }
+    private fun compareSps(current: ByteArray, next: ByteArray): Int =
+        if (hevc) hevcParameterSets.compareSps(current, next) else parameterSets.compareSps(current, next)
 
-                ppsData = newPpsData
-                Log.i(TAG, "Received PPS (Picture Parameter Set): $length bytes")
-                tryInitializeCodec()
-            }
-            NAL_IDR, NAL_SLICE -> {
-                // Video frame data
-                if (codecInitialized) {
-                    frameCount++
-                    if (frameCount <= 5 || frameCount % 30 == 0) {
-                        Log.i(TAG, "Decoding frame #$frameCount (NAL type: ${if (nalType == NAL_IDR) "IDR" else "SLICE"}, length: $length bytes)")
-                    }
-                    decodeFrame(data, offset, length, nalType == NAL_IDR)
-                } else {
-                    Log.w(TAG, "Received frame before codec initialized (NAL type: $nalType)")
-                }
-            }
-            NAL_SEI -> {
-                if (frameCount < 3) {
-                    Log.d(TAG, "Received SEI (Supplemental Enhancement Information)")
-                }
-            }
-            NAL_AUD -> {
-                // Access Unit Delimiter - can ignore
+    /**
+     * Take a new SPS/PPS pair (and VPS for HEVC) and restart the decoder only if it cannot decode the
+     * stream as configured. Byte-level changes to VUI timing, colour description, the PPS or VPS, and
+     * resolution changes that fit a decoder with adaptive playback (rotation, keyframe refresh), keep
+     * the running decoder.
+     */
+    private fun applyParameterSets(newSps: ByteArray?, newPps: ByteArray?, inBand: Boolean, newVps: ByteArray? = null) {
+        if (newVps != null) vpsData = newVps
+        if (newSps == null || newPps == null) {
+            if (newSps != null) spsData = newSps
+            if (newPps != null) ppsData = newPps
+            return
+        }
+        if (!hevc && parameterSets.parsePps(newPps) < 0) {
+            Log.w(TAG, "Ignoring undecodable PPS (${newPps.size} bytes)")
+            return
+        }
+        val previousSps = spsData
+        val spsChanged = !newSps.contentEquals(previousSps)
+        val ppsChanged = !newPps.contentEquals(ppsData)
+        spsData = newSps
+        ppsData = newPps
+        if (spsChanged || ppsChanged) {
+            keyframesStale = true
+        }
+        if (previousSps == null) {
+            Log.i(TAG, "Received SPS/PPS: ${newSps.size}/${newPps.size} bytes")
+        }
+        if (!codecInitialized) {
+            tryInitializeCodec()
+            return
+        }
+        if (!spsChanged && !ppsChanged) {
+            return
+        }
+
+        val change = if (spsChanged && previousSps != null) compareSps(previousSps, newSps) else H264ParameterSets.SAME
+        val sps = if (spsChanged) parseSps(newSps) else null
+        val fits = change == H264ParameterSets.SAME ||
+            (change == H264ParameterSets.RESOLUTION && sps != null && codecAdaptive &&
+                sps.codedWidth <= codecMaxWidth && sps.codedHeight <= codecMaxHeight)
+        if (fits) {
+            restartsAvoided++
+            Log.i(TAG, "Parameter sets changed (SPS $spsChanged, PPS $ppsChanged${if (sps != null) ": $sps" else ""}), " +
+                "decoder keeps running ($restartsAvoided restarts avoided)")
+            if (!inBand) {
+                queueCodecConfig()
             }
-            else -> {
-                if (frameCount < 10) {
-                    Log.d(TAG, "Received NAL unit type: $nalType, length: $length")
-                }
+            return
+        }
+
+        Log.w(TAG, "🔄 SPS changed incompatibly (${if (sps != null) "$sps" else "undecodable"}) - reinitializing codec...")
+        releaseCodec()
+        tryInitializeCodec()
+    }
+
+    private fun releaseCodec() {
+        try {
+            mediaCodec?.stop()
+            mediaCodec?.release()
+            mediaCodec = null
+            codecInitialized = false
+            frameCount = 0
+            codecRestarts++
+            Log.w(TAG, "   → Old codec released ($codecRestarts restarts)")
+        } catch (e: Exception) {
+            Log.e(TAG, "Error releasing old codec", e)
+        }
+    }
+
+    /** Current parameter sets as Annex-B: VPS (HEVC), SPS, PPS */
+    private fun codecConfig(): ByteArray {
+        val vps = if (hevc) vpsData else null
+        val out = ByteBuffer.allocate((vps?.size?.plus(4) ?: 0) + spsData!!.size + ppsData!!.size + 8)
+        vps?.let { out.put(START_CODE).put(it) }
+        out.put(START_CODE).put(spsData!!).put(START_CODE).put(ppsData!!)
+        return out.array()
+    }
+
+    /**
+     * Hand out-of-band parameter sets to the running decoder ahead of the frames that use them
+     */
+    private fun queueCodecConfig() {
+        try {
+            val codec = mediaCodec ?: return
+            val index = codec.dequeueInputBuffer(10000)
+            if (index < 0) {
+                Log.w(TAG, "No input buffer for codec config; the next IDR carries its own SPS/PPS")
+                return
             }
+            val input = codec.getInputBuffer(index) ?: return
+            input.clear()
+            val config = codecConfig()
+            input.put(config)
+            codec.queueInputBuffer(index, 0, config.size, 0, MediaCodec.BUFFER_FLAG_CODEC_CONFIG)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error queueing codec config", e)
         }
     }
 
     private fun tryInitializeCodec() {
-        if (spsData != null && ppsData != null && !codecInitialized) {
+        if (spsData != null && ppsData != null && (!hevc || vpsData != null) && !codecInitialized) {
             initializeMediaCodec()
         }
     }
 
     private fun initializeMediaCodec() {
         try {
-            Log.i(TAG, "Initializing MediaCodec for H.264...")
-
-            val format = MediaFormat.createVideoFormat(MediaFormat.MIMETYPE_VIDEO_AVC, width, height)
-
-            // Add SPS and PPS to format
-            val csd0 = ByteBuffer.allocate(spsData!!.size + ppsData!!.size + 8)
-            // Add SPS with start code
-            csd0.put(byteArrayOf(0, 0, 0, 1))
-            csd0.put(spsData!!)
-            // Add PPS with start code
-            csd0.put(byteArrayOf(0, 0, 0, 1))
-            csd0.put(ppsData!!)
-            csd0.flip()
-
-            format.setByteBuffer("csd-0", csd0)
-            format.setInteger(MediaFormat.KEY_MAX_INPUT_SIZE, 1024 * 1024) // 1MB
-
-            mediaCodec = MediaCodec.createDecoderByType(MediaFormat.MIMETYPE_VIDEO_AVC)
+            val mime = if (hevc) MediaFormat.MIMETYPE_VIDEO_HEVC else MediaFormat.MIMETYPE_VIDEO_AVC
+            Log.i(TAG, "Initializing MediaCodec for ${if (hevc) "HEVC" else "H.264"}...")
+
+            // Size the decoder from the SPS; the constructor's size only if it does not decode
+            val sps = parseSps(spsData!!)
+            val videoWidth = sps?.width ?: width
+            val videoHeight = sps?.height ?: height
+            val format = MediaFormat.createVideoFormat(mime, videoWidth, videoHeight)
+
+            // Parameter sets with start codes: SPS + PPS, VPS first for HEVC
+            format.setByteBuffer("csd-0", ByteBuffer.wrap(codecConfig()))
+
+            val codec = MediaCodec.createDecoderByType(mime)
+            mediaCodec = codec
+
+            // With adaptive playback, allow a square of the longer side so a rotation is taken in band
+            val caps = codec.codecInfo.getCapabilitiesForType(mime)
+            val side = maxOf(sps?.codedWidth ?: width, sps?.codedHeight ?: height)
+            codecAdaptive = surface != null &&
+                caps.isFeatureSupported(MediaCodecInfo.CodecCapabilities.FEATURE_AdaptivePlayback) &&
+                caps.videoCapabilities?.isSizeSupported(side, side) == true
+            if (codecAdaptive) {
+                codecMaxWidth = side
+                codecMaxHeight = side
+                format.setInteger(MediaFormat.KEY_MAX_WIDTH, side)
+                format.setInteger(MediaFormat.KEY_MAX_HEIGHT, side)
+            } else {
+                codecMaxWidth = sps?.codedWidth ?: width
+                codecMaxHeight = sps?.codedHeight ?: height
+            }
+            // One access unit at the largest size this codec accepts at the SPS's level; the 4 MB payload class
+            // if the SPS is unreadable. Once the stream has shown a keyframe, sized from its frames instead.
+            val spsBound = when {
+                sps == null -> PayloadBufferPool.MIN_CLASS_SIZE shl (PayloadBufferPool.CLASS_COUNT - 1)
+                codecAdaptive -> sps.maxInputSizeRotated
+                else -> sps.maxInputSize
+            }
+            val maxInputSize = accessUnits?.inputSize(spsBound) ?: spsBound
+            format.setInteger(MediaFormat.KEY_MAX_INPUT_SIZE, maxInputSize)
+            codecMaxInputSize = maxInputSize
 
             if (surface != null) {
-                mediaCodec!!.configure(format, surface, null, 0)
+                codec.configure(format, surface, null, 0)
             } else {
                 Log.w(TAG, "No surface provided - decoder will run without output")
-                mediaCodec!!.configure(format, null, null, 0)
+                codec.configure(format, null, null, 0)
             }
 
-            mediaCodec!!.start()
+            codec.start()
             codecInitialized = true
 
             Log.i(TAG, "✅ MediaCodec initialized successfully!")
-            Log.i(TAG, "   Codec: H.264 (AVC)")
-            Log.i(TAG, "   Resolution: ${width}x${height}")
+            Log.i(TAG, "   Codec: ${if (hevc) "HEVC" else "H.264 (AVC)"} (${codec.name})")
+            Log.i(TAG, "   Resolution: ${videoWidth}x${videoHeight}${if (sps != null) " ($sps)" else " (SPS not decoded)"}")
+            Log.i(TAG, "   Max input: $maxInputSize bytes (SPS bound $spsBound), adaptive ${if (codecAdaptive) "up to ${codecMaxWidth}x$codecMaxHeight" else "off"}")
             Log.i(TAG, "   SPS size: ${spsData!!.size} bytes")
             Log.i(TAG, "   PPS size: ${ppsData!!.size} bytes")
 
@@ -594,9 +993,16 @@ class VideoStreamReceiver(
         }
     }
 
-    private fun decodeFrame(data: ByteArray, offset: Int, length: Int, isKeyFrame: Boolean) {
+    /**
+     * Queue the access unit in data[0, length) (assembler's last) to the decoder
+     * @return false if it did not fit the decoder's input buffers
+     */
+    private fun decodeFrame(assembler: AccessUnitAssembler, latency: LatencyController, data: ByteBuffer, length: Int,
+                            presentationTimeUs: Long, traceId: Int): Boolean {
+        val auFlags = assembler.flags
+        var fits = true
         try {
-            val codec = mediaCodec ?: return
+            val codec = mediaCodec ?: return true
 
             // Get input buffer
             val inputBufferIndex = codec.dequeueInputBuffer(10000) // 10ms timeout
@@ -605,27 +1011,57 @@ class VideoStreamReceiver(
                 if (inputBuffer != null) {
                     inputBuffer.clear()
 
-                    // Add start code before NAL unit
-                    inputBuffer.put(byteArrayOf(0, 0, 0, 1))
-                    inputBuffer.put(data, offset, length)
+                    if (inputBuffer.capacity() < length) {
+                        // Hand the buffer back empty rather than feed the decoder half a frame
+                        Log.w(TAG, "Access unit of $length bytes exceeds input buffer (${inputBuffer.capacity()})")
+                        codec.queueInputBuffer(inputBufferIndex, 0, 0, presentationTimeUs, 0)
+                        latency.onInputLost(auFlags, presentationTimeUs)
+                        fits = false
+                    } else {
+                        // The whole frame, start codes included, straight from the payload buffer: one native
+                        // copy into the codec's buffer, through the ByteBuffer API only if that is not direct
+                        if (!assembler.copyTo(data, length, inputBuffer)) {
+                            val au = data.duplicate()
+                            au.limit(length).position(0)
+                            inputBuffer.put(au)
+                        }
 
-                    val flags = if (isKeyFrame) MediaCodec.BUFFER_FLAG_KEY_FRAME else 0
-                    codec.queueInputBuffer(inputBufferIndex, 0, length + 4, 0, flags)
+                        val isKeyFrame = (auFlags and AccessUnitAssembler.FLAG_KEYFRAME) != 0
+                        val flags = if (isKeyFrame) MediaCodec.BUFFER_FLAG_KEY_FRAME else 0
+                        codec.queueInputBuffer(inputBufferIndex, 0, length, presentationTimeUs, flags)
+                        latency.onQueued(auFlags, presentationTimeUs)
+                        frameTrace?.mark(traceId, FrameTrace.INPUT)
+                    }
                 }
+            } else {
+                // Decoder backlog: this frame is gone, and with it anything that references it
+                latency.onInputLost(auFlags, presentationTimeUs)
             }
 
+            drainOutput(codec, latency)
+
+        } catch (e: Exception) {
+            Log.e(TAG, "Error decoding frame", e)
+        }
+        return fits
+    }
+
+    private val bufferInfo = MediaCodec.BufferInfo()
+
+    private fun drainOutput(codec: MediaCodec, latency: LatencyController) {
+        try {
             // Release output buffers
-            val bufferInfo = MediaCodec.BufferInfo()
             var outputBufferIndex = codec.dequeueOutputBuffer(bufferInfo, 0)
 
             while (outputBufferIndex >= 0) {
-                // Render to surface (if provided)
-                codec.releaseOutputBuffer(outputBufferIndex, true)
+                latency.onOutput(bufferInfo.presentationTimeUs)
+                frameTrace?.output(bufferInfo.presentationTimeUs)
+                // Render to surface (if provided); replayed frames ahead of the newest one only rebuild references
+                codec.releaseOutputBuffer(outputBufferIndex, bufferInfo.presentationTimeUs >= renderFromUs)
                 outputBufferIndex = codec.dequeueOutputBuffer(bufferInfo, 0)
             }
-
         } catch (e: Exception) {
-            Log.e(TAG, "Error decoding frame", e)
+            Log.e(TAG, "Error draining decoder output", e)
         }
     }
 
@@ -633,37 +1069,51 @@ class VideoStreamReceiver(
         Log.i(TAG, "Stopping video stream receiver...")
         isRunning = false
 
+        // Wake the reader wherever it waits: a socket read, accept, or a full frame queue
         try {
-            nativeDecryptor?.destroy()
-            nativeDecryptor = null
+            clientSocket?.close()
         } catch (e: Exception) {
-            Log.e(TAG, "Error destroying native decryptor", e)
+            Log.e(TAG, "Error closing client socket", e)
         }
 
         try {
-            mediaCodec?.stop()
-            mediaCodec?.release()
-            mediaCodec = null
+            serverSocket?.close()
         } catch (e: Exception) {
-            Log.e(TAG, "Error stopping MediaCodec", e)
+            Log.e(TAG, "Error closing server socket", e)
         }
+        streamQueue?.close()
 
+        // The reader stops decrypting and, on its way out, joins the decoder thread; until then
+        // both may still be using the decryptor and the codec
         try {
-            clientSocket?.close()
+            streamJob?.let { runBlocking { it.join() } }
+        } catch (e: InterruptedException) {
+            Log.w(TAG, "Interrupted waiting for the stream threads", e)
+        }
+        streamJob = null
+
+        try {
+            nativeDecryptor?.destroy()
+            nativeDecryptor = null
         } catch (e: Exception) {
-            Log.e(TAG, "Error closing client socket", e)
+            Log.e(TAG, "Error destroying native decryptor", e)
         }
 
         try {
-            serverSocket?.close()
+            mediaCodec?.stop()
+            mediaCodec?.release()
+            mediaCodec = null
         } catch (e: Exception) {
-            Log.e(TAG, "Error closing server socket", e)
+            Log.e(TAG, "Error stopping MediaCodec", e)
         }
 
         scope.cancel()
+        // Freed once the reader and decoder threads return their in-flight buffers, if any
+        payloadPool.destroy()
         codecInitialized = false
         spsData = null
         ppsData = null
+        vpsData = null
 
         Log.i(TAG, "Video stream receiver stopped")
     }
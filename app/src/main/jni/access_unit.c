@@ -0,0 +1,251 @@
+/**
+ * Access-unit assembler for the mirror video stream
+ */
+
+#include <string.h>
+
+#include "access_unit.h"
+#include "hevc_params.h"
+
+#define NAL_SLICE 1
+#define NAL_IDR 5
+#define NAL_SPS 7
+#define NAL_PPS 8
+
+uint64_t
+access_unit_header_timestamp(const unsigned char *header)
+{
+    uint64_t ntp_timestamp = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        ntp_timestamp = ntp_timestamp << 8 | header[8 + i];
+    }
+    return ntp_timestamp;
+}
+
+int64_t
+access_unit_ntp_to_ns(uint64_t ntp)
+{
+    return (int64_t)((ntp >> 32) * 1000000000ull + (((ntp & 0xffffffffull) * 1000000000ull) >> 32));
+}
+
+void
+access_unit_clock_init(access_unit_clock_t *clock)
+{
+    memset(clock, 0, sizeof(*clock));
+}
+
+int64_t
+access_unit_clock_map(access_unit_clock_t *clock, uint64_t ntp_timestamp, int64_t arrival_ns)
+{
+    int64_t sender_ns = access_unit_ntp_to_ns(ntp_timestamp);
+    int64_t delta = arrival_ns - sender_ns;
+    int64_t step = sender_ns - clock->last_sender_ns;
+
+    if (!clock->anchored || step > ACCESS_UNIT_CLOCK_JUMP_NS || step < -ACCESS_UNIT_CLOCK_JUMP_NS) {
+        /* First packet or the sender's clock was reset */
+        clock->anchored = 1;
+        clock->window_min[0] = delta;
+        clock->window_min[1] = delta;
+        clock->window_count = 0;
+        clock->resets++;
+    } else {
+        if (delta < clock->window_min[0]) {
+            clock->window_min[0] = delta;
+        }
+        if (++clock->window_count == ACCESS_UNIT_CLOCK_WINDOW) {
+            /* Forget old minima so a sender clock running slow is followed too */
+            clock->window_min[1] = clock->window_min[0];
+            clock->window_min[0] = delta;
+            clock->window_count = 0;
+        }
+    }
+    clock->last_sender_ns = sender_ns;
+    clock->offset_ns = clock->window_min[0] < clock->window_min[1] ? clock->window_min[0] : clock->window_min[1];
+    return sender_ns + clock->offset_ns;
+}
+
+static int
+size_bucket(int len)
+{
+    int b = 0;
+
+    while (b < ACCESS_UNIT_SIZE_BUCKETS - 1 && len >= (1024 << b)) {
+        b++;
+    }
+    return b;
+}
+
+void
+access_unit_assembler_init(access_unit_assembler_t *assembler)
+{
+    memset(assembler, 0, sizeof(*assembler));
+    access_unit_clock_init(&assembler->clock);
+}
+
+void
+access_unit_assembler_set_codec(access_unit_assembler_t *assembler, int codec)
+{
+    assembler->codec = codec;
+}
+
+/* Flags for one H.264 NAL unit; records where parameter sets sit */
+static void
+classify_h264(const unsigned char *nal, int off, int len, access_unit_t *au)
+{
+    int type = nal[0] & 0x1f;
+
+    au->nal_types |= 1ull << type;
+    if (type == NAL_IDR || type == NAL_SLICE) {
+        au->flags |= ACCESS_UNIT_PICTURE;
+        if (type == NAL_IDR) {
+            au->flags |= ACCESS_UNIT_KEYFRAME;
+        }
+        if (nal[0] & 0x60) {
+            au->flags |= ACCESS_UNIT_REFERENCE;
+        }
+    } else if (type == NAL_SPS) {
+        au->flags |= ACCESS_UNIT_PARAMETER_SETS;
+        au->sps_off = off;
+        au->sps_len = len;
+    } else if (type == NAL_PPS) {
+        au->flags |= ACCESS_UNIT_PARAMETER_SETS;
+        au->pps_off = off;
+        au->pps_len = len;
+    }
+}
+
+/* Same for HEVC: every VCL type is a picture, IRAP types are keyframes */
+static void
+classify_hevc(const unsigned char *nal, int off, int len, access_unit_t *au)
+{
+    int type = HEVC_NAL_TYPE(nal[0]);
+
+    au->nal_types |= 1ull << type;
+    if (HEVC_NAL_IS_VCL(type)) {
+        au->flags |= ACCESS_UNIT_PICTURE;
+        if (HEVC_NAL_IS_IRAP(type)) {
+            au->flags |= ACCESS_UNIT_KEYFRAME;
+        }
+        /* Mirror streams are single-layer, so a sub-layer non-reference picture is never referenced */
+        if (!HEVC_NAL_IS_SUB_LAYER_NON_REF(type)) {
+            au->flags |= ACCESS_UNIT_REFERENCE;
+        }
+    } else if (type == HEVC_NAL_VPS) {
+        au->flags |= ACCESS_UNIT_PARAMETER_SETS;
+        au->vps_off = off;
+        au->vps_len = len;
+    } else if (type == HEVC_NAL_SPS) {
+        au->flags |= ACCESS_UNIT_PARAMETER_SETS;
+        au->sps_off = off;
+        au->sps_len = len;
+    } else if (type == HEVC_NAL_PPS) {
+        au->flags |= ACCESS_UNIT_PARAMETER_SETS;
+        au->pps_off = off;
+        au->pps_len = len;
+    }
+}
+
+int
+access_unit_assemble(access_unit_assembler_t *assembler, unsigned char *payload, int len,
+                     uint64_t ntp_timestamp, int64_t arrival_ns, access_unit_t *au)
+{
+    int pos = 0;
+
+    memset(au, 0, sizeof(*au));
+    au->data = payload;
+    while (len - pos >= 5) {
+        uint32_t nal_len = (uint32_t)payload[pos] << 24 | (uint32_t)payload[pos + 1] << 16 |
+                           (uint32_t)payload[pos + 2] << 8 | (uint32_t)payload[pos + 3];
+        int hevc = assembler->codec == ACCESS_UNIT_CODEC_HEVC;
+
+        /* Zero or overrunning length, shorter than the NAL header, or forbidden_zero_bit set:
+         * the rest is not trustworthy */
+        if (nal_len == 0 || nal_len > (uint32_t)(len - pos - 4) || (hevc && nal_len < 2) ||
+            (payload[pos + 4] & 0x80)) {
+            break;
+        }
+        if (hevc) {
+            classify_hevc(payload + pos + 4, pos + 4, (int)nal_len, au);
+        } else {
+            classify_h264(payload + pos + 4, pos + 4, (int)nal_len, au);
+        }
+
+        /* Length prefix becomes the start code: same size, so nothing moves */
+        payload[pos] = 0;
+        payload[pos + 1] = 0;
+        payload[pos + 2] = 0;
+        payload[pos + 3] = 1;
+        pos += 4 + (int)nal_len;
+        au->nal_count++;
+    }
+
+    if (au->nal_count == 0) {
+        assembler->dropped++;
+        return -1;
+    }
+    if (pos < len) {
+        au->flags |= ACCESS_UNIT_TRUNCATED;
+        assembler->truncated++;
+    }
+    au->len = pos;
+    au->ntp_timestamp = ntp_timestamp;
+    au->pts_ns = access_unit_clock_map(&assembler->clock, ntp_timestamp, arrival_ns);
+
+    assembler->units++;
+    assembler->nal_units += (unsigned long long)au->nal_count;
+    assembler->size_buckets[size_bucket(au->len)]++;
+    if (au->len > assembler->max_len) {
+        __atomic_store_n(&assembler->max_len, au->len, __ATOMIC_RELAXED);
+    }
+    if (au->flags & ACCESS_UNIT_KEYFRAME) {
+        assembler->keyframes++;
+        if (au->len > assembler->max_keyframe_len) {
+            __atomic_store_n(&assembler->max_keyframe_len, au->len, __ATOMIC_RELAXED);
+        }
+    }
+    return au->len;
+}
+
+int
+access_unit_input_size(const access_unit_assembler_t *assembler, int sps_bound)
+{
+    int64_t size;
+
+    if (__atomic_load_n(&assembler->max_keyframe_len, __ATOMIC_RELAXED) == 0) {
+        return sps_bound;
+    }
+    size = 2 * (int64_t)__atomic_load_n(&assembler->max_len, __ATOMIC_RELAXED);
+    if (size < sps_bound / 4) {
+        size = sps_bound / 4;
+    }
+    if (size < ACCESS_UNIT_MIN_INPUT_SIZE) {
+        size = ACCESS_UNIT_MIN_INPUT_SIZE;
+    }
+    size = (size + ACCESS_UNIT_INPUT_ALIGN - 1) / ACCESS_UNIT_INPUT_ALIGN * ACCESS_UNIT_INPUT_ALIGN;
+    return size < INT32_MAX ? (int)size : INT32_MAX;
+}
+
+int
+access_unit_size_percentile(const access_unit_assembler_t *assembler, double p)
+{
+    unsigned long long total = 0, seen = 0;
+    double rank;
+    int b;
+
+    for (b = 0; b < ACCESS_UNIT_SIZE_BUCKETS; b++) {
+        total += assembler->size_buckets[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = p / 100.0 * (double)total;
+    for (b = 0; b < ACCESS_UNIT_SIZE_BUCKETS - 1; b++) {
+        seen += assembler->size_buckets[b];
+        if ((double)seen >= rank && seen > 0) {
+            return 1024 << b;
+        }
+    }
+    return assembler->max_len;      /* open-ended last bucket */
+}
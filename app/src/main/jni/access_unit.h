@@ -0,0 +1,119 @@
+/**
+ * Access-unit assembler for the mirror video stream
+ *
+ * A decrypted video packet carries every NAL unit of one frame, each behind a
+ * 4-byte big-endian length (AVCC). The assembler rewrites those lengths into
+ * Annex-B start codes in place, so the packet's pooled buffer becomes one
+ * contiguous access unit the decoder can take as a single input, and tags it
+ * with what it contains (IDR, parameter sets, slices, whether any slice is a
+ * reference) and where the SPS and PPS sit, so callers never walk the NAL
+ * units themselves. HEVC streams take the same path once the assembler is
+ * switched to ACCESS_UNIT_CODEC_HEVC: 2-byte NAL headers, IRAP pictures as
+ * keyframes, and the VPS located alongside the SPS and PPS.
+ *
+ * The packet header's timestamp (bytes 8-15, NTP-style 32.32 seconds on the
+ * sender's clock) is mapped to local CLOCK_MONOTONIC time, the base of
+ * System.nanoTime() and MediaCodec render timestamps. With no clock sync
+ * channel, the mapping is the smallest arrival-minus-send offset seen over a
+ * sliding window: presentation times keep the sender's frame spacing, sit at
+ * the fastest observed transit, and follow drift in either direction within
+ * two windows. A sender clock jump re-anchors the mapping.
+ *
+ * Access-unit sizes go into a power-of-two histogram. Once a keyframe has been
+ * seen, access_unit_input_size sizes the next decoder's input buffers from
+ * them instead of the SPS's worst case, which is several times larger than
+ * what a mirroring encoder produces.
+ */
+
+#ifndef ACCESS_UNIT_H
+#define ACCESS_UNIT_H
+
+#include <stdint.h>
+
+#define ACCESS_UNIT_KEYFRAME 0x01           /* contains an IDR slice (HEVC: an IRAP picture) */
+#define ACCESS_UNIT_PARAMETER_SETS 0x02     /* contains an SPS and/or PPS (HEVC: or VPS) */
+#define ACCESS_UNIT_PICTURE 0x04            /* contains at least one slice */
+#define ACCESS_UNIT_TRUNCATED 0x08          /* bytes after the last valid NAL unit were dropped */
+#define ACCESS_UNIT_REFERENCE 0x10          /* a slice has nal_ref_idc != 0 (HEVC: is not a *_N type):
+                                               later frames may depend on it */
+
+#define ACCESS_UNIT_CODEC_H264 0
+#define ACCESS_UNIT_CODEC_HEVC 1
+
+#define ACCESS_UNIT_CLOCK_WINDOW 128        /* packets per offset window */
+#define ACCESS_UNIT_CLOCK_JUMP_NS (5 * 1000000000LL)
+
+#define ACCESS_UNIT_SIZE_BUCKETS 16         /* bucket b: sizes below 1 KB << b (the last open-ended) */
+#define ACCESS_UNIT_MIN_INPUT_SIZE (256 * 1024)
+#define ACCESS_UNIT_INPUT_ALIGN (64 * 1024)
+
+typedef struct {
+    int anchored;
+    int64_t last_sender_ns;
+    int64_t offset_ns;                      /* local = sender + offset */
+    int64_t window_min[2];                  /* current and previous window */
+    int window_count;
+    unsigned long long resets;
+} access_unit_clock_t;
+
+typedef struct {
+    unsigned char *data;        /* Annex-B, in the packet's buffer */
+    int len;
+    int flags;
+    int nal_count;
+    uint64_t nal_types;         /* bit n set when NAL type n is present */
+    int vps_off;                /* NAL unit without start code; len 0 when absent */
+    int vps_len;
+    int sps_off;
+    int sps_len;
+    int pps_off;
+    int pps_len;
+    uint64_t ntp_timestamp;     /* the header value */
+    int64_t pts_ns;             /* local CLOCK_MONOTONIC presentation time */
+} access_unit_t;
+
+typedef struct {
+    access_unit_clock_t clock;
+    int codec;                          /* ACCESS_UNIT_CODEC_* */
+    unsigned long long units;
+    unsigned long long keyframes;
+    unsigned long long nal_units;
+    unsigned long long truncated;
+    unsigned long long dropped;         /* no valid NAL unit at all */
+    unsigned long long size_buckets[ACCESS_UNIT_SIZE_BUCKETS];
+    int max_len;                        /* largest access unit (any thread may read it) */
+    int max_keyframe_len;
+} access_unit_assembler_t;
+
+/* Sender timestamp from a 128-byte mirror packet header */
+uint64_t access_unit_header_timestamp(const unsigned char *header);
+
+/* 32.32 fixed-point seconds to nanoseconds */
+int64_t access_unit_ntp_to_ns(uint64_t ntp);
+
+void access_unit_clock_init(access_unit_clock_t *clock);
+
+/* Local time for a sender timestamp that arrived at arrival_ns (CLOCK_MONOTONIC) */
+int64_t access_unit_clock_map(access_unit_clock_t *clock, uint64_t ntp_timestamp, int64_t arrival_ns);
+
+void access_unit_assembler_init(access_unit_assembler_t *assembler);
+
+/* How payloads are classified from now on; a new stream starts as H.264 */
+void access_unit_assembler_set_codec(access_unit_assembler_t *assembler, int codec);
+
+/* Turns a decrypted length-prefixed (AVCC / hvcC style) video payload into one Annex-B access unit in place and
+ * fills au. A corrupt NAL length ends the unit there (ACCESS_UNIT_TRUNCATED).
+ * Returns au->len, or -1 when the payload has no valid NAL unit. */
+int access_unit_assemble(access_unit_assembler_t *assembler, unsigned char *payload, int len,
+                         uint64_t ntp_timestamp, int64_t arrival_ns, access_unit_t *au);
+
+/* Decoder input buffer size for this stream: sps_bound (the SPS's worst case) until a keyframe has been
+ * assembled, then twice the largest access unit so far, at least a quarter of sps_bound and
+ * ACCESS_UNIT_MIN_INPUT_SIZE, rounded up to ACCESS_UNIT_INPUT_ALIGN. Exceeds sps_bound only for a sender
+ * overshooting its level. Safe to call from any thread. */
+int access_unit_input_size(const access_unit_assembler_t *assembler, int sps_bound);
+
+/* Smallest power-of-two size bound with at least p percent of the access units at or below it; 0 when none */
+int access_unit_size_percentile(const access_unit_assembler_t *assembler, double p);
+
+#endif // ACCESS_UNIT_H
@@ -0,0 +1,163 @@
+#include <jni.h>
+#include <android/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include "access_unit.h"
+
+#define LOG_TAG "AccessUnitJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeAssemble (must match AccessUnitAssembler.kt) */
+#define OUT_PTS_NS 0
+#define OUT_FLAGS 1
+#define OUT_NAL_COUNT 2
+#define OUT_SPS 3
+#define OUT_PPS 5
+#define OUT_VPS 7
+#define OUT_LEN 9
+
+/* Layout of the long[] filled by nativeGetStats */
+#define STATS_LEN 10
+
+/**
+ * Allocate an assembler for one video stream
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeCreate(JNIEnv *env, jobject thiz) {
+    access_unit_assembler_t *assembler = malloc(sizeof(access_unit_assembler_t));
+    if (assembler == NULL) {
+        LOGE("Failed to allocate access-unit assembler");
+        return 0;
+    }
+    access_unit_assembler_init(assembler);
+    return (jlong)assembler;
+}
+
+/**
+ * Switch NAL unit classification for the following payloads
+ * Input: codec = ACCESS_UNIT_CODEC_H264 or ACCESS_UNIT_CODEC_HEVC, from the stream's config packet
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeSetCodec(JNIEnv *env, jobject thiz, jlong handle,
+                                                                      jint codec) {
+    access_unit_assembler_t *assembler = (access_unit_assembler_t *)handle;
+    if (assembler != NULL) {
+        access_unit_assembler_set_codec(assembler, codec);
+    }
+}
+
+/**
+ * Rewrite a decrypted length-prefixed payload into one Annex-B access unit in place
+ * Input: buffer = direct buffer holding the payload at position 0, length = payload bytes,
+ *        ntpTimestamp = header bytes 8-15, arrivalNs = CLOCK_MONOTONIC time the reader thread queued the packet
+ *        (frame_queue enqueue_ns), so time spent waiting for the decoder thread is not taken for network delay
+ * Output: access-unit length (bytes 0..length of buffer), out = pts (CLOCK_MONOTONIC ns),
+ *         flags, NAL count, SPS (offset, length), PPS (offset, length), VPS (offset, length; HEVC only);
+ *         -1 if no valid NAL unit
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeAssemble(JNIEnv *env, jobject thiz, jlong handle,
+                                                                      jobject buffer, jint length,
+                                                                      jlong ntp_timestamp, jlong arrival_ns,
+                                                                      jlongArray out) {
+    access_unit_assembler_t *assembler = (access_unit_assembler_t *)handle;
+    access_unit_t au;
+
+    if (assembler == NULL || (*env)->GetArrayLength(env, out) < OUT_LEN) {
+        LOGE("Invalid access-unit assembler handle or output array");
+        return -1;
+    }
+    unsigned char *data = (*env)->GetDirectBufferAddress(env, buffer);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+    if (data == NULL || length < 0 || length > capacity) {
+        LOGE("Invalid direct buffer for access unit (length %d, capacity %lld)", length, (long long)capacity);
+        return -1;
+    }
+
+    int n = access_unit_assemble(assembler, data, length, (uint64_t)ntp_timestamp, (int64_t)arrival_ns, &au);
+    if (n < 0) {
+        return -1;
+    }
+
+    jlong fields[OUT_LEN];
+    fields[OUT_PTS_NS] = au.pts_ns;
+    fields[OUT_FLAGS] = au.flags;
+    fields[OUT_NAL_COUNT] = au.nal_count;
+    fields[OUT_SPS] = au.sps_off;
+    fields[OUT_SPS + 1] = au.sps_len;
+    fields[OUT_PPS] = au.pps_off;
+    fields[OUT_PPS + 1] = au.pps_len;
+    fields[OUT_VPS] = au.vps_off;
+    fields[OUT_VPS + 1] = au.vps_len;
+    (*env)->SetLongArrayRegion(env, out, 0, OUT_LEN, fields);
+    return n;
+}
+
+/**
+ * Copy an assembled access unit into a decoder input buffer
+ * Input: src = payload buffer holding it from offset 0, length = its bytes,
+ *        dst = direct codec input buffer, written from offset 0
+ * Output: length, or -1 when either buffer is not direct or dst is too small (dst untouched)
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeCopy(JNIEnv *env, jobject thiz, jobject src,
+                                                                  jint length, jobject dst) {
+    unsigned char *from = (*env)->GetDirectBufferAddress(env, src);
+    unsigned char *to = (*env)->GetDirectBufferAddress(env, dst);
+
+    if (from == NULL || to == NULL || length < 0 || length > (*env)->GetDirectBufferCapacity(env, src) ||
+        length > (*env)->GetDirectBufferCapacity(env, dst)) {
+        return -1;
+    }
+    memcpy(to, from, (size_t)length);
+    return length;
+}
+
+/**
+ * Decoder input buffer size from the access units seen so far
+ * Input: spsBound = the SPS's worst-case access unit (H264ParameterSets / HevcParameterSets maxInputSize)
+ * Output: bytes for KEY_MAX_INPUT_SIZE
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeInputSize(JNIEnv *env, jobject thiz, jlong handle,
+                                                                       jint sps_bound) {
+    access_unit_assembler_t *assembler = (access_unit_assembler_t *)handle;
+    return assembler != NULL ? access_unit_input_size(assembler, sps_bound) : sps_bound;
+}
+
+/**
+ * Snapshot of the assembler counters
+ * Output: out = units, keyframes, NAL units, truncated, dropped, clock resets, clock offset (ns),
+ *         largest access unit, p50 and p99 access-unit size bounds (bytes)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle,
+                                                                      jlongArray out) {
+    access_unit_assembler_t *assembler = (access_unit_assembler_t *)handle;
+    jlong values[STATS_LEN];
+
+    if (assembler == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    values[0] = (jlong)assembler->units;
+    values[1] = (jlong)assembler->keyframes;
+    values[2] = (jlong)assembler->nal_units;
+    values[3] = (jlong)assembler->truncated;
+    values[4] = (jlong)assembler->dropped;
+    values[5] = (jlong)assembler->clock.resets;
+    values[6] = assembler->clock.offset_ns;
+    values[7] = assembler->max_len;
+    values[8] = access_unit_size_percentile(assembler, 50);
+    values[9] = access_unit_size_percentile(assembler, 99);
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * Free an assembler from nativeCreate
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_AccessUnitAssembler_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    free((access_unit_assembler_t *)handle);
+}
@@ -0,0 +1,180 @@
+/**
+ * SETUP / stream request bodies and their responses
+ */
+
+#include <string.h>
+
+#include "airplay_setup.h"
+
+static void
+set_span(const bplist_t *pl, int obj, airplay_setup_span_t *span)
+{
+    int type = bplist_type(pl, obj);
+    int off, len;
+
+    if ((type == BPLIST_DATA || type == BPLIST_STRING || type == BPLIST_UTF16_STRING) &&
+        bplist_get_span(pl, obj, &off, &len) == 0) {
+        span->off = off;
+        span->len = len;
+        span->utf16 = type == BPLIST_UTF16_STRING;
+    }
+}
+
+static void
+clear_span(airplay_setup_span_t *span)
+{
+    span->off = -1;
+    span->len = 0;
+    span->utf16 = 0;
+}
+
+/* Compares an ASCII key object against a literal without going through strlen */
+#define KEY_IS(key_off, key_len, pl, lit) \
+    ((key_len) == (int)sizeof(lit) - 1 && memcmp((pl)->data + (key_off), lit, sizeof(lit) - 1) == 0)
+
+static void
+parse_stream(const bplist_t *pl, int dict, airplay_setup_stream_t *stream)
+{
+    int count = bplist_count(pl, dict);
+    int i, key, value, key_off, key_len;
+
+    stream->type = -1;
+    stream->stream_connection_id = 0;
+    stream->has_stream_connection_id = 0;
+    stream->control_port = -1;
+    for (i = 0; i < count; i++) {
+        if (bplist_dict_entry(pl, dict, i, &key, &value) < 0 || bplist_type(pl, key) != BPLIST_STRING ||
+            bplist_get_span(pl, key, &key_off, &key_len) < 0) {
+            continue;
+        }
+        if (KEY_IS(key_off, key_len, pl, "type")) {
+            bplist_get_int(pl, value, &stream->type);
+        } else if (KEY_IS(key_off, key_len, pl, "streamConnectionID")) {
+            stream->has_stream_connection_id = bplist_get_int(pl, value, &stream->stream_connection_id) == 0;
+        } else if (KEY_IS(key_off, key_len, pl, "controlPort")) {
+            bplist_get_int(pl, value, &stream->control_port);
+        }
+    }
+}
+
+int
+airplay_setup_parse(airplay_setup_t *setup, const unsigned char *body, int len)
+{
+    bplist_t pl;
+    int count, i, key, value, key_off, key_len;
+    int64_t flag;
+
+    clear_span(&setup->ekey);
+    clear_span(&setup->eiv);
+    clear_span(&setup->device_id);
+    clear_span(&setup->model);
+    clear_span(&setup->name);
+    clear_span(&setup->session_uuid);
+    clear_span(&setup->os_name);
+    clear_span(&setup->os_version);
+    setup->timing_port = -1;
+    setup->is_screen_mirroring = -1;
+    setup->stream_count = 0;
+
+    if (bplist_open(&pl, body, len) < 0 || bplist_type(&pl, pl.root) != BPLIST_DICT) {
+        return -1;
+    }
+
+    /* Single pass over the root: each key is matched once, unknown keys are skipped
+     * without decoding their values */
+    count = bplist_count(&pl, pl.root);
+    for (i = 0; i < count; i++) {
+        if (bplist_dict_entry(&pl, pl.root, i, &key, &value) < 0 || bplist_type(&pl, key) != BPLIST_STRING ||
+            bplist_get_span(&pl, key, &key_off, &key_len) < 0) {
+            continue;
+        }
+        if (KEY_IS(key_off, key_len, &pl, "ekey")) {
+            set_span(&pl, value, &setup->ekey);
+        } else if (KEY_IS(key_off, key_len, &pl, "eiv")) {
+            set_span(&pl, value, &setup->eiv);
+        } else if (KEY_IS(key_off, key_len, &pl, "deviceID")) {
+            set_span(&pl, value, &setup->device_id);
+        } else if (KEY_IS(key_off, key_len, &pl, "model")) {
+            set_span(&pl, value, &setup->model);
+        } else if (KEY_IS(key_off, key_len, &pl, "name")) {
+            set_span(&pl, value, &setup->name);
+        } else if (KEY_IS(key_off, key_len, &pl, "sessionUUID")) {
+            set_span(&pl, value, &setup->session_uuid);
+        } else if (KEY_IS(key_off, key_len, &pl, "osName")) {
+            set_span(&pl, value, &setup->os_name);
+        } else if (KEY_IS(key_off, key_len, &pl, "osVersion")) {
+            set_span(&pl, value, &setup->os_version);
+        } else if (KEY_IS(key_off, key_len, &pl, "timingPort")) {
+            bplist_get_int(&pl, value, &setup->timing_port);
+        } else if (KEY_IS(key_off, key_len, &pl, "isScreenMirroringSession")) {
+            if (bplist_get_int(&pl, value, &flag) == 0) {
+                setup->is_screen_mirroring = flag != 0;
+            }
+        } else if (KEY_IS(key_off, key_len, &pl, "streams")) {
+            int streams = bplist_count(&pl, value);
+            int s;
+            for (s = 0; s < streams && setup->stream_count < AIRPLAY_SETUP_MAX_STREAMS; s++) {
+                int item = bplist_array_item(&pl, value, s);
+                if (bplist_type(&pl, item) == BPLIST_DICT) {
+                    parse_stream(&pl, item, &setup->streams[setup->stream_count++]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int
+airplay_setup_write_session_reply(unsigned char *buf, int cap, int event_port, int timing_port)
+{
+    bplist_writer_t w;
+    int keys[2], values[2];
+
+    bplist_writer_init(&w, buf, cap);
+    keys[0] = bplist_write_string(&w, "eventPort");
+    values[0] = bplist_write_int(&w, event_port);
+    keys[1] = bplist_write_string(&w, "timingPort");
+    values[1] = bplist_write_int(&w, timing_port);
+    return bplist_writer_finish(&w, bplist_write_dict(&w, keys, values, 2));
+}
+
+int
+airplay_setup_write_streams_reply(unsigned char *buf, int cap, const airplay_stream_reply_t *streams, int count)
+{
+    bplist_writer_t w;
+    int items[AIRPLAY_SETUP_MAX_STREAMS];
+    int keys[4], values[4];
+    int key_type, key_data_port, key_control_port, key_server_port, key_streams;
+    int i;
+
+    if (count < 0 || count > AIRPLAY_SETUP_MAX_STREAMS) {
+        return -1;
+    }
+    bplist_writer_init(&w, buf, cap);
+    /* Keys are shared by every stream entry */
+    key_type = bplist_write_string(&w, "type");
+    key_data_port = bplist_write_string(&w, "dataPort");
+    key_control_port = bplist_write_string(&w, "controlPort");
+    key_server_port = bplist_write_string(&w, "serverPort");
+    for (i = 0; i < count; i++) {
+        int n = 0;
+        keys[n] = key_type;
+        values[n++] = bplist_write_int(&w, streams[i].type);
+        if (streams[i].data_port) {
+            keys[n] = key_data_port;
+            values[n++] = bplist_write_int(&w, streams[i].data_port);
+        }
+        if (streams[i].control_port) {
+            keys[n] = key_control_port;
+            values[n++] = bplist_write_int(&w, streams[i].control_port);
+        }
+        if (streams[i].server_port) {
+            keys[n] = key_server_port;
+            values[n++] = bplist_write_int(&w, streams[i].server_port);
+        }
+        items[i] = bplist_write_dict(&w, keys, values, n);
+    }
+    key_streams = bplist_write_string(&w, "streams");
+    values[0] = bplist_write_array(&w, items, count);
+    return bplist_writer_finish(&w, bplist_write_dict(&w, &key_streams, values, 1));
+}
@@ -0,0 +1,64 @@
+/**
+ * SETUP / stream request bodies and their responses
+ *
+ * airplay_setup_parse() walks the root dictionary of a SETUP (or POST /stream)
+ * bplist once and records every field the receiver uses: data and strings as
+ * spans into the body, numbers as values. Nothing is allocated and the body
+ * must outlive the result.
+ */
+
+#ifndef AIRPLAY_SETUP_H
+#define AIRPLAY_SETUP_H
+
+#include <stdint.h>
+
+#include "bplist.h"
+
+#define AIRPLAY_SETUP_MAX_STREAMS 4
+
+typedef struct {
+    int off;        /* -1 when absent */
+    int len;
+    int utf16;      /* string stored as big-endian UTF-16 */
+} airplay_setup_span_t;
+
+typedef struct {
+    int64_t type;                   /* 110 mirroring, 96 audio; -1 when absent */
+    int64_t stream_connection_id;   /* unsigned on the wire */
+    int has_stream_connection_id;
+    int64_t control_port;           /* -1 when absent */
+} airplay_setup_stream_t;
+
+typedef struct {
+    airplay_setup_span_t ekey;
+    airplay_setup_span_t eiv;
+    airplay_setup_span_t device_id;
+    airplay_setup_span_t model;
+    airplay_setup_span_t name;
+    airplay_setup_span_t session_uuid;
+    airplay_setup_span_t os_name;
+    airplay_setup_span_t os_version;
+    int64_t timing_port;            /* -1 when absent */
+    int is_screen_mirroring;        /* -1 when absent */
+    int stream_count;               /* entries in "streams", capped at AIRPLAY_SETUP_MAX_STREAMS */
+    airplay_setup_stream_t streams[AIRPLAY_SETUP_MAX_STREAMS];
+} airplay_setup_t;
+
+/* Returns 0 when body is a bplist whose root is a dictionary, -1 otherwise */
+int airplay_setup_parse(airplay_setup_t *setup, const unsigned char *body, int len);
+
+/* One entry of a stream SETUP response; zero ports are left out */
+typedef struct {
+    int type;
+    int data_port;
+    int control_port;
+    int server_port;
+} airplay_stream_reply_t;
+
+/* { eventPort, timingPort }; returns the body length or -1 if cap is too small */
+int airplay_setup_write_session_reply(unsigned char *buf, int cap, int event_port, int timing_port);
+
+/* { streams: [ { type, dataPort, ... } ] }; returns the body length or -1 */
+int airplay_setup_write_streams_reply(unsigned char *buf, int cap, const airplay_stream_reply_t *streams, int count);
+
+#endif // AIRPLAY_SETUP_H
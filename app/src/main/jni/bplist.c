@@ -0,0 +1,503 @@
+/**
+ * Binary property list (bplist00) reader and writer
+ */
+
+#include <string.h>
+
+#include "bplist.h"
+
+#define BPLIST_HEADER_LEN 8
+#define BPLIST_TRAILER_LEN 32
+
+static uint64_t
+read_be(const unsigned char *p, int size)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* Offset of obj's marker byte, -1 for a bad index or an offset outside the object area */
+static int
+object_offset(const bplist_t *pl, int obj)
+{
+    uint64_t off;
+
+    if (obj < 0 || obj >= pl->num_objects) {
+        return -1;
+    }
+    off = read_be(pl->data + pl->offset_table + (int64_t)obj * pl->offset_size, pl->offset_size);
+    if (off < BPLIST_HEADER_LEN || off >= (uint64_t)pl->offset_table) {
+        return -1;
+    }
+    return (int)off;
+}
+
+/* Decodes the element/byte count after a marker (inline nibble or a following int
+ * object) and checks that count * unit payload bytes fit; returns the payload
+ * offset or -1 */
+static int
+read_count(const bplist_t *pl, int off, int unit, int *count)
+{
+    int low = pl->data[off] & 0x0f;
+    int payload = off + 1;
+    uint64_t n = (uint64_t)low;
+
+    if (low == 0x0f) {
+        int size;
+        if (payload >= pl->offset_table || (pl->data[payload] & 0xf0) != 0x10) {
+            return -1;
+        }
+        size = 1 << (pl->data[payload] & 0x0f);
+        if (size > 8 || payload + 1 + size > pl->offset_table) {
+            return -1;
+        }
+        n = read_be(pl->data + payload + 1, size);
+        payload += 1 + size;
+    }
+    if (n > (uint64_t)(pl->offset_table - payload) / (unsigned)unit) {
+        return -1;
+    }
+    *count = (int)n;
+    return payload;
+}
+
+/* Reads the idx-th object reference of a container payload */
+static int
+read_ref(const bplist_t *pl, int payload, int idx)
+{
+    uint64_t ref = read_be(pl->data + payload + (int64_t)idx * pl->ref_size, pl->ref_size);
+    return ref < (uint64_t)pl->num_objects ? (int)ref : -1;
+}
+
+int
+bplist_open(bplist_t *pl, const unsigned char *data, int len)
+{
+    const unsigned char *trailer;
+    uint64_t num_objects, root, table;
+
+    memset(pl, 0, sizeof(*pl));
+    if (!data || len < BPLIST_HEADER_LEN + 1 + BPLIST_TRAILER_LEN || memcmp(data, "bplist0", 7) != 0) {
+        return -1;
+    }
+    trailer = data + len - BPLIST_TRAILER_LEN;
+    pl->offset_size = trailer[6];
+    pl->ref_size = trailer[7];
+    num_objects = read_be(trailer + 8, 8);
+    root = read_be(trailer + 16, 8);
+    table = read_be(trailer + 24, 8);
+
+    if (pl->offset_size < 1 || pl->offset_size > 8 || pl->ref_size < 1 || pl->ref_size > 8) {
+        return -1;
+    }
+    if (num_objects == 0 || root >= num_objects || table < BPLIST_HEADER_LEN + 1 ||
+        table >= (uint64_t)(len - BPLIST_TRAILER_LEN) ||
+        num_objects > ((uint64_t)(len - BPLIST_TRAILER_LEN) - table) / (unsigned)pl->offset_size) {
+        return -1;
+    }
+    pl->data = data;
+    pl->len = len;
+    pl->num_objects = (int)num_objects;
+    pl->root = (int)root;
+    pl->offset_table = (int)table;
+    return 0;
+}
+
+int
+bplist_type(const bplist_t *pl, int obj)
+{
+    int off = object_offset(pl, obj);
+    if (off < 0) {
+        return BPLIST_INVALID;
+    }
+    unsigned char marker = pl->data[off];
+    switch (marker >> 4) {
+    case 0x0:
+        if (marker == 0x00) {
+            return BPLIST_NULL;
+        }
+        return (marker == 0x08 || marker == 0x09) ? BPLIST_BOOL : BPLIST_INVALID;
+    case 0x1: return BPLIST_INT;
+    case 0x2: return BPLIST_REAL;
+    case 0x3: return marker == 0x33 ? BPLIST_DATE : BPLIST_INVALID;
+    case 0x4: return BPLIST_DATA;
+    case 0x5: return BPLIST_STRING;
+    case 0x6: return BPLIST_UTF16_STRING;
+    case 0x8: return BPLIST_UID;
+    case 0xa: return BPLIST_ARRAY;
+    case 0xd: return BPLIST_DICT;
+    default: return BPLIST_INVALID;
+    }
+}
+
+int
+bplist_count(const bplist_t *pl, int obj)
+{
+    int off = object_offset(pl, obj);
+    int count;
+
+    if (off < 0) {
+        return -1;
+    }
+    switch (pl->data[off] >> 4) {
+    case 0xa:
+        return read_count(pl, off, pl->ref_size, &count) < 0 ? -1 : count;
+    case 0xd:
+        return read_count(pl, off, 2 * pl->ref_size, &count) < 0 ? -1 : count;
+    default:
+        return -1;
+    }
+}
+
+int
+bplist_array_item(const bplist_t *pl, int array, int idx)
+{
+    int off = object_offset(pl, array);
+    int payload, count;
+
+    if (off < 0 || (pl->data[off] >> 4) != 0xa) {
+        return -1;
+    }
+    payload = read_count(pl, off, pl->ref_size, &count);
+    if (payload < 0 || idx < 0 || idx >= count) {
+        return -1;
+    }
+    return read_ref(pl, payload, idx);
+}
+
+int
+bplist_dict_entry(const bplist_t *pl, int dict, int idx, int *key, int *value)
+{
+    int off = object_offset(pl, dict);
+    int payload, count;
+
+    if (off < 0 || (pl->data[off] >> 4) != 0xd) {
+        return -1;
+    }
+    payload = read_count(pl, off, 2 * pl->ref_size, &count);
+    if (payload < 0 || idx < 0 || idx >= count) {
+        return -1;
+    }
+    *key = read_ref(pl, payload, idx);
+    *value = read_ref(pl, payload, count + idx);
+    return (*key < 0 || *value < 0) ? -1 : 0;
+}
+
+int
+bplist_string_equals(const bplist_t *pl, int obj, const char *key)
+{
+    int off = object_offset(pl, obj);
+    int payload, count, i;
+    size_t key_len = strlen(key);
+
+    if (off < 0) {
+        return 0;
+    }
+    switch (pl->data[off] >> 4) {
+    case 0x5:
+        payload = read_count(pl, off, 1, &count);
+        return payload >= 0 && (size_t)count == key_len && memcmp(pl->data + payload, key, key_len) == 0;
+    case 0x6:
+        payload = read_count(pl, off, 2, &count);
+        if (payload < 0 || (size_t)count != key_len) {
+            return 0;
+        }
+        for (i = 0; i < count; i++) {
+            if (pl->data[payload + 2 * i] != 0 || pl->data[payload + 2 * i + 1] != (unsigned char)key[i]) {
+                return 0;
+            }
+        }
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int
+bplist_dict_get(const bplist_t *pl, int dict, const char *key)
+{
+    int count = bplist_count(pl, dict);
+    int i, k, v;
+
+    for (i = 0; i < count; i++) {
+        if (bplist_dict_entry(pl, dict, i, &k, &v) == 0 && bplist_string_equals(pl, k, key)) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+int
+bplist_get_int(const bplist_t *pl, int obj, int64_t *value)
+{
+    int off = object_offset(pl, obj);
+    unsigned char marker;
+    int size;
+
+    if (off < 0) {
+        return -1;
+    }
+    marker = pl->data[off];
+    if (marker == 0x08 || marker == 0x09) {
+        *value = marker == 0x09;
+        return 0;
+    }
+    if ((marker >> 4) != 0x1 || (marker & 0x0f) > 4) {
+        return -1;
+    }
+    size = 1 << (marker & 0x0f);
+    if (off + 1 + size > pl->offset_table) {
+        return -1;
+    }
+    if (size == 16) {
+        /* Values above INT64_MAX; keep the low 64 bits like an unsigned read */
+        *value = (int64_t)read_be(pl->data + off + 1 + 8, 8);
+    } else {
+        *value = (int64_t)read_be(pl->data + off + 1, size);
+    }
+    return 0;
+}
+
+int
+bplist_get_span(const bplist_t *pl, int obj, int *off, int *len)
+{
+    int marker_off = object_offset(pl, obj);
+    int payload, count;
+
+    if (marker_off < 0) {
+        return -1;
+    }
+    switch (pl->data[marker_off] >> 4) {
+    case 0x4:
+    case 0x5:
+        payload = read_count(pl, marker_off, 1, &count);
+        break;
+    case 0x6:
+        payload = read_count(pl, marker_off, 2, &count);
+        count *= 2;
+        break;
+    default:
+        return -1;
+    }
+    if (payload < 0) {
+        return -1;
+    }
+    *off = payload;
+    *len = count;
+    return 0;
+}
+
+void
+bplist_writer_init(bplist_writer_t *w, unsigned char *buf, int cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->count = 0;
+    w->failed = 0;
+    if (cap < BPLIST_HEADER_LEN) {
+        w->failed = 1;
+        return;
+    }
+    memcpy(buf, "bplist00", BPLIST_HEADER_LEN);
+    w->len = BPLIST_HEADER_LEN;
+}
+
+static void
+put_be(unsigned char *p, uint64_t v, int size)
+{
+    int i;
+
+    for (i = size - 1; i >= 0; i--) {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+/* Records a new object at the current position with room for size bytes; returns its index */
+static int
+begin_object(bplist_writer_t *w, int size)
+{
+    if (w->failed || w->count >= BPLIST_WRITER_MAX_OBJECTS || size > w->cap - w->len) {
+        w->failed = 1;
+        return -1;
+    }
+    w->offsets[w->count] = w->len;
+    return w->count++;
+}
+
+/* Smallest int encoding: 1/2/4-byte unsigned, 8-byte signed for negatives and large values */
+static int
+int_size(int64_t value)
+{
+    if (value < 0 || value > 0xffffffffLL) {
+        return 8;
+    }
+    return value > 0xffff ? 4 : (value > 0xff ? 2 : 1);
+}
+
+static void
+put_int(bplist_writer_t *w, int64_t value)
+{
+    int size = int_size(value);
+    w->buf[w->len++] = (unsigned char)(0x10 | (size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3));
+    put_be(w->buf + w->len, (uint64_t)value, size);
+    w->len += size;
+}
+
+static int
+count_size(int count)
+{
+    return count < 15 ? 1 : 2 + int_size(count);
+}
+
+static void
+put_count(bplist_writer_t *w, int high, int count)
+{
+    if (count < 15) {
+        w->buf[w->len++] = (unsigned char)(high | count);
+    } else {
+        w->buf[w->len++] = (unsigned char)(high | 0x0f);
+        put_int(w, count);
+    }
+}
+
+int
+bplist_write_bool(bplist_writer_t *w, int value)
+{
+    int obj = begin_object(w, 1);
+    if (obj >= 0) {
+        w->buf[w->len++] = value ? 0x09 : 0x08;
+    }
+    return obj;
+}
+
+int
+bplist_write_int(bplist_writer_t *w, int64_t value)
+{
+    int obj = begin_object(w, 1 + int_size(value));
+    if (obj >= 0) {
+        put_int(w, value);
+    }
+    return obj;
+}
+
+int
+bplist_write_string(bplist_writer_t *w, const char *str)
+{
+    int len = (int)strlen(str);
+    int i, obj;
+
+    for (i = 0; i < len; i++) {
+        if ((unsigned char)str[i] >= 0x80) {
+            w->failed = 1;
+            return -1;
+        }
+    }
+    obj = begin_object(w, count_size(len) + len);
+    if (obj >= 0) {
+        put_count(w, 0x50, len);
+        memcpy(w->buf + w->len, str, len);
+        w->len += len;
+    }
+    return obj;
+}
+
+int
+bplist_write_data(bplist_writer_t *w, const unsigned char *data, int len)
+{
+    int obj = len < 0 ? -1 : begin_object(w, count_size(len) + len);
+    if (obj >= 0) {
+        put_count(w, 0x40, len);
+        if (len > 0) {
+            memcpy(w->buf + w->len, data, len);
+        }
+        w->len += len;
+    }
+    return obj;
+}
+
+static int
+refs_valid(bplist_writer_t *w, const int *refs, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (refs[i] < 0 || refs[i] >= w->count) {
+            w->failed = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+bplist_write_array(bplist_writer_t *w, const int *items, int count)
+{
+    int obj, i;
+
+    if (count < 0 || !refs_valid(w, items, count)) {
+        w->failed = 1;
+        return -1;
+    }
+    obj = begin_object(w, count_size(count) + count);
+    if (obj >= 0) {
+        put_count(w, 0xa0, count);
+        for (i = 0; i < count; i++) {
+            w->buf[w->len++] = (unsigned char)items[i];
+        }
+    }
+    return obj;
+}
+
+int
+bplist_write_dict(bplist_writer_t *w, const int *keys, const int *values, int count)
+{
+    int obj, i;
+
+    if (count < 0 || !refs_valid(w, keys, count) || !refs_valid(w, values, count)) {
+        w->failed = 1;
+        return -1;
+    }
+    obj = begin_object(w, count_size(count) + 2 * count);
+    if (obj >= 0) {
+        put_count(w, 0xd0, count);
+        for (i = 0; i < count; i++) {
+            w->buf[w->len++] = (unsigned char)keys[i];
+        }
+        for (i = 0; i < count; i++) {
+            w->buf[w->len++] = (unsigned char)values[i];
+        }
+    }
+    return obj;
+}
+
+int
+bplist_writer_finish(bplist_writer_t *w, int root)
+{
+    int table = w->len;
+    int offset_size = table > 0xffff ? 4 : (table > 0xff ? 2 : 1);
+    int i;
+
+    if (w->failed || root < 0 || root >= w->count ||
+        w->count * offset_size + BPLIST_TRAILER_LEN > w->cap - w->len) {
+        w->failed = 1;
+        return -1;
+    }
+    for (i = 0; i < w->count; i++) {
+        put_be(w->buf + w->len, (uint64_t)w->offsets[i], offset_size);
+        w->len += offset_size;
+    }
+    memset(w->buf + w->len, 0, 6);
+    w->buf[w->len + 6] = (unsigned char)offset_size;
+    w->buf[w->len + 7] = 1;
+    put_be(w->buf + w->len + 8, (uint64_t)w->count, 8);
+    put_be(w->buf + w->len + 16, (uint64_t)root, 8);
+    put_be(w->buf + w->len + 24, (uint64_t)table, 8);
+    w->len += BPLIST_TRAILER_LEN;
+    return w->len;
+}
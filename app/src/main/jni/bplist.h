@@ -0,0 +1,99 @@
+/**
+ * Binary property list (bplist00) reader and writer
+ *
+ * The reader works on the body in place: bplist_open() validates the trailer
+ * once and objects are resolved through the offset table only when looked up,
+ * so pulling a handful of keys out of a SETUP body touches just those objects
+ * and allocates nothing. Objects are referred to by their index in the offset
+ * table.
+ *
+ * The writer serializes small documents (SETUP and stream responses) into a
+ * caller-supplied buffer. Objects are written leaves first and containers
+ * reference the indices returned for their children.
+ */
+
+#ifndef BPLIST_H
+#define BPLIST_H
+
+#include <stdint.h>
+
+enum {
+    BPLIST_INVALID = -1,
+    BPLIST_NULL,
+    BPLIST_BOOL,
+    BPLIST_INT,
+    BPLIST_REAL,
+    BPLIST_DATE,
+    BPLIST_DATA,
+    BPLIST_STRING,          /* ASCII */
+    BPLIST_UTF16_STRING,    /* big-endian UTF-16 */
+    BPLIST_UID,
+    BPLIST_ARRAY,
+    BPLIST_DICT
+};
+
+typedef struct {
+    const unsigned char *data;
+    int len;
+    int offset_size;
+    int ref_size;
+    int num_objects;
+    int root;
+    int offset_table;
+} bplist_t;
+
+/* Returns 0 if data is a well-formed bplist00 header and trailer, -1 otherwise */
+int bplist_open(bplist_t *pl, const unsigned char *data, int len);
+
+/* BPLIST_* type of obj, BPLIST_INVALID for a bad index or marker */
+int bplist_type(const bplist_t *pl, int obj);
+
+/* Number of entries in an array or dict, -1 otherwise */
+int bplist_count(const bplist_t *pl, int obj);
+
+/* Object index of the idx-th array element, -1 when out of range */
+int bplist_array_item(const bplist_t *pl, int array, int idx);
+
+/* Key and value object indices of the idx-th dict entry; 0 or -1 */
+int bplist_dict_entry(const bplist_t *pl, int dict, int idx, int *key, int *value);
+
+/* Value object index for an ASCII key, -1 when absent */
+int bplist_dict_get(const bplist_t *pl, int dict, const char *key);
+
+/* 1 if obj is a string (ASCII or UTF-16) equal to the ASCII key */
+int bplist_string_equals(const bplist_t *pl, int obj, const char *key);
+
+/* Integers (16-byte ones are truncated to their low 64 bits) and booleans; 0 or -1 */
+int bplist_get_int(const bplist_t *pl, int obj, int64_t *value);
+
+/* Byte span of a data or string object within pl->data (UTF-16 spans are 2 bytes
+ * per unit); 0 or -1 */
+int bplist_get_span(const bplist_t *pl, int obj, int *off, int *len);
+
+#define BPLIST_WRITER_MAX_OBJECTS 255   /* one-byte object references */
+
+typedef struct {
+    unsigned char *buf;
+    int cap;
+    int len;
+    int count;
+    int failed;
+    int offsets[BPLIST_WRITER_MAX_OBJECTS];
+} bplist_writer_t;
+
+void bplist_writer_init(bplist_writer_t *w, unsigned char *buf, int cap);
+
+/* Each returns the new object's index, or -1 once the buffer or object table is
+ * full. Passing -1 as a child index fails the container, so a document can be
+ * built without checking every call and validated once by bplist_writer_finish(). */
+int bplist_write_bool(bplist_writer_t *w, int value);
+int bplist_write_int(bplist_writer_t *w, int64_t value);
+int bplist_write_string(bplist_writer_t *w, const char *str);    /* ASCII only */
+int bplist_write_data(bplist_writer_t *w, const unsigned char *data, int len);
+int bplist_write_array(bplist_writer_t *w, const int *items, int count);
+int bplist_write_dict(bplist_writer_t *w, const int *keys, const int *values, int count);
+
+/* Appends the offset table and trailer; returns the document length or -1 */
+int bplist_writer_finish(bplist_writer_t *w, int root);
+
+#endif // BPLIST_H
@@ -0,0 +1,187 @@
+/**
+ * Size-classed payload buffer pool
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer_pool.h"
+
+#define OVERSIZE_CLASS BUFFER_POOL_CLASSES
+
+/* Precedes the payload; 64 bytes keeps the payload cache-line aligned relative to the allocation */
+typedef struct pool_buffer_s {
+    struct pool_buffer_s *next;
+    size_t capacity;
+    int cls;
+    unsigned char pad[64 - sizeof(void *) - sizeof(size_t) - sizeof(int)];
+} pool_buffer_t;
+
+struct buffer_pool_s {
+    pthread_mutex_t lock;
+    size_t max_cached_bytes;
+    pool_buffer_t *free_list[BUFFER_POOL_CLASSES];
+    buffer_pool_stats_t stats;
+};
+
+static pool_buffer_t *
+header_of(const unsigned char *buf)
+{
+    return (pool_buffer_t *)(buf - sizeof(pool_buffer_t));
+}
+
+/* Smallest class holding size bytes, OVERSIZE_CLASS above the largest */
+static int
+class_for(size_t size)
+{
+    int cls = 0;
+
+    if (size > BUFFER_POOL_MAX_CLASS_SIZE) {
+        return OVERSIZE_CLASS;
+    }
+    while (((size_t)1 << (BUFFER_POOL_MIN_SHIFT + cls)) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+buffer_pool_t *
+buffer_pool_init(size_t max_cached_bytes)
+{
+    buffer_pool_t *pool = calloc(1, sizeof(buffer_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->max_cached_bytes = max_cached_bytes;
+    return pool;
+}
+
+void
+buffer_pool_trim(buffer_pool_t *pool)
+{
+    pool_buffer_t *lists[BUFFER_POOL_CLASSES];
+    int cls;
+
+    pthread_mutex_lock(&pool->lock);
+    for (cls = 0; cls < BUFFER_POOL_CLASSES; cls++) {
+        lists[cls] = pool->free_list[cls];
+        pool->free_list[cls] = NULL;
+        pool->stats.classes[cls].cached = 0;
+    }
+    pool->stats.bytes_cached = 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (cls = 0; cls < BUFFER_POOL_CLASSES; cls++) {
+        while (lists[cls]) {
+            pool_buffer_t *next = lists[cls]->next;
+            free(lists[cls]);
+            lists[cls] = next;
+        }
+    }
+}
+
+void
+buffer_pool_destroy(buffer_pool_t *pool)
+{
+    if (pool) {
+        buffer_pool_trim(pool);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+    }
+}
+
+unsigned char *
+buffer_pool_acquire(buffer_pool_t *pool, size_t size)
+{
+    int cls = class_for(size);
+    size_t capacity = cls == OVERSIZE_CLASS ? size : (size_t)1 << (BUFFER_POOL_MIN_SHIFT + cls);
+    pool_buffer_t *buf = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (cls != OVERSIZE_CLASS) {
+        buffer_pool_class_stats_t *cs = &pool->stats.classes[cls];
+        cs->acquires++;
+        buf = pool->free_list[cls];
+        if (buf) {
+            pool->free_list[cls] = buf->next;
+            cs->hits++;
+            cs->cached--;
+            pool->stats.bytes_cached -= capacity;
+        }
+        if (++cs->in_use > cs->in_use_high_water) {
+            cs->in_use_high_water = cs->in_use;
+        }
+    } else {
+        pool->stats.oversize_acquires++;
+    }
+    pool->stats.bytes_in_use += capacity;
+    if (pool->stats.bytes_in_use > pool->stats.bytes_in_use_high_water) {
+        pool->stats.bytes_in_use_high_water = pool->stats.bytes_in_use;
+    }
+    if (size > pool->stats.largest_request) {
+        pool->stats.largest_request = size;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!buf) {
+        /* Miss: allocate outside the lock */
+        buf = malloc(sizeof(pool_buffer_t) + capacity);
+        if (!buf) {
+            pthread_mutex_lock(&pool->lock);
+            if (cls != OVERSIZE_CLASS) {
+                pool->stats.classes[cls].in_use--;
+            }
+            pool->stats.bytes_in_use -= capacity;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        buf->capacity = capacity;
+        buf->cls = cls;
+    }
+    buf->next = NULL;
+    return (unsigned char *)(buf + 1);
+}
+
+void
+buffer_pool_release(buffer_pool_t *pool, unsigned char *data)
+{
+    pool_buffer_t *buf;
+    int cached = 0;
+
+    if (!data) {
+        return;
+    }
+    buf = header_of(data);
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.bytes_in_use -= buf->capacity;
+    if (buf->cls != OVERSIZE_CLASS) {
+        pool->stats.classes[buf->cls].in_use--;
+        if (pool->stats.bytes_cached + buf->capacity <= pool->max_cached_bytes) {
+            buf->next = pool->free_list[buf->cls];
+            pool->free_list[buf->cls] = buf;
+            pool->stats.classes[buf->cls].cached++;
+            pool->stats.bytes_cached += buf->capacity;
+            cached = 1;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!cached) {
+        free(buf);
+    }
+}
+
+size_t
+buffer_pool_capacity(const unsigned char *buf)
+{
+    return header_of(buf)->capacity;
+}
+
+void
+buffer_pool_get_stats(buffer_pool_t *pool, buffer_pool_stats_t *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    memcpy(stats, &pool->stats, sizeof(*stats));
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,59 @@
+/**
+ * Size-classed payload buffer pool
+ *
+ * Mirror payloads range from a few hundred bytes (P-frames, codec config) to
+ * several MB (4K IDR frames). Buffers are handed out from power-of-two classes
+ * of 16 KB through 4 MB and go back onto a per-class free list on release, so
+ * a running stream stops allocating once every class it uses has warmed up.
+ * Larger requests are allocated exactly and freed on release.
+ *
+ * Acquire and release may happen on different threads (receiver and decoder).
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#define BUFFER_POOL_MIN_SHIFT 14        /* 16 KB */
+#define BUFFER_POOL_CLASSES 9           /* 16 KB .. 4 MB */
+#define BUFFER_POOL_MAX_CLASS_SIZE ((size_t)1 << (BUFFER_POOL_MIN_SHIFT + BUFFER_POOL_CLASSES - 1))
+
+typedef struct buffer_pool_s buffer_pool_t;
+
+typedef struct {
+    unsigned long long acquires;
+    unsigned long long hits;            /* acquires served from the free list */
+    int in_use;
+    int in_use_high_water;
+    int cached;
+} buffer_pool_class_stats_t;
+
+typedef struct {
+    buffer_pool_class_stats_t classes[BUFFER_POOL_CLASSES];
+    unsigned long long oversize_acquires;   /* above BUFFER_POOL_MAX_CLASS_SIZE, never cached */
+    size_t bytes_in_use;
+    size_t bytes_in_use_high_water;
+    size_t bytes_cached;
+    size_t largest_request;
+} buffer_pool_stats_t;
+
+/* max_cached_bytes bounds the memory kept on the free lists; releases beyond it are freed */
+buffer_pool_t *buffer_pool_init(size_t max_cached_bytes);
+
+/* Frees the cached buffers; every acquired buffer must have been released */
+void buffer_pool_destroy(buffer_pool_t *pool);
+
+/* Returns a buffer of at least size bytes (see buffer_pool_capacity), NULL on allocation failure */
+unsigned char *buffer_pool_acquire(buffer_pool_t *pool, size_t size);
+void buffer_pool_release(buffer_pool_t *pool, unsigned char *buf);
+
+/* Usable bytes of an acquired buffer: its class size, or the exact size when oversize */
+size_t buffer_pool_capacity(const unsigned char *buf);
+
+/* Frees every cached buffer (e.g. when the stream stops or on memory pressure) */
+void buffer_pool_trim(buffer_pool_t *pool);
+
+void buffer_pool_get_stats(buffer_pool_t *pool, buffer_pool_stats_t *stats);
+
+#endif // BUFFER_POOL_H
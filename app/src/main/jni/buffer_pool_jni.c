@@ -0,0 +1,113 @@
+#include <jni.h>
+#include <android/log.h>
+#include "buffer_pool.h"
+
+#define LOG_TAG "BufferPoolJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeGetStats (must match PayloadBufferPool.kt) */
+#define STATS_PER_CLASS 5       /* acquires, hits, in use, in-use high water, cached */
+#define STATS_TOTALS (STATS_PER_CLASS * BUFFER_POOL_CLASSES)
+#define STATS_LEN (STATS_TOTALS + 5)
+
+/**
+ * Create a payload pool
+ * Input: maxCachedBytes = memory kept on the free lists between packets
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_PayloadBufferPool_nativeCreate(JNIEnv *env, jobject thiz, jlong max_cached_bytes) {
+    buffer_pool_t *pool = buffer_pool_init((size_t)max_cached_bytes);
+    if (pool == NULL) {
+        LOGE("Failed to create payload buffer pool");
+        return 0;
+    }
+    return (jlong)pool;
+}
+
+/**
+ * Acquire a pooled buffer
+ * Input: size = bytes needed
+ * Output: direct ByteBuffer over the pooled memory (capacity = class size), null on failure
+ */
+JNIEXPORT jobject JNICALL
+Java_com_pentagram_airplay_service_PayloadBufferPool_nativeAcquire(JNIEnv *env, jobject thiz, jlong handle, jint size) {
+    buffer_pool_t *pool = (buffer_pool_t *)handle;
+    if (pool == NULL || size < 0) {
+        return NULL;
+    }
+    unsigned char *buf = buffer_pool_acquire(pool, (size_t)size);
+    if (buf == NULL) {
+        LOGE("Failed to acquire %d-byte payload buffer", size);
+        return NULL;
+    }
+    jobject buffer = (*env)->NewDirectByteBuffer(env, buf, (jlong)buffer_pool_capacity(buf));
+    if (buffer == NULL) {
+        buffer_pool_release(pool, buf);
+    }
+    return buffer;
+}
+
+/**
+ * Return a buffer from nativeAcquire to its pool
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_PayloadBufferPool_nativeRelease(JNIEnv *env, jobject thiz, jlong handle, jobject buffer) {
+    buffer_pool_t *pool = (buffer_pool_t *)handle;
+    if (pool == NULL || buffer == NULL) {
+        return;
+    }
+    buffer_pool_release(pool, (*env)->GetDirectBufferAddress(env, buffer));
+}
+
+/**
+ * Snapshot of the pool statistics
+ * Output: out = per class (acquires, hits, in use, high water, cached), then
+ *         oversize acquires, bytes in use, bytes in use high water, bytes cached, largest request
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_PayloadBufferPool_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle, jlongArray out) {
+    buffer_pool_t *pool = (buffer_pool_t *)handle;
+    buffer_pool_stats_t stats;
+    jlong values[STATS_LEN];
+    int i;
+
+    if (pool == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    buffer_pool_get_stats(pool, &stats);
+    for (i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        jlong *c = &values[STATS_PER_CLASS * i];
+        c[0] = (jlong)stats.classes[i].acquires;
+        c[1] = (jlong)stats.classes[i].hits;
+        c[2] = stats.classes[i].in_use;
+        c[3] = stats.classes[i].in_use_high_water;
+        c[4] = stats.classes[i].cached;
+    }
+    values[STATS_TOTALS] = (jlong)stats.oversize_acquires;
+    values[STATS_TOTALS + 1] = (jlong)stats.bytes_in_use;
+    values[STATS_TOTALS + 2] = (jlong)stats.bytes_in_use_high_water;
+    values[STATS_TOTALS + 3] = (jlong)stats.bytes_cached;
+    values[STATS_TOTALS + 4] = (jlong)stats.largest_request;
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * Free cached buffers (memory pressure, stream paused)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_PayloadBufferPool_nativeTrim(JNIEnv *env, jobject thiz, jlong handle) {
+    buffer_pool_t *pool = (buffer_pool_t *)handle;
+    if (pool != NULL) {
+        buffer_pool_trim(pool);
+    }
+}
+
+/**
+ * Destroy the pool; every acquired buffer must have been released
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_PayloadBufferPool_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    buffer_pool_destroy((buffer_pool_t *)handle);
+}
@@ -20,10 +20,20 @@ typedef struct logger_s logger_t;
 
 typedef struct fairplay_s fairplay_t;
 
+#define FAIRPLAY_SETUP_REQ_LEN      16
+#define FAIRPLAY_SETUP_RES_LEN      142
+#define FAIRPLAY_HANDSHAKE_REQ_LEN  164
+#define FAIRPLAY_HANDSHAKE_RES_LEN  32
+#define FAIRPLAY_RES_MAX_LEN        FAIRPLAY_SETUP_RES_LEN
+
 fairplay_t *fairplay_init(logger_t *logger);
 int fairplay_setup(fairplay_t *fp, const unsigned char req[16], unsigned char res[142]);
 int fairplay_handshake(fairplay_t *fp, const unsigned char req[164], unsigned char res[32]);
+/* Answers either fp-setup phase from the raw request body; returns the response length or -1 */
+int fairplay_respond(fairplay_t *fp, const unsigned char *req, int reqlen, unsigned char *res, int rescap);
 int fairplay_decrypt(fairplay_t *fp, const unsigned char input[72], unsigned char output[16]);
+/* Decrypts n ekeys from one handshake, deriving the session key schedule once */
+int fairplay_decrypt_many(fairplay_t *fp, const unsigned char ekeys[][72], int n, unsigned char out[][16]);
 void fairplay_destroy(fairplay_t *fp);
 
 #endif
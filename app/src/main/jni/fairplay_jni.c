@@ -1,6 +1,7 @@
 #include <jni.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <android/log.h>
 #include "fairplay.h"
 
@@ -8,9 +9,6 @@
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
-// Global FairPlay instance (one per process)
-static fairplay_t *g_fairplay = NULL;
-
 // Dummy logger for FairPlay library (matches typedef in fairplay.h)
 struct logger_s {
     int dummy;
@@ -29,27 +27,23 @@ void logger_log(logger_t *logger, int level, const char *fmt, ...) {
 }
 
 /**
- * Initialize FairPlay
- * Returns 0 on success, -1 on failure
+ * Create a FairPlay instance
+ * Output: handle, or 0 on failure
+ *
+ * Each receiver session owns one, so concurrent senders never share
+ * handshake state.
  */
-JNIEXPORT jint JNICALL
+JNIEXPORT jlong JNICALL
 Java_com_pentagram_airplay_service_FairPlay_nativeInit(JNIEnv *env, jobject thiz) {
-    if (g_fairplay != NULL) {
-        LOGI("FairPlay already initialized");
-        return 0;
-    }
+    fairplay_t *fp = fairplay_init(NULL);
 
-    logger_t *logger = logger_init();
-    g_fairplay = fairplay_init(logger);
-
-    if (g_fairplay == NULL) {
+    if (fp == NULL) {
         LOGE("Failed to initialize FairPlay");
-        logger_destroy(logger);
-        return -1;
+        return 0;
     }
 
     LOGI("FairPlay initialized successfully");
-    return 0;
+    return (jlong)(intptr_t)fp;
 }
 
 /**
@@ -58,8 +52,9 @@ Java_com_pentagram_airplay_service_FairPlay_nativeInit(JNIEnv *env, jobject thiz
  * Output: 142-byte response
  */
 JNIEXPORT jbyteArray JNICALL
-Java_com_pentagram_airplay_service_FairPlay_nativeSetup(JNIEnv *env, jobject thiz, jbyteArray request) {
-    if (g_fairplay == NULL) {
+Java_com_pentagram_airplay_service_FairPlay_nativeSetup(JNIEnv *env, jobject thiz, jlong handle, jbyteArray request) {
+    fairplay_t *fp = (fairplay_t *)(intptr_t)handle;
+    if (fp == NULL) {
         LOGE("FairPlay not initialized");
         return NULL;
     }
@@ -74,7 +69,7 @@ Java_com_pentagram_airplay_service_FairPlay_nativeSetup(JNIEnv *env, jobject thi
     (*env)->GetByteArrayRegion(env, request, 0, 16, (jbyte*)req_data);
 
     unsigned char res_data[142];
-    int ret = fairplay_setup(g_fairplay, req_data, res_data);
+    int ret = fairplay_setup(fp, req_data, res_data);
 
     if (ret != 0) {
         LOGE("FairPlay setup failed: %d", ret);
@@ -95,8 +90,9 @@ Java_com_pentagram_airplay_service_FairPlay_nativeSetup(JNIEnv *env, jobject thi
  * Output: 32-byte response
  */
 JNIEXPORT jbyteArray JNICALL
-Java_com_pentagram_airplay_service_FairPlay_nativeHandshake(JNIEnv *env, jobject thiz, jbyteArray request) {
-    if (g_fairplay == NULL) {
+Java_com_pentagram_airplay_service_FairPlay_nativeHandshake(JNIEnv *env, jobject thiz, jlong handle, jbyteArray request) {
+    fairplay_t *fp = (fairplay_t *)(intptr_t)handle;
+    if (fp == NULL) {
         LOGE("FairPlay not initialized");
         return NULL;
     }
@@ -111,7 +107,7 @@ Java_com_pentagram_airplay_service_FairPlay_nativeHandshake(JNIEnv *env, jobject
     (*env)->GetByteArrayRegion(env, request, 0, 164, (jbyte*)req_data);
 
     unsigned char res_data[32];
-    int ret = fairplay_handshake(g_fairplay, req_data, res_data);
+    int ret = fairplay_handshake(fp, req_data, res_data);
 
     if (ret != 0) {
         LOGE("FairPlay handshake failed: %d", ret);
@@ -126,13 +122,57 @@ Java_com_pentagram_airplay_service_FairPlay_nativeHandshake(JNIEnv *env, jobject
     return response;
 }
 
+/**
+ * fp-setup responder (both phases)
+ * Input: raw request body (16 or 164 bytes)
+ * Output: response body written into a caller-owned byte[] of at least FAIRPLAY_RES_MAX_LEN
+ * Returns the response length, or -1 for a malformed request
+ *
+ * Nothing is allocated and nothing is logged on success, so rapid reconnects
+ * only pay for the two small copies. Each connection passes its own array, so
+ * concurrent fp-setups never share a reply.
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FairPlay_nativeRespond(JNIEnv *env, jobject thiz, jlong handle, jbyteArray request,
+                                                          jbyteArray response) {
+    fairplay_t *fp = (fairplay_t *)(intptr_t)handle;
+    if (fp == NULL) {
+        LOGE("FairPlay not initialized");
+        return -1;
+    }
+
+    jsize req_len = (*env)->GetArrayLength(env, request);
+    if (req_len != FAIRPLAY_SETUP_REQ_LEN && req_len != FAIRPLAY_HANDSHAKE_REQ_LEN) {
+        LOGE("Invalid fp-setup request length: %d", req_len);
+        return -1;
+    }
+
+    if ((*env)->GetArrayLength(env, response) < FAIRPLAY_RES_MAX_LEN) {
+        LOGE("fp-setup response array must hold %d bytes", FAIRPLAY_RES_MAX_LEN);
+        return -1;
+    }
+
+    unsigned char req_data[FAIRPLAY_HANDSHAKE_REQ_LEN];
+    unsigned char res_data[FAIRPLAY_RES_MAX_LEN];
+    (*env)->GetByteArrayRegion(env, request, 0, req_len, (jbyte*)req_data);
+
+    int ret = fairplay_respond(fp, req_data, req_len, res_data, sizeof(res_data));
+    if (ret < 0) {
+        LOGE("FairPlay fp-setup rejected (version 0x%02X, mode %d)", req_data[4], req_data[14]);
+        return -1;
+    }
+    (*env)->SetByteArrayRegion(env, response, 0, ret, (jbyte*)res_data);
+    return ret;
+}
+
 /**
  * Decrypt ekey (72 bytes) to get AES key (16 bytes)
  * This is the critical function for video decryption!
  */
 JNIEXPORT jbyteArray JNICALL
-Java_com_pentagram_airplay_service_FairPlay_nativeDecrypt(JNIEnv *env, jobject thiz, jbyteArray encrypted_key) {
-    if (g_fairplay == NULL) {
+Java_com_pentagram_airplay_service_FairPlay_nativeDecrypt(JNIEnv *env, jobject thiz, jlong handle, jbyteArray encrypted_key) {
+    fairplay_t *fp = (fairplay_t *)(intptr_t)handle;
+    if (fp == NULL) {
         LOGE("FairPlay not initialized");
         return NULL;
     }
@@ -147,7 +187,7 @@ Java_com_pentagram_airplay_service_FairPlay_nativeDecrypt(JNIEnv *env, jobject t
     (*env)->GetByteArrayRegion(env, encrypted_key, 0, 72, (jbyte*)ekey_data);
 
     unsigned char aes_key[16];
-    int ret = fairplay_decrypt(g_fairplay, ekey_data, aes_key);
+    int ret = fairplay_decrypt(fp, ekey_data, aes_key);
 
     if (ret != 0) {
         LOGE("FairPlay decrypt failed: %d", ret);
@@ -169,10 +209,10 @@ Java_com_pentagram_airplay_service_FairPlay_nativeDecrypt(JNIEnv *env, jobject t
  * Cleanup FairPlay instance
  */
 JNIEXPORT void JNICALL
-Java_com_pentagram_airplay_service_FairPlay_nativeDestroy(JNIEnv *env, jobject thiz) {
-    if (g_fairplay != NULL) {
-        fairplay_destroy(g_fairplay);
-        g_fairplay = NULL;
+Java_com_pentagram_airplay_service_FairPlay_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    fairplay_t *fp = (fairplay_t *)(intptr_t)handle;
+    if (fp != NULL) {
+        fairplay_destroy(fp);
         LOGI("FairPlay destroyed");
     }
 }
@@ -31,6 +31,10 @@ struct fairplay_s {
 
     unsigned char keymsg[164];
     unsigned int keymsglen;
+
+    /* Session key schedule derived from keymsg, valid until the next handshake */
+    uint32_t key_schedule[11][4];
+    int key_schedule_valid;
 };
 
 fairplay_t *
@@ -45,19 +49,36 @@ fairplay_init(logger_t *logger)
     return fp;
 }
 
+static int
+fairplay_validate(const unsigned char *req, int reqlen)
+{
+    if (reqlen != FAIRPLAY_SETUP_REQ_LEN && reqlen != FAIRPLAY_HANDSHAKE_REQ_LEN) {
+        return -1;
+    }
+    if (req[4] != 0x03) {
+        /* Unsupported fairplay version */
+        return -1;
+    }
+    if (reqlen == FAIRPLAY_SETUP_REQ_LEN && req[14] >= 4) {
+        /* Unknown key mode, there are only four reply messages */
+        return -1;
+    }
+    return 0;
+}
+
 int
 fairplay_setup(fairplay_t *fp, const unsigned char req[16], unsigned char res[142])
 {
     assert(fp);
 
-    if (req[4] != 0x03) {
-        /* Unsupported fairplay version */
+    if (fairplay_validate(req, FAIRPLAY_SETUP_REQ_LEN) < 0) {
         return -1;
     }
 
     int mode = req[14];
     memcpy(res, reply_message[mode], 142);
     fp->keymsglen = 0;
+    fp->key_schedule_valid = 0;
     return 0;
 }
 
@@ -66,13 +87,13 @@ fairplay_handshake(fairplay_t *fp, const unsigned char req[164], unsigned char r
 {
     assert(fp);
 
-    if (req[4] != 0x03) {
-        /* Unsupported fairplay version */
+    if (fairplay_validate(req, FAIRPLAY_HANDSHAKE_REQ_LEN) < 0) {
         return -1;
     }
 
     memcpy(fp->keymsg, req, 164);
     fp->keymsglen = 164;
+    fp->key_schedule_valid = 0;
 
     memcpy(res, fp_header, 12);
     memcpy(res + 12, req + 144, 20);
@@ -80,13 +101,64 @@ fairplay_handshake(fairplay_t *fp, const unsigned char req[164], unsigned char r
 }
 
 int
-fairplay_decrypt(fairplay_t *fp, const unsigned char input[72], unsigned char output[16])
+fairplay_respond(fairplay_t *fp, const unsigned char *req, int reqlen, unsigned char *res, int rescap)
+{
+    assert(fp);
+
+    if (fairplay_validate(req, reqlen) < 0) {
+        return -1;
+    }
+    if (reqlen == FAIRPLAY_SETUP_REQ_LEN) {
+        if (rescap < FAIRPLAY_SETUP_RES_LEN) {
+            return -1;
+        }
+        fairplay_setup(fp, req, res);
+        return FAIRPLAY_SETUP_RES_LEN;
+    }
+    if (rescap < FAIRPLAY_HANDSHAKE_RES_LEN) {
+        return -1;
+    }
+    fairplay_handshake(fp, req, res);
+    return FAIRPLAY_HANDSHAKE_RES_LEN;
+}
+
+static int
+fairplay_prepare(fairplay_t *fp)
 {
     if (fp->keymsglen != 164) {
         return -1;
     }
+    if (!fp->key_schedule_valid) {
+        playfair_key_schedule(fp->keymsg, fp->key_schedule);
+        fp->key_schedule_valid = 1;
+    }
+    return 0;
+}
+
+int
+fairplay_decrypt(fairplay_t *fp, const unsigned char input[72], unsigned char output[16])
+{
+    if (fairplay_prepare(fp) < 0) {
+        return -1;
+    }
+
+    playfair_decrypt_scheduled(fp->key_schedule, (unsigned char *) input, output);
+    return 0;
+}
+
+int
+fairplay_decrypt_many(fairplay_t *fp, const unsigned char ekeys[][72], int n, unsigned char out[][16])
+{
+    int i;
+
+    assert(fp);
 
-    playfair_decrypt(fp->keymsg, (unsigned char *) input, output);
+    if (n < 0 || fairplay_prepare(fp) < 0) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        playfair_decrypt_scheduled(fp->key_schedule, (unsigned char *) ekeys[i], out[i]);
+    }
     return 0;
 }
 
@@ -0,0 +1,253 @@
+/**
+ * Single-producer / single-consumer frame queue
+ */
+
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame_queue.h"
+
+#define ALIGNED __attribute__((aligned(FRAME_QUEUE_CACHE_LINE)))
+
+struct frame_queue_s {
+    /* Written by the producer */
+    ALIGNED unsigned int tail;
+    unsigned int head_cache;            /* producer's last view of head */
+    unsigned int push_seq;              /* futex word the consumer sleeps on */
+    unsigned long long pushes;
+    unsigned long long producer_waits;
+    unsigned long long producer_wakes;
+
+    /* Written by the consumer */
+    ALIGNED unsigned int head;
+    unsigned int tail_cache;            /* consumer's last view of tail */
+    unsigned int pop_seq;               /* futex word the producer sleeps on */
+    unsigned long long pops;
+    unsigned long long consumer_waits;
+    unsigned long long consumer_wakes;
+
+    /* Written by either side when it is about to sleep */
+    ALIGNED int consumer_waiting;
+    int producer_waiting;
+    int closed;
+
+    /* Read-only after create */
+    ALIGNED unsigned int mask;
+    frame_desc_t *slots;
+};
+
+static int64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+futex_wait(unsigned int *word, unsigned int expected, int64_t timeout_ns)
+{
+    struct timespec ts;
+
+    if (timeout_ns >= 0) {
+        ts.tv_sec = (time_t)(timeout_ns / 1000000000LL);
+        ts.tv_nsec = (long)(timeout_ns % 1000000000LL);
+    }
+    /* EAGAIN (word already moved), EINTR and ETIMEDOUT all mean: look again */
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, timeout_ns >= 0 ? &ts : NULL, NULL, 0);
+}
+
+static void
+futex_wake(unsigned int *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+frame_queue_t *
+frame_queue_create(unsigned int capacity)
+{
+    frame_queue_t *queue;
+    unsigned int size = 2;
+
+    while (size < capacity && size < (1u << 30)) {
+        size <<= 1;
+    }
+    if (posix_memalign((void **)&queue, FRAME_QUEUE_CACHE_LINE, sizeof(*queue)) != 0) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(*queue));
+    queue->mask = size - 1;
+    queue->slots = calloc(size, sizeof(frame_desc_t));
+    if (queue->slots == NULL) {
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void
+frame_queue_destroy(frame_queue_t *queue)
+{
+    if (queue == NULL) {
+        return;
+    }
+    free(queue->slots);
+    free(queue);
+}
+
+/* Sleep on *seq until the other side moves it, after announcing ourselves in
+ * *waiting. The other side publishes its index, then takes waiting (both
+ * sequentially consistent): either it finds us, bumps seq and wakes us once
+ * (a bump before our futex_wait makes the wait return at once), or we see its
+ * index here and never sleep. close() bumps both words after setting closed. */
+static void
+wait_for_peer(frame_queue_t *queue, int *waiting, unsigned int *seq, const unsigned int *peer_index,
+              unsigned int stale_index, int64_t timeout_ns)
+{
+    unsigned int expected;
+
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    expected = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(peer_index, __ATOMIC_SEQ_CST) == stale_index &&
+        !__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)) {
+        futex_wait(seq, expected, timeout_ns);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+static int64_t
+remaining(int64_t deadline, int64_t timeout_ns)
+{
+    int64_t left;
+
+    if (timeout_ns < 0) {
+        return -1;
+    }
+    left = deadline - now_ns();
+    return left > 0 ? left : 0;
+}
+
+int
+frame_queue_push(frame_queue_t *queue, const frame_desc_t *desc, int64_t timeout_ns)
+{
+    unsigned int tail = queue->tail;
+    unsigned int capacity = queue->mask + 1;
+    int64_t deadline = 0;
+    int64_t left;
+    frame_desc_t *slot;
+
+    if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    if (tail - queue->head_cache == capacity) {
+        queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (timeout_ns > 0) {
+            deadline = now_ns() + timeout_ns;
+        }
+        while (tail - queue->head_cache == capacity) {
+            if (timeout_ns == 0 || __atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+                return -1;
+            }
+            left = remaining(deadline, timeout_ns);
+            if (left == 0) {
+                return -1;
+            }
+            queue->producer_waits++;
+            wait_for_peer(queue, &queue->producer_waiting, &queue->pop_seq, &queue->head, queue->head_cache, left);
+            queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    slot = &queue->slots[tail & queue->mask];
+    *slot = *desc;
+    slot->enqueue_ns = now_ns();
+    queue->pushes++;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&queue->consumer_waiting, 0, __ATOMIC_SEQ_CST)) {
+        queue->producer_wakes++;
+        __atomic_add_fetch(&queue->push_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&queue->push_seq);
+    }
+    return 0;
+}
+
+int
+frame_queue_pop(frame_queue_t *queue, frame_desc_t *desc, int64_t timeout_ns)
+{
+    unsigned int head = queue->head;
+    int64_t deadline = 0;
+    int64_t left;
+
+    if (head == queue->tail_cache) {
+        queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        if (timeout_ns > 0) {
+            deadline = now_ns() + timeout_ns;
+        }
+        while (head == queue->tail_cache) {
+            if (timeout_ns == 0 || __atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+                /* A close racing the last push: take what was published */
+                queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+                if (head != queue->tail_cache) {
+                    break;
+                }
+                return -1;
+            }
+            left = remaining(deadline, timeout_ns);
+            if (left == 0) {
+                return -1;
+            }
+            queue->consumer_waits++;
+            wait_for_peer(queue, &queue->consumer_waiting, &queue->push_seq, &queue->tail, head, left);
+            queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    *desc = queue->slots[head & queue->mask];
+    queue->pops++;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&queue->producer_waiting, 0, __ATOMIC_SEQ_CST)) {
+        queue->consumer_wakes++;
+        __atomic_add_fetch(&queue->pop_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&queue->pop_seq);
+    }
+    return 0;
+}
+
+void
+frame_queue_close(frame_queue_t *queue)
+{
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&queue->push_seq, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&queue->pop_seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&queue->push_seq);
+    futex_wake(&queue->pop_seq);
+}
+
+unsigned int
+frame_queue_size(frame_queue_t *queue)
+{
+    return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+}
+
+void
+frame_queue_get_stats(frame_queue_t *queue, frame_queue_stats_t *stats)
+{
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    /* Counters belong to the two threads; a snapshot may be a few events stale */
+    stats->pushes = __atomic_load_n(&queue->pushes, __ATOMIC_RELAXED);
+    stats->pops = __atomic_load_n(&queue->pops, __ATOMIC_RELAXED);
+    stats->producer_waits = __atomic_load_n(&queue->producer_waits, __ATOMIC_RELAXED);
+    stats->consumer_waits = __atomic_load_n(&queue->consumer_waits, __ATOMIC_RELAXED);
+    stats->wakes = __atomic_load_n(&queue->producer_wakes, __ATOMIC_RELAXED) +
+                   __atomic_load_n(&queue->consumer_wakes, __ATOMIC_RELAXED);
+    stats->size = tail - head;
+    stats->capacity = queue->mask + 1;
+}
@@ -0,0 +1,70 @@
+/**
+ * Single-producer / single-consumer frame queue
+ *
+ * Hands decrypted frames from the network reader to the decoder feeder so a
+ * slow MediaCodec.dequeueInputBuffer no longer stalls socket reads. The ring
+ * holds small descriptors; the payload stays in its pooled buffer and only
+ * ownership of that buffer moves across.
+ *
+ * The producer's tail and the consumer's head live on separate cache lines,
+ * each side keeps a cached copy of the other's index, so a push or pop only
+ * touches the shared line when its cached view says the ring is full or
+ * empty. A side that finds nothing to do sleeps on a futex; the other side
+ * issues FUTEX_WAKE only when it sees a sleeper, so a busy stream runs with
+ * no syscalls at all.
+ *
+ * Exactly one thread may push and one (other) thread may pop.
+ */
+
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdint.h>
+
+#define FRAME_QUEUE_CACHE_LINE 64
+#define FRAME_QUEUE_DEFAULT_CAPACITY 64
+
+typedef struct {
+    unsigned char *data;        /* pooled payload buffer, owned by whoever holds the descriptor */
+    int len;
+    int type;                   /* mirror packet type (0x00 video, 0x01 codec config) */
+    uint64_t ntp_timestamp;     /* header bytes 8-15 */
+    int64_t enqueue_ns;         /* CLOCK_MONOTONIC, set by frame_queue_push */
+    uint64_t cookie;            /* caller's handle for the buffer */
+    uint32_t trace_id;          /* frame_trace.h id, 0 when untraced */
+} frame_desc_t;
+
+typedef struct frame_queue_s frame_queue_t;
+
+typedef struct {
+    unsigned long long pushes;
+    unsigned long long pops;
+    unsigned long long producer_waits;  /* push found the ring full and slept */
+    unsigned long long consumer_waits;  /* pop found the ring empty and slept */
+    unsigned long long wakes;           /* FUTEX_WAKE syscalls issued */
+    unsigned int size;                  /* descriptors queued right now */
+    unsigned int capacity;
+} frame_queue_stats_t;
+
+/* capacity is rounded up to a power of two; NULL on allocation failure */
+frame_queue_t *frame_queue_create(unsigned int capacity);
+
+/* Both sides must be done with the queue; descriptors still queued are dropped */
+void frame_queue_destroy(frame_queue_t *queue);
+
+/* Waits up to timeout_ns for room (0: don't wait, < 0: forever).
+ * Returns 0, or -1 when the queue is full or closed. */
+int frame_queue_push(frame_queue_t *queue, const frame_desc_t *desc, int64_t timeout_ns);
+
+/* Waits up to timeout_ns for a descriptor (0: don't wait, < 0: forever).
+ * Returns 0, or -1 on timeout or once the queue is closed and drained. */
+int frame_queue_pop(frame_queue_t *queue, frame_desc_t *desc, int64_t timeout_ns);
+
+/* No more pushes; wakes both sides. The consumer still drains what is queued. */
+void frame_queue_close(frame_queue_t *queue);
+
+unsigned int frame_queue_size(frame_queue_t *queue);
+
+void frame_queue_get_stats(frame_queue_t *queue, frame_queue_stats_t *stats);
+
+#endif // FRAME_QUEUE_H
@@ -0,0 +1,131 @@
+#include <jni.h>
+#include <android/log.h>
+#include "frame_queue.h"
+
+#define LOG_TAG "FrameQueueJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativePop (must match FrameQueue.kt) */
+#define OUT_COOKIE 0
+#define OUT_LENGTH 1
+#define OUT_TYPE 2
+#define OUT_NTP_TIMESTAMP 3
+#define OUT_ENQUEUE_NS 4
+#define OUT_TRACE_ID 5
+#define OUT_LEN 6
+
+/* Layout of the long[] filled by nativeGetStats */
+#define STATS_LEN 7
+
+/**
+ * Allocate a queue
+ * Input: capacity = descriptors, rounded up to a power of two
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_FrameQueue_nativeCreate(JNIEnv *env, jobject thiz, jint capacity) {
+    frame_queue_t *queue = frame_queue_create(capacity > 0 ? (unsigned int)capacity : FRAME_QUEUE_DEFAULT_CAPACITY);
+    if (queue == NULL) {
+        LOGE("Failed to allocate frame queue");
+        return 0;
+    }
+    return (jlong)queue;
+}
+
+/**
+ * Producer side: hand a payload buffer to the consumer
+ * Input: buffer = direct payload buffer, length / type / ntpTimestamp = packet fields,
+ *        cookie = caller's id for the buffer, traceId = FrameTrace id (0 none),
+ *        timeoutNs = wait for room (0 none, < 0 forever)
+ * Output: 0, or -1 when the queue stayed full or is closed (buffer still the caller's)
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FrameQueue_nativePush(JNIEnv *env, jobject thiz, jlong handle, jobject buffer,
+                                                         jint length, jint type, jlong ntp_timestamp, jlong cookie,
+                                                         jint trace_id, jlong timeout_ns) {
+    frame_queue_t *queue = (frame_queue_t *)handle;
+    frame_desc_t desc;
+
+    if (queue == NULL) {
+        return -1;
+    }
+    desc.data = (*env)->GetDirectBufferAddress(env, buffer);
+    desc.len = length;
+    desc.type = type;
+    desc.ntp_timestamp = (uint64_t)ntp_timestamp;
+    desc.enqueue_ns = 0;
+    desc.cookie = (uint64_t)cookie;
+    desc.trace_id = (uint32_t)trace_id;
+    return frame_queue_push(queue, &desc, timeout_ns);
+}
+
+/**
+ * Consumer side: take the next descriptor
+ * Input: timeoutNs = wait for one (0 none, < 0 forever)
+ * Output: 0 with out = cookie, length, type, ntpTimestamp, enqueue time (CLOCK_MONOTONIC ns), trace id;
+ *         -1 on timeout or once the queue is closed and drained
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FrameQueue_nativePop(JNIEnv *env, jobject thiz, jlong handle, jlong timeout_ns,
+                                                        jlongArray out) {
+    frame_queue_t *queue = (frame_queue_t *)handle;
+    frame_desc_t desc;
+    jlong fields[OUT_LEN];
+
+    if (queue == NULL || frame_queue_pop(queue, &desc, timeout_ns) != 0) {
+        return -1;
+    }
+    fields[OUT_COOKIE] = (jlong)desc.cookie;
+    fields[OUT_LENGTH] = desc.len;
+    fields[OUT_TYPE] = desc.type;
+    fields[OUT_NTP_TIMESTAMP] = (jlong)desc.ntp_timestamp;
+    fields[OUT_ENQUEUE_NS] = desc.enqueue_ns;
+    fields[OUT_TRACE_ID] = desc.trace_id;
+    (*env)->SetLongArrayRegion(env, out, 0, OUT_LEN, fields);
+    return 0;
+}
+
+/**
+ * Stop accepting pushes and wake both sides; the consumer drains what is queued
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameQueue_nativeClose(JNIEnv *env, jobject thiz, jlong handle) {
+    frame_queue_t *queue = (frame_queue_t *)handle;
+    if (queue != NULL) {
+        frame_queue_close(queue);
+    }
+}
+
+/**
+ * Snapshot of the queue counters
+ * Output: out = pushes, pops, producer waits, consumer waits, futex wakes, size, capacity
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameQueue_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle,
+                                                             jlongArray out) {
+    frame_queue_t *queue = (frame_queue_t *)handle;
+    frame_queue_stats_t stats;
+    jlong values[STATS_LEN];
+
+    if (queue == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    frame_queue_get_stats(queue, &stats);
+    values[0] = (jlong)stats.pushes;
+    values[1] = (jlong)stats.pops;
+    values[2] = (jlong)stats.producer_waits;
+    values[3] = (jlong)stats.consumer_waits;
+    values[4] = (jlong)stats.wakes;
+    values[5] = stats.size;
+    values[6] = stats.capacity;
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * Free a queue from nativeCreate; neither side may use it any more
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameQueue_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    frame_queue_destroy((frame_queue_t *)handle);
+}
@@ -0,0 +1,337 @@
+/**
+ * Per-frame stage timestamps for the mirror video path
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_trace.h"
+
+#define SLOT_MASK (FRAME_TRACE_CAPACITY - 1)
+
+/* Single writer per field (the decoder thread, or the reader for frames), read from any thread */
+#define STAT_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+typedef struct {
+    uint32_t id;                        /* occupant; 0 while begin resets the slot */
+    uint32_t done;                      /* set to id once the frame is complete */
+    int64_t t[FRAME_TRACE_STAGES];      /* 0: stage not reached */
+} slot_t;
+
+struct frame_trace_s {
+    slot_t slots[FRAME_TRACE_CAPACITY];
+    uint32_t newest;                    /* last id handed out (reader thread) */
+    frame_trace_stats_t stats;
+};
+
+static const char *stage_names[FRAME_TRACE_STAGES] = {
+    "capture", "arrival", "decrypted", "dequeued", "assembled", "input", "output"
+};
+
+static const char *interval_names[FRAME_TRACE_STAGES] = {
+    "end to end", "network", "decrypt", "queue", "assemble", "decoder input", "decode"
+};
+
+frame_trace_t *
+frame_trace_create(void)
+{
+    return calloc(1, sizeof(frame_trace_t));
+}
+
+void
+frame_trace_destroy(frame_trace_t *trace)
+{
+    free(trace);
+}
+
+/* Log-linear: 1 us buckets below 4 us, then four per power of two */
+static int
+bucket_of(int64_t ns)
+{
+    uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+    int e, bucket;
+
+    if (us < 4) {
+        return (int)us;
+    }
+    e = 63 - __builtin_clzll(us);
+    bucket = 4 * (e - 1) + (int)((us >> (e - 2)) & 3);
+    return bucket < FRAME_TRACE_BUCKETS ? bucket : FRAME_TRACE_BUCKETS - 1;
+}
+
+static int64_t
+bucket_lower_us(int bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    return (int64_t)(4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+int64_t
+frame_trace_bucket_upper_ns(int bucket)
+{
+    if (bucket < 0) {
+        return 0;
+    }
+    if (bucket >= FRAME_TRACE_BUCKETS) {
+        bucket = FRAME_TRACE_BUCKETS - 1;
+    }
+    return bucket_lower_us(bucket + 1) * 1000;
+}
+
+static slot_t *
+slot_of(frame_trace_t *trace, uint32_t id)
+{
+    slot_t *slot = &trace->slots[id & SLOT_MASK];
+    return id != 0 && __atomic_load_n(&slot->id, __ATOMIC_ACQUIRE) == id ? slot : NULL;
+}
+
+uint32_t
+frame_trace_begin(frame_trace_t *trace, int64_t arrival_ns)
+{
+    uint32_t id = trace->newest + 1;
+    slot_t *slot;
+    int i;
+
+    if (id == 0) {
+        id = 1;
+    }
+    slot = &trace->slots[id & SLOT_MASK];
+
+    /* A dump reading the old occupant sees id or done change and drops it */
+    __atomic_store_n(&slot->id, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->done, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < FRAME_TRACE_STAGES; i++) {
+        __atomic_store_n(&slot->t[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->t[FRAME_TRACE_ARRIVAL], arrival_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->id, id, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace->newest, id, __ATOMIC_RELEASE);
+    STAT_ADD(trace->stats.frames, 1);
+    return id;
+}
+
+void
+frame_trace_mark(frame_trace_t *trace, uint32_t id, int stage, int64_t ns)
+{
+    slot_t *slot;
+
+    if (stage < 0 || stage >= FRAME_TRACE_STAGES || (slot = slot_of(trace, id)) == NULL) {
+        return;
+    }
+    __atomic_store_n(&slot->t[stage], ns, __ATOMIC_RELAXED);
+}
+
+static void
+record(frame_trace_histogram_t *histogram, int64_t ns)
+{
+    if (ns < 0) {
+        ns = 0;     /* capture is an estimate and may trail arrival by a little */
+    }
+    STAT_ADD(histogram->count, 1);
+    STAT_ADD(histogram->sum_ns, (unsigned long long)ns);
+    STAT_ADD(histogram->buckets[bucket_of(ns)], 1);
+    if (ns > histogram->max_ns) {
+        __atomic_store_n(&histogram->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+/* Decoder thread */
+static void
+complete(frame_trace_t *trace, slot_t *slot, uint32_t id)
+{
+    frame_trace_stats_t *stats = &trace->stats;
+    int64_t t[FRAME_TRACE_STAGES];
+    int i;
+
+    for (i = 0; i < FRAME_TRACE_STAGES; i++) {
+        t[i] = __atomic_load_n(&slot->t[i], __ATOMIC_RELAXED);
+    }
+    for (i = 1; i < FRAME_TRACE_STAGES; i++) {
+        if (t[i] != 0 && t[i - 1] != 0) {
+            record(&stats->histograms[i], t[i] - t[i - 1]);
+        }
+    }
+    if (t[FRAME_TRACE_OUTPUT] != 0) {
+        if (t[FRAME_TRACE_CAPTURE] != 0) {
+            record(&stats->histograms[FRAME_TRACE_END_TO_END], t[FRAME_TRACE_OUTPUT] - t[FRAME_TRACE_CAPTURE]);
+        }
+        STAT_ADD(stats->decoded, 1);
+    }
+    STAT_ADD(stats->completed, 1);
+    __atomic_store_n(&slot->done, id, __ATOMIC_RELEASE);
+}
+
+int
+frame_trace_output(frame_trace_t *trace, int64_t pts_ns, int64_t ns)
+{
+    uint32_t newest = __atomic_load_n(&trace->newest, __ATOMIC_ACQUIRE);
+    int64_t pts_us = pts_ns / 1000;
+    int k;
+
+    /* Decoders may reorder, so match on the timestamp rather than take the oldest */
+    for (k = 0; k < FRAME_TRACE_OUTPUT_WINDOW; k++) {
+        uint32_t id = newest - (uint32_t)k;
+        slot_t *slot = slot_of(trace, id);
+
+        if (slot == NULL || __atomic_load_n(&slot->done, __ATOMIC_RELAXED) == id ||
+            __atomic_load_n(&slot->t[FRAME_TRACE_INPUT], __ATOMIC_RELAXED) == 0 ||
+            __atomic_load_n(&slot->t[FRAME_TRACE_OUTPUT], __ATOMIC_RELAXED) != 0 ||
+            __atomic_load_n(&slot->t[FRAME_TRACE_CAPTURE], __ATOMIC_RELAXED) / 1000 != pts_us) {
+            continue;
+        }
+        __atomic_store_n(&slot->t[FRAME_TRACE_OUTPUT], ns, __ATOMIC_RELAXED);
+        complete(trace, slot, id);
+        return 0;
+    }
+    STAT_ADD(trace->stats.unmatched_outputs, 1);
+    return -1;
+}
+
+void
+frame_trace_end(frame_trace_t *trace, uint32_t id)
+{
+    slot_t *slot = slot_of(trace, id);
+
+    if (slot == NULL || __atomic_load_n(&slot->done, __ATOMIC_RELAXED) == id) {
+        return;
+    }
+    if (__atomic_load_n(&slot->t[FRAME_TRACE_INPUT], __ATOMIC_RELAXED) != 0 &&
+        __atomic_load_n(&slot->t[FRAME_TRACE_OUTPUT], __ATOMIC_RELAXED) == 0) {
+        return;     /* in the decoder */
+    }
+    complete(trace, slot, id);
+}
+
+void
+frame_trace_get_stats(frame_trace_t *trace, frame_trace_stats_t *stats)
+{
+    int i, b;
+
+    stats->frames = __atomic_load_n(&trace->stats.frames, __ATOMIC_RELAXED);
+    stats->completed = __atomic_load_n(&trace->stats.completed, __ATOMIC_RELAXED);
+    stats->decoded = __atomic_load_n(&trace->stats.decoded, __ATOMIC_RELAXED);
+    stats->unmatched_outputs = __atomic_load_n(&trace->stats.unmatched_outputs, __ATOMIC_RELAXED);
+    for (i = 0; i < FRAME_TRACE_STAGES; i++) {
+        frame_trace_histogram_t *src = &trace->stats.histograms[i];
+        frame_trace_histogram_t *dst = &stats->histograms[i];
+
+        dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+        dst->sum_ns = __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+        dst->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+        for (b = 0; b < FRAME_TRACE_BUCKETS; b++) {
+            dst->buckets[b] = __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+int64_t
+frame_trace_percentile(const frame_trace_histogram_t *histogram, double p)
+{
+    unsigned long long total = 0, seen = 0, target;
+    double rank;
+    int b;
+
+    for (b = 0; b < FRAME_TRACE_BUCKETS; b++) {
+        total += histogram->buckets[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = p / 100.0 * (double)total;
+    target = (unsigned long long)rank;
+    if ((double)target < rank) {
+        target++;
+    }
+    if (target == 0) {
+        target = 1;
+    }
+    for (b = 0; b < FRAME_TRACE_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= target) {
+            break;
+        }
+    }
+    if (b >= FRAME_TRACE_BUCKETS - 1) {
+        return histogram->max_ns;   /* open-ended last bucket */
+    }
+    return frame_trace_bucket_upper_ns(b);
+}
+
+const char *
+frame_trace_stage_name(int stage)
+{
+    return stage >= 0 && stage < FRAME_TRACE_STAGES ? stage_names[stage] : "?";
+}
+
+const char *
+frame_trace_interval_name(int stage)
+{
+    return stage >= 0 && stage < FRAME_TRACE_STAGES ? interval_names[stage] : "?";
+}
+
+static int
+write_event(FILE *out, const char *name, char phase, uint32_t id, int64_t ns)
+{
+    return fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":%u,\"pid\":1,\"tid\":1,"
+                   "\"ts\":%lld.%03lld}", name, phase, id, (long long)(ns / 1000), (long long)(ns % 1000));
+}
+
+int
+frame_trace_write_json(frame_trace_t *trace, FILE *out)
+{
+    uint32_t newest = __atomic_load_n(&trace->newest, __ATOMIC_ACQUIRE);
+    int written = 0, k, i, err = 0;
+
+    err |= fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                   "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"mirror video\"}}") < 0;
+
+    /* Oldest first; each frame is an async track with one slice per stage */
+    for (k = FRAME_TRACE_CAPACITY - 1; k >= 0 && !err; k--) {
+        uint32_t id = newest - (uint32_t)k;
+        slot_t *slot = &trace->slots[id & SLOT_MASK];
+        int64_t t[FRAME_TRACE_STAGES];
+        int64_t start_ns = 0, end_ns = 0;
+        int stamps = 0;
+        char name[32];
+
+        if (id == 0 || id > newest || __atomic_load_n(&slot->done, __ATOMIC_ACQUIRE) != id) {
+            continue;
+        }
+        for (i = 0; i < FRAME_TRACE_STAGES; i++) {
+            t[i] = __atomic_load_n(&slot->t[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->id, __ATOMIC_RELAXED) != id ||
+            __atomic_load_n(&slot->done, __ATOMIC_RELAXED) != id) {
+            continue;   /* reused while we read it */
+        }
+
+        for (i = 0; i < FRAME_TRACE_STAGES; i++) {
+            if (t[i] != 0) {
+                start_ns = stamps == 0 || t[i] < start_ns ? t[i] : start_ns;
+                end_ns = stamps == 0 || t[i] > end_ns ? t[i] : end_ns;
+                stamps++;
+            }
+        }
+        if (stamps < 2) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "frame %u", id);
+        err |= write_event(out, name, 'b', id, start_ns) < 0;
+        for (i = 1; i < FRAME_TRACE_STAGES; i++) {
+            if (t[i] != 0 && t[i - 1] != 0) {
+                /* Stamps come from different threads; a slice never runs backwards */
+                int64_t start = t[i - 1] < t[i] ? t[i - 1] : t[i];
+                err |= write_event(out, interval_names[i], 'b', id, start) < 0;
+                err |= write_event(out, interval_names[i], 'e', id, t[i]) < 0;
+            }
+        }
+        err |= write_event(out, name, 'e', id, end_ns) < 0;
+        written++;
+    }
+    err |= fprintf(out, "\n]}\n") < 0;
+    return err ? -1 : written;
+}
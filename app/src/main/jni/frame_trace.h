@@ -0,0 +1,110 @@
+/**
+ * Per-frame stage timestamps for the mirror video path
+ *
+ * Every video packet gets an id when its payload has been read and collects a
+ * CLOCK_MONOTONIC timestamp at each stage on its way to the screen:
+ *
+ *   capture     sender timestamp mapped to local time (access_unit.h); with no
+ *               clock sync this is the fastest transit ever seen, so the first
+ *               interval is the network delay above the best case
+ *   arrival     payload read from the socket           (reader thread)
+ *   decrypted                                           (reader thread)
+ *   dequeued    taken off the frame queue               (decoder thread)
+ *   assembled   parsed into an access unit              (decoder thread)
+ *   input       queued to MediaCodec                    (decoder thread)
+ *   output      came out of MediaCodec                  (decoder thread)
+ *
+ * Stamps go into a ring of fixed slots indexed by id, with plain atomic
+ * stores: no lock, no allocation, nothing shared between the reader and the
+ * decoder thread except the slot of the frame they are both handling. When a
+ * frame completes (decoded, or dropped before the decoder), the interval
+ * ending at each stage it reached goes into that stage's histogram, and the
+ * whole capture-to-output time into the end-to-end one. Histograms are
+ * log-linear, four buckets per power of two from 1 us to 33 s.
+ *
+ * The ring keeps the last FRAME_TRACE_CAPACITY frames for
+ * frame_trace_write_json, a Chrome trace (chrome://tracing, Perfetto) with each
+ * frame as an async track holding one slice per stage, so a latency regression
+ * shows up in the stage it comes from.
+ *
+ * frame_trace_begin is for one thread (the reader's); frame_trace_output and
+ * frame_trace_end for one thread (the decoder's); frame_trace_mark for the
+ * thread at that stage. Stats and the JSON dump may be taken from any thread.
+ * Nothing here reads a clock.
+ */
+
+#ifndef FRAME_TRACE_H
+#define FRAME_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define FRAME_TRACE_CAPACITY 1024           /* frames kept in the ring (power of two) */
+#define FRAME_TRACE_OUTPUT_WINDOW 256       /* newest frames searched for a decoder output (queue + codec) */
+#define FRAME_TRACE_BUCKETS 96
+
+/* Stages, in pipeline order */
+#define FRAME_TRACE_CAPTURE 0
+#define FRAME_TRACE_ARRIVAL 1
+#define FRAME_TRACE_DECRYPTED 2
+#define FRAME_TRACE_DEQUEUED 3
+#define FRAME_TRACE_ASSEMBLED 4
+#define FRAME_TRACE_INPUT 5
+#define FRAME_TRACE_OUTPUT 6
+#define FRAME_TRACE_STAGES 7
+
+/* Histograms: index s > 0 is the interval from stage s - 1 to stage s; 0 is capture to output */
+#define FRAME_TRACE_END_TO_END 0
+
+typedef struct frame_trace_s frame_trace_t;
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long sum_ns;
+    int64_t max_ns;
+    unsigned long long buckets[FRAME_TRACE_BUCKETS];
+} frame_trace_histogram_t;
+
+typedef struct {
+    unsigned long long frames;              /* ids handed out */
+    unsigned long long completed;
+    unsigned long long decoded;             /* completed through decoder output */
+    unsigned long long unmatched_outputs;   /* outputs with no frame waiting for them (replays, old codecs) */
+    frame_trace_histogram_t histograms[FRAME_TRACE_STAGES];
+} frame_trace_stats_t;
+
+/* NULL on allocation failure */
+frame_trace_t *frame_trace_create(void);
+
+void frame_trace_destroy(frame_trace_t *trace);
+
+/* A packet was read at arrival_ns. Returns its id (never 0). */
+uint32_t frame_trace_begin(frame_trace_t *trace, int64_t arrival_ns);
+
+/* Stage FRAME_TRACE_* reached at ns; ignored for id 0 or a frame the ring has moved past */
+void frame_trace_mark(frame_trace_t *trace, uint32_t id, int stage, int64_t ns);
+
+/* MediaCodec gave back the frame whose capture stamp is pts_ns (compared in whole us); completes it.
+ * Returns 0, or -1 when no recent frame queued to the decoder matches. */
+int frame_trace_output(frame_trace_t *trace, int64_t pts_ns, int64_t ns);
+
+/* The decoder thread is done with the packet: completes it now, unless it is
+ * inside the decoder, in which case frame_trace_output will */
+void frame_trace_end(frame_trace_t *trace, uint32_t id);
+
+void frame_trace_get_stats(frame_trace_t *trace, frame_trace_stats_t *stats);
+
+/* Smallest bucket bound with at least p percent of the samples at or below it (ns); 0 when empty */
+int64_t frame_trace_percentile(const frame_trace_histogram_t *histogram, double p);
+
+/* Upper bound of a histogram bucket in ns */
+int64_t frame_trace_bucket_upper_ns(int bucket);
+
+/* "capture", "arrival", ...; for histograms, the interval ending there ("network", "decrypt", ...) */
+const char *frame_trace_stage_name(int stage);
+const char *frame_trace_interval_name(int stage);
+
+/* Completed frames still in the ring as Chrome trace JSON. Returns the frames written, -1 on a write error. */
+int frame_trace_write_json(frame_trace_t *trace, FILE *out);
+
+#endif // FRAME_TRACE_H
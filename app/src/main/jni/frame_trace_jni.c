@@ -0,0 +1,171 @@
+#include <jni.h>
+#include <unistd.h>
+#include <android/log.h>
+#include "frame_trace.h"
+
+#define LOG_TAG "FrameTraceJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeGetStats (must match FrameTrace.kt): the counters,
+ * then count, p50, p90, p99 and max for each histogram */
+#define STATS_COUNTERS 4
+#define STATS_PER_HISTOGRAM 5
+#define STATS_LEN (STATS_COUNTERS + STATS_PER_HISTOGRAM * FRAME_TRACE_STAGES)
+
+/**
+ * Allocate a trace
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeCreate(JNIEnv *env, jobject thiz) {
+    frame_trace_t *trace = frame_trace_create();
+    if (trace == NULL) {
+        LOGE("Failed to allocate frame trace");
+        return 0;
+    }
+    return (jlong)trace;
+}
+
+/**
+ * Reader thread: a packet payload was read
+ * Input: arrivalNs = System.nanoTime() when it was
+ * Output: the frame's id, 0 without a trace
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeBegin(JNIEnv *env, jobject thiz, jlong handle,
+                                                          jlong arrival_ns) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    return trace != NULL ? (jint)frame_trace_begin(trace, arrival_ns) : 0;
+}
+
+/**
+ * A frame reached a stage
+ * Input: id = from nativeBegin, stage = FrameTrace stage, ns = System.nanoTime() (or the capture estimate)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeMark(JNIEnv *env, jobject thiz, jlong handle, jint id,
+                                                         jint stage, jlong ns) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    if (trace != NULL) {
+        frame_trace_mark(trace, (uint32_t)id, stage, ns);
+    }
+}
+
+/**
+ * Decoder thread: MediaCodec released an output buffer
+ * Input: ptsUs = its presentation time, ns = System.nanoTime()
+ * Output: 0, or -1 when no traced frame was waiting for it
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeOutput(JNIEnv *env, jobject thiz, jlong handle, jlong pts_us,
+                                                           jlong ns) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    return trace != NULL ? frame_trace_output(trace, pts_us * 1000, ns) : -1;
+}
+
+/**
+ * Decoder thread: done with the packet (completes it unless it is inside the decoder)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeEnd(JNIEnv *env, jobject thiz, jlong handle, jint id) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    if (trace != NULL) {
+        frame_trace_end(trace, (uint32_t)id);
+    }
+}
+
+/**
+ * Snapshot of the counters and per-stage latency percentiles
+ * Output: out = frames, completed, decoded, unmatched outputs, then for each histogram
+ *         (end to end, network, decrypt, queue, assemble, decoder input, decode):
+ *         count, p50, p90, p99, max (ns)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle,
+                                                             jlongArray out) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    frame_trace_stats_t stats;
+    jlong values[STATS_LEN];
+    int i;
+
+    if (trace == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    frame_trace_get_stats(trace, &stats);
+    values[0] = (jlong)stats.frames;
+    values[1] = (jlong)stats.completed;
+    values[2] = (jlong)stats.decoded;
+    values[3] = (jlong)stats.unmatched_outputs;
+    for (i = 0; i < FRAME_TRACE_STAGES; i++) {
+        const frame_trace_histogram_t *histogram = &stats.histograms[i];
+        jlong *v = &values[STATS_COUNTERS + STATS_PER_HISTOGRAM * i];
+
+        v[0] = (jlong)histogram->count;
+        v[1] = frame_trace_percentile(histogram, 50);
+        v[2] = frame_trace_percentile(histogram, 90);
+        v[3] = frame_trace_percentile(histogram, 99);
+        v[4] = histogram->max_ns;
+    }
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * One histogram in full
+ * Input: stage = histogram index (0 end to end, else the interval ending at that stage)
+ * Output: out = bucket counts, then the bucket upper bounds in ns (2 * FRAME_TRACE_BUCKETS values);
+ *         0, or -1 for a bad index or short array
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeGetHistogram(JNIEnv *env, jobject thiz, jlong handle,
+                                                                 jint stage, jlongArray out) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    frame_trace_stats_t stats;
+    jlong values[2 * FRAME_TRACE_BUCKETS];
+    int b;
+
+    if (trace == NULL || stage < 0 || stage >= FRAME_TRACE_STAGES ||
+        (*env)->GetArrayLength(env, out) < 2 * FRAME_TRACE_BUCKETS) {
+        return -1;
+    }
+    frame_trace_get_stats(trace, &stats);
+    for (b = 0; b < FRAME_TRACE_BUCKETS; b++) {
+        values[b] = (jlong)stats.histograms[stage].buckets[b];
+        values[FRAME_TRACE_BUCKETS + b] = frame_trace_bucket_upper_ns(b);
+    }
+    (*env)->SetLongArrayRegion(env, out, 0, 2 * FRAME_TRACE_BUCKETS, values);
+    return 0;
+}
+
+/**
+ * Write the frames still in the ring as Chrome trace JSON
+ * Input: fd = open for writing, closed here
+ * Output: frames written, -1 on a write error
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeWriteJson(JNIEnv *env, jobject thiz, jlong handle, jint fd) {
+    frame_trace_t *trace = (frame_trace_t *)handle;
+    FILE *out;
+    int written;
+
+    if (trace == NULL || (out = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        return -1;
+    }
+    written = frame_trace_write_json(trace, out);
+    if (fclose(out) != 0) {
+        written = -1;
+    }
+    if (written < 0) {
+        LOGE("Failed to write frame trace");
+    }
+    return written;
+}
+
+/**
+ * Free a trace from nativeCreate; no thread may use it any more
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_FrameTrace_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    frame_trace_destroy((frame_trace_t *)handle);
+}
@@ -0,0 +1,318 @@
+/**
+ * H.264 SPS / PPS parser
+ */
+
+#include <string.h>
+
+#include "h264_params.h"
+#include "rbsp_reader.h"
+
+#define NAL_SPS 7
+#define NAL_PPS 8
+
+#define MAX_MBS_PER_SIDE 1024           /* 16384 pixels, above any level's limit */
+
+static void
+skip_scaling_list(bit_reader_t *br, int size)
+{
+    int last = 8, next = 8, j;
+
+    for (j = 0; j < size; j++) {
+        if (next != 0) {
+            next = (last + br_se(br) + 256) % 256;
+        }
+        last = next == 0 ? last : next;
+    }
+}
+
+static void
+skip_hrd(bit_reader_t *br)
+{
+    uint32_t cpb_cnt = br_ue(br) + 1, i;
+
+    br_u(br, 4);                        /* bit_rate_scale */
+    br_u(br, 4);                        /* cpb_size_scale */
+    for (i = 0; i < cpb_cnt && i < 32 && !br->overrun; i++) {
+        br_ue(br);                      /* bit_rate_value_minus1 */
+        br_ue(br);                      /* cpb_size_value_minus1 */
+        br_u1(br);                      /* cbr_flag */
+    }
+    br_u(br, 20);                       /* four 5-bit delay / offset lengths */
+}
+
+static void
+parse_vui(bit_reader_t *br, h264_sps_t *sps)
+{
+    int nal_hrd, vcl_hrd;
+
+    if (br_u1(br)) {                    /* aspect_ratio_info_present */
+        static const int sar[17][2] = {
+            { 0, 0 }, { 1, 1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 }, { 24, 11 }, { 20, 11 },
+            { 32, 11 }, { 80, 33 }, { 18, 11 }, { 15, 11 }, { 64, 33 }, { 160, 99 }, { 4, 3 }, { 3, 2 }, { 2, 1 },
+        };
+        int idc = (int)br_u(br, 8);
+        if (idc == 255) {
+            sps->sar_width = (int)br_u(br, 16);
+            sps->sar_height = (int)br_u(br, 16);
+        } else if (idc < 17) {
+            sps->sar_width = sar[idc][0];
+            sps->sar_height = sar[idc][1];
+        }
+    }
+    if (br_u1(br)) {                    /* overscan_info_present */
+        br_u1(br);
+    }
+    if (br_u1(br)) {                    /* video_signal_type_present */
+        br_u(br, 3);                    /* video_format */
+        sps->video_full_range = (int)br_u1(br);
+        if (br_u1(br)) {
+            sps->colour_primaries = (int)br_u(br, 8);
+            sps->transfer_characteristics = (int)br_u(br, 8);
+            sps->matrix_coefficients = (int)br_u(br, 8);
+        }
+    }
+    if (br_u1(br)) {                    /* chroma_loc_info_present */
+        br_ue(br);
+        br_ue(br);
+    }
+    if (br_u1(br)) {                    /* timing_info_present */
+        sps->num_units_in_tick = br_u(br, 32);
+        sps->time_scale = br_u(br, 32);
+        sps->fixed_frame_rate = (int)br_u1(br);
+    }
+    nal_hrd = (int)br_u1(br);
+    if (nal_hrd) {
+        skip_hrd(br);
+    }
+    vcl_hrd = (int)br_u1(br);
+    if (vcl_hrd) {
+        skip_hrd(br);
+    }
+    if (nal_hrd || vcl_hrd) {
+        br_u1(br);                      /* low_delay_hrd_flag */
+    }
+    br_u1(br);                          /* pic_struct_present_flag */
+    if (br_u1(br)) {                    /* bitstream_restriction */
+        br_u1(br);                      /* motion_vectors_over_pic_boundaries */
+        br_ue(br);                      /* max_bytes_per_pic_denom */
+        br_ue(br);                      /* max_bits_per_mb_denom */
+        br_ue(br);                      /* log2_max_mv_length_horizontal */
+        br_ue(br);                      /* log2_max_mv_length_vertical */
+        sps->max_num_reorder_frames = (int)br_ue(br);
+        sps->max_dec_frame_buffering = (int)br_ue(br);
+    }
+}
+
+static int
+has_chroma_info(int profile_idc)
+{
+    switch (profile_idc) {
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+    case 118: case 128: case 138: case 139: case 134: case 135:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int
+h264_sps_parse(const unsigned char *nal, int len, h264_sps_t *sps)
+{
+    bit_reader_t br;
+    uint32_t width_mbs, height_map_units, i, n;
+    int crop_unit_x, crop_unit_y;
+
+    memset(sps, 0, sizeof(*sps));
+    if (len < 4 || (nal[0] & 0x1f) != NAL_SPS) {
+        return -1;
+    }
+    br_init(&br, nal + 1, len - 1);
+
+    sps->profile_idc = (int)br_u(&br, 8);
+    sps->constraint_flags = (int)br_u(&br, 8);
+    sps->level_idc = (int)br_u(&br, 8);
+    sps->sps_id = (int)br_ue(&br);
+    sps->chroma_format_idc = 1;
+    sps->bit_depth_luma = 8;
+    sps->bit_depth_chroma = 8;
+    sps->colour_primaries = 2;
+    sps->transfer_characteristics = 2;
+    sps->matrix_coefficients = 2;
+    sps->max_num_reorder_frames = -1;
+    sps->max_dec_frame_buffering = -1;
+
+    if (has_chroma_info(sps->profile_idc)) {
+        sps->chroma_format_idc = (int)br_ue(&br);
+        if (sps->chroma_format_idc == 3) {
+            sps->separate_colour_plane = (int)br_u1(&br);
+        }
+        sps->bit_depth_luma = (int)br_ue(&br) + 8;
+        sps->bit_depth_chroma = (int)br_ue(&br) + 8;
+        br_u1(&br);                     /* qpprime_y_zero_transform_bypass */
+        sps->scaling_matrix_present = (int)br_u1(&br);
+        if (sps->scaling_matrix_present) {
+            n = sps->chroma_format_idc == 3 ? 12 : 8;
+            for (i = 0; i < n; i++) {
+                if (br_u1(&br)) {
+                    skip_scaling_list(&br, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+    if (sps->sps_id > 31 || sps->chroma_format_idc > 3 || sps->bit_depth_luma > 14 || sps->bit_depth_chroma > 14) {
+        return -1;
+    }
+
+    sps->log2_max_frame_num = (int)br_ue(&br) + 4;
+    sps->pic_order_cnt_type = (int)br_ue(&br);
+    if (sps->pic_order_cnt_type == 0) {
+        sps->log2_max_poc_lsb = (int)br_ue(&br) + 4;
+    } else if (sps->pic_order_cnt_type == 1) {
+        br_u1(&br);                     /* delta_pic_order_always_zero */
+        br_se(&br);                     /* offset_for_non_ref_pic */
+        br_se(&br);                     /* offset_for_top_to_bottom_field */
+        n = br_ue(&br);
+        if (n > 255) {
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            br_se(&br);
+        }
+    } else if (sps->pic_order_cnt_type != 2) {
+        return -1;
+    }
+    sps->max_num_ref_frames = (int)br_ue(&br);
+    sps->gaps_in_frame_num_allowed = (int)br_u1(&br);
+    width_mbs = br_ue(&br) + 1;
+    height_map_units = br_ue(&br) + 1;
+    sps->frame_mbs_only = (int)br_u1(&br);
+    if (!sps->frame_mbs_only) {
+        sps->mb_adaptive_frame_field = (int)br_u1(&br);
+    }
+    sps->direct_8x8_inference = (int)br_u1(&br);
+    if (br_u1(&br)) {                   /* frame_cropping_flag */
+        sps->crop_left = (int)br_ue(&br);
+        sps->crop_right = (int)br_ue(&br);
+        sps->crop_top = (int)br_ue(&br);
+        sps->crop_bottom = (int)br_ue(&br);
+    }
+    sps->vui_present = (int)br_u1(&br);
+    if (sps->vui_present) {
+        parse_vui(&br, sps);
+    }
+    if (br.overrun || sps->log2_max_frame_num > 16 || sps->log2_max_poc_lsb > 16 || sps->max_num_ref_frames > 16 ||
+        width_mbs > MAX_MBS_PER_SIDE || height_map_units > MAX_MBS_PER_SIDE) {
+        return -1;
+    }
+
+    sps->coded_width = (int)width_mbs * 16;
+    sps->coded_height = (int)height_map_units * 16 * (2 - sps->frame_mbs_only);
+    if (sps->coded_height > MAX_MBS_PER_SIDE * 16) {
+        return -1;
+    }
+    if (sps->chroma_format_idc == 0 || sps->separate_colour_plane) {
+        crop_unit_x = 1;
+        crop_unit_y = 2 - sps->frame_mbs_only;
+    } else {
+        crop_unit_x = sps->chroma_format_idc == 3 ? 1 : 2;
+        crop_unit_y = (sps->chroma_format_idc == 1 ? 2 : 1) * (2 - sps->frame_mbs_only);
+    }
+    sps->width = sps->coded_width - crop_unit_x * (sps->crop_left + sps->crop_right);
+    sps->height = sps->coded_height - crop_unit_y * (sps->crop_top + sps->crop_bottom);
+    if (sps->width <= 0 || sps->height <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+h264_pps_parse(const unsigned char *nal, int len, h264_pps_t *pps)
+{
+    bit_reader_t br;
+
+    memset(pps, 0, sizeof(*pps));
+    if (len < 2 || (nal[0] & 0x1f) != NAL_PPS) {
+        return -1;
+    }
+    br_init(&br, nal + 1, len - 1);
+
+    pps->pps_id = (int)br_ue(&br);
+    pps->sps_id = (int)br_ue(&br);
+    pps->entropy_coding_mode = (int)br_u1(&br);
+    pps->bottom_field_pic_order_present = (int)br_u1(&br);
+    pps->num_slice_groups = (int)br_ue(&br) + 1;
+    if (pps->pps_id > 255 || pps->sps_id > 31 || pps->num_slice_groups > 8) {
+        return -1;
+    }
+    if (pps->num_slice_groups > 1) {
+        /* FMO (Baseline only); the fields after the slice group map are not needed */
+        return br.overrun ? -1 : 0;
+    }
+    pps->num_ref_idx_l0_default = (int)br_ue(&br) + 1;
+    pps->num_ref_idx_l1_default = (int)br_ue(&br) + 1;
+    pps->weighted_pred = (int)br_u1(&br);
+    pps->weighted_bipred_idc = (int)br_u(&br, 2);
+    pps->pic_init_qp = 26 + br_se(&br);
+    br_se(&br);                         /* pic_init_qs_minus26 */
+    pps->chroma_qp_index_offset = br_se(&br);
+    pps->deblocking_filter_control_present = (int)br_u1(&br);
+    pps->constrained_intra_pred = (int)br_u1(&br);
+    pps->redundant_pic_cnt_present = (int)br_u1(&br);
+    if (br.overrun || pps->num_ref_idx_l0_default > 32 || pps->num_ref_idx_l1_default > 32) {
+        return -1;
+    }
+    /* transform_8x8_mode and the second chroma offset may follow; not needed here */
+    return 0;
+}
+
+int
+h264_sps_compare(const h264_sps_t *current, const h264_sps_t *next)
+{
+    if (current->profile_idc != next->profile_idc ||
+        current->chroma_format_idc != next->chroma_format_idc ||
+        current->separate_colour_plane != next->separate_colour_plane ||
+        current->bit_depth_luma != next->bit_depth_luma ||
+        current->bit_depth_chroma != next->bit_depth_chroma ||
+        current->frame_mbs_only != next->frame_mbs_only) {
+        return H264_SPS_INCOMPATIBLE;
+    }
+    if (current->coded_width != next->coded_width ||
+        current->coded_height != next->coded_height ||
+        current->width != next->width ||
+        current->height != next->height ||
+        current->level_idc != next->level_idc ||
+        current->max_num_ref_frames != next->max_num_ref_frames ||
+        current->max_dec_frame_buffering != next->max_dec_frame_buffering ||
+        current->max_num_reorder_frames != next->max_num_reorder_frames) {
+        return H264_SPS_RESOLUTION;
+    }
+    /* frame_num / POC sizes, scaling matrices and the rest are read per slice from the in-band SPS */
+    return H264_SPS_SAME;
+}
+
+double
+h264_sps_frame_rate(const h264_sps_t *sps)
+{
+    if (sps->num_units_in_tick == 0 || sps->time_scale == 0) {
+        return 0;
+    }
+    return (double)sps->time_scale / (2.0 * sps->num_units_in_tick);
+}
+
+int
+h264_sps_max_input_size(const h264_sps_t *sps, int width, int height)
+{
+    /* chroma samples per 4 luma samples: mono, 4:2:0, 4:2:2, 4:4:4 */
+    static const int chroma_quarters[4] = { 0, 2, 4, 8 };
+    int64_t samples, bits;
+
+    if (width <= 0 || height <= 0) {
+        width = sps->coded_width;
+        height = sps->coded_height;
+    }
+    width = (width + 15) & ~15;
+    height = (height + 15) & ~15;
+    samples = (int64_t)width * height;
+    bits = samples * sps->bit_depth_luma + samples * chroma_quarters[sps->chroma_format_idc & 3] / 4 * sps->bit_depth_chroma;
+    return (int)(bits / 8 / (sps->level_idc >= 31 && sps->level_idc <= 42 ? 4 : 2));
+}
@@ -0,0 +1,107 @@
+/**
+ * H.264 SPS / PPS parser
+ *
+ * Decodes the Exp-Golomb fields of sequence and picture parameter sets
+ * (emulation prevention bytes removed on the fly) into plain structs, so the
+ * video pipeline can size MediaCodec from the stream instead of guessing and
+ * can tell a parameter set that really needs a new decoder from one that only
+ * differs in bytes.
+ *
+ * h264_sps_compare classifies a new SPS against the one the decoder was
+ * configured with:
+ *   H264_SPS_SAME          every decoding field matches (the bytes may differ in
+ *                          VUI timing, HRD or colour description); feed in band
+ *   H264_SPS_RESOLUTION    only the picture size, cropping, reference or order
+ *                          counts changed; a decoder with adaptive playback
+ *                          configured for the larger size takes it in band
+ *   H264_SPS_INCOMPATIBLE  profile, chroma format, bit depth or field coding
+ *                          changed; the decoder must be reconfigured
+ */
+
+#ifndef H264_PARAMS_H
+#define H264_PARAMS_H
+
+#include <stdint.h>
+
+#define H264_SPS_SAME 0
+#define H264_SPS_RESOLUTION 1
+#define H264_SPS_INCOMPATIBLE 2
+
+typedef struct {
+    int profile_idc;
+    int constraint_flags;               /* constraint_set0..5 in bits 7..2 */
+    int level_idc;
+    int sps_id;
+    int chroma_format_idc;              /* 0 mono, 1 4:2:0, 2 4:2:2, 3 4:4:4 */
+    int separate_colour_plane;
+    int bit_depth_luma;
+    int bit_depth_chroma;
+    int scaling_matrix_present;
+    int log2_max_frame_num;
+    int pic_order_cnt_type;
+    int log2_max_poc_lsb;               /* pic_order_cnt_type 0 */
+    int max_num_ref_frames;
+    int gaps_in_frame_num_allowed;
+    int frame_mbs_only;
+    int mb_adaptive_frame_field;
+    int direct_8x8_inference;
+    int crop_left;                      /* frame_crop_*_offset, in crop units */
+    int crop_right;
+    int crop_top;
+    int crop_bottom;
+    int coded_width;                    /* macroblock-aligned luma size */
+    int coded_height;
+    int width;                          /* displayed size after cropping */
+    int height;
+
+    int vui_present;
+    int sar_width;                      /* 0 when not signalled */
+    int sar_height;
+    int video_full_range;
+    int colour_primaries;               /* 2 (unspecified) when not signalled */
+    int transfer_characteristics;
+    int matrix_coefficients;
+    uint32_t num_units_in_tick;         /* 0 when timing is not signalled */
+    uint32_t time_scale;
+    int fixed_frame_rate;
+    int max_num_reorder_frames;         /* -1 when bitstream_restriction is absent */
+    int max_dec_frame_buffering;
+} h264_sps_t;
+
+typedef struct {
+    int pps_id;
+    int sps_id;
+    int entropy_coding_mode;            /* 1 = CABAC */
+    int bottom_field_pic_order_present;
+    int num_slice_groups;
+    int num_ref_idx_l0_default;
+    int num_ref_idx_l1_default;
+    int weighted_pred;
+    int weighted_bipred_idc;
+    int pic_init_qp;
+    int chroma_qp_index_offset;
+    int deblocking_filter_control_present;
+    int constrained_intra_pred;
+    int redundant_pic_cnt_present;
+} h264_pps_t;
+
+/* nal = one SPS NAL unit including its header byte, no start code.
+ * Returns 0, or -1 when it is not an SPS or is truncated / out of range. */
+int h264_sps_parse(const unsigned char *nal, int len, h264_sps_t *sps);
+
+/* nal = one PPS NAL unit including its header byte. Returns 0 or -1. */
+int h264_pps_parse(const unsigned char *nal, int len, h264_pps_t *pps);
+
+/* H264_SPS_SAME / _RESOLUTION / _INCOMPATIBLE for next against current */
+int h264_sps_compare(const h264_sps_t *current, const h264_sps_t *next);
+
+/* Frames per second from VUI timing (0 when absent) */
+double h264_sps_frame_rate(const h264_sps_t *sps);
+
+/* Decoder input buffer size for one access unit of up to width x height
+ * (0, 0: the SPS's coded size) in this SPS's chroma format and bit depth,
+ * compressed at least by the level's MinCR (Table A-1: 4 for levels 3.1 to
+ * 4.2, else 2) */
+int h264_sps_max_input_size(const h264_sps_t *sps, int width, int height);
+
+#endif // H264_PARAMS_H
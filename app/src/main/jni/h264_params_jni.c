@@ -0,0 +1,118 @@
+#include <jni.h>
+#include <android/log.h>
+#include "h264_params.h"
+
+#define LOG_TAG "H264ParamsJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeParseSps (must match H264ParameterSets.kt) */
+#define OUT_PROFILE 0
+#define OUT_LEVEL 1
+#define OUT_WIDTH 2
+#define OUT_HEIGHT 3
+#define OUT_CODED_WIDTH 4
+#define OUT_CODED_HEIGHT 5
+#define OUT_CHROMA_FORMAT 6
+#define OUT_BIT_DEPTH 7
+#define OUT_MAX_REF_FRAMES 8
+#define OUT_FRAME_RATE_MILLI 9
+#define OUT_FULL_RANGE 10
+#define OUT_COLOUR_PRIMARIES 11
+#define OUT_TRANSFER 12
+#define OUT_MATRIX 13
+#define OUT_MAX_INPUT_SIZE 14
+#define OUT_MAX_INPUT_SIZE_ROTATED 15
+#define OUT_LEN 16
+
+static int
+parse_sps(JNIEnv *env, jbyteArray nal, h264_sps_t *sps)
+{
+    jsize len = (*env)->GetArrayLength(env, nal);
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, nal, NULL);
+    int ret;
+
+    if (bytes == NULL) {
+        return -1;
+    }
+    ret = h264_sps_parse((const unsigned char *)bytes, len, sps);
+    (*env)->ReleasePrimitiveArrayCritical(env, nal, bytes, JNI_ABORT);
+    return ret;
+}
+
+/**
+ * Decode one SPS
+ * Input: nal = SPS NAL unit without start code
+ * Output: 0 with out[] filled, -1 if it is not a valid SPS
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_H264ParameterSets_nativeParseSps(JNIEnv *env, jobject thiz, jbyteArray nal,
+                                                                    jlongArray out) {
+    h264_sps_t sps;
+    jlong fields[OUT_LEN];
+    int side;
+
+    if ((*env)->GetArrayLength(env, out) < OUT_LEN) {
+        LOGE("Output array too short: need %d longs", OUT_LEN);
+        return -1;
+    }
+    if (parse_sps(env, nal, &sps) != 0) {
+        return -1;
+    }
+    side = sps.coded_width > sps.coded_height ? sps.coded_width : sps.coded_height;
+    fields[OUT_PROFILE] = sps.profile_idc;
+    fields[OUT_LEVEL] = sps.level_idc;
+    fields[OUT_WIDTH] = sps.width;
+    fields[OUT_HEIGHT] = sps.height;
+    fields[OUT_CODED_WIDTH] = sps.coded_width;
+    fields[OUT_CODED_HEIGHT] = sps.coded_height;
+    fields[OUT_CHROMA_FORMAT] = sps.chroma_format_idc;
+    fields[OUT_BIT_DEPTH] = sps.bit_depth_luma;
+    fields[OUT_MAX_REF_FRAMES] = sps.max_num_ref_frames;
+    fields[OUT_FRAME_RATE_MILLI] = (jlong)(h264_sps_frame_rate(&sps) * 1000.0);
+    fields[OUT_FULL_RANGE] = sps.video_full_range;
+    fields[OUT_COLOUR_PRIMARIES] = sps.colour_primaries;
+    fields[OUT_TRANSFER] = sps.transfer_characteristics;
+    fields[OUT_MATRIX] = sps.matrix_coefficients;
+    fields[OUT_MAX_INPUT_SIZE] = h264_sps_max_input_size(&sps, 0, 0);
+    fields[OUT_MAX_INPUT_SIZE_ROTATED] = h264_sps_max_input_size(&sps, side, side);
+    (*env)->SetLongArrayRegion(env, out, 0, OUT_LEN, fields);
+    return 0;
+}
+
+/**
+ * Check that a PPS decodes and return the SPS it refers to
+ * Input: nal = PPS NAL unit without start code
+ * Output: seq_parameter_set_id, -1 if it is not a valid PPS
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_H264ParameterSets_nativeParsePps(JNIEnv *env, jobject thiz, jbyteArray nal) {
+    h264_pps_t pps;
+    jsize len = (*env)->GetArrayLength(env, nal);
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, nal, NULL);
+    int ret;
+
+    if (bytes == NULL) {
+        return -1;
+    }
+    ret = h264_pps_parse((const unsigned char *)bytes, len, &pps);
+    (*env)->ReleasePrimitiveArrayCritical(env, nal, bytes, JNI_ABORT);
+    return ret == 0 ? pps.sps_id : -1;
+}
+
+/**
+ * Classify a new SPS against the one the decoder was configured with
+ * Input: current / next = SPS NAL units without start code
+ * Output: H264_SPS_SAME, H264_SPS_RESOLUTION or H264_SPS_INCOMPATIBLE
+ *         (incompatible whenever either one does not decode)
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_H264ParameterSets_nativeCompareSps(JNIEnv *env, jobject thiz, jbyteArray current,
+                                                                      jbyteArray next) {
+    h264_sps_t a, b;
+
+    if (parse_sps(env, current, &a) != 0 || parse_sps(env, next, &b) != 0) {
+        return H264_SPS_INCOMPATIBLE;
+    }
+    return h264_sps_compare(&a, &b);
+}
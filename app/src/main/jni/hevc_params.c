@@ -0,0 +1,260 @@
+/**
+ * HEVC decoder configuration and SPS parser
+ */
+
+#include <string.h>
+
+#include "hevc_params.h"
+#include "rbsp_reader.h"
+
+#define HVCC_HEADER_LEN 23
+#define HVCC_MAX_ARRAYS 16
+#define HEVC_MAX_SIDE 16888                 /* level 6.2 limit: sqrt(MaxLumaPs x 8) */
+
+static int
+u16(const unsigned char *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+/* Parse a bare record; -1 unless every array is well formed and holds parameter sets */
+static int
+parse_record(const unsigned char *data, int base, int len, hevc_config_t *cfg)
+{
+    const unsigned char *rec = data + base;
+    int arrays, pos, i, j;
+
+    if (len < HVCC_HEADER_LEN || rec[0] != 1) {
+        return -1;
+    }
+    cfg->profile_space = rec[1] >> 6;
+    cfg->tier = (rec[1] >> 5) & 1;
+    cfg->profile_idc = rec[1] & 0x1f;
+    cfg->level_idc = rec[12];
+    cfg->chroma_format_idc = rec[16] & 3;
+    cfg->bit_depth_luma = (rec[17] & 7) + 8;
+    cfg->bit_depth_chroma = (rec[18] & 7) + 8;
+    cfg->temporal_layers = (rec[21] >> 3) & 7;
+    cfg->nal_length_size = (rec[21] & 3) + 1;
+    arrays = rec[22];
+    if (arrays == 0 || arrays > HVCC_MAX_ARRAYS) {
+        return -1;
+    }
+
+    pos = HVCC_HEADER_LEN;
+    for (i = 0; i < arrays; i++) {
+        int type, count;
+
+        if (pos + 3 > len) {
+            return -1;
+        }
+        type = rec[pos] & 0x3f;
+        count = u16(rec + pos + 1);
+        pos += 3;
+        /* Only non-VCL types (VPS, SPS, PPS, SEI, ...) belong in a configuration record */
+        if (HEVC_NAL_IS_VCL(type)) {
+            return -1;
+        }
+        for (j = 0; j < count; j++) {
+            int nal_len;
+
+            if (pos + 2 > len) {
+                return -1;
+            }
+            nal_len = u16(rec + pos);
+            pos += 2;
+            if (nal_len < 2 || pos + nal_len > len || (rec[pos] & 0x80) || HEVC_NAL_TYPE(rec[pos]) != type) {
+                return -1;
+            }
+            if (type == HEVC_NAL_VPS && cfg->vps_count++ == 0) {
+                cfg->vps_off = base + pos;
+                cfg->vps_len = nal_len;
+            } else if (type == HEVC_NAL_SPS && cfg->sps_count++ == 0) {
+                cfg->sps_off = base + pos;
+                cfg->sps_len = nal_len;
+            } else if (type == HEVC_NAL_PPS && cfg->pps_count++ == 0) {
+                cfg->pps_off = base + pos;
+                cfg->pps_len = nal_len;
+            }
+            pos += nal_len;
+        }
+    }
+    return cfg->sps_count > 0 && cfg->pps_count > 0 ? 0 : -1;
+}
+
+int
+hevc_config_parse(const unsigned char *data, int len, hevc_config_t *cfg)
+{
+    int i;
+
+    memset(cfg, 0, sizeof(*cfg));
+    if (parse_record(data, 0, len, cfg) == 0) {
+        cfg->record_len = len;
+        return 0;
+    }
+    /* Record wrapped in a box: [size]['hvcC'][record] */
+    for (i = 4; i + 4 <= len; i++) {
+        if (memcmp(data + i, "hvcC", 4) == 0) {
+            uint32_t box = (uint32_t)data[i - 4] << 24 | (uint32_t)data[i - 3] << 16 |
+                           (uint32_t)data[i - 2] << 8 | data[i - 1];
+            int body = len - (i + 4);
+
+            if (box >= 8 && box - 8 < (uint32_t)body) {
+                body = (int)(box - 8);
+            }
+            memset(cfg, 0, sizeof(*cfg));
+            if (parse_record(data, i + 4, body, cfg) != 0) {
+                return -1;
+            }
+            cfg->record_off = i + 4;
+            cfg->record_len = body;
+            return 0;
+        }
+    }
+    memset(cfg, 0, sizeof(*cfg));
+    return -1;
+}
+
+static void
+skip_profile_tier_level(bit_reader_t *br, hevc_sps_t *sps, int max_sub_layers_minus1)
+{
+    int profile_present[8], level_present[8], i;
+
+    sps->profile_space = (int)br_u(br, 2);
+    sps->tier = (int)br_u1(br);
+    sps->profile_idc = (int)br_u(br, 5);
+    br_u(br, 32);                       /* general_profile_compatibility_flags */
+    br_u(br, 24);                       /* progressive / interlaced / ... + 44 constraint bits */
+    br_u(br, 24);
+    sps->level_idc = (int)br_u(br, 8);
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        profile_present[i] = (int)br_u1(br);
+        level_present[i] = (int)br_u1(br);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        br_u(br, 2 * (8 - max_sub_layers_minus1));
+    }
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        if (profile_present[i]) {
+            br_u(br, 32);
+            br_u(br, 32);
+            br_u(br, 24);
+        }
+        if (level_present[i]) {
+            br_u(br, 8);
+        }
+    }
+}
+
+int
+hevc_sps_parse(const unsigned char *nal, int len, hevc_sps_t *sps)
+{
+    bit_reader_t br;
+    int max_sub_layers_minus1, sub_width, sub_height, i;
+    uint32_t width, height, left = 0, right = 0, top = 0, bottom = 0;
+
+    memset(sps, 0, sizeof(*sps));
+    if (len < 4 || HEVC_NAL_TYPE(nal[0]) != HEVC_NAL_SPS) {
+        return -1;
+    }
+    br_init(&br, nal + 2, len - 2);
+
+    sps->vps_id = (int)br_u(&br, 4);
+    max_sub_layers_minus1 = (int)br_u(&br, 3);
+    if (max_sub_layers_minus1 > 6) {
+        return -1;
+    }
+    sps->max_sub_layers = max_sub_layers_minus1 + 1;
+    br_u1(&br);                         /* sps_temporal_id_nesting_flag */
+    skip_profile_tier_level(&br, sps, max_sub_layers_minus1);
+    sps->sps_id = (int)br_ue(&br);
+    sps->chroma_format_idc = (int)br_ue(&br);
+    if (sps->sps_id > 15 || sps->chroma_format_idc > 3) {
+        return -1;
+    }
+    if (sps->chroma_format_idc == 3) {
+        sps->separate_colour_plane = (int)br_u1(&br);
+    }
+    width = br_ue(&br);
+    height = br_ue(&br);
+    if (br_u1(&br)) {                   /* conformance_window_flag */
+        left = br_ue(&br);
+        right = br_ue(&br);
+        top = br_ue(&br);
+        bottom = br_ue(&br);
+    }
+    sps->bit_depth_luma = (int)br_ue(&br) + 8;
+    sps->bit_depth_chroma = (int)br_ue(&br) + 8;
+    sps->log2_max_poc_lsb = (int)br_ue(&br) + 4;
+    i = br_u1(&br) ? 0 : max_sub_layers_minus1;     /* sub_layer_ordering_info_present_flag */
+    for (; i <= max_sub_layers_minus1; i++) {
+        sps->max_dec_pic_buffering = (int)br_ue(&br) + 1;
+        sps->max_num_reorder_pics = (int)br_ue(&br);
+        br_ue(&br);                     /* sps_max_latency_increase_plus1 */
+    }
+    if (br.overrun || width == 0 || height == 0 || width > HEVC_MAX_SIDE || height > HEVC_MAX_SIDE ||
+        sps->bit_depth_luma > 16 || sps->bit_depth_chroma > 16 || sps->log2_max_poc_lsb > 16 ||
+        sps->max_dec_pic_buffering > 16) {
+        return -1;
+    }
+
+    sps->coded_width = (int)width;
+    sps->coded_height = (int)height;
+    if (sps->separate_colour_plane || sps->chroma_format_idc == 0) {
+        sub_width = 1;
+        sub_height = 1;
+    } else {
+        sub_width = sps->chroma_format_idc == 3 ? 1 : 2;
+        sub_height = sps->chroma_format_idc == 1 ? 2 : 1;
+    }
+    if ((uint64_t)sub_width * ((uint64_t)left + right) >= width ||
+        (uint64_t)sub_height * ((uint64_t)top + bottom) >= height) {
+        return -1;
+    }
+    sps->width = (int)(width - (uint32_t)sub_width * (left + right));
+    sps->height = (int)(height - (uint32_t)sub_height * (top + bottom));
+    return 0;
+}
+
+int
+hevc_sps_compare(const hevc_sps_t *current, const hevc_sps_t *next)
+{
+    if (current->profile_space != next->profile_space ||
+        current->profile_idc != next->profile_idc ||
+        current->chroma_format_idc != next->chroma_format_idc ||
+        current->separate_colour_plane != next->separate_colour_plane ||
+        current->bit_depth_luma != next->bit_depth_luma ||
+        current->bit_depth_chroma != next->bit_depth_chroma) {
+        return HEVC_SPS_INCOMPATIBLE;
+    }
+    if (current->coded_width != next->coded_width ||
+        current->coded_height != next->coded_height ||
+        current->width != next->width ||
+        current->height != next->height ||
+        current->tier != next->tier ||
+        current->level_idc != next->level_idc ||
+        current->max_dec_pic_buffering != next->max_dec_pic_buffering ||
+        current->max_num_reorder_pics != next->max_num_reorder_pics) {
+        return HEVC_SPS_RESOLUTION;
+    }
+    return HEVC_SPS_SAME;
+}
+
+int
+hevc_sps_max_input_size(const hevc_sps_t *sps, int width, int height)
+{
+    /* chroma samples per 4 luma samples: mono, 4:2:0, 4:2:2, 4:4:4 */
+    static const int chroma_quarters[4] = { 0, 2, 4, 8 };
+    int64_t samples, bits;
+
+    if (width <= 0 || height <= 0) {
+        width = sps->coded_width;
+        height = sps->coded_height;
+    }
+    /* Worst case coding tree blocks are 64x64 */
+    width = (width + 63) & ~63;
+    height = (height + 63) & ~63;
+    samples = (int64_t)width * height;
+    bits = samples * sps->bit_depth_luma + samples * chroma_quarters[sps->chroma_format_idc & 3] / 4 * sps->bit_depth_chroma;
+    return (int)(bits / 8 / (sps->level_idc >= 120 ? 4 : 2));
+}
@@ -0,0 +1,100 @@
+/**
+ * HEVC decoder configuration and SPS parser
+ *
+ * Mirror senders that stream HEVC send an hvcC record (ISO/IEC 14496-15
+ * HEVCDecoderConfigurationRecord) in the type 0x01 packet instead of avcC:
+ * arrays of VPS, SPS and PPS NAL units behind a header with the profile,
+ * chroma format, bit depth and NAL length size. hevc_config_parse finds the
+ * record (bare or inside an 'hvcC' box) and locates the parameter sets in
+ * place; hevc_sps_parse reads the picture size and decoding fields of an SPS
+ * so the decoder can be sized from the stream and only restarted for a change
+ * it cannot take, as h264_params does for H.264.
+ */
+
+#ifndef HEVC_PARAMS_H
+#define HEVC_PARAMS_H
+
+#include <stdint.h>
+
+/* NAL unit types (nal_unit_type, bits 1..6 of the first header byte) */
+#define HEVC_NAL_BLA_W_LP 16                /* first IRAP type */
+#define HEVC_NAL_IDR_W_RADL 19
+#define HEVC_NAL_IDR_N_LP 20
+#define HEVC_NAL_CRA 21
+#define HEVC_NAL_IRAP_LAST 23
+#define HEVC_NAL_VPS 32
+#define HEVC_NAL_SPS 33
+#define HEVC_NAL_PPS 34
+#define HEVC_NAL_TYPE(header) (((header) >> 1) & 0x3f)
+#define HEVC_NAL_IS_VCL(type) ((type) < HEVC_NAL_VPS)
+#define HEVC_NAL_IS_IRAP(type) ((type) >= HEVC_NAL_BLA_W_LP && (type) <= HEVC_NAL_IRAP_LAST)
+/* TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and reserved RSV_VCL_N10/12/14:
+ * not referenced by later pictures of the same temporal sub-layer */
+#define HEVC_NAL_IS_SUB_LAYER_NON_REF(type) ((type) <= 14 && ((type) & 1) == 0)
+
+/* Same values as H264_SPS_* */
+#define HEVC_SPS_SAME 0
+#define HEVC_SPS_RESOLUTION 1
+#define HEVC_SPS_INCOMPATIBLE 2
+
+typedef struct {
+    int profile_space;
+    int tier;
+    int profile_idc;                    /* 1 Main, 2 Main 10, 3 Main Still, 4 range extensions */
+    int level_idc;                      /* 30 x level number */
+    int chroma_format_idc;
+    int bit_depth_luma;
+    int bit_depth_chroma;
+    int temporal_layers;
+    int nal_length_size;                /* bytes in each NAL length prefix of the stream */
+    int vps_off;                        /* first NAL unit of each type, offsets into the data; len 0 when absent */
+    int vps_len;
+    int sps_off;
+    int sps_len;
+    int pps_off;
+    int pps_len;
+    int vps_count;
+    int sps_count;
+    int pps_count;
+    int record_off;                     /* the bare record within the data (past an 'hvcC' box header) */
+    int record_len;
+} hevc_config_t;
+
+typedef struct {
+    int vps_id;
+    int max_sub_layers;
+    int profile_space;
+    int tier;
+    int profile_idc;
+    int level_idc;
+    int sps_id;
+    int chroma_format_idc;
+    int separate_colour_plane;
+    int coded_width;                    /* pic_width / height_in_luma_samples */
+    int coded_height;
+    int width;                          /* after the conformance window */
+    int height;
+    int bit_depth_luma;
+    int bit_depth_chroma;
+    int log2_max_poc_lsb;
+    int max_dec_pic_buffering;          /* highest sub-layer */
+    int max_num_reorder_pics;
+} hevc_sps_t;
+
+/* data = a type 0x01 payload holding an hvcC record, bare or as an 'hvcC' box.
+ * Returns 0 with the parameter sets located, -1 if it is not an hvcC record
+ * (an avcC one, for instance) or has no SPS and PPS. */
+int hevc_config_parse(const unsigned char *data, int len, hevc_config_t *cfg);
+
+/* nal = one SPS NAL unit including its 2-byte header. Returns 0 or -1. */
+int hevc_sps_parse(const unsigned char *nal, int len, hevc_sps_t *sps);
+
+/* HEVC_SPS_SAME / _RESOLUTION / _INCOMPATIBLE for next against current */
+int hevc_sps_compare(const hevc_sps_t *current, const hevc_sps_t *next);
+
+/* Decoder input buffer size for one access unit of up to width x height
+ * (0, 0: the SPS's coded size), compressed at least by the level's MinCr
+ * (Table A.8: 4 or more from level 4 in either tier, else 2) */
+int hevc_sps_max_input_size(const hevc_sps_t *sps, int width, int height);
+
+#endif // HEVC_PARAMS_H
@@ -0,0 +1,135 @@
+#include <jni.h>
+#include <android/log.h>
+#include "hevc_params.h"
+
+#define LOG_TAG "HevcParamsJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeParseConfig (must match HevcParameterSets.kt) */
+#define CFG_PROFILE 0
+#define CFG_LEVEL 1
+#define CFG_NAL_LENGTH_SIZE 2
+#define CFG_VPS 3               /* offset, length */
+#define CFG_SPS 5
+#define CFG_PPS 7
+#define CFG_LEN 9
+
+/* Layout of the long[] filled by nativeParseSps (the H264ParameterSets.Sps fields it has) */
+#define OUT_PROFILE 0
+#define OUT_LEVEL 1
+#define OUT_WIDTH 2
+#define OUT_HEIGHT 3
+#define OUT_CODED_WIDTH 4
+#define OUT_CODED_HEIGHT 5
+#define OUT_CHROMA_FORMAT 6
+#define OUT_BIT_DEPTH 7
+#define OUT_MAX_REF_FRAMES 8
+#define OUT_MAX_INPUT_SIZE 9
+#define OUT_MAX_INPUT_SIZE_ROTATED 10
+#define OUT_LEN 11
+
+static int
+parse_sps(JNIEnv *env, jbyteArray nal, hevc_sps_t *sps)
+{
+    jsize len = (*env)->GetArrayLength(env, nal);
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, nal, NULL);
+    int ret;
+
+    if (bytes == NULL) {
+        return -1;
+    }
+    ret = hevc_sps_parse((const unsigned char *)bytes, len, sps);
+    (*env)->ReleasePrimitiveArrayCritical(env, nal, bytes, JNI_ABORT);
+    return ret;
+}
+
+/**
+ * Locate the parameter sets of an hvcC config packet
+ * Input: data = type 0x01 payload, length = its bytes
+ * Output: 0 with out[] filled (offsets into data, first NAL unit of each type), -1 if it is not hvcC
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_HevcParameterSets_nativeParseConfig(JNIEnv *env, jobject thiz, jbyteArray data,
+                                                                       jint length, jlongArray out) {
+    hevc_config_t cfg;
+    jlong fields[CFG_LEN];
+    int ret;
+
+    if ((*env)->GetArrayLength(env, out) < CFG_LEN || length < 0 || length > (*env)->GetArrayLength(env, data)) {
+        LOGE("Invalid hvcC arguments (length %d)", length);
+        return -1;
+    }
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, data, NULL);
+    if (bytes == NULL) {
+        return -1;
+    }
+    ret = hevc_config_parse((const unsigned char *)bytes, length, &cfg);
+    (*env)->ReleasePrimitiveArrayCritical(env, data, bytes, JNI_ABORT);
+    if (ret != 0) {
+        return -1;
+    }
+    fields[CFG_PROFILE] = cfg.profile_idc;
+    fields[CFG_LEVEL] = cfg.level_idc;
+    fields[CFG_NAL_LENGTH_SIZE] = cfg.nal_length_size;
+    fields[CFG_VPS] = cfg.vps_off;
+    fields[CFG_VPS + 1] = cfg.vps_len;
+    fields[CFG_SPS] = cfg.sps_off;
+    fields[CFG_SPS + 1] = cfg.sps_len;
+    fields[CFG_PPS] = cfg.pps_off;
+    fields[CFG_PPS + 1] = cfg.pps_len;
+    (*env)->SetLongArrayRegion(env, out, 0, CFG_LEN, fields);
+    return 0;
+}
+
+/**
+ * Decode one HEVC SPS
+ * Input: nal = SPS NAL unit without start code
+ * Output: 0 with out[] filled, -1 if it is not a valid SPS
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_HevcParameterSets_nativeParseSps(JNIEnv *env, jobject thiz, jbyteArray nal,
+                                                                    jlongArray out) {
+    hevc_sps_t sps;
+    jlong fields[OUT_LEN];
+    int side;
+
+    if ((*env)->GetArrayLength(env, out) < OUT_LEN) {
+        LOGE("Output array too short: need %d longs", OUT_LEN);
+        return -1;
+    }
+    if (parse_sps(env, nal, &sps) != 0) {
+        return -1;
+    }
+    side = sps.coded_width > sps.coded_height ? sps.coded_width : sps.coded_height;
+    fields[OUT_PROFILE] = sps.profile_idc;
+    fields[OUT_LEVEL] = sps.level_idc;
+    fields[OUT_WIDTH] = sps.width;
+    fields[OUT_HEIGHT] = sps.height;
+    fields[OUT_CODED_WIDTH] = sps.coded_width;
+    fields[OUT_CODED_HEIGHT] = sps.coded_height;
+    fields[OUT_CHROMA_FORMAT] = sps.chroma_format_idc;
+    fields[OUT_BIT_DEPTH] = sps.bit_depth_luma;
+    fields[OUT_MAX_REF_FRAMES] = sps.max_dec_pic_buffering;
+    fields[OUT_MAX_INPUT_SIZE] = hevc_sps_max_input_size(&sps, 0, 0);
+    fields[OUT_MAX_INPUT_SIZE_ROTATED] = hevc_sps_max_input_size(&sps, side, side);
+    (*env)->SetLongArrayRegion(env, out, 0, OUT_LEN, fields);
+    return 0;
+}
+
+/**
+ * Classify a new HEVC SPS against the one the decoder was configured with
+ * Input: current / next = SPS NAL units without start code
+ * Output: HEVC_SPS_SAME, HEVC_SPS_RESOLUTION or HEVC_SPS_INCOMPATIBLE
+ *         (incompatible whenever either one does not decode)
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_HevcParameterSets_nativeCompareSps(JNIEnv *env, jobject thiz, jbyteArray current,
+                                                                      jbyteArray next) {
+    hevc_sps_t a, b;
+
+    if (parse_sps(env, current, &a) != 0 || parse_sps(env, next, &b) != 0) {
+        return HEVC_SPS_INCOMPATIBLE;
+    }
+    return hevc_sps_compare(&a, &b);
+}
@@ -0,0 +1,181 @@
+/**
+ * Keyframe cache for re-attaching a decoder mid-stream
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "access_unit.h"
+#include "keyframe_cache.h"
+
+#define ARENA_MIN_BYTES ((size_t)1 << 20)
+
+typedef struct {
+    size_t off;
+    int len;
+    int flags;
+    int64_t pts_ns;
+} cached_frame_t;
+
+struct keyframe_cache_s {
+    unsigned char *arena;
+    size_t arena_size;
+    size_t used;
+    cached_frame_t *frames;
+    int count;
+    int valid;                          /* a complete group since the last keyframe */
+    size_t max_bytes;
+    int max_frames;
+    keyframe_cache_stats_t stats;
+};
+
+keyframe_cache_t *
+keyframe_cache_create(size_t max_bytes, int max_frames)
+{
+    keyframe_cache_t *cache = calloc(1, sizeof(keyframe_cache_t));
+
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->max_bytes = max_bytes > 0 ? max_bytes : KEYFRAME_CACHE_DEFAULT_BYTES;
+    cache->max_frames = max_frames > 0 ? max_frames : KEYFRAME_CACHE_DEFAULT_FRAMES;
+    cache->frames = calloc((size_t)cache->max_frames, sizeof(cached_frame_t));
+    if (cache->frames == NULL) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void
+keyframe_cache_destroy(keyframe_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    free(cache->arena);
+    free(cache->frames);
+    free(cache);
+}
+
+static void
+drop_group(keyframe_cache_t *cache)
+{
+    cache->used = 0;
+    cache->count = 0;
+    cache->valid = 0;
+}
+
+/* Room for len more bytes, growing the arena by doubling up to max_bytes; 0, 1 over a cap, -1 out of memory */
+static int
+reserve(keyframe_cache_t *cache, size_t len)
+{
+    size_t need = cache->used + len;
+    size_t size;
+    unsigned char *arena;
+
+    if (need > cache->max_bytes || cache->count >= cache->max_frames) {
+        return 1;
+    }
+    if (need <= cache->arena_size) {
+        return 0;
+    }
+    size = cache->arena_size > 0 ? cache->arena_size : ARENA_MIN_BYTES;
+    while (size < need) {
+        size *= 2;
+    }
+    if (size > cache->max_bytes) {
+        size = cache->max_bytes;
+    }
+    arena = realloc(cache->arena, size);
+    if (arena == NULL) {
+        return -1;
+    }
+    cache->arena = arena;
+    cache->arena_size = size;
+    return 0;
+}
+
+int
+keyframe_cache_add(keyframe_cache_t *cache, const unsigned char *data, int len, int flags, int64_t pts_ns)
+{
+    cached_frame_t *frame;
+    int ret;
+
+    if (len <= 0 || !(flags & ACCESS_UNIT_PICTURE)) {
+        return 0;
+    }
+    if (flags & ACCESS_UNIT_KEYFRAME) {
+        drop_group(cache);
+        cache->valid = 1;
+        cache->stats.keyframes++;
+    } else if (!cache->valid || !(flags & ACCESS_UNIT_REFERENCE)) {
+        cache->stats.frames_skipped++;
+        return 0;
+    }
+
+    ret = reserve(cache, (size_t)len);
+    if (ret != 0) {
+        drop_group(cache);
+        if (ret < 0) {
+            return -1;
+        }
+        cache->stats.overflows++;
+        return 0;
+    }
+    frame = &cache->frames[cache->count++];
+    frame->off = cache->used;
+    frame->len = len;
+    frame->flags = flags;
+    frame->pts_ns = pts_ns;
+    memcpy(cache->arena + cache->used, data, (size_t)len);
+    cache->used += (size_t)len;
+    if (cache->used > cache->stats.peak_bytes) {
+        cache->stats.peak_bytes = cache->used;
+    }
+    cache->stats.frames_cached++;
+    return 1;
+}
+
+void
+keyframe_cache_clear(keyframe_cache_t *cache)
+{
+    drop_group(cache);
+}
+
+int
+keyframe_cache_replay(keyframe_cache_t *cache, keyframe_sink_fn sink, void *ctx)
+{
+    keyframe_frame_t frame;
+    int i;
+
+    if (!cache->valid || cache->count == 0) {
+        cache->stats.misses++;
+        return -1;
+    }
+    cache->stats.hits++;
+    for (i = 0; i < cache->count; i++) {
+        frame.data = cache->arena + cache->frames[i].off;
+        frame.len = cache->frames[i].len;
+        frame.flags = cache->frames[i].flags;
+        frame.pts_ns = cache->frames[i].pts_ns;
+        if (sink(ctx, &frame, i < cache->count - 1) != 0) {
+            cache->stats.aborted++;
+            break;
+        }
+        cache->stats.frames_replayed++;
+        cache->stats.bytes_replayed += (unsigned long long)frame.len;
+    }
+    return i;
+}
+
+void
+keyframe_cache_get_stats(keyframe_cache_t *cache, keyframe_cache_stats_t *stats)
+{
+    *stats = cache->stats;
+    stats->frames = cache->valid ? cache->count : 0;
+    stats->bytes = cache->valid ? cache->used : 0;
+    stats->arena_bytes = cache->arena_size;
+    stats->max_bytes = cache->max_bytes;
+    stats->max_frames = cache->max_frames;
+}
@@ -0,0 +1,82 @@
+/**
+ * Keyframe cache for re-attaching a decoder mid-stream
+ *
+ * A new decoder (surface change, codec restart) can show nothing until the
+ * sender's next keyframe, and mirror senders send those rarely: seconds apart,
+ * or only on request. The cache keeps a copy of the latest keyframe access unit
+ * and of every reference frame after it, which is exactly what a decoder needs
+ * to rebuild the current picture. keyframe_cache_replay hands them to a sink
+ * in stream order, all but the last flagged decode-only, so the new decoder
+ * catches up in one burst and shows the latest cached picture; live frames
+ * then continue from a correct reference state.
+ *
+ * Non-reference frames are never cached (nothing depends on them), so a
+ * replay is at most one frame behind the live stream. Copies go to one arena
+ * that is rewound at each keyframe, grows only while the group of pictures
+ * grows, and never beyond max_bytes. A group that outgrows max_bytes or
+ * max_frames invalidates the cache until the next keyframe: replaying a
+ * prefix of it would leave the decoder without the newer references, which
+ * is no better than waiting.
+ *
+ * Not thread-safe: one thread adds, clears and replays.
+ */
+
+#ifndef KEYFRAME_CACHE_H
+#define KEYFRAME_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEYFRAME_CACHE_DEFAULT_BYTES ((size_t)8 << 20)
+#define KEYFRAME_CACHE_DEFAULT_FRAMES 240
+
+typedef struct keyframe_cache_s keyframe_cache_t;
+
+typedef struct {
+    const unsigned char *data;          /* Annex-B access unit, valid for the sink call only */
+    int len;
+    int flags;                          /* ACCESS_UNIT_* */
+    int64_t pts_ns;
+} keyframe_frame_t;
+
+/* Returns 0 to continue, non-zero to stop the replay (e.g. no decoder input buffer) */
+typedef int (*keyframe_sink_fn)(void *ctx, const keyframe_frame_t *frame, int decode_only);
+
+typedef struct {
+    unsigned long long keyframes;       /* groups started */
+    unsigned long long frames_cached;
+    unsigned long long frames_skipped;  /* non-reference frames, and frames before the first keyframe */
+    unsigned long long overflows;       /* groups that outgrew a cap */
+    unsigned long long hits;            /* replays that reached the sink */
+    unsigned long long misses;          /* replays with no valid group cached */
+    unsigned long long aborted;         /* replays the sink stopped early */
+    unsigned long long frames_replayed;
+    unsigned long long bytes_replayed;
+    int frames;                         /* cached right now */
+    size_t bytes;
+    size_t arena_bytes;                 /* allocated */
+    size_t peak_bytes;
+    size_t max_bytes;
+    int max_frames;
+} keyframe_cache_stats_t;
+
+/* NULL on allocation failure; 0 for either cap takes its default */
+keyframe_cache_t *keyframe_cache_create(size_t max_bytes, int max_frames);
+
+void keyframe_cache_destroy(keyframe_cache_t *cache);
+
+/* Offer an assembled access unit. Keyframes start a new group; reference
+ * pictures extend the current one. Returns 1 when cached, 0 when not needed
+ * or the group is invalid, -1 on allocation failure (the group is dropped). */
+int keyframe_cache_add(keyframe_cache_t *cache, const unsigned char *data, int len, int flags, int64_t pts_ns);
+
+/* Forget the group, e.g. when the stream's parameter sets change incompatibly */
+void keyframe_cache_clear(keyframe_cache_t *cache);
+
+/* Feed the cached group to sink. Returns the frames the sink accepted, or -1
+ * on a miss (nothing cached). The group stays cached. */
+int keyframe_cache_replay(keyframe_cache_t *cache, keyframe_sink_fn sink, void *ctx);
+
+void keyframe_cache_get_stats(keyframe_cache_t *cache, keyframe_cache_stats_t *stats);
+
+#endif // KEYFRAME_CACHE_H
@@ -0,0 +1,156 @@
+#include <jni.h>
+#include <android/log.h>
+#include "keyframe_cache.h"
+
+#define LOG_TAG "KeyframeCacheJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeGetStats (must match KeyframeCache.kt) */
+#define STATS_LEN 13
+
+typedef struct {
+    JNIEnv *env;
+    jobject sink;
+    jmethodID on_frame;
+} replay_ctx_t;
+
+/* KeyframeCache.ReplaySink.onFrame on a direct buffer over the cached bytes */
+static int
+replay_sink(void *ctx, const keyframe_frame_t *frame, int decode_only)
+{
+    replay_ctx_t *replay = ctx;
+    JNIEnv *env = replay->env;
+    jobject buffer;
+    jboolean more;
+
+    buffer = (*env)->NewDirectByteBuffer(env, (void *)frame->data, frame->len);
+    if (buffer == NULL) {
+        return -1;
+    }
+    more = (*env)->CallBooleanMethod(env, replay->sink, replay->on_frame, buffer, frame->len, frame->flags,
+                                     (jlong)(frame->pts_ns / 1000), decode_only ? JNI_TRUE : JNI_FALSE);
+    (*env)->DeleteLocalRef(env, buffer);
+    if ((*env)->ExceptionCheck(env)) {
+        return -1;
+    }
+    return more ? 0 : -1;
+}
+
+/**
+ * Allocate a cache
+ * Input: maxBytes / maxFrames = caps on one cached group (0 for the defaults)
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_KeyframeCache_nativeCreate(JNIEnv *env, jobject thiz, jlong max_bytes,
+                                                              jint max_frames) {
+    keyframe_cache_t *cache = keyframe_cache_create(max_bytes > 0 ? (size_t)max_bytes : 0,
+                                                    max_frames > 0 ? max_frames : 0);
+    if (cache == NULL) {
+        LOGE("Failed to allocate keyframe cache");
+        return 0;
+    }
+    return (jlong)cache;
+}
+
+/**
+ * Offer an assembled access unit
+ * Input: buffer = direct buffer holding it from offset 0, length = its bytes,
+ *        flags = AccessUnitAssembler flags, ptsUs = presentation time
+ * Output: 1 cached, 0 not needed (or the group is over a cap), -1 on error
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_KeyframeCache_nativeAdd(JNIEnv *env, jobject thiz, jlong handle, jobject buffer,
+                                                           jint length, jint flags, jlong pts_us) {
+    keyframe_cache_t *cache = (keyframe_cache_t *)handle;
+    unsigned char *data;
+
+    if (cache == NULL) {
+        return -1;
+    }
+    data = (*env)->GetDirectBufferAddress(env, buffer);
+    if (data == NULL || length < 0 || length > (*env)->GetDirectBufferCapacity(env, buffer)) {
+        LOGE("Invalid access unit buffer (length %d)", length);
+        return -1;
+    }
+    return keyframe_cache_add(cache, data, length, flags, (int64_t)pts_us * 1000);
+}
+
+/**
+ * Forget the cached group
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_KeyframeCache_nativeClear(JNIEnv *env, jobject thiz, jlong handle) {
+    keyframe_cache_t *cache = (keyframe_cache_t *)handle;
+    if (cache != NULL) {
+        keyframe_cache_clear(cache);
+    }
+}
+
+/**
+ * Hand the cached group to sink.onFrame in stream order, all but the last decode-only
+ * Input: sink = KeyframeCache.ReplaySink; each buffer is only valid during its call
+ * Output: frames the sink accepted, -1 on a miss
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_KeyframeCache_nativeReplay(JNIEnv *env, jobject thiz, jlong handle,
+                                                              jobject sink) {
+    keyframe_cache_t *cache = (keyframe_cache_t *)handle;
+    replay_ctx_t replay;
+    jclass cls;
+
+    if (cache == NULL || sink == NULL) {
+        return -1;
+    }
+    cls = (*env)->GetObjectClass(env, sink);
+    replay.env = env;
+    replay.sink = sink;
+    replay.on_frame = (*env)->GetMethodID(env, cls, "onFrame", "(Ljava/nio/ByteBuffer;IIJZ)Z");
+    (*env)->DeleteLocalRef(env, cls);
+    if (replay.on_frame == NULL) {
+        LOGE("Replay sink has no onFrame(ByteBuffer, int, int, long, boolean)");
+        return -1;
+    }
+    return keyframe_cache_replay(cache, replay_sink, &replay);
+}
+
+/**
+ * Snapshot of the cache counters
+ * Output: out = keyframes, frames cached, frames skipped, overflows, hits, misses, aborted,
+ *         frames replayed, bytes replayed, frames now, bytes now, peak bytes, max bytes
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_KeyframeCache_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle,
+                                                                jlongArray out) {
+    keyframe_cache_t *cache = (keyframe_cache_t *)handle;
+    keyframe_cache_stats_t stats;
+    jlong values[STATS_LEN];
+
+    if (cache == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    keyframe_cache_get_stats(cache, &stats);
+    values[0] = (jlong)stats.keyframes;
+    values[1] = (jlong)stats.frames_cached;
+    values[2] = (jlong)stats.frames_skipped;
+    values[3] = (jlong)stats.overflows;
+    values[4] = (jlong)stats.hits;
+    values[5] = (jlong)stats.misses;
+    values[6] = (jlong)stats.aborted;
+    values[7] = (jlong)stats.frames_replayed;
+    values[8] = (jlong)stats.bytes_replayed;
+    values[9] = stats.frames;
+    values[10] = (jlong)stats.bytes;
+    values[11] = (jlong)stats.peak_bytes;
+    values[12] = (jlong)stats.max_bytes;
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * Free a cache from nativeCreate
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_KeyframeCache_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    keyframe_cache_destroy((keyframe_cache_t *)handle);
+}
@@ -0,0 +1,129 @@
+/**
+ * Decode latency controller for the mirror video stream
+ */
+
+#include <string.h>
+
+#include "access_unit.h"
+#include "latency_controller.h"
+
+#define SERVICE_SMOOTHING 8             /* EWMA weight 1/8 */
+
+void
+latency_controller_init(latency_controller_t *lc, int64_t budget_ns, int64_t skip_ns)
+{
+    memset(lc, 0, sizeof(*lc));
+    lc->budget_ns = budget_ns > 0 ? budget_ns : LATENCY_CONTROLLER_BUDGET_NS;
+    lc->skip_ns = skip_ns > 0 ? skip_ns : LATENCY_CONTROLLER_SKIP_NS;
+    if (lc->skip_ns < lc->budget_ns) {
+        lc->skip_ns = lc->budget_ns;
+    }
+}
+
+void
+latency_controller_reset(latency_controller_t *lc)
+{
+    lc->head = 0;
+    lc->count = 0;
+    lc->last_output_ns = 0;
+    lc->skipping = 0;
+}
+
+int
+latency_controller_decide(latency_controller_t *lc, int flags, int64_t pts_ns, int64_t now_ns)
+{
+    int64_t oldest = pts_ns;
+
+    if (lc->count > 0 && lc->in_flight[lc->head].pts_ns < oldest) {
+        oldest = lc->in_flight[lc->head].pts_ns;
+    }
+    lc->lag_ns = now_ns - oldest;
+    if (lc->lag_ns > lc->max_lag_ns) {
+        lc->max_lag_ns = lc->lag_ns;
+    }
+
+    /* An IDR frame always decodes: it is the way out of any backlog */
+    if (flags & ACCESS_UNIT_KEYFRAME) {
+        lc->skipping = 0;
+        return LATENCY_DECODE;
+    }
+    if (!lc->skipping && lc->lag_ns > lc->skip_ns) {
+        lc->skipping = 1;
+        lc->skips++;
+    }
+    if (lc->skipping) {
+        lc->dropped_to_idr++;
+        lc->recovered_ns += lc->service_ns;
+        return LATENCY_DROP_TO_IDR;
+    }
+    if (lc->lag_ns > lc->budget_ns && !(flags & ACCESS_UNIT_REFERENCE)) {
+        lc->dropped_non_reference++;
+        lc->recovered_ns += lc->service_ns;
+        return LATENCY_DROP_NON_REFERENCE;
+    }
+    return LATENCY_DECODE;
+}
+
+void
+latency_controller_on_queued(latency_controller_t *lc, int64_t pts_ns, int64_t now_ns)
+{
+    int tail;
+
+    if (lc->count == LATENCY_CONTROLLER_MAX_IN_FLIGHT) {
+        /* Decoder swallowed frames without output; stop tracking the oldest */
+        lc->head = (lc->head + 1) % LATENCY_CONTROLLER_MAX_IN_FLIGHT;
+        lc->count--;
+    }
+    tail = (lc->head + lc->count) % LATENCY_CONTROLLER_MAX_IN_FLIGHT;
+    lc->in_flight[tail].pts_ns = pts_ns;
+    lc->in_flight[tail].queued_ns = now_ns;
+    lc->count++;
+    lc->decoded++;
+}
+
+void
+latency_controller_on_input_lost(latency_controller_t *lc, int flags)
+{
+    lc->inputs_lost++;
+    /* Frames after a lost reference frame would decode with artifacts */
+    if (flags & (ACCESS_UNIT_REFERENCE | ACCESS_UNIT_KEYFRAME)) {
+        if (!lc->skipping) {
+            lc->skips++;
+        }
+        lc->skipping = 1;
+    }
+}
+
+void
+latency_controller_on_output(latency_controller_t *lc, int64_t pts_ns, int64_t now_ns)
+{
+    int i, n;
+    int64_t sample;
+
+    for (n = 0; n < lc->count; n++) {
+        if (lc->in_flight[(lc->head + n) % LATENCY_CONTROLLER_MAX_IN_FLIGHT].pts_ns == pts_ns) {
+            break;
+        }
+    }
+    if (n == lc->count) {
+        return;                         /* queued before a reset, or not ours */
+    }
+
+    /* Back to back with the previous output the gap is the decoder's time per
+     * frame; after an idle decoder it is this frame's own time inside it */
+    i = (lc->head + n) % LATENCY_CONTROLLER_MAX_IN_FLIGHT;
+    sample = now_ns - lc->in_flight[i].queued_ns;
+    if (lc->last_output_ns != 0 && lc->in_flight[i].queued_ns < lc->last_output_ns) {
+        sample = now_ns - lc->last_output_ns;
+    }
+    if (lc->service_ns == 0) {
+        lc->service_ns = sample;
+    } else {
+        lc->service_ns += (sample - lc->service_ns) / SERVICE_SMOOTHING;
+    }
+    lc->last_output_ns = now_ns;
+
+    /* Frames queued before this one and never output were consumed silently */
+    lc->head = (i + 1) % LATENCY_CONTROLLER_MAX_IN_FLIGHT;
+    lc->count -= n + 1;
+}
@@ -0,0 +1,84 @@
+/**
+ * Decode latency controller for the mirror video stream
+ *
+ * The receive loop hands every access unit to MediaCodec as it arrives. When
+ * the decoder falls behind (a slow hardware decoder, a stall after a surface
+ * change) frames pile up in its input queue and on-screen latency grows
+ * without bound. The controller tracks the frames queued to the decoder
+ * against their presentation times (the sender timestamp mapped to local
+ * time, see access_unit.h) and decides per frame whether to decode it:
+ *
+ *   lag <= budget        decode everything
+ *   lag >  budget        drop non-reference frames (every slice nal_ref_idc 0);
+ *                        nothing else depends on them, so the picture stays intact
+ *   lag >  skip budget   drop everything up to the next IDR frame
+ *
+ * lag is the age of the oldest frame still inside the decoder, or of the
+ * incoming frame when the decoder is empty. Losing a reference frame any other
+ * way (no input buffer available) also skips to the next IDR, since the frames
+ * after it would decode with artifacts. Each dropped frame is credited with
+ * the decoder's measured per-frame service time as recovered latency.
+ *
+ * Times are CLOCK_MONOTONIC ns; nothing here reads a clock, so the policy runs
+ * on simulated timings in host tests.
+ */
+
+#ifndef LATENCY_CONTROLLER_H
+#define LATENCY_CONTROLLER_H
+
+#include <stdint.h>
+
+#define LATENCY_CONTROLLER_BUDGET_NS (100 * 1000000LL)
+#define LATENCY_CONTROLLER_SKIP_NS (300 * 1000000LL)
+#define LATENCY_CONTROLLER_MAX_IN_FLIGHT 32     /* frames tracked inside the decoder */
+
+/* latency_controller_decide results */
+#define LATENCY_DECODE 0
+#define LATENCY_DROP_NON_REFERENCE 1
+#define LATENCY_DROP_TO_IDR 2
+
+typedef struct {
+    int64_t pts_ns;
+    int64_t queued_ns;
+} latency_frame_t;
+
+typedef struct {
+    int64_t budget_ns;
+    int64_t skip_ns;
+    int skipping;                           /* dropping until the next IDR */
+
+    latency_frame_t in_flight[LATENCY_CONTROLLER_MAX_IN_FLIGHT];
+    int head;
+    int count;
+    int64_t last_output_ns;                 /* 0 until the first output */
+    int64_t service_ns;                     /* smoothed decoder time per frame */
+
+    int64_t lag_ns;                         /* at the last decision */
+    int64_t max_lag_ns;
+    unsigned long long decoded;             /* frames queued to the decoder */
+    unsigned long long dropped_non_reference;
+    unsigned long long dropped_to_idr;
+    unsigned long long skips;               /* times skip-to-IDR was entered */
+    unsigned long long inputs_lost;         /* frames the decoder had no input buffer for */
+    int64_t recovered_ns;
+} latency_controller_t;
+
+/* budget_ns / skip_ns <= 0 select the defaults above */
+void latency_controller_init(latency_controller_t *lc, int64_t budget_ns, int64_t skip_ns);
+
+/* Forgets the frames in flight (codec flushed or recreated); counters are kept */
+void latency_controller_reset(latency_controller_t *lc);
+
+/* Decide whether to decode a frame; flags are ACCESS_UNIT_* from access_unit.h */
+int latency_controller_decide(latency_controller_t *lc, int flags, int64_t pts_ns, int64_t now_ns);
+
+/* The frame was queued to the decoder */
+void latency_controller_on_queued(latency_controller_t *lc, int64_t pts_ns, int64_t now_ns);
+
+/* The decoder had no room for a frame it was meant to decode */
+void latency_controller_on_input_lost(latency_controller_t *lc, int flags);
+
+/* The decoder produced the frame with this presentation time */
+void latency_controller_on_output(latency_controller_t *lc, int64_t pts_ns, int64_t now_ns);
+
+#endif // LATENCY_CONTROLLER_H
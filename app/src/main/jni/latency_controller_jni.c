@@ -0,0 +1,130 @@
+#include <jni.h>
+#include <android/log.h>
+#include <stdlib.h>
+#include <time.h>
+#include "latency_controller.h"
+
+#define LOG_TAG "LatencyControllerJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeGetStats (must match LatencyController.kt) */
+#define STATS_LEN 9
+
+/* MediaCodec timestamps are microseconds; the controller and the clock work in ns */
+static int64_t
+now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Allocate a controller for one video stream
+ * Input: budgetNs = lag above which non-reference frames are dropped,
+ *        skipNs = lag above which everything up to the next IDR is dropped (<= 0: defaults)
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeCreate(JNIEnv *env, jobject thiz, jlong budget_ns,
+                                                                  jlong skip_ns) {
+    latency_controller_t *lc = malloc(sizeof(latency_controller_t));
+    if (lc == NULL) {
+        LOGE("Failed to allocate latency controller");
+        return 0;
+    }
+    latency_controller_init(lc, budget_ns, skip_ns);
+    return (jlong)lc;
+}
+
+/**
+ * Decide whether to decode a frame now
+ * Input: flags = AccessUnitAssembler flags, ptsUs = the frame's presentation time
+ * Output: LATENCY_DECODE (0), LATENCY_DROP_NON_REFERENCE (1) or LATENCY_DROP_TO_IDR (2)
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeDecide(JNIEnv *env, jobject thiz, jlong handle,
+                                                                  jint flags, jlong pts_us) {
+    latency_controller_t *lc = (latency_controller_t *)handle;
+    if (lc == NULL) {
+        return LATENCY_DECODE;
+    }
+    return latency_controller_decide(lc, flags, pts_us * 1000, now_ns());
+}
+
+/**
+ * Record a frame queued to the decoder, or one the decoder had no input buffer for
+ * Input: queued = JNI_FALSE when the input was lost, flags = AccessUnitAssembler flags
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeOnInput(JNIEnv *env, jobject thiz, jlong handle,
+                                                                   jboolean queued, jint flags, jlong pts_us) {
+    latency_controller_t *lc = (latency_controller_t *)handle;
+    if (lc == NULL) {
+        return;
+    }
+    if (queued) {
+        latency_controller_on_queued(lc, pts_us * 1000, now_ns());
+    } else {
+        latency_controller_on_input_lost(lc, flags);
+    }
+}
+
+/**
+ * Record a decoded frame leaving the codec
+ * Input: ptsUs = BufferInfo.presentationTimeUs
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeOnOutput(JNIEnv *env, jobject thiz, jlong handle,
+                                                                    jlong pts_us) {
+    latency_controller_t *lc = (latency_controller_t *)handle;
+    if (lc != NULL) {
+        latency_controller_on_output(lc, pts_us * 1000, now_ns());
+    }
+}
+
+/**
+ * Forget the frames in flight after the codec was flushed or recreated
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeReset(JNIEnv *env, jobject thiz, jlong handle) {
+    latency_controller_t *lc = (latency_controller_t *)handle;
+    if (lc != NULL) {
+        latency_controller_reset(lc);
+    }
+}
+
+/**
+ * Snapshot of the controller counters
+ * Output: out = decoded, dropped non-reference, dropped to IDR, skips, inputs lost,
+ *         recovered (ns), lag (ns), max lag (ns), decoder time per frame (ns)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle,
+                                                                    jlongArray out) {
+    latency_controller_t *lc = (latency_controller_t *)handle;
+    jlong values[STATS_LEN];
+
+    if (lc == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    values[0] = (jlong)lc->decoded;
+    values[1] = (jlong)lc->dropped_non_reference;
+    values[2] = (jlong)lc->dropped_to_idr;
+    values[3] = (jlong)lc->skips;
+    values[4] = (jlong)lc->inputs_lost;
+    values[5] = lc->recovered_ns;
+    values[6] = lc->lag_ns;
+    values[7] = lc->max_lag_ns;
+    values[8] = lc->service_ns;
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * Free a controller from nativeCreate
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_LatencyController_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    free((latency_controller_t *)handle);
+}
@@ -92,8 +92,10 @@ void mirror_buffer_decrypt(mirror_buffer_t *mirror_buffer, unsigned char* input,
     aes_ctr_start_fresh_block(mirror_buffer->aes_ctx);
     aes_ctr_decrypt(mirror_buffer->aes_ctx, input + mirror_buffer->nextDecryptCount,
                     input + mirror_buffer->nextDecryptCount, encryptlen);
-    // Copy to output
-    memcpy(output + mirror_buffer->nextDecryptCount, input + mirror_buffer->nextDecryptCount, encryptlen);
+    // Copy to output (nothing to do when decrypting in place)
+    if (output != input) {
+        memcpy(output + mirror_buffer->nextDecryptCount, input + mirror_buffer->nextDecryptCount, encryptlen);
+    }
     // int outputlength = mirror_buffer->nextDecryptCount + encryptlen;
     // Processing remaining length
     int restlen = (inputLen - mirror_buffer->nextDecryptCount) % 16;
@@ -79,6 +79,27 @@ Java_com_pentagram_airplay_crypto_MirrorBufferDecryptor_nativeDecrypt(JNIEnv *en
     return output;
 }
 
+// Java: native int nativeDecryptInPlace(long handle, ByteBuffer buffer, int length)
+// Decrypts the first length bytes of a direct buffer in place; returns 0 or -1
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_crypto_MirrorBufferDecryptor_nativeDecryptInPlace(JNIEnv *env, jobject thiz, jlong handle, jobject buffer, jint length) {
+    mirror_buffer_t *mirror = (mirror_buffer_t*)handle;
+    if (mirror == NULL) {
+        LOGE("Invalid mirror_buffer handle");
+        return -1;
+    }
+
+    unsigned char *data = (*env)->GetDirectBufferAddress(env, buffer);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+    if (data == NULL || length < 0 || length > capacity) {
+        LOGE("Invalid direct buffer for in-place decrypt (length %d, capacity %lld)", length, (long long)capacity);
+        return -1;
+    }
+
+    mirror_buffer_decrypt(mirror, data, data, length);
+    return 0;
+}
+
 // Java: native void nativeDestroy(long handle)
 JNIEXPORT void JNICALL
 Java_com_pentagram_airplay_crypto_MirrorBufferDecryptor_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
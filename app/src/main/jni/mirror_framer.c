@@ -0,0 +1,111 @@
+/**
+ * Incremental framer for the mirror video stream
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mirror_framer.h"
+
+void
+mirror_framer_init(mirror_framer_t *framer, buffer_pool_t *pool, mirror_packet_cb_t callback, void *opaque)
+{
+    memset(framer, 0, sizeof(*framer));
+    framer->pool = pool;
+    framer->callback = callback;
+    framer->opaque = opaque;
+}
+
+void
+mirror_framer_reset(mirror_framer_t *framer)
+{
+    if (framer->payload) {
+        buffer_pool_release(framer->pool, framer->payload);
+        framer->payload = NULL;
+    }
+    framer->header_len = 0;
+    framer->payload_len = 0;
+    framer->payload_got = 0;
+}
+
+/* Header complete: sets up the payload buffer; returns -1 on a corrupt length */
+static int
+begin_payload(mirror_framer_t *framer, const unsigned char *header)
+{
+    int len = (int)((uint32_t)header[0] | (uint32_t)header[1] << 8 |
+                    (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24);
+
+    if (len <= 0 || len > MIRROR_MAX_PAYLOAD) {
+        return -1;
+    }
+    if (header != framer->header) {
+        memcpy(framer->header, header, MIRROR_HEADER_LEN);
+    }
+    framer->payload = buffer_pool_acquire(framer->pool, (size_t)len);
+    if (!framer->payload) {
+        return -1;
+    }
+    framer->payload_len = len;
+    framer->payload_got = 0;
+    return 0;
+}
+
+static int
+finish_payload(mirror_framer_t *framer)
+{
+    int ret = framer->callback(framer->opaque, framer->header, framer->header[4],
+                               framer->payload, framer->payload_len);
+    buffer_pool_release(framer->pool, framer->payload);
+    framer->payload = NULL;
+    framer->header_len = 0;
+    framer->packets++;
+    return ret < 0 ? -1 : 0;
+}
+
+int
+mirror_framer_feed(mirror_framer_t *framer, const unsigned char *data, int len)
+{
+    while (len > 0) {
+        int n;
+
+        if (!framer->payload) {
+            if (framer->header_len == 0 && len >= MIRROR_HEADER_LEN) {
+                /* Whole header in this chunk */
+                if (begin_payload(framer, data) < 0) {
+                    return -1;
+                }
+                data += MIRROR_HEADER_LEN;
+                len -= MIRROR_HEADER_LEN;
+            } else {
+                n = MIRROR_HEADER_LEN - framer->header_len;
+                if (n > len) {
+                    n = len;
+                }
+                memcpy(framer->header + framer->header_len, data, n);
+                framer->header_len += n;
+                data += n;
+                len -= n;
+                if (framer->header_len < MIRROR_HEADER_LEN) {
+                    return 0;
+                }
+                if (begin_payload(framer, framer->header) < 0) {
+                    return -1;
+                }
+            }
+            continue;
+        }
+
+        n = framer->payload_len - framer->payload_got;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(framer->payload + framer->payload_got, data, n);
+        framer->payload_got += n;
+        data += n;
+        len -= n;
+        if (framer->payload_got == framer->payload_len && finish_payload(framer) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
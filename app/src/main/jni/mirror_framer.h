@@ -0,0 +1,46 @@
+/**
+ * Incremental framer for the mirror video stream
+ *
+ * The mirror connection carries packets of a 128-byte header (payload length
+ * little-endian in bytes 0-3, type in byte 4) followed by the payload. Bytes
+ * arrive in whatever chunks the transport delivers; the framer reassembles
+ * each payload into a pooled buffer (buffer_pool.h) and hands it to the packet
+ * callback, which may decrypt it in place before parsing NAL units. Headers
+ * are consumed without copying when a chunk holds them whole.
+ */
+
+#ifndef MIRROR_FRAMER_H
+#define MIRROR_FRAMER_H
+
+#include "buffer_pool.h"
+
+#define MIRROR_HEADER_LEN 128
+#define MIRROR_MAX_PAYLOAD (32 * 1024 * 1024)   /* same sanity bound as VideoStreamReceiver */
+
+/* payload is writable and owned by the framer (released after the callback
+ * returns); return -1 to stop framing */
+typedef int (*mirror_packet_cb_t)(void *opaque, const unsigned char *header, int type,
+                                  unsigned char *payload, int len);
+
+typedef struct {
+    buffer_pool_t *pool;
+    mirror_packet_cb_t callback;
+    void *opaque;
+
+    unsigned char header[MIRROR_HEADER_LEN];
+    int header_len;                     /* bytes of a split header collected so far */
+    unsigned char *payload;             /* payload being filled, NULL between packets */
+    int payload_len;
+    int payload_got;
+    unsigned long long packets;
+} mirror_framer_t;
+
+void mirror_framer_init(mirror_framer_t *framer, buffer_pool_t *pool, mirror_packet_cb_t callback, void *opaque);
+
+/* Returns 0, or -1 on a corrupt length, allocation failure or a callback asking to stop */
+int mirror_framer_feed(mirror_framer_t *framer, const unsigned char *data, int len);
+
+/* Releases a partially received payload */
+void mirror_framer_reset(mirror_framer_t *framer);
+
+#endif // MIRROR_FRAMER_H
@@ -0,0 +1,200 @@
+/**
+ * Headless mirror video pipeline
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "hevc_params.h"
+#include "mirror_pipeline.h"
+#include "session_manager.h"
+
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+
+/* Single writer (the worker), read from any thread */
+#define STAT_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+static const unsigned char start_code[4] = { 0, 0, 0, 1 };
+
+static int64_t
+clock_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+append_nal(unsigned char *out, int pos, const unsigned char *nal, int len)
+{
+    if (pos + 4 + len > MIRROR_PIPELINE_MAX_CONFIG) {
+        return -1;
+    }
+    memcpy(out + pos, start_code, 4);
+    memcpy(out + pos + 4, nal, (size_t)len);
+    return pos + 4 + len;
+}
+
+/* avcC record: every SPS, then every PPS, as Annex-B. Returns the length or -1. */
+static int
+avcc_to_annexb(const unsigned char *data, int len, unsigned char *out)
+{
+    int pos = 5, n = 0, set, i;
+
+    if (len < 7 || data[0] != 1) {
+        return -1;
+    }
+    for (set = 0; set < 2; set++) {
+        int count;
+
+        if (pos >= len) {
+            return -1;
+        }
+        count = set == 0 ? data[pos] & 0x1f : data[pos];
+        pos++;
+        if (count == 0) {
+            return -1;
+        }
+        for (i = 0; i < count; i++) {
+            int nal_len;
+
+            if (pos + 2 > len) {
+                return -1;
+            }
+            nal_len = data[pos] << 8 | data[pos + 1];
+            pos += 2;
+            if (nal_len == 0 || pos + nal_len > len ||
+                (data[pos] & 0x1f) != (set == 0 ? H264_NAL_SPS : H264_NAL_PPS)) {
+                return -1;
+            }
+            n = append_nal(out, n, data + pos, nal_len);
+            if (n < 0) {
+                return -1;
+            }
+            pos += nal_len;
+        }
+    }
+    return n;
+}
+
+/* hvcC record: its first VPS, SPS and PPS as Annex-B. Returns the length or -1. */
+static int
+hvcc_to_annexb(const unsigned char *data, int len, unsigned char *out)
+{
+    hevc_config_t cfg;
+    int n = 0;
+
+    if (hevc_config_parse(data, len, &cfg) != 0) {
+        return -1;
+    }
+    if (cfg.vps_len > 0) {
+        n = append_nal(out, n, data + cfg.vps_off, cfg.vps_len);
+    }
+    if (n >= 0) {
+        n = append_nal(out, n, data + cfg.sps_off, cfg.sps_len);
+    }
+    if (n >= 0) {
+        n = append_nal(out, n, data + cfg.pps_off, cfg.pps_len);
+    }
+    return n;
+}
+
+void
+mirror_pipeline_init(mirror_pipeline_t *pipeline, mirror_sink_t *sink, int stage_timing)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+    access_unit_assembler_init(&pipeline->assembler);
+    pipeline->sink = sink;
+    pipeline->stage_timing = stage_timing;
+}
+
+int
+mirror_pipeline_packet(mirror_pipeline_t *pipeline, int type, unsigned char *payload, int len,
+                       uint64_t ntp_timestamp, int64_t arrival_ns)
+{
+    int timing = pipeline->stage_timing;
+    int64_t t0 = 0, t1 = 0, t2;
+    access_unit_t au;
+    int codec = ACCESS_UNIT_CODEC_H264;
+    int n, ret;
+
+    if (pipeline->stopped) {
+        return -1;
+    }
+    if (type != MIRROR_TYPE_VIDEO && type != MIRROR_TYPE_CONFIG) {
+        return 0;
+    }
+    STAT_ADD(pipeline->stats.bytes_in, (unsigned long long)len);
+    if (timing) {
+        t0 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    }
+
+    if (type == MIRROR_TYPE_CONFIG) {
+        /* HEVC senders send hvcC instead of avcC; the codec follows the last config */
+        n = hvcc_to_annexb(payload, len, pipeline->config);
+        if (n >= 0) {
+            codec = ACCESS_UNIT_CODEC_HEVC;
+        } else {
+            n = avcc_to_annexb(payload, len, pipeline->config);
+        }
+        if (n >= 0) {
+            access_unit_assembler_set_codec(&pipeline->assembler, codec);
+        }
+    } else {
+        n = access_unit_assemble(&pipeline->assembler, payload, len, ntp_timestamp, arrival_ns, &au);
+    }
+    if (timing) {
+        t1 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        STAT_ADD(pipeline->stats.assemble_cpu_ns, (unsigned long long)(t1 - t0));
+    }
+    if (n < 0) {
+        STAT_ADD(pipeline->stats.dropped, 1);
+        ret = 0;
+        goto done;
+    }
+
+    if (type == MIRROR_TYPE_CONFIG) {
+        ret = pipeline->sink->config(pipeline->sink, codec, pipeline->config, n);
+        STAT_ADD(pipeline->stats.config_packets, 1);
+    } else {
+        ret = pipeline->sink->frame(pipeline->sink, &au);
+        STAT_ADD(pipeline->stats.frames, 1);
+        if (au.flags & ACCESS_UNIT_KEYFRAME) {
+            STAT_ADD(pipeline->stats.keyframes, 1);
+        }
+    }
+    STAT_ADD(pipeline->stats.bytes_out, (unsigned long long)n);
+    if (timing) {
+        t2 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        STAT_ADD(pipeline->stats.sink_cpu_ns, (unsigned long long)(t2 - t1));
+    }
+    if (ret != 0) {
+        pipeline->stopped = 1;
+        ret = -1;
+    }
+done:
+    /* Last, so a reader that sees the count also sees the sink's work on it */
+    __atomic_store_n(&pipeline->stats.packets, pipeline->stats.packets + 1, __ATOMIC_RELEASE);
+    return ret;
+}
+
+void
+mirror_pipeline_on_packet(void *opaque, int type, unsigned char *payload, int len, uint64_t ntp_timestamp)
+{
+    mirror_pipeline_packet(opaque, type, payload, len, ntp_timestamp, clock_ns(CLOCK_MONOTONIC));
+}
+
+void
+mirror_pipeline_get_stats(mirror_pipeline_t *pipeline, mirror_pipeline_stats_t *stats)
+{
+    stats->packets = __atomic_load_n(&pipeline->stats.packets, __ATOMIC_ACQUIRE);
+    stats->config_packets = __atomic_load_n(&pipeline->stats.config_packets, __ATOMIC_RELAXED);
+    stats->frames = __atomic_load_n(&pipeline->stats.frames, __ATOMIC_RELAXED);
+    stats->keyframes = __atomic_load_n(&pipeline->stats.keyframes, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&pipeline->stats.dropped, __ATOMIC_RELAXED);
+    stats->bytes_in = __atomic_load_n(&pipeline->stats.bytes_in, __ATOMIC_RELAXED);
+    stats->bytes_out = __atomic_load_n(&pipeline->stats.bytes_out, __ATOMIC_RELAXED);
+    stats->assemble_cpu_ns = __atomic_load_n(&pipeline->stats.assemble_cpu_ns, __ATOMIC_RELAXED);
+    stats->sink_cpu_ns = __atomic_load_n(&pipeline->stats.sink_cpu_ns, __ATOMIC_RELAXED);
+}
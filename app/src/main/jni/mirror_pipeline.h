@@ -0,0 +1,61 @@
+/**
+ * Headless mirror video pipeline
+ *
+ * The parse / assemble half of what VideoStreamReceiver does, in native code
+ * and without MediaCodec: decrypted mirror packets in (from a session's
+ * packet callback), decoder input out to a mirror_sink_t. Config packets are
+ * recognized as hvcC or avcC, switch the assembler's codec and reach the sink
+ * as Annex-B parameter sets; video packets are assembled in place into Annex-B
+ * access units. With session_manager on the receive side, the whole path from
+ * socket to decoder input runs on a Linux host at full speed, and both halves
+ * can count the CPU each stage takes.
+ *
+ * Runs on the session's worker thread; mirror_pipeline_get_stats may be
+ * called from any thread.
+ */
+
+#ifndef MIRROR_PIPELINE_H
+#define MIRROR_PIPELINE_H
+
+#include <stdint.h>
+
+#include "access_unit.h"
+#include "mirror_sink.h"
+
+#define MIRROR_PIPELINE_MAX_CONFIG 4096     /* Annex-B parameter sets of one config packet */
+
+typedef struct {
+    unsigned long long packets;
+    unsigned long long config_packets;
+    unsigned long long frames;
+    unsigned long long keyframes;
+    unsigned long long dropped;             /* video with no valid NAL unit, config neither hvcC nor avcC */
+    unsigned long long bytes_in;            /* payload bytes */
+    unsigned long long bytes_out;           /* Annex-B bytes handed to the sink */
+    unsigned long long assemble_cpu_ns;     /* with stage timing: config parsing and assembly */
+    unsigned long long sink_cpu_ns;         /* with stage timing: inside the sink */
+} mirror_pipeline_stats_t;
+
+typedef struct {
+    access_unit_assembler_t assembler;
+    mirror_sink_t *sink;
+    int stage_timing;
+    int stopped;                            /* the sink returned -1; later packets are ignored */
+    unsigned char config[MIRROR_PIPELINE_MAX_CONFIG];
+    mirror_pipeline_stats_t stats;
+} mirror_pipeline_t;
+
+/* stage_timing: count thread CPU per stage (two CLOCK_THREAD_CPUTIME_ID reads per stage and packet) */
+void mirror_pipeline_init(mirror_pipeline_t *pipeline, mirror_sink_t *sink, int stage_timing);
+
+/* One decrypted packet (MIRROR_TYPE_*); video payloads are rewritten in place.
+ * arrival_ns is CLOCK_MONOTONIC. Returns 0, or -1 once the sink has stopped. */
+int mirror_pipeline_packet(mirror_pipeline_t *pipeline, int type, unsigned char *payload, int len,
+                           uint64_t ntp_timestamp, int64_t arrival_ns);
+
+/* airplay_session_packet_cb_t for session_manager_open, with the pipeline as opaque */
+void mirror_pipeline_on_packet(void *opaque, int type, unsigned char *payload, int len, uint64_t ntp_timestamp);
+
+void mirror_pipeline_get_stats(mirror_pipeline_t *pipeline, mirror_pipeline_stats_t *stats);
+
+#endif // MIRROR_PIPELINE_H
@@ -0,0 +1,177 @@
+/**
+ * Consumers for assembled mirror video
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mirror_sink.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define FILE_SINK_BUFFER (1024 * 1024)
+
+typedef struct {
+    mirror_sink_t base;
+    uint64_t hash;
+} checksum_sink_t;
+
+typedef struct {
+    mirror_sink_t base;
+    FILE *file;
+    char *buffer;
+} file_sink_t;
+
+static int
+null_config(mirror_sink_t *sink, int codec, const unsigned char *data, int len)
+{
+    (void)sink;
+    (void)codec;
+    (void)data;
+    (void)len;
+    return 0;
+}
+
+static int
+null_frame(mirror_sink_t *sink, const access_unit_t *au)
+{
+    (void)sink;
+    (void)au;
+    return 0;
+}
+
+static void
+free_sink(mirror_sink_t *sink)
+{
+    free(sink);
+}
+
+mirror_sink_t *
+mirror_sink_null_create(void)
+{
+    mirror_sink_t *sink = calloc(1, sizeof(mirror_sink_t));
+
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->name = "null";
+    sink->config = null_config;
+    sink->frame = null_frame;
+    sink->destroy = free_sink;
+    return sink;
+}
+
+static uint64_t
+fnv1a(uint64_t hash, const unsigned char *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static int
+checksum_config(mirror_sink_t *sink, int codec, const unsigned char *data, int len)
+{
+    checksum_sink_t *checksum = (checksum_sink_t *)sink;
+
+    (void)codec;
+    checksum->hash = fnv1a(checksum->hash, data, len);
+    return 0;
+}
+
+static int
+checksum_frame(mirror_sink_t *sink, const access_unit_t *au)
+{
+    checksum_sink_t *checksum = (checksum_sink_t *)sink;
+
+    checksum->hash = fnv1a(checksum->hash, au->data, au->len);
+    return 0;
+}
+
+mirror_sink_t *
+mirror_sink_checksum_create(void)
+{
+    checksum_sink_t *sink = calloc(1, sizeof(checksum_sink_t));
+
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->base.name = "checksum";
+    sink->base.config = checksum_config;
+    sink->base.frame = checksum_frame;
+    sink->base.destroy = free_sink;
+    sink->hash = FNV_OFFSET;
+    return &sink->base;
+}
+
+uint64_t
+mirror_sink_checksum_value(const mirror_sink_t *sink)
+{
+    return ((const checksum_sink_t *)sink)->hash;
+}
+
+static int
+file_write(mirror_sink_t *sink, const unsigned char *data, int len)
+{
+    file_sink_t *file = (file_sink_t *)sink;
+    return fwrite(data, 1, (size_t)len, file->file) == (size_t)len ? 0 : -1;
+}
+
+static int
+file_config(mirror_sink_t *sink, int codec, const unsigned char *data, int len)
+{
+    (void)codec;
+    return file_write(sink, data, len);
+}
+
+static int
+file_frame(mirror_sink_t *sink, const access_unit_t *au)
+{
+    return file_write(sink, au->data, au->len);
+}
+
+static void
+file_destroy(mirror_sink_t *sink)
+{
+    file_sink_t *file = (file_sink_t *)sink;
+
+    fclose(file->file);
+    free(file->buffer);
+    free(file);
+}
+
+mirror_sink_t *
+mirror_sink_file_create(const char *path)
+{
+    file_sink_t *sink = calloc(1, sizeof(file_sink_t));
+
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->file = fopen(path, "wb");
+    if (sink->file == NULL) {
+        free(sink);
+        return NULL;
+    }
+    /* Access units are tens of KB; one large buffer keeps it to a write per MB */
+    sink->buffer = malloc(FILE_SINK_BUFFER);
+    if (sink->buffer != NULL) {
+        setvbuf(sink->file, sink->buffer, _IOFBF, FILE_SINK_BUFFER);
+    }
+    sink->base.name = "file";
+    sink->base.config = file_config;
+    sink->base.frame = file_frame;
+    sink->base.destroy = file_destroy;
+    return &sink->base;
+}
+
+void
+mirror_sink_destroy(mirror_sink_t *sink)
+{
+    if (sink != NULL) {
+        sink->destroy(sink);
+    }
+}
@@ -0,0 +1,49 @@
+/**
+ * Consumers for assembled mirror video
+ *
+ * The end of the native receive pipeline (mirror_pipeline.h): whatever would
+ * feed MediaCodec in the app. A sink is a small vtable so the complete
+ * socket / decrypt / parse / assemble path can run on a host with no decoder
+ * at all:
+ *  - null: discards everything, for the pipeline's own throughput ceiling
+ *  - checksum: FNV-1a 64 over every byte handed in, to check a run end to end
+ *  - file: writes the Annex-B elementary stream (parameter sets, then access
+ *    units), playable with ffplay or fed back to mirror_sender --input
+ *
+ * A sink is called on one thread at a time (the session's worker).
+ */
+
+#ifndef MIRROR_SINK_H
+#define MIRROR_SINK_H
+
+#include <stdint.h>
+
+#include "access_unit.h"
+
+typedef struct mirror_sink_s mirror_sink_t;
+
+struct mirror_sink_s {
+    const char *name;
+    /* Parameter sets of a config packet as Annex-B (VPS for HEVC, SPS, PPS).
+     * Returns 0, or -1 to stop the pipeline. */
+    int (*config)(mirror_sink_t *sink, int codec, const unsigned char *data, int len);
+    /* One Annex-B access unit in decode order; au->data is only valid during the call.
+     * Returns 0, or -1 to stop the pipeline. */
+    int (*frame)(mirror_sink_t *sink, const access_unit_t *au);
+    void (*destroy)(mirror_sink_t *sink);
+};
+
+/* NULL on allocation failure */
+mirror_sink_t *mirror_sink_null_create(void);
+mirror_sink_t *mirror_sink_checksum_create(void);
+
+/* NULL when path cannot be opened for writing */
+mirror_sink_t *mirror_sink_file_create(const char *path);
+
+/* FNV-1a 64 of everything a checksum sink has taken so far, in order */
+uint64_t mirror_sink_checksum_value(const mirror_sink_t *sink);
+
+/* Flushes and frees any sink */
+void mirror_sink_destroy(mirror_sink_t *sink);
+
+#endif // MIRROR_SINK_H
@@ -0,0 +1,853 @@
+/**
+ * Fragmented MP4 recorder for the mirror stream
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "access_unit.h"
+#include "h264_params.h"
+#include "hevc_params.h"
+#include "mp4_recorder.h"
+
+#define DESC_VIDEO 0x00
+#define DESC_CONFIG 0x01                /* data is a malloc'd copy, freed by the writer */
+
+#define INIT_BOX_BYTES 1024             /* ftyp + moov without the config record */
+#define MOOF_BYTES(samples) (96 + 12 * (samples))
+#define DEFAULT_DURATION (MP4_RECORDER_TIMESCALE / 60)
+
+#define SAMPLE_SYNC 0x02000000          /* sample_depends_on = 2 */
+#define SAMPLE_NON_SYNC 0x01010000      /* sample_depends_on = 1, sample_is_non_sync_sample */
+
+/* Single writer per field (decode thread or writer thread), read from any thread */
+#define STAT_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+typedef struct {
+    unsigned char *buf;
+    int pos;
+} box_writer_t;
+
+struct mp4_recorder_s {
+    int fd;
+    size_t max_backlog;
+    frame_queue_t *queue;               /* decode thread -> writer */
+    frame_queue_t *done;                /* writer -> decode thread */
+    pthread_t thread;
+    int thread_started;
+    int stopped;
+
+    /* Decode thread */
+    int have_config;
+    int waiting_keyframe;
+    int held;                           /* buffers taken and not yet reclaimed */
+    unsigned char *unsent_config;       /* a config the queue had no room for */
+    int unsent_config_len;
+
+    /* Writer thread */
+    int codec;
+    int have_init;
+    unsigned char config[MP4_RECORDER_MAX_CONFIG];  /* last config as received */
+    int config_len;
+    unsigned char inband[MP4_RECORDER_MAX_CONFIG];  /* its parameter sets as length-prefixed NAL units */
+    int inband_len;
+    int inband_pending;                 /* ahead of the next keyframe */
+    unsigned char frag_inband[MP4_RECORDER_MAX_CONFIG];
+    int frag_inband_len;
+    frame_desc_t pend[MP4_RECORDER_FRAGMENT_SAMPLES];
+    uint32_t pend_duration[MP4_RECORDER_FRAGMENT_SAMPLES];
+    int pend_sync[MP4_RECORDER_FRAGMENT_SAMPLES];
+    int pend_count;
+    int64_t frag_start_ns;              /* sender time of the fragment's first sample */
+    int64_t base_ns;                    /* sender time of the first sample: decode time 0 */
+    int64_t last_ticks;                 /* decode time of the newest pending sample */
+    int64_t next_dts;                   /* decode time of the next fragment's first sample */
+    int started;
+    uint32_t sequence;
+    unsigned char moof[MOOF_BYTES(MP4_RECORDER_FRAGMENT_SAMPLES)];
+    struct iovec iov[MP4_RECORDER_FRAGMENT_SAMPLES + 2];
+
+    mp4_recorder_stats_t stats;
+};
+
+static int64_t
+clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+put8(box_writer_t *w, unsigned int v)
+{
+    w->buf[w->pos++] = (unsigned char)v;
+}
+
+static void
+put16(box_writer_t *w, unsigned int v)
+{
+    put8(w, v >> 8);
+    put8(w, v);
+}
+
+static void
+put32(box_writer_t *w, uint32_t v)
+{
+    put16(w, v >> 16);
+    put16(w, v & 0xffff);
+}
+
+static void
+put64(box_writer_t *w, uint64_t v)
+{
+    put32(w, (uint32_t)(v >> 32));
+    put32(w, (uint32_t)v);
+}
+
+static void
+put_bytes(box_writer_t *w, const void *data, int len)
+{
+    memcpy(w->buf + w->pos, data, (size_t)len);
+    w->pos += len;
+}
+
+static void
+put_zeros(box_writer_t *w, int len)
+{
+    memset(w->buf + w->pos, 0, (size_t)len);
+    w->pos += len;
+}
+
+static void
+store32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+/* Returns the box's offset for box_end */
+static int
+box_begin(box_writer_t *w, const char *type)
+{
+    int at = w->pos;
+
+    put32(w, 0);
+    put_bytes(w, type, 4);
+    return at;
+}
+
+static int
+full_box_begin(box_writer_t *w, const char *type, int version, uint32_t flags)
+{
+    int at = box_begin(w, type);
+
+    put32(w, (uint32_t)version << 24 | flags);
+    return at;
+}
+
+static void
+box_end(box_writer_t *w, int at)
+{
+    store32(w->buf + at, (uint32_t)(w->pos - at));
+}
+
+static void
+put_matrix(box_writer_t *w)
+{
+    put32(w, 0x00010000);
+    put_zeros(w, 12);
+    put32(w, 0x00010000);
+    put_zeros(w, 12);
+    put32(w, 0x40000000);
+}
+
+static int
+write_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (unsigned char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+static int
+timed_write(mp4_recorder_t *rec, struct iovec *iov, int count, size_t bytes)
+{
+    int64_t start = clock_ns(), elapsed;
+    int ret = write_all(rec->fd, iov, count);
+
+    elapsed = clock_ns() - start;
+    STAT_ADD(rec->stats.write_ns, (unsigned long long)elapsed);
+    if ((unsigned long long)elapsed > rec->stats.max_write_ns) {
+        __atomic_store_n(&rec->stats.max_write_ns, (unsigned long long)elapsed, __ATOMIC_RELAXED);
+    }
+    if (ret == 0) {
+        STAT_ADD(rec->stats.bytes_written, (unsigned long long)bytes);
+    } else {
+        STAT_ADD(rec->stats.write_errors, 1);
+    }
+    return ret;
+}
+
+/* Codec, bare record and picture size of a config payload. Returns 0, or -1 if it is neither hvcC nor avcC. */
+static int
+parse_config(const unsigned char *data, int len, int *codec, int *record_off, int *record_len,
+             int *width, int *height)
+{
+    hevc_config_t hevc;
+    h264_sps_t sps;
+    hevc_sps_t hsps;
+
+    *width = 0;
+    *height = 0;
+    if (hevc_config_parse(data, len, &hevc) == 0) {
+        *codec = ACCESS_UNIT_CODEC_HEVC;
+        *record_off = hevc.record_off;
+        *record_len = hevc.record_len;
+        if (hevc_sps_parse(data + hevc.sps_off, hevc.sps_len, &hsps) == 0) {
+            *width = hsps.width;
+            *height = hsps.height;
+        }
+        return 0;
+    }
+    if (len < 7 || data[0] != 1) {
+        return -1;
+    }
+    *codec = ACCESS_UNIT_CODEC_H264;
+    *record_off = 0;
+    *record_len = len;
+    /* First SPS: count at 5, 2-byte length at 6 */
+    if ((data[5] & 0x1f) > 0 && len >= 8 && 8 + (data[6] << 8 | data[7]) <= len &&
+        h264_sps_parse(data + 8, data[6] << 8 | data[7], &sps) == 0) {
+        *width = sps.width;
+        *height = sps.height;
+    }
+    return 0;
+}
+
+static int
+append_nal(unsigned char *out, int pos, const unsigned char *nal, int len)
+{
+    if (len <= 0 || pos + 4 + len > MP4_RECORDER_MAX_CONFIG) {
+        return -1;
+    }
+    store32(out + pos, (uint32_t)len);
+    memcpy(out + pos + 4, nal, (size_t)len);
+    return pos + 4 + len;
+}
+
+/* Parameter sets of a config as length-prefixed NAL units (sample format). Returns the length or -1. */
+static int
+config_to_samples(int codec, const unsigned char *data, int len, unsigned char *out)
+{
+    int pos = 5, n = 0, set, i;
+
+    if (codec == ACCESS_UNIT_CODEC_HEVC) {
+        hevc_config_t cfg;
+
+        if (hevc_config_parse(data, len, &cfg) != 0) {
+            return -1;
+        }
+        if (cfg.vps_len > 0) {
+            n = append_nal(out, n, data + cfg.vps_off, cfg.vps_len);
+        }
+        if (n >= 0) {
+            n = append_nal(out, n, data + cfg.sps_off, cfg.sps_len);
+        }
+        if (n >= 0) {
+            n = append_nal(out, n, data + cfg.pps_off, cfg.pps_len);
+        }
+        return n;
+    }
+    /* avcC: every SPS, then every PPS */
+    for (set = 0; set < 2 && n >= 0; set++) {
+        int count;
+
+        if (pos >= len) {
+            return -1;
+        }
+        count = set == 0 ? data[pos] & 0x1f : data[pos];
+        pos++;
+        for (i = 0; i < count && n >= 0; i++) {
+            int nal_len;
+
+            if (pos + 2 > len) {
+                return -1;
+            }
+            nal_len = data[pos] << 8 | data[pos + 1];
+            pos += 2;
+            if (pos + nal_len > len) {
+                return -1;
+            }
+            n = append_nal(out, n, data + pos, nal_len);
+            pos += nal_len;
+        }
+    }
+    return n;
+}
+
+/* ftyp + moov for one avc1 / hvc1 track described by the config record */
+static int
+write_init(mp4_recorder_t *rec, const unsigned char *record, int record_len, int width, int height)
+{
+    unsigned char *buf = malloc(INIT_BOX_BYTES + (size_t)record_len);
+    box_writer_t w = { buf, 0 };
+    int hevc = rec->codec == ACCESS_UNIT_CODEC_HEVC;
+    int moov, trak, box, mdia, minf, dinf, stbl, stsd, entry, mvex, ret;
+    struct iovec iov;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    box = box_begin(&w, "ftyp");
+    put_bytes(&w, "isom", 4);
+    put32(&w, 0x200);
+    put_bytes(&w, "isomiso6mp41", 12);
+    put_bytes(&w, hevc ? "hvc1" : "avc1", 4);
+    box_end(&w, box);
+
+    moov = box_begin(&w, "moov");
+    box = full_box_begin(&w, "mvhd", 0, 0);
+    put_zeros(&w, 8);                   /* creation / modification time */
+    put32(&w, 1000);
+    put32(&w, 0);                       /* duration: in the fragments */
+    put32(&w, 0x00010000);              /* rate 1.0 */
+    put16(&w, 0x0100);                  /* volume 1.0 */
+    put_zeros(&w, 10);
+    put_matrix(&w);
+    put_zeros(&w, 24);
+    put32(&w, 2);                       /* next_track_ID */
+    box_end(&w, box);
+
+    trak = box_begin(&w, "trak");
+    box = full_box_begin(&w, "tkhd", 0, 3);     /* enabled, in movie */
+    put_zeros(&w, 8);
+    put32(&w, 1);                       /* track_ID */
+    put_zeros(&w, 4);
+    put32(&w, 0);
+    put_zeros(&w, 16);                  /* reserved, layer, alternate_group, volume, reserved */
+    put_matrix(&w);
+    put32(&w, (uint32_t)width << 16);
+    put32(&w, (uint32_t)height << 16);
+    box_end(&w, box);
+
+    mdia = box_begin(&w, "mdia");
+    box = full_box_begin(&w, "mdhd", 0, 0);
+    put_zeros(&w, 8);
+    put32(&w, MP4_RECORDER_TIMESCALE);
+    put32(&w, 0);
+    put16(&w, 0x55c4);                  /* 'und' */
+    put16(&w, 0);
+    box_end(&w, box);
+    box = full_box_begin(&w, "hdlr", 0, 0);
+    put32(&w, 0);
+    put_bytes(&w, "vide", 4);
+    put_zeros(&w, 12);
+    put_bytes(&w, "VideoHandler", 13);
+    box_end(&w, box);
+
+    minf = box_begin(&w, "minf");
+    box = full_box_begin(&w, "vmhd", 0, 1);
+    put_zeros(&w, 8);
+    box_end(&w, box);
+    dinf = box_begin(&w, "dinf");
+    box = full_box_begin(&w, "dref", 0, 0);
+    put32(&w, 1);
+    entry = full_box_begin(&w, "url ", 0, 1);  /* media in this file */
+    box_end(&w, entry);
+    box_end(&w, box);
+    box_end(&w, dinf);
+
+    stbl = box_begin(&w, "stbl");
+    stsd = full_box_begin(&w, "stsd", 0, 0);
+    put32(&w, 1);
+    entry = box_begin(&w, hevc ? "hvc1" : "avc1");
+    put_zeros(&w, 6);
+    put16(&w, 1);                       /* data_reference_index */
+    put_zeros(&w, 16);
+    put16(&w, (unsigned int)width);
+    put16(&w, (unsigned int)height);
+    put32(&w, 0x00480000);              /* 72 dpi */
+    put32(&w, 0x00480000);
+    put32(&w, 0);
+    put16(&w, 1);                       /* frame_count */
+    put_zeros(&w, 32);                  /* compressorname */
+    put16(&w, 0x0018);
+    put16(&w, 0xffff);
+    box = box_begin(&w, hevc ? "hvcC" : "avcC");
+    put_bytes(&w, record, record_len);
+    /* Samples carry 4-byte NAL lengths whatever the sender's record declares */
+    w.buf[box + 8 + (hevc ? 21 : 4)] |= 3;
+    box_end(&w, box);
+    box_end(&w, entry);
+    box_end(&w, stsd);
+    box = full_box_begin(&w, "stts", 0, 0);
+    put32(&w, 0);
+    box_end(&w, box);
+    box = full_box_begin(&w, "stsc", 0, 0);
+    put32(&w, 0);
+    box_end(&w, box);
+    box = full_box_begin(&w, "stsz", 0, 0);
+    put32(&w, 0);
+    put32(&w, 0);
+    box_end(&w, box);
+    box = full_box_begin(&w, "stco", 0, 0);
+    put32(&w, 0);
+    box_end(&w, box);
+    box_end(&w, stbl);
+    box_end(&w, minf);
+    box_end(&w, mdia);
+    box_end(&w, trak);
+
+    mvex = box_begin(&w, "mvex");
+    box = full_box_begin(&w, "trex", 0, 0);
+    put32(&w, 1);                       /* track_ID */
+    put32(&w, 1);                       /* default_sample_description_index */
+    put_zeros(&w, 12);
+    box_end(&w, box);
+    box_end(&w, mvex);
+    box_end(&w, moov);
+
+    iov.iov_base = buf;
+    iov.iov_len = (size_t)w.pos;
+    ret = timed_write(rec, &iov, 1, (size_t)w.pos);
+    free(buf);
+    return ret;
+}
+
+static void
+give_back(mp4_recorder_t *rec, const frame_desc_t *desc)
+{
+    __atomic_sub_fetch(&rec->stats.backlog_bytes, (size_t)desc->len, __ATOMIC_RELAXED);
+    /* The decode thread holds at most as many buffers as the queue has room for */
+    frame_queue_push(rec->done, desc, -1);
+}
+
+static void
+fail(mp4_recorder_t *rec)
+{
+    int i;
+
+    __atomic_store_n(&rec->stats.failed, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < rec->pend_count; i++) {
+        give_back(rec, &rec->pend[i]);
+    }
+    rec->pend_count = 0;
+}
+
+/* One moof + mdat for the pending samples, every duration known */
+static void
+flush_fragment(mp4_recorder_t *rec)
+{
+    box_writer_t w = { rec->moof, 0 };
+    int moof, traf, box, data_offset, count = 0, i;
+    size_t mdat = 8, total;
+    int64_t duration = 0;
+
+    if (rec->pend_count == 0) {
+        return;
+    }
+    for (i = 0; i < rec->pend_count; i++) {
+        mdat += (size_t)rec->pend[i].len;
+    }
+    mdat += (size_t)rec->frag_inband_len;
+
+    moof = box_begin(&w, "moof");
+    box = full_box_begin(&w, "mfhd", 0, 0);
+    put32(&w, ++rec->sequence);
+    box_end(&w, box);
+    traf = box_begin(&w, "traf");
+    box = full_box_begin(&w, "tfhd", 0, 0x020000);     /* default-base-is-moof */
+    put32(&w, 1);
+    box_end(&w, box);
+    box = full_box_begin(&w, "tfdt", 1, 0);
+    put64(&w, (uint64_t)rec->next_dts);
+    box_end(&w, box);
+    /* data-offset, sample-duration, -size and -flags present */
+    box = full_box_begin(&w, "trun", 0, 0x000701);
+    put32(&w, (uint32_t)rec->pend_count);
+    data_offset = w.pos;
+    put32(&w, 0);
+    for (i = 0; i < rec->pend_count; i++) {
+        put32(&w, rec->pend_duration[i]);
+        put32(&w, (uint32_t)(rec->pend[i].len + (i == 0 ? rec->frag_inband_len : 0)));
+        put32(&w, rec->pend_sync[i] ? SAMPLE_SYNC : SAMPLE_NON_SYNC);
+        duration += rec->pend_duration[i];
+    }
+    box_end(&w, box);
+    box_end(&w, traf);
+    box_end(&w, moof);
+    store32(w.buf + data_offset, (uint32_t)(w.pos - moof + 8));
+    put32(&w, (uint32_t)mdat);
+    put_bytes(&w, "mdat", 4);
+
+    rec->iov[count].iov_base = rec->moof;
+    rec->iov[count++].iov_len = (size_t)w.pos;
+    if (rec->frag_inband_len > 0) {
+        rec->iov[count].iov_base = rec->frag_inband;
+        rec->iov[count++].iov_len = (size_t)rec->frag_inband_len;
+    }
+    for (i = 0; i < rec->pend_count; i++) {
+        rec->iov[count].iov_base = rec->pend[i].data;
+        rec->iov[count++].iov_len = (size_t)rec->pend[i].len;
+    }
+    total = (size_t)w.pos + mdat - 8;
+
+    if (timed_write(rec, rec->iov, count, total) != 0) {
+        fail(rec);
+        return;
+    }
+    STAT_ADD(rec->stats.samples, (unsigned long long)rec->pend_count);
+    STAT_ADD(rec->stats.fragments, 1);
+    rec->next_dts += duration;
+    for (i = 0; i < rec->pend_count; i++) {
+        give_back(rec, &rec->pend[i]);
+    }
+    rec->pend_count = 0;
+}
+
+static void
+handle_config(mp4_recorder_t *rec, const unsigned char *data, int len)
+{
+    int codec, record_off, record_len, width, height, n;
+
+    if (parse_config(data, len, &codec, &record_off, &record_len, &width, &height) != 0) {
+        return;
+    }
+    if (!rec->have_init) {
+        rec->codec = codec;
+        if (write_init(rec, data + record_off, record_len, width, height) != 0) {
+            fail(rec);
+            return;
+        }
+        rec->have_init = 1;
+    } else if (codec != rec->codec) {
+        /* One sample description per file */
+        fail(rec);
+        return;
+    } else if (len != rec->config_len || memcmp(data, rec->config, (size_t)len) != 0) {
+        n = config_to_samples(codec, data, len, rec->inband);
+        if (n > 0) {
+            rec->inband_len = n;
+            rec->inband_pending = 1;
+            STAT_ADD(rec->stats.config_changes, 1);
+        }
+    }
+    memcpy(rec->config, data, (size_t)len);
+    rec->config_len = len;
+}
+
+/* Offset of the next 00 00 00 01 at or after from, or len */
+static int
+next_start_code(const unsigned char *data, int from, int len)
+{
+    const unsigned char *p = data + from + 3, *end = data + len;
+
+    while (p < end && (p = memchr(p, 1, (size_t)(end - p))) != NULL) {
+        if (p[-1] == 0 && p[-2] == 0 && p[-3] == 0) {
+            return (int)(p - 3 - data);
+        }
+        p++;
+    }
+    return len;
+}
+
+/* The assembler's 4-byte start codes back into NAL lengths, in place. Returns 1 for a sync sample. */
+static int
+annexb_to_samples(unsigned char *data, int len, int codec)
+{
+    int pos = 0, sync = 0;
+
+    while (pos + 4 < len) {
+        int nal = pos + 4, next = next_start_code(data, nal + 1, len), type;
+
+        store32(data + pos, (uint32_t)(next - nal));
+        if (codec == ACCESS_UNIT_CODEC_HEVC) {
+            type = HEVC_NAL_TYPE(data[nal]);
+            sync |= HEVC_NAL_IS_IRAP(type);
+        } else {
+            type = data[nal] & 0x1f;
+            sync |= type == 5;
+        }
+        pos = next;
+    }
+    return sync;
+}
+
+static void
+add_sample(mp4_recorder_t *rec, const frame_desc_t *desc)
+{
+    int sync = annexb_to_samples(desc->data, desc->len, rec->codec);
+    int64_t t = access_unit_ntp_to_ns(desc->ntp_timestamp);
+    int64_t ticks;
+
+    if (!rec->started) {
+        rec->started = 1;
+        rec->base_ns = t;
+    }
+    /* Sender time to 90 kHz, from the first sample so rounding never accumulates */
+    ticks = (t - rec->base_ns) * 9 / 100000;
+    if (rec->pend_count > 0) {
+        int64_t duration = ticks - rec->last_ticks;
+
+        if (duration < 1) {
+            /* Sender clock went back: keep decode times increasing */
+            duration = 1;
+            ticks = rec->last_ticks + 1;
+        }
+        rec->pend_duration[rec->pend_count - 1] = (uint32_t)duration;
+        if (sync || rec->pend_count == MP4_RECORDER_FRAGMENT_SAMPLES ||
+            t - rec->frag_start_ns >= MP4_RECORDER_FRAGMENT_NS) {
+            flush_fragment(rec);
+        }
+    }
+    rec->last_ticks = ticks;
+    if (__atomic_load_n(&rec->stats.failed, __ATOMIC_RELAXED)) {
+        give_back(rec, desc);
+        return;
+    }
+    if (rec->pend_count == 0) {
+        rec->frag_start_ns = t;
+        rec->frag_inband_len = 0;
+        if (sync && rec->inband_pending) {
+            memcpy(rec->frag_inband, rec->inband, (size_t)rec->inband_len);
+            rec->frag_inband_len = rec->inband_len;
+            rec->inband_pending = 0;
+        }
+    }
+    rec->pend[rec->pend_count] = *desc;
+    rec->pend_duration[rec->pend_count] = DEFAULT_DURATION;
+    rec->pend_sync[rec->pend_count] = sync;
+    rec->pend_count++;
+}
+
+static void *
+writer_main(void *arg)
+{
+    mp4_recorder_t *rec = arg;
+    frame_desc_t desc;
+
+    while (frame_queue_pop(rec->queue, &desc, -1) == 0) {
+        int failed = __atomic_load_n(&rec->stats.failed, __ATOMIC_RELAXED);
+
+        if (desc.type == DESC_CONFIG) {
+            if (!failed) {
+                handle_config(rec, desc.data, desc.len);
+            }
+            free(desc.data);
+        } else if (failed || !rec->have_init) {
+            give_back(rec, &desc);
+        } else {
+            add_sample(rec, &desc);
+        }
+    }
+    /* Closed and drained: the last sample keeps the duration of the one before it */
+    if (rec->pend_count > 1) {
+        rec->pend_duration[rec->pend_count - 1] = rec->pend_duration[rec->pend_count - 2];
+    }
+    flush_fragment(rec);
+    return NULL;
+}
+
+mp4_recorder_t *
+mp4_recorder_create(int fd, size_t max_backlog)
+{
+    mp4_recorder_t *rec = calloc(1, sizeof(mp4_recorder_t));
+
+    if (rec == NULL) {
+        close(fd);
+        return NULL;
+    }
+    rec->fd = fd;
+    rec->max_backlog = max_backlog > 0 ? max_backlog : MP4_RECORDER_DEFAULT_BACKLOG;
+    rec->stats.max_backlog = rec->max_backlog;
+    rec->waiting_keyframe = 1;
+    /* Room for every held buffer plus configs in between */
+    rec->queue = frame_queue_create(2 * MP4_RECORDER_MAX_FRAMES);
+    rec->done = frame_queue_create(MP4_RECORDER_MAX_FRAMES);
+    if (rec->queue == NULL || rec->done == NULL ||
+        pthread_create(&rec->thread, NULL, writer_main, rec) != 0) {
+        mp4_recorder_destroy(rec);
+        return NULL;
+    }
+    rec->thread_started = 1;
+    return rec;
+}
+
+static int
+push_config(mp4_recorder_t *rec, unsigned char *copy, int len)
+{
+    frame_desc_t desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.data = copy;
+    desc.len = len;
+    desc.type = DESC_CONFIG;
+    return frame_queue_push(rec->queue, &desc, 0);
+}
+
+int
+mp4_recorder_config(mp4_recorder_t *recorder, const unsigned char *data, int len)
+{
+    int codec, record_off, record_len, width, height;
+    unsigned char *copy;
+
+    if (recorder->stopped || len > MP4_RECORDER_MAX_CONFIG ||
+        parse_config(data, len, &codec, &record_off, &record_len, &width, &height) != 0) {
+        return -1;
+    }
+    copy = malloc((size_t)len);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, data, (size_t)len);
+    STAT_ADD(recorder->stats.configs, 1);
+    recorder->have_config = 1;
+    free(recorder->unsent_config);
+    recorder->unsent_config = NULL;
+    if (push_config(recorder, copy, len) != 0) {
+        /* Sent ahead of the next frame instead; frames never overtake it */
+        recorder->unsent_config = copy;
+        recorder->unsent_config_len = len;
+    }
+    return 0;
+}
+
+static int
+refuse(mp4_recorder_t *rec)
+{
+    STAT_ADD(rec->stats.dropped_backlog, 1);
+    rec->waiting_keyframe = 1;
+    return 0;
+}
+
+int
+mp4_recorder_frame(mp4_recorder_t *recorder, unsigned char *data, int len, int flags,
+                   uint64_t ntp_timestamp, uint64_t cookie)
+{
+    frame_desc_t desc;
+    size_t backlog;
+
+    if (recorder->stopped || len <= 0 || __atomic_load_n(&recorder->stats.failed, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (!recorder->have_config || (recorder->waiting_keyframe && !(flags & ACCESS_UNIT_KEYFRAME))) {
+        STAT_ADD(recorder->stats.dropped_waiting, 1);
+        return 0;
+    }
+    if (recorder->unsent_config != NULL) {
+        if (push_config(recorder, recorder->unsent_config, recorder->unsent_config_len) != 0) {
+            return refuse(recorder);
+        }
+        recorder->unsent_config = NULL;
+    }
+    if (recorder->held >= MP4_RECORDER_MAX_FRAMES ||
+        __atomic_load_n(&recorder->stats.backlog_bytes, __ATOMIC_RELAXED) + (size_t)len > recorder->max_backlog) {
+        return refuse(recorder);
+    }
+    /* Counted before the push: the writer may give it back at once */
+    backlog = __atomic_add_fetch(&recorder->stats.backlog_bytes, (size_t)len, __ATOMIC_RELAXED);
+    desc.data = data;
+    desc.len = len;
+    desc.type = DESC_VIDEO;
+    desc.ntp_timestamp = ntp_timestamp;
+    desc.cookie = cookie;
+    if (frame_queue_push(recorder->queue, &desc, 0) != 0) {
+        __atomic_sub_fetch(&recorder->stats.backlog_bytes, (size_t)len, __ATOMIC_RELAXED);
+        return refuse(recorder);
+    }
+    if (backlog > recorder->stats.backlog_high_water) {
+        __atomic_store_n(&recorder->stats.backlog_high_water, backlog, __ATOMIC_RELAXED);
+    }
+    recorder->held++;
+    recorder->waiting_keyframe = 0;
+    STAT_ADD(recorder->stats.frames, 1);
+    return 1;
+}
+
+int
+mp4_recorder_reclaim(mp4_recorder_t *recorder, frame_desc_t *desc)
+{
+    if (recorder->held == 0 || frame_queue_pop(recorder->done, desc, 0) != 0) {
+        return -1;
+    }
+    recorder->held--;
+    return 0;
+}
+
+int
+mp4_recorder_stop(mp4_recorder_t *recorder)
+{
+    if (!recorder->stopped) {
+        recorder->stopped = 1;
+        if (recorder->queue != NULL) {
+            frame_queue_close(recorder->queue);
+        }
+        if (recorder->thread_started) {
+            pthread_join(recorder->thread, NULL);
+        }
+        if (recorder->fd >= 0) {
+            close(recorder->fd);
+            recorder->fd = -1;
+        }
+        free(recorder->unsent_config);
+        recorder->unsent_config = NULL;
+    }
+    return recorder->stats.write_errors > 0 ? -1 : 0;
+}
+
+void
+mp4_recorder_destroy(mp4_recorder_t *recorder)
+{
+    if (recorder == NULL) {
+        return;
+    }
+    mp4_recorder_stop(recorder);
+    frame_queue_destroy(recorder->queue);
+    frame_queue_destroy(recorder->done);
+    free(recorder);
+}
+
+void
+mp4_recorder_get_stats(mp4_recorder_t *recorder, mp4_recorder_stats_t *stats)
+{
+    stats->frames = __atomic_load_n(&recorder->stats.frames, __ATOMIC_RELAXED);
+    stats->dropped_backlog = __atomic_load_n(&recorder->stats.dropped_backlog, __ATOMIC_RELAXED);
+    stats->dropped_waiting = __atomic_load_n(&recorder->stats.dropped_waiting, __ATOMIC_RELAXED);
+    stats->configs = __atomic_load_n(&recorder->stats.configs, __ATOMIC_RELAXED);
+    stats->samples = __atomic_load_n(&recorder->stats.samples, __ATOMIC_RELAXED);
+    stats->fragments = __atomic_load_n(&recorder->stats.fragments, __ATOMIC_RELAXED);
+    stats->bytes_written = __atomic_load_n(&recorder->stats.bytes_written, __ATOMIC_RELAXED);
+    stats->config_changes = __atomic_load_n(&recorder->stats.config_changes, __ATOMIC_RELAXED);
+    stats->write_errors = __atomic_load_n(&recorder->stats.write_errors, __ATOMIC_RELAXED);
+    stats->write_ns = __atomic_load_n(&recorder->stats.write_ns, __ATOMIC_RELAXED);
+    stats->max_write_ns = __atomic_load_n(&recorder->stats.max_write_ns, __ATOMIC_RELAXED);
+    stats->backlog_bytes = __atomic_load_n(&recorder->stats.backlog_bytes, __ATOMIC_RELAXED);
+    stats->backlog_high_water = __atomic_load_n(&recorder->stats.backlog_high_water, __ATOMIC_RELAXED);
+    stats->max_backlog = recorder->max_backlog;
+    stats->failed = __atomic_load_n(&recorder->stats.failed, __ATOMIC_RELAXED);
+}
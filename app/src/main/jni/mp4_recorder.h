@@ -0,0 +1,93 @@
+/**
+ * Fragmented MP4 recorder for the mirror stream
+ *
+ * Archives a mirroring session as it is decoded. The codec config packet
+ * (avcC or hvcC record) becomes the sample description of an avc1 / hvc1
+ * track, and every recorded access unit becomes one sample of a moof + mdat
+ * fragment, timed by the sender's packet timestamps (90 kHz), so the file
+ * keeps the sender's frame spacing, static screens included, and plays while
+ * it is still being written.
+ *
+ * Nothing is copied on the decode path. mp4_recorder_frame takes the pooled
+ * payload buffer that already holds the assembled Annex-B access unit and
+ * queues its descriptor (frame_queue.h) to a writer thread. The writer turns
+ * the start codes back into 4-byte NAL lengths in place, which is the MP4
+ * sample format, and writes each fragment with one writev: the moof and mdat
+ * headers, then iovecs pointing straight into the held buffers. Written
+ * buffers come back through a second queue; the decode thread picks them up
+ * with mp4_recorder_reclaim and returns them to its pool.
+ *
+ * The decode thread never waits. Held buffers are bounded in bytes and in
+ * count; under slow storage a frame that does not fit is refused (the caller
+ * keeps its buffer) and recording resumes at the next keyframe, so the file
+ * has a freeze, never a corrupt picture. A later config with different
+ * parameter sets is written in-band ahead of the next keyframe; a config for
+ * the other codec ends the recording.
+ *
+ * mp4_recorder_config, _frame and _reclaim are for one thread (the decoder's);
+ * mp4_recorder_get_stats may be called from any thread.
+ */
+
+#ifndef MP4_RECORDER_H
+#define MP4_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame_queue.h"
+
+#define MP4_RECORDER_TIMESCALE 90000
+#define MP4_RECORDER_DEFAULT_BACKLOG ((size_t)16 << 20)   /* payload bytes held by the recorder */
+#define MP4_RECORDER_MAX_FRAMES 512                       /* buffers held by the recorder */
+#define MP4_RECORDER_FRAGMENT_SAMPLES 128
+#define MP4_RECORDER_FRAGMENT_NS 1000000000LL             /* a fragment is cut at the next keyframe or after this */
+#define MP4_RECORDER_MAX_CONFIG 4096
+
+typedef struct mp4_recorder_s mp4_recorder_t;
+
+typedef struct {
+    /* Decode thread */
+    unsigned long long frames;              /* accepted by mp4_recorder_frame */
+    unsigned long long dropped_backlog;     /* refused: backlog full (bytes or buffers) */
+    unsigned long long dropped_waiting;     /* refused: no config yet, or waiting for a keyframe after a drop */
+    unsigned long long configs;
+    /* Writer thread */
+    unsigned long long samples;             /* written */
+    unsigned long long fragments;
+    unsigned long long bytes_written;
+    unsigned long long config_changes;      /* parameter sets written in-band */
+    unsigned long long write_errors;
+    unsigned long long write_ns;            /* in writev */
+    unsigned long long max_write_ns;
+    size_t backlog_bytes;                   /* held right now */
+    size_t backlog_high_water;
+    size_t max_backlog;
+    int failed;                             /* a write failed or the codec changed; nothing more is recorded */
+} mp4_recorder_stats_t;
+
+/* fd: a file open for writing, owned (and closed) by the recorder from now on.
+ * max_backlog 0: MP4_RECORDER_DEFAULT_BACKLOG. NULL on allocation failure (fd is closed). */
+mp4_recorder_t *mp4_recorder_create(int fd, size_t max_backlog);
+
+/* A type 0x01 payload (avcC or hvcC record); copied. Returns 0, or -1 if it is neither. */
+int mp4_recorder_config(mp4_recorder_t *recorder, const unsigned char *data, int len);
+
+/* An assembled access unit occupying data[0, len) (access_unit_assemble's output and ACCESS_UNIT_* flags).
+ * Returns 1 when the recorder took the buffer (it comes back from mp4_recorder_reclaim with cookie),
+ * 0 when it was refused and is still the caller's. Never blocks. */
+int mp4_recorder_frame(mp4_recorder_t *recorder, unsigned char *data, int len, int flags,
+                       uint64_t ntp_timestamp, uint64_t cookie);
+
+/* A buffer the recorder is done with (desc->data, desc->cookie). Returns 0, or -1 when none is ready. */
+int mp4_recorder_reclaim(mp4_recorder_t *recorder, frame_desc_t *desc);
+
+/* Writes what is queued, ends the file and closes it; every held buffer is then reclaimable.
+ * Returns 0, or -1 if any write failed. */
+int mp4_recorder_stop(mp4_recorder_t *recorder);
+
+/* Stops if needed; buffers not reclaimed by then are forgotten */
+void mp4_recorder_destroy(mp4_recorder_t *recorder);
+
+void mp4_recorder_get_stats(mp4_recorder_t *recorder, mp4_recorder_stats_t *stats);
+
+#endif // MP4_RECORDER_H
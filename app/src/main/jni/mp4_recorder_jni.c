@@ -0,0 +1,138 @@
+#include <jni.h>
+#include <android/log.h>
+#include "mp4_recorder.h"
+
+#define LOG_TAG "Mp4RecorderJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeGetStats (must match Mp4Recorder.kt) */
+#define STATS_LEN 15
+
+/**
+ * Start a recorder writing to a file descriptor
+ * Input: fd = open for writing, owned by the recorder from now on;
+ *        maxBacklog = payload bytes the recorder may hold (0 for the default)
+ * Output: opaque handle, 0 on allocation failure (fd is closed)
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeCreate(JNIEnv *env, jobject thiz, jint fd,
+                                                            jlong max_backlog) {
+    mp4_recorder_t *recorder = mp4_recorder_create(fd, max_backlog > 0 ? (size_t)max_backlog : 0);
+    if (recorder == NULL) {
+        LOGE("Failed to allocate MP4 recorder");
+        return 0;
+    }
+    return (jlong)recorder;
+}
+
+/**
+ * Codec config packet (avcC or hvcC record)
+ * Input: data[0, length) = the type 0x01 payload
+ * Output: 0, or -1 if it is neither record or too large
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeConfig(JNIEnv *env, jobject thiz, jlong handle,
+                                                            jbyteArray data, jint length) {
+    mp4_recorder_t *recorder = (mp4_recorder_t *)handle;
+    unsigned char config[MP4_RECORDER_MAX_CONFIG];
+
+    if (recorder == NULL || length <= 0 || length > MP4_RECORDER_MAX_CONFIG ||
+        length > (*env)->GetArrayLength(env, data)) {
+        return -1;
+    }
+    (*env)->GetByteArrayRegion(env, data, 0, length, (jbyte *)config);
+    return mp4_recorder_config(recorder, config, length);
+}
+
+/**
+ * Offer an assembled access unit without copying it
+ * Input: buffer = direct pooled buffer holding it from offset 0, length = its bytes,
+ *        flags = AccessUnitAssembler flags, ntpTimestamp = sender time, cookie = caller's id for the buffer
+ * Output: 1 when the recorder took the buffer (back through nativeReclaim), 0 when it is still the caller's
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeFrame(JNIEnv *env, jobject thiz, jlong handle, jobject buffer,
+                                                           jint length, jint flags, jlong ntp_timestamp,
+                                                           jlong cookie) {
+    mp4_recorder_t *recorder = (mp4_recorder_t *)handle;
+    unsigned char *data;
+
+    if (recorder == NULL) {
+        return 0;
+    }
+    data = (*env)->GetDirectBufferAddress(env, buffer);
+    if (data == NULL || length <= 0 || length > (*env)->GetDirectBufferCapacity(env, buffer)) {
+        LOGE("Invalid access unit buffer (length %d)", length);
+        return 0;
+    }
+    return mp4_recorder_frame(recorder, data, length, flags, (uint64_t)ntp_timestamp, (uint64_t)cookie);
+}
+
+/**
+ * Next buffer the recorder is done with
+ * Output: its cookie, or -1 when none is ready
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeReclaim(JNIEnv *env, jobject thiz, jlong handle) {
+    mp4_recorder_t *recorder = (mp4_recorder_t *)handle;
+    frame_desc_t desc;
+
+    if (recorder == NULL || mp4_recorder_reclaim(recorder, &desc) != 0) {
+        return -1;
+    }
+    return (jlong)desc.cookie;
+}
+
+/**
+ * Write what is queued, end and close the file; held buffers become reclaimable
+ * Output: 0, or -1 if any write failed
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeStop(JNIEnv *env, jobject thiz, jlong handle) {
+    mp4_recorder_t *recorder = (mp4_recorder_t *)handle;
+    return recorder != NULL ? mp4_recorder_stop(recorder) : -1;
+}
+
+/**
+ * Snapshot of the recorder counters
+ * Output: out = frames, dropped (backlog), dropped (waiting), configs, samples, fragments, bytes written,
+ *         config changes, write errors, write ns, max write ns, backlog bytes, backlog high water,
+ *         max backlog, failed
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeGetStats(JNIEnv *env, jobject thiz, jlong handle,
+                                                              jlongArray out) {
+    mp4_recorder_t *recorder = (mp4_recorder_t *)handle;
+    mp4_recorder_stats_t stats;
+    jlong values[STATS_LEN];
+
+    if (recorder == NULL || (*env)->GetArrayLength(env, out) < STATS_LEN) {
+        return;
+    }
+    mp4_recorder_get_stats(recorder, &stats);
+    values[0] = (jlong)stats.frames;
+    values[1] = (jlong)stats.dropped_backlog;
+    values[2] = (jlong)stats.dropped_waiting;
+    values[3] = (jlong)stats.configs;
+    values[4] = (jlong)stats.samples;
+    values[5] = (jlong)stats.fragments;
+    values[6] = (jlong)stats.bytes_written;
+    values[7] = (jlong)stats.config_changes;
+    values[8] = (jlong)stats.write_errors;
+    values[9] = (jlong)stats.write_ns;
+    values[10] = (jlong)stats.max_write_ns;
+    values[11] = (jlong)stats.backlog_bytes;
+    values[12] = (jlong)stats.backlog_high_water;
+    values[13] = (jlong)stats.max_backlog;
+    values[14] = stats.failed;
+    (*env)->SetLongArrayRegion(env, out, 0, STATS_LEN, values);
+}
+
+/**
+ * Free a recorder from nativeCreate (stopping it first if needed)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_Mp4Recorder_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    mp4_recorder_destroy((mp4_recorder_t *)handle);
+}
@@ -0,0 +1,130 @@
+# Emits playfair_unrolled.c: cycle, permute_block_1/2 and generate_key_schedule
+# from omg_hax.c with every table_index/permute_table_2/index_mangle lookup and
+# ShiftRows-style byte shuffle resolved at build time, so the decrypt path does
+# direct loads at constant offsets instead of (31*i)%40 / (71*i)%144 arithmetic.
+#
+#   cmake -DOUTPUT=<file> -P gen_unrolled.cmake
+#
+# Runs in script mode so it works unchanged under the NDK toolchain. The host
+# build checks the output against omg_hax.c (playfair_unrolled_check).
+
+if(NOT OUTPUT)
+    message(FATAL_ERROR "gen_unrolled.cmake: -DOUTPUT=<file> is required")
+endif()
+
+set(INDEX_MANGLE 0x01 0x02 0x04 0x08 0x10 0x20 0x40 0x80 0x1B 0x36 0x6C)
+
+# permute_block_1/2 write block[d] from block[src(d)] (inverse ShiftRows)
+function(shuffle_src d out)
+    math(EXPR v "(${d} - 4 * (${d} & 3)) & 15")
+    set(${out} ${v} PARENT_SCOPE)
+endfunction()
+
+# Appends 16 lines "dst[d] = table[offset(d) + src[src(d)]];" for one permute
+# table: s3 uses fixed offsets, s4 uses permute_table_2(round*16+d)
+function(emit_permute var table round dst_block src_block)
+    set(code "")
+    foreach(d RANGE 15)
+        shuffle_src(${d} s)
+        if(table STREQUAL "table_s3")
+            math(EXPR off "((${d} + 4 * (${d} & 3)) & 15) << 8" OUTPUT_FORMAT HEXADECIMAL)
+        else()
+            math(EXPR off "((71 * (${round} * 16 + ${d})) % 144) << 8" OUTPUT_FORMAT HEXADECIMAL)
+        endif()
+        string(APPEND code "    ${dst_block}[${d}] = ${table}[${off} + ${src_block}[${s}]];\n")
+    endforeach()
+    set(${var} "${${var}}${code}" PARENT_SCOPE)
+endfunction()
+
+# One cycle round: T-table mix of each word with key_schedule[row], result in t
+function(emit_mix var row)
+    set(code "    k = (const unsigned char *)key_schedule[${row}];\n")
+    foreach(w RANGE 3)
+        math(EXPR b0 "${w} * 4")
+        math(EXPR b1 "${w} * 4 + 1")
+        math(EXPR b2 "${w} * 4 + 2")
+        math(EXPR b3 "${w} * 4 + 3")
+        string(APPEND code "    t.w[${w}] = (uint32_t)(table_s5[s.b[${b3}] ^ k[${b3}]] ^ table_s6[s.b[${b2}] ^ k[${b2}]] ^\n")
+        string(APPEND code "                         table_s7[s.b[${b1}] ^ k[${b1}]] ^ table_s8[s.b[${b0}] ^ k[${b0}]]);\n")
+    endforeach()
+    set(${var} "${${var}}${code}" PARENT_SCOPE)
+endfunction()
+
+set(src "/* Generated by playfair/gen_unrolled.cmake - do not edit */\n\n")
+string(APPEND src "#include <stdint.h>\n#include <string.h>\n\n#include \"omg_hax_unrolled.h\"\n\n")
+string(APPEND src "extern unsigned char t_key[];\nextern unsigned char table_s1[];\n")
+string(APPEND src "extern unsigned char table_s3[];\nextern unsigned char table_s4[];\n")
+string(APPEND src "extern unsigned long table_s5[];\nextern unsigned long table_s6[];\n")
+string(APPEND src "extern unsigned long table_s7[];\nextern unsigned long table_s8[];\n\n")
+string(APPEND src "typedef union {\n    uint32_t w[4];\n    unsigned char b[16];\n} block_t;\n\n")
+
+# generate_key_schedule: table_index(4*round+j) and index_mangle[round] baked in
+string(APPEND src "void\ngenerate_key_schedule_unrolled(const unsigned char *key_material, uint32_t key_schedule[11][4])\n{\n")
+string(APPEND src "    block_t kd;\n\n")
+foreach(i RANGE 15)
+    string(APPEND src "    kd.b[${i}] = key_material[${i}] ^ t_key[${i}];\n")
+endforeach()
+foreach(round RANGE 10)
+    list(GET INDEX_MANGLE ${round} mangle)
+    math(EXPR ti "${round} * 4")
+    string(APPEND src "\n    /* round ${round} */\n")
+    string(APPEND src "    key_schedule[${round}][0] = kd.w[0];\n")
+    set(src_bytes 13 14 15 12)
+    foreach(j RANGE 3)
+        list(GET src_bytes ${j} sb)
+        math(EXPR off "((31 * (${ti} + ${j})) % 40) << 8" OUTPUT_FORMAT HEXADECIMAL)
+        if(j EQUAL 0)
+            string(APPEND src "    kd.b[${j}] ^= table_s1[${off} + kd.b[${sb}]] ^ ${mangle};\n")
+        else()
+            string(APPEND src "    kd.b[${j}] ^= table_s1[${off} + kd.b[${sb}]];\n")
+        endif()
+    endforeach()
+    string(APPEND src "    key_schedule[${round}][1] = kd.w[1];\n    kd.w[1] ^= kd.w[0];\n")
+    string(APPEND src "    key_schedule[${round}][2] = kd.w[2];\n    kd.w[2] ^= kd.w[1];\n")
+    string(APPEND src "    key_schedule[${round}][3] = kd.w[3];\n    kd.w[3] ^= kd.w[2];\n")
+endforeach()
+string(APPEND src "}\n\n")
+
+# permute_block_1
+string(APPEND src "void\npermute_block_1_unrolled(unsigned char *block)\n{\n    unsigned char in[16];\n\n")
+string(APPEND src "    memcpy(in, block, 16);\n")
+emit_permute(src table_s3 0 block in)
+string(APPEND src "}\n\n")
+
+# permute_block_2: one specialisation per round plus a dispatcher
+foreach(round RANGE 8)
+    string(APPEND src "static inline void\npermute_block_2_round${round}(unsigned char *block, const unsigned char *in)\n{\n")
+    emit_permute(src table_s4 ${round} block in)
+    string(APPEND src "}\n\n")
+endforeach()
+string(APPEND src "void\npermute_block_2_unrolled(unsigned char *block, int round)\n{\n    unsigned char in[16];\n\n")
+string(APPEND src "    memcpy(in, block, 16);\n    switch (round) {\n")
+foreach(round RANGE 8)
+    string(APPEND src "    case ${round}: permute_block_2_round${round}(block, in); break;\n")
+endforeach()
+string(APPEND src "    default: break;\n    }\n}\n\n")
+
+# cycle: 9 rounds, each T-table mix followed by permute_block_2(8 - round)
+string(APPEND src "void\ncycle_unrolled(unsigned char *block, uint32_t key_schedule[11][4])\n{\n")
+string(APPEND src "    block_t s, t;\n    const unsigned char *k;\n\n    memcpy(t.b, block, 16);\n")
+foreach(w RANGE 3)
+    string(APPEND src "    t.w[${w}] ^= key_schedule[10][${w}];\n")
+endforeach()
+emit_permute(src table_s3 0 s.b t.b)
+foreach(round RANGE 8)
+    math(EXPR row "9 - ${round}")
+    math(EXPR p2 "8 - ${round}")
+    string(APPEND src "\n    /* round ${round}: key_schedule[${row}], permute_table_2 round ${p2} */\n")
+    emit_mix(src ${row})
+    emit_permute(src table_s4 ${p2} s.b t.b)
+endforeach()
+string(APPEND src "\n")
+foreach(w RANGE 3)
+    string(APPEND src "    s.w[${w}] ^= key_schedule[0][${w}];\n")
+endforeach()
+string(APPEND src "    memcpy(block, s.b, 16);\n}\n")
+
+# Only touch the output when it changes so dependents don't rebuild needlessly
+file(WRITE "${OUTPUT}.tmp" "${src}")
+configure_file("${OUTPUT}.tmp" "${OUTPUT}" COPYONLY)
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,12 @@
+#ifndef OMG_HAX_UNROLLED_H
+#define OMG_HAX_UNROLLED_H
+
+#include <stdint.h>
+
+/* Build-generated (gen_unrolled.cmake) equivalents of the omg_hax.c primitives */
+void generate_key_schedule_unrolled(const unsigned char *key_material, uint32_t key_schedule[11][4]);
+void permute_block_1_unrolled(unsigned char *block);
+void permute_block_2_unrolled(unsigned char *block, int round);
+void cycle_unrolled(unsigned char *block, uint32_t key_schedule[11][4]);
+
+#endif
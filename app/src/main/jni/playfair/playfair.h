@@ -1,6 +1,12 @@
 #ifndef PLAYFAIR_H
 #define PLAYFAIR_H
 
+#include <stdint.h>
+
+/* The session key and its schedule depend only on message3, so callers
+ * decrypting several ekeys per handshake can derive them once. */
+void playfair_key_schedule(unsigned char* message3, uint32_t key_schedule[11][4]);
+void playfair_decrypt_scheduled(uint32_t key_schedule[11][4], unsigned char* cipherText, unsigned char* keyOut);
 void playfair_decrypt(unsigned char* message3, unsigned char* cipherText, unsigned char* keyOut);
 
 #endif
@@ -0,0 +1,275 @@
+/**
+ * Batched UDP transport for the RAOP audio data, control and timing channels
+ */
+
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "raop_udp.h"
+
+#define RAOP_UDP_INITIAL_BATCH 16
+#define RAOP_UDP_GROW_STREAK 4          /* consecutive full batches before doubling */
+#define RAOP_UDP_SHRINK_STREAK 32       /* consecutive mostly-empty calls before halving */
+#define RAOP_UDP_CONTROL_LEN CMSG_SPACE(sizeof(struct timespec))
+
+struct raop_udp_s {
+    logger_t *logger;
+    int fd;
+    int port;
+    int flags;
+    int use_recvmmsg;                   /* cleared if the kernel lacks recvmmsg */
+
+    int batch;
+    int full_streak;
+    int sparse_streak;
+
+    struct mmsghdr msgs[RAOP_UDP_MAX_BATCH];
+    struct iovec iovs[RAOP_UDP_MAX_BATCH];
+    raop_udp_packet_t packets[RAOP_UDP_MAX_BATCH];
+    unsigned char control[RAOP_UDP_MAX_BATCH][RAOP_UDP_CONTROL_LEN];
+    unsigned char data[RAOP_UDP_MAX_BATCH][RAOP_UDP_PACKET_LEN];
+
+    struct mmsghdr send_msgs[RAOP_UDP_MAX_BATCH];
+    struct iovec send_iovs[RAOP_UDP_MAX_BATCH];
+
+    raop_udp_stats_t stats;
+};
+
+raop_udp_t *
+raop_udp_init(logger_t *logger, unsigned short port, int flags, int recv_timeout_ms)
+{
+    raop_udp_t *udp;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int on = 1;
+    int i;
+
+    udp = calloc(1, sizeof(raop_udp_t));
+    if (!udp) {
+        return NULL;
+    }
+    udp->logger = logger;
+    udp->flags = flags;
+    udp->use_recvmmsg = 1;
+    udp->batch = (flags & RAOP_UDP_FIXED_BATCH) ? RAOP_UDP_MAX_BATCH : RAOP_UDP_INITIAL_BATCH;
+
+    udp->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (udp->fd < 0) {
+        free(udp);
+        return NULL;
+    }
+    if ((flags & RAOP_UDP_TIMESTAMPS) &&
+        setsockopt(udp->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+        goto fail;
+    }
+    if (recv_timeout_ms > 0) {
+        struct timeval tv;
+        tv.tv_sec = recv_timeout_ms / 1000;
+        tv.tv_usec = (recv_timeout_ms % 1000) * 1000;
+        setsockopt(udp->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(udp->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(udp->fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        goto fail;
+    }
+    udp->port = ntohs(addr.sin_port);
+
+    /* Buffers never move, so the iovecs and headers are wired up once */
+    for (i = 0; i < RAOP_UDP_MAX_BATCH; i++) {
+        udp->iovs[i].iov_base = udp->data[i];
+        udp->iovs[i].iov_len = RAOP_UDP_PACKET_LEN;
+        udp->msgs[i].msg_hdr.msg_iov = &udp->iovs[i];
+        udp->msgs[i].msg_hdr.msg_iovlen = 1;
+        udp->msgs[i].msg_hdr.msg_name = &udp->packets[i].addr;
+        udp->packets[i].data = udp->data[i];
+        udp->send_msgs[i].msg_hdr.msg_iov = &udp->send_iovs[i];
+        udp->send_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return udp;
+
+fail:
+    close(udp->fd);
+    free(udp);
+    return NULL;
+}
+
+void
+raop_udp_destroy(raop_udp_t *udp)
+{
+    if (udp) {
+        close(udp->fd);
+        free(udp);
+    }
+}
+
+int
+raop_udp_get_port(raop_udp_t *udp)
+{
+    return udp->port;
+}
+
+int
+raop_udp_get_fd(raop_udp_t *udp)
+{
+    return udp->fd;
+}
+
+/* Grow while the socket keeps more queued than one call takes; shrink when calls come back mostly empty */
+static void
+tune_batch(raop_udp_t *udp, int received)
+{
+    if (udp->flags & RAOP_UDP_FIXED_BATCH) {
+        return;
+    }
+    if (received == udp->batch) {
+        udp->sparse_streak = 0;
+        if (++udp->full_streak >= RAOP_UDP_GROW_STREAK && udp->batch < RAOP_UDP_MAX_BATCH) {
+            udp->batch *= 2;
+            udp->full_streak = 0;
+            udp->stats.batch_grows++;
+        }
+    } else if (received <= udp->batch / 4) {
+        udp->full_streak = 0;
+        if (++udp->sparse_streak >= RAOP_UDP_SHRINK_STREAK && udp->batch > RAOP_UDP_MIN_BATCH) {
+            udp->batch /= 2;
+            udp->sparse_streak = 0;
+            udp->stats.batch_shrinks++;
+        }
+    } else {
+        udp->full_streak = 0;
+        udp->sparse_streak = 0;
+    }
+}
+
+static uint64_t
+packet_timestamp(struct msghdr *hdr)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+int
+raop_udp_recv(raop_udp_t *udp)
+{
+    int timestamps = udp->flags & RAOP_UDP_TIMESTAMPS;
+    int count;
+    int i;
+
+    /* The kernel overwrites name and control lengths, so reset the slots this call may fill */
+    for (i = 0; i < udp->batch; i++) {
+        struct msghdr *hdr = &udp->msgs[i].msg_hdr;
+        hdr->msg_namelen = sizeof(struct sockaddr_storage);
+        hdr->msg_control = timestamps ? udp->control[i] : NULL;
+        hdr->msg_controllen = timestamps ? RAOP_UDP_CONTROL_LEN : 0;
+        hdr->msg_flags = 0;
+    }
+
+    if (udp->use_recvmmsg) {
+        /* Blocks (up to SO_RCVTIMEO) for the first datagram only, then drains what is queued */
+        count = recvmmsg(udp->fd, udp->msgs, udp->batch, MSG_WAITFORONE, NULL);
+        if (count < 0 && errno == ENOSYS) {
+            udp->use_recvmmsg = 0;
+        }
+    }
+    if (!udp->use_recvmmsg) {
+        ssize_t len = recvmsg(udp->fd, &udp->msgs[0].msg_hdr, 0);
+        count = len < 0 ? -1 : 1;
+        if (len >= 0) {
+            udp->msgs[0].msg_len = (unsigned int)len;
+        }
+    }
+    udp->stats.recv_syscalls++;
+
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            udp->stats.recv_timeouts++;
+            return 0;
+        }
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct msghdr *hdr = &udp->msgs[i].msg_hdr;
+        raop_udp_packet_t *packet = &udp->packets[i];
+        packet->len = (int)udp->msgs[i].msg_len;
+        packet->truncated = (hdr->msg_flags & MSG_TRUNC) != 0;
+        packet->addrlen = hdr->msg_namelen;
+        packet->timestamp_ns = timestamps ? packet_timestamp(hdr) : 0;
+        if (packet->truncated) {
+            udp->stats.truncated++;
+        }
+    }
+    udp->stats.recv_packets += count;
+    if (count == udp->batch) {
+        udp->stats.full_batches++;
+    }
+    tune_batch(udp, count);
+    return count;
+}
+
+const raop_udp_packet_t *
+raop_udp_get_packet(raop_udp_t *udp, int index)
+{
+    return &udp->packets[index];
+}
+
+int
+raop_udp_send(raop_udp_t *udp, const struct sockaddr *addr, socklen_t addrlen,
+              const unsigned char *const *bufs, const int *lens, int count)
+{
+    int sent = 0;
+
+    while (sent < count) {
+        int chunk = count - sent;
+        int i;
+        int n;
+
+        if (chunk > RAOP_UDP_MAX_BATCH) {
+            chunk = RAOP_UDP_MAX_BATCH;
+        }
+        for (i = 0; i < chunk; i++) {
+            udp->send_iovs[i].iov_base = (void *)bufs[sent + i];
+            udp->send_iovs[i].iov_len = (size_t)lens[sent + i];
+            udp->send_msgs[i].msg_hdr.msg_name = (void *)addr;
+            udp->send_msgs[i].msg_hdr.msg_namelen = addrlen;
+        }
+        n = sendmmsg(udp->fd, udp->send_msgs, chunk, 0);
+        udp->stats.send_syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return sent > 0 ? sent : -1;
+        }
+        sent += n;
+        udp->stats.send_packets += n;
+    }
+    return sent;
+}
+
+void
+raop_udp_get_stats(raop_udp_t *udp, raop_udp_stats_t *stats)
+{
+    memcpy(stats, &udp->stats, sizeof(*stats));
+    stats->batch_size = udp->batch;
+}
@@ -0,0 +1,73 @@
+/**
+ * Batched UDP transport for the RAOP audio data, control and timing channels
+ *
+ * Datagrams are received with recvmmsg() into preallocated mmsghdr/iovec
+ * arrays and sent with sendmmsg(), so a burst of audio or retransmit packets
+ * costs one syscall instead of one per packet. The batch size tunes itself:
+ * it grows while every call fills the batch and shrinks while calls come back
+ * mostly empty. Sockets opened with RAOP_UDP_TIMESTAMPS report the kernel
+ * receive time (SO_TIMESTAMPNS), which the timing channel uses instead of a
+ * clock read after the packet has already been queued.
+ */
+
+#ifndef RAOP_UDP_H
+#define RAOP_UDP_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "logger.h"
+
+#define RAOP_UDP_MAX_BATCH 64
+#define RAOP_UDP_MIN_BATCH 4
+#define RAOP_UDP_PACKET_LEN 2048        /* RTP audio / control / timing packets are well under this */
+
+/* raop_udp_init flags */
+#define RAOP_UDP_TIMESTAMPS 0x1         /* kernel receive timestamps (SO_TIMESTAMPNS) */
+#define RAOP_UDP_FIXED_BATCH 0x2        /* disable the batch-size tuner */
+
+typedef struct raop_udp_s raop_udp_t;
+
+typedef struct {
+    unsigned char *data;
+    int len;
+    int truncated;                      /* datagram was longer than RAOP_UDP_PACKET_LEN */
+    uint64_t timestamp_ns;              /* CLOCK_REALTIME receive time, 0 without RAOP_UDP_TIMESTAMPS */
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+} raop_udp_packet_t;
+
+typedef struct {
+    unsigned long long recv_syscalls;
+    unsigned long long recv_packets;
+    unsigned long long recv_timeouts;   /* calls that returned no packet */
+    unsigned long long full_batches;    /* calls that filled the batch */
+    unsigned long long truncated;
+    unsigned long long send_syscalls;
+    unsigned long long send_packets;
+    int batch_size;                     /* current tuned batch size */
+    int batch_grows;
+    int batch_shrinks;
+} raop_udp_stats_t;
+
+/* Binds a UDP socket on port (0 picks a free one). recv_timeout_ms bounds how
+ * long raop_udp_recv waits for the first datagram (0 = forever). */
+raop_udp_t *raop_udp_init(logger_t *logger, unsigned short port, int flags, int recv_timeout_ms);
+void raop_udp_destroy(raop_udp_t *udp);
+
+int raop_udp_get_port(raop_udp_t *udp);
+int raop_udp_get_fd(raop_udp_t *udp);
+
+/* Waits for at least one datagram and takes whatever else is queued, up to the
+ * current batch size. Returns the packet count (see raop_udp_get_packet), 0 on
+ * timeout, -1 on error. Packets stay valid until the next call. */
+int raop_udp_recv(raop_udp_t *udp);
+const raop_udp_packet_t *raop_udp_get_packet(raop_udp_t *udp, int index);
+
+/* Sends count datagrams to addr in as few syscalls as possible; returns the number sent or -1 */
+int raop_udp_send(raop_udp_t *udp, const struct sockaddr *addr, socklen_t addrlen,
+                  const unsigned char *const *bufs, const int *lens, int count);
+
+void raop_udp_get_stats(raop_udp_t *udp, raop_udp_stats_t *stats);
+
+#endif // RAOP_UDP_H
@@ -0,0 +1,97 @@
+/**
+ * Bit reader for H.264 / HEVC parameter sets
+ *
+ * Reads fixed-width and Exp-Golomb fields from a NAL unit's payload, skipping
+ * emulation prevention bytes (00 00 03) on the fly so no unescaped copy is
+ * needed. Reads past the end return zeros and set overrun, so a parser checks
+ * once at the end instead of after every field.
+ */
+
+#ifndef RBSP_READER_H
+#define RBSP_READER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_UE_BITS 31
+
+/* Bit reader over an RBSP that skips emulation prevention bytes (00 00 03) */
+typedef struct {
+    const unsigned char *data;
+    int len;
+    int pos;                            /* byte */
+    int bit;                            /* next bit in data[pos], 7 = MSB */
+    int zeros;                          /* consecutive zero bytes before pos */
+    int overrun;
+} bit_reader_t;
+
+static inline void
+br_init(bit_reader_t *br, const unsigned char *data, int len)
+{
+    memset(br, 0, sizeof(*br));
+    br->data = data;
+    br->len = len;
+    br->bit = 7;
+}
+
+static inline void
+br_next_byte(bit_reader_t *br)
+{
+    br->zeros = br->data[br->pos] == 0 ? br->zeros + 1 : 0;
+    br->pos++;
+    br->bit = 7;
+    if (br->zeros >= 2 && br->pos < br->len && br->data[br->pos] == 3) {
+        br->pos++;
+        br->zeros = 0;
+    }
+}
+
+static inline unsigned int
+br_u1(bit_reader_t *br)
+{
+    unsigned int v;
+
+    if (br->pos >= br->len) {
+        br->overrun = 1;
+        return 0;
+    }
+    v = (br->data[br->pos] >> br->bit) & 1;
+    if (br->bit-- == 0) {
+        br_next_byte(br);
+    }
+    return v;
+}
+
+static inline uint32_t
+br_u(bit_reader_t *br, int n)
+{
+    uint32_t v = 0;
+
+    while (n-- > 0) {
+        v = v << 1 | br_u1(br);
+    }
+    return v;
+}
+
+static inline uint32_t
+br_ue(bit_reader_t *br)
+{
+    int leading = 0;
+
+    while (br_u1(br) == 0) {
+        if (++leading > MAX_UE_BITS || br->overrun) {
+            br->overrun = 1;
+            return 0;
+        }
+    }
+    return (uint32_t)(((uint64_t)1 << leading) - 1 + br_u(br, leading));
+}
+
+static inline int32_t
+br_se(bit_reader_t *br)
+{
+    uint32_t k = br_ue(br);
+    return (k & 1) ? (int32_t)((k + 1) / 2) : -(int32_t)(k / 2);
+}
+
+#endif // RBSP_READER_H
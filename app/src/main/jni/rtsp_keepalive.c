@@ -0,0 +1,217 @@
+/**
+ * Keepalive fast path for the control connection
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+#include "rtsp_keepalive.h"
+
+/* Keepalives are a few short headers; anything larger takes the regular path */
+#define RTSP_KEEPALIVE_MAX_HEAD 1024
+#define RTSP_KEEPALIVE_MAX_BODY 4096
+
+#define FEEDBACK_LINE "POST /feedback RTSP/1.0\r\n"
+#define GET_PARAMETER_METHOD "GET_PARAMETER "
+#define RTSP_PROTOCOL_EOL " RTSP/1.0\r\n"
+
+/* Every reply starts the same; the CSeq value goes right after it. A request
+ * without CSeq gets the head up to "Server: ..." and no CSeq line. */
+static const char reply_head[] = "RTSP/1.0 200 OK\r\nServer: AirTunes/220.68\r\nCSeq: ";
+#define REPLY_CSEQ_FIELD_LEN (sizeof("\r\nCSeq: ") - 1)
+
+static const char feedback_tail[] =
+    "\r\nContent-Type: text/plain\r\nAudio-Jack-Status: connected\r\n\r\n";
+static const char volume_tail[] =
+    "\r\nContent-Type: text/parameters\r\nContent-Length: 15\r\nAudio-Jack-Status: connected\r\n\r\n"
+    "volume: -20.0\r\n";
+static const char parameter_tail[] =
+    "\r\nContent-Type: text/parameters\r\nAudio-Jack-Status: connected\r\n\r\n";
+
+static int
+header_is(const unsigned char *line, int len, const char *name, int name_len)
+{
+    return len > name_len && line[name_len] == ':' && strncasecmp((const char *)line, name, name_len) == 0;
+}
+
+/* Length of the request line when it is one the fast path answers, else 0 */
+static int
+match_request_line(const unsigned char *buf, int len, rtsp_keepalive_kind_t *kind)
+{
+    const unsigned char *eol;
+    int line_len;
+
+    if (len >= (int)sizeof(FEEDBACK_LINE) - 1 && memcmp(buf, FEEDBACK_LINE, sizeof(FEEDBACK_LINE) - 1) == 0) {
+        *kind = RTSP_KEEPALIVE_FEEDBACK;
+        return sizeof(FEEDBACK_LINE) - 1;
+    }
+    if (len < (int)sizeof(GET_PARAMETER_METHOD) - 1 ||
+        memcmp(buf, GET_PARAMETER_METHOD, sizeof(GET_PARAMETER_METHOD) - 1) != 0) {
+        return 0;
+    }
+
+    /* GET_PARAMETER <url> RTSP/1.0; a "/..." path could hit another handler in AirPlayServer */
+    eol = memchr(buf, '\n', len < RTSP_KEEPALIVE_MAX_HEAD ? len : RTSP_KEEPALIVE_MAX_HEAD);
+    if (!eol) {
+        return 0;
+    }
+    line_len = (int)(eol - buf) + 1;
+    if (line_len <= (int)(sizeof(GET_PARAMETER_METHOD) - 1 + sizeof(RTSP_PROTOCOL_EOL) - 1) ||
+        buf[sizeof(GET_PARAMETER_METHOD) - 1] == '/' ||
+        memcmp(eol + 1 - (sizeof(RTSP_PROTOCOL_EOL) - 1), RTSP_PROTOCOL_EOL, sizeof(RTSP_PROTOCOL_EOL) - 1) != 0 ||
+        memchr(buf + sizeof(GET_PARAMETER_METHOD) - 1, ' ',
+               line_len - (sizeof(GET_PARAMETER_METHOD) - 1) - (sizeof(RTSP_PROTOCOL_EOL) - 1)) != NULL) {
+        return 0;
+    }
+    *kind = RTSP_KEEPALIVE_PARAMETER;
+    return line_len;
+}
+
+/* GET_PARAMETER bodies are compared trimmed, like AirPlayServer does */
+static int
+body_is_volume(const unsigned char *body, int len)
+{
+    while (len > 0 && body[len - 1] <= ' ') {
+        len--;
+    }
+    while (len > 0 && body[0] <= ' ') {
+        body++;
+        len--;
+    }
+    return len == 6 && memcmp(body, "volume", 6) == 0;
+}
+
+int
+rtsp_keepalive_match(const unsigned char *buf, int len, rtsp_keepalive_t *ka)
+{
+    rtsp_keepalive_kind_t kind = RTSP_KEEPALIVE_NONE;
+    int content_length = 0;
+    int pos;
+
+    pos = match_request_line(buf, len, &kind);
+    if (pos == 0) {
+        return 0;
+    }
+    ka->cseq.off = 0;
+    ka->cseq.len = 0;
+
+    for (;;) {
+        int limit = (len < RTSP_KEEPALIVE_MAX_HEAD ? len : RTSP_KEEPALIVE_MAX_HEAD) - pos;
+        const unsigned char *line = buf + pos;
+        const unsigned char *eol = limit > 0 ? memchr(line, '\n', limit) : NULL;
+        int line_len;
+
+        if (!eol) {
+            return 0;
+        }
+        line_len = (int)(eol - line) - 1;
+        if (line_len < 0 || line[line_len] != '\r') {
+            return 0;
+        }
+        pos += line_len + 2;
+        if (line_len == 0) {
+            break;
+        }
+
+        if (header_is(line, line_len, "CSeq", 4)) {
+            int v = 5;
+            while (v < line_len && (line[v] == ' ' || line[v] == '\t')) {
+                v++;
+            }
+            if (ka->cseq.len == 0) {
+                ka->cseq.off = (int)(line - buf) + v;
+                ka->cseq.len = line_len - v;
+            }
+        } else if (header_is(line, line_len, "Content-Length", 14)) {
+            int v = 15;
+            while (v < line_len && (line[v] == ' ' || line[v] == '\t')) {
+                v++;
+            }
+            if (v == line_len) {
+                return 0;
+            }
+            content_length = 0;
+            for (; v < line_len; v++) {
+                if (line[v] < '0' || line[v] > '9') {
+                    return 0;
+                }
+                content_length = content_length * 10 + (line[v] - '0');
+                if (content_length > RTSP_KEEPALIVE_MAX_BODY) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    if (len - pos < content_length) {
+        return 0;
+    }
+    if (kind == RTSP_KEEPALIVE_PARAMETER && body_is_volume(buf + pos, content_length)) {
+        kind = RTSP_KEEPALIVE_VOLUME;
+    }
+    ka->kind = kind;
+    ka->total_len = pos + content_length;
+    return ka->total_len;
+}
+
+int
+rtsp_keepalive_response(const rtsp_keepalive_t *ka, const unsigned char *buf, struct iovec *iov)
+{
+    int count = 0;
+
+    iov[count].iov_base = (void *)reply_head;
+    iov[count++].iov_len = sizeof(reply_head) - 1 - (ka->cseq.len > 0 ? 0 : REPLY_CSEQ_FIELD_LEN);
+    if (ka->cseq.len > 0) {
+        iov[count].iov_base = (void *)(buf + ka->cseq.off);
+        iov[count++].iov_len = ka->cseq.len;
+    }
+    switch (ka->kind) {
+    case RTSP_KEEPALIVE_VOLUME:
+        iov[count].iov_base = (void *)volume_tail;
+        iov[count++].iov_len = sizeof(volume_tail) - 1;
+        break;
+    case RTSP_KEEPALIVE_PARAMETER:
+        iov[count].iov_base = (void *)parameter_tail;
+        iov[count++].iov_len = sizeof(parameter_tail) - 1;
+        break;
+    default:
+        iov[count].iov_base = (void *)feedback_tail;
+        iov[count++].iov_len = sizeof(feedback_tail) - 1;
+        break;
+    }
+    return count;
+}
+
+int
+rtsp_keepalive_send(int fd, const rtsp_keepalive_t *ka, const unsigned char *buf)
+{
+    struct iovec iov[RTSP_KEEPALIVE_MAX_IOV];
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = rtsp_keepalive_response(ka, buf, iov);
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        /* Short write: drop what went out and resend the rest */
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= (ssize_t)msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (unsigned char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * Keepalive fast path for the control connection
+ *
+ * While mirroring, senders issue POST /feedback and GET_PARAMETER (volume)
+ * every second or so for the whole session. Their replies never change except
+ * for the echoed CSeq, so they are kept as precomputed templates: a request is
+ * recognised from its request line, only CSeq and Content-Length are picked
+ * out of the headers, and the reply is the template with the request's own
+ * CSeq bytes spliced in through an iovec. Nothing is formatted or copied, and
+ * the answer goes out in one gather write.
+ *
+ * Replies match AirPlayServer's handleFeedback / handleGetParameter byte for
+ * byte. Anything that is not a complete RTSP/1.0 keepalive is left to the
+ * regular parser and handlers.
+ */
+
+#ifndef RTSP_KEEPALIVE_H
+#define RTSP_KEEPALIVE_H
+
+#include <sys/uio.h>
+
+#include "rtsp_request.h"
+
+#define RTSP_KEEPALIVE_MAX_IOV 3
+
+typedef enum {
+    RTSP_KEEPALIVE_NONE = 0,
+    RTSP_KEEPALIVE_FEEDBACK,        /* POST /feedback: empty 200, text/plain */
+    RTSP_KEEPALIVE_VOLUME,          /* GET_PARAMETER "volume": "volume: -20.0" */
+    RTSP_KEEPALIVE_PARAMETER        /* any other GET_PARAMETER: empty 200, text/parameters */
+} rtsp_keepalive_kind_t;
+
+typedef struct {
+    rtsp_keepalive_kind_t kind;
+    rtsp_slice_t cseq;              /* into the request; len 0 when it has none */
+    int total_len;                  /* request line + headers + body */
+} rtsp_keepalive_t;
+
+/* buf holds the pending request (and possibly pipelined ones after it). Returns
+ * its length when it is a complete keepalive, with ka filled; 0 when it is not
+ * a keepalive, is incomplete or looks malformed, so the regular parser should
+ * see it. Costs one compare for any other request. */
+int rtsp_keepalive_match(const unsigned char *buf, int len, rtsp_keepalive_t *ka);
+
+/* Points iov at the reply for a matched request: template head, the CSeq bytes
+ * in buf, template tail. Returns the iovec count (at most RTSP_KEEPALIVE_MAX_IOV). */
+int rtsp_keepalive_response(const rtsp_keepalive_t *ka, const unsigned char *buf, struct iovec *iov);
+
+/* Writes the reply to a blocking socket with one sendmsg (writev plus
+ * MSG_NOSIGNAL), continuing on short writes. Returns 0 or -1. */
+int rtsp_keepalive_send(int fd, const rtsp_keepalive_t *ka, const unsigned char *buf);
+
+#endif // RTSP_KEEPALIVE_H
@@ -0,0 +1,153 @@
+#include <jni.h>
+#include <android/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtsp_keepalive.h"
+#include "rtsp_request.h"
+
+#define LOG_TAG "RtspParserJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the int[] filled by nativeParse (must match RtspRequestParser.kt) */
+#define OUT_METHOD 0
+#define OUT_PATH 2
+#define OUT_PROTOCOL 4
+#define OUT_BODY 6
+#define OUT_HEADER_COUNT 8
+#define OUT_HEADERS 9
+#define OUT_LEN (OUT_HEADERS + 4 * RTSP_MAX_HEADERS)
+
+/* Longer CSeq values are left to the regular path */
+#define KEEPALIVE_MAX_CSEQ 32
+
+/**
+ * Allocate an incremental parser for one control connection
+ * Output: opaque handle, 0 on allocation failure
+ */
+JNIEXPORT jlong JNICALL
+Java_com_pentagram_airplay_service_RtspRequestParser_nativeCreate(JNIEnv *env, jobject thiz) {
+    rtsp_parser_t *parser = malloc(sizeof(rtsp_parser_t));
+    if (parser == NULL) {
+        LOGE("Failed to allocate RTSP parser");
+        return 0;
+    }
+    rtsp_parser_init(parser);
+    return (jlong)parser;
+}
+
+/**
+ * Resume parsing the pending request
+ * Input: buf[start, start + len) = every byte received so far for the pending request
+ * Output: request length when complete, with out[] holding absolute (offset, length)
+ *         pairs into buf; 0 if more data is needed; -1 if malformed
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_RtspRequestParser_nativeParse(JNIEnv *env, jobject thiz, jlong handle,
+                                                                 jbyteArray buf, jint start, jint len,
+                                                                 jintArray out) {
+    rtsp_parser_t *parser = (rtsp_parser_t *)handle;
+    if (parser == NULL) {
+        LOGE("Invalid RTSP parser handle");
+        return -1;
+    }
+    if ((*env)->GetArrayLength(env, out) < OUT_LEN) {
+        LOGE("Output array too short: need %d ints", OUT_LEN);
+        return -1;
+    }
+
+    // Critical access: the scan is short and makes no JNI calls
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, buf, NULL);
+    if (bytes == NULL) {
+        return -1;
+    }
+    int n = rtsp_parser_execute(parser, (const unsigned char *)bytes + start, len);
+    (*env)->ReleasePrimitiveArrayCritical(env, buf, bytes, JNI_ABORT);
+    if (n <= 0) {
+        return n;
+    }
+
+    const rtsp_request_t *req = &parser->req;
+    jint fields[OUT_LEN];
+    fields[OUT_METHOD] = start + req->method.off;
+    fields[OUT_METHOD + 1] = req->method.len;
+    fields[OUT_PATH] = start + req->path.off;
+    fields[OUT_PATH + 1] = req->path.len;
+    fields[OUT_PROTOCOL] = start + req->protocol.off;
+    fields[OUT_PROTOCOL + 1] = req->protocol.len;
+    fields[OUT_BODY] = start + req->body.off;
+    fields[OUT_BODY + 1] = req->body.len;
+    fields[OUT_HEADER_COUNT] = req->header_count;
+    for (int i = 0; i < req->header_count; i++) {
+        jint *h = &fields[OUT_HEADERS + 4 * i];
+        h[0] = start + req->headers[i].name.off;
+        h[1] = req->headers[i].name.len;
+        h[2] = start + req->headers[i].value.off;
+        h[3] = req->headers[i].value.len;
+    }
+    (*env)->SetIntArrayRegion(env, out, 0, OUT_HEADERS + 4 * req->header_count, fields);
+    return n;
+}
+
+/**
+ * Answer the pending request directly when it is a /feedback or GET_PARAMETER keepalive
+ * Input: buf[start, start + len) as for nativeParse; fd = the control socket (blocking)
+ * Output: request length when it was answered (consume it without calling nativeParse);
+ *         0 if it is not a complete keepalive; -1 if writing the reply failed
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_RtspRequestParser_nativeKeepalive(JNIEnv *env, jobject thiz, jlong handle,
+                                                                     jbyteArray buf, jint start, jint len,
+                                                                     jint fd) {
+    rtsp_parser_t *parser = (rtsp_parser_t *)handle;
+    rtsp_keepalive_t ka;
+    unsigned char cseq[KEEPALIVE_MAX_CSEQ];
+
+    if (parser == NULL || len <= 0) {
+        return 0;
+    }
+
+    // Match under critical access, but copy CSeq out so the write happens after release
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, buf, NULL);
+    if (bytes == NULL) {
+        return 0;
+    }
+    int n = rtsp_keepalive_match((const unsigned char *)bytes + start, len, &ka);
+    if (n > 0 && ka.cseq.len <= (int)sizeof(cseq)) {
+        memcpy(cseq, (const unsigned char *)bytes + start + ka.cseq.off, ka.cseq.len);
+        ka.cseq.off = 0;
+    } else {
+        n = 0;
+    }
+    (*env)->ReleasePrimitiveArrayCritical(env, buf, bytes, JNI_ABORT);
+    if (n == 0) {
+        return 0;
+    }
+
+    // The parser may have scanned part of this request on an earlier call
+    rtsp_parser_init(parser);
+    if (rtsp_keepalive_send(fd, &ka, cseq) < 0) {
+        LOGE("Failed to write keepalive reply");
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * Drop any partially parsed request (connection reset or buffer discarded)
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_RtspRequestParser_nativeReset(JNIEnv *env, jobject thiz, jlong handle) {
+    rtsp_parser_t *parser = (rtsp_parser_t *)handle;
+    if (parser != NULL) {
+        rtsp_parser_init(parser);
+    }
+}
+
+/**
+ * Free a parser from nativeCreate
+ */
+JNIEXPORT void JNICALL
+Java_com_pentagram_airplay_service_RtspRequestParser_nativeDestroy(JNIEnv *env, jobject thiz, jlong handle) {
+    free((rtsp_parser_t *)handle);
+}
@@ -0,0 +1,201 @@
+/**
+ * In-place RTSP/HTTP request view
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "rtsp_request.h"
+
+#define RTSP_MAX_CONTENT_LENGTH (4 * 1024 * 1024)
+
+/* Resumes the CRLFCRLF search at *scanned; returns the header length or -1 */
+static int
+find_header_end(const unsigned char *buf, int len, int *scanned)
+{
+    const unsigned char *p = buf + *scanned;
+    const unsigned char *end = buf + len;
+
+    while (p < end && (p = memchr(p, '\r', end - p)) != NULL) {
+        if (end - p < 4) {
+            break;
+        }
+        if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+            return (int)(p - buf) + 4;
+        }
+        p++;
+    }
+    /* The last three bytes may start a terminator split across reads */
+    *scanned = len > 3 ? len - 3 : 0;
+    return -1;
+}
+
+static int
+parse_token(const unsigned char *buf, int pos, int line_end, unsigned char stop, rtsp_slice_t *out)
+{
+    int start = pos;
+    while (pos < line_end && buf[pos] != stop) {
+        pos++;
+    }
+    out->off = start;
+    out->len = pos - start;
+    return pos;
+}
+
+static int
+parse_content_length(const unsigned char *buf, const rtsp_slice_t *value)
+{
+    long n = 0;
+    int i;
+
+    if (value->len == 0) {
+        return -1;
+    }
+    for (i = 0; i < value->len; i++) {
+        unsigned char c = buf[value->off + i];
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        n = n * 10 + (c - '0');
+        if (n > RTSP_MAX_CONTENT_LENGTH) {
+            return -1;
+        }
+    }
+    return (int)n;
+}
+
+static int
+parse_head(rtsp_request_t *req, const unsigned char *buf, int header_end)
+{
+    int pos, line_end;
+
+    memset(req, 0, sizeof(*req));
+    req->buf = buf;
+
+    /* Request line: METHOD SP PATH SP PROTOCOL CRLF */
+    line_end = (int)((const unsigned char *)memchr(buf, '\n', header_end) - buf) - 1;
+    if (line_end < 0 || buf[line_end] != '\r') {
+        return -1;
+    }
+    pos = parse_token(buf, 0, line_end, ' ', &req->method);
+    if (req->method.len == 0 || pos >= line_end) {
+        return -1;
+    }
+    pos = parse_token(buf, pos + 1, line_end, ' ', &req->path);
+    if (req->path.len == 0 || pos >= line_end) {
+        return -1;
+    }
+    parse_token(buf, pos + 1, line_end, '\r', &req->protocol);
+
+    /* Header lines until the blank line; "Name:" OWS value */
+    pos = line_end + 2;
+    while (pos < header_end - 2) {
+        rtsp_header_t *h;
+        line_end = (int)((const unsigned char *)memchr(buf + pos, '\n', header_end - pos) - buf) - 1;
+        if (buf[line_end] != '\r') {
+            return -1;
+        }
+        if (req->header_count == RTSP_MAX_HEADERS) {
+            return -1;
+        }
+        h = &req->headers[req->header_count];
+        pos = parse_token(buf, pos, line_end, ':', &h->name);
+        if (pos < line_end && h->name.len > 0) {
+            pos++;
+            while (pos < line_end && (buf[pos] == ' ' || buf[pos] == '\t')) {
+                pos++;
+            }
+            h->value.off = pos;
+            h->value.len = line_end - pos;
+            req->header_count++;
+        }
+        pos = line_end + 2;
+    }
+
+    const rtsp_slice_t *cl = rtsp_request_header(req, "Content-Length");
+    if (cl) {
+        req->content_length = parse_content_length(buf, cl);
+        if (req->content_length < 0) {
+            return -1;
+        }
+    }
+    req->body.off = header_end;
+    req->body.len = req->content_length;
+    req->total_len = header_end + req->content_length;
+    return 0;
+}
+
+void
+rtsp_parser_init(rtsp_parser_t *parser)
+{
+    parser->scanned = 0;
+    parser->header_end = 0;
+}
+
+int
+rtsp_parser_execute(rtsp_parser_t *parser, const unsigned char *buf, int len)
+{
+    if (!parser->header_end) {
+        int header_end = find_header_end(buf, len, &parser->scanned);
+        if (header_end < 0) {
+            return 0;
+        }
+        if (parse_head(&parser->req, buf, header_end) < 0) {
+            rtsp_parser_init(parser);
+            return -1;
+        }
+        parser->header_end = header_end;
+    }
+
+    /* Waiting for the body only costs a length check per read */
+    if (len < parser->req.total_len) {
+        return 0;
+    }
+    parser->req.buf = buf;
+    rtsp_parser_init(parser);
+    return parser->req.total_len;
+}
+
+int
+rtsp_request_parse(rtsp_request_t *req, const unsigned char *buf, int len)
+{
+    rtsp_parser_t parser;
+    int ret;
+
+    rtsp_parser_init(&parser);
+    ret = rtsp_parser_execute(&parser, buf, len);
+    if (ret > 0) {
+        *req = parser.req;
+    }
+    return ret;
+}
+
+const rtsp_slice_t *
+rtsp_request_header(const rtsp_request_t *req, const char *name)
+{
+    int name_len = (int)strlen(name);
+    int i;
+
+    for (i = 0; i < req->header_count; i++) {
+        const rtsp_header_t *h = &req->headers[i];
+        if (h->name.len == name_len &&
+            strncasecmp((const char *)req->buf + h->name.off, name, name_len) == 0) {
+            return &h->value;
+        }
+    }
+    return NULL;
+}
+
+int
+rtsp_slice_equals(const rtsp_request_t *req, const rtsp_slice_t *slice, const char *str)
+{
+    int len = (int)strlen(str);
+    return slice->len == len && memcmp(req->buf + slice->off, str, len) == 0;
+}
+
+int
+rtsp_slice_starts_with(const rtsp_request_t *req, const rtsp_slice_t *slice, const char *prefix)
+{
+    int len = (int)strlen(prefix);
+    return slice->len >= len && memcmp(req->buf + slice->off, prefix, len) == 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * In-place RTSP/HTTP request view
+ *
+ * Parses a request line, headers and Content-Length body straight out of the
+ * connection's receive buffer. Nothing is copied: every field is an offset and
+ * length into that buffer, valid until the buffer is compacted or reused.
+ *
+ * rtsp_parser_t is the incremental form: feed it the bytes received so far for
+ * the pending request and it resumes where the previous call stopped, so a
+ * request arriving in many small reads is scanned once. The header terminator
+ * is found with memchr (vectorised in bionic and glibc) rather than per byte.
+ */
+
+#ifndef RTSP_REQUEST_H
+#define RTSP_REQUEST_H
+
+#define RTSP_MAX_HEADERS 32
+
+typedef struct {
+    int off;
+    int len;
+} rtsp_slice_t;
+
+typedef struct {
+    rtsp_slice_t name;
+    rtsp_slice_t value;
+} rtsp_header_t;
+
+typedef struct {
+    const unsigned char *buf;   /* start of this request in the receive buffer */
+    rtsp_slice_t method;
+    rtsp_slice_t path;
+    rtsp_slice_t protocol;
+    rtsp_header_t headers[RTSP_MAX_HEADERS];
+    int header_count;
+    rtsp_slice_t body;
+    int content_length;
+    int total_len;              /* request line + headers + body */
+} rtsp_request_t;
+
+typedef struct {
+    int scanned;                /* header bytes already searched for CRLFCRLF */
+    int header_end;             /* 0 until the header block has been parsed */
+    rtsp_request_t req;
+} rtsp_parser_t;
+
+void rtsp_parser_init(rtsp_parser_t *parser);
+
+/* buf holds everything received so far for the pending request (it may also hold
+ * pipelined requests after it). Returns the request length once complete, with
+ * parser->req filled and the parser ready for the next request; 0 if more data
+ * is needed; -1 if malformed. Offsets in req are relative to buf. */
+int rtsp_parser_execute(rtsp_parser_t *parser, const unsigned char *buf, int len);
+
+/* One-shot form: returns bytes consumed for a complete request, 0 if more data is needed, -1 if malformed */
+int rtsp_request_parse(rtsp_request_t *req, const unsigned char *buf, int len);
+
+/* Case-insensitive header lookup; returns NULL when absent */
+const rtsp_slice_t *rtsp_request_header(const rtsp_request_t *req, const char *name);
+
+int rtsp_slice_equals(const rtsp_request_t *req, const rtsp_slice_t *slice, const char *str);
+int rtsp_slice_starts_with(const rtsp_request_t *req, const rtsp_slice_t *slice, const char *prefix);
+
+#endif // RTSP_REQUEST_H
@@ -0,0 +1,570 @@
+/**
+ * Native RTSP/HTTP control-plane server
+ */
+
+#define _GNU_SOURCE /* accept4 */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "rtsp_server.h"
+
+#define RTSP_MAX_HANDLERS 32
+#define RTSP_MAX_EVENTS 64
+#define RTSP_READ_CHUNK 4096
+#define RTSP_MAX_CONN_BUFFER (4 * 1024 * 1024 + 64 * 1024)
+#define RTSP_MAX_RESPONSE_HEAD 512
+
+typedef struct {
+    char method[32];            /* empty = any */
+    char path[128];             /* empty = any */
+    int prefix;
+    rtsp_handler_t handler;
+    void *opaque;
+} rtsp_route_t;
+
+struct rtsp_conn_s {
+    rtsp_server_t *server;
+    int fd;
+    int closing;
+    void *data;
+
+    unsigned char *rbuf;
+    int rlen;
+    int rcap;
+    rtsp_parser_t parser;       /* state for the request at the front of rbuf */
+
+    unsigned char *wbuf;
+    int wlen;
+    int woff;
+    int wcap;
+    int want_write;
+
+    rtsp_conn_t *prev;
+    rtsp_conn_t *next;
+};
+
+struct rtsp_server_s {
+    logger_t *logger;
+    int epfd;
+    int listen_fd;
+    int stop_fd;
+    volatile int running;
+    int keepalive_fast_path;
+    unsigned long long requests;
+    unsigned long long keepalives;
+
+    rtsp_route_t routes[RTSP_MAX_HANDLERS];
+    int route_count;
+
+    rtsp_conn_t *conns;
+};
+
+/* epoll tags for the two non-connection descriptors */
+static char listen_tag;
+static char stop_tag;
+
+static int
+set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+rtsp_server_t *
+rtsp_server_init(logger_t *logger)
+{
+    rtsp_server_t *server = calloc(1, sizeof(rtsp_server_t));
+    if (!server) {
+        return NULL;
+    }
+    server->logger = logger;
+    server->listen_fd = -1;
+    server->epfd = epoll_create1(EPOLL_CLOEXEC);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->epfd < 0 || server->stop_fd < 0) {
+        rtsp_server_destroy(server);
+        return NULL;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &stop_tag };
+    if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->stop_fd, &ev) < 0) {
+        rtsp_server_destroy(server);
+        return NULL;
+    }
+    return server;
+}
+
+int
+rtsp_server_add_handler(rtsp_server_t *server, const char *method, const char *path,
+                        rtsp_handler_t handler, void *opaque)
+{
+    rtsp_route_t *route;
+    size_t path_len;
+
+    if (server->route_count == RTSP_MAX_HANDLERS || !handler) {
+        return -1;
+    }
+    if ((method && strlen(method) >= sizeof(route->method)) || (path && strlen(path) >= sizeof(route->path))) {
+        return -1;
+    }
+
+    route = &server->routes[server->route_count++];
+    memset(route, 0, sizeof(*route));
+    if (method) {
+        strcpy(route->method, method);
+    }
+    if (path) {
+        strcpy(route->path, path);
+        path_len = strlen(path);
+        if (path_len > 0 && path[path_len - 1] == '*') {
+            route->path[path_len - 1] = '\0';
+            route->prefix = 1;
+        }
+    }
+    route->handler = handler;
+    route->opaque = opaque;
+    return 0;
+}
+
+void
+rtsp_server_set_keepalive_fast_path(rtsp_server_t *server, int enable)
+{
+    server->keepalive_fast_path = enable;
+}
+
+int
+rtsp_server_listen(rtsp_server_t *server, unsigned short port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0 ||
+        set_nonblocking(fd) < 0 || getsockname(fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &listen_tag };
+    if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return -1;
+    }
+    server->listen_fd = fd;
+    return ntohs(addr.sin_port);
+}
+
+static void
+conn_free(rtsp_server_t *server, rtsp_conn_t *conn)
+{
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        server->conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->rbuf);
+    free(conn->wbuf);
+    free(conn);
+}
+
+static void
+accept_conns(rtsp_server_t *server)
+{
+    for (;;) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+        rtsp_conn_t *conn = calloc(1, sizeof(rtsp_conn_t));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->server = server;
+        conn->fd = fd;
+        rtsp_parser_init(&conn->parser);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = server->conns;
+        if (server->conns) {
+            server->conns->prev = conn;
+        }
+        server->conns = conn;
+    }
+}
+
+/* Returns 0 when all queued output is written, 1 when the socket is full, -1 on error */
+static int
+conn_flush(rtsp_conn_t *conn)
+{
+    while (conn->woff < conn->wlen) {
+        ssize_t n = send(conn->fd, conn->wbuf + conn->woff, conn->wlen - conn->woff, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+        }
+        conn->woff += (int)n;
+    }
+    conn->woff = 0;
+    conn->wlen = 0;
+    return 0;
+}
+
+static void
+conn_update_events(rtsp_conn_t *conn, int want_write)
+{
+    if (conn->want_write == want_write) {
+        return;
+    }
+    struct epoll_event ev = {
+        .events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+        .data.ptr = conn
+    };
+    epoll_ctl(conn->server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->want_write = want_write;
+}
+
+int
+rtsp_conn_write(rtsp_conn_t *conn, const void *data, int len)
+{
+    if (len <= 0) {
+        return 0;
+    }
+    if (conn->wlen + len > conn->wcap) {
+        int cap = conn->wcap ? conn->wcap : RTSP_READ_CHUNK;
+        while (cap < conn->wlen + len) {
+            cap *= 2;
+        }
+        unsigned char *wbuf = realloc(conn->wbuf, cap);
+        if (!wbuf) {
+            return -1;
+        }
+        conn->wbuf = wbuf;
+        conn->wcap = cap;
+    }
+    memcpy(conn->wbuf + conn->wlen, data, len);
+    conn->wlen += len;
+    return 0;
+}
+
+/* snprintf that never runs past the buffer; *pos ends past cap on truncation */
+static void
+head_append(char *head, int cap, int *pos, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (*pos >= cap) {
+        return;
+    }
+    va_start(ap, fmt);
+    *pos += vsnprintf(head + *pos, cap - *pos, fmt, ap);
+    va_end(ap);
+}
+
+int
+rtsp_conn_respond(rtsp_conn_t *conn, const rtsp_request_t *req, int status, const char *reason,
+                  const char *content_type, const unsigned char *body, int body_len)
+{
+    char head[RTSP_MAX_RESPONSE_HEAD];
+    const rtsp_slice_t *cseq = req ? rtsp_request_header(req, "CSeq") : NULL;
+    int n = 0;
+
+    if (req && rtsp_slice_starts_with(req, &req->protocol, "HTTP/")) {
+        head_append(head, sizeof(head), &n, "%.*s %d %s\r\n", req->protocol.len,
+                    (const char *)req->buf + req->protocol.off, status, reason);
+    } else {
+        head_append(head, sizeof(head), &n, "RTSP/1.0 %d %s\r\n", status, reason);
+    }
+    head_append(head, sizeof(head), &n, "Server: AirTunes/220.68\r\n");
+    if (cseq) {
+        head_append(head, sizeof(head), &n, "CSeq: %.*s\r\n", cseq->len, (const char *)req->buf + cseq->off);
+    }
+    if (content_type && content_type[0]) {
+        head_append(head, sizeof(head), &n, "Content-Type: %s\r\n", content_type);
+    }
+    if (body_len > 0) {
+        head_append(head, sizeof(head), &n, "Content-Length: %d\r\n", body_len);
+    }
+    head_append(head, sizeof(head), &n, "Audio-Jack-Status: connected\r\n\r\n");
+    if (n >= (int)sizeof(head)) {
+        return -1;
+    }
+
+    if (rtsp_conn_write(conn, head, n) < 0 || rtsp_conn_write(conn, body, body_len) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void
+rtsp_conn_close(rtsp_conn_t *conn)
+{
+    conn->closing = 1;
+}
+
+void
+rtsp_conn_set_data(rtsp_conn_t *conn, void *data)
+{
+    conn->data = data;
+}
+
+void *
+rtsp_conn_get_data(rtsp_conn_t *conn)
+{
+    return conn->data;
+}
+
+int
+rtsp_conn_get_fd(rtsp_conn_t *conn)
+{
+    return conn->fd;
+}
+
+static int
+route_matches(const rtsp_route_t *route, const rtsp_request_t *req)
+{
+    if (route->method[0] && !rtsp_slice_equals(req, &req->method, route->method)) {
+        return 0;
+    }
+    if (!route->path[0] && !route->prefix) {
+        return 1;
+    }
+    return route->prefix ? rtsp_slice_starts_with(req, &req->path, route->path)
+                         : rtsp_slice_equals(req, &req->path, route->path);
+}
+
+static void
+dispatch(rtsp_server_t *server, rtsp_conn_t *conn, const rtsp_request_t *req)
+{
+    int i;
+
+    server->requests++;
+    for (i = 0; i < server->route_count; i++) {
+        if (route_matches(&server->routes[i], req)) {
+            server->routes[i].handler(conn, req, server->routes[i].opaque);
+            return;
+        }
+    }
+    rtsp_conn_respond(conn, req, 404, "Not Found", "text/plain", NULL, 0);
+}
+
+/* Queues the template reply; its pieces are small enough that copying them
+ * behind any pending output is cheaper than a send per keepalive */
+static int
+respond_keepalive(rtsp_conn_t *conn, const rtsp_keepalive_t *ka, const unsigned char *req)
+{
+    struct iovec iov[RTSP_KEEPALIVE_MAX_IOV];
+    int count = rtsp_keepalive_response(ka, req, iov);
+
+    for (int i = 0; i < count; i++) {
+        if (rtsp_conn_write(conn, iov[i].iov_base, (int)iov[i].iov_len) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Reads everything available and serves each complete request; -1 closes the connection */
+static int
+conn_read(rtsp_server_t *server, rtsp_conn_t *conn)
+{
+    int eof = 0;
+
+    while (!eof) {
+        if (conn->rcap - conn->rlen < RTSP_READ_CHUNK) {
+            int cap = conn->rcap ? conn->rcap * 2 : 2 * RTSP_READ_CHUNK;
+            if (cap > RTSP_MAX_CONN_BUFFER) {
+                return -1;
+            }
+            unsigned char *rbuf = realloc(conn->rbuf, cap);
+            if (!rbuf) {
+                return -1;
+            }
+            conn->rbuf = rbuf;
+            conn->rcap = cap;
+        }
+
+        ssize_t n = recv(conn->fd, conn->rbuf + conn->rlen, conn->rcap - conn->rlen, 0);
+        if (n == 0) {
+            /* Peer finished sending: answer what is buffered, then close */
+            eof = 1;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        conn->rlen += (int)n;
+    }
+
+    int consumed = 0;
+    while (consumed < conn->rlen && !conn->closing) {
+        rtsp_keepalive_t ka;
+        int n;
+        if (server->keepalive_fast_path &&
+            (n = rtsp_keepalive_match(conn->rbuf + consumed, conn->rlen - consumed, &ka)) > 0) {
+            /* The parser may have scanned part of this request on an earlier read */
+            rtsp_parser_init(&conn->parser);
+            if (respond_keepalive(conn, &ka, conn->rbuf + consumed) < 0) {
+                return -1;
+            }
+            server->requests++;
+            server->keepalives++;
+            consumed += n;
+            continue;
+        }
+        n = rtsp_parser_execute(&conn->parser, conn->rbuf + consumed, conn->rlen - consumed);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            rtsp_conn_respond(conn, NULL, 400, "Bad Request", "text/plain", NULL, 0);
+            rtsp_conn_close(conn);
+            break;
+        }
+        dispatch(server, conn, &conn->parser.req);
+        consumed += n;
+    }
+    if (consumed > 0) {
+        memmove(conn->rbuf, conn->rbuf + consumed, conn->rlen - consumed);
+        conn->rlen -= consumed;
+    }
+    if (eof) {
+        rtsp_conn_close(conn);
+    }
+    return 0;
+}
+
+int
+rtsp_server_run(rtsp_server_t *server)
+{
+    struct epoll_event events[RTSP_MAX_EVENTS];
+
+    if (server->listen_fd < 0) {
+        return -1;
+    }
+    server->running = 1;
+    while (server->running) {
+        int n = epoll_wait(server->epfd, events, RTSP_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &stop_tag) {
+                server->running = 0;
+                continue;
+            }
+            if (tag == &listen_tag) {
+                accept_conns(server);
+                continue;
+            }
+
+            rtsp_conn_t *conn = tag;
+            int failed = 0;
+            if (events[i].events & EPOLLIN) {
+                failed = conn_read(server, conn) < 0;
+            }
+            if (!failed && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                failed = 1;
+            }
+            if (!failed) {
+                int pending = conn_flush(conn);
+                failed = pending < 0 || (pending == 0 && conn->closing);
+                if (!failed) {
+                    conn_update_events(conn, pending == 1);
+                }
+            }
+            if (failed) {
+                conn_free(server, conn);
+            }
+        }
+    }
+    return 0;
+}
+
+void
+rtsp_server_stop(rtsp_server_t *server)
+{
+    uint64_t one = 1;
+    ssize_t ret = write(server->stop_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+unsigned long long
+rtsp_server_get_requests(rtsp_server_t *server)
+{
+    return server->requests;
+}
+
+unsigned long long
+rtsp_server_get_keepalives(rtsp_server_t *server)
+{
+    return server->keepalives;
+}
+
+void
+rtsp_server_destroy(rtsp_server_t *server)
+{
+    if (!server) {
+        return;
+    }
+    while (server->conns) {
+        conn_free(server, server->conns);
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+    }
+    if (server->stop_fd >= 0) {
+        close(server->stop_fd);
+    }
+    if (server->epfd >= 0) {
+        close(server->epfd);
+    }
+    free(server);
+}
@@ -0,0 +1,60 @@
+/**
+ * Native RTSP/HTTP control-plane server
+ *
+ * One epoll loop serves every control connection: reads are buffered per
+ * connection, requests are parsed in place (rtsp_request.h) and dispatched to
+ * handlers registered by method and path. Pipelined requests are answered in
+ * order; responses are queued and flushed without blocking the loop.
+ */
+
+#ifndef RTSP_SERVER_H
+#define RTSP_SERVER_H
+
+#include "logger.h"
+#include "rtsp_keepalive.h"
+#include "rtsp_request.h"
+
+typedef struct rtsp_server_s rtsp_server_t;
+typedef struct rtsp_conn_s rtsp_conn_t;
+
+typedef void (*rtsp_handler_t)(rtsp_conn_t *conn, const rtsp_request_t *req, void *opaque);
+
+rtsp_server_t *rtsp_server_init(logger_t *logger);
+
+/* method NULL matches any method, path NULL matches any path and a trailing '*'
+ * matches by prefix. Handlers are tried in registration order; unmatched
+ * requests get 404 like AirPlayServer. */
+int rtsp_server_add_handler(rtsp_server_t *server, const char *method, const char *path,
+                            rtsp_handler_t handler, void *opaque);
+
+/* With enable set, POST /feedback and GET_PARAMETER keepalives are answered
+ * from rtsp_keepalive.h templates ahead of the handlers (default off) */
+void rtsp_server_set_keepalive_fast_path(rtsp_server_t *server, int enable);
+
+/* Binds and listens on port (0 picks a free one); returns the bound port or -1 */
+int rtsp_server_listen(rtsp_server_t *server, unsigned short port);
+
+/* Runs the event loop on the calling thread until rtsp_server_stop() */
+int rtsp_server_run(rtsp_server_t *server);
+
+/* Safe to call from any thread */
+void rtsp_server_stop(rtsp_server_t *server);
+void rtsp_server_destroy(rtsp_server_t *server);
+
+/* Requests served, including keepalives answered by the fast path */
+unsigned long long rtsp_server_get_requests(rtsp_server_t *server);
+unsigned long long rtsp_server_get_keepalives(rtsp_server_t *server);
+
+/* Queues a full response echoing the request's protocol and CSeq */
+int rtsp_conn_respond(rtsp_conn_t *conn, const rtsp_request_t *req, int status, const char *reason,
+                      const char *content_type, const unsigned char *body, int body_len);
+/* Queues raw bytes */
+int rtsp_conn_write(rtsp_conn_t *conn, const void *data, int len);
+/* Closes the connection once queued output has been flushed */
+void rtsp_conn_close(rtsp_conn_t *conn);
+
+void rtsp_conn_set_data(rtsp_conn_t *conn, void *data);
+void *rtsp_conn_get_data(rtsp_conn_t *conn);
+int rtsp_conn_get_fd(rtsp_conn_t *conn);
+
+#endif // RTSP_SERVER_H
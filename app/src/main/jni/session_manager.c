@@ -0,0 +1,560 @@
+/**
+ * Multi-session receiver core
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "access_unit.h"
+#include "buffer_pool.h"
+#include "mirror_buffer.h"
+#include "mirror_framer.h"
+#include "session_manager.h"
+
+#define SESSION_POOL_CACHE_BYTES (8 * 1024 * 1024)
+#define SESSION_LISTEN_BACKLOG 4
+
+/* Counters have a single writer (the session's worker) and are read from any
+ * thread, so relaxed atomic stores are enough */
+#define STAT_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+typedef struct {
+    session_manager_t *manager;
+    stream_io_t *io;
+    pthread_t thread;
+    int index;
+    int sessions;                       /* guarded by the manager lock */
+} worker_t;
+
+struct airplay_session_s {
+    session_manager_t *manager;
+    worker_t *worker;
+    airplay_session_t *prev;
+    airplay_session_t *next;
+    int close_posted;                   /* guarded by the manager lock */
+
+    unsigned short port;
+    fairplay_t *fairplay;               /* control thread */
+
+    /* Worker thread only */
+    int listen_fd;
+    int conn_fd;
+    int refs;                           /* sockets still in the loop, plus a running close job */
+    int closing;
+    buffer_pool_t *pool;
+    mirror_framer_t framer;
+    mirror_buffer_t *mirror;
+    airplay_session_packet_cb_t callback;
+    void *opaque;
+    int timing;                         /* stage timing for the chunk being framed */
+    int64_t cpu_mark;                   /* thread CPU when the last chunk was done, 0 before the first */
+    int64_t nested_cpu_ns;              /* decrypt and callback time inside the current chunk */
+
+    airplay_session_stats_t stats;
+};
+
+struct session_manager_s {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    airplay_session_t *sessions;
+    int session_count;
+    int worker_count;
+    int stage_timing;
+    worker_t workers[SESSION_MANAGER_MAX_WORKERS];
+};
+
+typedef struct {
+    airplay_session_t *session;
+    mirror_buffer_t *mirror;
+} key_job_t;
+
+static int64_t
+thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *
+worker_main(void *arg)
+{
+    worker_t *worker = arg;
+    stream_io_serve(worker->io);
+    return NULL;
+}
+
+/* AVCC payload: 4-byte big-endian length before each NAL unit. Returns the unit count or -1 */
+static int
+count_nal_units(const unsigned char *data, int len)
+{
+    int count = 0;
+
+    while (len >= 4) {
+        uint32_t nal_len = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+                           (uint32_t)data[2] << 8 | (uint32_t)data[3];
+        if (nal_len == 0 || nal_len > (uint32_t)(len - 4)) {
+            return -1;
+        }
+        data += 4 + nal_len;
+        len -= 4 + (int)nal_len;
+        count++;
+    }
+    return len == 0 ? count : -1;
+}
+
+static int
+session_packet(void *opaque, const unsigned char *header, int type, unsigned char *payload, int len)
+{
+    airplay_session_t *session = opaque;
+    uint64_t ntp_timestamp = access_unit_header_timestamp(header);
+    int64_t start = 0, end;
+
+    STAT_ADD(session->stats.packets, 1);
+    STAT_ADD(session->stats.bytes, (unsigned long long)len);
+
+    if (type == MIRROR_TYPE_VIDEO) {
+        int units;
+
+        if (!session->mirror) {
+            STAT_ADD(session->stats.dropped_packets, 1);
+            return 0;
+        }
+        if (session->timing) {
+            start = thread_cpu_ns();
+        }
+        mirror_buffer_decrypt(session->mirror, payload, payload, len);
+        if (session->timing) {
+            end = thread_cpu_ns();
+            STAT_ADD(session->stats.decrypt_cpu_ns, (unsigned long long)(end - start));
+            session->nested_cpu_ns += end - start;
+        }
+        units = count_nal_units(payload, len);
+        if (units < 0) {
+            STAT_ADD(session->stats.dropped_packets, 1);
+            return 0;
+        }
+        STAT_ADD(session->stats.video_packets, 1);
+        STAT_ADD(session->stats.nal_units, (unsigned long long)units);
+    } else if (type == MIRROR_TYPE_CONFIG) {
+        STAT_ADD(session->stats.config_packets, 1);
+    } else {
+        return 0;   /* keepalives and sender reports */
+    }
+    if (session->callback) {
+        if (session->timing) {
+            start = thread_cpu_ns();
+        }
+        session->callback(session->opaque, type, payload, len, ntp_timestamp);
+        if (session->timing) {
+            end = thread_cpu_ns();
+            STAT_ADD(session->stats.consumer_cpu_ns, (unsigned long long)(end - start));
+            session->nested_cpu_ns += end - start;
+        }
+    }
+    return 0;
+}
+
+/* Manager lock held */
+static void
+unlink_session(session_manager_t *manager, airplay_session_t *session)
+{
+    if (session->prev) {
+        session->prev->next = session->next;
+    } else {
+        manager->sessions = session->next;
+    }
+    if (session->next) {
+        session->next->prev = session->prev;
+    }
+    session->worker->sessions--;
+    manager->session_count--;
+    pthread_cond_broadcast(&manager->cond);
+}
+
+/* Worker thread: drops a reference, freeing the session with the last one */
+static void
+session_release(airplay_session_t *session)
+{
+    session_manager_t *manager = session->manager;
+
+    if (--session->refs > 0 || !session->closing) {
+        return;
+    }
+    mirror_framer_reset(&session->framer);
+    mirror_buffer_destroy(session->mirror);
+    buffer_pool_destroy(session->pool);
+    fairplay_destroy(session->fairplay);
+
+    pthread_mutex_lock(&manager->lock);
+    unlink_session(manager, session);
+    pthread_mutex_unlock(&manager->lock);
+    free(session);
+}
+
+static int
+session_data(void *opaque, const unsigned char *data, int len)
+{
+    airplay_session_t *session = opaque;
+    int64_t start, end;
+    int ret;
+
+    session->timing = __atomic_load_n(&session->manager->stage_timing, __ATOMIC_RELAXED);
+    if (!session->timing) {
+        session->cpu_mark = 0;
+        return mirror_framer_feed(&session->framer, data, len);
+    }
+    start = thread_cpu_ns();
+    if (session->cpu_mark != 0) {
+        STAT_ADD(session->stats.receive_cpu_ns, (unsigned long long)(start - session->cpu_mark));
+    }
+    session->nested_cpu_ns = 0;
+    ret = mirror_framer_feed(&session->framer, data, len);
+    end = thread_cpu_ns();
+    STAT_ADD(session->stats.framing_cpu_ns, (unsigned long long)(end - start - session->nested_cpu_ns));
+    session->cpu_mark = end;
+    return ret;
+}
+
+static void
+session_conn_closed(void *opaque, int error)
+{
+    airplay_session_t *session = opaque;
+
+    (void)error;
+    session->conn_fd = -1;
+    mirror_framer_reset(&session->framer);
+    session_release(session);
+}
+
+static void
+session_accept(void *opaque, int fd)
+{
+    airplay_session_t *session = opaque;
+    stream_io_callbacks_t callbacks = { session_data, session_conn_closed };
+
+    if (session->closing || session->conn_fd >= 0) {
+        close(fd);
+        STAT_ADD(session->stats.rejected_connections, 1);
+        return;
+    }
+    if (stream_io_add(session->worker->io, fd, &callbacks, session) < 0) {
+        close(fd);
+        return;
+    }
+    session->conn_fd = fd;
+    session->refs++;
+    STAT_ADD(session->stats.connections, 1);
+}
+
+static void
+session_listener_closed(void *opaque, int error)
+{
+    airplay_session_t *session = opaque;
+
+    (void)error;
+    session->listen_fd = -1;
+    session_release(session);
+}
+
+static void
+session_attach_job(stream_io_t *io, void *arg)
+{
+    airplay_session_t *session = arg;
+
+    if (stream_io_add_listener(io, session->listen_fd, session_accept, session_listener_closed, session) < 0) {
+        close(session->listen_fd);
+        session->listen_fd = -1;
+        return;
+    }
+    session->refs++;
+}
+
+static void
+session_close_job(stream_io_t *io, void *arg)
+{
+    airplay_session_t *session = arg;
+
+    /* Held across the closes: on epoll their callbacks run inside stream_io_close */
+    session->refs++;
+    session->closing = 1;
+    if (session->conn_fd >= 0) {
+        stream_io_close(io, session->conn_fd);
+    }
+    if (session->listen_fd >= 0) {
+        stream_io_close(io, session->listen_fd);
+    }
+    session_release(session);
+}
+
+static void
+session_key_job(stream_io_t *io, void *arg)
+{
+    key_job_t *job = arg;
+    mirror_buffer_t *old = job->session->mirror;
+
+    (void)io;
+    job->session->mirror = job->mirror;
+    mirror_buffer_destroy(old);
+    free(job);
+}
+
+static int
+open_listener(unsigned short *port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;      /* kernel-assigned, so concurrent sessions never collide */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SESSION_LISTEN_BACKLOG) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+session_manager_t *
+session_manager_init(int workers, stream_io_backend_t backend)
+{
+    session_manager_t *manager;
+    int i;
+
+    if (workers < 1 || workers > SESSION_MANAGER_MAX_WORKERS) {
+        return NULL;
+    }
+    manager = calloc(1, sizeof(session_manager_t));
+    if (!manager) {
+        return NULL;
+    }
+    pthread_mutex_init(&manager->lock, NULL);
+    pthread_cond_init(&manager->cond, NULL);
+
+    for (i = 0; i < workers; i++) {
+        worker_t *worker = &manager->workers[i];
+
+        worker->manager = manager;
+        worker->index = i;
+        /* AUTO resolves once so every worker runs the same backend */
+        worker->io = stream_io_init(i == 0 ? backend : stream_io_get_backend(manager->workers[0].io), 0, 0);
+        if (!worker->io) {
+            break;
+        }
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            stream_io_destroy(worker->io);
+            worker->io = NULL;
+            break;
+        }
+        manager->worker_count++;
+    }
+    if (manager->worker_count < workers) {
+        session_manager_destroy(manager);
+        return NULL;
+    }
+    return manager;
+}
+
+void
+session_manager_destroy(session_manager_t *manager)
+{
+    airplay_session_t *session;
+    int i;
+
+    if (!manager) {
+        return;
+    }
+    pthread_mutex_lock(&manager->lock);
+    for (session = manager->sessions; session; session = session->next) {
+        if (!session->close_posted) {
+            session->close_posted = 1;
+            stream_io_post(session->worker->io, session_close_job, session);
+        }
+    }
+    while (manager->session_count > 0) {
+        pthread_cond_wait(&manager->cond, &manager->lock);
+    }
+    pthread_mutex_unlock(&manager->lock);
+
+    for (i = 0; i < manager->worker_count; i++) {
+        stream_io_stop(manager->workers[i].io);
+        pthread_join(manager->workers[i].thread, NULL);
+        stream_io_destroy(manager->workers[i].io);
+    }
+    pthread_cond_destroy(&manager->cond);
+    pthread_mutex_destroy(&manager->lock);
+    free(manager);
+}
+
+stream_io_backend_t
+session_manager_get_backend(session_manager_t *manager)
+{
+    return stream_io_get_backend(manager->workers[0].io);
+}
+
+void
+session_manager_set_stage_timing(session_manager_t *manager, int enabled)
+{
+    __atomic_store_n(&manager->stage_timing, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+int
+session_manager_get_session_count(session_manager_t *manager)
+{
+    int count;
+
+    pthread_mutex_lock(&manager->lock);
+    count = manager->session_count;
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+airplay_session_t *
+session_manager_open(session_manager_t *manager, airplay_session_packet_cb_t callback, void *opaque)
+{
+    airplay_session_t *session = calloc(1, sizeof(airplay_session_t));
+    worker_t *worker = NULL;
+    int i;
+
+    if (!session) {
+        return NULL;
+    }
+    session->manager = manager;
+    session->callback = callback;
+    session->opaque = opaque;
+    session->conn_fd = -1;
+    session->fairplay = fairplay_init(NULL);
+    session->pool = buffer_pool_init(SESSION_POOL_CACHE_BYTES);
+    session->listen_fd = open_listener(&session->port);
+    if (!session->fairplay || !session->pool || session->listen_fd < 0) {
+        goto fail;
+    }
+    mirror_framer_init(&session->framer, session->pool, session_packet, session);
+
+    pthread_mutex_lock(&manager->lock);
+    for (i = 0; i < manager->worker_count; i++) {
+        worker_t *candidate = &manager->workers[i];
+        if (candidate->sessions < SESSION_MANAGER_SESSIONS_PER_WORKER &&
+            (!worker || candidate->sessions < worker->sessions)) {
+            worker = candidate;
+        }
+    }
+    if (worker) {
+        worker->sessions++;
+        manager->session_count++;
+        session->worker = worker;
+        session->next = manager->sessions;
+        if (manager->sessions) {
+            manager->sessions->prev = session;
+        }
+        manager->sessions = session;
+    }
+    pthread_mutex_unlock(&manager->lock);
+    if (!worker) {
+        goto fail;
+    }
+
+    /* The listener is accepting already; the worker starts watching it when the job runs */
+    if (stream_io_post(worker->io, session_attach_job, session) < 0) {
+        pthread_mutex_lock(&manager->lock);
+        unlink_session(manager, session);
+        pthread_mutex_unlock(&manager->lock);
+        goto fail;
+    }
+    return session;
+
+fail:
+    if (session->listen_fd >= 0) {
+        close(session->listen_fd);
+    }
+    buffer_pool_destroy(session->pool);
+    fairplay_destroy(session->fairplay);
+    free(session);
+    return NULL;
+}
+
+void
+session_manager_close(session_manager_t *manager, airplay_session_t *session)
+{
+    int post;
+
+    pthread_mutex_lock(&manager->lock);
+    post = !session->close_posted;
+    session->close_posted = 1;
+    pthread_mutex_unlock(&manager->lock);
+    if (post) {
+        stream_io_post(session->worker->io, session_close_job, session);
+    }
+}
+
+unsigned short
+airplay_session_get_data_port(airplay_session_t *session)
+{
+    return session->port;
+}
+
+int
+airplay_session_get_worker(airplay_session_t *session)
+{
+    return session->worker->index;
+}
+
+fairplay_t *
+airplay_session_get_fairplay(airplay_session_t *session)
+{
+    return session->fairplay;
+}
+
+int
+airplay_session_set_mirror_key(airplay_session_t *session, const unsigned char aeskey[16],
+                               uint64_t stream_connection_id)
+{
+    key_job_t *job = malloc(sizeof(key_job_t));
+
+    if (!job) {
+        return -1;
+    }
+    job->session = session;
+    job->mirror = mirror_buffer_init(NULL, aeskey);
+    if (!job->mirror) {
+        free(job);
+        return -1;
+    }
+    mirror_buffer_init_aes(job->mirror, &stream_connection_id);
+    if (stream_io_post(session->worker->io, session_key_job, job) < 0) {
+        mirror_buffer_destroy(job->mirror);
+        free(job);
+        return -1;
+    }
+    return 0;
+}
+
+void
+airplay_session_get_stats(airplay_session_t *session, airplay_session_stats_t *stats)
+{
+    const unsigned long long *src = (const unsigned long long *)&session->stats;
+    unsigned long long *dst = (unsigned long long *)stats;
+    size_t i;
+
+    for (i = 0; i < sizeof(*stats) / sizeof(*dst); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
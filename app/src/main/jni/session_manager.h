@@ -0,0 +1,97 @@
+/**
+ * Multi-session receiver core
+ *
+ * Every connected sender gets an isolated session: its own FairPlay state, a
+ * mirror data port picked by the kernel, and the framer, payload pool,
+ * decryptor (mirror_buffer_t) and counters for its video stream. Nothing is
+ * shared between sessions, so one sender's fp-setup or stream cannot disturb
+ * another's.
+ *
+ * Sessions are spread over a fixed pool of worker threads, each running one
+ * stream_io loop that owns the data sockets of its sessions. A session's
+ * packets are framed, decrypted and parsed entirely on its worker; other
+ * threads only hand it work through stream_io_post. The manager lock is taken
+ * to open and close sessions, never per packet.
+ */
+
+#ifndef SESSION_MANAGER_H
+#define SESSION_MANAGER_H
+
+#include <stdint.h>
+
+#include "fairplay.h"
+#include "stream_io.h"
+
+#define SESSION_MANAGER_MAX_WORKERS 16
+/* A session holds a listener and one data connection in its worker's loop */
+#define SESSION_MANAGER_SESSIONS_PER_WORKER (STREAM_IO_MAX_CONNS / 2)
+
+#define MIRROR_TYPE_VIDEO 0x00          /* encrypted AVCC NAL units */
+#define MIRROR_TYPE_CONFIG 0x01         /* unencrypted avcC SPS/PPS */
+
+typedef struct session_manager_s session_manager_t;
+typedef struct airplay_session_s airplay_session_t;
+
+/* A decrypted mirror packet, on the session's worker thread. payload is only
+ * valid during the call and may be rewritten in place (it is the framer's
+ * pooled buffer); ntp_timestamp is the sender's header timestamp. */
+typedef void (*airplay_session_packet_cb_t)(void *opaque, int type, unsigned char *payload, int len,
+                                            uint64_t ntp_timestamp);
+
+typedef struct {
+    unsigned long long packets;
+    unsigned long long bytes;
+    unsigned long long video_packets;
+    unsigned long long config_packets;
+    unsigned long long nal_units;
+    unsigned long long connections;
+    unsigned long long rejected_connections;    /* a second data connection while one is open */
+    unsigned long long dropped_packets;         /* video before a key was installed, or bad NAL framing */
+
+    /* Worker thread CPU per stage, counted while stage timing is on */
+    unsigned long long receive_cpu_ns;          /* event loop and socket reads between deliveries
+                                                   (exact with one session per worker) */
+    unsigned long long framing_cpu_ns;
+    unsigned long long decrypt_cpu_ns;
+    unsigned long long consumer_cpu_ns;         /* the packet callback */
+} airplay_session_stats_t;
+
+/* workers threads (1..SESSION_MANAGER_MAX_WORKERS), each with its own loop. Returns NULL on failure. */
+session_manager_t *session_manager_init(int workers, stream_io_backend_t backend);
+
+/* Closes any sessions still open and joins the workers */
+void session_manager_destroy(session_manager_t *manager);
+
+stream_io_backend_t session_manager_get_backend(session_manager_t *manager);
+
+/* Count worker thread CPU per stage (airplay_session_stats_t *_cpu_ns). Off by
+ * default: it costs a few CLOCK_THREAD_CPUTIME_ID reads per packet. */
+void session_manager_set_stage_timing(session_manager_t *manager, int enabled);
+int session_manager_get_session_count(session_manager_t *manager);
+
+/* Opens a session listening on a free port, assigned to the least loaded
+ * worker. Returns NULL when every worker is full or the socket fails. */
+airplay_session_t *session_manager_open(session_manager_t *manager, airplay_session_packet_cb_t callback,
+                                        void *opaque);
+
+/* Stops the session's stream and frees it on its worker; the handle is invalid on return */
+void session_manager_close(session_manager_t *manager, airplay_session_t *session);
+
+unsigned short airplay_session_get_data_port(airplay_session_t *session);
+int airplay_session_get_worker(airplay_session_t *session);
+
+/* Per-session FairPlay state for fp-setup and ekey decryption; used from the
+ * session's control thread only */
+fairplay_t *airplay_session_get_fairplay(airplay_session_t *session);
+
+/* Installs the stream key from SETUP: the FairPlay-decrypted (and, with
+ * pairing, hashed) AES key and the stream's streamConnectionID. The key
+ * schedule is derived on the calling thread and swapped in on the worker.
+ * Returns 0 or -1. */
+int airplay_session_set_mirror_key(airplay_session_t *session, const unsigned char aeskey[16],
+                                   uint64_t stream_connection_id);
+
+/* Safe from any thread while the session is open */
+void airplay_session_get_stats(airplay_session_t *session, airplay_session_stats_t *stats);
+
+#endif // SESSION_MANAGER_H
@@ -0,0 +1,126 @@
+#include <jni.h>
+#include <android/log.h>
+#include "airplay_setup.h"
+
+#define LOG_TAG "SetupPlistJNI"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/* Layout of the long[] filled by nativeParse (must match SetupPlist.kt) */
+#define OUT_SPANS 0             /* 8 x (offset, length, utf16) */
+#define OUT_TIMING_PORT 24
+#define OUT_SCREEN_MIRRORING 25
+#define OUT_STREAM_COUNT 26
+#define OUT_STREAMS 27          /* per stream: type, has id, id, control port */
+#define OUT_LEN (OUT_STREAMS + 4 * AIRPLAY_SETUP_MAX_STREAMS)
+
+static void
+put_span(jlong *out, int idx, const airplay_setup_span_t *span)
+{
+    out[OUT_SPANS + 3 * idx] = span->off;
+    out[OUT_SPANS + 3 * idx + 1] = span->len;
+    out[OUT_SPANS + 3 * idx + 2] = span->utf16;
+}
+
+/**
+ * Extract the SETUP / POST /stream fields from a bplist body in one pass
+ * Input: body = binary plist request body
+ * Output: 0 with out[] filled (spans index into body, offset -1 when absent), -1 if not a bplist dictionary
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_SetupPlist_nativeParse(JNIEnv *env, jobject thiz, jbyteArray body, jlongArray out) {
+    airplay_setup_t setup;
+    jlong fields[OUT_LEN];
+    int i;
+
+    if ((*env)->GetArrayLength(env, out) < OUT_LEN) {
+        LOGE("Output array too short: need %d longs", OUT_LEN);
+        return -1;
+    }
+
+    jsize len = (*env)->GetArrayLength(env, body);
+    jbyte *bytes = (*env)->GetPrimitiveArrayCritical(env, body, NULL);
+    if (bytes == NULL) {
+        return -1;
+    }
+    int ret = airplay_setup_parse(&setup, (const unsigned char *)bytes, len);
+    (*env)->ReleasePrimitiveArrayCritical(env, body, bytes, JNI_ABORT);
+    if (ret < 0) {
+        return -1;
+    }
+
+    put_span(fields, 0, &setup.ekey);
+    put_span(fields, 1, &setup.eiv);
+    put_span(fields, 2, &setup.device_id);
+    put_span(fields, 3, &setup.model);
+    put_span(fields, 4, &setup.name);
+    put_span(fields, 5, &setup.session_uuid);
+    put_span(fields, 6, &setup.os_name);
+    put_span(fields, 7, &setup.os_version);
+    fields[OUT_TIMING_PORT] = setup.timing_port;
+    fields[OUT_SCREEN_MIRRORING] = setup.is_screen_mirroring;
+    fields[OUT_STREAM_COUNT] = setup.stream_count;
+    for (i = 0; i < setup.stream_count; i++) {
+        jlong *s = &fields[OUT_STREAMS + 4 * i];
+        s[0] = setup.streams[i].type;
+        s[1] = setup.streams[i].has_stream_connection_id;
+        s[2] = setup.streams[i].stream_connection_id;
+        s[3] = setup.streams[i].control_port;
+    }
+    (*env)->SetLongArrayRegion(env, out, 0, OUT_STREAMS + 4 * setup.stream_count, fields);
+    return 0;
+}
+
+/**
+ * Serialize the first-SETUP reply { eventPort, timingPort }
+ * Output: body length written into out, -1 if out is too small
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_SetupPlist_nativeWriteSessionReply(JNIEnv *env, jobject thiz,
+                                                                      jint event_port, jint timing_port,
+                                                                      jbyteArray out) {
+    unsigned char buf[128];
+    int len = airplay_setup_write_session_reply(buf, sizeof(buf), event_port, timing_port);
+
+    if (len < 0 || len > (*env)->GetArrayLength(env, out)) {
+        LOGE("Failed to write session reply");
+        return -1;
+    }
+    (*env)->SetByteArrayRegion(env, out, 0, len, (const jbyte *)buf);
+    return len;
+}
+
+/**
+ * Serialize a stream SETUP reply { streams: [...] }
+ * Input: replies = 4 ints per stream (type, dataPort, controlPort, serverPort; 0 = omitted)
+ * Output: body length written into out, -1 on error
+ */
+JNIEXPORT jint JNICALL
+Java_com_pentagram_airplay_service_SetupPlist_nativeWriteStreamsReply(JNIEnv *env, jobject thiz,
+                                                                      jintArray replies, jint count,
+                                                                      jbyteArray out) {
+    airplay_stream_reply_t streams[AIRPLAY_SETUP_MAX_STREAMS];
+    jint values[4 * AIRPLAY_SETUP_MAX_STREAMS];
+    unsigned char buf[256];
+    int i;
+
+    if (count < 0 || count > AIRPLAY_SETUP_MAX_STREAMS || (*env)->GetArrayLength(env, replies) < 4 * count) {
+        LOGE("Invalid stream reply count: %d", count);
+        return -1;
+    }
+    (*env)->GetIntArrayRegion(env, replies, 0, 4 * count, values);
+    for (i = 0; i < count; i++) {
+        streams[i].type = values[4 * i];
+        streams[i].data_port = values[4 * i + 1];
+        streams[i].control_port = values[4 * i + 2];
+        streams[i].server_port = values[4 * i + 3];
+    }
+
+    int len = airplay_setup_write_streams_reply(buf, sizeof(buf), streams, count);
+    if (len < 0 || len > (*env)->GetArrayLength(env, out)) {
+        LOGE("Failed to write streams reply");
+        return -1;
+    }
+    (*env)->SetByteArrayRegion(env, out, 0, len, (const jbyte *)buf);
+    return len;
+}
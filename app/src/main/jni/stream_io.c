@@ -0,0 +1,919 @@
+/**
+ * Pluggable receive backend for the mirror and control stream sockets
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "stream_io.h"
+
+/* Multishot recv (and the provided-buffer ring it selects from) need 6.0 uapi headers */
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define STREAM_IO_HAVE_URING 1
+#endif
+
+#define STREAM_IO_MAX_EVENTS 64
+#define URING_ENTRIES 128
+#define URING_BUFFER_GROUP 0
+#define URING_STOP_TAG UINT64_MAX
+#define URING_CANCEL_TAG (UINT64_MAX - 1)
+
+typedef struct {
+    int fd;                             /* -1 when the slot is free */
+    int listener;
+    int armed;                          /* io_uring: a recv/accept request is in flight */
+    int closing;                        /* io_uring: cancel submitted, waiting for the final completion */
+    int error;
+    int got_data;
+    stream_io_callbacks_t callbacks;
+    stream_io_accept_cb_t accept_cb;
+    void *opaque;
+} stream_conn_t;
+
+typedef struct stream_job_s {
+    stream_io_job_t job;
+    void *arg;
+    struct stream_job_s *next;
+} stream_job_t;
+
+#ifdef STREAM_IO_HAVE_URING
+typedef struct {
+    int fd;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_len;
+    unsigned buf_mask;
+    unsigned short buf_tail;
+    int multishot;                      /* cleared if the kernel rejects IORING_RECV_MULTISHOT */
+    int multishot_accept;               /* cleared if the kernel rejects IORING_ACCEPT_MULTISHOT */
+} uring_t;
+#endif
+
+struct stream_io_s {
+    stream_io_backend_t backend;
+    int stop_fd;                        /* eventfd: wakes the loop for stop and posted jobs */
+    volatile int running;
+    volatile int stop_requested;
+    int persistent;                     /* stream_io_serve: keep running with no connections */
+    int buffer_size;
+    int buffer_count;
+    unsigned char *buffers;             /* epoll: one read buffer; io_uring: buffer_count ring buffers */
+
+    stream_conn_t conns[STREAM_IO_MAX_CONNS];
+    int conn_count;
+
+    pthread_mutex_t jobs_lock;
+    stream_job_t *jobs_head;
+    stream_job_t *jobs_tail;
+
+    int epfd;
+#ifdef STREAM_IO_HAVE_URING
+    uring_t ring;
+#endif
+    stream_io_stats_t stats;
+};
+
+static void
+finish_conn(stream_io_t *io, stream_conn_t *conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+    conn->closing = 0;
+    io->conn_count--;
+    if (conn->callbacks.closed) {
+        conn->callbacks.closed(conn->opaque, conn->error);
+    }
+}
+
+static stream_conn_t *
+alloc_conn(stream_io_t *io, int fd, const stream_io_callbacks_t *callbacks, void *opaque)
+{
+    int i;
+
+    for (i = 0; i < STREAM_IO_MAX_CONNS; i++) {
+        stream_conn_t *conn = &io->conns[i];
+        if (conn->fd < 0) {
+            memset(conn, 0, sizeof(*conn));
+            conn->fd = fd;
+            conn->callbacks = *callbacks;
+            conn->opaque = opaque;
+            io->conn_count++;
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+/* Stop or posted jobs: clears the eventfd and runs whatever was queued, in order */
+static void
+handle_wake(stream_io_t *io)
+{
+    uint64_t count;
+    stream_job_t *job;
+
+    if (read(io->stop_fd, &count, sizeof(count)) < 0) {
+        /* already cleared by an earlier wake */
+    }
+    pthread_mutex_lock(&io->jobs_lock);
+    job = io->jobs_head;
+    io->jobs_head = NULL;
+    io->jobs_tail = NULL;
+    pthread_mutex_unlock(&io->jobs_lock);
+
+    while (job) {
+        stream_job_t *next = job->next;
+        job->job(io, job->arg);
+        free(job);
+        job = next;
+    }
+    if (io->stop_requested) {
+        io->stop_requested = 0;
+        io->running = 0;
+    }
+}
+
+static stream_conn_t *
+find_conn(stream_io_t *io, int fd)
+{
+    int i;
+
+    for (i = 0; i < STREAM_IO_MAX_CONNS; i++) {
+        if (io->conns[i].fd == fd && fd >= 0) {
+            return &io->conns[i];
+        }
+    }
+    return NULL;
+}
+
+/* ---- epoll ---- */
+
+static int
+epoll_setup(stream_io_t *io)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = STREAM_IO_MAX_CONNS };
+
+    io->epfd = epoll_create1(EPOLL_CLOEXEC);
+    io->buffers = malloc((size_t)io->buffer_size);
+    if (io->epfd < 0 || !io->buffers || epoll_ctl(io->epfd, EPOLL_CTL_ADD, io->stop_fd, &ev) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+epoll_add(stream_io_t *io, stream_conn_t *conn)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)(conn - io->conns) };
+    int flags = fcntl(conn->fd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+    return epoll_ctl(io->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+}
+
+static void
+epoll_read(stream_io_t *io, stream_conn_t *conn)
+{
+    int fd = conn->fd;
+
+    for (;;) {
+        ssize_t n = recv(conn->fd, io->buffers, (size_t)io->buffer_size, 0);
+        io->stats.syscalls++;
+        if (n > 0) {
+            int ret;
+
+            io->stats.bytes += (unsigned long long)n;
+            io->stats.reads++;
+            ret = conn->callbacks.data(conn->opaque, io->buffers, (int)n);
+            if (conn->fd != fd) {
+                return;     /* the callback closed it (stream_io_close) */
+            }
+            if (ret < 0) {
+                break;
+            }
+            if (n < io->buffer_size) {
+                return;     /* drained; a full buffer means more is likely queued */
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        conn->error = n < 0 ? -errno : 0;
+        break;
+    }
+    epoll_ctl(io->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    finish_conn(io, conn);
+}
+
+static void
+epoll_accept(stream_io_t *io, stream_conn_t *conn)
+{
+    int listen_fd = conn->fd;
+
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        io->stats.syscalls++;
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;     /* EAGAIN, or out of descriptors: retried on the next readiness event */
+        }
+        conn->accept_cb(conn->opaque, fd);
+        if (conn->fd != listen_fd || !conn->listener) {
+            return;     /* the callback closed the listener */
+        }
+    }
+}
+
+static int
+epoll_run(stream_io_t *io)
+{
+    struct epoll_event events[STREAM_IO_MAX_EVENTS];
+
+    while (io->running && (io->persistent || io->conn_count > 0)) {
+        int n = epoll_wait(io->epfd, events, STREAM_IO_MAX_EVENTS, -1);
+        int i;
+
+        io->stats.syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            uint32_t id = events[i].data.u32;
+            if (id == STREAM_IO_MAX_CONNS) {
+                handle_wake(io);
+                if (!io->running) {
+                    break;
+                }
+                continue;
+            }
+            if (io->conns[id].fd < 0) {
+                continue;
+            }
+            if (io->conns[id].listener) {
+                epoll_accept(io, &io->conns[id]);
+            } else {
+                epoll_read(io, &io->conns[id]);
+            }
+        }
+    }
+    return 0;
+}
+
+/* ---- io_uring ---- */
+
+#ifdef STREAM_IO_HAVE_URING
+
+static int
+uring_enter(uring_t *ring, unsigned to_submit, unsigned min_complete)
+{
+    return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                        min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/* Next free SQE, zeroed; flushes queued entries first if the ring is full */
+static struct io_uring_sqe *
+uring_get_sqe(stream_io_t *io)
+{
+    uring_t *ring = &io->ring;
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    if (tail - head >= ring->sq_entries) {
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        uring_enter(ring, ring->to_submit, 0);
+        io->stats.syscalls++;
+        ring->to_submit = 0;
+    }
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->to_submit++;
+    return sqe;
+}
+
+static void
+uring_flush(uring_t *ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->to_submit, __ATOMIC_RELEASE);
+}
+
+static void
+uring_recycle_buffer(stream_io_t *io, unsigned short bid)
+{
+    uring_t *ring = &io->ring;
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & ring->buf_mask];
+
+    buf->addr = (uint64_t)(uintptr_t)(io->buffers + (size_t)bid * io->buffer_size);
+    buf->len = (uint32_t)io->buffer_size;
+    buf->bid = bid;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void
+uring_arm_recv(stream_io_t *io, stream_conn_t *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(io);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = io->ring.multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uint64_t)(conn - io->conns) + 1;
+    conn->armed = 1;
+    io->stats.rearms++;
+}
+
+static void
+uring_arm_accept(stream_io_t *io, stream_conn_t *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(io);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = conn->fd;
+    sqe->ioprio = io->ring.multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)(conn - io->conns) + 1;
+    conn->armed = 1;
+}
+
+/* With no request in flight (called from inside its final completion) the
+ * completion handler finishes the connection itself */
+static void
+uring_cancel(stream_io_t *io, stream_conn_t *conn)
+{
+    struct io_uring_sqe *sqe;
+
+    conn->closing = 1;
+    if (!conn->armed) {
+        return;
+    }
+    sqe = uring_get_sqe(io);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(conn - io->conns) + 1;
+    sqe->user_data = URING_CANCEL_TAG;
+}
+
+static void
+uring_arm_stop(stream_io_t *io)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(io);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = io->stop_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_STOP_TAG;
+}
+
+static void
+uring_teardown(stream_io_t *io)
+{
+    uring_t *ring = &io->ring;
+
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->buf_ring) {
+        munmap(ring->buf_ring, ring->buf_ring_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static int
+uring_setup(stream_io_t *io)
+{
+    uring_t *ring = &io->ring;
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    int i;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return -1;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+    ring->sq_head = (unsigned *)((char *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned *)((char *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+
+    /* Provided-buffer ring: the kernel picks a buffer per completion from one registered slab */
+    ring->buf_ring_len = (size_t)io->buffer_count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = (uint32_t)io->buffer_count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        goto fail;
+    }
+    io->buffers = malloc((size_t)io->buffer_size * io->buffer_count);
+    if (!io->buffers) {
+        goto fail;
+    }
+    ring->buf_mask = (unsigned)io->buffer_count - 1;
+    for (i = 0; i < io->buffer_count; i++) {
+        uring_recycle_buffer(io, (unsigned short)i);
+    }
+    ring->multishot = 1;
+    ring->multishot_accept = 1;
+
+    uring_arm_stop(io);
+    return 0;
+
+fail:
+    uring_teardown(io);
+    return -1;
+}
+
+static void
+uring_complete_accept(stream_io_t *io, stream_conn_t *conn, const struct io_uring_cqe *cqe, int more)
+{
+    if (cqe->res >= 0) {
+        if (conn->closing) {
+            close(cqe->res);
+        } else {
+            conn->got_data = 1;
+            conn->accept_cb(conn->opaque, cqe->res);
+        }
+    }
+    if (more) {
+        return;
+    }
+
+    if (conn->closing) {
+        finish_conn(io, conn);
+    } else if (cqe->res >= 0 || cqe->res == -ECONNABORTED || cqe->res == -EINTR) {
+        uring_arm_accept(io, conn);
+    } else if (cqe->res == -EINVAL && io->ring.multishot_accept && !conn->got_data) {
+        /* Kernel predates multishot accept */
+        io->ring.multishot_accept = 0;
+        uring_arm_accept(io, conn);
+    } else {
+        conn->error = cqe->res;
+        finish_conn(io, conn);
+    }
+}
+
+static void
+uring_complete(stream_io_t *io, const struct io_uring_cqe *cqe)
+{
+    stream_conn_t *conn;
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    if (cqe->user_data == URING_STOP_TAG) {
+        handle_wake(io);
+        uring_arm_stop(io);
+        return;
+    }
+    if (cqe->user_data == URING_CANCEL_TAG) {
+        return;
+    }
+    conn = &io->conns[cqe->user_data - 1];
+    if (!more) {
+        conn->armed = 0;
+    }
+
+    if (conn->listener) {
+        uring_complete_accept(io, conn, cqe, more);
+        return;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!conn->closing) {
+            io->stats.bytes += (unsigned long long)cqe->res;
+            io->stats.reads++;
+            conn->got_data = 1;
+            if (conn->callbacks.data(conn->opaque, io->buffers + (size_t)bid * io->buffer_size, cqe->res) < 0) {
+                uring_cancel(io, conn);
+            }
+        }
+        uring_recycle_buffer(io, bid);
+    }
+    if (more) {
+        return;
+    }
+
+    /* The request finished: re-arm it, or close the connection */
+    if (conn->closing) {
+        finish_conn(io, conn);
+    } else if (cqe->res > 0) {
+        uring_arm_recv(io, conn);
+    } else if (cqe->res == -ENOBUFS) {
+        io->stats.buffer_stalls++;
+        uring_arm_recv(io, conn);
+    } else if (cqe->res == -EINVAL && io->ring.multishot && !conn->got_data) {
+        /* Kernel predates multishot recv: one completion per submitted recv from here on */
+        io->ring.multishot = 0;
+        uring_arm_recv(io, conn);
+    } else {
+        conn->error = cqe->res;
+        finish_conn(io, conn);
+    }
+}
+
+/* Cancels every armed recv and waits for the final completions, so the kernel is done with the buffers */
+static void
+uring_drain(stream_io_t *io)
+{
+    uring_t *ring = &io->ring;
+    int i;
+
+    for (i = 0; i < STREAM_IO_MAX_CONNS; i++) {
+        stream_conn_t *conn = &io->conns[i];
+        if (conn->fd >= 0) {
+            conn->callbacks.closed = NULL;
+            if (!conn->closing) {
+                uring_cancel(io, conn);
+            }
+        }
+    }
+    while (io->conn_count > 0) {
+        unsigned head;
+        unsigned tail;
+        unsigned submit = ring->to_submit;
+
+        uring_flush(ring);
+        ring->to_submit = 0;
+        if (uring_enter(ring, submit, 1) < 0 && errno != EINTR) {
+            break;
+        }
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->user_data != URING_STOP_TAG) {
+                uring_complete(io, cqe);
+            }
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static int
+uring_run(stream_io_t *io)
+{
+    uring_t *ring = &io->ring;
+
+    while (io->running && (io->persistent || io->conn_count > 0)) {
+        unsigned head;
+        unsigned tail;
+        unsigned submit = ring->to_submit;
+        int ret;
+
+        uring_flush(ring);
+        ring->to_submit = 0;
+        ret = uring_enter(ring, submit, 1);
+        io->stats.syscalls++;
+        if (ret < 0 && errno != EINTR && errno != EBUSY) {
+            return -1;
+        }
+
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            uring_complete(io, &ring->cqes[head & *ring->cq_mask]);
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+#endif // STREAM_IO_HAVE_URING
+
+/* ---- common ---- */
+
+stream_io_t *
+stream_io_init(stream_io_backend_t backend, int buffer_size, int buffer_count)
+{
+    stream_io_t *io = calloc(1, sizeof(stream_io_t));
+    int count = 1;
+    int i;
+
+    if (!io) {
+        return NULL;
+    }
+    /* The provided-buffer ring needs a power-of-two entry count */
+    while (count < (buffer_count > 0 ? buffer_count : STREAM_IO_DEFAULT_BUFFER_COUNT) && count < 32768) {
+        count <<= 1;
+    }
+    io->buffer_size = buffer_size > 0 ? buffer_size : STREAM_IO_DEFAULT_BUFFER_SIZE;
+    io->buffer_count = count;
+    io->epfd = -1;
+    for (i = 0; i < STREAM_IO_MAX_CONNS; i++) {
+        io->conns[i].fd = -1;
+    }
+    io->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (io->stop_fd < 0) {
+        free(io);
+        return NULL;
+    }
+    pthread_mutex_init(&io->jobs_lock, NULL);
+
+#ifdef STREAM_IO_HAVE_URING
+    io->ring.fd = -1;
+    if (backend != STREAM_IO_EPOLL && uring_setup(io) == 0) {
+        io->backend = STREAM_IO_URING;
+        return io;
+    }
+#endif
+    if (backend == STREAM_IO_URING || epoll_setup(io) < 0) {
+        stream_io_destroy(io);
+        return NULL;
+    }
+    io->backend = STREAM_IO_EPOLL;
+    return io;
+}
+
+void
+stream_io_destroy(stream_io_t *io)
+{
+    int i;
+
+    if (!io) {
+        return;
+    }
+#ifdef STREAM_IO_HAVE_URING
+    if (io->backend == STREAM_IO_URING) {
+        uring_drain(io);
+    }
+    uring_teardown(io);
+#endif
+    for (i = 0; i < STREAM_IO_MAX_CONNS; i++) {
+        if (io->conns[i].fd >= 0) {
+            close(io->conns[i].fd);
+        }
+    }
+    if (io->epfd >= 0) {
+        close(io->epfd);
+    }
+    close(io->stop_fd);
+    /* Jobs posted after the loop stopped are dropped */
+    while (io->jobs_head) {
+        stream_job_t *next = io->jobs_head->next;
+        free(io->jobs_head);
+        io->jobs_head = next;
+    }
+    pthread_mutex_destroy(&io->jobs_lock);
+    free(io->buffers);
+    free(io);
+}
+
+stream_io_backend_t
+stream_io_get_backend(stream_io_t *io)
+{
+    return io->backend;
+}
+
+const char *
+stream_io_backend_name(stream_io_backend_t backend)
+{
+    switch (backend) {
+    case STREAM_IO_EPOLL:
+        return "epoll";
+    case STREAM_IO_URING:
+        return "io_uring";
+    default:
+        return "auto";
+    }
+}
+
+int
+stream_io_add(stream_io_t *io, int fd, const stream_io_callbacks_t *callbacks, void *opaque)
+{
+    stream_conn_t *conn = alloc_conn(io, fd, callbacks, opaque);
+
+    if (!conn) {
+        return -1;
+    }
+#ifdef STREAM_IO_HAVE_URING
+    if (io->backend == STREAM_IO_URING) {
+        uring_arm_recv(io, conn);
+        return 0;
+    }
+#endif
+    if (epoll_add(io, conn) < 0) {
+        conn->fd = -1;
+        io->conn_count--;
+        return -1;
+    }
+    return 0;
+}
+
+int
+stream_io_add_listener(stream_io_t *io, int fd, stream_io_accept_cb_t accept_cb,
+                       void (*closed)(void *opaque, int error), void *opaque)
+{
+    stream_io_callbacks_t callbacks = { NULL, closed };
+    stream_conn_t *conn = alloc_conn(io, fd, &callbacks, opaque);
+
+    if (!conn) {
+        return -1;
+    }
+    conn->listener = 1;
+    conn->accept_cb = accept_cb;
+#ifdef STREAM_IO_HAVE_URING
+    if (io->backend == STREAM_IO_URING) {
+        uring_arm_accept(io, conn);
+        return 0;
+    }
+#endif
+    if (epoll_add(io, conn) < 0) {
+        conn->fd = -1;
+        io->conn_count--;
+        return -1;
+    }
+    return 0;
+}
+
+int
+stream_io_close(stream_io_t *io, int fd)
+{
+    stream_conn_t *conn = find_conn(io, fd);
+
+    if (!conn) {
+        return -1;
+    }
+#ifdef STREAM_IO_HAVE_URING
+    if (io->backend == STREAM_IO_URING) {
+        if (!conn->closing) {
+            uring_cancel(io, conn);
+        }
+        return 0;
+    }
+#endif
+    epoll_ctl(io->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    finish_conn(io, conn);
+    return 0;
+}
+
+int
+stream_io_post(stream_io_t *io, stream_io_job_t job, void *arg)
+{
+    stream_job_t *node = malloc(sizeof(stream_job_t));
+    uint64_t one = 1;
+
+    if (!node) {
+        return -1;
+    }
+    node->job = job;
+    node->arg = arg;
+    node->next = NULL;
+    pthread_mutex_lock(&io->jobs_lock);
+    if (io->jobs_tail) {
+        io->jobs_tail->next = node;
+    } else {
+        io->jobs_head = node;
+    }
+    io->jobs_tail = node;
+    pthread_mutex_unlock(&io->jobs_lock);
+
+    if (write(io->stop_fd, &one, sizeof(one)) < 0) {
+        /* counter already non-zero: the loop is waking anyway */
+    }
+    return 0;
+}
+
+int
+stream_io_serve(stream_io_t *io)
+{
+    int ret;
+
+    io->persistent = 1;
+    ret = stream_io_run(io);
+    io->persistent = 0;
+    return ret;
+}
+
+int
+stream_io_run(stream_io_t *io)
+{
+    io->running = 1;
+#ifdef STREAM_IO_HAVE_URING
+    if (io->backend == STREAM_IO_URING) {
+        return uring_run(io);
+    }
+#endif
+    return epoll_run(io);
+}
+
+void
+stream_io_stop(stream_io_t *io)
+{
+    uint64_t one = 1;
+    io->stop_requested = 1;
+    io->running = 0;
+    if (write(io->stop_fd, &one, sizeof(one)) < 0) {
+        /* counter already non-zero: the loop is waking anyway */
+    }
+}
+
+void
+stream_io_get_stats(stream_io_t *io, stream_io_stats_t *stats)
+{
+    memcpy(stats, &io->stats, sizeof(*stats));
+}
@@ -0,0 +1,95 @@
+/**
+ * Pluggable receive backend for the mirror and control stream sockets
+ *
+ * One event loop owns a set of connected stream sockets and delivers their
+ * bytes to per-connection callbacks, so the decrypt / NAL pipeline runs
+ * directly off completion events instead of a blocking read per thread.
+ *
+ * Backends:
+ *  - io_uring: multishot recv selecting from a registered provided-buffer
+ *    ring, so one armed request keeps completing with no syscall per read
+ *    and no buffer handoff. Falls back to re-armed single-shot recv on
+ *    kernels without multishot recv.
+ *  - epoll: level-triggered readiness plus recv() into a loop-owned buffer.
+ *
+ * STREAM_IO_AUTO picks io_uring when the kernel allows it (it is commonly
+ * blocked by seccomp, including for Android apps) and epoll otherwise.
+ *
+ * A loop can also own listening sockets (multishot accept on io_uring) and
+ * run jobs posted from other threads, so a worker thread can own everything
+ * about a session without locks on its data path.
+ */
+
+#ifndef STREAM_IO_H
+#define STREAM_IO_H
+
+#define STREAM_IO_MAX_CONNS 64
+#define STREAM_IO_DEFAULT_BUFFER_SIZE (64 * 1024)
+#define STREAM_IO_DEFAULT_BUFFER_COUNT 64
+
+typedef enum {
+    STREAM_IO_AUTO = 0,
+    STREAM_IO_EPOLL,
+    STREAM_IO_URING
+} stream_io_backend_t;
+
+typedef struct stream_io_s stream_io_t;
+
+typedef struct {
+    /* Received bytes in order; data is only valid during the call. Return -1 to close. */
+    int (*data)(void *opaque, const unsigned char *data, int len);
+    /* Connection ended (error 0 on EOF or a -1 from data, else the negative errno); the fd is closed */
+    void (*closed)(void *opaque, int error);
+} stream_io_callbacks_t;
+
+/* New connection on a listener (stream_io_add_listener); the callee owns fd */
+typedef void (*stream_io_accept_cb_t)(void *opaque, int fd);
+
+/* Job run on the loop thread (stream_io_post) */
+typedef void (*stream_io_job_t)(stream_io_t *io, void *arg);
+
+typedef struct {
+    unsigned long long bytes;
+    unsigned long long reads;           /* data deliveries (recv completions / recv calls) */
+    unsigned long long syscalls;        /* io_uring_enter or epoll_wait + recv */
+    unsigned long long rearms;          /* io_uring: recv requests (re)submitted */
+    unsigned long long buffer_stalls;   /* io_uring: provided-buffer ring ran dry (ENOBUFS) */
+} stream_io_stats_t;
+
+/* buffer_size/buffer_count size the receive buffers (0 = defaults). Returns
+ * NULL if the requested backend is unavailable. */
+stream_io_t *stream_io_init(stream_io_backend_t backend, int buffer_size, int buffer_count);
+void stream_io_destroy(stream_io_t *io);
+
+stream_io_backend_t stream_io_get_backend(stream_io_t *io);
+const char *stream_io_backend_name(stream_io_backend_t backend);
+
+/* Takes ownership of a connected stream socket. Call before stream_io_run or
+ * from a callback on the loop thread. Returns 0 or -1. */
+int stream_io_add(stream_io_t *io, int fd, const stream_io_callbacks_t *callbacks, void *opaque);
+
+/* Takes ownership of a listening socket; accepted fds go to accept_cb on the
+ * loop thread. closed(opaque, error) fires when the listener is closed. Same
+ * threading rules as stream_io_add. */
+int stream_io_add_listener(stream_io_t *io, int fd, stream_io_accept_cb_t accept_cb,
+                           void (*closed)(void *opaque, int error), void *opaque);
+
+/* Closes a connection or listener added to this loop; its closed callback
+ * fires (possibly later, once in-flight receives are cancelled). Loop thread only. */
+int stream_io_close(stream_io_t *io, int fd);
+
+/* Runs job(io, arg) on the loop thread; safe to call from any thread. Returns 0 or -1. */
+int stream_io_post(stream_io_t *io, stream_io_job_t job, void *arg);
+
+/* Runs the loop on the calling thread until stream_io_stop() or until the last connection closes */
+int stream_io_run(stream_io_t *io);
+
+/* Like stream_io_run, but keeps running with no connections (worker loops) */
+int stream_io_serve(stream_io_t *io);
+
+/* Safe to call from any thread */
+void stream_io_stop(stream_io_t *io);
+
+void stream_io_get_stats(stream_io_t *io, stream_io_stats_t *stats);
+
+#endif // STREAM_IO_H
@@ -0,0 +1,179 @@
+package com.pentagram.airplay.service
+
+import org.junit.Test
+import org.junit.Assert.*
+import java.io.ByteArrayOutputStream
+import java.io.OutputStream
+import java.lang.management.ManagementFactory
+
+/**
+ * Unit tests for RtspResponseWriter
+ * Responses must be byte-identical to the string-built ones AirPlayServer used to send,
+ * and each must reach the socket stream in a single write. testCostVsLegacy measures
+ * both paths' per-response allocations and time.
+ */
+class RtspResponseWriterTest {
+
+    /** Records every write call separately */
+    private class RecordingStream : ByteArrayOutputStream() {
+        val writes = mutableListOf<ByteArray>()
+
+        override fun write(b: ByteArray, off: Int, len: Int) {
+            writes.add(b.copyOfRange(off, off + len))
+            super.write(b, off, len)
+        }
+    }
+
+    // The previous AirPlayServer.sendResponse header format
+    private fun legacy(statusCode: Int, statusText: String, contentType: String, cseq: String?, body: ByteArray): ByteArray {
+        val headers = buildString {
+            append("RTSP/1.0 $statusCode $statusText\r\n")
+            append("Server: AirTunes/220.68\r\n")
+            cseq?.let { append("CSeq: $it\r\n") }
+            if (contentType.isNotEmpty()) append("Content-Type: $contentType\r\n")
+            if (body.isNotEmpty()) append("Content-Length: ${body.size}\r\n")
+            append("Audio-Jack-Status: connected\r\n")
+            append("\r\n")
+        }
+        return headers.toByteArray(Charsets.ISO_8859_1) + body
+    }
+
+    /** Discards everything, so only response serialization is measured */
+    private class NullStream : OutputStream() {
+        override fun write(b: Int) {}
+        override fun write(b: ByteArray, off: Int, len: Int) {}
+    }
+
+    // The previous AirPlayServer.sendResponse, writes included
+    private fun legacySend(output: OutputStream, statusCode: Int, statusText: String, contentType: String,
+                           cseq: String?, body: ByteArray, bodyLength: Int) {
+        val headers = buildString {
+            append("RTSP/1.0 $statusCode $statusText\r\n")
+            append("Server: AirTunes/220.68\r\n")
+            cseq?.let { append("CSeq: $it\r\n") }
+            if (contentType.isNotEmpty()) append("Content-Type: $contentType\r\n")
+            if (bodyLength > 0) append("Content-Length: $bodyLength\r\n")
+            append("Audio-Jack-Status: connected\r\n")
+            append("\r\n")
+        }
+        output.write(headers.toByteArray(Charsets.ISO_8859_1))
+        if (bodyLength > 0) output.write(body, 0, bodyLength)
+        output.flush()
+    }
+
+    private class Cost(val bytesPerResponse: Double, val nsPerResponse: Double)
+
+    /** Allocated bytes and wall time of this thread per response over [responses] calls of [send] (inline: no boxing) */
+    private inline fun measure(responses: Int, send: (Int) -> Unit): Cost {
+        val threads = ManagementFactory.getThreadMXBean() as com.sun.management.ThreadMXBean
+        val tid = Thread.currentThread().id
+        for (i in 0 until responses) send(i)    // warm up (JIT, buffer growth)
+        val bytesBefore = threads.getThreadAllocatedBytes(tid)
+        val start = System.nanoTime()
+        for (i in 0 until responses) send(i)
+        val ns = System.nanoTime() - start
+        val bytes = threads.getThreadAllocatedBytes(tid) - bytesBefore
+        return Cost(bytes.toDouble() / responses, ns.toDouble() / responses)
+    }
+
+    @Test
+    fun testCostVsLegacy() {
+        val responses = 200_000
+        // The control connection's usual mix: keepalive OK, fp-setup reply, SETUP plist
+        val cseqs = Array(64) { it.toString() }
+        val empty = ByteArray(0)
+        val fpReply = ByteArray(142) { it.toByte() }
+        val setupReply = ByteArray(96) { (it * 3).toByte() }
+        val stream = NullStream()
+        val writer = RtspResponseWriter(stream)
+
+        val legacy = measure(responses) { i ->
+            val cseq = cseqs[i and 63]
+            when (i % 3) {
+                0 -> legacySend(stream, 200, "OK", "", cseq, empty, 0)
+                1 -> legacySend(stream, 200, "OK", "application/octet-stream", cseq, fpReply, fpReply.size)
+                else -> legacySend(stream, 200, "OK", "application/x-apple-binary-plist", cseq, setupReply,
+                    setupReply.size)
+            }
+        }
+        val current = measure(responses) { i ->
+            val cseq = cseqs[i and 63]
+            when (i % 3) {
+                0 -> writer.send(200, "OK", "", cseq, empty, 0)
+                1 -> writer.send(200, "OK", "application/octet-stream", cseq, fpReply, fpReply.size)
+                else -> writer.send(200, "OK", "application/x-apple-binary-plist", cseq, setupReply, setupReply.size)
+            }
+        }
+
+        println("RTSP responses x$responses: buildString %.1f B %.0f ns, writer %.1f B %.0f ns per response (%.1fx faster)"
+            .format(legacy.bytesPerResponse, legacy.nsPerResponse, current.bytesPerResponse, current.nsPerResponse,
+                legacy.nsPerResponse / current.nsPerResponse))
+
+        // The writer's buffer has grown during warm-up, so after it nothing is allocated per response
+        assertTrue("writer allocates ${current.bytesPerResponse} B per response", current.bytesPerResponse < 1.0)
+        assertTrue(current.bytesPerResponse < legacy.bytesPerResponse / 10)
+    }
+
+    @Test
+    fun testMatchesLegacyFormat() {
+        val stream = RecordingStream()
+        val writer = RtspResponseWriter(stream)
+        val plist = ByteArray(300) { (it * 7).toByte() }
+
+        writer.send(200, "OK", "application/x-apple-binary-plist", "3", plist, plist.size)
+        writer.send(404, "Not Found", "text/plain", "12345", "")
+        writer.send(101, "Switching Protocols", "text/plain", null, "")
+        writer.send(200, "OK", "", "0", ByteArray(0), 0)
+        writer.send(500, "Internal Server Error", "text/plain", "9", "FairPlay setup failed")
+
+        assertEquals(5, stream.writes.size)
+        assertArrayEquals(legacy(200, "OK", "application/x-apple-binary-plist", "3", plist), stream.writes[0])
+        assertArrayEquals(legacy(404, "Not Found", "text/plain", "12345", ByteArray(0)), stream.writes[1])
+        assertArrayEquals(legacy(101, "Switching Protocols", "text/plain", null, ByteArray(0)), stream.writes[2])
+        assertArrayEquals(legacy(200, "OK", "", "0", ByteArray(0)), stream.writes[3])
+        assertArrayEquals(
+            legacy(500, "Internal Server Error", "text/plain", "9", "FairPlay setup failed".toByteArray()),
+            stream.writes[4]
+        )
+    }
+
+    @Test
+    fun testBodyLengthLimitsBody() {
+        val stream = RecordingStream()
+        val writer = RtspResponseWriter(stream)
+        val reply = ByteArray(1024) { 0x42 }
+
+        // Only the first bodyLength bytes of a reused reply buffer are sent
+        writer.send(200, "OK", "application/octet-stream", "7", reply, 142)
+
+        assertArrayEquals(legacy(200, "OK", "application/octet-stream", "7", reply.copyOf(142)), stream.writes[0])
+    }
+
+    @Test
+    fun testLargeBodyGrowsBuffer() {
+        val stream = RecordingStream()
+        val writer = RtspResponseWriter(stream)
+        val big = ByteArray(100_000) { it.toByte() }
+
+        writer.send(200, "OK", "application/octet-stream", "1", big, big.size)
+        writer.send(200, "OK", "text/plain", "2", "")
+
+        assertEquals(2, stream.writes.size)
+        assertArrayEquals(legacy(200, "OK", "application/octet-stream", "1", big), stream.writes[0])
+        assertArrayEquals(legacy(200, "OK", "text/plain", "2", ByteArray(0)), stream.writes[1])
+    }
+
+    @Test
+    fun testNonLatin1TextEncodedLikeIso88591() {
+        val stream = RecordingStream()
+        val writer = RtspResponseWriter(stream)
+        val text = "⛧ café 😀"
+
+        writer.send(200, "OK", "text/plain", "4", text)
+
+        assertArrayEquals(
+            legacy(200, "OK", "text/plain", "4", text.toByteArray(Charsets.ISO_8859_1)),
+            stream.writes[0]
+        )
+    }
+}
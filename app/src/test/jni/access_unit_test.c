@@ -0,0 +1,288 @@
+/**
+ * Access-unit assembler: in-place AVCC to Annex-B, frame tagging and sender clock mapping.
+ *
+ * Checks that multi-NAL packets (SPS/PPS/SEI/IDR slices, P slices) become one
+ * Annex-B access unit byte-identical to a reference conversion, with the right
+ * flags (including nal_ref_idc) and parameter-set positions, and that corrupt
+ * lengths truncate or drop the unit. Then maps a simulated sender clock
+ * (offset, +/- drift, jittered transit, a clock reset) to local time and
+ * reports the presentation-time error against the true send time plus the
+ * fastest transit, and the cost of assembling frames with several slices.
+ * Decoder input sizing: the SPS bound until a keyframe, then sized from a
+ * mirroring session's frame sizes, and growing past the bound for a sender
+ * that overshoots its level.
+ *
+ *   access_unit_test [--frames N] [--slices N] [--drift-ppm N] [--seed S]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "access_unit.h"
+#include "test_util.h"
+
+#define BASE_TRANSIT_NS 2000000ll       // fastest network + read path
+#define FRAME_NS 16666667ll             // 60 fps
+
+typedef struct {
+    unsigned char data[1 << 20];
+    int len;
+} packet_t;
+
+static void append_nal(packet_t *p, uint64_t *rng, int type, int len) {
+    unsigned char *d = p->data + p->len;
+    d[0] = (unsigned char)(len >> 24);
+    d[1] = (unsigned char)(len >> 16);
+    d[2] = (unsigned char)(len >> 8);
+    d[3] = (unsigned char)len;
+    d[4] = (unsigned char)(0x60 | type);
+    test_fill_random(rng, d + 5, (size_t)len - 1);
+    p->len += 4 + len;
+}
+
+// Reference: a fresh Annex-B copy, walking the lengths independently
+static int to_annexb(const unsigned char *in, int len, unsigned char *out) {
+    int pos = 0, n = 0;
+    while (pos + 4 <= len) {
+        int nal = in[pos] << 24 | in[pos + 1] << 16 | in[pos + 2] << 8 | in[pos + 3];
+        memcpy(out + n, "\0\0\0\1", 4);
+        memcpy(out + n + 4, in + pos + 4, nal);
+        n += 4 + nal;
+        pos += 4 + nal;
+    }
+    return n;
+}
+
+static void test_assemble(uint64_t *rng) {
+    static packet_t p;
+    static unsigned char ref[sizeof(p.data)];
+    access_unit_assembler_t a;
+    access_unit_t au;
+
+    access_unit_assembler_init(&a);
+
+    // IDR packet: SPS, PPS, SEI, 4 IDR slices
+    p.len = 0;
+    append_nal(&p, rng, 7, 23);
+    append_nal(&p, rng, 8, 4);
+    append_nal(&p, rng, 6, 40);
+    for (int i = 0; i < 4; i++) {
+        append_nal(&p, rng, 5, 30000 + i);
+    }
+    int ref_len = to_annexb(p.data, p.len, ref);
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+    CHECK(au.data == p.data && au.len == ref_len && memcmp(p.data, ref, ref_len) == 0);
+    CHECK(au.flags == (ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_PICTURE | ACCESS_UNIT_PARAMETER_SETS | ACCESS_UNIT_REFERENCE));
+    CHECK(au.nal_count == 7);
+    CHECK(au.nal_types == (1u << 7 | 1u << 8 | 1u << 6 | 1u << 5));
+    CHECK(au.sps_off == 4 && au.sps_len == 23 && (p.data[au.sps_off] & 0x1f) == 7);
+    CHECK(au.pps_off == 4 + 23 + 4 && au.pps_len == 4 && (p.data[au.pps_off] & 0x1f) == 8);
+
+    // P frame: slices only
+    p.len = 0;
+    append_nal(&p, rng, 1, 5000);
+    append_nal(&p, rng, 1, 7000);
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+    CHECK(au.flags == (ACCESS_UNIT_PICTURE | ACCESS_UNIT_REFERENCE) && au.nal_count == 2);
+    CHECK(au.sps_len == 0 && au.pps_len == 0);
+
+    // Non-reference P frame: nal_ref_idc 0 on every slice (SEI ref_idc does not count)
+    p.len = 0;
+    append_nal(&p, rng, 6, 20);
+    append_nal(&p, rng, 1, 5000);
+    append_nal(&p, rng, 1, 7000);
+    p.data[4 + 20 + 4] &= 0x1f;
+    p.data[4 + 20 + 4 + 5000 + 4] &= 0x1f;
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+    CHECK(au.flags == ACCESS_UNIT_PICTURE && au.nal_count == 3);
+
+    // Overrunning second length: the first slice survives, the rest is cut
+    p.len = 0;
+    append_nal(&p, rng, 1, 100);
+    append_nal(&p, rng, 1, 100);
+    p.data[104] = 0x7f;
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == 104);
+    CHECK(au.flags == (ACCESS_UNIT_PICTURE | ACCESS_UNIT_REFERENCE | ACCESS_UNIT_TRUNCATED) && au.nal_count == 1);
+    CHECK(memcmp(p.data, "\0\0\0\1", 4) == 0);
+
+    // Forbidden bit, zero length and a short tail
+    p.len = 0;
+    append_nal(&p, rng, 1, 100);
+    p.data[4] |= 0x80;
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == -1);
+    memset(p.data, 0, 8);
+    CHECK(access_unit_assemble(&a, p.data, 8, 0, 0, &au) == -1);
+    CHECK(access_unit_assemble(&a, p.data, 3, 0, 0, &au) == -1);
+    CHECK(a.units == 4 && a.keyframes == 1 && a.truncated == 1 && a.dropped == 3 && a.nal_units == 13);
+
+    // Header timestamp: bytes 8-15, little-endian
+    unsigned char header[128] = { 0 };
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (unsigned char)(0x11 * (i + 1));
+    }
+    CHECK(access_unit_header_timestamp(header) == 0x8877665544332211ull);
+    CHECK(access_unit_ntp_to_ns(3ull << 32 | 0x80000000ull) == 3500000000ll);
+}
+
+static void test_input_size(uint64_t *rng) {
+    static packet_t p;
+    const int sps_bound = 1920 * 1088 * 3 / 8;     // 1080p 4:2:0 at level 4.2 (MinCR 4)
+    access_unit_assembler_t a;
+    access_unit_t au;
+    int largest = 0;
+
+    access_unit_assembler_init(&a);
+    CHECK(access_unit_input_size(&a, sps_bound) == sps_bound);
+    CHECK(access_unit_size_percentile(&a, 50) == 0);
+
+    // P frames alone say nothing about keyframes: still the SPS bound
+    for (int i = 0; i < 30; i++) {
+        p.len = 0;
+        append_nal(&p, rng, 1, 10000 + (int)(test_rand(rng) % 50000));
+        CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+        largest = p.len > largest ? p.len : largest;
+    }
+    CHECK(access_unit_input_size(&a, sps_bound) == sps_bound);
+
+    // Ten seconds of mirroring: a 180-250 KB keyframe every two seconds, 10-60 KB P frames
+    for (int i = 0; i < 600; i++) {
+        p.len = 0;
+        if (i % 120 == 0) {
+            append_nal(&p, rng, 7, 23);
+            append_nal(&p, rng, 8, 4);
+            append_nal(&p, rng, 5, 180000 + (int)(test_rand(rng) % 70000));
+        } else {
+            append_nal(&p, rng, 1, 10000 + (int)(test_rand(rng) % 50000));
+        }
+        CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+        largest = p.len > largest ? p.len : largest;
+    }
+    int size = access_unit_input_size(&a, sps_bound);
+    CHECK(a.max_len == largest && a.max_keyframe_len == largest);
+    CHECK(size >= 2 * largest && size < 2 * largest + ACCESS_UNIT_INPUT_ALIGN);
+    CHECK(size % ACCESS_UNIT_INPUT_ALIGN == 0);
+    CHECK(size < sps_bound);
+    CHECK(access_unit_size_percentile(&a, 50) == 64 * 1024);
+    CHECK(access_unit_size_percentile(&a, 99) == 64 * 1024);       // keyframes are under 1%
+    CHECK(access_unit_size_percentile(&a, 99.5) == 256 * 1024);
+    printf("access unit sizes: p50 <= %d KB, p99 <= %d KB, max %d KB; decoder input %d KB "
+           "(SPS bound %d KB, 2:1 bound %d KB)\n", access_unit_size_percentile(&a, 50) / 1024,
+           access_unit_size_percentile(&a, 99) / 1024, a.max_len / 1024, size / 1024, sps_bound / 1024,
+           1920 * 1088 * 3 / 4 / 1024);
+
+    // Floors: a quarter of the bound, and the minimum
+    CHECK(access_unit_input_size(&a, 8 * sps_bound) ==
+          (2 * sps_bound + ACCESS_UNIT_INPUT_ALIGN - 1) / ACCESS_UNIT_INPUT_ALIGN * ACCESS_UNIT_INPUT_ALIGN);
+    access_unit_assembler_init(&a);
+    p.len = 0;
+    append_nal(&p, rng, 5, 3000);
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+    CHECK(access_unit_input_size(&a, sps_bound) == ACCESS_UNIT_MIN_INPUT_SIZE);
+
+    // A sender overshooting its level: sized for its frames, not the bound
+    p.len = 0;
+    append_nal(&p, rng, 5, 900000);
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len);
+    CHECK(access_unit_input_size(&a, sps_bound) >= 2 * p.len);
+    CHECK(access_unit_size_percentile(&a, 100) == 1024 * 1024);
+}
+
+static uint64_t ns_to_ntp(int64_t ns) {
+    return ((uint64_t)ns / 1000000000ull) << 32 | (((uint64_t)ns % 1000000000ull) << 32) / 1000000000ull;
+}
+
+// Exponential-ish queueing delay on top of the base transit, with rare large spikes
+static int64_t transit(uint64_t *rng) {
+    double u = (double)(test_rand(rng) >> 11) / (double)(1ull << 53);
+    int64_t t = BASE_TRANSIT_NS + (int64_t)(-log(1.0 - u) * 1.5e6);
+    if ((test_rand(rng) & 63) == 0) {
+        t += 40000000;
+    }
+    return t;
+}
+
+// Returns p99 |pts - (send + base transit)| over the frames after warm-up
+static uint64_t run_clock(long frames, double drift_ppm, uint64_t *rng, int reset_at, unsigned long long *resets) {
+    access_unit_clock_t clock;
+    uint64_t *err = malloc(sizeof(uint64_t) * frames);
+    long count = 0;
+    int64_t local_origin = 1000000000ll * 5000;     // arbitrary CLOCK_MONOTONIC origin
+    int64_t sender_origin = 1000000000ll * 3900000000ll / 1000;  // NTP-era sender clock
+
+    access_unit_clock_init(&clock);
+    for (long i = 0; i < frames; i++) {
+        int64_t send_local = local_origin + i * FRAME_NS;
+        int64_t sender_ns = sender_origin + (int64_t)((double)(i * FRAME_NS) * (1.0 + drift_ppm * 1e-6));
+        if (reset_at > 0 && i >= reset_at) {
+            sender_ns -= 3600ll * 1000000000ll;     // sender clock stepped back an hour
+        }
+        int64_t arrival = send_local + transit(rng);
+        int64_t pts = access_unit_clock_map(&clock, ns_to_ntp(sender_ns), arrival);
+        int64_t e = pts - (send_local + BASE_TRANSIT_NS);
+        // The first window after an anchor is still learning the minimum
+        if (i >= ACCESS_UNIT_CLOCK_WINDOW && (reset_at <= 0 || i >= reset_at + ACCESS_UNIT_CLOCK_WINDOW)) {
+            err[count++] = (uint64_t)(e < 0 ? -e : e);
+        }
+        CHECK(pts <= arrival);
+    }
+    *resets = clock.resets;
+    uint64_t p99 = test_percentile(err, (size_t)count, 99);
+    free(err);
+    return p99;
+}
+
+int main(int argc, char **argv) {
+    long frames = test_arg_long(argc, argv, "--frames", 36000);
+    int slices = (int)test_arg_long(argc, argv, "--slices", 4);
+    double drift = (double)test_arg_long(argc, argv, "--drift-ppm", 100);
+    uint64_t rng = (uint64_t)test_arg_long(argc, argv, "--seed", 0x5eed);
+    unsigned long long resets;
+
+    test_assemble(&rng);
+    test_input_size(&rng);
+
+    // Clock mapping: steady, sender fast, sender slow, sender clock reset
+    const struct {
+        const char *name;
+        double drift;
+        int reset_at;
+    } runs[] = {
+        { "no drift", 0, 0 },
+        { "sender fast", drift, 0 },
+        { "sender slow", -drift, 0 },
+        { "clock reset", 0, (int)(frames / 2) },
+    };
+    printf("access unit clock: %ld frames at 60 fps, p99 |pts - (send + %lld us)|\n", frames,
+           BASE_TRANSIT_NS / 1000);
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        uint64_t p99 = run_clock(frames, runs[i].drift, &rng, runs[i].reset_at, &resets);
+        printf("  %-12s %+5.0f ppm: %6.0f us (anchors %llu)\n", runs[i].name, runs[i].drift, p99 / 1e3, resets);
+        // Half a millisecond of queueing noise plus up to two windows of drift
+        CHECK(p99 < 1500000);
+        CHECK(resets == (runs[i].reset_at ? 2u : 1u));
+    }
+
+    // Cost: one 1080p-ish frame of several slices, reassembled from a pristine copy each time
+    static packet_t src, work;
+    src.len = 0;
+    for (int s = 0; s < slices; s++) {
+        append_nal(&src, &rng, 1, 60000 / slices);
+    }
+    access_unit_assembler_t a;
+    access_unit_t au;
+    access_unit_assembler_init(&a);
+    long iterations = 20000;
+    uint64_t copy_ns = 0, start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        uint64_t t0 = now_ns();
+        memcpy(work.data, src.data, src.len);
+        copy_ns += now_ns() - t0;
+        CHECK(access_unit_assemble(&a, work.data, src.len, ns_to_ntp(i * FRAME_NS), i * FRAME_NS, &au) == src.len);
+    }
+    double assemble_ns = (double)(now_ns() - start - copy_ns) / iterations;
+    printf("access unit assemble: %d-slice %d-byte frame in %.0f ns; decoder inputs per frame %d -> 1\n",
+           slices, src.len, assemble_ns, slices);
+
+    return test_failures();
+}
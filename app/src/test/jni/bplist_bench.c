@@ -0,0 +1,447 @@
+/**
+ * bplist00 reader/writer: SETUP body checks and decode benchmark.
+ *
+ * Parses the SETUP / POST /stream bodies in vectors/setup_plists.txt with
+ * airplay_setup_parse and checks every extracted field against the expected
+ * values, then truncates and corrupts each body to make sure the reader never
+ * leaves the buffer. The reply writers are round-tripped through the reader.
+ *
+ * The benchmark compares the single-pass extraction against decoding the whole
+ * document into an allocated object tree and looking keys up in it, which is
+ * what dd-plist's PropertyListParser.parse + NSDictionary.get do on the device.
+ *
+ *   bplist_bench --vectors FILE [--iterations N]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "airplay_setup.h"
+#include "test_util.h"
+
+#define MAX_BODIES 16
+#define MAX_EXPECT 16
+
+typedef struct {
+    char name[64];
+    unsigned char *body;
+    int len;
+    int expect_count;
+    char expect_field[MAX_EXPECT][48];
+    char expect_value[MAX_EXPECT][192];
+} vector_t;
+
+// ---- Reference: full object-tree decode, one allocation per object ----
+
+typedef struct node_s {
+    int type;
+    int64_t value;
+    unsigned char *bytes;   /* data, or string as UTF-8 */
+    int len;
+    struct node_s **items;  /* array items, or dict keys followed by values */
+    int count;
+} node_t;
+
+static long g_allocs;
+
+static void *counted_malloc(size_t size) {
+    g_allocs++;
+    return malloc(size ? size : 1);
+}
+
+static int utf16_to_utf8(const unsigned char *in, int units, unsigned char *out) {
+    int n = 0;
+    for (int i = 0; i < units; i++) {
+        unsigned c = (unsigned)in[2 * i] << 8 | in[2 * i + 1];
+        if (c < 0x80) {
+            out[n++] = (unsigned char)c;
+        } else if (c < 0x800) {
+            out[n++] = (unsigned char)(0xc0 | c >> 6);
+            out[n++] = (unsigned char)(0x80 | (c & 0x3f));
+        } else {
+            out[n++] = (unsigned char)(0xe0 | c >> 12);
+            out[n++] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+            out[n++] = (unsigned char)(0x80 | (c & 0x3f));
+        }
+    }
+    return n;
+}
+
+static node_t *tree_decode(const bplist_t *pl, int obj, int depth) {
+    int type = bplist_type(pl, obj);
+    if (type == BPLIST_INVALID || depth > 16) {
+        return NULL;
+    }
+    node_t *node = counted_malloc(sizeof(node_t));
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    int off, len;
+    switch (type) {
+    case BPLIST_BOOL:
+    case BPLIST_INT:
+        bplist_get_int(pl, obj, &node->value);
+        break;
+    case BPLIST_DATA:
+    case BPLIST_STRING:
+    case BPLIST_UTF16_STRING:
+        bplist_get_span(pl, obj, &off, &len);
+        node->bytes = counted_malloc(type == BPLIST_UTF16_STRING ? len / 2 * 3 : len);
+        if (type == BPLIST_UTF16_STRING) {
+            node->len = utf16_to_utf8(pl->data + off, len / 2, node->bytes);
+            node->type = BPLIST_STRING;
+        } else {
+            memcpy(node->bytes, pl->data + off, len);
+            node->len = len;
+        }
+        break;
+    case BPLIST_ARRAY:
+    case BPLIST_DICT:
+        node->count = bplist_count(pl, obj);
+        node->items = counted_malloc(sizeof(node_t *) * node->count * (type == BPLIST_DICT ? 2 : 1));
+        for (int i = 0; i < node->count; i++) {
+            if (type == BPLIST_ARRAY) {
+                node->items[i] = tree_decode(pl, bplist_array_item(pl, obj, i), depth + 1);
+            } else {
+                int k, v;
+                bplist_dict_entry(pl, obj, i, &k, &v);
+                node->items[i] = tree_decode(pl, k, depth + 1);
+                node->items[node->count + i] = tree_decode(pl, v, depth + 1);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return node;
+}
+
+static void tree_free(node_t *node) {
+    if (!node) {
+        return;
+    }
+    int n = node->type == BPLIST_DICT ? 2 * node->count : (node->type == BPLIST_ARRAY ? node->count : 0);
+    for (int i = 0; i < n; i++) {
+        tree_free(node->items[i]);
+    }
+    free(node->items);
+    free(node->bytes);
+    free(node);
+}
+
+static node_t *tree_get(const node_t *dict, const char *key) {
+    if (!dict || dict->type != BPLIST_DICT) {
+        return NULL;
+    }
+    size_t key_len = strlen(key);
+    for (int i = 0; i < dict->count; i++) {
+        const node_t *k = dict->items[i];
+        if (k && k->type == BPLIST_STRING && (size_t)k->len == key_len && memcmp(k->bytes, key, key_len) == 0) {
+            return dict->items[dict->count + i];
+        }
+    }
+    return NULL;
+}
+
+// The fields handleSetup reads, pulled from the tree the way AirPlayServer does with dd-plist
+static int64_t tree_extract(const unsigned char *body, int len) {
+    bplist_t pl;
+    int64_t sum = 0;
+    if (bplist_open(&pl, body, len) < 0) {
+        return -1;
+    }
+    node_t *root = tree_decode(&pl, pl.root, 0);
+    static const char *keys[] = { "ekey", "eiv", "deviceID", "model", "name", "sessionUUID", "osName", "osVersion" };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        node_t *n = tree_get(root, keys[i]);
+        sum += n ? n->len : 0;
+    }
+    node_t *n = tree_get(root, "timingPort");
+    sum += n ? n->value : 0;
+    node_t *streams = tree_get(root, "streams");
+    for (int i = 0; streams && streams->type == BPLIST_ARRAY && i < streams->count; i++) {
+        node_t *t = tree_get(streams->items[i], "type");
+        node_t *id = tree_get(streams->items[i], "streamConnectionID");
+        sum += (t ? t->value : 0) + (id ? id->value : 0);
+    }
+    tree_free(root);
+    return sum;
+}
+
+static int64_t native_extract(const unsigned char *body, int len) {
+    airplay_setup_t setup;
+    if (airplay_setup_parse(&setup, body, len) < 0) {
+        return -1;
+    }
+    return setup.ekey.len + setup.eiv.len + setup.timing_port + setup.stream_count;
+}
+
+// ---- Vector checks ----
+
+static int span_equals(const vector_t *v, const airplay_setup_span_t *span, const char *expected) {
+    unsigned char text[256];
+    int len = span->len;
+    const unsigned char *p = v->body + span->off;
+    if (span->off < 0) {
+        return strcmp(expected, "-") == 0;
+    }
+    if (span->utf16) {
+        len = utf16_to_utf8(p, span->len / 2, text);
+        p = text;
+    }
+    return (size_t)len == strlen(expected) && memcmp(p, expected, len) == 0;
+}
+
+static int hex_span_equals(const vector_t *v, const airplay_setup_span_t *span, const char *expected) {
+    unsigned char bytes[256];
+    if (span->off < 0 || strcmp(expected, "-") == 0) {
+        return span->off < 0 && strcmp(expected, "-") == 0;
+    }
+    int n = (int)strlen(expected) / 2;
+    if (n > (int)sizeof(bytes) || test_hex_decode(expected, bytes, n) < 0) {
+        return 0;
+    }
+    return n == span->len && memcmp(bytes, v->body + span->off, n) == 0;
+}
+
+static void check_vector(const vector_t *v) {
+    airplay_setup_t s;
+    CHECK(airplay_setup_parse(&s, v->body, v->len) == 0);
+    for (int i = 0; i < v->expect_count; i++) {
+        const char *f = v->expect_field[i];
+        const char *e = v->expect_value[i];
+        int ok;
+        int idx = -1;
+        if (strncmp(f, "stream.", 7) == 0) {
+            idx = atoi(f + 7);
+            f = strchr(f + 7, '.') + 1;
+            if (idx >= s.stream_count) {
+                fprintf(stderr, "%s: stream %d missing\n", v->name, idx);
+                CHECK(0);
+                continue;
+            }
+        }
+        if (idx >= 0 && strcmp(f, "type") == 0) {
+            ok = s.streams[idx].type == strtoll(e, NULL, 10);
+        } else if (idx >= 0 && strcmp(f, "streamConnectionID") == 0) {
+            ok = s.streams[idx].has_stream_connection_id &&
+                 (uint64_t)s.streams[idx].stream_connection_id == strtoull(e, NULL, 10);
+        } else if (idx >= 0 && strcmp(f, "controlPort") == 0) {
+            ok = s.streams[idx].control_port == strtoll(e, NULL, 10);
+        } else if (strcmp(f, "ekey") == 0) {
+            ok = hex_span_equals(v, &s.ekey, e);
+        } else if (strcmp(f, "eiv") == 0) {
+            ok = hex_span_equals(v, &s.eiv, e);
+        } else if (strcmp(f, "deviceID") == 0) {
+            ok = span_equals(v, &s.device_id, e);
+        } else if (strcmp(f, "model") == 0) {
+            ok = span_equals(v, &s.model, e);
+        } else if (strcmp(f, "name") == 0) {
+            ok = span_equals(v, &s.name, e);
+        } else if (strcmp(f, "sessionUUID") == 0) {
+            ok = span_equals(v, &s.session_uuid, e);
+        } else if (strcmp(f, "osName") == 0) {
+            ok = span_equals(v, &s.os_name, e);
+        } else if (strcmp(f, "osVersion") == 0) {
+            ok = span_equals(v, &s.os_version, e);
+        } else if (strcmp(f, "timingPort") == 0) {
+            ok = s.timing_port == strtoll(e, NULL, 10);
+        } else if (strcmp(f, "isScreenMirroringSession") == 0) {
+            ok = s.is_screen_mirroring == atoi(e);
+        } else if (strcmp(f, "streams") == 0) {
+            ok = s.stream_count == atoi(e);
+        } else {
+            fprintf(stderr, "%s: unknown field %s\n", v->name, f);
+            ok = 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s: %s does not match %s\n", v->name, v->expect_field[i], e);
+        }
+        CHECK(ok);
+    }
+}
+
+static int span_inside(const airplay_setup_span_t *span, int len) {
+    return span->off < 0 || (span->off >= 0 && span->len >= 0 && span->off + span->len <= len);
+}
+
+static int setup_inside(const airplay_setup_t *s, int len) {
+    return span_inside(&s->ekey, len) && span_inside(&s->eiv, len) && span_inside(&s->device_id, len) &&
+           span_inside(&s->model, len) && span_inside(&s->name, len) && span_inside(&s->session_uuid, len) &&
+           span_inside(&s->os_name, len) && span_inside(&s->os_version, len) &&
+           s->stream_count >= 0 && s->stream_count <= AIRPLAY_SETUP_MAX_STREAMS;
+}
+
+// Truncated and bit-flipped bodies must be rejected or parsed without leaving the buffer
+static void check_corrupt(const vector_t *v, uint64_t *seed) {
+    unsigned char *copy = malloc(v->len);
+    airplay_setup_t s;
+    for (int len = 0; len < v->len; len++) {
+        // Copy into an exact-size buffer so an overread would touch past the allocation
+        unsigned char *cut = malloc(len ? len : 1);
+        memcpy(cut, v->body, len);
+        if (airplay_setup_parse(&s, cut, len) == 0) {
+            CHECK(setup_inside(&s, len));
+        }
+        free(cut);
+    }
+    for (int i = 0; i < 2000; i++) {
+        memcpy(copy, v->body, v->len);
+        int flips = 1 + (int)(test_rand(seed) % 4);
+        for (int f = 0; f < flips; f++) {
+            copy[test_rand(seed) % v->len] ^= (unsigned char)(1 + test_rand(seed) % 255);
+        }
+        if (airplay_setup_parse(&s, copy, v->len) == 0) {
+            CHECK(setup_inside(&s, v->len));
+        }
+    }
+    free(copy);
+}
+
+static void check_writers(void) {
+    unsigned char buf[256];
+    airplay_setup_t s;
+    bplist_t pl;
+    int64_t value;
+
+    int len = airplay_setup_write_session_reply(buf, sizeof(buf), 0, 7010);
+    CHECK(len > 0);
+    CHECK(bplist_open(&pl, buf, len) == 0);
+    CHECK(bplist_get_int(&pl, bplist_dict_get(&pl, pl.root, "eventPort"), &value) == 0 && value == 0);
+    CHECK(bplist_get_int(&pl, bplist_dict_get(&pl, pl.root, "timingPort"), &value) == 0 && value == 7010);
+    CHECK(airplay_setup_parse(&s, buf, len) == 0 && s.timing_port == 7010);
+    CHECK(airplay_setup_write_session_reply(buf, len - 1, 0, 7010) == -1);
+
+    airplay_stream_reply_t replies[2] = {
+        { .type = 110, .data_port = 7100 },
+        { .type = 96, .data_port = 6000, .control_port = 6001, .server_port = 6002 },
+    };
+    len = airplay_setup_write_streams_reply(buf, sizeof(buf), replies, 2);
+    CHECK(len > 0);
+    CHECK(airplay_setup_parse(&s, buf, len) == 0 && s.stream_count == 2);
+    CHECK(s.streams[0].type == 110 && s.streams[1].type == 96 && s.streams[1].control_port == 6001);
+    CHECK(bplist_open(&pl, buf, len) == 0);
+    int streams = bplist_dict_get(&pl, pl.root, "streams");
+    CHECK(bplist_count(&pl, streams) == 2);
+    CHECK(bplist_get_int(&pl, bplist_dict_get(&pl, bplist_array_item(&pl, streams, 0), "dataPort"), &value) == 0 &&
+          value == 7100);
+    CHECK(bplist_dict_get(&pl, bplist_array_item(&pl, streams, 0), "serverPort") == -1);
+    CHECK(bplist_get_int(&pl, bplist_dict_get(&pl, bplist_array_item(&pl, streams, 1), "serverPort"), &value) == 0 &&
+          value == 6002);
+
+    // Extended counts, 8-byte negative ints and data round-trip through the generic writer
+    bplist_writer_t w;
+    unsigned char big[2048];
+    int keys[20], values[20];
+    char key[16];
+    bplist_writer_init(&w, big, sizeof(big));
+    for (int i = 0; i < 20; i++) {
+        snprintf(key, sizeof(key), "key%02d", i);
+        keys[i] = bplist_write_string(&w, key);
+        values[i] = (i % 2) ? bplist_write_int(&w, -1000L * i) : bplist_write_data(&w, big, i * 10);
+    }
+    len = bplist_writer_finish(&w, bplist_write_dict(&w, keys, values, 20));
+    CHECK(len > 0);
+    CHECK(bplist_open(&pl, big, len) == 0 && bplist_count(&pl, pl.root) == 20);
+    int off, span;
+    CHECK(bplist_get_int(&pl, bplist_dict_get(&pl, pl.root, "key19"), &value) == 0 && value == -19000);
+    CHECK(bplist_get_span(&pl, bplist_dict_get(&pl, pl.root, "key18"), &off, &span) == 0 && span == 180);
+}
+
+static int load_vectors(const char *path, vector_t *vectors) {
+    FILE *f = fopen(path, "r");
+    static char line[16384];
+    int count = 0;
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (strncmp(line, "body ", 5) == 0 && count < MAX_BODIES) {
+            vector_t *v = &vectors[count++];
+            char *hex = strchr(line + 5, ' ');
+            memset(v, 0, sizeof(*v));
+            if (!hex) {
+                fclose(f);
+                return -1;
+            }
+            *hex++ = 0;
+            snprintf(v->name, sizeof(v->name), "%s", line + 5);
+            v->len = (int)strlen(hex) / 2;
+            v->body = malloc(v->len);
+            if (test_hex_decode(hex, v->body, v->len) < 0) {
+                v->len = -1;
+            }
+        } else if (strncmp(line, "expect ", 7) == 0 && count > 0) {
+            vector_t *v = &vectors[count - 1];
+            char *value = strchr(line + 7, ' ');
+            if (!value || v->expect_count == MAX_EXPECT) {
+                continue;
+            }
+            *value++ = 0;
+            snprintf(v->expect_field[v->expect_count], sizeof(v->expect_field[0]), "%s", line + 7);
+            snprintf(v->expect_value[v->expect_count], sizeof(v->expect_value[0]), "%s", value);
+            v->expect_count++;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    const char *path = test_arg_str(argc, argv, "--vectors");
+    long iterations = test_arg_long(argc, argv, "--iterations", 100000);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 33);
+    static vector_t vectors[MAX_BODIES];
+
+    if (!path) {
+        fprintf(stderr, "usage: %s --vectors FILE [--iterations N] [--seed S]\n", argv[0]);
+        return 2;
+    }
+    int count = load_vectors(path, vectors);
+    CHECK(count > 0);
+    if (count <= 0) {
+        return test_failures();
+    }
+    for (int i = 0; i < count; i++) {
+        CHECK(vectors[i].len > 0);
+        check_vector(&vectors[i]);
+        check_corrupt(&vectors[i], &seed);
+    }
+    check_writers();
+    CHECK(airplay_setup_parse(&(airplay_setup_t){ 0 }, (const unsigned char *)"bplist00", 8) == -1);
+
+    printf("bplist: %d SETUP bodies\n", count);
+    printf("  %-16s %6s %12s %12s %12s\n", "body", "bytes", "native ns", "tree ns", "tree allocs");
+    volatile int64_t sink = 0;
+    for (int i = 0; i < count; i++) {
+        const vector_t *v = &vectors[i];
+        uint64_t start = now_ns();
+        for (long it = 0; it < iterations; it++) {
+            sink += native_extract(v->body, v->len);
+        }
+        double native_ns = (double)(now_ns() - start) / iterations;
+        g_allocs = 0;
+        start = now_ns();
+        for (long it = 0; it < iterations; it++) {
+            sink += tree_extract(v->body, v->len);
+        }
+        double tree_ns = (double)(now_ns() - start) / iterations;
+        printf("  %-16s %6d %12.0f %12.0f %12.1f\n", v->name, v->len, native_ns, tree_ns,
+               (double)g_allocs / iterations);
+    }
+
+    unsigned char reply[128];
+    airplay_stream_reply_t video = { .type = 110, .data_port = 7100 };
+    uint64_t start = now_ns();
+    for (long it = 0; it < iterations; it++) {
+        sink += airplay_setup_write_streams_reply(reply, sizeof(reply), &video, 1);
+    }
+    printf("  streams reply write: %.0f ns\n", (double)(now_ns() - start) / iterations);
+    (void)sink;
+
+    for (int i = 0; i < count; i++) {
+        free(vectors[i].body);
+    }
+    return test_failures();
+}
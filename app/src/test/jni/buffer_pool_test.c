@@ -0,0 +1,239 @@
+/**
+ * Payload buffer pool: class/recycling checks and mirror-stream benchmark.
+ *
+ * Checks class selection (16 KB..4 MB, exact oversize), recycling, the cache
+ * budget, trim and the statistics, then hands buffers from a receiver thread
+ * to a decoder thread the way VideoStreamReceiver does. The benchmark replays
+ * a synthetic 60 fps mirror stream (small P-frames, a multi-MB IDR every
+ * second, payloads written in full as recv() would) through the pool and
+ * through malloc/free and reports ns per packet (and over the cost of just
+ * filling a preallocated buffer) plus the pool hit rate.
+ *
+ *   buffer_pool_test [--packets N] [--seed S]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "buffer_pool.h"
+#include "test_util.h"
+
+#define KB 1024
+#define MB (1024 * 1024)
+
+static void test_classes(void) {
+    buffer_pool_t *pool = buffer_pool_init(64 * MB);
+    buffer_pool_stats_t stats;
+
+    static const size_t sizes[][2] = {
+        { 1, 16 * KB }, { 16 * KB, 16 * KB }, { 16 * KB + 1, 32 * KB }, { 128 * KB, 128 * KB },
+        { 128 * KB + 1, 256 * KB }, { 3 * MB, 4 * MB }, { 4 * MB, 4 * MB }, { 4 * MB + 1, 4 * MB + 1 },
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *buf = buffer_pool_acquire(pool, sizes[i][0]);
+        CHECK(buf != NULL);
+        CHECK(buffer_pool_capacity(buf) == sizes[i][1]);
+        memset(buf, 0xa5, buffer_pool_capacity(buf));
+        buffer_pool_release(pool, buf);
+    }
+
+    // Same class comes back from the free list
+    unsigned char *a = buffer_pool_acquire(pool, 200 * KB);
+    buffer_pool_release(pool, a);
+    unsigned char *b = buffer_pool_acquire(pool, 150 * KB);
+    CHECK(a == b);
+    unsigned char *c = buffer_pool_acquire(pool, 180 * KB);
+    CHECK(c != b);
+    buffer_pool_get_stats(pool, &stats);
+    CHECK(stats.classes[4].in_use == 2 && stats.classes[4].in_use_high_water == 2);
+    CHECK(stats.classes[4].hits >= 2);
+    CHECK(stats.oversize_acquires == 1 && stats.largest_request == 4 * MB + 1);
+    CHECK(stats.bytes_in_use == 512 * KB);
+    buffer_pool_release(pool, b);
+    buffer_pool_release(pool, c);
+
+    buffer_pool_get_stats(pool, &stats);
+    CHECK(stats.bytes_in_use == 0);
+    CHECK(stats.bytes_in_use_high_water >= 4 * MB + 1);
+    CHECK(stats.classes[4].cached == 2);
+    buffer_pool_trim(pool);
+    buffer_pool_get_stats(pool, &stats);
+    CHECK(stats.bytes_cached == 0 && stats.classes[4].cached == 0);
+    buffer_pool_destroy(pool);
+
+    // Cache budget: only what fits stays on the free lists
+    pool = buffer_pool_init(5 * MB);
+    unsigned char *big[3];
+    for (int i = 0; i < 3; i++) {
+        big[i] = buffer_pool_acquire(pool, 3 * MB);
+    }
+    for (int i = 0; i < 3; i++) {
+        buffer_pool_release(pool, big[i]);
+    }
+    buffer_pool_get_stats(pool, &stats);
+    CHECK(stats.classes[8].cached == 1 && stats.bytes_cached == 4 * MB);
+    buffer_pool_destroy(pool);
+}
+
+// ---- Receiver -> decoder handoff ----
+
+#define HANDOFF_SLOTS 8
+
+typedef struct {
+    buffer_pool_t *pool;
+    unsigned char *slots[HANDOFF_SLOTS];
+    size_t lens[HANDOFF_SLOTS];
+    int head;
+    int tail;
+    int done;
+    int corrupt;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} handoff_t;
+
+static void *decoder_thread(void *arg) {
+    handoff_t *h = arg;
+    for (;;) {
+        pthread_mutex_lock(&h->lock);
+        while (h->head == h->tail && !h->done) {
+            pthread_cond_wait(&h->cond, &h->lock);
+        }
+        if (h->head == h->tail) {
+            pthread_mutex_unlock(&h->lock);
+            return NULL;
+        }
+        unsigned char *buf = h->slots[h->tail % HANDOFF_SLOTS];
+        size_t len = h->lens[h->tail % HANDOFF_SLOTS];
+        h->tail++;
+        pthread_cond_signal(&h->cond);
+        pthread_mutex_unlock(&h->lock);
+
+        // Payload carries its own length pattern; a recycled-too-early buffer breaks it
+        for (size_t i = 0; i < len; i += 4096) {
+            if (buf[i] != (unsigned char)(len + i / 4096)) {
+                h->corrupt = 1;
+            }
+        }
+        buffer_pool_release(h->pool, buf);
+    }
+}
+
+static void test_handoff(uint64_t *seed) {
+    handoff_t h;
+    pthread_t tid;
+    memset(&h, 0, sizeof(h));
+    h.pool = buffer_pool_init(32 * MB);
+    pthread_mutex_init(&h.lock, NULL);
+    pthread_cond_init(&h.cond, NULL);
+    pthread_create(&tid, NULL, decoder_thread, &h);
+
+    for (long p = 0; p < 3000; p++) {
+        size_t len = (p % 60 == 0) ? 512 * KB + test_rand(seed) % (5 * MB) : 1 + test_rand(seed) % (96 * KB);
+        unsigned char *buf = buffer_pool_acquire(h.pool, len);
+        CHECK(buf != NULL);
+        for (size_t i = 0; i < len; i += 4096) {
+            buf[i] = (unsigned char)(len + i / 4096);
+        }
+        pthread_mutex_lock(&h.lock);
+        while (h.head - h.tail == HANDOFF_SLOTS) {
+            pthread_cond_wait(&h.cond, &h.lock);
+        }
+        h.slots[h.head % HANDOFF_SLOTS] = buf;
+        h.lens[h.head % HANDOFF_SLOTS] = len;
+        h.head++;
+        pthread_cond_signal(&h.cond);
+        pthread_mutex_unlock(&h.lock);
+    }
+    pthread_mutex_lock(&h.lock);
+    h.done = 1;
+    pthread_cond_signal(&h.cond);
+    pthread_mutex_unlock(&h.lock);
+    pthread_join(tid, NULL);
+
+    buffer_pool_stats_t stats;
+    buffer_pool_get_stats(h.pool, &stats);
+    CHECK(!h.corrupt);
+    CHECK(stats.bytes_in_use == 0);
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        CHECK(stats.classes[i].in_use == 0);
+        CHECK(stats.classes[i].in_use_high_water <= HANDOFF_SLOTS + 1);
+    }
+    buffer_pool_destroy(h.pool);
+}
+
+// ---- Benchmark ----
+
+// 60 fps screen content: mostly small P-frames, a large IDR once a second
+static size_t packet_size(long p, uint64_t *seed) {
+    if (p % 60 == 0) {
+        return 1 * MB + test_rand(seed) % (3 * MB);
+    }
+    if (test_rand(seed) % 10 == 0) {
+        return 64 * KB + test_rand(seed) % (192 * KB);
+    }
+    return 512 + test_rand(seed) % (40 * KB);
+}
+
+enum { BENCH_FILL_ONLY, BENCH_MALLOC, BENCH_POOL };
+
+static double bench(int mode, long packets, uint64_t seed, buffer_pool_stats_t *stats) {
+    buffer_pool_t *pool = buffer_pool_init(16 * MB);
+    unsigned char *fixed = malloc(4 * MB);
+    uint64_t start = now_ns();
+    for (long p = 0; p < packets; p++) {
+        size_t len = packet_size(p, &seed);
+        unsigned char *buf = mode == BENCH_POOL ? buffer_pool_acquire(pool, len)
+                           : mode == BENCH_MALLOC ? malloc(len) : fixed;
+        memset(buf, (int)p, len);     // stands in for the socket read filling the payload
+        if (mode == BENCH_POOL) {
+            buffer_pool_release(pool, buf);
+        } else if (mode == BENCH_MALLOC) {
+            free(buf);
+        }
+    }
+    double ns = (double)(now_ns() - start) / packets;
+    buffer_pool_get_stats(pool, stats);
+    buffer_pool_destroy(pool);
+    free(fixed);
+    return ns;
+}
+
+int main(int argc, char **argv) {
+    long packets = test_arg_long(argc, argv, "--packets", 6000);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 34);
+
+    test_classes();
+    test_handoff(&seed);
+
+#ifdef __GLIBC__
+    // Android's allocators map large blocks fresh each time; keep glibc from
+    // adapting its mmap threshold upward so the malloc baseline does the same
+    mallopt(M_MMAP_THRESHOLD, 128 * KB);
+#endif
+    buffer_pool_stats_t stats;
+    double fill_ns = bench(BENCH_FILL_ONLY, packets, seed, &stats);
+    double malloc_ns = bench(BENCH_MALLOC, packets, seed, &stats);
+    double pool_ns = bench(BENCH_POOL, packets, seed, &stats);
+    unsigned long long acquires = 0, hits = 0;
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        acquires += stats.classes[i].acquires;
+        hits += stats.classes[i].hits;
+    }
+    printf("buffer pool: %ld packets, fill only %.0f ns/packet\n", packets, fill_ns);
+    printf("  malloc/free %.0f ns/packet (+%.0f), pool %.0f ns/packet (+%.0f)\n",
+           malloc_ns, malloc_ns - fill_ns, pool_ns, pool_ns - fill_ns);
+    printf("  hit rate %.2f%%, high water %zu KB in use, largest request %zu KB\n",
+           acquires ? 100.0 * hits / acquires : 0.0, stats.bytes_in_use_high_water / KB, stats.largest_request / KB);
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        if (stats.classes[i].acquires) {
+            printf("  %5zu KB class: %llu acquires, %llu hits, %d cached\n",
+                   ((size_t)1 << (BUFFER_POOL_MIN_SHIFT + i)) / KB, stats.classes[i].acquires,
+                   stats.classes[i].hits, stats.classes[i].cached);
+        }
+    }
+    return test_failures();
+}
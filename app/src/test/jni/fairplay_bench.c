@@ -0,0 +1,325 @@
+/**
+ * FairPlay golden-vector test and latency benchmark.
+ *
+ * Replays recorded fp-setup sessions (setup -> handshake -> one or more ekeys)
+ * through fairplay_setup/fairplay_handshake/fairplay_decrypt, checks every
+ * output bit-exactly against the recording, then times each call over many
+ * replays and reports p50/p99/max latency per phase. Also times SETUP handling
+ * for one to four streams: per-key playfair_decrypt (session key derived every
+ * time) against one fairplay_decrypt_many call that derives it once.
+ *
+ *   fairplay_bench --vectors FILE [--iterations N] [--json]
+ *   fairplay_bench --record FILE [--sessions N] [--seed S]
+ *
+ * Vector files hold one record per line, '#' starts a comment:
+ *
+ *   setup     <16-byte request hex>  <142-byte response hex>
+ *   handshake <164-byte request hex> <32-byte response hex>
+ *   ekey      <72-byte ekey hex>     <16-byte AES key hex>
+ *
+ * Each ekey is decrypted with the most recent handshake, exactly as a sender
+ * session would drive it. --record writes a new file from the UxPlay reference.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fairplay.h"
+#include "playfair/playfair.h"
+#include "test_util.h"
+
+#define FP_EKEY_LEN 72
+#define FP_AESKEY_LEN 16
+#define MAX_VECTORS 256
+#define LINE_MAX_LEN 1024
+#define MAX_STREAMS 4
+
+enum vector_type { VECTOR_SETUP, VECTOR_HANDSHAKE, VECTOR_EKEY, VECTOR_TYPES };
+
+static const char *vector_names[VECTOR_TYPES] = { "setup", "handshake", "ekey" };
+static const int vector_in_len[VECTOR_TYPES] = {
+    FAIRPLAY_SETUP_REQ_LEN, FAIRPLAY_HANDSHAKE_REQ_LEN, FP_EKEY_LEN
+};
+static const int vector_out_len[VECTOR_TYPES] = {
+    FAIRPLAY_SETUP_RES_LEN, FAIRPLAY_HANDSHAKE_RES_LEN, FP_AESKEY_LEN
+};
+
+typedef struct {
+    enum vector_type type;
+    int line;
+    unsigned char in[FAIRPLAY_HANDSHAKE_REQ_LEN];
+    unsigned char out[FAIRPLAY_SETUP_RES_LEN];
+} vector_t;
+
+static int load_vectors(const char *path, vector_t *vectors, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[LINE_MAX_LEN];
+    int count = 0;
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *name = strtok(line, " \t\r\n");
+        if (!name || name[0] == '#') {
+            continue;
+        }
+        char *in_hex = strtok(NULL, " \t\r\n");
+        char *out_hex = strtok(NULL, " \t\r\n");
+
+        int type;
+        for (type = 0; type < VECTOR_TYPES; type++) {
+            if (strcmp(name, vector_names[type]) == 0) {
+                break;
+            }
+        }
+        if (type == VECTOR_TYPES || !in_hex || !out_hex || count == max ||
+            test_hex_decode(in_hex, vectors[count].in, vector_in_len[type]) < 0 ||
+            test_hex_decode(out_hex, vectors[count].out, vector_out_len[type]) < 0) {
+            fprintf(stderr, "%s:%d: malformed vector\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        vectors[count].type = type;
+        vectors[count].line = lineno;
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static int run_vector(fairplay_t *fp, const vector_t *v, unsigned char *out) {
+    switch (v->type) {
+    case VECTOR_SETUP:
+        return fairplay_setup(fp, v->in, out);
+    case VECTOR_HANDSHAKE:
+        return fairplay_handshake(fp, v->in, out);
+    default:
+        return fairplay_decrypt(fp, v->in, out);
+    }
+}
+
+// Times handshake + n ekey decrypts both ways; returns p50 ns for each in per_key/batched
+static void bench_streams(const vector_t *handshake, const vector_t *ekeys, int n, long iterations,
+                          uint64_t *per_key, uint64_t *batched) {
+    unsigned char batch_in[MAX_STREAMS][FP_EKEY_LEN];
+    unsigned char batch_out[MAX_STREAMS][FP_AESKEY_LEN];
+    unsigned char single_out[MAX_STREAMS][FP_AESKEY_LEN];
+    unsigned char res[FAIRPLAY_HANDSHAKE_RES_LEN];
+    uint64_t *a = malloc(sizeof(uint64_t) * (size_t)iterations);
+    uint64_t *b = malloc(sizeof(uint64_t) * (size_t)iterations);
+    unsigned char message3[FAIRPLAY_HANDSHAKE_REQ_LEN];
+
+    fairplay_t *fp = fairplay_init(NULL);
+    memcpy(message3, handshake->in, sizeof(message3));
+    for (int k = 0; k < n; k++) {
+        memcpy(batch_in[k], ekeys[k].in, FP_EKEY_LEN);
+    }
+    for (long it = 0; it < iterations; it++) {
+        uint64_t start = now_ns();
+        fairplay_handshake(fp, handshake->in, res);
+        for (int k = 0; k < n; k++) {
+            playfair_decrypt(message3, batch_in[k], single_out[k]);
+        }
+        a[it] = now_ns() - start;
+
+        start = now_ns();
+        fairplay_handshake(fp, handshake->in, res);
+        CHECK(fairplay_decrypt_many(fp, (const unsigned char (*)[FP_EKEY_LEN])batch_in, n, batch_out) == 0);
+        b[it] = now_ns() - start;
+
+        for (int k = 0; k < n; k++) {
+            CHECK(memcmp(single_out[k], ekeys[k].out, FP_AESKEY_LEN) == 0);
+            CHECK(memcmp(batch_out[k], ekeys[k].out, FP_AESKEY_LEN) == 0);
+        }
+    }
+    fairplay_destroy(fp);
+
+    *per_key = test_percentile(a, (size_t)iterations, 50);
+    *batched = test_percentile(b, (size_t)iterations, 50);
+    free(a);
+    free(b);
+}
+
+static int record_vectors(const char *path, long sessions, uint64_t rng) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    fairplay_t *fp = fairplay_init(NULL);
+    if (!fp) {
+        fclose(f);
+        return 1;
+    }
+
+    fprintf(f, "# FairPlay golden vectors: setup -> handshake -> ekeys, per key mode\n");
+    fprintf(f, "# Regenerate with: fairplay_bench --record FILE --sessions %ld\n", sessions);
+    for (long s = 0; s < sessions; s++) {
+        int mode = (int)(s & 3);
+        unsigned char req[FAIRPLAY_HANDSHAKE_REQ_LEN] = {0};
+        unsigned char res[FAIRPLAY_SETUP_RES_LEN];
+
+        memcpy(req, "FPLY", 4);
+        req[4] = 0x03;
+        req[14] = mode;
+        fairplay_setup(fp, req, res);
+        fprintf(f, "setup ");
+        test_hex_write(f, req, FAIRPLAY_SETUP_REQ_LEN);
+        fputc(' ', f);
+        test_hex_write(f, res, FAIRPLAY_SETUP_RES_LEN);
+        fputc('\n', f);
+
+        test_fill_random(&rng, req, sizeof(req));
+        memcpy(req, "FPLY", 4);
+        req[4] = 0x03;
+        req[12] = mode;
+        fairplay_handshake(fp, req, res);
+        fprintf(f, "handshake ");
+        test_hex_write(f, req, FAIRPLAY_HANDSHAKE_REQ_LEN);
+        fputc(' ', f);
+        test_hex_write(f, res, FAIRPLAY_HANDSHAKE_RES_LEN);
+        fputc('\n', f);
+
+        // Enough ekeys per session for the multi-stream SETUP benchmark
+        for (int k = 0; k < MAX_STREAMS; k++) {
+            unsigned char ekey[FP_EKEY_LEN];
+            unsigned char key[FP_AESKEY_LEN];
+            test_fill_random(&rng, ekey, sizeof(ekey));
+            playfair_decrypt(req, ekey, key);
+            fprintf(f, "ekey ");
+            test_hex_write(f, ekey, sizeof(ekey));
+            fputc(' ', f);
+            test_hex_write(f, key, sizeof(key));
+            fputc('\n', f);
+        }
+    }
+
+    fairplay_destroy(fp);
+    fclose(f);
+    printf("recorded %ld fp-setup sessions to %s\n", sessions, path);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *record_path = test_arg_str(argc, argv, "--record");
+    if (record_path) {
+        return record_vectors(record_path, test_arg_long(argc, argv, "--sessions", 8),
+                              (uint64_t)test_arg_long(argc, argv, "--seed", 0xf9a7));
+    }
+
+    const char *path = test_arg_str(argc, argv, "--vectors");
+    long iterations = test_arg_long(argc, argv, "--iterations", 2000);
+    int json = test_arg_flag(argc, argv, "--json");
+    if (!path) {
+        fprintf(stderr, "usage: %s --vectors FILE [--iterations N] [--json]\n", argv[0]);
+        return 2;
+    }
+
+    static vector_t vectors[MAX_VECTORS];
+    int count = load_vectors(path, vectors, MAX_VECTORS);
+    CHECK(count > 0);
+    if (count <= 0) {
+        return test_failures();
+    }
+
+    fairplay_t *fp = fairplay_init(NULL);
+    CHECK(fp != NULL);
+    if (!fp) {
+        return test_failures();
+    }
+
+    // Golden pass: every output must match the recording bit for bit
+    int per_type[VECTOR_TYPES] = {0};
+    for (int i = 0; i < count; i++) {
+        unsigned char out[FAIRPLAY_SETUP_RES_LEN];
+        const vector_t *v = &vectors[i];
+        if (run_vector(fp, v, out) != 0 || memcmp(out, v->out, vector_out_len[v->type]) != 0) {
+            fprintf(stderr, "%s:%d: %s output differs from golden vector\n", path, v->line, vector_names[v->type]);
+            CHECK(0);
+        }
+        per_type[v->type]++;
+    }
+
+    // Latency pass: replay the sessions and time each call on its own
+    uint64_t *samples[VECTOR_TYPES];
+    size_t sample_count[VECTOR_TYPES] = {0};
+    for (int t = 0; t < VECTOR_TYPES; t++) {
+        samples[t] = malloc(sizeof(uint64_t) * (size_t)(iterations * per_type[t] + 1));
+    }
+    for (long it = 0; it < iterations; it++) {
+        for (int i = 0; i < count; i++) {
+            unsigned char out[FAIRPLAY_SETUP_RES_LEN];
+            const vector_t *v = &vectors[i];
+            uint64_t start = now_ns();
+            run_vector(fp, v, out);
+            samples[v->type][sample_count[v->type]++] = now_ns() - start;
+        }
+    }
+    fairplay_destroy(fp);
+
+    if (json) {
+        printf("{\"benchmark\":\"fairplay\",\"vectors\":%d,\"iterations\":%ld", count, iterations);
+    } else {
+        printf("fairplay golden vectors: %d checked (%d setup, %d handshake, %d ekey)\n", count,
+               per_type[VECTOR_SETUP], per_type[VECTOR_HANDSHAKE], per_type[VECTOR_EKEY]);
+    }
+    for (int t = 0; t < VECTOR_TYPES; t++) {
+        size_t n = sample_count[t];
+        uint64_t p50 = test_percentile(samples[t], n, 50);
+        uint64_t p99 = test_percentile(samples[t], n, 99);
+        uint64_t max = n ? samples[t][n - 1] : 0;
+        if (json) {
+            printf(",\"%s\":{\"samples\":%zu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}", vector_names[t], n,
+                   (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)max);
+        } else {
+            printf("  %-9s %8zu samples  p50 %8llu ns  p99 %8llu ns  max %8llu ns\n", vector_names[t], n,
+                   (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)max);
+        }
+        free(samples[t]);
+    }
+
+    // Multi-stream SETUP: the first handshake followed by at least MAX_STREAMS ekeys
+    const vector_t *handshake = NULL;
+    for (int i = 0; i + MAX_STREAMS < count && !handshake; i++) {
+        if (vectors[i].type != VECTOR_HANDSHAKE) {
+            continue;
+        }
+        int k = 1;
+        while (k <= MAX_STREAMS && vectors[i + k].type == VECTOR_EKEY) {
+            k++;
+        }
+        if (k > MAX_STREAMS) {
+            handshake = &vectors[i];
+        }
+    }
+    long stream_iterations = iterations < 200 ? iterations : 200;
+    if (handshake && stream_iterations > 0) {
+        if (json) {
+            printf(",\"setup_streams\":[");
+        } else {
+            printf("  SETUP handshake + n ekeys (p50): per-key decrypt vs fairplay_decrypt_many\n");
+        }
+        for (int n = 1; n <= MAX_STREAMS; n++) {
+            uint64_t per_key, batched;
+            bench_streams(handshake, handshake + 1, n, stream_iterations, &per_key, &batched);
+            if (json) {
+                printf("%s{\"streams\":%d,\"per_key_ns\":%llu,\"batched_ns\":%llu}", n > 1 ? "," : "", n,
+                       (unsigned long long)per_key, (unsigned long long)batched);
+            } else {
+                printf("    %d stream(s)  %8llu ns -> %8llu ns\n", n, (unsigned long long)per_key,
+                       (unsigned long long)batched);
+            }
+        }
+        if (json) {
+            printf("]");
+        }
+    }
+    if (json) {
+        printf(",\"failures\":%d}\n", g_test_failures);
+    }
+    return test_failures();
+}
@@ -0,0 +1,172 @@
+/**
+ * FairPlay differential test and benchmark.
+ *
+ * Drives the native path the app uses (fairplay_setup -> fairplay_handshake ->
+ * fairplay_decrypt, exactly as FairPlay.kt calls it through JNI) and compares
+ * every AES key over randomized message3/ekey inputs for all four key modes
+ * against an independent reference: UxPlay's decrypt written out here on the
+ * original omg_hax.c generate_key_schedule/cycle, so neither the cached
+ * schedule nor the generated unrolled primitives are on the reference side.
+ * Each session decrypts two ekeys: the first pays for the session key and
+ * schedule the native path then caches, the second shows the per-stream cost.
+ * Reports ns/op for both sides and the native speedup for each. Also covers the single-call fp-setup responder (fairplay_respond).
+ *
+ *   fairplay_parity_test [--iterations N] [--seed S]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fairplay.h"
+#include "test_util.h"
+
+#define FP_SETUP_REQ_LEN 16
+#define FP_SETUP_RES_LEN 142
+#define FP_HANDSHAKE_REQ_LEN 164
+#define FP_HANDSHAKE_RES_LEN 32
+#define FP_EKEY_LEN 72
+#define FP_AESKEY_LEN 16
+
+// omg_hax.c originals, linked from the fairplay library
+extern unsigned char default_sap[];
+void generate_session_key(unsigned char *oldSap, unsigned char *messageIn, unsigned char *sessionKey);
+void generate_key_schedule(unsigned char *key_material, uint32_t key_schedule[11][4]);
+void cycle(unsigned char *block, uint32_t key_schedule[11][4]);
+void z_xor(unsigned char *in, unsigned char *out, int blocks);
+void x_xor(unsigned char *in, unsigned char *out, int blocks);
+
+// UxPlay's playfair_decrypt on the rolled primitives
+static void reference_decrypt(unsigned char *message3, unsigned char *ekey, unsigned char *key) {
+    uint32_t key_schedule[11][4];
+    unsigned char session_key[16];
+    unsigned char block[16];
+
+    generate_session_key(default_sap, message3, session_key);
+    generate_key_schedule(session_key, key_schedule);
+    z_xor(&ekey[56], block, 1);
+    cycle(block, key_schedule);
+    for (int i = 0; i < 16; i++) {
+        key[i] = block[i] ^ ekey[16 + i];
+    }
+    x_xor(key, key, 1);
+    z_xor(key, key, 1);
+}
+
+static void make_message3(uint64_t *rng, int mode, unsigned char message3[FP_HANDSHAKE_REQ_LEN]) {
+    test_fill_random(rng, message3, FP_HANDSHAKE_REQ_LEN);
+    memcpy(message3, "FPLY", 4);
+    message3[4] = 0x03;   // fairplay version
+    message3[12] = mode;  // key mode selects message_key/message_iv
+}
+
+// fairplay_respond must answer both phases byte-for-byte like setup/handshake
+static void test_respond(fairplay_t *fp) {
+    unsigned char req[FP_HANDSHAKE_REQ_LEN] = {0};
+    unsigned char expected[FP_SETUP_RES_LEN];
+    unsigned char res[FAIRPLAY_RES_MAX_LEN];
+
+    req[4] = 0x03;
+    for (int mode = 0; mode < 4; mode++) {
+        req[14] = mode;
+        CHECK(fairplay_setup(fp, req, expected) == 0);
+        CHECK(fairplay_respond(fp, req, FP_SETUP_REQ_LEN, res, sizeof(res)) == FP_SETUP_RES_LEN);
+        CHECK(memcmp(res, expected, FP_SETUP_RES_LEN) == 0);
+    }
+
+    for (int i = 144; i < FP_HANDSHAKE_REQ_LEN; i++) {
+        req[i] = (unsigned char)i;
+    }
+    CHECK(fairplay_handshake(fp, req, expected) == 0);
+    CHECK(fairplay_respond(fp, req, FP_HANDSHAKE_REQ_LEN, res, sizeof(res)) == FP_HANDSHAKE_RES_LEN);
+    CHECK(memcmp(res, expected, FP_HANDSHAKE_RES_LEN) == 0);
+
+    // Rejections: unknown mode, wrong version, wrong length, short output buffer
+    req[14] = 4;
+    CHECK(fairplay_respond(fp, req, FP_SETUP_REQ_LEN, res, sizeof(res)) == -1);
+    CHECK(fairplay_setup(fp, req, res) == -1);
+    req[14] = 0;
+    req[4] = 0x02;
+    CHECK(fairplay_respond(fp, req, FP_SETUP_REQ_LEN, res, sizeof(res)) == -1);
+    CHECK(fairplay_respond(fp, req, FP_HANDSHAKE_REQ_LEN, res, sizeof(res)) == -1);
+    req[4] = 0x03;
+    CHECK(fairplay_respond(fp, req, 15, res, sizeof(res)) == -1);
+    CHECK(fairplay_respond(fp, req, FP_SETUP_REQ_LEN, res, FP_SETUP_RES_LEN - 1) == -1);
+    CHECK(fairplay_respond(fp, req, FP_HANDSHAKE_REQ_LEN, res, FP_HANDSHAKE_RES_LEN) == FP_HANDSHAKE_RES_LEN);
+}
+
+int main(int argc, char **argv) {
+    long iterations = test_arg_long(argc, argv, "--iterations", 1000);
+    uint64_t rng = (uint64_t)test_arg_long(argc, argv, "--seed", 0x5eed);
+
+    fairplay_t *fp = fairplay_init(NULL);
+    CHECK(fp != NULL);
+    if (!fp) {
+        return test_failures();
+    }
+
+    uint64_t native_ns[2] = {0, 0};    // first ekey of a session, later ekeys
+    uint64_t reference_ns[2] = {0, 0};
+    for (long i = 0; i < iterations; i++) {
+        int mode = (int)(i & 3);
+        unsigned char setup_req[FP_SETUP_REQ_LEN] = {0};
+        unsigned char setup_res[FP_SETUP_RES_LEN];
+        unsigned char message3[FP_HANDSHAKE_REQ_LEN];
+        unsigned char handshake_res[FP_HANDSHAKE_RES_LEN];
+        unsigned char ekey[2][FP_EKEY_LEN];
+        unsigned char native_key[FP_AESKEY_LEN];
+        unsigned char reference_key[FP_AESKEY_LEN];
+
+        setup_req[4] = 0x03;
+        setup_req[14] = mode;
+        make_message3(&rng, mode, message3);
+        test_fill_random(&rng, &ekey[0][0], sizeof(ekey));
+
+        CHECK(fairplay_setup(fp, setup_req, setup_res) == 0);
+        CHECK(fairplay_handshake(fp, message3, handshake_res) == 0);
+        CHECK(setup_res[13] == mode);
+        CHECK(memcmp(handshake_res + 12, message3 + 144, 20) == 0);
+
+        int mismatch = 0;
+        for (int k = 0; k < 2; k++) {
+            uint64_t start = now_ns();
+            CHECK(fairplay_decrypt(fp, ekey[k], native_key) == 0);
+            native_ns[k] += now_ns() - start;
+
+            start = now_ns();
+            reference_decrypt(message3, ekey[k], reference_key);
+            reference_ns[k] += now_ns() - start;
+
+            if (memcmp(native_key, reference_key, FP_AESKEY_LEN) != 0) {
+                fprintf(stderr, "AES key mismatch at iteration %ld (mode %d, ekey %d)\n", i, mode, k);
+                mismatch = 1;
+            }
+        }
+        if (mismatch) {
+            CHECK(0);
+            break;
+        }
+    }
+
+    test_respond(fp);
+
+    // Decrypting before a handshake must be rejected, not read stale key material
+    unsigned char setup_req[FP_SETUP_REQ_LEN] = {0};
+    unsigned char setup_res[FP_SETUP_RES_LEN];
+    unsigned char ekey[FP_EKEY_LEN] = {0};
+    unsigned char key[FP_AESKEY_LEN];
+    setup_req[4] = 0x03;
+    CHECK(fairplay_setup(fp, setup_req, setup_res) == 0);
+    CHECK(fairplay_decrypt(fp, ekey, key) == -1);
+
+    fairplay_destroy(fp);
+
+    printf("fairplay parity: %ld randomized ekeys match the omg_hax.c reference\n", 2 * iterations);
+    for (int k = 0; k < 2 && iterations > 0; k++) {
+        double native_op = (double)native_ns[k] / iterations;
+        double reference_op = (double)reference_ns[k] / iterations;
+        printf("  %s ekey: native %.0f ns/op, reference %.0f ns/op, speedup %.2fx\n",
+               k == 0 ? "first" : "later", native_op, reference_op,
+               native_op > 0 ? reference_op / native_op : 0.0);
+    }
+    return test_failures();
+}
@@ -0,0 +1,245 @@
+/**
+ * SPSC frame queue: semantics, then handoff latency and throughput under bursty producers.
+ *
+ * Checks ordering, full/empty/timeout/close behaviour on one thread, then runs
+ * a reader thread pushing descriptors in bursts (a TCP read delivering several
+ * frames at once, then a gap) against a decoder thread popping them, with an
+ * optional per-frame decode cost. Every run is repeated with a mutex + condvar
+ * ring of the same size as the baseline, and reports handoff latency
+ * (push to pop) percentiles, frames per second, producer/consumer sleeps and
+ * the futex wakes issued.
+ *
+ *   frame_queue_bench [--frames N] [--capacity N] [--burst N] [--gap-us N] [--work-ns N]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_queue.h"
+#include "test_util.h"
+
+typedef struct {
+    long frames;
+    int burst;
+    long gap_ns;
+    long work_ns;
+} workload_t;
+
+// Baseline: the same ring behind one mutex, condvars for empty/full
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    frame_desc_t *slots;
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int tail;
+    int closed;
+    unsigned long long waits;
+} locked_queue_t;
+
+typedef struct {
+    const workload_t *w;
+    frame_queue_t *spsc;
+    locked_queue_t *locked;
+    uint64_t *handoff;
+    long received;
+    int in_order;
+} run_t;
+
+static void spin_for(long ns) {
+    uint64_t end = now_ns() + (uint64_t)ns;
+    while (now_ns() < end) {
+    }
+}
+
+static void locked_push(locked_queue_t *q, const frame_desc_t *desc) {
+    pthread_mutex_lock(&q->lock);
+    while (q->tail - q->head == q->capacity) {
+        q->waits++;
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->slots[q->tail % q->capacity] = *desc;
+    q->slots[q->tail % q->capacity].enqueue_ns = (int64_t)now_ns();
+    q->tail++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int locked_pop(locked_queue_t *q, frame_desc_t *desc) {
+    pthread_mutex_lock(&q->lock);
+    while (q->tail == q->head && !q->closed) {
+        q->waits++;
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    if (q->tail == q->head) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    *desc = q->slots[q->head % q->capacity];
+    q->head++;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static void *consumer(void *arg) {
+    run_t *r = arg;
+    frame_desc_t desc;
+
+    for (;;) {
+        int rc = r->spsc ? frame_queue_pop(r->spsc, &desc, -1) : locked_pop(r->locked, &desc);
+        if (rc != 0) {
+            break;
+        }
+        r->handoff[r->received] = now_ns() - (uint64_t)desc.enqueue_ns;
+        if (desc.cookie != (uint64_t)r->received || desc.len != (int)(r->received & 0xffff)) {
+            r->in_order = 0;
+        }
+        r->received++;
+        if (r->w->work_ns > 0) {
+            spin_for(r->w->work_ns);
+        }
+    }
+    return NULL;
+}
+
+static void run(const workload_t *w, frame_queue_t *spsc, locked_queue_t *locked, const char *name) {
+    run_t r = { w, spsc, locked, calloc((size_t)w->frames, sizeof(uint64_t)), 0, 1 };
+    pthread_t thread;
+    frame_desc_t desc;
+    struct timespec gap = { 0, w->gap_ns };
+
+    memset(&desc, 0, sizeof(desc));
+    uint64_t start = now_ns();
+    pthread_create(&thread, NULL, consumer, &r);
+    for (long i = 0; i < w->frames; i++) {
+        desc.cookie = (uint64_t)i;
+        desc.len = (int)(i & 0xffff);
+        if (spsc) {
+            CHECK(frame_queue_push(spsc, &desc, -1) == 0);
+        } else {
+            locked_push(locked, &desc);
+        }
+        if (w->gap_ns > 0 && (i + 1) % w->burst == 0) {
+            nanosleep(&gap, NULL);
+        }
+    }
+    if (spsc) {
+        frame_queue_close(spsc);
+    } else {
+        pthread_mutex_lock(&locked->lock);
+        locked->closed = 1;
+        pthread_cond_signal(&locked->not_empty);
+        pthread_mutex_unlock(&locked->lock);
+    }
+    pthread_join(thread, NULL);
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    CHECK(r.received == w->frames && r.in_order);
+    printf("  %-8s %8.0f frames/s  handoff p50 %6llu ns  p99 %7llu ns  max %8llu ns",
+           name, (double)w->frames / seconds,
+           (unsigned long long)test_percentile(r.handoff, (size_t)w->frames, 50),
+           (unsigned long long)test_percentile(r.handoff, (size_t)w->frames, 99),
+           (unsigned long long)test_percentile(r.handoff, (size_t)w->frames, 100));
+    if (spsc) {
+        frame_queue_stats_t stats;
+        frame_queue_get_stats(spsc, &stats);
+        CHECK(stats.pushes == (unsigned long long)w->frames && stats.pops == stats.pushes && stats.size == 0);
+        printf("  sleeps %llu/%llu  wakes %llu\n", stats.producer_waits, stats.consumer_waits, stats.wakes);
+    } else {
+        printf("  sleeps %llu\n", locked->waits);
+    }
+    free(r.handoff);
+}
+
+static void test_semantics(void) {
+    frame_queue_t *q = frame_queue_create(5);
+    frame_queue_stats_t stats;
+    frame_desc_t desc, out;
+
+    memset(&desc, 0, sizeof(desc));
+    frame_queue_get_stats(q, &stats);
+    CHECK(stats.capacity == 8);
+
+    // Fill, overflow without waiting, then drain in order
+    for (int i = 0; i < 8; i++) {
+        desc.cookie = (uint64_t)i;
+        desc.data = (unsigned char *)&desc + i;
+        CHECK(frame_queue_push(q, &desc, 0) == 0);
+    }
+    CHECK(frame_queue_size(q) == 8);
+    CHECK(frame_queue_push(q, &desc, 0) == -1);
+    uint64_t t0 = now_ns();
+    CHECK(frame_queue_push(q, &desc, 5000000) == -1);
+    CHECK(now_ns() - t0 >= 5000000);
+    for (int i = 0; i < 8; i++) {
+        CHECK(frame_queue_pop(q, &out, 0) == 0 && out.cookie == (uint64_t)i && out.data == (unsigned char *)&desc + i);
+    }
+    CHECK(frame_queue_pop(q, &out, 0) == -1);
+    t0 = now_ns();
+    CHECK(frame_queue_pop(q, &out, 5000000) == -1);
+    CHECK(now_ns() - t0 >= 5000000);
+
+    // Indices wrap; close lets the consumer drain, then refuses both sides
+    for (int i = 0; i < 20; i++) {
+        desc.cookie = (uint64_t)(100 + i);
+        CHECK(frame_queue_push(q, &desc, 0) == 0);
+        CHECK(frame_queue_pop(q, &out, 0) == 0 && out.cookie == (uint64_t)(100 + i));
+    }
+    CHECK(frame_queue_push(q, &desc, 0) == 0);
+    frame_queue_close(q);
+    CHECK(frame_queue_push(q, &desc, -1) == -1);
+    CHECK(frame_queue_pop(q, &out, -1) == 0 && out.cookie == 119);
+    CHECK(frame_queue_pop(q, &out, -1) == -1);
+    frame_queue_get_stats(q, &stats);
+    CHECK(stats.pushes == 29 && stats.pops == 29 && stats.wakes == 0);
+    frame_queue_destroy(q);
+}
+
+int main(int argc, char **argv) {
+    long frames = test_arg_long(argc, argv, "--frames", 200000);
+    unsigned int capacity = (unsigned int)test_arg_long(argc, argv, "--capacity", FRAME_QUEUE_DEFAULT_CAPACITY);
+    int burst = (int)test_arg_long(argc, argv, "--burst", 8);
+    long gap_ns = test_arg_long(argc, argv, "--gap-us", 100) * 1000;
+    long work_ns = test_arg_long(argc, argv, "--work-ns", 0);
+
+    test_semantics();
+
+    // Saturated (throughput), bursty reader (handoff latency), and bursts into a slow consumer
+    const struct {
+        const char *name;
+        workload_t w;
+    } workloads[] = {
+        { "saturated", { frames, 1, 0, 0 } },
+        { "bursty", { frames / 10, burst, gap_ns, work_ns } },
+        { "slow consumer", { frames / 20, burst * 16, gap_ns * 10, 2000 } },
+    };
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        const workload_t *w = &workloads[i].w;
+        printf("frame queue %s: %ld frames, bursts of %d, gap %ld us, decode %ld ns, capacity %u\n",
+               workloads[i].name, w->frames, w->burst, w->gap_ns / 1000, w->work_ns, capacity);
+
+        frame_queue_t *spsc = frame_queue_create(capacity);
+        run(w, spsc, NULL, "spsc");
+        frame_queue_destroy(spsc);
+
+        locked_queue_t locked;
+        memset(&locked, 0, sizeof(locked));
+        pthread_mutex_init(&locked.lock, NULL);
+        pthread_cond_init(&locked.not_empty, NULL);
+        pthread_cond_init(&locked.not_full, NULL);
+        for (locked.capacity = 2; locked.capacity < capacity; locked.capacity <<= 1) {
+        }
+        locked.slots = calloc(locked.capacity, sizeof(frame_desc_t));
+        run(w, NULL, &locked, "mutex");
+        free(locked.slots);
+        pthread_cond_destroy(&locked.not_full);
+        pthread_cond_destroy(&locked.not_empty);
+        pthread_mutex_destroy(&locked.lock);
+    }
+
+    return test_failures();
+}
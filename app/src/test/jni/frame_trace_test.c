@@ -0,0 +1,426 @@
+/**
+ * Frame trace: stage stamps across threads, histograms, Chrome trace dumps and cost.
+ *
+ * A reader thread begins frames and marks them decrypted, then hands their ids
+ * to a decoder thread through the real frame queue, the way VideoStreamReceiver
+ * carries them. The decoder marks dequeue, assembly (with the capture stamp)
+ * and input, drops some frames before the decoder and feeds the rest through
+ * a mock codec that gives them back two deep and reordered, matched by
+ * timestamp. Every stamp is a function of the frame id, so the per-stage
+ * percentiles are known in advance, and a third thread dumping Chrome trace
+ * JSON the whole time can check every event it wrote against the frame it
+ * claims to be: a slot torn by reuse would show up as a wrong timestamp.
+ *
+ * Then ring reuse (stale ids ignored), the bucket layout, a well-formed dump,
+ * and the cost of tracing a frame on the hot path.
+ *
+ *   frame_trace_test [--frames N] [--iterations N] [--output PATH]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_queue.h"
+#include "frame_trace.h"
+#include "test_util.h"
+
+#define FRAME_NS 16666667ll             // 60 fps
+#define US 1000ll
+#define MS 1000000ll
+
+#define NETWORK_NS(id) (2 * MS + ((id) % 7) * 100 * US)
+#define DECRYPT_NS (40 * US)
+#define QUEUE_NS (300 * US)
+#define ASSEMBLE_NS (20 * US)
+#define INPUT_NS (100 * US)
+#define DECODE_NS(id) ((id) % 50 == 0 ? 30 * MS : 8 * MS)
+#define DROPPED(id) ((id) % 10 == 3)    // dropped by the latency policy before the decoder
+
+// What every stage of a frame is stamped with; 0 for stages a dropped frame never reaches
+static int64_t stamp(uint32_t id, int stage) {
+    int64_t t = 1000 * MS + (int64_t)id * FRAME_NS;     // capture
+
+    if (stage >= FRAME_TRACE_ARRIVAL) t += NETWORK_NS(id);
+    if (stage >= FRAME_TRACE_DECRYPTED) t += DECRYPT_NS;
+    if (stage >= FRAME_TRACE_DEQUEUED) t += QUEUE_NS;
+    if (stage >= FRAME_TRACE_ASSEMBLED) t += ASSEMBLE_NS;
+    if (stage >= FRAME_TRACE_INPUT) {
+        if (DROPPED(id)) return 0;
+        t += INPUT_NS;
+    }
+    if (stage >= FRAME_TRACE_OUTPUT) t += DECODE_NS(id);
+    return t;
+}
+
+static int64_t last_stamp(uint32_t id) {
+    return stamp(id, DROPPED(id) ? FRAME_TRACE_ASSEMBLED : FRAME_TRACE_OUTPUT);
+}
+
+typedef struct {
+    frame_trace_t *trace;
+    frame_queue_t *queue;
+    long frames;
+    volatile int done;
+    long dumps;
+    long dumped_frames;
+    long bad_events;
+} pipeline_t;
+
+static void *reader_thread(void *arg) {
+    pipeline_t *p = arg;
+
+    for (long i = 0; i < p->frames; i++) {
+        uint32_t id = frame_trace_begin(p->trace, 0);
+        frame_desc_t desc;
+
+        // The id exists only once begun, so arrival is stamped again with its scripted value
+        frame_trace_mark(p->trace, id, FRAME_TRACE_ARRIVAL, stamp(id, FRAME_TRACE_ARRIVAL));
+        frame_trace_mark(p->trace, id, FRAME_TRACE_DECRYPTED, stamp(id, FRAME_TRACE_DECRYPTED));
+        memset(&desc, 0, sizeof(desc));
+        desc.trace_id = id;
+        CHECK(frame_queue_push(p->queue, &desc, -1) == 0);
+    }
+    frame_queue_close(p->queue);
+    return NULL;
+}
+
+static void decoder_thread(pipeline_t *p) {
+    uint32_t in_codec[2];
+    int depth = 0;
+    frame_desc_t desc;
+
+    while (frame_queue_pop(p->queue, &desc, -1) == 0) {
+        uint32_t id = desc.trace_id;
+
+        frame_trace_mark(p->trace, id, FRAME_TRACE_DEQUEUED, stamp(id, FRAME_TRACE_DEQUEUED));
+        frame_trace_mark(p->trace, id, FRAME_TRACE_CAPTURE, stamp(id, FRAME_TRACE_CAPTURE));
+        frame_trace_mark(p->trace, id, FRAME_TRACE_ASSEMBLED, stamp(id, FRAME_TRACE_ASSEMBLED));
+        if (!DROPPED(id)) {
+            frame_trace_mark(p->trace, id, FRAME_TRACE_INPUT, stamp(id, FRAME_TRACE_INPUT));
+            in_codec[depth++] = id;
+            if (depth == 2) {
+                // Out in reverse order, like B-frames
+                for (int k = 1; k >= 0; k--) {
+                    uint32_t out = in_codec[k];
+                    CHECK(frame_trace_output(p->trace, stamp(out, FRAME_TRACE_CAPTURE),
+                                             stamp(out, FRAME_TRACE_OUTPUT)) == 0);
+                }
+                depth = 0;
+            }
+        }
+        frame_trace_end(p->trace, id);
+    }
+    if (depth == 1) {
+        CHECK(frame_trace_output(p->trace, stamp(in_codec[0], FRAME_TRACE_CAPTURE),
+                                 stamp(in_codec[0], FRAME_TRACE_OUTPUT)) == 0);
+    }
+}
+
+static int interval_of(const char *name) {
+    for (int i = 1; i < FRAME_TRACE_STAGES; i++) {
+        if (strcmp(name, frame_trace_interval_name(i)) == 0) return i;
+    }
+    return -1;
+}
+
+// Every event must carry the timestamp its frame was stamped with; returns the frames in the dump
+static long check_dump(FILE *f, long *bad) {
+    char line[256], name[64];
+    long frames = 0;
+    uint32_t id;
+    char ph;
+    long long us, frac;
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, ",{\"name\":\"%63[^\"]\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":%u,\"pid\":1,\"tid\":1,"
+                   "\"ts\":%lld.%lld}", name, &ph, &id, &us, &frac) != 5 &&
+            sscanf(line, "{\"name\":\"%63[^\"]\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":%u,\"pid\":1,\"tid\":1,"
+                   "\"ts\":%lld.%lld}", name, &ph, &id, &us, &frac) != 5) {
+            continue;
+        }
+        int64_t ts = us * 1000 + frac, want;
+        if (strncmp(name, "frame ", 6) == 0) {
+            CHECK((uint32_t)strtoul(name + 6, NULL, 10) == id);
+            want = ph == 'b' ? stamp(id, FRAME_TRACE_CAPTURE) : last_stamp(id);
+            frames += ph == 'b';
+        } else {
+            int i = interval_of(name);
+            CHECK(i > 0);
+            want = i > 0 ? stamp(id, ph == 'b' ? i - 1 : i) : -1;
+        }
+        if (ts != want) {
+            if (*bad < 5) {
+                fprintf(stderr, "  bad event for frame %u: %s %c at %lld, want %lld\n", id, name, ph,
+                        (long long)ts, (long long)want);
+            }
+            (*bad)++;
+        }
+    }
+    return frames;
+}
+
+static void *dump_thread(void *arg) {
+    pipeline_t *p = arg;
+
+    while (!__atomic_load_n(&p->done, __ATOMIC_ACQUIRE)) {
+        FILE *f = tmpfile();
+        if (f == NULL) break;
+        CHECK(frame_trace_write_json(p->trace, f) >= 0);
+        fflush(f);
+        p->dumped_frames += check_dump(f, &p->bad_events);
+        p->dumps++;
+        fclose(f);
+    }
+    return NULL;
+}
+
+static void check_near(const char *what, int64_t got, int64_t want) {
+    // Bucket bounds are at most 25% above the value they hold
+    int ok = got >= want && got <= want + want / 4;
+    printf("  %-14s %8.3f ms (expect %.3f)%s\n", what, got / 1e6, want / 1e6, ok ? "" : "  <-- off");
+    CHECK(ok);
+}
+
+static void test_pipeline(long frames) {
+    pipeline_t p = { 0 };
+    frame_trace_stats_t stats;
+    pthread_t reader, dumper;
+    long dropped = 0, spikes = 0;
+
+    p.trace = frame_trace_create();
+    p.queue = frame_queue_create(64);
+    p.frames = frames;
+    CHECK(p.trace != NULL && p.queue != NULL);
+
+    pthread_create(&dumper, NULL, dump_thread, &p);
+    pthread_create(&reader, NULL, reader_thread, &p);
+    decoder_thread(&p);
+    pthread_join(reader, NULL);
+    __atomic_store_n(&p.done, 1, __ATOMIC_RELEASE);
+    pthread_join(dumper, NULL);
+
+    for (uint32_t id = 1; id <= (uint32_t)frames; id++) {
+        dropped += DROPPED(id);
+        spikes += DECODE_NS(id) > 8 * MS;
+    }
+    frame_trace_get_stats(p.trace, &stats);
+    printf("pipeline: %llu frames, %llu completed, %llu decoded, %llu unmatched outputs; "
+           "%ld concurrent dumps (%ld frames) checked, %ld bad events\n",
+           stats.frames, stats.completed, stats.decoded, stats.unmatched_outputs,
+           p.dumps, p.dumped_frames, p.bad_events);
+    CHECK(stats.frames == (unsigned long long)frames);
+    CHECK(stats.completed == (unsigned long long)frames);
+    CHECK(stats.decoded == (unsigned long long)(frames - dropped));
+    CHECK(stats.unmatched_outputs == 0);
+    CHECK(p.bad_events == 0);
+    CHECK(p.dumps > 0);
+
+    // Every frame passes the stages up to assembly; only decoded ones the last two
+    const frame_trace_histogram_t *h = stats.histograms;
+    for (int i = FRAME_TRACE_ARRIVAL; i <= FRAME_TRACE_ASSEMBLED; i++) {
+        CHECK(h[i].count == (unsigned long long)frames);
+    }
+    CHECK(h[FRAME_TRACE_INPUT].count == (unsigned long long)(frames - dropped));
+    CHECK(h[FRAME_TRACE_OUTPUT].count == (unsigned long long)(frames - dropped));
+    CHECK(h[FRAME_TRACE_END_TO_END].count == (unsigned long long)(frames - dropped));
+
+    check_near("network p50", frame_trace_percentile(&h[FRAME_TRACE_ARRIVAL], 50), 2 * MS + 300 * US);
+    check_near("network max", h[FRAME_TRACE_ARRIVAL].max_ns, 2 * MS + 600 * US);
+    check_near("decrypt p99", frame_trace_percentile(&h[FRAME_TRACE_DECRYPTED], 99), DECRYPT_NS);
+    check_near("queue p99", frame_trace_percentile(&h[FRAME_TRACE_DEQUEUED], 99), QUEUE_NS);
+    check_near("assemble p99", frame_trace_percentile(&h[FRAME_TRACE_ASSEMBLED], 99), ASSEMBLE_NS);
+    check_near("input p99", frame_trace_percentile(&h[FRAME_TRACE_INPUT], 99), INPUT_NS);
+    check_near("decode p90", frame_trace_percentile(&h[FRAME_TRACE_OUTPUT], 90), 8 * MS);
+    // Spikes are over 1% of decoded frames, so they own p99 and only the decode stage shows them
+    CHECK(spikes * 100 > (frames - dropped));
+    check_near("decode p99", frame_trace_percentile(&h[FRAME_TRACE_OUTPUT], 99), 30 * MS);
+    check_near("end-to-end p50", frame_trace_percentile(&h[FRAME_TRACE_END_TO_END], 50),
+               stamp(1, FRAME_TRACE_OUTPUT) - stamp(1, FRAME_TRACE_CAPTURE));
+    CHECK(frame_trace_percentile(&h[FRAME_TRACE_DEQUEUED], 100) < 1 * MS);
+    CHECK(h[FRAME_TRACE_END_TO_END].sum_ns / h[FRAME_TRACE_END_TO_END].count > 10 * MS);
+
+    frame_queue_destroy(p.queue);
+    frame_trace_destroy(p.trace);
+}
+
+static void test_ring_reuse(void) {
+    frame_trace_t *trace = frame_trace_create();
+    frame_trace_stats_t stats;
+    uint32_t first, id = 0;
+
+    first = frame_trace_begin(trace, 1000);
+    CHECK(first != 0);
+    frame_trace_mark(trace, first, FRAME_TRACE_INPUT, 2000);
+    for (int i = 0; i < FRAME_TRACE_CAPACITY; i++) {
+        id = frame_trace_begin(trace, 10000 + i);
+    }
+    CHECK(id == first + FRAME_TRACE_CAPACITY);
+
+    // first's slot now belongs to id: stale marks, ends and outputs must not touch it
+    frame_trace_mark(trace, first, FRAME_TRACE_DECRYPTED, 5);
+    frame_trace_end(trace, first);
+    CHECK(frame_trace_output(trace, 0, 3000) == -1);
+    frame_trace_get_stats(trace, &stats);
+    CHECK(stats.completed == 0);
+    CHECK(stats.unmatched_outputs == 1);
+
+    // Ignored: id 0, unknown stages
+    frame_trace_mark(trace, 0, FRAME_TRACE_DECRYPTED, 5);
+    frame_trace_mark(trace, id, FRAME_TRACE_STAGES, 5);
+    frame_trace_mark(trace, id, -1, 5);
+    frame_trace_end(trace, 0);
+
+    frame_trace_mark(trace, id, FRAME_TRACE_DECRYPTED, 10000 + FRAME_TRACE_CAPACITY - 1 + 7000);
+    frame_trace_end(trace, id);
+    frame_trace_end(trace, id);             // once only
+    frame_trace_get_stats(trace, &stats);
+    CHECK(stats.completed == 1);
+    CHECK(stats.decoded == 0);
+    CHECK(stats.histograms[FRAME_TRACE_DECRYPTED].count == 1);
+    CHECK(stats.histograms[FRAME_TRACE_DECRYPTED].max_ns == 7000);
+
+    // In the decoder: end leaves it to the output
+    id = frame_trace_begin(trace, 50 * MS);
+    frame_trace_mark(trace, id, FRAME_TRACE_CAPTURE, 48 * MS + 123);
+    frame_trace_mark(trace, id, FRAME_TRACE_INPUT, 51 * MS);
+    frame_trace_end(trace, id);
+    frame_trace_get_stats(trace, &stats);
+    CHECK(stats.completed == 1);
+    CHECK(frame_trace_output(trace, 48 * MS + 999, 60 * MS) == 0);     // same microsecond
+    CHECK(frame_trace_output(trace, 48 * MS + 999, 61 * MS) == -1);    // already out
+    frame_trace_end(trace, id);
+    frame_trace_get_stats(trace, &stats);
+    CHECK(stats.completed == 2);
+    CHECK(stats.decoded == 1);
+    CHECK(stats.histograms[FRAME_TRACE_END_TO_END].max_ns == 12 * MS - 123);
+    CHECK(stats.histograms[FRAME_TRACE_ARRIVAL].max_ns == 2 * MS - 123);
+
+    // Capture is an estimate and may land after arrival: counted as 0
+    id = frame_trace_begin(trace, 70 * MS);
+    frame_trace_mark(trace, id, FRAME_TRACE_CAPTURE, 70 * MS + 500);
+    frame_trace_end(trace, id);
+    frame_trace_get_stats(trace, &stats);
+    CHECK(stats.histograms[FRAME_TRACE_ARRIVAL].count == 2);
+    CHECK(stats.histograms[FRAME_TRACE_ARRIVAL].buckets[0] == 1);
+    frame_trace_destroy(trace);
+    printf("ring reuse: stale ids ignored, end defers to output\n");
+}
+
+static void test_buckets(void) {
+    frame_trace_histogram_t h;
+    int64_t prev = 0;
+
+    for (int b = 0; b < FRAME_TRACE_BUCKETS; b++) {
+        int64_t upper = frame_trace_bucket_upper_ns(b);
+        CHECK(upper > prev);
+        // Four buckets per octave past 4 us: each at most 25% wider than the last bound
+        if (b >= 4) CHECK(upper - prev <= prev / 4);
+        prev = upper;
+    }
+    CHECK(frame_trace_bucket_upper_ns(0) == 1 * US);
+    CHECK(frame_trace_bucket_upper_ns(FRAME_TRACE_BUCKETS - 1) >= 30000 * MS);
+
+    memset(&h, 0, sizeof(h));
+    CHECK(frame_trace_percentile(&h, 50) == 0);
+    h.buckets[10] = 99;
+    h.buckets[FRAME_TRACE_BUCKETS - 1] = 1;
+    h.max_ns = 40000 * MS;
+    CHECK(frame_trace_percentile(&h, 50) == frame_trace_bucket_upper_ns(10));
+    CHECK(frame_trace_percentile(&h, 99) == frame_trace_bucket_upper_ns(10));
+    CHECK(frame_trace_percentile(&h, 99.5) == 40000 * MS);     // open-ended last bucket: the max
+    CHECK(frame_trace_percentile(&h, 0) == frame_trace_bucket_upper_ns(10));
+    printf("buckets: %d, 1 us .. %.1f s\n", FRAME_TRACE_BUCKETS,
+           frame_trace_bucket_upper_ns(FRAME_TRACE_BUCKETS - 1) / 1e9);
+}
+
+static void test_json(const char *output) {
+    frame_trace_t *trace = frame_trace_create();
+    FILE *f = output != NULL ? fopen(output, "w+") : tmpfile();
+    long bad = 0, begins = 0, ends = 0, depth = 0, max_depth = 0;
+    int c, in_string = 0, written;
+
+    CHECK(f != NULL);
+    if (f == NULL) return;
+    for (uint32_t i = 1; i <= 100; i++) {
+        uint32_t id = frame_trace_begin(trace, stamp(i, FRAME_TRACE_ARRIVAL));
+        CHECK(id == i);
+        for (int s = FRAME_TRACE_CAPTURE; s <= FRAME_TRACE_INPUT; s++) {
+            if (s != FRAME_TRACE_ARRIVAL && stamp(id, s) != 0) frame_trace_mark(trace, id, s, stamp(id, s));
+        }
+        if (!DROPPED(id)) {
+            frame_trace_output(trace, stamp(id, FRAME_TRACE_CAPTURE), stamp(id, FRAME_TRACE_OUTPUT));
+        }
+        frame_trace_end(trace, id);
+    }
+    frame_trace_begin(trace, 5);            // in flight: not dumped
+    written = frame_trace_write_json(trace, f);
+    CHECK(written == 100);
+    fflush(f);
+    CHECK(check_dump(f, &bad) == 100);
+    CHECK(bad == 0);
+
+    rewind(f);
+    while ((c = fgetc(f)) != EOF) {
+        if (in_string) {
+            if (c == '"') in_string = 0;
+            continue;
+        }
+        if (c == '"') in_string = 1;
+        if (c == '{' || c == '[') depth++;
+        if (c == '}' || c == ']') depth--;
+        CHECK(depth >= 0);
+        if (depth > max_depth) max_depth = depth;
+    }
+    CHECK(depth == 0 && !in_string);
+    CHECK(max_depth == 4);                  // {"traceEvents":[{"args":{}}]}
+    char line[256];
+    rewind(f);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        begins += strstr(line, "\"ph\":\"b\"") != NULL;
+        ends += strstr(line, "\"ph\":\"e\"") != NULL;
+    }
+    // Per frame: the frame, then network, decrypt, queue, assemble (+ decoder input, decode)
+    CHECK(begins == ends);
+    CHECK(begins == 100 * 5 + (100 - 10) * 2);
+    fclose(f);
+    frame_trace_destroy(trace);
+    printf("json: %d frames, %ld slices%s%s\n", written, begins, output != NULL ? " -> " : "",
+           output != NULL ? output : "");
+}
+
+static void bench(long iterations) {
+    frame_trace_t *trace = frame_trace_create();
+    uint64_t start = now_ns();
+
+    for (long i = 0; i < iterations; i++) {
+        int64_t t = (int64_t)i * FRAME_NS + 1;
+        uint32_t id = frame_trace_begin(trace, t);
+        frame_trace_mark(trace, id, FRAME_TRACE_DECRYPTED, t + 1);
+        frame_trace_mark(trace, id, FRAME_TRACE_DEQUEUED, t + 2);
+        frame_trace_mark(trace, id, FRAME_TRACE_CAPTURE, t - 1000);
+        frame_trace_mark(trace, id, FRAME_TRACE_ASSEMBLED, t + 3);
+        frame_trace_mark(trace, id, FRAME_TRACE_INPUT, t + 4);
+        frame_trace_output(trace, t - 1000, t + 5);
+        frame_trace_end(trace, id);
+    }
+    double per_frame = (double)(now_ns() - start) / (double)iterations;
+    frame_trace_stats_t stats;
+    frame_trace_get_stats(trace, &stats);
+    CHECK(stats.decoded == (unsigned long long)iterations);
+    printf("cost: %.0f ns per traced frame (begin, 5 marks, output match, end, 7 histograms)\n", per_frame);
+    frame_trace_destroy(trace);
+}
+
+int main(int argc, char **argv) {
+    long frames = test_arg_long(argc, argv, "--frames", 20000);
+    long iterations = test_arg_long(argc, argv, "--iterations", 1000000);
+
+    test_buckets();
+    test_ring_reuse();
+    test_json(test_arg_str(argc, argv, "--output"));
+    test_pipeline(frames);
+    bench(iterations);
+    return test_failures();
+}
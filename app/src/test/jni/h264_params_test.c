@@ -0,0 +1,494 @@
+/**
+ * H.264 SPS / PPS parser: field round trips, change classification, and codec restarts over a session.
+ *
+ * Encodes SPSs with a bit writer (cropped 1080p, High profile with scaling
+ * lists, 4:4:4 10-bit, interlaced, VUI with timing, HRD and bitstream
+ * restriction, payloads that need emulation prevention bytes) and checks every
+ * field decodes back, plus a real x264 SPS / PPS. Then replays the
+ * parameter set changes of a mirroring session (keyframe refresh with new VUI
+ * timing, rotations, a level bump, a profile change) against the old policy of
+ * restarting the decoder on any byte change and the new one of restarting only
+ * for changes the running decoder cannot take, and fuzzes truncated and
+ * bit-flipped input (run under ASan to catch overreads).
+ *
+ *   h264_params_test [--iterations N] [--seed N]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "h264_params.h"
+#include "test_util.h"
+
+typedef struct {
+    unsigned char rbsp[256];
+    int bits;
+} bit_writer_t;
+
+typedef struct {
+    int profile_idc;
+    int level_idc;
+    int chroma_format_idc;
+    int bit_depth;
+    int scaling_lists;
+    int poc_type;
+    int max_ref_frames;
+    int width_mbs;
+    int height_map_units;
+    int frame_mbs_only;
+    int crop_right;
+    int crop_bottom;
+    int vui;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+    int hrd;
+    int max_reorder;
+} sps_spec_t;
+
+static void put_u(bit_writer_t *bw, uint32_t v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if ((v >> i) & 1) {
+            bw->rbsp[bw->bits / 8] |= (unsigned char)(0x80 >> (bw->bits % 8));
+        }
+        bw->bits++;
+    }
+}
+
+static void put_ue(bit_writer_t *bw, uint32_t v) {
+    int len = 0;
+    while ((v + 1) >> (len + 1)) {
+        len++;
+    }
+    put_u(bw, 0, len);
+    put_u(bw, v + 1, len + 1);
+}
+
+static void put_se(bit_writer_t *bw, int v) {
+    put_ue(bw, v > 0 ? (uint32_t)(2 * v - 1) : (uint32_t)(-2 * v));
+}
+
+// Trailing bits, then emulation prevention into nal (after the header byte); returns NAL length
+static int finish_nal(bit_writer_t *bw, unsigned char header, unsigned char *nal) {
+    int len = 1, zeros = 0;
+
+    put_u(bw, 1, 1);
+    nal[0] = header;
+    for (int i = 0; i < (bw->bits + 7) / 8; i++) {
+        if (zeros >= 2 && bw->rbsp[i] <= 3) {
+            nal[len++] = 3;
+            zeros = 0;
+        }
+        nal[len++] = bw->rbsp[i];
+        zeros = bw->rbsp[i] == 0 ? zeros + 1 : 0;
+    }
+    return len;
+}
+
+static int write_sps(const sps_spec_t *s, unsigned char *nal) {
+    bit_writer_t bw;
+
+    memset(&bw, 0, sizeof(bw));
+    put_u(&bw, (uint32_t)s->profile_idc, 8);
+    put_u(&bw, 0, 8);
+    put_u(&bw, (uint32_t)s->level_idc, 8);
+    put_ue(&bw, 0);
+    if (s->profile_idc >= 100) {
+        put_ue(&bw, (uint32_t)s->chroma_format_idc);
+        if (s->chroma_format_idc == 3) {
+            put_u(&bw, 0, 1);
+        }
+        put_ue(&bw, (uint32_t)s->bit_depth - 8);
+        put_ue(&bw, (uint32_t)s->bit_depth - 8);
+        put_u(&bw, 0, 1);
+        put_u(&bw, (uint32_t)s->scaling_lists, 1);
+        if (s->scaling_lists) {
+            int lists = s->chroma_format_idc == 3 ? 12 : 8;
+            for (int i = 0; i < lists; i++) {
+                put_u(&bw, 1, 1);
+                for (int j = 0; j < (i < 6 ? 16 : 64); j++) {
+                    put_se(&bw, j % 3 - 1);     // nonzero deltas so every coefficient is coded
+                }
+            }
+        }
+    }
+    put_ue(&bw, 4);                             // log2_max_frame_num - 4
+    put_ue(&bw, (uint32_t)s->poc_type);
+    if (s->poc_type == 0) {
+        put_ue(&bw, 2);
+    } else if (s->poc_type == 1) {
+        put_u(&bw, 0, 1);
+        put_se(&bw, -2);
+        put_se(&bw, 1);
+        put_ue(&bw, 2);
+        put_se(&bw, 2);
+        put_se(&bw, -1);
+    }
+    put_ue(&bw, (uint32_t)s->max_ref_frames);
+    put_u(&bw, 0, 1);
+    put_ue(&bw, (uint32_t)s->width_mbs - 1);
+    put_ue(&bw, (uint32_t)s->height_map_units - 1);
+    put_u(&bw, (uint32_t)s->frame_mbs_only, 1);
+    if (!s->frame_mbs_only) {
+        put_u(&bw, 1, 1);
+    }
+    put_u(&bw, 1, 1);
+    put_u(&bw, s->crop_right || s->crop_bottom, 1);
+    if (s->crop_right || s->crop_bottom) {
+        put_ue(&bw, 0);
+        put_ue(&bw, (uint32_t)s->crop_right);
+        put_ue(&bw, 0);
+        put_ue(&bw, (uint32_t)s->crop_bottom);
+    }
+    put_u(&bw, (uint32_t)s->vui, 1);
+    if (s->vui) {
+        put_u(&bw, 1, 1);                       // aspect ratio: 255 + explicit
+        put_u(&bw, 255, 8);
+        put_u(&bw, 4, 16);
+        put_u(&bw, 3, 16);
+        put_u(&bw, 0, 1);
+        put_u(&bw, 1, 1);                       // video signal type, full range, BT.709
+        put_u(&bw, 5, 3);
+        put_u(&bw, 1, 1);
+        put_u(&bw, 1, 1);
+        put_u(&bw, 1, 8);
+        put_u(&bw, 1, 8);
+        put_u(&bw, 1, 8);
+        put_u(&bw, 0, 1);
+        put_u(&bw, s->time_scale != 0, 1);
+        if (s->time_scale != 0) {
+            put_u(&bw, s->num_units_in_tick, 32);
+            put_u(&bw, s->time_scale, 32);
+            put_u(&bw, 1, 1);
+        }
+        for (int hrd = 0; hrd < 2; hrd++) {     // NAL then VCL HRD
+            put_u(&bw, (uint32_t)s->hrd, 1);
+            if (s->hrd) {
+                put_ue(&bw, 1);
+                put_u(&bw, 4, 4);
+                put_u(&bw, 6, 4);
+                for (int i = 0; i < 2; i++) {
+                    put_ue(&bw, 12000);
+                    put_ue(&bw, 30000);
+                    put_u(&bw, 0, 1);
+                }
+                put_u(&bw, 0x5a5a5, 20);
+            }
+        }
+        if (s->hrd) {
+            put_u(&bw, 0, 1);
+        }
+        put_u(&bw, 0, 1);
+        put_u(&bw, s->max_reorder >= 0, 1);
+        if (s->max_reorder >= 0) {
+            put_u(&bw, 1, 1);
+            put_ue(&bw, 2);
+            put_ue(&bw, 1);
+            put_ue(&bw, 16);
+            put_ue(&bw, 16);
+            put_ue(&bw, (uint32_t)s->max_reorder);
+            put_ue(&bw, (uint32_t)s->max_ref_frames);
+        }
+    }
+    return finish_nal(&bw, 0x67, nal);
+}
+
+static int write_pps(int cabac, int qp, unsigned char *nal) {
+    bit_writer_t bw;
+
+    memset(&bw, 0, sizeof(bw));
+    put_ue(&bw, 0);
+    put_ue(&bw, 0);
+    put_u(&bw, (uint32_t)cabac, 1);
+    put_u(&bw, 0, 1);
+    put_ue(&bw, 0);
+    put_ue(&bw, 2);
+    put_ue(&bw, 0);
+    put_u(&bw, 0, 1);
+    put_u(&bw, 0, 2);
+    put_se(&bw, qp - 26);
+    put_se(&bw, 0);
+    put_se(&bw, -2);
+    put_u(&bw, 1, 1);
+    put_u(&bw, 0, 1);
+    put_u(&bw, 0, 1);
+    return finish_nal(&bw, 0x68, nal);
+}
+
+static const sps_spec_t landscape_1080p = {
+    100, 42, 1, 8, 0, 0, 1, 120, 68, 1, 0, 4, 1, 1, 120, 0, 0,
+};
+
+static void test_round_trip(void) {
+    unsigned char nal[512];
+    h264_sps_t sps;
+    h264_pps_t pps;
+    int len;
+
+    // Cropped 1080p, High, VUI with timing + bitstream restriction
+    len = write_sps(&landscape_1080p, nal);
+    CHECK(h264_sps_parse(nal, len, &sps) == 0);
+    CHECK(sps.profile_idc == 100 && sps.level_idc == 42 && sps.chroma_format_idc == 1 && sps.bit_depth_luma == 8);
+    CHECK(sps.coded_width == 1920 && sps.coded_height == 1088 && sps.width == 1920 && sps.height == 1080);
+    CHECK(sps.log2_max_frame_num == 8 && sps.pic_order_cnt_type == 0 && sps.log2_max_poc_lsb == 6);
+    CHECK(sps.max_num_ref_frames == 1 && sps.frame_mbs_only == 1 && sps.crop_bottom == 4);
+    CHECK(sps.vui_present && sps.sar_width == 4 && sps.sar_height == 3 && sps.video_full_range == 1);
+    CHECK(sps.colour_primaries == 1 && sps.transfer_characteristics == 1 && sps.matrix_coefficients == 1);
+    CHECK(sps.num_units_in_tick == 1 && sps.time_scale == 120 && sps.fixed_frame_rate == 1);
+    CHECK(h264_sps_frame_rate(&sps) == 60.0);
+    CHECK(sps.max_num_reorder_frames == 0 && sps.max_dec_frame_buffering == 1);
+    // Level 4.2: MinCR 4
+    CHECK(h264_sps_max_input_size(&sps, 0, 0) == 1920 * 1088 * 3 / 8);
+    CHECK(h264_sps_max_input_size(&sps, 1920, 1920) == 1920 * 1920 * 3 / 8);
+
+    // High 4:4:4 10-bit with all twelve scaling lists, POC type 1, HRD, no cropping
+    sps_spec_t s444 = { 244, 51, 3, 10, 1, 1, 4, 80, 45, 1, 0, 0, 1, 1001, 60000, 1, 2 };
+    len = write_sps(&s444, nal);
+    CHECK(h264_sps_parse(nal, len, &sps) == 0);
+    CHECK(sps.profile_idc == 244 && sps.chroma_format_idc == 3 && sps.bit_depth_luma == 10 && sps.bit_depth_chroma == 10);
+    CHECK(sps.scaling_matrix_present && sps.pic_order_cnt_type == 1 && sps.max_num_ref_frames == 4);
+    CHECK(sps.width == 1280 && sps.height == 720);
+    CHECK(sps.num_units_in_tick == 1001 && sps.time_scale == 60000 && sps.max_num_reorder_frames == 2);
+    CHECK(h264_sps_max_input_size(&sps, 0, 0) == 1280 * 720 * 3 * 10 / 16);     // level 5.1: MinCR 2
+
+    // Interlaced (field pairs): map units are pairs of macroblock rows, crop units double
+    sps_spec_t field = { 77, 40, 1, 8, 0, 2, 2, 120, 34, 0, 0, 2, 0, 0, 0, 0, -1 };
+    len = write_sps(&field, nal);
+    CHECK(h264_sps_parse(nal, len, &sps) == 0);
+    CHECK(sps.frame_mbs_only == 0 && sps.mb_adaptive_frame_field == 1);
+    CHECK(sps.coded_height == 1088 && sps.height == 1080 && sps.width == 1920 && !sps.vui_present);
+    CHECK(sps.max_num_reorder_frames == -1 && sps.colour_primaries == 2);
+
+    // Right crop + zero runs in the payload: the writer had to insert emulation prevention bytes
+    sps_spec_t odd = { 66, 30, 1, 8, 0, 2, 1, 45, 80, 1, 4, 0, 1, 0, 0, 0, -1 };
+    odd.time_scale = 0x00000100;
+    odd.num_units_in_tick = 0x00000001;
+    len = write_sps(&odd, nal);
+    int escaped = 0;
+    for (int i = 2; i < len; i++) {
+        escaped += nal[i - 2] == 0 && nal[i - 1] == 0 && nal[i] == 3;
+    }
+    CHECK(escaped > 0);
+    CHECK(h264_sps_parse(nal, len, &sps) == 0);
+    CHECK(sps.width == 712 && sps.height == 1280 && sps.time_scale == 0x100 && sps.num_units_in_tick == 1);
+
+    len = write_pps(1, 30, nal);
+    CHECK(h264_pps_parse(nal, len, &pps) == 0);
+    CHECK(pps.entropy_coding_mode == 1 && pps.num_slice_groups == 1 && pps.num_ref_idx_l0_default == 3);
+    CHECK(pps.pic_init_qp == 30 && pps.chroma_qp_index_offset == -2 && pps.deblocking_filter_control_present == 1);
+
+    // Wrong NAL type / too short
+    CHECK(h264_sps_parse(nal, len, &sps) == -1);
+    CHECK(h264_pps_parse((const unsigned char *)"\x67", 1, &pps) == -1);
+}
+
+static void test_real_vectors(void) {
+    h264_sps_t sps;
+    h264_pps_t pps;
+
+    // x264, High 4.0, 1920x1080 cropped from 1088, 25 fps VUI timing
+    static const unsigned char x264_sps[] = {
+        0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0xc0, 0x44, 0x00, 0x00, 0x03,
+        0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xc8, 0x3c, 0x60, 0xc6, 0x58,
+    };
+    static const unsigned char x264_pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+    CHECK(h264_sps_parse(x264_sps, sizeof(x264_sps), &sps) == 0);
+    CHECK(sps.profile_idc == 100 && sps.level_idc == 40 && sps.width == 1920 && sps.height == 1080);
+    CHECK(sps.coded_height == 1088 && sps.num_units_in_tick == 1 && sps.time_scale == 50);
+    CHECK(h264_sps_frame_rate(&sps) == 25.0);
+    CHECK(h264_pps_parse(x264_pps, sizeof(x264_pps), &pps) == 0);
+    CHECK(pps.entropy_coding_mode == 1 && pps.sps_id == 0);
+
+}
+
+static void test_compare(void) {
+    unsigned char a[512], b[512];
+    h264_sps_t x, y;
+    sps_spec_t s = landscape_1080p;
+
+    write_sps(&s, a);
+    h264_sps_parse(a, write_sps(&s, a), &x);
+
+    // New VUI timing / HRD: different bytes, same decoder
+    s.time_scale = 60;
+    s.hrd = 1;
+    CHECK(h264_sps_parse(b, write_sps(&s, b), &y) == 0);
+    CHECK(h264_sps_compare(&x, &y) == H264_SPS_SAME);
+
+    // Rotation
+    s = landscape_1080p;
+    s.width_mbs = 68;
+    s.height_map_units = 120;
+    s.crop_bottom = 0;
+    s.crop_right = 4;
+    CHECK(h264_sps_parse(b, write_sps(&s, b), &y) == 0);
+    CHECK(y.width == 1080 && y.height == 1920);
+    CHECK(h264_sps_compare(&x, &y) == H264_SPS_RESOLUTION);
+
+    // More reference frames / level bump
+    s = landscape_1080p;
+    s.max_ref_frames = 3;
+    CHECK(h264_sps_parse(b, write_sps(&s, b), &y) == 0);
+    CHECK(h264_sps_compare(&x, &y) == H264_SPS_RESOLUTION);
+
+    // Profile, bit depth, field coding
+    s = landscape_1080p;
+    s.profile_idc = 77;
+    CHECK(h264_sps_parse(b, write_sps(&s, b), &y) == 0);
+    CHECK(h264_sps_compare(&x, &y) == H264_SPS_INCOMPATIBLE);
+    s = landscape_1080p;
+    s.bit_depth = 10;
+    CHECK(h264_sps_parse(b, write_sps(&s, b), &y) == 0);
+    CHECK(h264_sps_compare(&x, &y) == H264_SPS_INCOMPATIBLE);
+    s = landscape_1080p;
+    s.frame_mbs_only = 0;
+    s.height_map_units = 34;
+    CHECK(h264_sps_parse(b, write_sps(&s, b), &y) == 0);
+    CHECK(h264_sps_compare(&x, &y) == H264_SPS_INCOMPATIBLE);
+}
+
+// A decoder configured from one SPS; with adaptive playback it takes sizes up to a square of the longer side
+typedef struct {
+    h264_sps_t sps;
+    unsigned char bytes[512];
+    int len;
+    int max_side;
+    int restarts;
+} decoder_model_t;
+
+static void configure(decoder_model_t *d, const unsigned char *nal, int len) {
+    memcpy(d->bytes, nal, (size_t)len);
+    d->len = len;
+    h264_sps_parse(nal, len, &d->sps);
+    d->max_side = d->sps.coded_width > d->sps.coded_height ? d->sps.coded_width : d->sps.coded_height;
+}
+
+static void apply_old(decoder_model_t *d, const unsigned char *nal, int len) {
+    if (len != d->len || memcmp(nal, d->bytes, (size_t)len) != 0) {
+        d->restarts++;
+        configure(d, nal, len);
+    }
+}
+
+static void apply_new(decoder_model_t *d, const unsigned char *nal, int len) {
+    h264_sps_t next;
+
+    if (len == d->len && memcmp(nal, d->bytes, (size_t)len) == 0) {
+        return;
+    }
+    if (h264_sps_parse(nal, len, &next) == 0) {
+        int change = h264_sps_compare(&d->sps, &next);
+        if (change == H264_SPS_SAME ||
+            (change == H264_SPS_RESOLUTION && next.coded_width <= d->max_side && next.coded_height <= d->max_side)) {
+            memcpy(d->bytes, nal, (size_t)len);
+            d->len = len;
+            d->sps = next;
+            return;
+        }
+    }
+    d->restarts++;
+    configure(d, nal, len);
+}
+
+static void test_session(void) {
+    unsigned char nal[512];
+    sps_spec_t landscape = landscape_1080p, portrait = landscape_1080p, refresh = landscape_1080p;
+    sps_spec_t baseline = landscape_1080p;
+    decoder_model_t old_policy, new_policy;
+    int len, expected_old = 0;
+
+    portrait.width_mbs = 68;
+    portrait.height_map_units = 120;
+    portrait.crop_bottom = 0;
+    portrait.crop_right = 4;
+    refresh.time_scale = 60;            // sender drops to 30 fps timing on a keyframe refresh
+    baseline.profile_idc = 66;
+
+    // Every keyframe carries an SPS; rotate every 20, VUI flips on refreshes, one profile change at the end
+    len = write_sps(&landscape, nal);
+    configure(&old_policy, nal, len);
+    configure(&new_policy, nal, len);
+    old_policy.restarts = new_policy.restarts = 0;
+    const sps_spec_t *previous = &landscape;
+    for (int keyframe = 1; keyframe <= 120; keyframe++) {
+        const sps_spec_t *spec;
+        if (keyframe == 120) {
+            spec = &baseline;
+        } else if ((keyframe / 20) % 2 == 1) {
+            spec = &portrait;
+        } else {
+            spec = keyframe % 7 == 0 ? &refresh : &landscape;
+        }
+        expected_old += spec != previous;
+        previous = spec;
+        len = write_sps(spec, nal);
+        apply_old(&old_policy, nal, len);
+        apply_new(&new_policy, nal, len);
+    }
+    printf("session of 120 keyframes: %d decoder restarts restarting on any byte change, %d with compare\n",
+           old_policy.restarts, new_policy.restarts);
+    CHECK(old_policy.restarts == expected_old);
+    CHECK(new_policy.restarts == 1);
+}
+
+static void test_fuzz(long iterations, uint64_t seed) {
+    unsigned char good[512], nal[512];
+    h264_sps_t sps;
+    h264_pps_t pps;
+    sps_spec_t s444 = { 244, 51, 3, 10, 1, 1, 4, 80, 45, 1, 0, 0, 1, 1001, 60000, 1, 2 };
+    int good_len = write_sps(&s444, good);
+    long parsed = 0;
+
+    // Every truncation fails cleanly or still yields a sane picture
+    for (int len = 0; len < good_len; len++) {
+        if (h264_sps_parse(good, len, &sps) == 0) {
+            CHECK(sps.width > 0 && sps.height > 0 && sps.width <= 16384 && sps.height <= 16384);
+        }
+    }
+    for (long i = 0; i < iterations; i++) {
+        int len = 2 + (int)(test_rand(&seed) % (uint64_t)good_len);
+        memcpy(nal, good, (size_t)good_len);
+        for (int flips = 1 + (int)(test_rand(&seed) % 4); flips > 0; flips--) {
+            nal[1 + test_rand(&seed) % (uint64_t)(len - 1)] ^= (unsigned char)(1 << (test_rand(&seed) % 8));
+        }
+        if (i % 4 == 0) {
+            test_fill_random(&seed, nal + 1, (size_t)len - 1);
+        }
+        if (h264_sps_parse(nal, len, &sps) == 0) {
+            parsed++;
+            CHECK(sps.width > 0 && sps.height > 0 && sps.width <= 16384 && sps.height <= 16384);
+            CHECK(sps.chroma_format_idc <= 3 && sps.max_num_ref_frames <= 16);
+            CHECK(h264_sps_max_input_size(&sps, 0, 0) > 0);
+        }
+        nal[0] = 0x68;
+        h264_pps_parse(nal, len, &pps);
+    }
+    printf("fuzz: %ld mutated SPSs, %ld still parsed\n", iterations, parsed);
+}
+
+static void bench(long iterations) {
+    unsigned char nal[512];
+    h264_sps_t sps;
+    int len = write_sps(&landscape_1080p, nal);
+    volatile int sink = 0;
+
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        h264_sps_parse(nal, len, &sps);
+        sink += sps.width;
+    }
+    printf("parse: %.0f ns per %d-byte SPS\n", (double)(now_ns() - t0) / (double)iterations, len);
+}
+
+int main(int argc, char **argv) {
+    long iterations = test_arg_long(argc, argv, "--iterations", 200000);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 0x5eed);
+
+    test_round_trip();
+    test_real_vectors();
+    test_compare();
+    test_session();
+    test_fuzz(iterations, seed);
+    bench(iterations);
+
+    return test_failures();
+}
@@ -0,0 +1,413 @@
+/**
+ * HEVC mirror stream path: hvcC config parsing, SPS decoding, NAL classification and Annex-B assembly.
+ *
+ * Parses an hvcC record built from x265 1080p Main parameter sets, bare and
+ * wrapped in an 'hvcC' box, and checks avcC records and malformed arrays are
+ * rejected. Decodes the x265 SPS and bit-written SPSs (4:2:2 10-bit with a
+ * conformance window, three temporal sub-layers with sub-layer profile/level)
+ * and classifies SPS changes. Then replays a mirror session through the
+ * access-unit assembler in HEVC mode: IDR with in-band VPS/SPS/PPS and SEI,
+ * reference and non-reference trailing pictures, a CRA refresh, and a
+ * corrupt length, checking every frame's flags, parameter set positions and
+ * the in-place length-to-start-code rewrite. Ends with a fuzz pass over the
+ * record and SPS parsers (run under ASan to catch overreads) and parse timings.
+ *
+ * No captured HEVC mirror session is in the tree; the stream uses x265's
+ * parameter sets with synthesized slice payloads, which the assembler treats
+ * as opaque.
+ *
+ *   hevc_params_test [--iterations N] [--seed N]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "access_unit.h"
+#include "hevc_params.h"
+#include "test_util.h"
+
+// x265 --preset medium, 1920x1080 Main, level 4
+static const unsigned char x265_vps[] = {
+    0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03,
+    0x00, 0x00, 0x03, 0x00, 0x78, 0x95, 0x98, 0x09,
+};
+static const unsigned char x265_sps[] = {
+    0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+    0x00, 0x78, 0xa0, 0x03, 0xc0, 0x80, 0x10, 0xe5, 0x96, 0x66, 0x69, 0x24, 0xca, 0xe0, 0x10, 0x00,
+    0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x01, 0xe0, 0x80,
+};
+static const unsigned char x265_pps[] = { 0x44, 0x01, 0xc1, 0x72, 0xb4, 0x62, 0x40 };
+
+typedef struct {
+    unsigned char rbsp[256];
+    int bits;
+} bit_writer_t;
+
+static void put_u(bit_writer_t *bw, uint32_t v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if ((v >> i) & 1) {
+            bw->rbsp[bw->bits / 8] |= (unsigned char)(0x80 >> (bw->bits % 8));
+        }
+        bw->bits++;
+    }
+}
+
+static void put_ue(bit_writer_t *bw, uint32_t v) {
+    int len = 0;
+    while ((v + 1) >> (len + 1)) {
+        len++;
+    }
+    put_u(bw, 0, len);
+    put_u(bw, v + 1, len + 1);
+}
+
+// 2-byte SPS header, trailing bits and emulation prevention; returns the NAL length
+static int finish_sps(bit_writer_t *bw, unsigned char *nal) {
+    int len = 2, zeros = 0;
+
+    put_u(bw, 1, 1);
+    nal[0] = HEVC_NAL_SPS << 1;
+    nal[1] = 1;
+    for (int i = 0; i < (bw->bits + 7) / 8; i++) {
+        if (zeros >= 2 && bw->rbsp[i] <= 3) {
+            nal[len++] = 3;
+            zeros = 0;
+        }
+        nal[len++] = bw->rbsp[i];
+        zeros = bw->rbsp[i] == 0 ? zeros + 1 : 0;
+    }
+    return len;
+}
+
+static int write_sps(int profile, int sub_layers, int chroma, int bit_depth, int width, int height,
+                     int crop_right, int crop_bottom, unsigned char *nal) {
+    bit_writer_t bw;
+
+    memset(&bw, 0, sizeof(bw));
+    put_u(&bw, 0, 4);                   // vps id
+    put_u(&bw, (uint32_t)sub_layers - 1, 3);
+    put_u(&bw, 1, 1);
+    put_u(&bw, (uint32_t)profile, 8);   // space 0, tier 0, profile_idc
+    put_u(&bw, 0x60000000, 32);
+    put_u(&bw, 0x900000, 24);
+    put_u(&bw, 0, 24);
+    put_u(&bw, 123, 8);                 // level 4.1
+    for (int i = 0; i < sub_layers - 1; i++) {
+        put_u(&bw, 1, 1);
+        put_u(&bw, 1, 1);
+    }
+    if (sub_layers > 1) {
+        put_u(&bw, 0, 2 * (8 - (sub_layers - 1)));
+    }
+    for (int i = 0; i < sub_layers - 1; i++) {
+        put_u(&bw, 0xffffffff, 32);     // sub-layer profile: set bits must not leak into the SPS fields
+        put_u(&bw, 0xffffffff, 32);
+        put_u(&bw, 0xffffff, 24);
+        put_u(&bw, 90, 8);
+    }
+    put_ue(&bw, 0);                     // sps id
+    put_ue(&bw, (uint32_t)chroma);
+    if (chroma == 3) {
+        put_u(&bw, 0, 1);
+    }
+    put_ue(&bw, (uint32_t)width);
+    put_ue(&bw, (uint32_t)height);
+    put_u(&bw, crop_right || crop_bottom, 1);
+    if (crop_right || crop_bottom) {
+        put_ue(&bw, 0);
+        put_ue(&bw, (uint32_t)crop_right);
+        put_ue(&bw, 0);
+        put_ue(&bw, (uint32_t)crop_bottom);
+    }
+    put_ue(&bw, (uint32_t)bit_depth - 8);
+    put_ue(&bw, (uint32_t)bit_depth - 8);
+    put_ue(&bw, 4);                     // log2_max_poc_lsb - 4
+    put_u(&bw, 1, 1);
+    for (int i = 0; i < sub_layers; i++) {
+        put_ue(&bw, (uint32_t)(2 + i));
+        put_ue(&bw, (uint32_t)i);
+        put_ue(&bw, 0);
+    }
+    put_ue(&bw, 0);                     // log2_min_luma_coding_block_size - 3: ignored from here on
+    return finish_sps(&bw, nal);
+}
+
+static int put_array(unsigned char *out, int type, const unsigned char *nal, int len) {
+    out[0] = (unsigned char)(0x80 | type);
+    out[1] = 0;
+    out[2] = 1;
+    out[3] = (unsigned char)(len >> 8);
+    out[4] = (unsigned char)len;
+    memcpy(out + 5, nal, (size_t)len);
+    return 5 + len;
+}
+
+// hvcC record for the x265 parameter sets
+static int write_hvcc(unsigned char *out) {
+    static const unsigned char header[23] = {
+        0x01, 0x01, 0x60, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x78,
+        0xf0, 0x00, 0xfc, 0xfd, 0xf8, 0xf8, 0x00, 0x00, 0x0f, 0x03,
+    };
+    int n = sizeof(header);
+
+    memcpy(out, header, sizeof(header));
+    n += put_array(out + n, HEVC_NAL_VPS, x265_vps, sizeof(x265_vps));
+    n += put_array(out + n, HEVC_NAL_SPS, x265_sps, sizeof(x265_sps));
+    n += put_array(out + n, HEVC_NAL_PPS, x265_pps, sizeof(x265_pps));
+    return n;
+}
+
+static void test_config(void) {
+    unsigned char rec[256], boxed[512];
+    hevc_config_t cfg;
+    int len = write_hvcc(rec);
+
+    CHECK(hevc_config_parse(rec, len, &cfg) == 0);
+    CHECK(cfg.profile_idc == 1 && cfg.level_idc == 120 && cfg.chroma_format_idc == 1 && cfg.bit_depth_luma == 8);
+    CHECK(cfg.nal_length_size == 4 && cfg.temporal_layers == 1);
+    CHECK(cfg.vps_count == 1 && cfg.sps_count == 1 && cfg.pps_count == 1);
+    CHECK(cfg.vps_len == sizeof(x265_vps) && memcmp(rec + cfg.vps_off, x265_vps, sizeof(x265_vps)) == 0);
+    CHECK(cfg.sps_len == sizeof(x265_sps) && memcmp(rec + cfg.sps_off, x265_sps, sizeof(x265_sps)) == 0);
+    CHECK(cfg.pps_len == sizeof(x265_pps) && memcmp(rec + cfg.pps_off, x265_pps, sizeof(x265_pps)) == 0);
+    CHECK(cfg.record_off == 0 && cfg.record_len == len);
+
+    // Inside a sample entry: [size]['hvcC'][record], offsets stay relative to the whole payload
+    memset(boxed, 0, sizeof(boxed));
+    memcpy(boxed + 8, "hvc1", 4);
+    boxed[40] = 0;
+    boxed[41] = 0;
+    boxed[42] = (unsigned char)((len + 8) >> 8);
+    boxed[43] = (unsigned char)(len + 8);
+    memcpy(boxed + 44, "hvcC", 4);
+    memcpy(boxed + 48, rec, (size_t)len);
+    CHECK(hevc_config_parse(boxed, 48 + len + 16, &cfg) == 0);
+    CHECK(cfg.sps_off == 48 + 23 + 5 + (int)sizeof(x265_vps) + 5);
+    CHECK(memcmp(boxed + cfg.sps_off, x265_sps, sizeof(x265_sps)) == 0);
+    CHECK(cfg.record_off == 48 && cfg.record_len == len);
+
+    // The avcC record mirror senders send for H.264 is not hvcC
+    static const unsigned char avcc[] = {
+        0x01, 0x64, 0x00, 0x28, 0xff, 0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x28, 0x01, 0x00, 0x04, 0x68, 0xeb, 0xe3, 0xcb,
+    };
+    CHECK(hevc_config_parse(avcc, sizeof(avcc), &cfg) == -1);
+
+    // Truncated, a VCL type in an array, a NAL header that does not match its array, no PPS
+    for (int cut = 0; cut < len; cut++) {
+        CHECK(hevc_config_parse(rec, cut, &cfg) == -1);
+    }
+    unsigned char bad[256];
+    memcpy(bad, rec, (size_t)len);
+    bad[23] = 0x80 | 19;
+    CHECK(hevc_config_parse(bad, len, &cfg) == -1);
+    memcpy(bad, rec, (size_t)len);
+    bad[23 + 5] = HEVC_NAL_SPS << 1;
+    CHECK(hevc_config_parse(bad, len, &cfg) == -1);
+    memcpy(bad, rec, (size_t)len);
+    bad[22] = 2;
+    CHECK(hevc_config_parse(bad, len - 5 - (int)sizeof(x265_pps), &cfg) == -1);
+}
+
+static void test_sps(void) {
+    unsigned char nal[512];
+    hevc_sps_t sps, other;
+    int len;
+
+    CHECK(hevc_sps_parse(x265_sps, sizeof(x265_sps), &sps) == 0);
+    CHECK(sps.profile_idc == 1 && sps.level_idc == 120 && sps.max_sub_layers == 1 && sps.chroma_format_idc == 1);
+    CHECK(sps.width == 1920 && sps.height == 1080 && sps.coded_width == 1920 && sps.coded_height == 1080);
+    CHECK(sps.bit_depth_luma == 8 && sps.log2_max_poc_lsb == 8);
+    CHECK(sps.max_dec_pic_buffering == 6 && sps.max_num_reorder_pics == 2);
+    CHECK(hevc_sps_max_input_size(&sps, 0, 0) == 1920 * 1088 * 3 / 8);     // level 4: MinCr 4
+
+    // 4:2:2 10-bit, 1088 coded rows cropped to 1080 (chroma rows are full height: crop units of 1)
+    len = write_sps(4, 1, 2, 10, 1920, 1088, 0, 8, nal);
+    CHECK(hevc_sps_parse(nal, len, &sps) == 0);
+    CHECK(sps.profile_idc == 4 && sps.chroma_format_idc == 2 && sps.bit_depth_luma == 10 && sps.bit_depth_chroma == 10);
+    CHECK(sps.width == 1920 && sps.height == 1080 && sps.coded_height == 1088);
+
+    // Three sub-layers with sub-layer profile and level: the highest layer's DPB size wins
+    len = write_sps(1, 3, 1, 8, 1280, 720, 0, 0, nal);
+    CHECK(hevc_sps_parse(nal, len, &sps) == 0);
+    CHECK(sps.max_sub_layers == 3 && sps.level_idc == 123 && sps.width == 1280 && sps.height == 720);
+    CHECK(sps.max_dec_pic_buffering == 5 && sps.max_num_reorder_pics == 2);
+
+    // Classification: rotation, profile change, same stream
+    len = write_sps(1, 1, 1, 8, 1920, 1080, 0, 0, nal);
+    CHECK(hevc_sps_parse(nal, len, &sps) == 0);
+    CHECK(hevc_sps_parse(nal, write_sps(1, 1, 1, 8, 1080, 1920, 0, 0, nal), &other) == 0);
+    CHECK(hevc_sps_compare(&sps, &other) == HEVC_SPS_RESOLUTION);
+    CHECK(hevc_sps_parse(nal, write_sps(2, 1, 1, 10, 1920, 1080, 0, 0, nal), &other) == 0);
+    CHECK(hevc_sps_compare(&sps, &other) == HEVC_SPS_INCOMPATIBLE);
+    CHECK(hevc_sps_parse(nal, write_sps(1, 1, 1, 8, 1920, 1080, 0, 0, nal), &other) == 0);
+    CHECK(hevc_sps_compare(&sps, &other) == HEVC_SPS_SAME);
+
+    // Not an SPS, crop swallowing the picture
+    CHECK(hevc_sps_parse(x265_pps, sizeof(x265_pps), &sps) == -1);
+    len = write_sps(1, 1, 1, 8, 64, 64, 0, 32, nal);
+    CHECK(hevc_sps_parse(nal, len, &sps) == -1);
+}
+
+typedef struct {
+    unsigned char data[4096];
+    int len;
+} packet_t;
+
+static void add_nal(packet_t *p, int type, const unsigned char *body, int body_len, int payload_len) {
+    int nal_len = body ? body_len : payload_len;
+
+    p->data[p->len] = (unsigned char)(nal_len >> 24);
+    p->data[p->len + 1] = (unsigned char)(nal_len >> 16);
+    p->data[p->len + 2] = (unsigned char)(nal_len >> 8);
+    p->data[p->len + 3] = (unsigned char)nal_len;
+    if (body) {
+        memcpy(p->data + p->len + 4, body, (size_t)body_len);
+    } else {
+        for (int i = 0; i < payload_len; i++) {
+            p->data[p->len + 4 + i] = (unsigned char)(0x11 * (i + 1));
+        }
+        p->data[p->len + 4] = (unsigned char)(type << 1);
+        p->data[p->len + 5] = 1;        // nuh_temporal_id_plus1
+    }
+    p->len += 4 + nal_len;
+}
+
+static void test_stream(void) {
+    static const unsigned char sei[] = { 0x4e, 0x01, 0x05, 0x01, 0x80 };
+    access_unit_assembler_t a;
+    access_unit_t au;
+    packet_t p;
+    int keyframes = 0, references = 0, pictures = 0;
+
+    access_unit_assembler_init(&a);
+    access_unit_assembler_set_codec(&a, ACCESS_UNIT_CODEC_HEVC);
+
+    // 60 frames: IDR with parameter sets, then TRAIL_R / TRAIL_N alternating, CRA refresh at 30
+    for (int frame = 0; frame < 60; frame++) {
+        int type, expected = ACCESS_UNIT_PICTURE;
+
+        memset(&p, 0, sizeof(p));
+        if (frame == 0) {
+            add_nal(&p, HEVC_NAL_VPS, x265_vps, sizeof(x265_vps), 0);
+            add_nal(&p, HEVC_NAL_SPS, x265_sps, sizeof(x265_sps), 0);
+            add_nal(&p, HEVC_NAL_PPS, x265_pps, sizeof(x265_pps), 0);
+            add_nal(&p, 39, sei, sizeof(sei), 0);
+            type = HEVC_NAL_IDR_W_RADL;
+            expected |= ACCESS_UNIT_PARAMETER_SETS | ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_REFERENCE;
+        } else if (frame == 30) {
+            type = HEVC_NAL_CRA;
+            expected |= ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_REFERENCE;
+        } else if (frame % 2) {
+            type = 1;                   // TRAIL_R
+            expected |= ACCESS_UNIT_REFERENCE;
+        } else {
+            type = 0;                   // TRAIL_N
+        }
+        add_nal(&p, type, NULL, 0, frame == 0 ? 2000 : 300);
+        add_nal(&p, type, NULL, 0, 200);    // second slice segment
+
+        int n = access_unit_assemble(&a, p.data, p.len, (uint64_t)frame << 26, frame * 16666667LL, &au);
+        CHECK(n == p.len && au.flags == expected);
+        CHECK(au.nal_count == (frame == 0 ? 6 : 2));
+        CHECK(au.nal_types & (1ull << type));
+        if (frame == 0) {
+            CHECK(au.nal_types == (1ull << 32 | 1ull << 33 | 1ull << 34 | 1ull << 39 | 1ull << 19));
+            CHECK(au.vps_len == sizeof(x265_vps) && memcmp(p.data + au.vps_off, x265_vps, sizeof(x265_vps)) == 0);
+            CHECK(au.sps_len == sizeof(x265_sps) && memcmp(p.data + au.sps_off, x265_sps, sizeof(x265_sps)) == 0);
+            CHECK(au.pps_len == sizeof(x265_pps) && memcmp(p.data + au.pps_off, x265_pps, sizeof(x265_pps)) == 0);
+            CHECK(memcmp(p.data, "\0\0\0\1\x40\x01", 6) == 0);
+            CHECK(memcmp(p.data + au.sps_off - 4, "\0\0\0\1", 4) == 0);
+        }
+        keyframes += (au.flags & ACCESS_UNIT_KEYFRAME) != 0;
+        references += (au.flags & ACCESS_UNIT_REFERENCE) != 0;
+        pictures += (au.flags & ACCESS_UNIT_PICTURE) != 0;
+    }
+    CHECK(a.units == 60 && a.keyframes == 2 && keyframes == 2 && pictures == 60 && references == 32);
+
+    // Corrupt second length: the first NAL unit survives, a 1-byte NAL unit cannot hold an HEVC header
+    memset(&p, 0, sizeof(p));
+    add_nal(&p, 1, NULL, 0, 100);
+    add_nal(&p, 1, NULL, 0, 100);
+    p.data[104 + 3] = 0xff;
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == 104 && (au.flags & ACCESS_UNIT_TRUNCATED));
+    memset(&p, 0, sizeof(p));
+    p.data[3] = 1;
+    p.data[4] = 0x02;
+    p.len = 5;
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == -1);
+
+    // The same bytes read as H.264 classify differently: the codec switch is what makes HEVC work
+    memset(&p, 0, sizeof(p));
+    add_nal(&p, HEVC_NAL_IDR_W_RADL, NULL, 0, 100);
+    access_unit_assembler_set_codec(&a, ACCESS_UNIT_CODEC_H264);
+    CHECK(access_unit_assemble(&a, p.data, p.len, 0, 0, &au) == p.len && !(au.flags & ACCESS_UNIT_KEYFRAME));
+    printf("hevc stream: 60 frames, %d keyframes, %d reference pictures\n", keyframes, references);
+}
+
+static void test_fuzz(long iterations, uint64_t seed) {
+    unsigned char rec[256], buf[256];
+    hevc_config_t cfg;
+    hevc_sps_t sps;
+    int len = write_hvcc(rec);
+    long configs = 0, spss = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        int n = 1 + (int)(test_rand(&seed) % (uint64_t)len);
+        memcpy(buf, rec, (size_t)len);
+        for (int flips = 1 + (int)(test_rand(&seed) % 4); flips > 0; flips--) {
+            buf[test_rand(&seed) % (uint64_t)n] ^= (unsigned char)(1 << (test_rand(&seed) % 8));
+        }
+        if (hevc_config_parse(buf, n, &cfg) == 0) {
+            configs++;
+            CHECK(cfg.sps_off + cfg.sps_len <= n && cfg.pps_off + cfg.pps_len <= n && cfg.vps_off + cfg.vps_len <= n);
+        }
+
+        n = 3 + (int)(test_rand(&seed) % (sizeof(x265_sps) - 2));
+        memcpy(buf, x265_sps, sizeof(x265_sps));
+        if (i % 3 == 0) {
+            test_fill_random(&seed, buf + 2, (size_t)n - 2);
+        } else {
+            buf[2 + test_rand(&seed) % (uint64_t)(n - 2)] ^= (unsigned char)(1 << (test_rand(&seed) % 8));
+        }
+        if (hevc_sps_parse(buf, n, &sps) == 0) {
+            spss++;
+            CHECK(sps.width > 0 && sps.height > 0 && sps.width <= sps.coded_width && sps.height <= sps.coded_height);
+            CHECK(hevc_sps_max_input_size(&sps, 0, 0) > 0);
+        }
+    }
+    printf("fuzz: %ld mutations, %ld records and %ld SPSs still parsed\n", iterations, configs, spss);
+}
+
+static void bench(long iterations) {
+    unsigned char rec[256];
+    hevc_config_t cfg;
+    hevc_sps_t sps;
+    int len = write_hvcc(rec);
+    volatile int sink = 0;
+
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        hevc_config_parse(rec, len, &cfg);
+        sink += cfg.sps_len;
+    }
+    uint64_t t1 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        hevc_sps_parse(x265_sps, sizeof(x265_sps), &sps);
+        sink += sps.width;
+    }
+    uint64_t t2 = now_ns();
+    printf("parse: hvcC %.0f ns, SPS %.0f ns\n", (double)(t1 - t0) / (double)iterations,
+           (double)(t2 - t1) / (double)iterations);
+}
+
+int main(int argc, char **argv) {
+    long iterations = test_arg_long(argc, argv, "--iterations", 200000);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 0x5eed);
+
+    test_config();
+    test_sps();
+    test_stream();
+    test_fuzz(iterations, seed);
+    bench(iterations);
+
+    return test_failures();
+}
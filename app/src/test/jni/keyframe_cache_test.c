@@ -0,0 +1,391 @@
+/**
+ * Keyframe cache: replay into a restarted decoder, caps, counters and cost.
+ *
+ * A synthetic 60 fps stream (long groups of pictures, as mirror senders send
+ * them, with every third frame non-reference) runs through the cache and a
+ * mock decoder that tracks its reference state: a frame decodes cleanly only
+ * if it is a keyframe or the reference frame it predicts from was decoded
+ * cleanly by the same decoder instance. The decoder is restarted at random
+ * points. With the cache, the replay rebuilds the references, the newest
+ * cached picture is shown at once and every live frame after it decodes
+ * cleanly; without it, nothing valid is shown until the next keyframe. Then
+ * the direct checks: non-reference frames are not cached, a group over the
+ * byte or frame cap is a miss until the next keyframe, clear and sink aborts
+ * are counted, and memory never exceeds the cap. Last, the copy cost per
+ * cached frame and the time to replay a full group.
+ *
+ *   keyframe_cache_test [--seconds N] [--gop N] [--restarts N] [--seed N]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "access_unit.h"
+#include "keyframe_cache.h"
+#include "test_util.h"
+
+#define MAX_FRAME_BYTES (256 * 1024)
+#define FRAME_NS 16666667ll             // 60 fps
+#define HEADER_BYTES 16                 // start code, id, reference it predicts from
+
+typedef struct {
+    int id;
+    int dep;                            // reference frame this one predicts from, -1 for keyframes
+    int flags;
+    int len;
+} stream_frame_t;
+
+// Mock MediaCodec: reference state of one decoder instance
+typedef struct {
+    int last_ref;                       // newest reference frame decoded cleanly, -1 none
+    int shown;                          // newest frame rendered, -1 none
+    unsigned long long clean;
+    unsigned long long corrupt;         // decoded against a reference it never had
+    unsigned long long hidden;          // decode-only
+    int replay_count;
+    int replay_abort_after;             // sink stops after this many frames, -1 never
+    unsigned long long bad_flags;
+} mock_decoder_t;
+
+static unsigned char g_frame[MAX_FRAME_BYTES];
+
+static void make_frame(const stream_frame_t *f, unsigned char *buf) {
+    memset(buf, 0x5a, (size_t)f->len);
+    buf[0] = 0;
+    buf[1] = 0;
+    buf[2] = 0;
+    buf[3] = 1;
+    memcpy(buf + 4, &f->id, sizeof(int));
+    memcpy(buf + 8, &f->dep, sizeof(int));
+}
+
+static void decoder_reset(mock_decoder_t *dec) {
+    memset(dec, 0, sizeof(*dec));
+    dec->last_ref = -1;
+    dec->shown = -1;
+    dec->replay_abort_after = -1;
+}
+
+// Returns 1 when the frame decoded cleanly
+static int decoder_input(mock_decoder_t *dec, const unsigned char *data, int flags, int render) {
+    int id, dep;
+
+    memcpy(&id, data + 4, sizeof(int));
+    memcpy(&dep, data + 8, sizeof(int));
+    if ((flags & ACCESS_UNIT_KEYFRAME) || (dep >= 0 && dep == dec->last_ref)) {
+        dec->clean++;
+        if (flags & ACCESS_UNIT_REFERENCE) {
+            dec->last_ref = id;
+        }
+        if (render) {
+            dec->shown = id;
+        } else {
+            dec->hidden++;
+        }
+        return 1;
+    }
+    // Real decoders conceal and show garbage here; the receiver has nothing valid to show
+    dec->corrupt++;
+    return 0;
+}
+
+static int decoder_sink(void *ctx, const keyframe_frame_t *frame, int decode_only) {
+    mock_decoder_t *dec = ctx;
+
+    if (dec->replay_abort_after >= 0 && dec->replay_count >= dec->replay_abort_after) {
+        return 1;
+    }
+    if (!(frame->flags & ACCESS_UNIT_REFERENCE) && !(frame->flags & ACCESS_UNIT_KEYFRAME)) {
+        dec->bad_flags++;
+    }
+    decoder_input(dec, frame->data, frame->flags, !decode_only);
+    dec->replay_count++;
+    return 0;
+}
+
+// Keyframe every gop frames, every third frame non-reference, sizes around typical mirror bitrates
+static int build_stream(stream_frame_t *frames, int count, int gop, uint64_t *rng) {
+    int last_ref = -1;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        stream_frame_t *f = &frames[i];
+
+        f->id = i;
+        if (i % gop == 0) {
+            f->flags = ACCESS_UNIT_PICTURE | ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_PARAMETER_SETS | ACCESS_UNIT_REFERENCE;
+            f->dep = -1;
+            f->len = 120 * 1024 + (int)(test_rand(rng) % (64 * 1024));
+        } else {
+            f->flags = ACCESS_UNIT_PICTURE | (i % 3 == 2 ? 0 : ACCESS_UNIT_REFERENCE);
+            f->dep = last_ref;
+            f->len = HEADER_BYTES + 4 * 1024 + (int)(test_rand(rng) % (24 * 1024));
+        }
+        if (f->flags & ACCESS_UNIT_REFERENCE) {
+            last_ref = i;
+        }
+    }
+    return last_ref;
+}
+
+typedef struct {
+    unsigned long long restarts;
+    unsigned long long replayed;
+    unsigned long long black_frames;    // live frames with nothing valid shown after a restart
+    unsigned long long corrupt;
+    unsigned long long stale_pictures;  // shown picture after replay older than the newest reference
+} session_result_t;
+
+// Run the stream, restarting the decoder before each frame flagged in restart[]
+static void run_session(const stream_frame_t *frames, int count, const int *restart, keyframe_cache_t *cache,
+                        session_result_t *res) {
+    mock_decoder_t dec;
+    int newest_ref = -1;
+    int waiting = 0;
+    int clean, i;
+
+    memset(res, 0, sizeof(*res));
+    decoder_reset(&dec);
+    for (i = 0; i < count; i++) {
+        const stream_frame_t *f = &frames[i];
+
+        make_frame(f, g_frame);
+        if (restart[i]) {
+            res->restarts++;
+            res->corrupt += dec.corrupt;
+            decoder_reset(&dec);
+            waiting = 1;
+            if (cache != NULL && !(f->flags & ACCESS_UNIT_KEYFRAME)) {
+                int n = keyframe_cache_replay(cache, decoder_sink, &dec);
+                if (n > 0) {
+                    res->replayed += (unsigned long long)n;
+                    CHECK(dec.bad_flags == 0);
+                    CHECK(dec.hidden == (unsigned long long)(n - 1));
+                    CHECK(dec.corrupt == 0);
+                    if (dec.shown != newest_ref) {
+                        res->stale_pictures++;
+                    }
+                    waiting = 0;
+                }
+            }
+        }
+        if (cache != NULL) {
+            keyframe_cache_add(cache, g_frame, f->len, f->flags, (int64_t)i * FRAME_NS);
+        }
+        clean = decoder_input(&dec, g_frame, f->flags, 1);
+        if (f->flags & ACCESS_UNIT_REFERENCE) {
+            newest_ref = i;
+        }
+        if (waiting) {
+            if (clean) {
+                waiting = 0;
+            } else {
+                res->black_frames++;
+            }
+        }
+    }
+    res->corrupt += dec.corrupt;
+}
+
+static void test_restarts(int seconds, int gop, int restarts, uint64_t seed) {
+    int count = seconds * 60;
+    stream_frame_t *frames = calloc((size_t)count, sizeof(stream_frame_t));
+    int *restart = calloc((size_t)count, sizeof(int));
+    uint64_t rng = seed;
+    session_result_t with, without;
+    keyframe_cache_t *cache = keyframe_cache_create(0, 0);
+    keyframe_cache_stats_t st;
+    int i;
+
+    build_stream(frames, count, gop, &rng);
+    for (i = 0; i < restarts; i++) {
+        restart[1 + test_rand(&rng) % (uint64_t)(count - 1)] = 1;
+    }
+
+    run_session(frames, count, restart, NULL, &without);
+    run_session(frames, count, restart, cache, &with);
+    keyframe_cache_get_stats(cache, &st);
+
+    printf("restarts: %llu over %d s (gop %d frames)\n", with.restarts, seconds, gop);
+    printf("  without cache: %llu black frames (%.1f s), %llu corrupt decodes\n",
+           without.black_frames, without.black_frames / 60.0, without.corrupt);
+    printf("  with cache:    %llu black frames, %llu corrupt decodes, %llu frames replayed "
+           "(%.1f per restart), %llu hits / %llu misses, peak %zu KB\n",
+           with.black_frames, with.corrupt, with.replayed,
+           with.restarts ? (double)with.replayed / (double)with.restarts : 0.0,
+           st.hits, st.misses, st.peak_bytes / 1024);
+
+    CHECK(with.restarts > 0);
+    CHECK(with.corrupt == 0);
+    CHECK(with.stale_pictures == 0);
+    CHECK(with.black_frames == 0);
+    CHECK(without.black_frames > with.black_frames);
+    CHECK(st.overflows == 0);
+    CHECK(st.peak_bytes <= st.max_bytes);
+    CHECK(st.arena_bytes <= st.max_bytes);
+
+    keyframe_cache_destroy(cache);
+    free(restart);
+    free(frames);
+}
+
+static int add_frame(keyframe_cache_t *cache, int id, int dep, int flags, int len) {
+    stream_frame_t f = { id, dep, flags, len };
+    make_frame(&f, g_frame);
+    return keyframe_cache_add(cache, g_frame, len, flags, (int64_t)id * FRAME_NS);
+}
+
+#define KEY (ACCESS_UNIT_PICTURE | ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_REFERENCE)
+#define REF (ACCESS_UNIT_PICTURE | ACCESS_UNIT_REFERENCE)
+#define NONREF ACCESS_UNIT_PICTURE
+
+static void test_policy(void) {
+    keyframe_cache_t *cache = keyframe_cache_create(64 * 1024, 8);
+    keyframe_cache_stats_t st;
+    mock_decoder_t dec;
+    int i;
+
+    // Nothing before the first keyframe, and nothing to replay
+    CHECK(add_frame(cache, 0, 0, REF, 1000) == 0);
+    decoder_reset(&dec);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == -1);
+    CHECK(dec.replay_count == 0);
+
+    // Keyframe + references cached, non-reference and picture-less units not
+    CHECK(add_frame(cache, 1, -1, KEY, 8000) == 1);
+    CHECK(add_frame(cache, 2, 1, REF, 1000) == 1);
+    CHECK(add_frame(cache, 3, 2, NONREF, 1000) == 0);
+    CHECK(add_frame(cache, 4, 2, ACCESS_UNIT_PARAMETER_SETS, 100) == 0);
+    CHECK(add_frame(cache, 5, 2, REF, 1000) == 1);
+    keyframe_cache_get_stats(cache, &st);
+    CHECK(st.frames == 3);
+    CHECK(st.bytes == 10000);
+    CHECK(st.keyframes == 1);
+    CHECK(st.frames_skipped == 2);
+
+    decoder_reset(&dec);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == 3);
+    CHECK(dec.shown == 5);
+    CHECK(dec.hidden == 2);
+    CHECK(dec.corrupt == 0);
+
+    // The group stays cached: a second restart replays it again
+    decoder_reset(&dec);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == 3);
+
+    // A sink out of input buffers stops the replay
+    decoder_reset(&dec);
+    dec.replay_abort_after = 1;
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == 1);
+    keyframe_cache_get_stats(cache, &st);
+    CHECK(st.hits == 3);
+    CHECK(st.misses == 1);
+    CHECK(st.aborted == 1);
+    CHECK(st.frames_replayed == 7);
+    CHECK(st.bytes_replayed == 10000 + 10000 + 8000);
+
+    // Frame cap: the ninth frame of a group invalidates it until the next keyframe
+    CHECK(add_frame(cache, 10, -1, KEY, 1000) == 1);
+    for (i = 11; i < 18; i++) {
+        CHECK(add_frame(cache, i, i - 1, REF, 1000) == 1);
+    }
+    CHECK(add_frame(cache, 18, 17, REF, 1000) == 0);
+    CHECK(add_frame(cache, 19, 18, REF, 1000) == 0);
+    decoder_reset(&dec);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == -1);
+    keyframe_cache_get_stats(cache, &st);
+    CHECK(st.overflows == 1);
+    CHECK(st.frames == 0);
+    CHECK(st.bytes == 0);
+
+    // Byte cap, the same way; the arena never grows past it
+    CHECK(add_frame(cache, 20, -1, KEY, 40 * 1024) == 1);
+    CHECK(add_frame(cache, 21, 20, REF, 20 * 1024) == 1);
+    CHECK(add_frame(cache, 22, 21, REF, 8 * 1024) == 0);
+    decoder_reset(&dec);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == -1);
+    keyframe_cache_get_stats(cache, &st);
+    CHECK(st.overflows == 2);
+    CHECK(st.peak_bytes == 60 * 1024);
+    CHECK(st.arena_bytes <= 64 * 1024);
+
+    // A keyframe bigger than the cap cannot be cached at all
+    CHECK(add_frame(cache, 30, -1, KEY, 65 * 1024) == 0);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == -1);
+
+    // The next keyframe that fits restores hits; clear drops it again
+    CHECK(add_frame(cache, 40, -1, KEY, 1000) == 1);
+    decoder_reset(&dec);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == 1);
+    CHECK(dec.shown == 40);
+    CHECK(dec.hidden == 0);
+    keyframe_cache_clear(cache);
+    CHECK(keyframe_cache_replay(cache, decoder_sink, &dec) == -1);
+    CHECK(add_frame(cache, 41, 40, REF, 1000) == 0);
+
+    keyframe_cache_get_stats(cache, &st);
+    CHECK(st.max_bytes == 64 * 1024);
+    CHECK(st.max_frames == 8);
+    printf("policy: %llu keyframes, %llu cached, %llu skipped, %llu overflows, %llu hits / %llu misses / %llu aborted\n",
+           st.keyframes, st.frames_cached, st.frames_skipped, st.overflows, st.hits, st.misses, st.aborted);
+    keyframe_cache_destroy(cache);
+}
+
+static int count_sink(void *ctx, const keyframe_frame_t *frame, int decode_only) {
+    unsigned long long *sum = ctx;
+    *sum += frame->data[frame->len - 1] + (unsigned)decode_only;
+    return 0;
+}
+
+static void bench(int gop, uint64_t seed) {
+    int count = gop;
+    stream_frame_t *frames = calloc((size_t)count, sizeof(stream_frame_t));
+    keyframe_cache_t *cache = keyframe_cache_create(0, count);
+    keyframe_cache_stats_t st;
+    uint64_t rng = seed;
+    unsigned long long bytes = 0, sum = 0;
+    uint64_t t0, add_ns = 0, replay_ns;
+    int rounds = 20, r, i;
+
+    build_stream(frames, count, gop, &rng);
+    make_frame(&frames[1], g_frame);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < count; i++) {
+            t0 = now_ns();
+            if (keyframe_cache_add(cache, g_frame, frames[i].len, frames[i].flags, (int64_t)i * FRAME_NS) == 1) {
+                bytes += (unsigned long long)frames[i].len;
+            }
+            add_ns += now_ns() - t0;
+        }
+    }
+    t0 = now_ns();
+    for (r = 0; r < rounds; r++) {
+        keyframe_cache_replay(cache, count_sink, &sum);
+    }
+    replay_ns = (now_ns() - t0) / (uint64_t)rounds;
+    keyframe_cache_get_stats(cache, &st);
+
+    printf("bench: add %.2f us/frame (%.0f MB/s copied), full group %d frames / %zu KB replays in %.1f us\n",
+           add_ns / 1e3 / (double)(rounds * count), bytes / (add_ns / 1e9) / 1e6,
+           st.frames, st.bytes / 1024, replay_ns / 1e3);
+    CHECK(st.frames > 0);
+    CHECK(sum > 0);
+    keyframe_cache_destroy(cache);
+    free(frames);
+}
+
+int main(int argc, char **argv) {
+    int seconds = (int)test_arg_long(argc, argv, "--seconds", 120);
+    int gop = (int)test_arg_long(argc, argv, "--gop", 180);
+    int restarts = (int)test_arg_long(argc, argv, "--restarts", 25);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 46);
+
+    if (seconds < 1 || gop < 2 || restarts < 1) {
+        fprintf(stderr, "usage: keyframe_cache_test [--seconds N] [--gop N] [--restarts N] [--seed N]\n");
+        return 2;
+    }
+    test_policy();
+    test_restarts(seconds, gop, restarts, seed | 1);
+    bench(gop, seed | 1);
+    return test_failures();
+}
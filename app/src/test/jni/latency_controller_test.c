@@ -0,0 +1,287 @@
+/**
+ * Latency controller: drop policy decisions and a simulated decoder falling behind.
+ *
+ * Checks the policy directly (IDR frames always decode, non-reference frames go
+ * above the budget, everything up to the next IDR above the skip budget or
+ * after a lost reference frame, output matching), then replays a 60 fps stream
+ * through a model of the receive loop and MediaCodec: a fixed number of input
+ * buffers, dequeueInputBuffer waiting up to 10 ms, and a decoder that is fast,
+ * then slower than the frame rate, then stalls. Without the controller every
+ * input buffer fills, latency sits at the full queue's decode time and the
+ * frames that find no buffer are lost, so the frames after a lost reference
+ * decode with artifacts. With it, display latency stays near the budget, no
+ * frame is decoded against a missing reference, and latency recovers after the
+ * stall.
+ *
+ *   latency_controller_test [--seconds N] [--budget-ms N] [--skip-ms N] [--slow-ms N]
+ *                           [--stall-ms N] [--gop N] [--input-buffers N]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "access_unit.h"
+#include "latency_controller.h"
+#include "test_util.h"
+
+#define MS 1000000ll
+#define FRAME_NS 16666667ll             // 60 fps
+#define TRANSIT_NS (2 * MS)
+#define INPUT_WAIT_NS (10 * MS)         // dequeueInputBuffer timeout in VideoStreamReceiver
+#define MAX_INPUT_BUFFERS 64
+
+#define PHASE_STEADY 0
+#define PHASE_SLOW 1
+#define PHASE_STALL 2
+#define PHASE_RECOVERED 3
+#define PHASES 4
+
+static const char *phase_names[PHASES] = { "steady", "slow", "stall", "recovered" };
+
+typedef struct {
+    int64_t seconds;
+    int64_t budget_ns;
+    int64_t skip_ns;
+    int64_t fast_ns;
+    int64_t slow_ns;
+    int64_t stall_ns;
+    int gop;
+    int input_buffers;
+} scenario_t;
+
+typedef struct {
+    int64_t pts[MAX_INPUT_BUFFERS];
+    int64_t finish[MAX_INPUT_BUFFERS];
+    int head;
+    int count;
+    int64_t free_at;
+    int stalled;
+} decoder_t;
+
+typedef struct {
+    uint64_t *latency[PHASES];
+    size_t latency_count[PHASES];
+    unsigned long long dropped[PHASES];
+    unsigned long long displayed;
+    unsigned long long corrupt;         // decoded while a reference it needs was missing
+    unsigned long long lost;
+    latency_controller_t lc;
+} result_t;
+
+// Slow from 1/4 to 1/2 of the run, one stall at 5/8, fast otherwise
+static int phase_at(const scenario_t *s, int64_t t) {
+    int64_t end = s->seconds * 1000 * MS;
+    if (t < end / 4) {
+        return PHASE_STEADY;
+    }
+    if (t < end / 2) {
+        return PHASE_SLOW;
+    }
+    if (t < end * 5 / 8 + s->stall_ns + 1000 * MS) {
+        return t < end * 5 / 8 ? PHASE_STEADY : PHASE_STALL;
+    }
+    return PHASE_RECOVERED;
+}
+
+static void decoder_queue(const scenario_t *s, decoder_t *d, int64_t pts, int64_t now) {
+    int64_t start = now > d->free_at ? now : d->free_at;
+    int64_t end = s->seconds * 1000 * MS;
+
+    if (!d->stalled && start >= end * 5 / 8) {
+        start += s->stall_ns;
+        d->stalled = 1;
+    }
+    d->free_at = start + (phase_at(s, start) == PHASE_SLOW ? s->slow_ns : s->fast_ns);
+    int tail = (d->head + d->count) % MAX_INPUT_BUFFERS;
+    d->pts[tail] = pts;
+    d->finish[tail] = d->free_at;
+    d->count++;
+}
+
+// Releases every finished frame to the display, as decodeFrame's output loop does
+static void decoder_poll(const scenario_t *s, decoder_t *d, result_t *r, latency_controller_t *lc, int64_t now) {
+    while (d->count > 0 && d->finish[d->head] <= now) {
+        int64_t pts = d->pts[d->head];
+        int phase = phase_at(s, pts);
+        if (lc != NULL) {
+            latency_controller_on_output(lc, pts, now);
+        }
+        r->latency[phase][r->latency_count[phase]++] = (uint64_t)(now - pts);
+        r->displayed++;
+        d->head = (d->head + 1) % MAX_INPUT_BUFFERS;
+        d->count--;
+    }
+}
+
+static void simulate(const scenario_t *s, int controlled, result_t *r) {
+    static decoder_t d;
+    long frames = (long)(s->seconds * 60);
+    int64_t loop_ns = 0;
+    int broken = 1;                     // nothing decodable before the first IDR
+
+    memset(&d, 0, sizeof(d));
+    for (int p = 0; p < PHASES; p++) {
+        r->latency[p] = calloc((size_t)frames, sizeof(uint64_t));
+    }
+    latency_controller_init(&r->lc, s->budget_ns, s->skip_ns);
+
+    for (long i = 0; i < frames; i++) {
+        int64_t pts = i * FRAME_NS + TRANSIT_NS;
+        int64_t now = pts > loop_ns ? pts : loop_ns;
+        int flags = ACCESS_UNIT_PICTURE;
+        if (i % s->gop == 0) {
+            flags |= ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_REFERENCE;
+        } else if (i % 2 == 0) {
+            flags |= ACCESS_UNIT_REFERENCE;
+        }
+
+        decoder_poll(s, &d, r, controlled ? &r->lc : NULL, now);
+        int decision = controlled ? latency_controller_decide(&r->lc, flags, pts, now) : LATENCY_DECODE;
+        if (decision != LATENCY_DECODE) {
+            r->dropped[phase_at(s, pts)]++;
+            if (flags & ACCESS_UNIT_REFERENCE) {
+                broken = 1;
+            }
+            loop_ns = now;
+            continue;
+        }
+
+        // dequeueInputBuffer(10 ms): wait for the decoder to free a buffer, or give up
+        if (d.count == s->input_buffers) {
+            int64_t freed = d.finish[d.head];
+            now = freed <= now + INPUT_WAIT_NS ? freed : now + INPUT_WAIT_NS;
+            decoder_poll(s, &d, r, controlled ? &r->lc : NULL, now);
+        }
+        if (d.count == s->input_buffers) {
+            r->lost++;
+            if (controlled) {
+                latency_controller_on_input_lost(&r->lc, flags);
+            }
+            if (flags & ACCESS_UNIT_REFERENCE) {
+                broken = 1;
+            }
+        } else {
+            if (flags & ACCESS_UNIT_KEYFRAME) {
+                broken = 0;
+            } else if (broken) {
+                r->corrupt++;
+            }
+            decoder_queue(s, &d, pts, now);
+            if (controlled) {
+                latency_controller_on_queued(&r->lc, pts, now);
+            }
+        }
+        loop_ns = now;
+    }
+}
+
+static void report(const char *name, result_t *r) {
+    printf("  %-13s", name);
+    for (int p = 0; p < PHASES; p++) {
+        printf(" %s p99 %4llu ms (drop %3llu)", phase_names[p],
+               (unsigned long long)(test_percentile(r->latency[p], r->latency_count[p], 99) / MS), r->dropped[p]);
+    }
+    printf("\n  %-13s displayed %llu, lost inputs %llu, decoded with a missing reference %llu\n", "",
+           r->displayed, r->lost, r->corrupt);
+}
+
+static void test_policy(void) {
+    latency_controller_t lc;
+    int ref = ACCESS_UNIT_PICTURE | ACCESS_UNIT_REFERENCE;
+    int non_ref = ACCESS_UNIT_PICTURE;
+    int idr = ref | ACCESS_UNIT_KEYFRAME;
+
+    latency_controller_init(&lc, 100 * MS, 300 * MS);
+
+    // Under budget everything decodes; lag follows the oldest frame in the decoder
+    CHECK(latency_controller_decide(&lc, non_ref, 0, 50 * MS) == LATENCY_DECODE);
+    latency_controller_on_queued(&lc, 0, 50 * MS);
+    CHECK(latency_controller_decide(&lc, non_ref, 100 * MS, 120 * MS) == LATENCY_DROP_NON_REFERENCE);
+    CHECK(lc.lag_ns == 120 * MS);
+    CHECK(latency_controller_decide(&lc, ref, 100 * MS, 120 * MS) == LATENCY_DECODE);
+    latency_controller_on_queued(&lc, 100 * MS, 120 * MS);
+
+    // Output pops the frame and everything queued before it
+    latency_controller_on_output(&lc, 100 * MS, 130 * MS);
+    CHECK(lc.count == 0 && lc.service_ns == 10 * MS);
+    CHECK(latency_controller_decide(&lc, non_ref, 140 * MS, 150 * MS) == LATENCY_DECODE);
+    latency_controller_on_output(&lc, 12345, 150 * MS);
+    CHECK(lc.count == 0);
+
+    // Above the skip budget: drop to the next IDR, which always decodes
+    latency_controller_on_queued(&lc, 200 * MS, 200 * MS);
+    CHECK(latency_controller_decide(&lc, ref, 400 * MS, 501 * MS) == LATENCY_DROP_TO_IDR);
+    latency_controller_on_output(&lc, 200 * MS, 520 * MS);
+    CHECK(latency_controller_decide(&lc, ref, 520 * MS, 521 * MS) == LATENCY_DROP_TO_IDR);
+    CHECK(latency_controller_decide(&lc, idr, 540 * MS, 541 * MS) == LATENCY_DECODE);
+    CHECK(latency_controller_decide(&lc, non_ref, 560 * MS, 561 * MS) == LATENCY_DECODE);
+    CHECK(lc.skips == 1 && lc.dropped_to_idr == 2 && lc.dropped_non_reference == 1);
+    CHECK(lc.max_lag_ns == 301 * MS);
+
+    // A lost non-reference frame is harmless; a lost reference frame skips to IDR
+    latency_controller_on_input_lost(&lc, non_ref);
+    CHECK(latency_controller_decide(&lc, ref, 580 * MS, 581 * MS) == LATENCY_DECODE);
+    latency_controller_on_input_lost(&lc, ref);
+    CHECK(latency_controller_decide(&lc, non_ref, 600 * MS, 601 * MS) == LATENCY_DROP_TO_IDR);
+    CHECK(lc.skips == 2 && lc.inputs_lost == 2);
+
+    // Reset forgets frames in flight and the skip, keeps counters
+    latency_controller_on_queued(&lc, 600 * MS, 601 * MS);
+    latency_controller_reset(&lc);
+    CHECK(lc.count == 0 && !lc.skipping && lc.decoded == 4 && lc.skips == 2);
+
+    // The in-flight ring keeps the newest frames when outputs never come
+    for (int i = 0; i < LATENCY_CONTROLLER_MAX_IN_FLIGHT + 5; i++) {
+        latency_controller_on_queued(&lc, i, i);
+    }
+    CHECK(lc.count == LATENCY_CONTROLLER_MAX_IN_FLIGHT && lc.in_flight[lc.head].pts_ns == 5);
+}
+
+int main(int argc, char **argv) {
+    scenario_t s;
+    s.seconds = test_arg_long(argc, argv, "--seconds", 40);
+    s.budget_ns = test_arg_long(argc, argv, "--budget-ms", 100) * MS;
+    s.skip_ns = test_arg_long(argc, argv, "--skip-ms", 300) * MS;
+    s.fast_ns = 8 * MS;
+    s.slow_ns = test_arg_long(argc, argv, "--slow-ms", 24) * MS;
+    s.stall_ns = test_arg_long(argc, argv, "--stall-ms", 800) * MS;
+    s.gop = (int)test_arg_long(argc, argv, "--gop", 120);
+    s.input_buffers = (int)test_arg_long(argc, argv, "--input-buffers", 8);
+    if (s.input_buffers > MAX_INPUT_BUFFERS) {
+        s.input_buffers = MAX_INPUT_BUFFERS;
+    }
+
+    test_policy();
+
+    static result_t open_loop, controlled;
+    simulate(&s, 0, &open_loop);
+    simulate(&s, 1, &controlled);
+
+    printf("latency controller: %lld s at 60 fps, decode %lld ms -> %lld ms -> %lld ms stall, IDR every %d, "
+           "budget %lld / skip %lld ms, %d input buffers\n",
+           (long long)s.seconds, (long long)(s.fast_ns / MS), (long long)(s.slow_ns / MS),
+           (long long)(s.stall_ns / MS), s.gop, (long long)(s.budget_ns / MS), (long long)(s.skip_ns / MS),
+           s.input_buffers);
+    report("no control", &open_loop);
+    report("controlled", &controlled);
+    printf("  dropped %llu non-reference + %llu to IDR (%llu skips), recovered %lld ms of decode time, "
+           "max lag %lld ms\n",
+           controlled.lc.dropped_non_reference, controlled.lc.dropped_to_idr, controlled.lc.skips,
+           (long long)(controlled.lc.recovered_ns / MS), (long long)(controlled.lc.max_lag_ns / MS));
+
+    uint64_t slow = test_percentile(controlled.latency[PHASE_SLOW], controlled.latency_count[PHASE_SLOW], 99);
+    uint64_t recovered = test_percentile(controlled.latency[PHASE_RECOVERED],
+                                         controlled.latency_count[PHASE_RECOVERED], 99);
+    // The open loop runs with a full decoder and loses frames; the controller holds the budget
+    CHECK(open_loop.corrupt > 0);
+    CHECK(slow < (uint64_t)(s.budget_ns + 3 * s.slow_ns));
+    CHECK(recovered < (uint64_t)(s.fast_ns + FRAME_NS));
+    CHECK(controlled.dropped[PHASE_STEADY] == 0 && controlled.corrupt == 0);
+    CHECK(controlled.lc.dropped_non_reference > 0 && controlled.lc.skips > 0 && controlled.lc.recovered_ns > 0);
+
+    for (int p = 0; p < PHASES; p++) {
+        free(open_loop.latency[p]);
+        free(controlled.latency[p]);
+    }
+    return test_failures();
+}
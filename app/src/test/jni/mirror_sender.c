@@ -0,0 +1,1005 @@
+/**
+ * Synthetic AirPlay mirror sender for local load testing.
+ *
+ * Drives a receiver the way a Mac or iPhone does, minus pairing: POST
+ * /fp-setup twice with a recorded FairPlay session, SETUP with its ekey,
+ * SETUP of a type 110 stream, then connects to the returned data port and
+ * streams 128-byte-header mirror packets: the avcC config, then one AVCC
+ * access unit per frame, AES-CTR encrypted with the key derived exactly as
+ * mirror_buffer_init_aes does (the receiver's decryptor is the encryptor).
+ *
+ * Video comes from an Annex-B or AVCC H.264 file, or is synthesized at
+ * --bitrate with an IDR every --idr-interval frames. Frames are paced at
+ * --fps (0 = as fast as the receiver takes them, for throughput ceilings).
+ * Each packet header carries the send time as its NTP timestamp.
+ *
+ * --loopback starts the native receiver in-process (rtsp_server +
+ * session_manager on an ephemeral port), so runs need no device or network:
+ * it checks the receiver decrypts every frame to the sender's checksum and
+ * reports send-to-receive latency and peak memory as well.
+ *
+ * --sink runs the loopback receiver headless all the way to decoder input:
+ * decrypted packets go through mirror_pipeline (config parsing, Annex-B
+ * assembly) into a null, checksum or file sink, and the run reports
+ * packets/s, frames/s, bytes/s and the receiver's CPU per stage (receive,
+ * framing, decrypt, assemble, sink). The checksum sink must match the
+ * sender's Annex-B rendering of what it sent; the file sink's output is a
+ * playable elementary stream.
+ *
+ *   mirror_sender --vectors FILE (--loopback [--sink null|checksum|file:PATH] | --host ADDR --port N)
+ *                 [--input FILE [--avcc]] [--bitrate KBPS] [--fps N] [--idr-interval N]
+ *                 [--frames N] [--session N] [--dump FILE] [--seed S]
+ *
+ * --dump writes the synthesized stream as Annex-B, to be replayed with --input.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "airplay_setup.h"
+#include "bplist.h"
+#include "mirror_buffer.h"
+#include "mirror_framer.h"
+#include "mirror_pipeline.h"
+#include "rtsp_server.h"
+#include "session_manager.h"
+#include "test_util.h"
+
+#define KB 1024
+#define MB (1024 * 1024)
+#define LINE_MAX_LEN 1024
+#define FP_EKEY_LEN 72
+#define FP_AESKEY_LEN 16
+#define MAX_NALS (1 << 20)
+#define MAX_PARAM_SET 256
+#define RANDOM_POOL (4 * MB)
+#define RECV_TIMEOUT_NS (30ull * 1000000000ull)
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+#define NAL_SLICE 1
+#define NAL_IDR 5
+#define NAL_SPS 7
+#define NAL_PPS 8
+#define NAL_AUD 9
+
+typedef struct {
+    unsigned char setup_req[FAIRPLAY_SETUP_REQ_LEN];
+    unsigned char setup_res[FAIRPLAY_SETUP_RES_LEN];
+    unsigned char handshake_req[FAIRPLAY_HANDSHAKE_REQ_LEN];
+    unsigned char handshake_res[FAIRPLAY_HANDSHAKE_RES_LEN];
+    unsigned char ekey[FP_EKEY_LEN];
+    unsigned char aeskey[FP_AESKEY_LEN];
+} fp_vector_t;
+
+typedef struct {
+    int off;
+    int len;
+} nal_t;
+
+// Video source: NAL units of a file, or a synthesized stream
+typedef struct {
+    const unsigned char *data;
+    nal_t *nals;
+    int nal_count;
+    int next;
+    unsigned char sps[MAX_PARAM_SET];
+    int sps_len;
+    unsigned char pps[MAX_PARAM_SET];
+    int pps_len;
+
+    // Synthetic
+    int synthetic;
+    long frame;
+    int idr_interval;
+    int p_size;
+    int idr_size;
+    unsigned char *pool;
+    int pool_off;
+} source_t;
+
+// Loopback receiver, measured on its worker thread
+typedef struct {
+    session_manager_t *manager;
+    airplay_session_t *session;
+    unsigned char aeskey[FP_AESKEY_LEN];
+    int have_key;
+    uint64_t checksum;
+    long frames;
+    long config_packets;
+    uint64_t *latency_ns;
+    long latency_cap;
+    mirror_pipeline_t *pipeline;    // --sink: packets go through the headless pipeline instead
+} receiver_t;
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static const unsigned char start_code[4] = { 0, 0, 0, 1 };
+
+// Hash of an AVCC payload as the receiver's assembler renders it: a start code for each length
+static uint64_t fnv1a_annexb(uint64_t hash, const unsigned char *data, int len) {
+    int off = 0;
+    while (off + 4 <= len) {
+        int n = (int)((uint32_t)data[off] << 24 | (uint32_t)data[off + 1] << 16 |
+                      (uint32_t)data[off + 2] << 8 | data[off + 3]);
+        hash = fnv1a(hash, start_code, 4);
+        hash = fnv1a(hash, data + off + 4, n);
+        off += 4 + n;
+    }
+    return hash;
+}
+
+// NTP-style 32.32 fixed point of a CLOCK_MONOTONIC time
+static uint64_t ns_to_ntp(uint64_t ns) {
+    return (ns / 1000000000ull) << 32 | ((ns % 1000000000ull) << 32) / 1000000000ull;
+}
+
+static uint64_t ntp_to_ns(uint64_t ntp) {
+    return (ntp >> 32) * 1000000000ull + (((ntp & 0xffffffffull) * 1000000000ull) >> 32);
+}
+
+static long peak_rss_kb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = strtol(line + 6, NULL, 10);
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    return kb;
+}
+
+// --session N: the Nth "setup / handshake / ekey" group of the vector file
+static int load_fp_vector(const char *path, int index, fp_vector_t *v) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[LINE_MAX_LEN];
+    int session = -1;
+    int have = 0;   // bit 0 setup, 1 handshake, 2 ekey
+    int ok = 1;
+    while (ok && have != 7 && fgets(line, sizeof(line), f)) {
+        char *name = strtok(line, " \t\r\n");
+        if (!name || name[0] == '#') {
+            continue;
+        }
+        char *in = strtok(NULL, " \t\r\n");
+        char *out = strtok(NULL, " \t\r\n");
+        if (strcmp(name, "setup") == 0) {
+            session++;
+        }
+        if (session != index) {
+            continue;
+        }
+        if (!in || !out) {
+            ok = 0;
+        } else if (strcmp(name, "setup") == 0) {
+            ok = test_hex_decode(in, v->setup_req, sizeof(v->setup_req)) == 0 &&
+                 test_hex_decode(out, v->setup_res, sizeof(v->setup_res)) == 0;
+            have |= 1;
+        } else if (strcmp(name, "handshake") == 0) {
+            ok = test_hex_decode(in, v->handshake_req, sizeof(v->handshake_req)) == 0 &&
+                 test_hex_decode(out, v->handshake_res, sizeof(v->handshake_res)) == 0;
+            have |= 2;
+        } else if (strcmp(name, "ekey") == 0 && !(have & 4)) {
+            ok = test_hex_decode(in, v->ekey, sizeof(v->ekey)) == 0 &&
+                 test_hex_decode(out, v->aeskey, sizeof(v->aeskey)) == 0;
+            have |= 4;
+        }
+    }
+    fclose(f);
+    if (!ok || have != 7) {
+        fprintf(stderr, "%s: no complete fp-setup session %d\n", path, index);
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- video source ---- */
+
+static unsigned char *read_file(const char *path, long *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = malloc((size_t)*len + 1);
+    if (data && fread(data, 1, (size_t)*len, f) != (size_t)*len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+// Splits an Annex-B stream on 00 00 01 / 00 00 00 01 start codes
+static int split_annexb(const unsigned char *data, long len, nal_t *nals, int max) {
+    int count = 0;
+    long start = -1;
+    long i = 0;
+    while (i + 2 < len) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (start >= 0 && count < max) {
+                long end = i;
+                while (end > start && data[end - 1] == 0) {
+                    end--;      // trailing zero of a 4-byte start code
+                }
+                nals[count++] = (nal_t){ (int)start, (int)(end - start) };
+            }
+            i += 3;
+            start = i;
+        } else {
+            i++;
+        }
+    }
+    if (start >= 0 && start < len && count < max) {
+        nals[count++] = (nal_t){ (int)start, (int)(len - start) };
+    }
+    return count;
+}
+
+// 4-byte big-endian length before each NAL unit
+static int split_avcc(const unsigned char *data, long len, nal_t *nals, int max) {
+    int count = 0;
+    long off = 0;
+    while (off + 4 <= len && count < max) {
+        uint32_t n = (uint32_t)data[off] << 24 | (uint32_t)data[off + 1] << 16 |
+                     (uint32_t)data[off + 2] << 8 | data[off + 3];
+        if (n == 0 || n > (uint32_t)(len - off - 4)) {
+            return -1;
+        }
+        nals[count++] = (nal_t){ (int)(off + 4), (int)n };
+        off += 4 + n;
+    }
+    return off == len ? count : -1;
+}
+
+static int nal_type(const unsigned char *nal) {
+    return nal[0] & 0x1f;
+}
+
+static int is_vcl(int type) {
+    return type >= NAL_SLICE && type <= NAL_IDR;
+}
+
+// avcC record from the current SPS/PPS; returns its length
+static int write_avcc(const source_t *src, unsigned char *out) {
+    int n = 0;
+    out[n++] = 1;
+    out[n++] = src->sps[1];
+    out[n++] = src->sps[2];
+    out[n++] = src->sps[3];
+    out[n++] = 0xff;        // 4-byte NAL lengths
+    out[n++] = 0xe1;        // one SPS
+    out[n++] = (unsigned char)(src->sps_len >> 8);
+    out[n++] = (unsigned char)src->sps_len;
+    memcpy(out + n, src->sps, (size_t)src->sps_len);
+    n += src->sps_len;
+    out[n++] = 1;           // one PPS
+    out[n++] = (unsigned char)(src->pps_len >> 8);
+    out[n++] = (unsigned char)src->pps_len;
+    memcpy(out + n, src->pps, (size_t)src->pps_len);
+    return n + src->pps_len;
+}
+
+static void append_nal(unsigned char *out, int *len, const unsigned char *nal, int nal_len) {
+    out[*len] = (unsigned char)(nal_len >> 24);
+    out[*len + 1] = (unsigned char)(nal_len >> 16);
+    out[*len + 2] = (unsigned char)(nal_len >> 8);
+    out[*len + 3] = (unsigned char)nal_len;
+    memcpy(out + *len + 4, nal, (size_t)nal_len);
+    *len += 4 + nal_len;
+}
+
+static void synth_param_sets(source_t *src) {
+    // High profile, level 4.2; contents beyond the header bytes are opaque to the transport
+    static const unsigned char sps[] = { 0x67, 0x64, 0x00, 0x2a, 0xac, 0x2b, 0x40, 0x3c, 0x01, 0x13, 0xf2, 0xe0 };
+    static const unsigned char pps[] = { 0x68, 0xee, 0x3c, 0xb0 };
+    memcpy(src->sps, sps, sizeof(sps));
+    src->sps_len = sizeof(sps);
+    memcpy(src->pps, pps, sizeof(pps));
+    src->pps_len = sizeof(pps);
+}
+
+// Next access unit as AVCC into out (SPS/PPS go to the config packet instead).
+// Returns its length, 0 at the end of a file; *config_changed is set when a new SPS/PPS was seen.
+static int next_frame(source_t *src, unsigned char *out, int *is_idr, int *config_changed) {
+    int len = 0;
+    int have_vcl = 0;
+
+    *is_idr = 0;
+    *config_changed = 0;
+    if (src->synthetic) {
+        int size;
+        *is_idr = src->frame % src->idr_interval == 0;
+        size = *is_idr ? src->idr_size : src->p_size;
+        if (src->pool_off + size > RANDOM_POOL) {
+            src->pool_off = 0;
+        }
+        unsigned char *nal = src->pool + src->pool_off;
+        src->pool_off += size;
+        nal[0] = *is_idr ? 0x65 : 0x41;
+        nal[1] |= 0x80;     // first_mb_in_slice = 0
+        append_nal(out, &len, nal, size);
+        src->frame++;
+        return len;
+    }
+
+    while (src->next < src->nal_count) {
+        const nal_t *n = &src->nals[src->next];
+        const unsigned char *nal = src->data + n->off;
+        int type = nal_type(nal);
+
+        // A slice starting at macroblock 0, or any non-VCL unit after a slice, opens the next access unit
+        if (have_vcl && (!is_vcl(type) || (n->len > 1 && (nal[1] & 0x80)))) {
+            break;
+        }
+        src->next++;
+        if ((type == NAL_SPS && n->len <= MAX_PARAM_SET) || (type == NAL_PPS && n->len <= MAX_PARAM_SET)) {
+            unsigned char *dst = type == NAL_SPS ? src->sps : src->pps;
+            int *dst_len = type == NAL_SPS ? &src->sps_len : &src->pps_len;
+            if (*dst_len != n->len || memcmp(dst, nal, (size_t)n->len) != 0) {
+                memcpy(dst, nal, (size_t)n->len);
+                *dst_len = n->len;
+                *config_changed = 1;
+            }
+            continue;
+        }
+        if (type == NAL_AUD) {
+            continue;
+        }
+        have_vcl |= is_vcl(type);
+        *is_idr |= type == NAL_IDR;
+        append_nal(out, &len, nal, n->len);
+    }
+    return len;
+}
+
+/* ---- RTSP client ---- */
+
+typedef struct {
+    int fd;
+    int cseq;
+    unsigned char buf[64 * KB];
+    int len;
+    int consumed;
+    rtsp_request_t res;
+} rtsp_client_t;
+
+static int connect_to(const char *host, int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Sends one request and reads its response; returns the status or -1. The body
+// stays in client->buf at client->res.body until the next request.
+static int rtsp_call(rtsp_client_t *c, const char *method, const char *url, const char *content_type,
+                     const unsigned char *body, int body_len) {
+    char head[512];
+    int n = snprintf(head, sizeof(head),
+                     "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: AirPlay/620.8.2\r\n"
+                     "X-Apple-ProtocolVersion: 1\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+                     method, url, ++c->cseq, content_type, body_len);
+    if (send_all(c->fd, head, (size_t)n) < 0 || (body_len > 0 && send_all(c->fd, body, (size_t)body_len) < 0)) {
+        return -1;
+    }
+
+    memmove(c->buf, c->buf + c->consumed, (size_t)(c->len - c->consumed));
+    c->len -= c->consumed;
+    c->consumed = 0;
+    for (;;) {
+        // "RTSP/1.0 200 OK" parses as a request line: the status lands in path
+        int got = rtsp_request_parse(&c->res, c->buf, c->len);
+        if (got > 0) {
+            c->consumed = got;
+            return atoi((const char *)c->buf + c->res.path.off);
+        }
+        if (got < 0 || c->len == (int)sizeof(c->buf)) {
+            return -1;
+        }
+        ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - (size_t)c->len, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        c->len += (int)r;
+    }
+}
+
+static int write_session_setup(unsigned char *buf, int cap, const fp_vector_t *v, const unsigned char eiv[16]) {
+    bplist_writer_t w;
+    int keys[6], values[6];
+
+    bplist_writer_init(&w, buf, cap);
+    keys[0] = bplist_write_string(&w, "ekey");
+    values[0] = bplist_write_data(&w, v->ekey, FP_EKEY_LEN);
+    keys[1] = bplist_write_string(&w, "eiv");
+    values[1] = bplist_write_data(&w, eiv, 16);
+    keys[2] = bplist_write_string(&w, "timingPort");
+    values[2] = bplist_write_int(&w, 0);
+    keys[3] = bplist_write_string(&w, "isScreenMirroringSession");
+    values[3] = bplist_write_bool(&w, 1);
+    keys[4] = bplist_write_string(&w, "name");
+    values[4] = bplist_write_string(&w, "mirror_sender");
+    keys[5] = bplist_write_string(&w, "model");
+    values[5] = bplist_write_string(&w, "Synthetic1,1");
+    return bplist_writer_finish(&w, bplist_write_dict(&w, keys, values, 6));
+}
+
+static int write_stream_setup(unsigned char *buf, int cap, uint64_t stream_connection_id) {
+    bplist_writer_t w;
+    int keys[2], values[2];
+    int stream_key, streams_key, stream;
+
+    bplist_writer_init(&w, buf, cap);
+    keys[0] = bplist_write_string(&w, "type");
+    values[0] = bplist_write_int(&w, 110);
+    keys[1] = bplist_write_string(&w, "streamConnectionID");
+    values[1] = bplist_write_int(&w, (int64_t)stream_connection_id);
+    stream = bplist_write_dict(&w, keys, values, 2);
+    streams_key = bplist_write_string(&w, "streams");
+    stream_key = bplist_write_array(&w, &stream, 1);
+    return bplist_writer_finish(&w, bplist_write_dict(&w, &streams_key, &stream_key, 1));
+}
+
+// dataPort of the type 110 entry in a stream SETUP reply, or -1
+static int parse_data_port(const unsigned char *body, int len) {
+    bplist_t pl;
+    int64_t type, port;
+
+    if (bplist_open(&pl, body, len) < 0) {
+        return -1;
+    }
+    int streams = bplist_dict_get(&pl, pl.root, "streams");
+    for (int i = 0; i < bplist_count(&pl, streams); i++) {
+        int item = bplist_array_item(&pl, streams, i);
+        if (bplist_get_int(&pl, bplist_dict_get(&pl, item, "type"), &type) == 0 && type == 110 &&
+            bplist_get_int(&pl, bplist_dict_get(&pl, item, "dataPort"), &port) == 0) {
+            return (int)port;
+        }
+    }
+    return -1;
+}
+
+// fp-setup (both phases), session SETUP, stream SETUP; returns the data port or -1
+static int handshake(rtsp_client_t *c, const fp_vector_t *v, uint64_t stream_connection_id, uint64_t *rng) {
+    const char *bplist_type = "application/x-apple-binary-plist";
+    const char *url = "rtsp://127.0.0.1/mirror_sender";
+    unsigned char body[1024];
+    unsigned char eiv[16];
+    int len;
+
+    if (rtsp_call(c, "POST", "/fp-setup", "application/octet-stream", v->setup_req, sizeof(v->setup_req)) != 200 ||
+        c->res.body.len != FAIRPLAY_SETUP_RES_LEN ||
+        memcmp(c->buf + c->res.body.off, v->setup_res, FAIRPLAY_SETUP_RES_LEN) != 0) {
+        fprintf(stderr, "fp-setup phase 1 failed\n");
+        return -1;
+    }
+    if (rtsp_call(c, "POST", "/fp-setup", "application/octet-stream", v->handshake_req,
+                  sizeof(v->handshake_req)) != 200 ||
+        c->res.body.len != FAIRPLAY_HANDSHAKE_RES_LEN ||
+        memcmp(c->buf + c->res.body.off, v->handshake_res, FAIRPLAY_HANDSHAKE_RES_LEN) != 0) {
+        fprintf(stderr, "fp-setup phase 2 failed\n");
+        return -1;
+    }
+
+    test_fill_random(rng, eiv, sizeof(eiv));
+    len = write_session_setup(body, sizeof(body), v, eiv);
+    if (len < 0 || rtsp_call(c, "SETUP", url, bplist_type, body, len) != 200) {
+        fprintf(stderr, "session SETUP failed\n");
+        return -1;
+    }
+    len = write_stream_setup(body, sizeof(body), stream_connection_id);
+    if (len < 0 || rtsp_call(c, "SETUP", url, bplist_type, body, len) != 200) {
+        fprintf(stderr, "stream SETUP failed\n");
+        return -1;
+    }
+    int port = parse_data_port(c->buf + c->res.body.off, c->res.body.len);
+    if (port <= 0) {
+        fprintf(stderr, "stream SETUP reply has no dataPort\n");
+    }
+    return port;
+}
+
+/* ---- loopback receiver ---- */
+
+static void on_packet(void *opaque, int type, unsigned char *payload, int len, uint64_t ntp) {
+    receiver_t *rx = opaque;
+    rx->checksum = fnv1a(rx->checksum, payload, len);
+    if (type == MIRROR_TYPE_CONFIG) {
+        rx->config_packets++;
+        return;
+    }
+    if (rx->frames < rx->latency_cap) {
+        rx->latency_ns[rx->frames] = now_ns() - ntp_to_ns(ntp);
+    }
+    __atomic_store_n(&rx->frames, rx->frames + 1, __ATOMIC_RELEASE);
+}
+
+static void handle_fp_setup(rtsp_conn_t *conn, const rtsp_request_t *req, void *opaque) {
+    receiver_t *rx = opaque;
+    unsigned char res[FAIRPLAY_RES_MAX_LEN];
+
+    if (!rx->session) {
+        rx->session = rx->pipeline ? session_manager_open(rx->manager, mirror_pipeline_on_packet, rx->pipeline)
+                                   : session_manager_open(rx->manager, on_packet, rx);
+    }
+    int n = rx->session ? fairplay_respond(airplay_session_get_fairplay(rx->session), req->buf + req->body.off,
+                                           req->body.len, res, sizeof(res)) : -1;
+    if (n < 0) {
+        rtsp_conn_respond(conn, req, 400, "Bad Request", "", NULL, 0);
+        return;
+    }
+    rtsp_conn_respond(conn, req, 200, "OK", "application/octet-stream", res, n);
+}
+
+static void handle_setup(rtsp_conn_t *conn, const rtsp_request_t *req, void *opaque) {
+    receiver_t *rx = opaque;
+    airplay_setup_t setup;
+    unsigned char reply[256];
+    int n = -1;
+
+    if (!rx->session || airplay_setup_parse(&setup, req->buf + req->body.off, req->body.len) < 0) {
+        rtsp_conn_respond(conn, req, 400, "Bad Request", "", NULL, 0);
+        return;
+    }
+    if (setup.ekey.off >= 0 && setup.ekey.len == FP_EKEY_LEN) {
+        // No pairing: the FairPlay key is used as is (AirPlayServer's legacy mode)
+        rx->have_key = fairplay_decrypt(airplay_session_get_fairplay(rx->session),
+                                        req->buf + req->body.off + setup.ekey.off, rx->aeskey) == 0;
+        n = airplay_setup_write_session_reply(reply, sizeof(reply), 0, 0);
+    } else if (setup.stream_count > 0 && setup.streams[0].type == 110 && rx->have_key) {
+        airplay_stream_reply_t stream = { 110, airplay_session_get_data_port(rx->session), 0, 0 };
+        airplay_session_set_mirror_key(rx->session, rx->aeskey, (uint64_t)setup.streams[0].stream_connection_id);
+        n = airplay_setup_write_streams_reply(reply, sizeof(reply), &stream, 1);
+    }
+    if (n < 0) {
+        rtsp_conn_respond(conn, req, 400, "Bad Request", "", NULL, 0);
+        return;
+    }
+    rtsp_conn_respond(conn, req, 200, "OK", "application/x-apple-binary-plist", reply, n);
+}
+
+// --sink null | checksum | file:PATH
+static mirror_sink_t *open_sink(const char *spec) {
+    if (strcmp(spec, "null") == 0) {
+        return mirror_sink_null_create();
+    }
+    if (strcmp(spec, "checksum") == 0) {
+        return mirror_sink_checksum_create();
+    }
+    if (strncmp(spec, "file:", 5) == 0) {
+        mirror_sink_t *sink = mirror_sink_file_create(spec + 5);
+        if (!sink) {
+            perror(spec + 5);
+        }
+        return sink;
+    }
+    fprintf(stderr, "unknown sink '%s' (null, checksum, file:PATH)\n", spec);
+    return NULL;
+}
+
+static void *server_thread(void *arg) {
+    rtsp_server_run(arg);
+    return NULL;
+}
+
+/* ---- sender ---- */
+
+typedef struct {
+    long frames;
+    long idr_frames;
+    long config_packets;
+    long long bytes;
+    uint64_t checksum;
+    uint64_t annexb_checksum;   // what a checksum sink behind the pipeline should see
+    uint64_t start_ns;
+    uint64_t elapsed_ns;
+    uint64_t *late_ns;      // pacing: how far behind schedule each frame went out
+} send_result_t;
+
+static int send_packet(int fd, mirror_buffer_t *cipher, unsigned char *packet, int len, int type,
+                       send_result_t *r) {
+    unsigned char *header = packet;
+    uint64_t ntp = ns_to_ntp(now_ns());
+
+    r->checksum = fnv1a(r->checksum, packet + MIRROR_HEADER_LEN, len);
+    if (type == MIRROR_TYPE_VIDEO) {
+        r->annexb_checksum = fnv1a_annexb(r->annexb_checksum, packet + MIRROR_HEADER_LEN, len);
+        mirror_buffer_decrypt(cipher, packet + MIRROR_HEADER_LEN, packet + MIRROR_HEADER_LEN, len);
+    }
+    memset(header, 0, MIRROR_HEADER_LEN);
+    header[0] = (unsigned char)len;
+    header[1] = (unsigned char)(len >> 8);
+    header[2] = (unsigned char)(len >> 16);
+    header[3] = (unsigned char)(len >> 24);
+    header[4] = (unsigned char)type;
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (unsigned char)(ntp >> (8 * i));
+    }
+    r->bytes += MIRROR_HEADER_LEN + len;
+    return send_all(fd, packet, MIRROR_HEADER_LEN + (size_t)len);
+}
+
+static int stream_video(int fd, source_t *src, mirror_buffer_t *cipher, long frames, int fps, int max_frame,
+                        send_result_t *r) {
+    unsigned char *packet = malloc(MIRROR_HEADER_LEN + (size_t)max_frame + 16);
+    unsigned char *payload = packet + MIRROR_HEADER_LEN;
+    uint64_t interval = fps > 0 ? 1000000000ull / (uint64_t)fps : 0;
+    uint64_t start = now_ns();
+    int ret = 0;
+
+    r->start_ns = start;
+    if (!packet) {
+        return -1;
+    }
+    for (long f = 0; f < frames && ret == 0; f++) {
+        int is_idr, config_changed;
+        int len = next_frame(src, payload, &is_idr, &config_changed);
+        if (len == 0) {
+            break;      // end of file
+        }
+        if (interval) {
+            uint64_t due = start + (uint64_t)f * interval;
+            uint64_t now = now_ns();
+            if (now < due) {
+                struct timespec ts = { (time_t)((due - now) / 1000000000ull), (long)((due - now) % 1000000000ull) };
+                nanosleep(&ts, NULL);
+            }
+            r->late_ns[f] = now > due ? now - due : 0;
+        }
+        if (config_changed || f == 0) {
+            // New SPS/PPS go out as an avcC config packet ahead of the frame, as senders do
+            unsigned char *config = malloc(MIRROR_HEADER_LEN + 2 * MAX_PARAM_SET + 16);
+            int config_len = write_avcc(src, config + MIRROR_HEADER_LEN);
+            r->annexb_checksum = fnv1a(r->annexb_checksum, start_code, 4);
+            r->annexb_checksum = fnv1a(r->annexb_checksum, src->sps, src->sps_len);
+            r->annexb_checksum = fnv1a(r->annexb_checksum, start_code, 4);
+            r->annexb_checksum = fnv1a(r->annexb_checksum, src->pps, src->pps_len);
+            ret = send_packet(fd, cipher, config, config_len, MIRROR_TYPE_CONFIG, r);
+            free(config);
+            r->config_packets++;
+        }
+        if (ret == 0) {
+            ret = send_packet(fd, cipher, packet, len, MIRROR_TYPE_VIDEO, r);
+        }
+        r->frames++;
+        r->idr_frames += is_idr;
+    }
+    r->elapsed_ns = now_ns() - start;
+    free(packet);
+    return ret;
+}
+
+static void print_stage(const char *name, unsigned long long cpu_ns, unsigned long long total_ns, long frames) {
+    printf("    %-9s %8.1f ms  %6.2f us/frame  %5.1f%%\n", name, (double)cpu_ns / 1e6,
+           frames > 0 ? (double)cpu_ns / 1e3 / (double)frames : 0.0,
+           total_ns > 0 ? 100.0 * (double)cpu_ns / (double)total_ns : 0.0);
+}
+
+// --sink: wait for the pipeline to take every packet, then rates, CPU per stage and the sink's check
+static void report_pipeline(receiver_t *rx, const send_result_t *r, mirror_sink_t *sink) {
+    unsigned long long expected = (unsigned long long)(r->frames + r->config_packets);
+    uint64_t deadline = now_ns() + RECV_TIMEOUT_NS;
+    mirror_pipeline_stats_t ps;
+    airplay_session_stats_t ss;
+
+    mirror_pipeline_get_stats(rx->pipeline, &ps);
+    while (ps.packets < expected && now_ns() < deadline) {
+        usleep(100);
+        mirror_pipeline_get_stats(rx->pipeline, &ps);
+    }
+    // From the first frame sent to the last one through the sink
+    double secs = (double)(now_ns() - r->start_ns) / 1e9;
+    if (rx->session) {
+        airplay_session_get_stats(rx->session, &ss);
+    } else {
+        memset(&ss, 0, sizeof(ss));
+    }
+    unsigned long long total = ss.receive_cpu_ns + ss.framing_cpu_ns + ss.decrypt_cpu_ns +
+                               ps.assemble_cpu_ns + ps.sink_cpu_ns;
+    long frames = (long)ps.frames;
+
+    printf("  headless pipeline (%s sink, %s): %llu packets, %llu frames (%llu keyframes), %.1f MB in %.3f s\n",
+           sink->name, stream_io_backend_name(session_manager_get_backend(rx->manager)), ps.packets, ps.frames,
+           ps.keyframes, (double)ps.bytes_in / MB, secs);
+    printf("    %.0f packets/s, %.0f frames/s, %.1f MB/s in, %.1f MB/s to the sink\n",
+           (double)ps.packets / secs, (double)ps.frames / secs, (double)ps.bytes_in / MB / secs,
+           (double)ps.bytes_out / MB / secs);
+    printf("  receiver CPU per stage (%.1f ms, %.0f%% of one core while streaming):\n",
+           (double)total / 1e6, 100.0 * (double)total / 1e9 / secs);
+    print_stage("receive", ss.receive_cpu_ns, total, frames);
+    print_stage("framing", ss.framing_cpu_ns, total, frames);
+    print_stage("decrypt", ss.decrypt_cpu_ns, total, frames);
+    print_stage("assemble", ps.assemble_cpu_ns, total, frames);
+    print_stage("sink", ps.sink_cpu_ns, total, frames);
+
+    CHECK(ps.packets == expected);
+    CHECK(ps.frames == (unsigned long long)r->frames);
+    CHECK(ps.config_packets == (unsigned long long)r->config_packets);
+    CHECK(ps.dropped == 0);
+    CHECK(ss.dropped_packets == 0);
+    CHECK(ss.decrypt_cpu_ns > 0 && ps.assemble_cpu_ns > 0);
+    if (strcmp(sink->name, "checksum") == 0) {
+        uint64_t sum = mirror_sink_checksum_value(sink);
+        printf("  checksum sink: %016llx, %s\n", (unsigned long long)sum,
+               sum == r->annexb_checksum ? "matches the sender" : "MISMATCH");
+        CHECK(sum == r->annexb_checksum);
+    }
+}
+
+static int dump_annexb(const char *path, source_t *src, long frames) {
+    unsigned char *frame = malloc((size_t)src->idr_size + 16);
+    FILE *f = fopen(path, "wb");
+    if (!f || !frame) {
+        perror(path);
+        free(frame);
+        return -1;
+    }
+    for (long i = 0; i < frames; i++) {
+        int is_idr, changed;
+        int len = next_frame(src, frame, &is_idr, &changed);
+        if (is_idr) {
+            fwrite(start_code, 1, 4, f);
+            fwrite(src->sps, 1, (size_t)src->sps_len, f);
+            fwrite(start_code, 1, 4, f);
+            fwrite(src->pps, 1, (size_t)src->pps_len, f);
+        }
+        fwrite(start_code, 1, 4, f);
+        fwrite(frame + 4, 1, (size_t)len - 4, f);
+    }
+    fclose(f);
+    free(frame);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *vectors = test_arg_str(argc, argv, "--vectors");
+    const char *host = test_arg_str(argc, argv, "--host");
+    const char *input = test_arg_str(argc, argv, "--input");
+    const char *dump = test_arg_str(argc, argv, "--dump");
+    const char *sink_spec = test_arg_str(argc, argv, "--sink");
+    int port = (int)test_arg_long(argc, argv, "--port", 7000);
+    int loopback = test_arg_flag(argc, argv, "--loopback");
+    int avcc = test_arg_flag(argc, argv, "--avcc");
+    long bitrate_kbps = test_arg_long(argc, argv, "--bitrate", 8000);
+    int fps = (int)test_arg_long(argc, argv, "--fps", 60);
+    int idr_interval = (int)test_arg_long(argc, argv, "--idr-interval", 60);
+    long frames = test_arg_long(argc, argv, "--frames", 600);
+    int session_index = (int)test_arg_long(argc, argv, "--session", 0);
+    uint64_t rng = (uint64_t)test_arg_long(argc, argv, "--seed", 38);
+    source_t src;
+    fp_vector_t v;
+    receiver_t rx;
+    rtsp_server_t *server = NULL;
+    pthread_t server_tid;
+    mirror_sink_t *sink = NULL;
+    long file_len = 0;
+    int max_frame;
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&src, 0, sizeof(src));
+    memset(&rx, 0, sizeof(rx));
+
+    if (fps < 0 || idr_interval < 1 || frames < 1 || bitrate_kbps < 1) {
+        fprintf(stderr, "--fps >= 0, --idr-interval >= 1, --frames >= 1, --bitrate >= 1\n");
+        return 2;
+    }
+
+    // Video source
+    if (input) {
+        unsigned char *data = read_file(input, &file_len);
+        src.nals = malloc(sizeof(nal_t) * MAX_NALS);
+        if (!data || !src.nals) {
+            return 1;
+        }
+        src.data = data;
+        src.nal_count = avcc ? split_avcc(data, file_len, src.nals, MAX_NALS)
+                             : split_annexb(data, file_len, src.nals, MAX_NALS);
+        if (src.nal_count <= 0) {
+            fprintf(stderr, "%s: no %s NAL units\n", input, avcc ? "AVCC" : "Annex-B");
+            return 1;
+        }
+        max_frame = (int)file_len + 4 * src.nal_count;
+    } else {
+        // Average bitrate over a GOP, with an IDR four times the size of a P frame
+        long gop_bytes = bitrate_kbps * 1000 / 8 * idr_interval / (fps > 0 ? fps : 60);
+        src.synthetic = 1;
+        src.idr_interval = idr_interval;
+        src.p_size = (int)(gop_bytes / (idr_interval - 1 + 4));
+        if (src.p_size < 16) {
+            src.p_size = 16;
+        }
+        src.idr_size = idr_interval == 1 ? (int)gop_bytes : 4 * src.p_size;
+        if (src.idr_size > RANDOM_POOL) {
+            src.idr_size = RANDOM_POOL;
+        }
+        src.pool = malloc(RANDOM_POOL);
+        test_fill_random(&rng, src.pool, RANDOM_POOL);
+        for (int i = 0; i < RANDOM_POOL; i++) {
+            src.pool[i] |= src.pool[i] ? 0 : 0x80;  // no zero bytes, so a dump has no false start codes
+        }
+        synth_param_sets(&src);
+        max_frame = src.idr_size + 4;
+    }
+
+    if (dump) {
+        if (!src.synthetic) {
+            fprintf(stderr, "--dump writes the synthesized stream; drop --input\n");
+            return 2;
+        }
+        int ret = dump_annexb(dump, &src, frames);
+        printf("mirror sender: wrote %ld synthetic frames to %s\n", frames, dump);
+        return ret < 0 ? 1 : 0;
+    }
+
+    if (!vectors || load_fp_vector(vectors, session_index, &v) < 0 || (!loopback && !host)) {
+        fprintf(stderr, "usage: mirror_sender --vectors FILE (--loopback | --host ADDR --port N) [options]\n");
+        return 2;
+    }
+
+    if (loopback) {
+        rx.manager = session_manager_init(1, STREAM_IO_AUTO);
+        rx.checksum = FNV_OFFSET;
+        rx.latency_cap = frames;
+        rx.latency_ns = calloc((size_t)frames, sizeof(uint64_t));
+        server = rtsp_server_init(NULL);
+        if (!rx.manager || !server) {
+            return 1;
+        }
+        if (sink_spec) {
+            sink = open_sink(sink_spec);
+            rx.pipeline = malloc(sizeof(mirror_pipeline_t));
+            if (!sink || !rx.pipeline) {
+                return 1;
+            }
+            mirror_pipeline_init(rx.pipeline, sink, 1);
+            session_manager_set_stage_timing(rx.manager, 1);
+        }
+        rtsp_server_add_handler(server, "POST", "/fp-setup", handle_fp_setup, &rx);
+        rtsp_server_add_handler(server, "SETUP", NULL, handle_setup, &rx);
+        port = rtsp_server_listen(server, 0);
+        host = "127.0.0.1";
+        pthread_create(&server_tid, NULL, server_thread, server);
+    }
+
+    rtsp_client_t *client = calloc(1, sizeof(rtsp_client_t));
+    uint64_t stream_connection_id = test_rand(&rng);
+    client->fd = connect_to(host, port);
+    CHECK(client->fd >= 0);
+    int data_port = client->fd >= 0 ? handshake(client, &v, stream_connection_id, &rng) : -1;
+    CHECK(data_port > 0);
+
+    send_result_t r;
+    memset(&r, 0, sizeof(r));
+    r.checksum = FNV_OFFSET;
+    r.annexb_checksum = FNV_OFFSET;
+    r.late_ns = calloc((size_t)frames, sizeof(uint64_t));
+    int data_fd = data_port > 0 ? connect_to(host, data_port) : -1;
+    if (data_fd >= 0) {
+        mirror_buffer_t *cipher = mirror_buffer_init(NULL, v.aeskey);
+        mirror_buffer_init_aes(cipher, &stream_connection_id);
+        CHECK(stream_video(data_fd, &src, cipher, frames, fps, max_frame, &r) == 0);
+        mirror_buffer_destroy(cipher);
+    } else if (data_port > 0) {
+        fprintf(stderr, "cannot connect to data port %d\n", data_port);
+        CHECK(data_fd >= 0);
+    }
+
+    double secs = (double)r.elapsed_ns / 1e9;
+    printf("mirror sender: %s, %ld frames (%ld IDR, %ld config), %.1f MB in %.2f s: %.1f Mbps, %.1f fps\n",
+           input ? input : "synthetic", r.frames, r.idr_frames, r.config_packets, (double)r.bytes / MB, secs,
+           (double)r.bytes * 8 / 1e6 / secs, (double)r.frames / secs);
+    if (fps > 0 && r.frames > 0) {
+        printf("  pacing at %d fps: late p50 %.2f ms, p99 %.2f ms\n", fps,
+               (double)test_percentile(r.late_ns, (size_t)r.frames, 50) / 1e6,
+               (double)test_percentile(r.late_ns, (size_t)r.frames, 99) / 1e6);
+    }
+
+    if (loopback && rx.pipeline) {
+        report_pipeline(&rx, &r, sink);
+    } else if (loopback) {
+        // Wait for the receiver to drain the socket before comparing
+        uint64_t deadline = now_ns() + RECV_TIMEOUT_NS;
+        while (__atomic_load_n(&rx.frames, __ATOMIC_ACQUIRE) < r.frames && now_ns() < deadline) {
+            usleep(1000);
+        }
+        airplay_session_stats_t stats;
+        if (rx.session) {
+            airplay_session_get_stats(rx.session, &stats);
+        } else {
+            memset(&stats, 0, sizeof(stats));
+        }
+        CHECK(rx.frames == r.frames);
+        CHECK(rx.config_packets == r.config_packets);
+        CHECK(rx.checksum == r.checksum);
+        CHECK(stats.dropped_packets == 0);
+
+        long n = rx.frames < rx.latency_cap ? rx.frames : rx.latency_cap;
+        printf("  loopback receiver (%s): %ld frames, %llu NAL units, checksum %s\n",
+               stream_io_backend_name(session_manager_get_backend(rx.manager)), rx.frames,
+               stats.nal_units, rx.checksum == r.checksum ? "match" : "MISMATCH");
+        printf("  send-to-receive latency p50 %.3f ms, p99 %.3f ms, max %.3f ms; peak RSS %ld KB\n",
+               (double)test_percentile(rx.latency_ns, (size_t)n, 50) / 1e6,
+               (double)test_percentile(rx.latency_ns, (size_t)n, 99) / 1e6,
+               (double)test_percentile(rx.latency_ns, (size_t)n, 100) / 1e6, peak_rss_kb());
+    }
+
+    if (data_fd >= 0) {
+        close(data_fd);
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    free(client);
+    if (loopback) {
+        rtsp_server_stop(server);
+        pthread_join(server_tid, NULL);
+        rtsp_server_destroy(server);
+        session_manager_destroy(rx.manager);
+        free(rx.latency_ns);
+    }
+    if (rx.pipeline) {
+        // The file sink's stream is complete once the sink is flushed and closed
+        mirror_pipeline_stats_t ps;
+        struct stat st;
+        mirror_pipeline_get_stats(rx.pipeline, &ps);
+        mirror_sink_destroy(sink);
+        if (strncmp(sink_spec, "file:", 5) == 0) {
+            CHECK(stat(sink_spec + 5, &st) == 0 && (unsigned long long)st.st_size == ps.bytes_out);
+            printf("  file sink: %llu bytes of Annex-B in %s\n", ps.bytes_out, sink_spec + 5);
+        }
+        free(rx.pipeline);
+    }
+    free(r.late_ns);
+    free(src.pool);
+    free(src.nals);
+    free((void *)src.data);
+    return test_failures();
+}
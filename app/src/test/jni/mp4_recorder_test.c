@@ -0,0 +1,732 @@
+/**
+ * MP4 recorder: file structure, sample round trip, timing, slow storage and cost.
+ *
+ * A synthetic mirror stream (H.264, then HEVC from a boxed hvcC) goes through
+ * the real assembler and pooled buffers into the recorder, the way the decode
+ * thread drives it, and the file is parsed back: ftyp, moov with the sender's
+ * avcC / hvcC as the sample description, then moof + mdat fragments whose
+ * samples must be the original length-prefixed payloads byte for byte, with
+ * sync flags on the keyframes, decode times from the sender timestamps (a
+ * two-second static screen included) and a changed config in-band ahead of
+ * the next keyframe. Every buffer must come back to the pool.
+ *
+ * Slow storage: the recorder writes into a pipe drained at a quarter of the
+ * stream's rate. The decode side must never wait, the backlog must stay under
+ * its bound, drops must resume at a keyframe and the file must stay valid.
+ *
+ * Last, the decode-thread CPU per frame that recording adds (queueing and
+ * reclaiming, no copy) and the writer's throughput into a real file.
+ *
+ *   mp4_recorder_test [--frames N] [--seconds N] [--output PATH] [--seed N]
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "access_unit.h"
+#include "buffer_pool.h"
+#include "h264_params.h"
+#include "hevc_params.h"
+#include "mp4_recorder.h"
+#include "test_util.h"
+
+#define FRAME_NS 16666667ll             // 60 fps
+#define MAX_FRAMES 20000
+#define MAX_PAYLOAD (160 * 1024)
+#define TIMESCALE MP4_RECORDER_TIMESCALE
+
+// x264 High 4.0 1920x1080, then mirror_sender's synthetic High 4.2 parameter sets
+static const unsigned char avcc_a[] = {
+    0x01, 0x64, 0x00, 0x28, 0xff, 0xe1, 0x00, 0x1b,
+    0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0xc0, 0x44, 0x00, 0x00, 0x03,
+    0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xc8, 0x3c, 0x60, 0xc6, 0x58,
+    0x01, 0x00, 0x06, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0,
+};
+static const unsigned char avcc_b[] = {
+    0x01, 0x64, 0x00, 0x2a, 0xfd, 0xe1, 0x00, 0x0c,
+    0x67, 0x64, 0x00, 0x2a, 0xac, 0x2b, 0x40, 0x3c, 0x01, 0x13, 0xf2, 0xe0,
+    0x01, 0x00, 0x04, 0x68, 0xee, 0x3c, 0xb0,
+};
+
+// x265 --preset medium, 1920x1080 Main (hevc_params_test)
+static const unsigned char x265_vps[] = {
+    0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03,
+    0x00, 0x00, 0x03, 0x00, 0x78, 0x95, 0x98, 0x09,
+};
+static const unsigned char x265_sps[] = {
+    0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+    0x00, 0x78, 0xa0, 0x03, 0xc0, 0x80, 0x10, 0xe5, 0x96, 0x66, 0x69, 0x24, 0xca, 0xe0, 0x10, 0x00,
+    0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x01, 0xe0, 0x80,
+};
+static const unsigned char x265_pps[] = { 0x44, 0x01, 0xc1, 0x72, 0xb4, 0x62, 0x40 };
+
+typedef struct {
+    int codec;
+    int count;
+    int gop;
+    uint64_t seed;
+    int avg_len;                        // non-keyframe payload; keyframes are 8x
+    int len[MAX_FRAMES];
+    int key[MAX_FRAMES];
+    uint64_t ntp[MAX_FRAMES];
+    int recorded[MAX_FRAMES];
+    const unsigned char *config;        // in effect from frame 0
+    int config_len;
+    int width;                          // of its SPS
+    int height;
+    int change_at;                      // frame that gets config_b's parameter sets in-band, -1 none
+    const unsigned char *config_b;
+    int config_b_len;
+} stream_t;
+
+static stream_t g_stream;
+static stream_t g_slow_stream;
+
+static uint64_t ns_to_ntp(int64_t ns) {
+    return ((uint64_t)(ns / 1000000000ll) << 32) | (((uint64_t)(ns % 1000000000ll) << 32) / 1000000000ull);
+}
+
+static uint32_t rd32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void wr32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void build_stream(stream_t *s, int codec, int count, int gop, int avg_len, int pause_at, uint64_t seed) {
+    uint64_t rng = seed;
+    int64_t t = 1000ll * 1000000000ll;
+
+    s->codec = codec;
+    s->count = count;
+    s->gop = gop;
+    s->seed = seed;
+    s->avg_len = avg_len;
+    s->change_at = -1;
+    for (int i = 0; i < count; i++) {
+        s->key[i] = i % gop == 0;
+        s->len[i] = s->key[i] ? 8 * avg_len : avg_len / 2 + (int)(test_rand(&rng) % (uint64_t)avg_len);
+        if (s->len[i] > MAX_PAYLOAD) {
+            s->len[i] = MAX_PAYLOAD;
+        }
+        // Sender clock: 60 fps with a little jitter, and a static screen (no frames) at pause_at
+        t += FRAME_NS + (int64_t)(test_rand(&rng) % 2000000) - 1000000;
+        if (i == pause_at) {
+            t += 2000000000ll;
+        }
+        s->ntp[i] = ns_to_ntp(t);
+        s->recorded[i] = 0;
+    }
+}
+
+// Length-prefixed payload of frame i: an SEI on keyframes, then one slice. Bytes are never zero, so
+// no start code can appear inside a NAL unit, as emulation prevention guarantees for real streams.
+static int make_payload(const stream_t *s, int i, unsigned char *out) {
+    uint64_t rng = s->seed ^ ((uint64_t)i * 0x9e3779b97f4a7c15ull);
+    int hevc = s->codec == ACCESS_UNIT_CODEC_HEVC;
+    int pos = 0, body;
+
+    if (s->key[i]) {
+        wr32(out, 12);
+        out[4] = hevc ? 39 << 1 : 6;    // prefix SEI
+        out[5] = hevc ? 1 : 0x11;
+        memset(out + 6, 0x11, 10);
+        pos = 16;
+    }
+    body = s->len[i] - pos - 4;
+    wr32(out + pos, (uint32_t)body);
+    if (hevc) {
+        out[pos + 4] = (unsigned char)((s->key[i] ? HEVC_NAL_IDR_W_RADL : 1) << 1);
+        out[pos + 5] = 1;
+    } else {
+        out[pos + 4] = s->key[i] ? 0x65 : 0x41;
+    }
+    for (int k = pos + 4 + (hevc ? 2 : 1); k < s->len[i]; k++) {
+        out[k] = (unsigned char)((test_rand(&rng) >> 56) | 1);
+    }
+    return s->len[i];
+}
+
+// Parameter sets of a config as length-prefixed NAL units, as the recorder puts them in-band
+static int config_nals(const unsigned char *cfg, unsigned char *out) {
+    int pos = 5, n = 0;
+
+    for (int set = 0; set < 2; set++) {
+        int count = set == 0 ? cfg[pos] & 0x1f : cfg[pos];
+        pos++;
+        for (int i = 0; i < count; i++) {
+            int nal = cfg[pos] << 8 | cfg[pos + 1];
+            wr32(out + n, (uint32_t)nal);
+            memcpy(out + n + 4, cfg + pos + 2, (size_t)nal);
+            n += 4 + nal;
+            pos += 2 + nal;
+        }
+    }
+    return n;
+}
+
+// Offset of the first child box of the given type in [pos, end), -1 if none
+static long find_box(const unsigned char *buf, long pos, long end, const char *type) {
+    while (pos + 8 <= end) {
+        uint32_t size = rd32(buf + pos);
+        if (size < 8 || pos + size > end) {
+            return -1;
+        }
+        if (memcmp(buf + pos + 4, type, 4) == 0) {
+            return pos;
+        }
+        pos += size;
+    }
+    return -1;
+}
+
+// Start of the box at the end of a path of nested boxes from the top level, -1 if missing
+static long box_path(const unsigned char *buf, long len, const char *const *path) {
+    long box = -1, pos = 0, end = len;
+
+    for (int i = 0; path[i] != NULL; i++) {
+        box = find_box(buf, pos, end, path[i]);
+        if (box < 0) {
+            return -1;
+        }
+        end = box + rd32(buf + box);
+        pos = box + 8;
+    }
+    return box;
+}
+
+typedef struct {
+    int fragments;
+    int samples;
+    int bad_samples;
+    int bad_timing;
+    int bad_sync;
+    int frag_start_not_sync;            // a fragment began on a non-keyframe after a drop
+} parse_result_t;
+
+// Parses the whole file and checks it against the stream's recorded frames
+static void check_file(const stream_t *s, const unsigned char *buf, long len, parse_result_t *r) {
+    static unsigned char expect[MAX_PAYLOAD + MP4_RECORDER_MAX_CONFIG];
+    static const char *const stsd_path[] = { "moov", "trak", "mdia", "minf", "stbl", "stsd", NULL };
+    static const char *const mdhd_path[] = { "moov", "trak", "mdia", "mdhd", NULL };
+    int hevc = s->codec == ACCESS_UNIT_CODEC_HEVC;
+    const unsigned char *record;
+    long pos, entry, cfg_box, mdhd;
+    int frame = 0, prev_frame = -1;
+    uint32_t sequence = 0;
+    int64_t base_ns = -1, dts = 0;
+
+    memset(r, 0, sizeof(*r));
+    CHECK(len > 16 && memcmp(buf + 4, "ftyp", 4) == 0 && memcmp(buf + 8, "isom", 4) == 0);
+    if (len <= 16) {
+        return;
+    }
+    pos = rd32(buf);
+    CHECK(find_box(buf, pos, len, "moov") == pos);
+
+    entry = box_path(buf, len, stsd_path);
+    entry = entry > 0 ? entry + 16 : -1;    // first sample entry, past version/flags and the count
+    CHECK(entry > 0 && memcmp(buf + entry + 4, hevc ? "hvc1" : "avc1", 4) == 0);
+    if (entry < 0) {
+        return;
+    }
+    CHECK((buf[entry + 32] << 8 | buf[entry + 33]) == s->width);
+    CHECK((buf[entry + 34] << 8 | buf[entry + 35]) == s->height);
+    cfg_box = find_box(buf, entry + 86, entry + rd32(buf + entry), hevc ? "hvcC" : "avcC");
+    CHECK(cfg_box > 0);
+    if (cfg_box > 0) {
+        // The sender's record verbatim, with 4-byte NAL lengths declared
+        record = s->config + (hevc ? 8 : 0);
+        int record_len = s->config_len - (hevc ? 8 : 0);
+        CHECK((int)rd32(buf + cfg_box) == 8 + record_len);
+        for (int i = 0; i < record_len; i++) {
+            unsigned char want = record[i];
+            if (i == (hevc ? 21 : 4)) {
+                want |= 3;
+            }
+            if (buf[cfg_box + 8 + i] != want) {
+                CHECK(buf[cfg_box + 8 + i] == want);
+                break;
+            }
+        }
+    }
+    mdhd = box_path(buf, len, mdhd_path);
+    CHECK(mdhd > 0 && rd32(buf + mdhd + 20) == TIMESCALE);
+
+    pos += rd32(buf + pos);
+    while (pos + 8 <= len) {
+        long moof = pos, mdat, traf, tfdt, trun, data;
+        uint32_t count, flags;
+
+        CHECK(memcmp(buf + moof + 4, "moof", 4) == 0);
+        if (memcmp(buf + moof + 4, "moof", 4) != 0) {
+            return;
+        }
+        mdat = moof + rd32(buf + moof);
+        CHECK(mdat + 8 <= len && memcmp(buf + mdat + 4, "mdat", 4) == 0);
+        CHECK(rd32(buf + moof + 20) == ++sequence);
+        traf = find_box(buf, moof + 8, mdat, "traf");
+        tfdt = find_box(buf, traf + 8, mdat, "tfdt");
+        trun = find_box(buf, traf + 8, mdat, "trun");
+        CHECK(traf > 0 && tfdt > 0 && trun > 0 && buf[tfdt + 8] == 1);
+        if (traf < 0 || tfdt < 0 || trun < 0) {
+            return;
+        }
+        CHECK((int64_t)((uint64_t)rd32(buf + tfdt + 12) << 32 | rd32(buf + tfdt + 16)) == dts);
+        flags = rd32(buf + trun + 8) & 0xffffff;
+        count = rd32(buf + trun + 12);
+        CHECK(flags == 0x701 && count >= 1 && count <= MP4_RECORDER_FRAGMENT_SAMPLES);
+        data = moof + rd32(buf + trun + 16);
+        CHECK(data == mdat + 8);
+        for (uint32_t i = 0; i < count; i++) {
+            const unsigned char *entry_p = buf + trun + 20 + 12 * i;
+            uint32_t duration = rd32(entry_p), size = rd32(entry_p + 4), sflags = rd32(entry_p + 8);
+            int n = 0, sync = (sflags & 0x00010000) == 0;
+
+            while (frame < s->count && !s->recorded[frame]) {
+                frame++;
+            }
+            if (frame >= s->count || data + size > len) {
+                r->bad_samples++;
+                return;
+            }
+            if (frame == s->change_at) {
+                n = config_nals(s->config_b, expect);
+            }
+            n += make_payload(s, frame, expect + n);
+            if ((int)size != n || memcmp(buf + data, expect, (size_t)n) != 0) {
+                r->bad_samples++;
+            }
+            if (sync != s->key[frame]) {
+                r->bad_sync++;
+            }
+            if (i == 0 && !sync && prev_frame >= 0 && prev_frame != frame - 1) {
+                r->frag_start_not_sync++;
+            }
+            // Decode time of the next recorded frame, from the sender clock
+            if (base_ns < 0) {
+                base_ns = access_unit_ntp_to_ns(s->ntp[frame]);
+            }
+            int next = frame + 1;
+            while (next < s->count && !s->recorded[next]) {
+                next++;
+            }
+            if (next < s->count) {
+                int64_t want = (access_unit_ntp_to_ns(s->ntp[next]) - base_ns) * 9 / 100000 - dts;
+                if ((int64_t)duration != want) {
+                    r->bad_timing++;
+                }
+            }
+            dts += duration;
+            data += size;
+            prev_frame = frame;
+            frame++;
+            r->samples++;
+        }
+        CHECK(data == mdat + (long)rd32(buf + mdat));
+        r->fragments++;
+        pos = mdat + rd32(buf + mdat);
+    }
+    CHECK(pos == len);
+}
+
+static void set_size_h264(stream_t *s) {
+    h264_sps_t sps;
+
+    CHECK(h264_sps_parse(s->config + 8, s->config[6] << 8 | s->config[7], &sps) == 0);
+    s->width = sps.width;
+    s->height = sps.height;
+}
+
+static unsigned char *read_file(const char *path, long *len) {
+    FILE *f = fopen(path, "rb");
+    unsigned char *buf;
+
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc((size_t)*len + 1);
+    if (buf != NULL && fread(buf, 1, (size_t)*len, f) != (size_t)*len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+static void reclaim_all(mp4_recorder_t *rec, buffer_pool_t *pool, uint64_t *next_cookie) {
+    frame_desc_t desc;
+
+    while (mp4_recorder_reclaim(rec, &desc) == 0) {
+        // Buffers come back in the order they were taken
+        CHECK(desc.cookie >= *next_cookie);
+        *next_cookie = desc.cookie + 1;
+        buffer_pool_release(pool, desc.data);
+    }
+}
+
+// Decode-thread side: assemble each frame in a pooled buffer and offer it to the recorder.
+// frame_gap_ns > 0 paces the frames in real time. Returns the worst mp4_recorder_frame call in ns.
+static uint64_t feed(stream_t *s, mp4_recorder_t *rec, buffer_pool_t *pool, int64_t frame_gap_ns,
+                     uint64_t *call_ns, int *calls) {
+    access_unit_assembler_t assembler;
+    uint64_t next_cookie = 0, worst = 0, start = now_ns();
+
+    access_unit_assembler_init(&assembler);
+    access_unit_assembler_set_codec(&assembler, s->codec);
+    CHECK(mp4_recorder_config(rec, s->config, s->config_len) == 0);
+    *calls = 0;
+    for (int i = 0; i < s->count; i++) {
+        unsigned char *buf = buffer_pool_acquire(pool, (size_t)s->len[i]);
+        access_unit_t au;
+        uint64_t t0;
+        int len = make_payload(s, i, buf);
+
+        if (frame_gap_ns > 0) {
+            while ((int64_t)(now_ns() - start) < frame_gap_ns * i) {
+                struct timespec ts = { 0, 200000 };
+                nanosleep(&ts, NULL);
+            }
+        }
+        if (i == s->change_at) {
+            CHECK(mp4_recorder_config(rec, s->config_b, s->config_b_len) == 0);
+        }
+        CHECK(access_unit_assemble(&assembler, buf, len, s->ntp[i], 0, &au) > 0);
+        CHECK(!!(au.flags & ACCESS_UNIT_KEYFRAME) == s->key[i]);
+        t0 = now_ns();
+        s->recorded[i] = mp4_recorder_frame(rec, buf, au.len, au.flags, s->ntp[i], (uint64_t)i);
+        t0 = now_ns() - t0;
+        if (call_ns != NULL) {
+            call_ns[(*calls)++] = t0;
+        }
+        if (t0 > worst) {
+            worst = t0;
+        }
+        if (!s->recorded[i]) {
+            buffer_pool_release(pool, buf);
+        }
+        reclaim_all(rec, pool, &next_cookie);
+    }
+    CHECK(mp4_recorder_stop(rec) == 0);
+    reclaim_all(rec, pool, &next_cookie);
+    return worst;
+}
+
+static int temp_file(char *path) {
+    strcpy(path, "/tmp/mp4_recorder_test_XXXXXX");
+    return mkstemp(path);
+}
+
+static void record_and_check(stream_t *s, const char *label) {
+    char path[64];
+    int fd = temp_file(path);
+    buffer_pool_t *pool = buffer_pool_init(8 << 20);
+    mp4_recorder_t *rec = mp4_recorder_create(fd, 0);
+    buffer_pool_stats_t ps;
+    mp4_recorder_stats_t st;
+    parse_result_t r;
+    unsigned char *file;
+    long len = 0;
+    int recorded = 0;
+
+    CHECK(fd >= 0 && rec != NULL);
+    feed(s, rec, pool, 0, NULL, &recorded);
+    mp4_recorder_get_stats(rec, &st);
+    recorded = 0;
+    for (int i = 0; i < s->count; i++) {
+        recorded += s->recorded[i];
+    }
+    buffer_pool_get_stats(pool, &ps);
+    CHECK(ps.bytes_in_use == 0);
+    CHECK(st.backlog_bytes == 0 && st.failed == 0 && st.write_errors == 0);
+    CHECK(st.frames == (unsigned long long)recorded && st.samples == st.frames);
+
+    file = read_file(path, &len);
+    CHECK(file != NULL && (unsigned long long)len == st.bytes_written);
+    if (file != NULL) {
+        check_file(s, file, len, &r);
+        CHECK(r.samples == recorded && r.bad_samples == 0 && r.bad_timing == 0 && r.bad_sync == 0);
+        CHECK(r.fragments == (int)st.fragments);
+        printf("%s: %d frames -> %d samples in %d fragments, %ld bytes, %llu config change(s) in-band, "
+               "dropped %llu (backlog) / %llu (waiting)\n", label, s->count, r.samples, r.fragments, len,
+               st.config_changes, st.dropped_backlog, st.dropped_waiting);
+        free(file);
+    }
+    mp4_recorder_destroy(rec);
+    buffer_pool_destroy(pool);
+    unlink(path);
+}
+
+static void test_h264(uint64_t seed) {
+    stream_t *s = &g_stream;
+
+    build_stream(s, ACCESS_UNIT_CODEC_H264, 600, 60, 6000, 200, seed);
+    s->config = avcc_a;
+    s->config_len = sizeof(avcc_a);
+    set_size_h264(s);
+    s->config_b = avcc_b;
+    s->config_b_len = sizeof(avcc_b);
+    s->change_at = 300;
+    record_and_check(s, "h264");
+}
+
+static void test_hevc(uint64_t seed) {
+    static unsigned char boxed[256];
+    static const unsigned char header[23] = {
+        0x01, 0x01, 0x60, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x78,
+        0xf0, 0x00, 0xfc, 0xfd, 0xf8, 0xf8, 0x00, 0x00, 0x0f, 0x03,
+    };
+    const unsigned char *nals[3] = { x265_vps, x265_sps, x265_pps };
+    const int nal_len[3] = { sizeof(x265_vps), sizeof(x265_sps), sizeof(x265_pps) };
+    const int types[3] = { HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS };
+    stream_t *s = &g_stream;
+    int n = 8;
+
+    // hvcC record inside its box, as some senders send it
+    memcpy(boxed + n, header, sizeof(header));
+    boxed[n + 21] = 0x0d;               // declares 2-byte NAL lengths; the file must say 4
+    n += sizeof(header);
+    for (int i = 0; i < 3; i++) {
+        boxed[n] = (unsigned char)(0x80 | types[i]);
+        boxed[n + 1] = 0;
+        boxed[n + 2] = 1;
+        boxed[n + 3] = (unsigned char)(nal_len[i] >> 8);
+        boxed[n + 4] = (unsigned char)nal_len[i];
+        memcpy(boxed + n + 5, nals[i], (size_t)nal_len[i]);
+        n += 5 + nal_len[i];
+    }
+    wr32(boxed, (uint32_t)n);
+    memcpy(boxed + 4, "hvcC", 4);
+
+    build_stream(s, ACCESS_UNIT_CODEC_HEVC, 240, 60, 6000, -1, seed + 1);
+    s->config = boxed;
+    s->config_len = n;
+    s->width = 1920;
+    s->height = 1080;
+    record_and_check(s, "hevc");
+}
+
+// Nothing is taken before a config and a keyframe; a config for the other codec ends the recording
+static void test_policy(void) {
+    char path[64];
+    int fd = temp_file(path);
+    mp4_recorder_t *rec = mp4_recorder_create(fd, 0);
+    unsigned char frame_a[8] = { 0, 0, 0, 1, 0x65, 0x11, 0x22 };
+    unsigned char frame_b[8] = { 0, 0, 0, 1, 0x65, 0x11, 0x22 };
+    static const unsigned char bogus[] = { 0x02, 0x00, 0x00 };
+    const int key = ACCESS_UNIT_KEYFRAME | ACCESS_UNIT_PICTURE;
+    mp4_recorder_stats_t st;
+    frame_desc_t desc;
+    int taken;
+
+    CHECK(mp4_recorder_frame(rec, frame_a, 7, key, 0, 1) == 0);
+    CHECK(mp4_recorder_config(rec, bogus, sizeof(bogus)) == -1);
+    CHECK(mp4_recorder_config(rec, avcc_a, sizeof(avcc_a)) == 0);
+    CHECK(mp4_recorder_frame(rec, frame_a, 7, ACCESS_UNIT_PICTURE, 0, 2) == 0);
+    CHECK(mp4_recorder_frame(rec, frame_a, 7, key, 0, 3) == 1);
+    CHECK(mp4_recorder_config(rec, g_stream.config, g_stream.config_len) == 0);     // hvcC from test_hevc
+    // Taken or not depending on whether the writer has seen the codec change yet
+    taken = mp4_recorder_frame(rec, frame_b, 7, key, 1ull << 32, 5);
+    CHECK(mp4_recorder_stop(rec) == 0);
+    mp4_recorder_get_stats(rec, &st);
+    CHECK(st.failed == 1 && st.samples == 0);
+    CHECK(st.dropped_waiting == 2 && st.configs == 2);
+    CHECK(mp4_recorder_reclaim(rec, &desc) == 0 && desc.cookie == 3 && desc.data == frame_a);
+    if (taken) {
+        CHECK(mp4_recorder_reclaim(rec, &desc) == 0 && desc.cookie == 5 && desc.data == frame_b);
+    }
+    CHECK(mp4_recorder_reclaim(rec, &desc) == -1);
+    CHECK(mp4_recorder_frame(rec, frame_b, 7, key, 0, 6) == 0);
+    mp4_recorder_destroy(rec);
+    unlink(path);
+}
+
+typedef struct {
+    int fd;
+    long rate;                          // bytes per second
+    unsigned char *out;
+    long len;
+    long cap;
+} slow_reader_t;
+
+static void *slow_reader_main(void *arg) {
+    slow_reader_t *r = arg;
+    uint64_t start = now_ns();
+
+    for (;;) {
+        // Read only what the budget allows so far
+        long allowed = (long)((double)(now_ns() - start) / 1e9 * (double)r->rate) - r->len;
+        if (allowed <= 0) {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        if (allowed > 65536) {
+            allowed = 65536;
+        }
+        if (r->len + allowed > r->cap) {
+            r->cap = (r->len + allowed) * 2;
+            r->out = realloc(r->out, (size_t)r->cap);
+        }
+        ssize_t n = read(r->fd, r->out + r->len, (size_t)allowed);
+        if (n <= 0) {
+            break;
+        }
+        r->len += n;
+    }
+    return NULL;
+}
+
+static void test_slow_storage(int seconds, uint64_t seed) {
+    stream_t *s = &g_slow_stream;
+    size_t backlog = 1 << 20;
+    int frames = seconds * 500, pipefd[2], calls = 0;
+    slow_reader_t reader = { 0 };
+    pthread_t thread;
+    buffer_pool_t *pool = buffer_pool_init(8 << 20);
+    mp4_recorder_t *rec;
+    mp4_recorder_stats_t st;
+    parse_result_t r;
+    uint64_t *call_ns, worst;
+
+    if (frames > MAX_FRAMES) {
+        frames = MAX_FRAMES;
+    }
+    // 500 frames/s of ~8 KB (keyframes 64 KB every 50): about 5 MB/s into a pipe drained at 1.25 MB/s
+    build_stream(s, ACCESS_UNIT_CODEC_H264, frames, 50, 8000, -1, seed + 2);
+    s->config = avcc_a;
+    s->config_len = sizeof(avcc_a);
+    set_size_h264(s);
+    CHECK(pipe(pipefd) == 0);
+    reader.fd = pipefd[0];
+    reader.rate = 1250000;
+    pthread_create(&thread, NULL, slow_reader_main, &reader);
+    rec = mp4_recorder_create(pipefd[1], backlog);
+    call_ns = malloc(sizeof(uint64_t) * (size_t)frames);
+
+    worst = feed(s, rec, pool, 2000000, call_ns, &calls);
+    mp4_recorder_get_stats(rec, &st);
+    // The writer is done once stop returned; let the reader see EOF
+    pthread_join(thread, NULL);
+    close(pipefd[0]);
+
+    CHECK(st.dropped_backlog > 0);
+    CHECK(st.backlog_high_water <= backlog);
+    CHECK(st.failed == 0 && st.backlog_bytes == 0);
+    check_file(s, reader.out, reader.len, &r);
+    CHECK(r.samples == (int)st.frames && r.bad_samples == 0 && r.bad_sync == 0 && r.bad_timing == 0);
+    CHECK(r.frag_start_not_sync == 0);
+    uint64_t p50 = test_percentile(call_ns, (size_t)calls, 50.0);
+    uint64_t p99 = test_percentile(call_ns, (size_t)calls, 99.0);
+    // Never waits for storage: a blocked call would take as long as the pipe's drain
+    CHECK(p99 < 1000000);
+    printf("slow storage: %d frames at 500/s, storage at %ld KB/s: recorded %llu, dropped %llu (backlog) / "
+           "%llu (to keyframe), backlog high water %zu KB of %zu KB, longest write %.1f ms; "
+           "mp4_recorder_frame p50 %llu ns, p99 %llu ns, max %llu ns\n",
+           frames, reader.rate / 1000, st.frames, st.dropped_backlog, st.dropped_waiting,
+           st.backlog_high_water / 1024, backlog / 1024, st.max_write_ns / 1e6,
+           (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)worst);
+
+    mp4_recorder_destroy(rec);
+    buffer_pool_destroy(pool);
+    free(call_ns);
+    free(reader.out);
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Decode-thread CPU per frame with and without recording, and the writer's throughput
+static void bench(int frames, const char *output, uint64_t seed) {
+    stream_t *s = &g_stream;
+    access_unit_assembler_t assembler;
+    buffer_pool_t *pool = buffer_pool_init(16 << 20);
+    char path[64];
+    uint64_t cpu[2] = { 0, 0 }, cookie = 0;
+    mp4_recorder_stats_t st;
+    mp4_recorder_t *rec = NULL;
+    unsigned long long bytes = 0;
+
+    if (frames > MAX_FRAMES) {
+        frames = MAX_FRAMES;
+    }
+    // ~1080p60 screen content: 20 KB frames, 160 KB keyframes every 2 s
+    build_stream(s, ACCESS_UNIT_CODEC_H264, frames, 120, 20000, -1, seed + 3);
+    s->config = avcc_a;
+    s->config_len = sizeof(avcc_a);
+    for (int pass = 0; pass < 2; pass++) {
+        int fd = -1;
+
+        access_unit_assembler_init(&assembler);
+        if (pass == 1) {
+            fd = output != NULL ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : temp_file(path);
+            rec = mp4_recorder_create(fd, 0);
+            mp4_recorder_config(rec, s->config, s->config_len);
+        }
+        for (int i = 0; i < s->count; i++) {
+            unsigned char *buf = buffer_pool_acquire(pool, (size_t)s->len[i]);
+            access_unit_t au;
+            int len = make_payload(s, i, buf);
+            uint64_t t0 = thread_cpu_ns();
+
+            access_unit_assemble(&assembler, buf, len, s->ntp[i], 0, &au);
+            bytes += pass == 1 ? (unsigned long long)au.len : 0;
+            if (rec == NULL || !mp4_recorder_frame(rec, buf, au.len, au.flags, s->ntp[i], (uint64_t)i)) {
+                buffer_pool_release(pool, buf);
+            }
+            if (rec != NULL) {
+                reclaim_all(rec, pool, &cookie);
+            }
+            cpu[pass] += thread_cpu_ns() - t0;
+        }
+        if (rec != NULL) {
+            mp4_recorder_stop(rec);
+            reclaim_all(rec, pool, &cookie);
+        }
+    }
+    mp4_recorder_get_stats(rec, &st);
+    CHECK(st.samples == st.frames && st.failed == 0);
+    printf("bench: %d frames (%.1f MB): decode thread %.0f ns/frame without recording, %.0f ns/frame with "
+           "(+%.0f ns, no copy); writer %llu fragments, %.0f MB/s in writev, %llu dropped\n",
+           frames, bytes / 1e6, (double)cpu[0] / frames, (double)cpu[1] / frames,
+           (double)((int64_t)cpu[1] - (int64_t)cpu[0]) / frames, st.fragments,
+           st.write_ns > 0 ? st.bytes_written / (st.write_ns / 1e9) / 1e6 : 0.0,
+           st.dropped_backlog + st.dropped_waiting);
+    mp4_recorder_destroy(rec);
+    buffer_pool_destroy(pool);
+    if (output == NULL) {
+        unlink(path);
+    }
+}
+
+int main(int argc, char **argv) {
+    int frames = (int)test_arg_long(argc, argv, "--frames", 3000);
+    int seconds = (int)test_arg_long(argc, argv, "--seconds", 2);
+    const char *output = test_arg_str(argc, argv, "--output");
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 48);
+
+    if (frames < 1 || seconds < 1) {
+        fprintf(stderr, "usage: mp4_recorder_test [--frames N] [--seconds N] [--output PATH] [--seed N]\n");
+        return 2;
+    }
+    test_h264(seed | 1);
+    test_hevc(seed | 1);
+    test_policy();
+    test_slow_storage(seconds, seed | 1);
+    bench(frames, output, seed | 1);
+    return test_failures();
+}
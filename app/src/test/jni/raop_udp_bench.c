@@ -0,0 +1,440 @@
+/**
+ * Batched RAOP UDP transport: correctness checks and loopback benchmark.
+ *
+ * Checks payload/sequence delivery, truncation, SO_TIMESTAMPNS receive times,
+ * sendmmsg batching, a timing-style request/reply exchange and the batch-size
+ * tuner (grows under bursts, shrinks under a trickle). The benchmark runs a
+ * synthetic RTP audio sender thread over loopback (credit-windowed so nothing
+ * is dropped) and compares one recvfrom() per datagram with raop_udp_recv()
+ * at a fixed and a tuned batch size: receiver CPU ns per packet, syscalls per
+ * packet and packets per second. "stream" has the receiver waiting in recv as
+ * packets arrive; "backlog" lets a window of packets queue up first, as happens
+ * when the receive thread is descheduled on a busy low-end box.
+ *
+ *   raop_udp_bench [--packets N] [--window N] [--seed S]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "raop_udp.h"
+#include "test_util.h"
+
+#define RTP_HEADER_LEN 12
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static struct sockaddr_in loopback(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+static int plain_socket(int timeout_ms) {
+    struct sockaddr_in addr = loopback(0);
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    int rcvbuf = 1 << 20;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    return fd;
+}
+
+static int socket_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+// RTP audio packet: V=2, PT 96, sequence, timestamp (352 samples/packet), SSRC, then payload
+static int make_rtp(unsigned char *buf, uint16_t seq, int payload_len) {
+    uint32_t ts = (uint32_t)seq * 352;
+    buf[0] = 0x80;
+    buf[1] = 0x60;
+    buf[2] = seq >> 8;
+    buf[3] = seq & 0xff;
+    buf[4] = ts >> 24;
+    buf[5] = ts >> 16;
+    buf[6] = ts >> 8;
+    buf[7] = ts;
+    memcpy(buf + 8, "\x12\x34\x56\x78", 4);
+    for (int i = 0; i < payload_len; i++) {
+        buf[RTP_HEADER_LEN + i] = (unsigned char)(seq + i);
+    }
+    return RTP_HEADER_LEN + payload_len;
+}
+
+static int rtp_valid(const unsigned char *buf, int len, uint16_t *seq) {
+    if (len < RTP_HEADER_LEN || buf[0] != 0x80 || buf[1] != 0x60) {
+        return 0;
+    }
+    *seq = (uint16_t)(buf[2] << 8 | buf[3]);
+    // First and last payload bytes: cheap enough not to swamp the receive cost being measured
+    int n = len - RTP_HEADER_LEN;
+    return n == 0 || (buf[RTP_HEADER_LEN] == (unsigned char)*seq &&
+                      buf[len - 1] == (unsigned char)(*seq + n - 1));
+}
+
+static void test_delivery(void) {
+    raop_udp_t *udp = raop_udp_init(NULL, 0, RAOP_UDP_TIMESTAMPS, 500);
+    int tx = plain_socket(500);
+    struct sockaddr_in to = loopback(raop_udp_get_port(udp));
+    unsigned char buf[4096];
+    static const int sizes[] = { 0, 1, 340, 1400, 2048 - RTP_HEADER_LEN, 3000, 16 };
+
+    CHECK(udp != NULL && raop_udp_get_port(udp) > 0);
+    uint64_t before = realtime_ns();
+    for (int i = 0; i < 7; i++) {
+        int len = make_rtp(buf, (uint16_t)(100 + i), sizes[i]);
+        sendto(tx, buf, len, 0, (struct sockaddr *)&to, sizeof(to));
+    }
+
+    int got = 0;
+    while (got < 7) {
+        int n = raop_udp_recv(udp);
+        CHECK(n > 0);
+        if (n <= 0) {
+            break;
+        }
+        for (int i = 0; i < n; i++, got++) {
+            const raop_udp_packet_t *p = raop_udp_get_packet(udp, i);
+            uint16_t seq = 0;
+            CHECK(p->truncated == (sizes[got] + RTP_HEADER_LEN > RAOP_UDP_PACKET_LEN));
+            if (!p->truncated) {
+                CHECK(p->len == RTP_HEADER_LEN + sizes[got]);
+                CHECK(rtp_valid(p->data, p->len, &seq) && seq == 100 + got);
+                for (int j = RTP_HEADER_LEN; j < p->len; j++) {
+                    CHECK(p->data[j] == (unsigned char)(seq + j - RTP_HEADER_LEN));
+                }
+            } else {
+                CHECK(p->len == RAOP_UDP_PACKET_LEN);
+            }
+            CHECK(p->timestamp_ns >= before && p->timestamp_ns <= realtime_ns());
+            CHECK(p->addrlen == sizeof(struct sockaddr_in));
+            CHECK(((const struct sockaddr_in *)&p->addr)->sin_port == htons(socket_port(tx)));
+        }
+    }
+    raop_udp_stats_t stats;
+    raop_udp_get_stats(udp, &stats);
+    CHECK(stats.recv_packets == 7 && stats.truncated == 1);
+    CHECK(stats.recv_syscalls < 7);
+
+    // Nothing queued: times out instead of blocking forever
+    CHECK(raop_udp_recv(udp) == 0);
+    raop_udp_get_stats(udp, &stats);
+    CHECK(stats.recv_timeouts == 1);
+
+    close(tx);
+    raop_udp_destroy(udp);
+}
+
+static void test_send(void) {
+    raop_udp_t *udp = raop_udp_init(NULL, 0, 0, 500);
+    int rx = plain_socket(500);
+    struct sockaddr_in to = loopback(socket_port(rx));
+    static unsigned char packets[100][RTP_HEADER_LEN + 200];
+    const unsigned char *bufs[100];
+    int lens[100];
+
+    for (int i = 0; i < 100; i++) {
+        lens[i] = make_rtp(packets[i], (uint16_t)i, i * 2);
+        bufs[i] = packets[i];
+    }
+    CHECK(raop_udp_send(udp, (struct sockaddr *)&to, sizeof(to), bufs, lens, 100) == 100);
+    raop_udp_stats_t stats;
+    raop_udp_get_stats(udp, &stats);
+    CHECK(stats.send_packets == 100);
+    CHECK(stats.send_syscalls == (100 + RAOP_UDP_MAX_BATCH - 1) / RAOP_UDP_MAX_BATCH);
+
+    for (int i = 0; i < 100; i++) {
+        unsigned char buf[2048];
+        uint16_t seq = 0;
+        ssize_t n = recv(rx, buf, sizeof(buf), 0);
+        CHECK(n == lens[i] && rtp_valid(buf, (int)n, &seq) && seq == i);
+    }
+    close(rx);
+    raop_udp_destroy(udp);
+}
+
+// Timing channel: the reply carries the kernel receive time of the request
+static void test_timing_exchange(void) {
+    raop_udp_t *server = raop_udp_init(NULL, 0, RAOP_UDP_TIMESTAMPS, 500);
+    int client = plain_socket(500);
+    struct sockaddr_in to = loopback(raop_udp_get_port(server));
+    unsigned char request[32] = { 0x80, 0xd2, 0x00, 0x07 };
+    unsigned char reply[32];
+
+    uint64_t sent_at = realtime_ns();
+    sendto(client, request, sizeof(request), 0, (struct sockaddr *)&to, sizeof(to));
+    CHECK(raop_udp_recv(server) == 1);
+    const raop_udp_packet_t *p = raop_udp_get_packet(server, 0);
+    uint64_t handled_at = realtime_ns();
+    CHECK(p->len == 32 && p->data[1] == 0xd2);
+    CHECK(p->timestamp_ns >= sent_at && p->timestamp_ns <= handled_at);
+
+    memcpy(reply, p->data, sizeof(reply));
+    reply[1] = 0xd3;
+    memcpy(reply + 16, &p->timestamp_ns, 8);
+    const unsigned char *bufs[1] = { reply };
+    int lens[1] = { sizeof(reply) };
+    CHECK(raop_udp_send(server, (const struct sockaddr *)&p->addr, p->addrlen, bufs, lens, 1) == 1);
+
+    unsigned char in[64];
+    uint64_t stamped = 0;
+    CHECK(recv(client, in, sizeof(in), 0) == 32);
+    memcpy(&stamped, in + 16, 8);
+    CHECK(in[1] == 0xd3 && stamped == p->timestamp_ns);
+    close(client);
+    raop_udp_destroy(server);
+}
+
+static void test_tuner(void) {
+    raop_udp_t *udp = raop_udp_init(NULL, 0, 0, 200);
+    int tx = plain_socket(200);
+    struct sockaddr_in to = loopback(raop_udp_get_port(udp));
+    int rcvbuf = 1 << 20;
+    unsigned char buf[64];
+    raop_udp_stats_t stats;
+
+    setsockopt(raop_udp_get_fd(udp), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    int len = make_rtp(buf, 1, 20);
+
+    // Bursts deeper than the batch: every call fills it, so it grows to the maximum
+    for (int round = 0; round < 12; round++) {
+        for (int i = 0; i < 128; i++) {
+            sendto(tx, buf, len, 0, (struct sockaddr *)&to, sizeof(to));
+        }
+        int got = 0;
+        while (got < 128) {
+            int n = raop_udp_recv(udp);
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        CHECK(got == 128);
+    }
+    raop_udp_get_stats(udp, &stats);
+    CHECK(stats.batch_size == RAOP_UDP_MAX_BATCH && stats.batch_grows >= 2);
+
+    // One datagram per call: shrinks back toward the minimum
+    for (int i = 0; i < 200; i++) {
+        sendto(tx, buf, len, 0, (struct sockaddr *)&to, sizeof(to));
+        CHECK(raop_udp_recv(udp) == 1);
+    }
+    raop_udp_get_stats(udp, &stats);
+    CHECK(stats.batch_size == RAOP_UDP_MIN_BATCH && stats.batch_shrinks >= 2);
+    close(tx);
+    raop_udp_destroy(udp);
+}
+
+// ---- Loopback benchmark ----
+
+typedef struct {
+    int port;
+    long packets;
+    long window;
+    uint64_t seed;
+    int backlog;
+    atomic_long received;       // stream: sender keeps at most window packets in flight
+    long queued_to;             // backlog: packets sent before posting queued
+    sem_t queued;
+    sem_t drained;
+} sender_t;
+
+#define SEND_BURST 64
+
+static void *sender_thread(void *arg) {
+    sender_t *s = arg;
+    raop_udp_t *tx = raop_udp_init(NULL, 0, 0, 0);
+    struct sockaddr_in to = loopback(s->port);
+    static unsigned char packets[SEND_BURST][RTP_HEADER_LEN + 1400];
+    const unsigned char *bufs[SEND_BURST];
+    int lens[SEND_BURST];
+    uint64_t seed = s->seed;
+    long sent = 0;
+
+    while (sent < s->packets) {
+        if (s->backlog && sent > 0 && sent % s->window == 0) {
+            s->queued_to = sent;
+            sem_post(&s->queued);
+            sem_wait(&s->drained);
+        }
+        while (!s->backlog && sent - atomic_load(&s->received) + SEND_BURST > s->window) {
+            sched_yield();
+        }
+        int n = s->packets - sent < SEND_BURST ? (int)(s->packets - sent) : SEND_BURST;
+        for (int i = 0; i < n; i++) {
+            // ALAC frames of 352 samples compress to a few hundred bytes up to ~1.4 KB
+            lens[i] = make_rtp(packets[i], (uint16_t)(sent + i), 200 + (int)(test_rand(&seed) % 1200));
+            bufs[i] = packets[i];
+        }
+        sent += raop_udp_send(tx, (struct sockaddr *)&to, sizeof(to), bufs, lens, n);
+    }
+    if (s->backlog) {
+        s->queued_to = sent;
+        sem_post(&s->queued);
+        sem_wait(&s->drained);
+    }
+    raop_udp_destroy(tx);
+    return NULL;
+}
+
+enum { MODE_RECVFROM, MODE_FIXED, MODE_TUNED };
+
+typedef struct {
+    double cpu_ns_per_packet;
+    double syscalls_per_packet;
+    double packets_per_sec;
+    long received;
+    long out_of_order;
+    int batch_size;
+} bench_result_t;
+
+static bench_result_t bench(int mode, int backlog, long packets, long window, uint64_t seed) {
+    bench_result_t r;
+    sender_t s;
+    pthread_t tid;
+    raop_udp_t *udp = NULL;
+    int fd;
+    int rcvbuf = 1 << 20;
+    unsigned long long syscalls = 0;
+    uint16_t expect = 0;
+    long drained_to = 0;
+
+    memset(&r, 0, sizeof(r));
+    if (mode == MODE_RECVFROM) {
+        fd = plain_socket(1000);
+    } else {
+        udp = raop_udp_init(NULL, 0, mode == MODE_FIXED ? RAOP_UDP_FIXED_BATCH : 0, 1000);
+        fd = raop_udp_get_fd(udp);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    s.port = socket_port(fd);
+    s.packets = packets;
+    s.window = window;
+    s.seed = seed;
+    s.backlog = backlog;
+    atomic_init(&s.received, 0);
+    sem_init(&s.queued, 0, 0);
+    sem_init(&s.drained, 0, 0);
+
+    uint64_t cpu_start = thread_cpu_ns();
+    uint64_t start = now_ns();
+    pthread_create(&tid, NULL, sender_thread, &s);
+    while (r.received < packets) {
+        uint16_t seq = 0;
+        int n;
+        if (backlog && r.received == drained_to) {
+            if (r.received > 0) {
+                sem_post(&s.drained);
+            }
+            sem_wait(&s.queued);
+            drained_to = s.queued_to;
+        }
+        if (mode == MODE_RECVFROM) {
+            unsigned char buf[RAOP_UDP_PACKET_LEN];
+            struct sockaddr_storage from;
+            socklen_t fromlen = sizeof(from);
+            ssize_t len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+            syscalls++;
+            if (len < 0) {
+                break;
+            }
+            n = 1;
+            if (!rtp_valid(buf, (int)len, &seq) || seq != expect) {
+                r.out_of_order++;
+            }
+            expect = seq + 1;
+        } else {
+            n = raop_udp_recv(udp);
+            if (n <= 0) {
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                const raop_udp_packet_t *p = raop_udp_get_packet(udp, i);
+                if (!rtp_valid(p->data, p->len, &seq) || seq != expect) {
+                    r.out_of_order++;
+                }
+                expect = seq + 1;
+            }
+        }
+        r.received += n;
+        atomic_store(&s.received, r.received);
+    }
+    uint64_t elapsed = now_ns() - start;
+    uint64_t cpu = thread_cpu_ns() - cpu_start;
+    atomic_store(&s.received, packets);
+    if (backlog) {
+        sem_post(&s.drained);
+    }
+    pthread_join(tid, NULL);
+    sem_destroy(&s.queued);
+    sem_destroy(&s.drained);
+
+    if (udp) {
+        raop_udp_stats_t stats;
+        raop_udp_get_stats(udp, &stats);
+        syscalls = stats.recv_syscalls;
+        r.batch_size = stats.batch_size;
+        raop_udp_destroy(udp);
+    } else {
+        close(fd);
+        r.batch_size = 1;
+    }
+    r.cpu_ns_per_packet = r.received ? (double)cpu / r.received : 0;
+    r.syscalls_per_packet = r.received ? (double)syscalls / r.received : 0;
+    r.packets_per_sec = elapsed ? r.received * 1e9 / elapsed : 0;
+    return r;
+}
+
+int main(int argc, char **argv) {
+    long packets = test_arg_long(argc, argv, "--packets", 200000);
+    long window = test_arg_long(argc, argv, "--window", 128);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 35);
+
+    test_delivery();
+    test_send();
+    test_timing_exchange();
+    test_tuner();
+
+    static const char *names[] = { "recvfrom", "recvmmsg fixed", "recvmmsg tuned" };
+    printf("raop udp: %ld RTP packets over loopback, window %ld\n", packets, window);
+    for (int backlog = 0; backlog <= 1; backlog++) {
+        bench_result_t results[3];
+        printf("  %s:\n", backlog ? "backlog" : "stream");
+        for (int mode = MODE_RECVFROM; mode <= MODE_TUNED; mode++) {
+            results[mode] = bench(mode, backlog, packets, window, seed);
+            CHECK(results[mode].received == packets);
+            CHECK(results[mode].out_of_order == 0);
+            printf("    %-15s %7.0f receiver CPU ns/packet, %.3f syscalls/packet, %8.0f packets/s, batch %d\n",
+                   names[mode], results[mode].cpu_ns_per_packet, results[mode].syscalls_per_packet,
+                   results[mode].packets_per_sec, results[mode].batch_size);
+        }
+        CHECK(results[MODE_TUNED].syscalls_per_packet < results[MODE_RECVFROM].syscalls_per_packet);
+    }
+    return test_failures();
+}
@@ -0,0 +1,246 @@
+/**
+ * Keepalive fast path: reply parity with AirPlayServer and cost per keepalive.
+ *
+ * Offers every request of a recorded AirPlay control-channel trace to
+ * rtsp_keepalive_match and checks that exactly the /feedback and
+ * GET_PARAMETER requests are taken, each with a reply byte-identical to what
+ * AirPlayServer.sendResponse builds for it. Covers requests split at every
+ * byte, pipelining, missing CSeq and the cases that must fall through to the
+ * regular parser, then writes replies through a socketpair with
+ * rtsp_keepalive_send.
+ *
+ * Then times replaying the trace with keepalives answered on the fast path
+ * (match + iovec) against the regular path (full parse, header lookup and
+ * formatting the reply).
+ *
+ *   rtsp_keepalive_bench --trace FILE [--iterations N]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "rtsp_keepalive.h"
+#include "rtsp_request.h"
+#include "test_util.h"
+
+static unsigned char *load_file(const char *path, int *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = malloc(size > 0 ? size : 1);
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *len = (int)size;
+    return data;
+}
+
+// What AirPlayServer's dispatch would answer with for a keepalive, else NONE
+static rtsp_keepalive_kind_t reference_kind(const rtsp_request_t *req) {
+    if (!rtsp_slice_equals(req, &req->protocol, "RTSP/1.0")) {
+        return RTSP_KEEPALIVE_NONE;
+    }
+    if (rtsp_slice_equals(req, &req->method, "POST") && rtsp_slice_equals(req, &req->path, "/feedback")) {
+        return RTSP_KEEPALIVE_FEEDBACK;
+    }
+    if (!rtsp_slice_equals(req, &req->method, "GET_PARAMETER") || rtsp_slice_starts_with(req, &req->path, "/")) {
+        return RTSP_KEEPALIVE_NONE;
+    }
+    const unsigned char *body = req->buf + req->body.off;
+    int len = req->body.len;
+    while (len > 0 && body[len - 1] <= ' ') {
+        len--;
+    }
+    while (len > 0 && body[0] <= ' ') {
+        body++;
+        len--;
+    }
+    return len == 6 && memcmp(body, "volume", 6) == 0 ? RTSP_KEEPALIVE_VOLUME : RTSP_KEEPALIVE_PARAMETER;
+}
+
+// AirPlayServer.sendResponse for the keepalive replies, formatted the slow way
+static int reference_reply(const rtsp_request_t *req, rtsp_keepalive_kind_t kind, char *out, int cap) {
+    const rtsp_slice_t *cseq = rtsp_request_header(req, "CSeq");
+    const char *type = kind == RTSP_KEEPALIVE_FEEDBACK ? "text/plain" : "text/parameters";
+    const char *body = kind == RTSP_KEEPALIVE_VOLUME ? "volume: -20.0\r\n" : "";
+    int n = snprintf(out, cap, "RTSP/1.0 200 OK\r\nServer: AirTunes/220.68\r\n");
+    if (cseq) {
+        n += snprintf(out + n, cap - n, "CSeq: %.*s\r\n", cseq->len, (const char *)req->buf + cseq->off);
+    }
+    n += snprintf(out + n, cap - n, "Content-Type: %s\r\n", type);
+    if (body[0]) {
+        n += snprintf(out + n, cap - n, "Content-Length: %d\r\n", (int)strlen(body));
+    }
+    n += snprintf(out + n, cap - n, "Audio-Jack-Status: connected\r\n\r\n%s", body);
+    return n;
+}
+
+static int flatten(const struct iovec *iov, int count, char *out) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(out + n, iov[i].iov_base, iov[i].iov_len);
+        n += (int)iov[i].iov_len;
+    }
+    return n;
+}
+
+// Fast path reply for buf must equal the reference; returns the request length or 0
+static int check_reply(const unsigned char *buf, int len) {
+    rtsp_request_t req;
+    rtsp_keepalive_t ka;
+    struct iovec iov[RTSP_KEEPALIVE_MAX_IOV];
+    char fast[512], ref[512];
+
+    int n = rtsp_keepalive_match(buf, len, &ka);
+    int parsed = rtsp_request_parse(&req, buf, len);
+    rtsp_keepalive_kind_t kind = parsed > 0 ? reference_kind(&req) : RTSP_KEEPALIVE_NONE;
+    CHECK((n > 0) == (kind != RTSP_KEEPALIVE_NONE));
+    if (n <= 0 || kind == RTSP_KEEPALIVE_NONE) {
+        return 0;
+    }
+    CHECK(n == parsed && ka.kind == kind);
+    int fast_len = flatten(iov, rtsp_keepalive_response(&ka, buf, iov), fast);
+    int ref_len = reference_reply(&req, kind, ref, sizeof(ref));
+    CHECK(fast_len == ref_len && memcmp(fast, ref, ref_len) == 0);
+    return n;
+}
+
+static int check_str(const char *req) {
+    return check_reply((const unsigned char *)req, (int)strlen(req));
+}
+
+static void test_cases(void) {
+    rtsp_keepalive_t ka;
+
+    static const char feedback[] = "POST /feedback RTSP/1.0\r\nCSeq: 42\r\n\r\n";
+    static const char volume[] = "GET_PARAMETER rtsp://10.0.0.2/1234 RTSP/1.0\r\nContent-Length: 8\r\n"
+                                 "Content-Type: text/parameters\r\ncseq:  9\r\nDACP-ID: 14413BE4996FEA4D\r\n\r\nvolume\r\n";
+    CHECK(check_str(feedback) == (int)strlen(feedback));
+    CHECK(check_str(volume) == (int)strlen(volume));
+    CHECK(check_str("GET_PARAMETER * RTSP/1.0\r\nCSeq: 3\r\nContent-Length: 10\r\n\r\nprogress\r\n") > 0);
+    CHECK(check_str("GET_PARAMETER rtsp://h/1 RTSP/1.0\r\nCSeq: 4\r\n\r\n") > 0);
+    CHECK(check_str("POST /feedback RTSP/1.0\r\nContent-Length: 3\r\n\r\nabc") > 0);  // no CSeq line
+
+    // Everything else is left to the regular parser
+    static const char *const others[] = {
+        "POST /feedback HTTP/1.1\r\nCSeq: 1\r\n\r\n",
+        "POST /feedbackx RTSP/1.0\r\nCSeq: 1\r\n\r\n",
+        "GET_PARAMETER /info RTSP/1.0\r\nCSeq: 1\r\n\r\n",
+        "GET_PARAMETER rtsp://h/1 HTTP/1.1\r\nCSeq: 1\r\n\r\n",
+        "SET_PARAMETER rtsp://h/1 RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 8\r\n\r\nvolume\r\n",
+        "GET /info RTSP/1.0\r\nCSeq: 1\r\n\r\n",
+        "POST /feedback RTSP/1.0\r\nCSeq: 1\r\nContent-Length: x\r\n\r\n",
+        "POST /feedback RTSP/1.0\r\nCSeq: 1\nBad: line\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++) {
+        CHECK(rtsp_keepalive_match((const unsigned char *)others[i], (int)strlen(others[i]), &ka) == 0);
+    }
+
+    // Incomplete at every cut, complete once whole; pipelined requests are taken one at a time
+    int len = (int)strlen(volume);
+    for (int cut = 0; cut < len; cut++) {
+        CHECK(rtsp_keepalive_match((const unsigned char *)volume, cut, &ka) == 0);
+    }
+    char pipelined[512];
+    int plen = snprintf(pipelined, sizeof(pipelined), "%s%s", volume, feedback);
+    CHECK(rtsp_keepalive_match((const unsigned char *)pipelined, plen, &ka) == len);
+    CHECK(check_reply((const unsigned char *)pipelined + len, plen - len) == (int)strlen(feedback));
+
+    // One gather write delivers the whole reply
+    int sv[2];
+    char got[512], ref[512];
+    rtsp_request_t req;
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    CHECK(rtsp_keepalive_match((const unsigned char *)volume, len, &ka) == len);
+    CHECK(rtsp_keepalive_send(sv[0], &ka, (const unsigned char *)volume) == 0);
+    ssize_t n = recv(sv[1], got, sizeof(got), 0);
+    CHECK(rtsp_request_parse(&req, (const unsigned char *)volume, len) == len);
+    int ref_len = reference_reply(&req, RTSP_KEEPALIVE_VOLUME, ref, sizeof(ref));
+    CHECK(n == ref_len && memcmp(got, ref, ref_len) == 0);
+    close(sv[0]);
+    close(sv[1]);
+    CHECK(rtsp_keepalive_send(sv[0], &ka, (const unsigned char *)volume) == -1);
+}
+
+int main(int argc, char **argv) {
+    const char *path = test_arg_str(argc, argv, "--trace");
+    long iterations = test_arg_long(argc, argv, "--iterations", 200);
+    int len;
+
+    if (!path) {
+        fprintf(stderr, "usage: %s --trace FILE [--iterations N]\n", argv[0]);
+        return 2;
+    }
+    unsigned char *trace = load_file(path, &len);
+    CHECK(trace != NULL);
+    if (!trace) {
+        return test_failures();
+    }
+
+    test_cases();
+
+    // Trace: every keepalive is taken with the right reply, nothing else is
+    int requests = 0, keepalives = 0;
+    for (int off = 0; off < len; requests++) {
+        rtsp_request_t req;
+        int n = rtsp_request_parse(&req, trace + off, len - off);
+        CHECK(n > 0);
+        if (n <= 0) {
+            break;
+        }
+        keepalives += check_reply(trace + off, len - off) > 0;
+        off += n;
+    }
+    CHECK(keepalives > 0);
+    printf("rtsp keepalive: %d of %d trace requests on the fast path\n", keepalives, requests);
+
+    // Per keepalive: fast path vs full parse + lookup + formatted reply
+    char out[512];
+    size_t reply_bytes[2] = { 0, 0 };
+    for (int mode = 1; mode >= 0; mode--) {
+        long answered = 0;
+        uint64_t start = now_ns();
+        for (long it = 0; it < iterations; it++) {
+            for (int off = 0; off < len;) {
+                rtsp_request_t req;
+                rtsp_keepalive_t ka;
+                int n = mode ? rtsp_keepalive_match(trace + off, len - off, &ka) : 0;
+                if (n > 0) {
+                    struct iovec iov[RTSP_KEEPALIVE_MAX_IOV];
+                    int count = rtsp_keepalive_response(&ka, trace + off, iov);
+                    for (int i = 0; i < count; i++) {
+                        reply_bytes[mode] += iov[i].iov_len;
+                    }
+                    answered++;
+                    off += n;
+                    continue;
+                }
+                n = rtsp_request_parse(&req, trace + off, len - off);
+                rtsp_keepalive_kind_t kind = reference_kind(&req);
+                if (kind != RTSP_KEEPALIVE_NONE) {
+                    reply_bytes[mode] += reference_reply(&req, kind, out, sizeof(out));
+                    answered++;
+                }
+                off += n;
+            }
+        }
+        double seconds = (double)(now_ns() - start) / 1e9;
+        printf("  %-9s %9.0f keepalives/s, %.1f ns per trace request\n", mode ? "fast path" : "dispatch",
+               answered / seconds, seconds * 1e9 / ((double)requests * iterations));
+    }
+    // Same replies either way
+    CHECK(reply_bytes[0] == reply_bytes[1]);
+
+    free(trace);
+    return test_failures();
+}
@@ -0,0 +1,259 @@
+/**
+ * Native RTSP control server: protocol checks and loopback load test.
+ *
+ * Starts rtsp_server on an ephemeral port with GET_PARAMETER, /feedback, /info
+ * and SETUP-style handlers, checks framing (CSeq echo, bodies, pipelining,
+ * split reads, 404/400), then drives it from client threads standing in for
+ * an AirPlay sender and reports requests/sec plus p50/p99 round-trip latency.
+ * With --keepalive-fast-path the /feedback and GET_PARAMETER load is answered
+ * from rtsp_keepalive.h templates instead of the handlers.
+ *
+ *   rtsp_server_test [--clients N] [--requests N] [--keepalive-fast-path]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "rtsp_server.h"
+#include "test_util.h"
+
+static const unsigned char volume_body[] = "volume: 0.000000\r\n";
+static const char fast_path_volume_body[] = "volume: -20.0\r\n";
+static int g_fast_path;
+
+static void handle_get_parameter(rtsp_conn_t *conn, const rtsp_request_t *req, void *opaque) {
+    (void)opaque;
+    rtsp_conn_respond(conn, req, 200, "OK", "text/parameters", volume_body, sizeof(volume_body) - 1);
+}
+
+static void handle_ok(rtsp_conn_t *conn, const rtsp_request_t *req, void *opaque) {
+    (void)opaque;
+    rtsp_conn_respond(conn, req, 200, "OK", "", NULL, 0);
+}
+
+// Echoes the request body back so body spans can be checked end to end
+static void handle_echo(rtsp_conn_t *conn, const rtsp_request_t *req, void *opaque) {
+    (void)opaque;
+    rtsp_conn_respond(conn, req, 200, "OK", "application/octet-stream", req->buf + req->body.off, req->body.len);
+}
+
+static void *server_thread(void *arg) {
+    rtsp_server_run(arg);
+    return NULL;
+}
+
+static int connect_to(int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+typedef struct {
+    unsigned char buf[8192];
+    int len;
+    int consumed;   /* previous response, dropped on the next read */
+} reader_t;
+
+// Reads one response ("RTSP/1.0 200 OK" parses as a request line); returns its status or -1.
+// The parsed view stays valid until the next call.
+static int read_response(int fd, reader_t *r, rtsp_request_t *res) {
+    memmove(r->buf, r->buf + r->consumed, r->len - r->consumed);
+    r->len -= r->consumed;
+    r->consumed = 0;
+    for (;;) {
+        int n = rtsp_request_parse(res, r->buf, r->len);
+        if (n > 0) {
+            r->consumed = n;
+            return atoi((const char *)r->buf + res->path.off);
+        }
+        if (n < 0 || r->len == (int)sizeof(r->buf)) {
+            return -1;
+        }
+        ssize_t got = recv(fd, r->buf + r->len, sizeof(r->buf) - r->len, 0);
+        if (got <= 0) {
+            return -1;
+        }
+        r->len += (int)got;
+    }
+}
+
+static void test_protocol(int port) {
+    reader_t r = { .len = 0, .consumed = 0 };
+    rtsp_request_t res;
+    int fd = connect_to(port);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    // Plain keepalive with CSeq echo and a text body
+    const char *get = "GET_PARAMETER rtsp://10.0.0.2/1 RTSP/1.0\r\nCSeq: 7\r\nContent-Type: text/parameters\r\n"
+                      "Content-Length: 8\r\n\r\nvolume\r\n";
+    CHECK(send_all(fd, get, strlen(get)) == 0);
+    CHECK(read_response(fd, &r, &res) == 200);
+    CHECK(rtsp_slice_equals(&res, rtsp_request_header(&res, "CSeq"), "7"));
+    if (g_fast_path) {
+        CHECK(res.body.len == (int)strlen(fast_path_volume_body) &&
+              memcmp(res.buf + res.body.off, fast_path_volume_body, res.body.len) == 0);
+    } else {
+        CHECK(res.body.len == (int)sizeof(volume_body) - 1);
+    }
+
+    // Three pipelined requests in one write, answered in order
+    const char *pipelined = "POST /feedback RTSP/1.0\r\nCSeq: 8\r\n\r\n"
+                            "POST /fp-setup RTSP/1.0\r\nCSeq: 9\r\nContent-Length: 4\r\n\r\nFPLY"
+                            "GET /nope RTSP/1.0\r\nCSeq: 10\r\n\r\n";
+    CHECK(send_all(fd, pipelined, strlen(pipelined)) == 0);
+    CHECK(read_response(fd, &r, &res) == 200);
+    CHECK(rtsp_slice_equals(&res, rtsp_request_header(&res, "CSeq"), "8"));
+    CHECK(read_response(fd, &r, &res) == 200);
+    CHECK(res.body.len == 4 && memcmp(res.buf + res.body.off, "FPLY", 4) == 0);
+    CHECK(read_response(fd, &r, &res) == 404);
+    CHECK(rtsp_slice_equals(&res, rtsp_request_header(&res, "CSeq"), "10"));
+
+    // Headers and body split across writes
+    const char *part1 = "POST /fp-setup RTSP/1.0\r\nCSeq: 11\r\nConte";
+    const char *part2 = "nt-Length: 6\r\n\r\nabc";
+    CHECK(send_all(fd, part1, strlen(part1)) == 0);
+    usleep(2000);
+    CHECK(send_all(fd, part2, strlen(part2)) == 0);
+    usleep(2000);
+    CHECK(send_all(fd, "def", 3) == 0);
+    CHECK(read_response(fd, &r, &res) == 200);
+    CHECK(res.body.len == 6 && memcmp(res.buf + res.body.off, "abcdef", 6) == 0);
+
+    // HTTP requests are answered with their own protocol version
+    const char *info = "GET /info HTTP/1.1\r\nCSeq: 12\r\n\r\n";
+    CHECK(send_all(fd, info, strlen(info)) == 0);
+    CHECK(read_response(fd, &r, &res) == 200);
+    CHECK(rtsp_slice_equals(&res, &res.method, "HTTP/1.1"));
+
+    // Malformed request line gets 400 and the connection is closed
+    CHECK(send_all(fd, "garbage\r\n\r\n", 11) == 0);
+    CHECK(read_response(fd, &r, &res) == 400);
+    char c;
+    CHECK(recv(fd, &c, 1, 0) == 0);
+    close(fd);
+}
+
+typedef struct {
+    int port;
+    long requests;
+    uint64_t *latencies;
+    int failed;
+} client_t;
+
+static void *client_thread(void *arg) {
+    client_t *client = arg;
+    reader_t r = { .len = 0, .consumed = 0 };
+    rtsp_request_t res;
+    char req[256];
+    int fd = connect_to(client->port);
+    if (fd < 0) {
+        client->failed = 1;
+        return NULL;
+    }
+    for (long i = 0; i < client->requests; i++) {
+        // Mix of the keepalives a mirroring sender issues continuously
+        int len = (i & 1)
+            ? snprintf(req, sizeof(req), "POST /feedback RTSP/1.0\r\nCSeq: %ld\r\n\r\n", i)
+            : snprintf(req, sizeof(req), "GET_PARAMETER rtsp://10.0.0.2/1 RTSP/1.0\r\nCSeq: %ld\r\n"
+                       "Content-Type: text/parameters\r\nContent-Length: 8\r\n\r\nvolume\r\n", i);
+        uint64_t start = now_ns();
+        if (send_all(fd, req, len) < 0 || read_response(fd, &r, &res) != 200) {
+            client->failed = 1;
+            break;
+        }
+        client->latencies[i] = now_ns() - start;
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int clients = (int)test_arg_long(argc, argv, "--clients", 4);
+    long requests = test_arg_long(argc, argv, "--requests", 5000);
+    g_fast_path = test_arg_flag(argc, argv, "--keepalive-fast-path");
+
+    rtsp_server_t *server = rtsp_server_init(NULL);
+    CHECK(server != NULL);
+    if (!server) {
+        return test_failures();
+    }
+    CHECK(rtsp_server_add_handler(server, "GET_PARAMETER", NULL, handle_get_parameter, NULL) == 0);
+    CHECK(rtsp_server_add_handler(server, "POST", "/feedback", handle_ok, NULL) == 0);
+    CHECK(rtsp_server_add_handler(server, NULL, "/fp-setup*", handle_echo, NULL) == 0);
+    CHECK(rtsp_server_add_handler(server, "GET", "/info", handle_ok, NULL) == 0);
+    rtsp_server_set_keepalive_fast_path(server, g_fast_path);
+    int port = rtsp_server_listen(server, 0);
+    CHECK(port > 0);
+
+    pthread_t server_tid;
+    pthread_create(&server_tid, NULL, server_thread, server);
+
+    test_protocol(port);
+
+    client_t *c = calloc(clients, sizeof(client_t));
+    pthread_t *tids = calloc(clients, sizeof(pthread_t));
+    uint64_t *all = malloc(sizeof(uint64_t) * clients * requests);
+    uint64_t start = now_ns();
+    for (int i = 0; i < clients; i++) {
+        c[i].port = port;
+        c[i].requests = requests;
+        c[i].latencies = all + (size_t)i * requests;
+        pthread_create(&tids[i], NULL, client_thread, &c[i]);
+    }
+    for (int i = 0; i < clients; i++) {
+        pthread_join(tids[i], NULL);
+        CHECK(!c[i].failed);
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    rtsp_server_stop(server);
+    pthread_join(server_tid, NULL);
+    unsigned long long served = rtsp_server_get_requests(server);
+    unsigned long long keepalives = rtsp_server_get_keepalives(server);
+    // The load is all keepalives, plus the two in test_protocol
+    CHECK(keepalives == (g_fast_path ? (unsigned long long)clients * requests + 2 : 0));
+    rtsp_server_destroy(server);
+
+    size_t total = (size_t)clients * requests;
+    printf("rtsp server%s: %d clients x %ld requests, %.0f req/s, p50 %llu ns, p99 %llu ns (%llu served, %llu keepalives)\n",
+           g_fast_path ? " (keepalive fast path)" : "", clients, requests, total / elapsed,
+           (unsigned long long)test_percentile(all, total, 50), (unsigned long long)test_percentile(all, total, 99),
+           served, keepalives);
+
+    free(all);
+    free(tids);
+    free(c);
+    return test_failures();
+}
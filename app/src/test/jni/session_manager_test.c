@@ -0,0 +1,471 @@
+/**
+ * Multi-session receiver core: isolation checks and loopback load test.
+ *
+ * Opens one session per synthetic sender and checks that each gets its own
+ * kernel-assigned data port and that sessions are spread evenly over the
+ * workers. With --vectors, recorded fp-setup sessions are driven through the
+ * per-session FairPlay instances with every phase interleaved across sessions,
+ * which only decrypts the right keys if no FairPlay state is shared.
+ *
+ * The load test runs N sender threads against N sessions at once. Each sender
+ * streams mirror packets (config, then AVCC video encrypted with its own
+ * key and streamConnectionID) to its session's port; every session must
+ * decrypt to the sender's plaintext checksum. Reports aggregate throughput
+ * and Jain's fairness index over per-sender throughput.
+ *
+ *   session_manager_test [--senders N] [--workers N] [--packets N] [--vectors FILE] [--seed S]
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "mirror_buffer.h"
+#include "mirror_framer.h"
+#include "session_manager.h"
+#include "test_util.h"
+
+#define MAX_SENDERS 64
+#define MAX_FP_SESSIONS 32
+#define MAX_EKEYS 4
+#define LINE_MAX_LEN 1024
+#define MAX_PACKET (64 * 1024)
+#define WAIT_TIMEOUT_NS (30ull * 1000000000ull)
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct {
+    unsigned char setup_req[FAIRPLAY_SETUP_REQ_LEN];
+    unsigned char setup_res[FAIRPLAY_SETUP_RES_LEN];
+    unsigned char handshake_req[FAIRPLAY_HANDSHAKE_REQ_LEN];
+    unsigned char handshake_res[FAIRPLAY_HANDSHAKE_RES_LEN];
+    unsigned char ekey[MAX_EKEYS][72];
+    unsigned char aeskey[MAX_EKEYS][16];
+    int ekeys;
+} fp_session_t;
+
+typedef struct {
+    // Receiver side, written on the session's worker
+    uint64_t rx_checksum;
+    long rx_packets;
+
+    // Sender side
+    unsigned short port;
+    unsigned char aeskey[16];
+    uint64_t stream_connection_id;
+    long packets;
+    uint64_t seed;
+    uint64_t tx_checksum;
+    long long tx_bytes;
+    uint64_t elapsed_ns;
+    int failed;
+} sender_t;
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Groups "setup / handshake / ekey..." records into sessions
+static int load_fp_sessions(const char *path, fp_session_t *sessions, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[LINE_MAX_LEN];
+    int count = 0;
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), f)) {
+        char *name = strtok(line, " \t\r\n");
+        if (!name || name[0] == '#') {
+            continue;
+        }
+        char *in = strtok(NULL, " \t\r\n");
+        char *out = strtok(NULL, " \t\r\n");
+        if (!in || !out) {
+            ok = 0;
+        } else if (strcmp(name, "setup") == 0) {
+            if (count == max) {
+                break;
+            }
+            fp_session_t *s = &sessions[count++];
+            memset(s, 0, sizeof(*s));
+            ok = test_hex_decode(in, s->setup_req, sizeof(s->setup_req)) == 0 &&
+                 test_hex_decode(out, s->setup_res, sizeof(s->setup_res)) == 0;
+        } else if (strcmp(name, "handshake") == 0 && count > 0) {
+            fp_session_t *s = &sessions[count - 1];
+            ok = test_hex_decode(in, s->handshake_req, sizeof(s->handshake_req)) == 0 &&
+                 test_hex_decode(out, s->handshake_res, sizeof(s->handshake_res)) == 0;
+        } else if (strcmp(name, "ekey") == 0 && count > 0) {
+            fp_session_t *s = &sessions[count - 1];
+            if (s->ekeys < MAX_EKEYS) {
+                ok = test_hex_decode(in, s->ekey[s->ekeys], 72) == 0 &&
+                     test_hex_decode(out, s->aeskey[s->ekeys], 16) == 0;
+                s->ekeys++;
+            }
+        } else {
+            ok = 0;
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "%s: malformed vector\n", path);
+        return -1;
+    }
+    return count;
+}
+
+static int connect_port(unsigned short port) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void write_header(unsigned char *header, int len, int type, uint64_t ntp) {
+    memset(header, 0, MIRROR_HEADER_LEN);
+    header[0] = (unsigned char)len;
+    header[1] = (unsigned char)(len >> 8);
+    header[2] = (unsigned char)(len >> 16);
+    header[3] = (unsigned char)(len >> 24);
+    header[4] = (unsigned char)type;
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (unsigned char)(ntp >> (8 * i));
+    }
+}
+
+// Random AVCC payload of 1-4 NAL units; returns its length
+static int make_video_payload(uint64_t *rng, unsigned char *out, int max) {
+    int units = 1 + (int)(test_rand(rng) % 4);
+    int len = 0;
+    for (int u = 0; u < units; u++) {
+        int room = max - len - 4;
+        int nal_len = 1 + (int)(test_rand(rng) % (uint64_t)(max / 4 - 4));
+        if (nal_len > room) {
+            break;
+        }
+        out[len] = (unsigned char)(nal_len >> 24);
+        out[len + 1] = (unsigned char)(nal_len >> 16);
+        out[len + 2] = (unsigned char)(nal_len >> 8);
+        out[len + 3] = (unsigned char)nal_len;
+        test_fill_random(rng, out + len + 4, (size_t)nal_len);
+        len += 4 + nal_len;
+    }
+    return len;
+}
+
+static void on_packet(void *opaque, int type, unsigned char *payload, int len, uint64_t ntp) {
+    sender_t *sender = opaque;
+    (void)type;
+    (void)ntp;
+    sender->rx_checksum = fnv1a(sender->rx_checksum, payload, len);
+    __atomic_store_n(&sender->rx_packets, sender->rx_packets + 1, __ATOMIC_RELEASE);
+}
+
+static void *sender_main(void *arg) {
+    sender_t *sender = arg;
+    unsigned char *packet = malloc(MIRROR_HEADER_LEN + MAX_PACKET);
+    unsigned char *payload = packet + MIRROR_HEADER_LEN;
+    mirror_buffer_t *cipher = mirror_buffer_init(NULL, sender->aeskey);
+    uint64_t rng = sender->seed;
+    int fd = connect_port(sender->port);
+
+    mirror_buffer_init_aes(cipher, &sender->stream_connection_id);
+    sender->tx_checksum = FNV_OFFSET;
+    uint64_t start = now_ns();
+    if (fd < 0) {
+        sender->failed = 1;
+    }
+
+    // Codec config first, unencrypted, like a real sender
+    int len = 32;
+    test_fill_random(&rng, payload, (size_t)len);
+    write_header(packet, len, MIRROR_TYPE_CONFIG, 0);
+    sender->tx_checksum = fnv1a(sender->tx_checksum, payload, len);
+    if (!sender->failed && write_all(fd, packet, MIRROR_HEADER_LEN + (size_t)len) < 0) {
+        sender->failed = 1;
+    }
+
+    for (long p = 0; p < sender->packets && !sender->failed; p++) {
+        len = make_video_payload(&rng, payload, MAX_PACKET);
+        sender->tx_checksum = fnv1a(sender->tx_checksum, payload, len);
+        // AES-CTR: the receiver's decrypt is the sender's encrypt
+        mirror_buffer_decrypt(cipher, payload, payload, len);
+        write_header(packet, len, MIRROR_TYPE_VIDEO, (uint64_t)p);
+        if (write_all(fd, packet, MIRROR_HEADER_LEN + (size_t)len) < 0) {
+            sender->failed = 1;
+        }
+        sender->tx_bytes += MIRROR_HEADER_LEN + len;
+    }
+    sender->elapsed_ns = now_ns() - start;
+
+    mirror_buffer_destroy(cipher);
+    free(packet);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+static int wait_for(long *counter, long target) {
+    uint64_t deadline = now_ns() + WAIT_TIMEOUT_NS;
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < target) {
+        if (now_ns() > deadline) {
+            return -1;
+        }
+        usleep(1000);
+    }
+    return 0;
+}
+
+static int wait_sessions(session_manager_t *manager, int count) {
+    uint64_t deadline = now_ns() + WAIT_TIMEOUT_NS;
+    while (session_manager_get_session_count(manager) != count) {
+        if (now_ns() > deadline) {
+            return -1;
+        }
+        usleep(1000);
+    }
+    return 0;
+}
+
+// Distinct ports, even spread over workers, and FairPlay phases interleaved across sessions
+static void test_isolation(stream_io_backend_t backend, int senders, int workers,
+                           const fp_session_t *fp, int fp_count) {
+    session_manager_t *manager = session_manager_init(workers, backend);
+    airplay_session_t *sessions[MAX_SENDERS];
+    int per_worker[SESSION_MANAGER_MAX_WORKERS] = { 0 };
+
+    CHECK(manager != NULL);
+    if (!manager) {
+        return;
+    }
+    for (int i = 0; i < senders; i++) {
+        sessions[i] = session_manager_open(manager, NULL, NULL);
+        CHECK(sessions[i] != NULL);
+        if (!sessions[i]) {
+            session_manager_destroy(manager);
+            return;
+        }
+        CHECK(airplay_session_get_data_port(sessions[i]) != 0);
+        for (int j = 0; j < i; j++) {
+            CHECK(airplay_session_get_data_port(sessions[i]) != airplay_session_get_data_port(sessions[j]));
+        }
+        per_worker[airplay_session_get_worker(sessions[i])]++;
+    }
+    for (int w = 0; w < workers; w++) {
+        CHECK(per_worker[w] >= senders / workers && per_worker[w] <= (senders + workers - 1) / workers);
+    }
+    CHECK(session_manager_get_session_count(manager) == senders);
+
+    if (fp_count > 0) {
+        unsigned char res[FAIRPLAY_SETUP_RES_LEN];
+        int mismatches = 0;
+
+        for (int i = 0; i < senders; i++) {
+            const fp_session_t *v = &fp[i % fp_count];
+            CHECK(fairplay_setup(airplay_session_get_fairplay(sessions[i]), v->setup_req, res) == 0);
+            mismatches += memcmp(res, v->setup_res, sizeof(v->setup_res)) != 0;
+        }
+        for (int i = 0; i < senders; i++) {
+            const fp_session_t *v = &fp[i % fp_count];
+            CHECK(fairplay_handshake(airplay_session_get_fairplay(sessions[i]), v->handshake_req, res) == 0);
+            mismatches += memcmp(res, v->handshake_res, sizeof(v->handshake_res)) != 0;
+        }
+        for (int k = 0; k < MAX_EKEYS; k++) {
+            for (int i = 0; i < senders; i++) {
+                const fp_session_t *v = &fp[i % fp_count];
+                if (k < v->ekeys) {
+                    CHECK(fairplay_decrypt(airplay_session_get_fairplay(sessions[i]), v->ekey[k], res) == 0);
+                    mismatches += memcmp(res, v->aeskey[k], 16) != 0;
+                }
+            }
+        }
+        CHECK(mismatches == 0);
+        printf("  fairplay: %d sessions over %d recorded handshakes interleaved, %d mismatches\n",
+               senders, fp_count, mismatches);
+    }
+
+    // Closing one session leaves the others untouched
+    session_manager_close(manager, sessions[0]);
+    CHECK(wait_sessions(manager, senders - 1) == 0);
+    session_manager_destroy(manager);
+}
+
+// One data connection per session; a second one is turned away, and closing ends the stream
+static void test_connections(stream_io_backend_t backend) {
+    session_manager_t *manager = session_manager_init(1, backend);
+    sender_t sender;
+    unsigned char packet[MIRROR_HEADER_LEN + 64];
+    unsigned char byte;
+    airplay_session_stats_t stats;
+
+    memset(&sender, 0, sizeof(sender));
+    sender.rx_checksum = FNV_OFFSET;
+    airplay_session_t *session = session_manager_open(manager, on_packet, &sender);
+    CHECK(session != NULL);
+    if (!session) {
+        session_manager_destroy(manager);
+        return;
+    }
+    unsigned short port = airplay_session_get_data_port(session);
+
+    int fd = connect_port(port);
+    CHECK(fd >= 0);
+    write_header(packet, 64, MIRROR_TYPE_CONFIG, 0);
+    memset(packet + MIRROR_HEADER_LEN, 0x5a, 64);
+    CHECK(write_all(fd, packet, sizeof(packet)) == 0);
+    CHECK(wait_for(&sender.rx_packets, 1) == 0);
+
+    // Video before SETUP installed a key is dropped, not misdecoded
+    write_header(packet, 64, MIRROR_TYPE_VIDEO, 0);
+    CHECK(write_all(fd, packet, sizeof(packet)) == 0);
+
+    int extra = connect_port(port);
+    CHECK(extra >= 0);
+    CHECK(recv(extra, &byte, 1, 0) == 0);
+    close(extra);
+
+    uint64_t deadline = now_ns() + WAIT_TIMEOUT_NS;
+    do {
+        airplay_session_get_stats(session, &stats);
+    } while (stats.packets < 2 && now_ns() < deadline && usleep(1000) == 0);
+    CHECK(stats.connections == 1);
+    CHECK(stats.rejected_connections == 1);
+    CHECK(stats.config_packets == 1);
+    CHECK(stats.dropped_packets == 1);
+    CHECK(stats.packets == 2);
+
+    session_manager_close(manager, session);
+    CHECK(recv(fd, &byte, 1, 0) == 0);
+    close(fd);
+    CHECK(wait_sessions(manager, 0) == 0);
+    session_manager_destroy(manager);
+}
+
+static void test_load(stream_io_backend_t backend, int senders, int workers, long packets, uint64_t seed) {
+    session_manager_t *manager = session_manager_init(workers, backend);
+    airplay_session_t *sessions[MAX_SENDERS];
+    sender_t *tx = calloc((size_t)senders, sizeof(sender_t));
+    pthread_t threads[MAX_SENDERS];
+    uint64_t rng = seed;
+    long long total_bytes = 0;
+    double sum = 0;
+    double sum_sq = 0;
+    int failed = 0;
+
+    for (int i = 0; i < senders; i++) {
+        tx[i].rx_checksum = FNV_OFFSET;
+        tx[i].packets = packets;
+        tx[i].seed = test_rand(&rng) | 1;
+        test_fill_random(&rng, tx[i].aeskey, sizeof(tx[i].aeskey));
+        tx[i].stream_connection_id = test_rand(&rng);
+        sessions[i] = session_manager_open(manager, on_packet, &tx[i]);
+        CHECK(sessions[i] != NULL);
+        tx[i].port = airplay_session_get_data_port(sessions[i]);
+        CHECK(airplay_session_set_mirror_key(sessions[i], tx[i].aeskey, tx[i].stream_connection_id) == 0);
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < senders; i++) {
+        pthread_create(&threads[i], NULL, sender_main, &tx[i]);
+    }
+    for (int i = 0; i < senders; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < senders; i++) {
+        CHECK(wait_for(&tx[i].rx_packets, packets + 1) == 0);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    for (int i = 0; i < senders; i++) {
+        airplay_session_stats_t stats;
+        airplay_session_get_stats(sessions[i], &stats);
+        failed += tx[i].failed || tx[i].rx_checksum != tx[i].tx_checksum;
+        CHECK(!tx[i].failed);
+        CHECK(tx[i].rx_checksum == tx[i].tx_checksum);
+        CHECK(stats.video_packets == (unsigned long long)packets);
+        CHECK(stats.dropped_packets == 0);
+        CHECK(stats.connections == 1);
+
+        double mbps = (double)tx[i].tx_bytes / (1024.0 * 1024.0) / ((double)tx[i].elapsed_ns / 1e9);
+        sum += mbps;
+        sum_sq += mbps * mbps;
+        total_bytes += tx[i].tx_bytes;
+    }
+
+    printf("  %-8s %2d senders / %d workers: %7.1f MB/s aggregate, fairness %.3f, %d session(s) corrupted\n",
+           stream_io_backend_name(session_manager_get_backend(manager)), senders, workers,
+           (double)total_bytes / (1024.0 * 1024.0) / ((double)elapsed / 1e9),
+           sum * sum / (senders * sum_sq), failed);
+
+    session_manager_destroy(manager);
+    free(tx);
+}
+
+int main(int argc, char **argv) {
+    int senders = (int)test_arg_long(argc, argv, "--senders", 8);
+    int workers = (int)test_arg_long(argc, argv, "--workers", 2);
+    long packets = test_arg_long(argc, argv, "--packets", 2000);
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 37);
+    const char *vectors = test_arg_str(argc, argv, "--vectors");
+    stream_io_backend_t backends[2] = { STREAM_IO_EPOLL, STREAM_IO_URING };
+    static fp_session_t fp[MAX_FP_SESSIONS];
+    int fp_count = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (senders < 1 || senders > MAX_SENDERS || workers < 1 || workers > SESSION_MANAGER_MAX_WORKERS ||
+        senders > workers * SESSION_MANAGER_SESSIONS_PER_WORKER) {
+        fprintf(stderr, "--senders 1-%d, --workers 1-%d\n", MAX_SENDERS, SESSION_MANAGER_MAX_WORKERS);
+        return 2;
+    }
+    if (vectors) {
+        fp_count = load_fp_sessions(vectors, fp, MAX_FP_SESSIONS);
+        CHECK(fp_count > 1);
+        if (fp_count < 0) {
+            return test_failures();
+        }
+    }
+
+    stream_io_t *probe = stream_io_init(STREAM_IO_URING, 0, 0);
+    int have_uring = probe != NULL;
+    stream_io_destroy(probe);
+
+    printf("session manager: %d senders, %d workers, %ld video packets each\n", senders, workers, packets);
+    for (int b = 0; b < 1 + have_uring; b++) {
+        test_isolation(backends[b], senders, workers, fp, fp_count);
+        test_connections(backends[b]);
+        test_load(backends[b], senders, workers, packets, seed);
+    }
+    return test_failures();
+}
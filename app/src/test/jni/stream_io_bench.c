@@ -0,0 +1,370 @@
+/**
+ * Stream receive backends: correctness checks and CPU-per-GB benchmark.
+ *
+ * For each available backend (epoll, io_uring) this streams synthetic mirror
+ * packets (128-byte header + payload) over loopback TCP on several connections
+ * at once, reassembles them with mirror_framer straight off the completion
+ * callbacks and checks every payload, then checks close-from-callback and
+ * stop-from-another-thread. The benchmark pushes a fixed volume over one
+ * connection and reports receiver CPU (user + system, including io_uring
+ * workers) per GB and syscalls per MB, against a blocking recv() thread like
+ * VideoStreamReceiver's.
+ *
+ *   stream_io_bench [--mb N] [--buffer-kb N] [--seed S]
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "mirror_framer.h"
+#include "stream_io.h"
+#include "test_util.h"
+
+#define KB 1024
+#define MB (1024 * 1024)
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t process_cpu_ns(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000ull +
+           ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000ull;
+}
+
+// Connected loopback TCP pair: fds[0] receives, fds[1] sends
+static int tcp_pair(int fds[2]) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &len) < 0) {
+        close(lfd);
+        return -1;
+    }
+    fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fds[1], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(lfd);
+        close(fds[1]);
+        return -1;
+    }
+    fds[0] = accept(lfd, NULL, NULL);
+    close(lfd);
+    return fds[0] < 0 ? -1 : 0;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// ---- Mirror packets over several connections ----
+
+typedef struct {
+    int fd;
+    int packets;
+    uint64_t seed;
+    uint64_t checksum;
+} mirror_sender_t;
+
+static uint64_t fnv1a(uint64_t h, const unsigned char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void *mirror_sender_thread(void *arg) {
+    mirror_sender_t *s = arg;
+    unsigned char *packet = malloc(MIRROR_HEADER_LEN + 600 * KB);
+    s->checksum = 0xcbf29ce484222325ull;
+    for (int p = 0; p < s->packets; p++) {
+        // Mostly small P-frames, an occasional large IDR
+        int len = p % 25 == 0 ? 200 * KB + (int)(test_rand(&s->seed) % (400 * KB))
+                              : 1 + (int)(test_rand(&s->seed) % (24 * KB));
+        memset(packet, 0, MIRROR_HEADER_LEN);
+        packet[0] = len & 0xff;
+        packet[1] = (len >> 8) & 0xff;
+        packet[2] = (len >> 16) & 0xff;
+        packet[4] = p == 0 ? 0x01 : 0x00;
+        test_fill_random(&s->seed, packet + MIRROR_HEADER_LEN, (size_t)len);
+        s->checksum = fnv1a(s->checksum, packet + MIRROR_HEADER_LEN, len);
+        if (write_all(s->fd, packet, MIRROR_HEADER_LEN + (size_t)len) < 0) {
+            break;
+        }
+    }
+    free(packet);
+    close(s->fd);
+    return NULL;
+}
+
+typedef struct {
+    mirror_framer_t framer;
+    uint64_t checksum;
+    int packets;
+    int config_packets;
+    int closed;
+    int close_error;
+} mirror_receiver_t;
+
+static int on_mirror_packet(void *opaque, const unsigned char *header, int type, unsigned char *payload, int len) {
+    mirror_receiver_t *r = opaque;
+    (void)header;
+    // This is where the decryptor and NAL walker run, on the loop thread
+    r->checksum = fnv1a(r->checksum, payload, len);
+    r->packets++;
+    r->config_packets += type == 0x01;
+    return 0;
+}
+
+static int on_mirror_data(void *opaque, const unsigned char *data, int len) {
+    mirror_receiver_t *r = opaque;
+    return mirror_framer_feed(&r->framer, data, len);
+}
+
+static void on_mirror_closed(void *opaque, int error) {
+    mirror_receiver_t *r = opaque;
+    r->closed = 1;
+    r->close_error = error;
+}
+
+#define MIRROR_CONNS 4
+
+static void test_mirror_streams(stream_io_backend_t backend, uint64_t seed) {
+    stream_io_t *io = stream_io_init(backend, 16 * KB, 16);
+    buffer_pool_t *pool = buffer_pool_init(8 * MB);
+    mirror_sender_t senders[MIRROR_CONNS];
+    mirror_receiver_t receivers[MIRROR_CONNS];
+    pthread_t tids[MIRROR_CONNS];
+    stream_io_callbacks_t callbacks = { on_mirror_data, on_mirror_closed };
+
+    CHECK(io != NULL && stream_io_get_backend(io) == backend);
+    for (int c = 0; c < MIRROR_CONNS; c++) {
+        int fds[2];
+        CHECK(tcp_pair(fds) == 0);
+        memset(&receivers[c], 0, sizeof(receivers[c]));
+        receivers[c].checksum = 0xcbf29ce484222325ull;
+        mirror_framer_init(&receivers[c].framer, pool, on_mirror_packet, &receivers[c]);
+        CHECK(stream_io_add(io, fds[0], &callbacks, &receivers[c]) == 0);
+        senders[c].fd = fds[1];
+        senders[c].packets = 150;
+        senders[c].seed = seed + (uint64_t)c;
+        pthread_create(&tids[c], NULL, mirror_sender_thread, &senders[c]);
+    }
+    CHECK(stream_io_run(io) == 0);
+    for (int c = 0; c < MIRROR_CONNS; c++) {
+        pthread_join(tids[c], NULL);
+        CHECK(receivers[c].closed && receivers[c].close_error == 0);
+        CHECK(receivers[c].packets == senders[c].packets && receivers[c].config_packets == 1);
+        CHECK(receivers[c].checksum == senders[c].checksum);
+        mirror_framer_reset(&receivers[c].framer);
+    }
+
+    stream_io_stats_t stats;
+    stream_io_get_stats(io, &stats);
+    CHECK(stats.bytes > 0 && stats.reads > 0);
+    stream_io_destroy(io);
+
+    buffer_pool_stats_t pool_stats;
+    buffer_pool_get_stats(pool, &pool_stats);
+    CHECK(pool_stats.bytes_in_use == 0);
+    buffer_pool_destroy(pool);
+}
+
+// ---- Close from the callback, stop from another thread ----
+
+static int close_after_first(void *opaque, const unsigned char *data, int len) {
+    (void)data;
+    (void)len;
+    (*(int *)opaque)++;
+    return -1;
+}
+
+static int count_data(void *opaque, const unsigned char *data, int len) {
+    (void)data;
+    (*(long *)opaque) += len;
+    return 0;
+}
+
+static void *stop_later(void *arg) {
+    usleep(50 * 1000);
+    stream_io_stop(arg);
+    return NULL;
+}
+
+static void test_close_and_stop(stream_io_backend_t backend) {
+    stream_io_t *io = stream_io_init(backend, 0, 0);
+    stream_io_callbacks_t close_cb = { close_after_first, NULL };
+    stream_io_callbacks_t count_cb = { count_data, NULL };
+    unsigned char buf[1000];
+    int calls = 0;
+    long counted = 0;
+    int a[2];
+    int b[2];
+
+    memset(buf, 0x5a, sizeof(buf));
+    CHECK(tcp_pair(a) == 0 && tcp_pair(b) == 0);
+    CHECK(stream_io_add(io, a[0], &close_cb, &calls) == 0);
+    CHECK(stream_io_add(io, b[0], &count_cb, &counted) == 0);
+    CHECK(write_all(a[1], buf, sizeof(buf)) == 0);
+    CHECK(write_all(b[1], buf, sizeof(buf)) == 0);
+
+    // b stays open, so only stop() ends the loop
+    pthread_t tid;
+    pthread_create(&tid, NULL, stop_later, io);
+    CHECK(stream_io_run(io) == 0);
+    pthread_join(tid, NULL);
+    CHECK(calls == 1);
+    CHECK(counted == (long)sizeof(buf));
+
+    close(a[1]);
+    close(b[1]);
+    stream_io_destroy(io);
+}
+
+// ---- CPU per GB ----
+
+typedef struct {
+    int fd;
+    long long bytes;
+    uint64_t cpu_ns;
+} bulk_sender_t;
+
+static void *bulk_sender_thread(void *arg) {
+    bulk_sender_t *s = arg;
+    unsigned char *buf = malloc(256 * KB);
+    uint64_t start = thread_cpu_ns();
+    memset(buf, 0x3c, 256 * KB);
+    for (long long sent = 0; sent < s->bytes; sent += 256 * KB) {
+        if (write_all(s->fd, buf, 256 * KB) < 0) {
+            break;
+        }
+    }
+    s->cpu_ns = thread_cpu_ns() - start;
+    close(s->fd);
+    free(buf);
+    return NULL;
+}
+
+typedef struct {
+    const char *name;
+    double cpu_ms_per_gb;
+    double syscalls_per_mb;
+    double gb_per_sec;
+    long long bytes;
+} bulk_result_t;
+
+static long long g_bulk_bytes;
+
+static int count_bulk(void *opaque, const unsigned char *data, int len) {
+    (void)opaque;
+    g_bulk_bytes += len + (data[0] == 0x3c ? 0 : 1);
+    return 0;
+}
+
+static bulk_result_t bench_bulk(int backend, long long bytes, int buffer_size) {
+    bulk_result_t r;
+    bulk_sender_t s;
+    pthread_t tid;
+    int fds[2];
+    unsigned long long syscalls = 0;
+
+    memset(&r, 0, sizeof(r));
+    CHECK(tcp_pair(fds) == 0);
+    s.fd = fds[1];
+    s.bytes = bytes;
+    g_bulk_bytes = 0;
+
+    uint64_t cpu_start = process_cpu_ns();
+    uint64_t start = now_ns();
+    pthread_create(&tid, NULL, bulk_sender_thread, &s);
+    if (backend < 0) {
+        // Blocking recv() on a dedicated thread, like VideoStreamReceiver
+        unsigned char *buf = malloc((size_t)buffer_size);
+        r.name = "blocking recv";
+        for (;;) {
+            ssize_t n = recv(fds[0], buf, (size_t)buffer_size, 0);
+            syscalls++;
+            if (n <= 0) {
+                break;
+            }
+            count_bulk(NULL, buf, (int)n);
+        }
+        close(fds[0]);
+        free(buf);
+    } else {
+        stream_io_t *io = stream_io_init((stream_io_backend_t)backend, buffer_size, 64);
+        stream_io_callbacks_t callbacks = { count_bulk, NULL };
+        stream_io_stats_t stats;
+        r.name = stream_io_backend_name((stream_io_backend_t)backend);
+        stream_io_add(io, fds[0], &callbacks, NULL);
+        stream_io_run(io);
+        stream_io_get_stats(io, &stats);
+        syscalls = stats.syscalls;
+        stream_io_destroy(io);
+    }
+    uint64_t elapsed = now_ns() - start;
+    pthread_join(tid, NULL);
+    uint64_t cpu = process_cpu_ns() - cpu_start - s.cpu_ns;
+
+    r.bytes = g_bulk_bytes;
+    r.cpu_ms_per_gb = (double)cpu / 1e6 / ((double)g_bulk_bytes / (1024.0 * MB));
+    r.syscalls_per_mb = (double)syscalls / ((double)g_bulk_bytes / MB);
+    r.gb_per_sec = (double)g_bulk_bytes / (1024.0 * MB) / ((double)elapsed / 1e9);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    long mb = test_arg_long(argc, argv, "--mb", 1024);
+    int buffer_size = (int)test_arg_long(argc, argv, "--buffer-kb", 64) * KB;
+    uint64_t seed = (uint64_t)test_arg_long(argc, argv, "--seed", 36);
+    stream_io_backend_t backends[2] = { STREAM_IO_EPOLL, STREAM_IO_URING };
+    int have_uring = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    stream_io_t *probe = stream_io_init(STREAM_IO_URING, 0, 0);
+    have_uring = probe != NULL;
+    stream_io_destroy(probe);
+    probe = stream_io_init(STREAM_IO_AUTO, 0, 0);
+    CHECK(probe != NULL && stream_io_get_backend(probe) == (have_uring ? STREAM_IO_URING : STREAM_IO_EPOLL));
+    stream_io_destroy(probe);
+    if (!have_uring) {
+        printf("io_uring unavailable here; checking the epoll backend only\n");
+    }
+
+    for (int b = 0; b < 1 + have_uring; b++) {
+        test_mirror_streams(backends[b], seed);
+        test_close_and_stop(backends[b]);
+    }
+
+    printf("stream io: %ld MB over loopback TCP, %d KB buffers, receiver CPU per GB\n", mb, buffer_size / KB);
+    for (int b = -1; b < 1 + have_uring; b++) {
+        bulk_result_t r = bench_bulk(b < 0 ? -1 : (int)backends[b], (long long)mb * MB, buffer_size);
+        CHECK(r.bytes == (long long)mb * MB);
+        printf("  %-14s %7.0f ms CPU/GB, %7.1f syscalls/MB, %.2f GB/s\n",
+               r.name, r.cpu_ms_per_gb, r.syscalls_per_mb, r.gb_per_sec);
+    }
+    return test_failures();
+}
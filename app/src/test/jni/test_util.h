@@ -0,0 +1,118 @@
+/**
+ * Shared helpers for the host-only native tests and benchmarks.
+ *
+ * Tests report failures through CHECK() and return test_failures() from main()
+ * so ctest sees a non-zero exit status.
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int g_test_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_test_failures++; \
+        } \
+    } while (0)
+
+static inline int test_failures(void) {
+    if (g_test_failures) {
+        fprintf(stderr, "%d check(s) failed\n", g_test_failures);
+    }
+    return g_test_failures ? 1 : 0;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64* - deterministic so a failing seed can be replayed with --seed
+static inline uint64_t test_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static inline void test_fill_random(uint64_t *state, unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (unsigned char)(test_rand(state) >> 56);
+    }
+}
+
+// Parses "--name value" integer options; leaves the default when absent
+static inline long test_arg_long(int argc, char **argv, const char *name, long def) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return strtol(argv[i + 1], NULL, 0);
+        }
+    }
+    return def;
+}
+
+// Parses "--name value" string options; returns NULL when absent
+static inline const char *test_arg_str(int argc, char **argv, const char *name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return NULL;
+}
+
+static inline int test_arg_flag(int argc, char **argv, const char *name) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Decodes exactly len bytes of hex; returns 0 on success, -1 on bad or short input
+static inline int test_hex_decode(const char *hex, unsigned char *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned int byte;
+        if (!hex[0] || !hex[1] || sscanf(hex, "%2x", &byte) != 1) {
+            return -1;
+        }
+        out[i] = (unsigned char)byte;
+        hex += 2;
+    }
+    return (*hex == '\0' || *hex == ' ' || *hex == '\n' || *hex == '\r') ? 0 : -1;
+}
+
+static inline void test_hex_write(FILE *f, const unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        fprintf(f, "%02x", buf[i]);
+    }
+}
+
+// Sorts samples in place and returns the value at percentile p (0-100)
+static inline int test_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static inline uint64_t test_percentile(uint64_t *samples, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    qsort(samples, n, sizeof(*samples), test_cmp_u64);
+    size_t idx = (size_t)(p / 100.0 * (double)(n - 1) + 0.5);
+    return samples[idx < n ? idx : n - 1];
+}
+
+#endif // TEST_UTIL_H